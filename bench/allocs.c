@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+/*
+ * Count the allocations done by a few hot operations, with and without
+ * the per-thread scratch buffers (see src/scratch.h).
+ *
+ * usage: libgit2_bench_allocs <repository> [iterations]
+ *
+ * Allocations are counted through the library's allocation statistics
+ * (see git2/alloc.h), summed over every subsystem.
+ */
+
+#include "common.h"
+#include "scratch.h"
+#include "vector.h"
+#include "git2.h"
+#include "git2/odb_backend.h"
+
+typedef int (*bench_fn)(git_repository *repo, void *payload);
+
+static void check(int error, const char *what)
+{
+	const git_error *err;
+
+	if (error >= 0)
+		return;
+
+	err = giterr_last();
+	fprintf(stderr, "%s failed: %s\n", what, err ? err->message : "unknown error");
+	exit(1);
+}
+
+static int status_noop_cb(const char *path, unsigned int flags, void *payload)
+{
+	GIT_UNUSED(path);
+	GIT_UNUSED(flags);
+	GIT_UNUSED(payload);
+	return 0;
+}
+
+static int bench_status(git_repository *repo, void *payload)
+{
+	GIT_UNUSED(payload);
+	return git_status_foreach(repo, status_noop_cb, NULL);
+}
+
+static int bench_ref_lookup(git_repository *repo, void *payload)
+{
+	git_strarray *names = payload;
+	git_reference *ref;
+	size_t i;
+
+	for (i = 0; i < names->count; ++i) {
+		if (git_reference_lookup(&ref, repo, names->strings[i]) < 0)
+			return -1;
+		git_reference_free(ref);
+	}
+
+	return 0;
+}
+
+struct loose_objects {
+	git_odb_backend *backend;
+	git_vector oids;
+};
+
+static int collect_loose_cb(git_oid *oid, void *payload)
+{
+	struct loose_objects *loose = payload;
+	git_oid *copy = git__malloc(sizeof(git_oid));
+
+	if (!copy)
+		return -1;
+
+	git_oid_cpy(copy, oid);
+	return git_vector_insert(&loose->oids, copy);
+}
+
+static int bench_loose_read(git_repository *repo, void *payload)
+{
+	struct loose_objects *loose = payload;
+	git_oid *oid;
+	git_otype type;
+	size_t len;
+	void *data;
+	unsigned int i;
+
+	GIT_UNUSED(repo);
+
+	git_vector_foreach(&loose->oids, i, oid) {
+		if (loose->backend->read(&data, &len, &type, loose->backend, oid) < 0)
+			return -1;
+		git__free(data);
+	}
+
+	return 0;
+}
+
+static size_t total_allocations(void)
+{
+	git_alloc_stats stats;
+	size_t total = 0;
+	int i;
+
+	for (i = 0; i < GIT_ALLOC__SUBSYSTEMS; ++i) {
+		check(git_alloc_stats_get(&stats, (git_alloc_subsystem_t)i), "reading statistics");
+		total += stats.allocations;
+	}
+
+	return total;
+}
+
+static void run(
+	const char *name,
+	bench_fn fn,
+	git_repository *repo,
+	void *payload,
+	int iterations)
+{
+	size_t counts[2];
+	int enabled, i;
+
+	for (enabled = 0; enabled <= 1; ++enabled) {
+		git_scratch__set_enabled(enabled);
+
+		/* warm up caches (and the scratch stack) */
+		check(fn(repo, payload), name);
+
+		git_alloc_stats_reset();
+
+		for (i = 0; i < iterations; ++i)
+			check(fn(repo, payload), name);
+
+		counts[enabled] = total_allocations();
+	}
+
+	printf("%-12s %12.1f %12.1f   allocations/iteration\n", name,
+		(double)counts[0] / iterations, (double)counts[1] / iterations);
+}
+
+int main(int argc, char **argv)
+{
+	git_repository *repo;
+	git_strarray names;
+	git_buf objects_dir = GIT_BUF_INIT;
+	struct loose_objects loose;
+	git_oid *oid;
+	unsigned int i;
+	int iterations = 100;
+
+	if (argc < 2 || argc > 3) {
+		fprintf(stderr, "usage: %s <repository> [iterations]\n", argv[0]);
+		return 1;
+	}
+
+	if (argc == 3 && (iterations = atoi(argv[2])) <= 0)
+		iterations = 100;
+
+	git_threads_init();
+	git_alloc_stats_enable(1);
+
+	check(git_repository_open(&repo, argv[1]), "opening the repository");
+
+	printf("%-12s %12s %12s\n", "", "no scratch", "scratch");
+
+	if (!git_repository_is_bare(repo))
+		run("status", bench_status, repo, NULL, iterations);
+
+	check(git_reference_list(&names, repo, GIT_REF_LISTALL), "listing references");
+	run("ref lookup", bench_ref_lookup, repo, &names, iterations);
+	git_strarray_free(&names);
+
+	check(git_buf_joinpath(&objects_dir, git_repository_path(repo), "objects"),
+		"building the objects path");
+	check(git_odb_backend_loose(&loose.backend, objects_dir.ptr, -1, 0),
+		"opening the loose backend");
+	check(git_vector_init(&loose.oids, 0, NULL), "allocating");
+	check(loose.backend->foreach(loose.backend, collect_loose_cb, &loose),
+		"listing loose objects");
+	run("loose read", bench_loose_read, repo, &loose, iterations);
+
+	git_vector_foreach(&loose.oids, i, oid)
+		git__free(oid);
+	git_vector_free(&loose.oids);
+	loose.backend->free(loose.backend);
+	git_buf_free(&objects_dir);
+
+	git_repository_free(repo);
+	git_threads_shutdown();
+
+	return 0;
+}
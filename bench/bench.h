@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_bench_h__
+#define INCLUDE_bench_h__
+
+#include "common.h"
+#include "git2.h"
+
+/*
+ * Shape of the synthetic repository built by `bench_generate`.
+ *
+ * The first commit holds a tree `depth` levels deep where every tree
+ * has `width` files and `fanout` subdirectories; each following commit
+ * rewrites a few lines in `changes` randomly chosen files.  `packed` is
+ * the percentage of the (oldest) history moved into a packfile, the
+ * rest stays loose.  The same options and `seed` always produce the
+ * same objects.
+ */
+typedef struct {
+	unsigned int commits;
+	unsigned int width;
+	unsigned int depth;
+	unsigned int fanout;
+	unsigned int blob_size;
+	unsigned int changes;
+	unsigned int packed;
+	unsigned int refs;
+	uint32_t seed;
+} bench_repo_opts;
+
+#define BENCH_REPO_OPTS_INIT { 200, 16, 3, 4, 2048, 8, 80, 50, 1 }
+
+extern int bench_generate(const char *path, const bench_repo_opts *opts);
+
+/*
+ * A benchmark: `setup` and `cleanup` run once, outside of the timed
+ * region; `run` is timed once per iteration and reports in `ops` the
+ * number of operations (objects, commits, files...) it did.
+ */
+typedef struct {
+	const char *name;
+	int (*setup)(void **state, git_repository *repo);
+	int (*run)(size_t *ops, git_repository *repo, void *state);
+	void (*cleanup)(void *state);
+} bench_def;
+
+extern const bench_def bench_defs[];
+
+extern uint64_t bench_now(void);
+
+#endif
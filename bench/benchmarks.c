@@ -0,0 +1,761 @@
+/*
+ * Copyright (C) 2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "bench.h"
+#include "buffer.h"
+#include "fileops.h"
+#include "odb.h"
+#include "oidmap.h"
+#include "strmap.h"
+#include "vector.h"
+
+GIT__USE_OIDMAP;
+GIT__USE_STRMAP;
+
+/* How many first-parent commits the diff and checkout benchmarks use */
+#define BENCH_HISTORY 100
+
+typedef struct {
+	git_vector oids;
+	git_vector objects;
+	git_vector paths;
+	git_buf path;
+	git_buf pack;
+	size_t count;
+} bench_state;
+
+static int state_new(void **out)
+{
+	bench_state *st = git__calloc(1, sizeof(bench_state));
+	GITERR_CHECK_ALLOC(st);
+
+	if (git_vector_init(&st->oids, 0, NULL) < 0 ||
+		git_vector_init(&st->objects, 0, NULL) < 0 ||
+		git_vector_init(&st->paths, 0, NULL) < 0)
+		return -1;
+
+	*out = st;
+	return 0;
+}
+
+static void state_free(void *payload)
+{
+	bench_state *st = payload;
+	git_object *obj;
+	git_oid *oid;
+	char *path;
+	unsigned int i;
+
+	if (!st)
+		return;
+
+	git_vector_foreach(&st->oids, i, oid)
+		git__free(oid);
+	git_vector_foreach(&st->objects, i, obj)
+		git_object_free(obj);
+	git_vector_foreach(&st->paths, i, path)
+		git__free(path);
+
+	git_vector_free(&st->oids);
+	git_vector_free(&st->objects);
+	git_vector_free(&st->paths);
+	git_buf_free(&st->path);
+	git_buf_free(&st->pack);
+	git__free(st);
+}
+
+static int push_oid(bench_state *st, const git_oid *oid)
+{
+	git_oid *copy = git__malloc(sizeof(git_oid));
+	GITERR_CHECK_ALLOC(copy);
+
+	git_oid_cpy(copy, oid);
+	return git_vector_insert(&st->oids, copy);
+}
+
+static int collect_oid_cb(git_oid *oid, void *payload)
+{
+	return push_oid(payload, oid);
+}
+
+/* Collect the trees of the last `BENCH_HISTORY` first-parent commits */
+static int collect_history_trees(bench_state *st, git_repository *repo)
+{
+	git_commit *commit = NULL, *parent;
+	git_tree *tree;
+	int error;
+
+	if ((error = git_revparse_single(
+			(git_object **)&commit, repo, "HEAD^{commit}")) < 0)
+		return error;
+
+	while (st->objects.length < BENCH_HISTORY) {
+		if ((error = git_commit_tree(&tree, commit)) < 0 ||
+			(error = git_vector_insert(&st->objects, tree)) < 0)
+			break;
+
+		if (!git_commit_parentcount(commit))
+			break;
+
+		if ((error = git_commit_parent(&parent, commit, 0)) < 0)
+			break;
+
+		git_commit_free(commit);
+		commit = parent;
+	}
+
+	git_commit_free(commit);
+	return error;
+}
+
+/* object lookup: read every object through a freshly opened odb */
+
+static int odb_setup(void **out, git_repository *repo)
+{
+	bench_state *st;
+	git_odb *odb;
+	int error;
+
+	if (state_new(out) < 0)
+		return -1;
+	st = *out;
+
+	if ((error = git_repository_odb(&odb, repo)) < 0)
+		return error;
+
+	error = git_odb_foreach(odb, collect_oid_cb, st);
+	git_odb_free(odb);
+
+	if (!error)
+		error = git_buf_joinpath(&st->path, git_repository_path(repo), "objects");
+
+	return error;
+}
+
+static int odb_run(size_t *ops, git_repository *repo, void *payload)
+{
+	bench_state *st = payload;
+	git_odb *odb;
+	git_odb_object *obj;
+	git_oid *oid;
+	unsigned int i;
+	int error = 0;
+
+	GIT_UNUSED(repo);
+
+	if (git_odb_open(&odb, st->path.ptr) < 0)
+		return -1;
+
+	git_vector_foreach(&st->oids, i, oid) {
+		if ((error = git_odb_read(&obj, odb, oid)) < 0)
+			break;
+		git_odb_object_free(obj);
+	}
+
+	git_odb_free(odb);
+	*ops = st->oids.length;
+	return error;
+}
+
+/* oidmap: insert every object id in a new map, then look each one up */
+
+static int oidmap_run(size_t *ops, git_repository *repo, void *payload)
+{
+	bench_state *st = payload;
+	git_oidmap *map;
+	git_oid *oid;
+	unsigned int i;
+	int error = 0;
+
+	GIT_UNUSED(repo);
+
+	map = git_oidmap_alloc();
+	GITERR_CHECK_ALLOC(map);
+
+	git_vector_foreach(&st->oids, i, oid) {
+		git_oidmap_insert(map, oid, oid, error);
+		if (error < 0)
+			goto cleanup;
+	}
+
+	git_vector_foreach(&st->oids, i, oid) {
+		if (!git_oidmap_exists(map, oid)) {
+			giterr_set(GITERR_INVALID, "object id missing from the map");
+			error = -1;
+			goto cleanup;
+		}
+	}
+
+	error = 0;
+
+cleanup:
+	git_oidmap_free(map);
+	*ops = st->oids.length * 2;
+	return error;
+}
+
+/* strmap: the same with every path of the index */
+
+static int paths_setup(void **out, git_repository *repo)
+{
+	bench_state *st;
+	git_index *index;
+	char *path;
+	size_t i;
+	int error;
+
+	if (state_new(out) < 0)
+		return -1;
+	st = *out;
+
+	if ((error = git_repository_index(&index, repo)) < 0)
+		return error;
+
+	for (i = 0; i < git_index_entrycount(index); ++i) {
+		path = git__strdup(git_index_get_byindex(index, i)->path);
+
+		if (!path || (error = git_vector_insert(&st->paths, path)) < 0) {
+			git__free(path);
+			error = -1;
+			break;
+		}
+	}
+
+	git_index_free(index);
+	return error;
+}
+
+static int strmap_run(size_t *ops, git_repository *repo, void *payload)
+{
+	bench_state *st = payload;
+	git_strmap *map;
+	char *path;
+	unsigned int i;
+	int error = 0;
+
+	GIT_UNUSED(repo);
+
+	map = git_strmap_alloc();
+	GITERR_CHECK_ALLOC(map);
+
+	git_vector_foreach(&st->paths, i, path) {
+		git_strmap_insert(map, path, path, error);
+		if (error < 0)
+			goto cleanup;
+	}
+
+	git_vector_foreach(&st->paths, i, path) {
+		if (!git_strmap_exists(map, path)) {
+			giterr_set(GITERR_INVALID, "path missing from the map");
+			error = -1;
+			goto cleanup;
+		}
+	}
+
+	error = 0;
+
+cleanup:
+	git_strmap_free(map);
+	*ops = st->paths.length * 2;
+	return error;
+}
+
+/* revwalk: topological walk of every branch and tag */
+
+static int revwalk_run(size_t *ops, git_repository *repo, void *payload)
+{
+	git_revwalk *walk;
+	git_oid oid;
+	size_t count = 0;
+	int error;
+
+	GIT_UNUSED(payload);
+
+	if ((error = git_revwalk_new(&walk, repo)) < 0)
+		return error;
+
+	git_revwalk_sorting(walk, GIT_SORT_TOPOLOGICAL | GIT_SORT_TIME);
+
+	if ((error = git_revwalk_push_head(walk)) < 0 ||
+		(error = git_revwalk_push_glob(walk, "heads")) < 0 ||
+		(error = git_revwalk_push_glob(walk, "tags")) < 0)
+		goto cleanup;
+
+	while ((error = git_revwalk_next(&oid, walk)) == 0)
+		count++;
+
+	if (error == GIT_ITEROVER)
+		error = 0;
+
+cleanup:
+	git_revwalk_free(walk);
+	*ops = count;
+	return error;
+}
+
+/* tree diff: diff each recent commit against its first parent */
+
+static int history_setup(void **out, git_repository *repo)
+{
+	if (state_new(out) < 0)
+		return -1;
+
+	return collect_history_trees(*out, repo);
+}
+
+static int tree_diff_run(size_t *ops, git_repository *repo, void *payload)
+{
+	bench_state *st = payload;
+	git_diff_list *diff;
+	unsigned int i;
+	int error = 0;
+
+	*ops = 0;
+
+	for (i = 1; i < st->objects.length; ++i) {
+		if ((error = git_diff_tree_to_tree(&diff, repo,
+				git_vector_get(&st->objects, i),
+				git_vector_get(&st->objects, i - 1), NULL)) < 0)
+			break;
+
+		git_diff_list_free(diff);
+		(*ops)++;
+	}
+
+	return error;
+}
+
+/* grep: search the head tree for a regex with a literal part */
+
+static int grep_cb(const git_grep_match *match, void *payload)
+{
+	GIT_UNUSED(match);
+	(*(size_t *)payload)++;
+	return 0;
+}
+
+static int grep_run(size_t *ops, git_repository *repo, void *payload)
+{
+	bench_state *st = payload;
+
+	GIT_UNUSED(repo);
+
+	*ops = 0;
+	return git_grep_tree(git_vector_get(&st->objects, 0),
+		"kilo li.a", NULL, grep_cb, ops);
+}
+
+/* blame: the top-level file which changed most often in the history */
+
+static int blame_setup(void **out, git_repository *repo)
+{
+	bench_state *st;
+	const git_tree_entry *entry, *older;
+	size_t i, j, changes, most = 0;
+	int error;
+
+	if ((error = history_setup(out, repo)) < 0)
+		return error;
+	st = *out;
+
+	for (i = 0; i < git_tree_entrycount(git_vector_get(&st->objects, 0)); ++i) {
+		entry = git_tree_entry_byindex(git_vector_get(&st->objects, 0), i);
+		if (git_tree_entry_type(entry) != GIT_OBJ_BLOB)
+			continue;
+
+		for (j = 1, changes = 0; j < st->objects.length; ++j, entry = older) {
+			older = git_tree_entry_byname(
+				git_vector_get(&st->objects, j), git_tree_entry_name(entry));
+			if (!older)
+				break;
+			if (git_oid_cmp(git_tree_entry_id(entry), git_tree_entry_id(older)))
+				changes++;
+		}
+
+		if (changes >= most) {
+			most = changes;
+			git_buf_sets(&st->path, git_tree_entry_name(entry));
+		}
+	}
+
+	return git_buf_oom(&st->path) ? -1 : 0;
+}
+
+static int blame_run(size_t *ops, git_repository *repo, void *payload)
+{
+	bench_state *st = payload;
+	git_blame *blame;
+	size_t i;
+	int error;
+
+	if ((error = git_blame_file(&blame, repo, st->path.ptr, NULL)) < 0)
+		return error;
+
+	*ops = 0;
+	for (i = 0; i < git_blame_get_hunk_count(blame); ++i)
+		*ops += git_blame_get_hunk_byindex(blame, i)->lines_in_hunk;
+
+	git_blame_free(blame);
+	return 0;
+}
+
+/* last commits: the last commit of each entry of the root directory */
+
+static int last_commit_cb(
+	const git_tree_entry *entry, const git_oid *commit_id, void *payload)
+{
+	GIT_UNUSED(entry);
+	GIT_UNUSED(commit_id);
+	(*(size_t *)payload)++;
+	return 0;
+}
+
+static int last_commits_run(size_t *ops, git_repository *repo, void *payload)
+{
+	git_oid head;
+	int error;
+
+	GIT_UNUSED(payload);
+
+	if ((error = git_reference_name_to_oid(&head, repo, "HEAD")) < 0)
+		return error;
+
+	*ops = 0;
+	return git_last_commit_foreach(repo, &head, NULL, last_commit_cb, ops);
+}
+
+/* apply: apply the printed diff of each recent commit to its parent */
+
+static int apply_print_cb(
+	void *payload, const git_diff_delta *delta, const git_diff_range *range,
+	char line_origin, const char *content, size_t content_len)
+{
+	GIT_UNUSED(delta);
+	GIT_UNUSED(range);
+	GIT_UNUSED(line_origin);
+
+	return git_buf_put(payload, content, content_len);
+}
+
+static int apply_setup(void **out, git_repository *repo)
+{
+	bench_state *st;
+	git_diff_list *diff;
+	git_buf patch = GIT_BUF_INIT;
+	git_oid id;
+	char *text;
+	unsigned int i;
+	int error;
+
+	if ((error = history_setup(out, repo)) < 0)
+		return error;
+	st = *out;
+
+	for (i = 1; i < st->objects.length; ++i) {
+		git_buf_clear(&patch);
+
+		if ((error = git_diff_tree_to_tree(&diff, repo,
+				git_vector_get(&st->objects, i),
+				git_vector_get(&st->objects, i - 1), NULL)) < 0)
+			break;
+
+		error = git_diff_print_patch(diff, &patch, apply_print_cb);
+		git_diff_list_free(diff);
+		if (error < 0)
+			break;
+
+		/* binary changes do not apply: keep a hole for them */
+		text = NULL;
+		if (git_apply_to_tree(&id, repo, git_vector_get(&st->objects, i),
+				patch.ptr, patch.size, NULL) == 0)
+			text = git_buf_detach(&patch);
+		else
+			giterr_clear();
+
+		if ((error = git_vector_insert(&st->paths, text)) < 0)
+			break;
+	}
+
+	git_buf_free(&patch);
+	return error;
+}
+
+static int apply_run(size_t *ops, git_repository *repo, void *payload)
+{
+	bench_state *st = payload;
+	const char *patch;
+	git_oid id;
+	unsigned int i;
+	int error;
+
+	*ops = 0;
+
+	git_vector_foreach(&st->paths, i, patch) {
+		if (!patch)
+			continue;
+
+		if ((error = git_apply_to_tree(&id, repo,
+				git_vector_get(&st->objects, i + 1),
+				patch, strlen(patch), NULL)) < 0)
+			return error;
+
+		(*ops)++;
+	}
+
+	return 0;
+}
+
+/* status of the (clean) working directory */
+
+static int status_cb(const char *path, unsigned int flags, void *payload)
+{
+	GIT_UNUSED(path);
+	GIT_UNUSED(flags);
+	(*(size_t *)payload)++;
+	return 0;
+}
+
+static int status_run(size_t *ops, git_repository *repo, void *payload)
+{
+	size_t changed = 0;
+
+	GIT_UNUSED(payload);
+
+	*ops = 1;
+	return git_status_foreach(repo, status_cb, &changed);
+}
+
+/* index read and write */
+
+static int index_setup(void **out, git_repository *repo)
+{
+	bench_state *st;
+
+	if (state_new(out) < 0)
+		return -1;
+	st = *out;
+
+	return git_buf_joinpath(&st->path, git_repository_path(repo), "index");
+}
+
+static int index_read_run(size_t *ops, git_repository *repo, void *payload)
+{
+	bench_state *st = payload;
+	git_index *index;
+
+	GIT_UNUSED(repo);
+
+	if (git_index_open(&index, st->path.ptr) < 0)
+		return -1;
+
+	*ops = git_index_entrycount(index);
+	git_index_free(index);
+	return 0;
+}
+
+static int index_write_run(size_t *ops, git_repository *repo, void *payload)
+{
+	git_index *index;
+	int error;
+
+	GIT_UNUSED(payload);
+
+	if ((error = git_repository_index(&index, repo)) < 0)
+		return error;
+
+	*ops = git_index_entrycount(index);
+	error = git_index_write(index);
+
+	git_index_free(index);
+	return error;
+}
+
+/* checkout: go back and forth between HEAD and an older commit */
+
+static int checkout_tree(git_repository *repo, git_tree *tree)
+{
+	git_checkout_opts opts = {0};
+
+	opts.checkout_strategy = GIT_CHECKOUT_FORCE | GIT_CHECKOUT_REMOVE_UNTRACKED;
+	return git_checkout_tree(repo, (git_object *)tree, &opts);
+}
+
+static int checkout_run(size_t *ops, git_repository *repo, void *payload)
+{
+	bench_state *st = payload;
+	size_t last = st->objects.length - 1;
+	int error;
+
+	*ops = 2;
+
+	if ((error = checkout_tree(repo, git_vector_get(&st->objects, last))) < 0)
+		return error;
+
+	return checkout_tree(repo, git_vector_get(&st->objects, 0));
+}
+
+/* packbuilder: pack the recent history and stream it to memory */
+
+static int pack_sink_cb(void *buf, size_t size, void *payload)
+{
+	GIT_UNUSED(buf);
+	*(size_t *)payload += size;
+	return 0;
+}
+
+static int build_pack(
+	git_repository *repo,
+	bench_state *st,
+	int (*cb)(void *buf, size_t size, void *payload),
+	void *payload)
+{
+	git_packbuilder *pb;
+	git_oid *oid;
+	git_object *tree;
+	unsigned int i;
+	int error;
+
+	if ((error = git_packbuilder_new(&pb, repo)) < 0)
+		return error;
+
+	git_vector_foreach(&st->oids, i, oid) {
+		if ((error = git_packbuilder_insert(pb, oid, NULL)) < 0)
+			goto cleanup;
+	}
+
+	git_vector_foreach(&st->objects, i, tree) {
+		if ((error = git_packbuilder_insert_tree(pb, git_object_id(tree))) < 0)
+			goto cleanup;
+	}
+
+	st->count = git_packbuilder_object_count(pb);
+	error = git_packbuilder_foreach(pb, cb, payload);
+
+cleanup:
+	git_packbuilder_free(pb);
+	return error;
+}
+
+static int pack_setup(void **out, git_repository *repo)
+{
+	bench_state *st;
+	git_revwalk *walk;
+	git_oid oid;
+	int error;
+
+	if ((error = history_setup(out, repo)) < 0)
+		return error;
+	st = *out;
+
+	if ((error = git_revwalk_new(&walk, repo)) < 0)
+		return error;
+
+	git_revwalk_sorting(walk, GIT_SORT_TOPOLOGICAL);
+
+	if (!(error = git_revwalk_push_head(walk))) {
+		while (st->oids.length < BENCH_HISTORY &&
+			!(error = git_revwalk_next(&oid, walk)))
+			error = push_oid(st, &oid);
+	}
+
+	git_revwalk_free(walk);
+	return (error == GIT_ITEROVER) ? 0 : error;
+}
+
+static int packbuilder_run(size_t *ops, git_repository *repo, void *payload)
+{
+	bench_state *st = payload;
+	size_t written = 0;
+	int error;
+
+	error = build_pack(repo, st, pack_sink_cb, &written);
+	*ops = st->count;
+	return error;
+}
+
+/* indexer: index a pack of the recent history from memory */
+
+static int pack_buf_cb(void *buf, size_t size, void *payload)
+{
+	return git_buf_put(payload, buf, size);
+}
+
+static int indexer_setup(void **out, git_repository *repo)
+{
+	bench_state *st;
+	int error;
+
+	if ((error = pack_setup(out, repo)) < 0)
+		return error;
+	st = *out;
+
+	if ((error = build_pack(repo, st, pack_buf_cb, &st->pack)) < 0 ||
+		(error = git_buf_joinpath(&st->path,
+			git_repository_path(repo), "bench-indexer")) < 0)
+		return error;
+
+	return git_futils_mkdir_r(st->path.ptr, NULL, GIT_OBJECT_DIR_MODE);
+}
+
+static int indexer_run(size_t *ops, git_repository *repo, void *payload)
+{
+	bench_state *st = payload;
+	git_indexer_stream *idx;
+	git_transfer_progress stats = {0};
+	size_t offset, chunk;
+	int error;
+
+	GIT_UNUSED(repo);
+
+	if ((error = git_indexer_stream_new(&idx, st->path.ptr, NULL, NULL, NULL)) < 0)
+		return error;
+
+	/* feed it the way the network would, in 64k chunks */
+	for (offset = 0; offset < st->pack.size; offset += chunk) {
+		chunk = min(st->pack.size - offset, 64 * 1024);
+
+		if ((error = git_indexer_stream_add(idx,
+				st->pack.ptr + offset, chunk, &stats)) < 0)
+			goto cleanup;
+	}
+
+	error = git_indexer_stream_finalize(idx, &stats);
+	*ops = stats.total_objects;
+
+cleanup:
+	git_indexer_stream_free(idx);
+	return error;
+}
+
+static void indexer_cleanup(void *payload)
+{
+	bench_state *st = payload;
+
+	if (st && st->path.size)
+		git_futils_rmdir_r(st->path.ptr, NULL, GIT_RMDIR_REMOVE_FILES);
+
+	state_free(st);
+}
+
+const bench_def bench_defs[] = {
+	{ "object_lookup", odb_setup, odb_run, state_free },
+	{ "oidmap", odb_setup, oidmap_run, state_free },
+	{ "strmap", paths_setup, strmap_run, state_free },
+	{ "revwalk", NULL, revwalk_run, NULL },
+	{ "tree_diff", history_setup, tree_diff_run, state_free },
+	{ "grep", history_setup, grep_run, state_free },
+	{ "blame", blame_setup, blame_run, state_free },
+	{ "last_commits", NULL, last_commits_run, NULL },
+	{ "apply", apply_setup, apply_run, state_free },
+	{ "status", NULL, status_run, NULL },
+	{ "index_read", index_setup, index_read_run, state_free },
+	{ "index_write", NULL, index_write_run, NULL },
+	{ "checkout", history_setup, checkout_run, state_free },
+	{ "packbuilder", pack_setup, packbuilder_run, state_free },
+	{ "indexer", indexer_setup, indexer_run, indexer_cleanup },
+	{ NULL, NULL, NULL, NULL }
+};
@@ -0,0 +1,446 @@
+/*
+ * Copyright (C) 2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+/*
+ * Deterministic synthetic repository generator.
+ *
+ * Everything (paths, contents, which files a commit touches, where the
+ * refs point) derives from `bench_repo_opts.seed`, and commit times are
+ * fixed, so a given set of options always yields the same object ids.
+ */
+
+#include "bench.h"
+#include "buffer.h"
+#include "fileops.h"
+#include "tree.h"
+#include "vector.h"
+#include "git2/odb_backend.h"
+
+typedef struct {
+	char *path;
+	uint32_t seed;
+	uint32_t version;
+	unsigned int touched;
+} bench_file;
+
+static const char *words[] = {
+	"alpha", "bravo", "charlie", "delta", "echo", "foxtrot", "golf",
+	"hotel", "india", "juliet", "kilo", "lima", "mike", "november",
+	"oscar", "papa",
+};
+
+#define WORD_COUNT (sizeof(words) / sizeof(words[0]))
+#define AVERAGE_LINE 48
+
+static uint32_t mix(uint32_t a, uint32_t b)
+{
+	uint32_t h = (a * 0x9E3779B1u) ^ b;
+
+	h ^= h >> 16;
+	h *= 0x85EBCA6Bu;
+	h ^= h >> 13;
+	h *= 0xC2B2AE35u;
+	h ^= h >> 16;
+	return h;
+}
+
+static uint32_t rand_next(uint32_t *state)
+{
+	uint32_t x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return (*state = x);
+}
+
+static int render_blob(
+	git_buf *out, const bench_file *file, const bench_repo_opts *opts)
+{
+	size_t size, lines, i, w, count;
+	uint32_t *line_seed, seed;
+
+	size = opts->blob_size / 2 + mix(file->seed, 0) % (opts->blob_size + 1);
+	lines = size / AVERAGE_LINE + 1;
+
+	line_seed = git__malloc(lines * sizeof(uint32_t));
+	GITERR_CHECK_ALLOC(line_seed);
+
+	for (i = 0; i < lines; ++i)
+		line_seed[i] = mix(file->seed, (uint32_t)i + 1);
+
+	/* each new version rewrites a single line */
+	for (i = 1; i <= file->version; ++i) {
+		size_t line = mix(file->seed ^ 0x5bd1e995u, (uint32_t)i) % lines;
+		line_seed[line] = mix(line_seed[line], (uint32_t)i);
+	}
+
+	git_buf_clear(out);
+
+	for (i = 0; i < lines; ++i) {
+		seed = line_seed[i];
+		count = 4 + seed % 8;
+
+		for (w = 0; w < count; ++w) {
+			seed = mix(seed, (uint32_t)w);
+			git_buf_puts(out, words[seed % WORD_COUNT]);
+			git_buf_putc(out, (w + 1 < count) ? ' ' : '\n');
+		}
+	}
+
+	git__free(line_seed);
+	return git_buf_oom(out) ? -1 : 0;
+}
+
+static int add_files(
+	git_vector *files,
+	git_buf *path,
+	const bench_repo_opts *opts,
+	unsigned int depth,
+	uint32_t *rand)
+{
+	size_t len = path->size;
+	bench_file *file;
+	unsigned int i;
+
+	for (i = 0; i < opts->width; ++i) {
+		if (git_buf_printf(path, "file%03u.txt", i) < 0)
+			return -1;
+
+		file = git__calloc(1, sizeof(bench_file));
+		GITERR_CHECK_ALLOC(file);
+
+		file->path = git_buf_detach(path);
+		file->seed = rand_next(rand);
+
+		if (git_vector_insert(files, file) < 0 ||
+			git_buf_put(path, file->path, len) < 0)
+			return -1;
+	}
+
+	if (depth >= opts->depth)
+		return 0;
+
+	for (i = 0; i < opts->fanout; ++i) {
+		if (git_buf_printf(path, "dir%02u/", i) < 0 ||
+			add_files(files, path, opts, depth + 1, rand) < 0)
+			return -1;
+
+		git_buf_truncate(path, len);
+	}
+
+	return 0;
+}
+
+static int write_commit(
+	git_oid *commit_out,
+	git_oid *tree_out,
+	git_repository *repo,
+	git_tree *baseline,
+	git_commit *parent,
+	git_vector *updates,
+	unsigned int n)
+{
+	git_signature *sig = NULL;
+	git_tree *tree = NULL;
+	char message[64];
+	const git_commit *parents[1];
+	int error;
+
+	parents[0] = parent;
+	p_snprintf(message, sizeof(message), "Synthetic commit %u\n", n);
+
+	if ((error = git_tree__create_updated(tree_out, repo, baseline, updates)) < 0 ||
+		(error = git_tree_lookup(&tree, repo, tree_out)) < 0 ||
+		(error = git_signature_new(&sig, "Bench Author", "bench@example.com",
+			1300000000 + (git_time_t)n * 3600, 0)) < 0)
+		goto cleanup;
+
+	error = git_commit_create(commit_out, repo, NULL, sig, sig, NULL,
+		message, tree, parent ? 1 : 0, parents);
+
+cleanup:
+	git_signature_free(sig);
+	git_tree_free(tree);
+	return error;
+}
+
+static int write_history(
+	git_oid *commits,
+	git_oid *trees,
+	git_repository *repo,
+	git_vector *files,
+	const bench_repo_opts *opts,
+	uint32_t *rand)
+{
+	git_vector updates = GIT_VECTOR_INIT;
+	git_tree_update *update = NULL;
+	git_buf content = GIT_BUF_INIT;
+	git_tree *baseline = NULL;
+	git_commit *parent = NULL;
+	bench_file *file;
+	unsigned int c, k;
+	int error = -1;
+
+	update = git__calloc(files->length, sizeof(git_tree_update));
+	GITERR_CHECK_ALLOC(update);
+
+	for (c = 0; c < opts->commits; ++c) {
+		git_vector_clear(&updates);
+
+		for (k = 0; k < files->length; ++k) {
+			if (c == 0)
+				file = git_vector_get(files, k);
+			else if (k < opts->changes)
+				file = git_vector_get(files, rand_next(rand) % files->length);
+			else
+				break;
+
+			if (c > 0) {
+				if (file->touched == c)
+					continue;
+				file->version++;
+			}
+			file->touched = c;
+
+			update[updates.length].path = file->path;
+			update[updates.length].mode = GIT_FILEMODE_BLOB;
+
+			if ((error = render_blob(&content, file, opts)) < 0 ||
+				(error = git_blob_create_frombuffer(
+					&update[updates.length].oid, repo,
+					content.ptr, content.size)) < 0 ||
+				(error = git_vector_insert(&updates, &update[updates.length])) < 0)
+				goto cleanup;
+		}
+
+		if ((error = write_commit(&commits[c], &trees[c],
+				repo, baseline, parent, &updates, c)) < 0)
+			goto cleanup;
+
+		git_tree_free(baseline);
+		git_commit_free(parent);
+		baseline = NULL;
+		parent = NULL;
+
+		if ((error = git_tree_lookup(&baseline, repo, &trees[c])) < 0 ||
+			(error = git_commit_lookup(&parent, repo, &commits[c])) < 0)
+			goto cleanup;
+	}
+
+	error = 0;
+
+cleanup:
+	git_tree_free(baseline);
+	git_commit_free(parent);
+	git_buf_free(&content);
+	git_vector_free(&updates);
+	git__free(update);
+	return error;
+}
+
+static int write_refs(
+	git_repository *repo,
+	const git_oid *commits,
+	const bench_repo_opts *opts,
+	uint32_t *rand)
+{
+	git_reference *ref;
+	char name[64];
+	unsigned int i;
+
+	if (git_reference_create_oid(&ref, repo, "refs/heads/master",
+			&commits[opts->commits - 1], 1) < 0)
+		return -1;
+	git_reference_free(ref);
+
+	for (i = 0; i < opts->refs; ++i) {
+		p_snprintf(name, sizeof(name), (i % 2) ?
+			"refs/tags/tag%04u" : "refs/heads/branch%04u", i);
+
+		if (git_reference_create_oid(&ref, repo, name,
+				&commits[rand_next(rand) % opts->commits], 1) < 0)
+			return -1;
+		git_reference_free(ref);
+	}
+
+	return 0;
+}
+
+struct index_data {
+	git_indexer_stream *idx;
+	git_transfer_progress stats;
+};
+
+static int index_pack_cb(void *buf, size_t size, void *payload)
+{
+	struct index_data *data = payload;
+	return git_indexer_stream_add(data->idx, buf, size, &data->stats);
+}
+
+static int write_pack(
+	git_repository *repo,
+	const git_oid *commits,
+	const git_oid *trees,
+	unsigned int count)
+{
+	git_packbuilder *pb = NULL;
+	struct index_data data = {0};
+	git_buf pack_dir = GIT_BUF_INIT;
+	unsigned int i;
+	int error;
+
+	if ((error = git_buf_joinpath(&pack_dir,
+			git_repository_path(repo), "objects/pack")) < 0 ||
+		(error = git_packbuilder_new(&pb, repo)) < 0)
+		goto cleanup;
+
+	for (i = 0; i < count; ++i) {
+		if ((error = git_packbuilder_insert(pb, &commits[i], NULL)) < 0 ||
+			(error = git_packbuilder_insert_tree(pb, &trees[i])) < 0)
+			goto cleanup;
+	}
+
+	if ((error = git_indexer_stream_new(&data.idx, pack_dir.ptr, NULL, NULL, NULL)) < 0 ||
+		(error = git_packbuilder_foreach(pb, index_pack_cb, &data)) < 0)
+		goto cleanup;
+
+	error = git_indexer_stream_finalize(data.idx, &data.stats);
+
+cleanup:
+	git_indexer_stream_free(data.idx);
+	git_packbuilder_free(pb);
+	git_buf_free(&pack_dir);
+	return error;
+}
+
+struct prune_data {
+	git_odb_backend *packs;
+	git_vector packed;
+};
+
+static int collect_packed_cb(git_oid *oid, void *payload)
+{
+	struct prune_data *data = payload;
+	git_oid *copy;
+
+	if (!data->packs->exists(data->packs, oid))
+		return 0;
+
+	copy = git__malloc(sizeof(git_oid));
+	GITERR_CHECK_ALLOC(copy);
+
+	git_oid_cpy(copy, oid);
+	return git_vector_insert(&data->packed, copy);
+}
+
+/* Remove the loose copies of the objects which made it into a pack */
+static int prune_packed(const char *repo_path)
+{
+	struct prune_data data;
+	git_odb_backend *loose = NULL;
+	git_buf objects_dir = GIT_BUF_INIT, path = GIT_BUF_INIT;
+	char name[GIT_OID_HEXSZ + 2];
+	git_oid *oid;
+	unsigned int i;
+	int error;
+
+	data.packs = NULL;
+	git_vector_init(&data.packed, 0, NULL);
+
+	if ((error = git_buf_joinpath(&objects_dir, repo_path, "objects")) < 0 ||
+		(error = git_odb_backend_loose(&loose, objects_dir.ptr, -1, 0)) < 0 ||
+		(error = git_odb_backend_pack(&data.packs, objects_dir.ptr)) < 0 ||
+		(error = loose->foreach(loose, collect_packed_cb, &data)) < 0)
+		goto cleanup;
+
+	git_vector_foreach(&data.packed, i, oid) {
+		git_oid_pathfmt(name, oid);
+		name[GIT_OID_HEXSZ + 1] = '\0';
+
+		if ((error = git_buf_joinpath(&path, objects_dir.ptr, name)) < 0)
+			goto cleanup;
+
+		if (p_unlink(path.ptr) < 0) {
+			giterr_set(GITERR_OS, "Failed to remove '%s'", path.ptr);
+			error = -1;
+			goto cleanup;
+		}
+	}
+
+cleanup:
+	git_vector_foreach(&data.packed, i, oid)
+		git__free(oid);
+	git_vector_free(&data.packed);
+	if (data.packs)
+		data.packs->free(data.packs);
+	if (loose)
+		loose->free(loose);
+	git_buf_free(&objects_dir);
+	git_buf_free(&path);
+	return error;
+}
+
+int bench_generate(const char *path, const bench_repo_opts *opts)
+{
+	git_repository *repo = NULL;
+	git_vector files = GIT_VECTOR_INIT;
+	git_buf buf = GIT_BUF_INIT;
+	git_checkout_opts checkout = {0};
+	git_oid *commits = NULL, *trees = NULL;
+	uint32_t rand = opts->seed ? opts->seed : 1;
+	unsigned int packed;
+	bench_file *file;
+	unsigned int i;
+	int error;
+
+	if (!opts->commits || !opts->width) {
+		giterr_set(GITERR_INVALID, "Need at least one commit and one file");
+		return -1;
+	}
+
+	commits = git__calloc(opts->commits, sizeof(git_oid));
+	GITERR_CHECK_ALLOC(commits);
+	trees = git__calloc(opts->commits, sizeof(git_oid));
+	GITERR_CHECK_ALLOC(trees);
+
+	packed = (unsigned int)((uint64_t)opts->commits * opts->packed / 100);
+
+	if ((error = git_repository_init(&repo, path, 0)) < 0 ||
+		(error = add_files(&files, &buf, opts, 0, &rand)) < 0 ||
+		(error = write_history(commits, trees, repo, &files, opts, &rand)) < 0 ||
+		(error = write_refs(repo, commits, opts, &rand)) < 0)
+		goto cleanup;
+
+	if (packed > 0) {
+		if ((error = write_pack(repo, commits, trees, packed)) < 0 ||
+			(error = prune_packed(git_repository_path(repo))) < 0)
+			goto cleanup;
+
+		/* reopen, so the odb sees the pack and forgets the pruned objects */
+		git_repository_free(repo);
+		repo = NULL;
+
+		if ((error = git_repository_open(&repo, path)) < 0)
+			goto cleanup;
+	}
+
+	checkout.checkout_strategy = GIT_CHECKOUT_FORCE;
+	error = git_checkout_head(repo, &checkout);
+
+cleanup:
+	git_vector_foreach(&files, i, file) {
+		git__free(file->path);
+		git__free(file);
+	}
+	git_vector_free(&files);
+	git_buf_free(&buf);
+	git__free(commits);
+	git__free(trees);
+	git_repository_free(repo);
+	return error;
+}
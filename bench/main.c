@@ -0,0 +1,229 @@
+/*
+ * Copyright (C) 2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+/*
+ * usage: libgit2_bench [options] <repository> [benchmark...]
+ *
+ * When <repository> does not exist, a synthetic one is generated there
+ * first (see bench_repo_opts); otherwise it is used as is.  Each
+ * benchmark prints a single JSON object on its own line, so the output
+ * of two runs can be compared with any line-oriented tool.
+ */
+
+#include <time.h>
+#ifndef GIT_WIN32
+# include <sys/time.h>
+#endif
+
+#include "bench.h"
+#include "fileops.h"
+
+static const char *usage =
+	"usage: libgit2_bench [options] <repository> [benchmark...]\n"
+	"\n"
+	"  --iterations=<n>   timed runs of each benchmark (default 10)\n"
+	"  --list             list the benchmarks and exit\n"
+	"\n"
+	"options used when generating <repository>:\n"
+	"  --commits=<n>      number of commits (default 200)\n"
+	"  --width=<n>        files in each tree (default 16)\n"
+	"  --depth=<n>        levels of subdirectories (default 3)\n"
+	"  --fanout=<n>       subdirectories in each tree (default 4)\n"
+	"  --blob-size=<n>    average file size in bytes (default 2048)\n"
+	"  --changes=<n>      files modified by each commit (default 8)\n"
+	"  --packed=<pct>     percentage of the history packed (default 80)\n"
+	"  --refs=<n>         extra branches and tags (default 50)\n"
+	"  --seed=<n>         generator seed (default 1)\n";
+
+uint64_t bench_now(void)
+{
+#if defined(GIT_WIN32)
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER now;
+
+	if (!freq.QuadPart)
+		QueryPerformanceFrequency(&freq);
+
+	QueryPerformanceCounter(&now);
+	return (uint64_t)((double)now.QuadPart * 1e9 / (double)freq.QuadPart);
+#elif defined(CLOCK_MONOTONIC)
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#else
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000000 + (uint64_t)tv.tv_usec * 1000;
+#endif
+}
+
+static void check(int error, const char *what)
+{
+	const git_error *err;
+
+	if (error >= 0)
+		return;
+
+	err = giterr_last();
+	fprintf(stderr, "%s failed: %s\n", what, err ? err->message : "unknown error");
+	exit(1);
+}
+
+static int uint64_cmp(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+static int parse_uint(unsigned int *out, const char *arg, const char *name)
+{
+	size_t len = strlen(name);
+	int32_t value;
+	const char *end;
+
+	if (strncmp(arg, name, len) != 0 || arg[len] != '=')
+		return 0;
+
+	if (git__strtol32(&value, arg + len + 1, &end, 10) < 0 ||
+		*end != '\0' || value < 0) {
+		fprintf(stderr, "invalid value for %s\n", name);
+		exit(1);
+	}
+
+	*out = (unsigned int)value;
+	return 1;
+}
+
+static int selected(const char *name, char **names, int count)
+{
+	int i;
+
+	if (!count)
+		return 1;
+
+	for (i = 0; i < count; ++i)
+		if (!strcmp(name, names[i]))
+			return 1;
+
+	return 0;
+}
+
+static void run(
+	const bench_def *bench, git_repository *repo, unsigned int iterations)
+{
+	uint64_t *times, start, total = 0;
+	void *state = NULL;
+	size_t ops = 0;
+	unsigned int i;
+
+	times = git__calloc(iterations, sizeof(uint64_t));
+	check(times ? 0 : -1, "allocating");
+
+	if (bench->setup)
+		check(bench->setup(&state, repo), bench->name);
+
+	/* warm up the caches and the filesystem */
+	check(bench->run(&ops, repo, state), bench->name);
+
+	for (i = 0; i < iterations; ++i) {
+		start = bench_now();
+		check(bench->run(&ops, repo, state), bench->name);
+		times[i] = bench_now() - start;
+		total += times[i];
+	}
+
+	if (bench->cleanup)
+		bench->cleanup(state);
+
+	qsort(times, iterations, sizeof(uint64_t), uint64_cmp);
+
+	printf("{\"benchmark\":\"%s\",\"iterations\":%u,\"ops\":%lu,"
+		"\"min_ns\":%llu,\"median_ns\":%llu,\"mean_ns\":%llu,\"max_ns\":%llu,"
+		"\"ns_per_op\":%.1f}\n",
+		bench->name, iterations, (unsigned long)ops,
+		(unsigned long long)times[0],
+		(unsigned long long)times[iterations / 2],
+		(unsigned long long)(total / iterations),
+		(unsigned long long)times[iterations - 1],
+		ops ? (double)times[iterations / 2] / ops : 0.0);
+	fflush(stdout);
+
+	git__free(times);
+}
+
+int main(int argc, char **argv)
+{
+	bench_repo_opts opts = BENCH_REPO_OPTS_INIT;
+	git_repository *repo;
+	const bench_def *bench;
+	const char *path = NULL;
+	unsigned int iterations = 10, seed = opts.seed;
+	uint64_t start;
+	int i, list = 0;
+
+	for (i = 1; i < argc && argv[i][0] == '-'; ++i) {
+		const char *arg = argv[i];
+
+		if (!strcmp(arg, "--list"))
+			list = 1;
+		else if (!parse_uint(&iterations, arg, "--iterations") &&
+			!parse_uint(&opts.commits, arg, "--commits") &&
+			!parse_uint(&opts.width, arg, "--width") &&
+			!parse_uint(&opts.depth, arg, "--depth") &&
+			!parse_uint(&opts.fanout, arg, "--fanout") &&
+			!parse_uint(&opts.blob_size, arg, "--blob-size") &&
+			!parse_uint(&opts.changes, arg, "--changes") &&
+			!parse_uint(&opts.packed, arg, "--packed") &&
+			!parse_uint(&opts.refs, arg, "--refs") &&
+			!parse_uint(&seed, arg, "--seed")) {
+			fputs(usage, stderr);
+			return 1;
+		}
+	}
+
+	if (list) {
+		for (bench = bench_defs; bench->name; ++bench)
+			puts(bench->name);
+		return 0;
+	}
+
+	if (i >= argc || !iterations || opts.packed > 100) {
+		fputs(usage, stderr);
+		return 1;
+	}
+
+	path = argv[i++];
+	opts.seed = seed;
+
+	git_threads_init();
+
+	if (!git_path_exists(path)) {
+		start = bench_now();
+		check(bench_generate(path, &opts), "generating the repository");
+
+		printf("{\"generate\":\"%s\",\"commits\":%u,\"width\":%u,\"depth\":%u,"
+			"\"fanout\":%u,\"blob_size\":%u,\"changes\":%u,\"packed\":%u,"
+			"\"refs\":%u,\"seed\":%u,\"ns\":%llu}\n",
+			path, opts.commits, opts.width, opts.depth, opts.fanout,
+			opts.blob_size, opts.changes, opts.packed, opts.refs, seed,
+			(unsigned long long)(bench_now() - start));
+	}
+
+	check(git_repository_open(&repo, path), "opening the repository");
+
+	for (bench = bench_defs; bench->name; ++bench) {
+		if (selected(bench->name, argv + i, argc - i))
+			run(bench, repo, iterations);
+	}
+
+	git_repository_free(repo);
+	git_threads_shutdown();
+
+	return 0;
+}
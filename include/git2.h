@@ -13,6 +13,8 @@
 #include "git2/common.h"
 #include "git2/threads.h"
 #include "git2/errors.h"
+#include "git2/alloc.h"
+#include "git2/trace.h"
 
 #include "git2/types.h"
 
@@ -35,6 +37,7 @@
 #include "git2/diff.h"
 
 #include "git2/index.h"
+#include "git2/fsmonitor.h"
 #include "git2/config.h"
 #include "git2/transport.h"
 #include "git2/remote.h"
@@ -54,5 +57,11 @@
 #include "git2/message.h"
 #include "git2/pack.h"
 #include "git2/stash.h"
+#include "git2/fsck.h"
+#include "git2/archive.h"
+#include "git2/grep.h"
+#include "git2/blame.h"
+#include "git2/lastcommit.h"
+#include "git2/apply.h"
 
 #endif
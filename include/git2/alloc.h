@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_git_alloc_h__
+#define INCLUDE_git_alloc_h__
+
+#include "common.h"
+
+/**
+ * @file git2/alloc.h
+ * @brief Git memory allocation routines
+ * @defgroup git_alloc Git memory allocation routines
+ * @ingroup Git
+ * @{
+ */
+GIT_BEGIN_DECL
+
+/**
+ * Memory allocator used by the library.
+ *
+ * Every function receives the `payload` of the structure.  `gmalloc`
+ * and `grealloc` return NULL when the memory cannot (or should not) be
+ * allocated; the library then fails the current operation with a
+ * GITERR_NOMEMORY error.  `gfree` is never called with a NULL pointer.
+ */
+typedef struct git_allocator {
+	void *(*gmalloc)(size_t len, void *payload);
+	void *(*grealloc)(void *ptr, size_t len, void *payload);
+	void (*gfree)(void *ptr, void *payload);
+	void *payload;
+} git_allocator;
+
+/**
+ * Subsystems which allocation statistics are kept for.
+ *
+ * Allocations are attributed to the part of the library asking for
+ * memory; allocations made by generic helpers (buffers, vectors,
+ * memory pools...) are accounted as GIT_ALLOC_OTHER.
+ */
+typedef enum {
+	GIT_ALLOC_OTHER = 0,
+	GIT_ALLOC_ODB = 1,
+	GIT_ALLOC_INDEX = 2,
+	GIT_ALLOC_DIFF = 3,
+	GIT_ALLOC_PACK = 4,
+	GIT_ALLOC_REFS = 5
+} git_alloc_subsystem_t;
+
+#define GIT_ALLOC__SUBSYSTEMS 6
+
+/**
+ * Allocation statistics for a subsystem
+ */
+typedef struct {
+	/** number of successful allocations and reallocations */
+	size_t allocations;
+	/** number of bytes requested by these calls */
+	size_t bytes;
+	/** number of allocations which have been refused */
+	size_t failures;
+} git_alloc_stats;
+
+/**
+ * Set the memory allocator used by the library.
+ *
+ * The allocator can only be replaced while the library does not hold
+ * any memory: before any other call is made, or once every object
+ * obtained from it has been freed and `git_threads_shutdown` has been
+ * called.
+ *
+ * @param allocator the allocator to use, or NULL to use the C library's
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_allocator_set(const git_allocator *allocator);
+
+/**
+ * Enable or disable the collection of allocation statistics.
+ *
+ * Statistics are disabled by default; keeping them costs a couple of
+ * atomic increments per allocation.
+ *
+ * @param enabled non-zero to start counting, zero to stop
+ */
+GIT_EXTERN(void) git_alloc_stats_enable(int enabled);
+
+/**
+ * Read the allocation statistics of a subsystem.
+ *
+ * The counters are cumulative since statistics were enabled or last
+ * reset.
+ *
+ * @param out structure to fill with the statistics
+ * @param subsystem the subsystem to look at
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_alloc_stats_get(
+	git_alloc_stats *out,
+	git_alloc_subsystem_t subsystem);
+
+/**
+ * Reset the allocation statistics of every subsystem to zero.
+ */
+GIT_EXTERN(void) git_alloc_stats_reset(void);
+
+/** @} */
+GIT_END_DECL
+#endif
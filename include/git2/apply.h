@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_git_apply_h__
+#define INCLUDE_git_apply_h__
+
+#include "common.h"
+#include "types.h"
+#include "oid.h"
+
+/**
+ * @file git2/apply.h
+ * @brief Git patch application routines
+ * @defgroup git_apply Git patch application routines
+ * @ingroup Git
+ * @{
+ */
+GIT_BEGIN_DECL
+
+typedef struct {
+	/**
+	 * How many context lines may be ignored at each end of a hunk
+	 * which does not apply as it is (like `patch --fuzz`); 0 for
+	 * none, like `git apply`
+	 */
+	unsigned int fuzz;
+} git_apply_opts;
+
+/**
+ * Apply a patch to a tree, in memory
+ *
+ * The patch is a unified diff, as `git_diff_print_patch` or `git diff`
+ * make them, possibly with text around the changes, like in an email.
+ * New, deleted and renamed files and mode changes are understood;
+ * binary patches are not.  Paths have their first component (`a/`,
+ * `b/`) stripped.
+ *
+ * Each hunk is looked for at the lines it gives, or the nearest place
+ * where its context and removed lines are in the file.  Only the blobs
+ * of the patched files are read, and only the trees on their paths are
+ * written again: the cost depends on the patch, not on the tree.
+ *
+ * Either the whole patch applies, or nothing is written but blobs.
+ *
+ * @param out where to store the id of the resulting tree
+ * @param repo the repository of the tree
+ * @param preimage the tree to apply the patch to
+ * @param patch the patch text
+ * @param patch_len the length of `patch`
+ * @param opts how to apply the patch, or NULL for the defaults
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_apply_to_tree(
+	git_oid *out,
+	git_repository *repo,
+	git_tree *preimage,
+	const char *patch,
+	size_t patch_len,
+	const git_apply_opts *opts);
+
+/**
+ * Apply a patch to the staged files of an index, in memory
+ *
+ * Works like `git_apply_to_tree`, on the blobs of the index's
+ * entries, like `git apply --cached`.  The index is only changed if
+ * the whole patch applies; it is not written to disk.
+ *
+ * @param repo the repository holding the blobs
+ * @param index the index to change
+ * @param patch the patch text
+ * @param patch_len the length of `patch`
+ * @param opts how to apply the patch, or NULL for the defaults
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_apply_to_index(
+	git_repository *repo,
+	git_index *index,
+	const char *patch,
+	size_t patch_len,
+	const git_apply_opts *opts);
+
+/** @} */
+GIT_END_DECL
+#endif
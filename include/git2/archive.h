@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_git_archive_h__
+#define INCLUDE_git_archive_h__
+
+#include "common.h"
+#include "types.h"
+
+/**
+ * @file git2/archive.h
+ * @brief Git tree archive export routines
+ * @defgroup git_archive Git tree archive export routines
+ * @ingroup Git
+ * @{
+ */
+GIT_BEGIN_DECL
+
+typedef enum {
+	GIT_ARCHIVE_TAR = 0,
+	GIT_ARCHIVE_ZIP = 1,
+} git_archive_format_t;
+
+typedef enum {
+	GIT_ARCHIVE_DEFAULT = 0,
+
+	/** Store the entries of a zip archive without compressing them */
+	GIT_ARCHIVE_ZIP_STORE = (1 << 0),
+} git_archive_flag_t;
+
+/**
+ * Called with each consecutive piece of the archive
+ *
+ * @param data the bytes to write
+ * @param len number of bytes at `data`
+ * @param payload the payload given to `git_archive`
+ * @return 0 to go on, any other value to stop the export
+ */
+typedef int (*git_archive_write_cb)(
+	const char *data, size_t len, void *payload);
+
+typedef struct {
+	git_archive_format_t format;
+	unsigned int flags; /** combination of `git_archive_flag_t` flags */
+
+	/** prepended to every path, e.g. "project-1.0/"; may be NULL */
+	const char *prefix;
+
+	/** modification time of every entry; 0 for the current time */
+	git_time_t mtime;
+
+	/** threads reading blobs ahead of the writer; 0 for one per CPU */
+	unsigned int nthreads;
+} git_archive_opts;
+
+/**
+ * Write the contents of a tree as a tar or zip archive
+ *
+ * Entries come in the order of the tree, each directory before its
+ * contents, like `git archive` writes them.  Paths with the
+ * `export-ignore` attribute are left out; the attributes come from
+ * the `.gitattributes` files of the tree itself and from the
+ * repository's `info/attributes`, never from the working directory.
+ * Submodules are written as empty directories.
+ *
+ * Blobs are read by worker threads a little ahead of the writer.
+ * Large blobs are not read ahead but streamed from the object
+ * database, so that they are never held in memory at once.
+ *
+ * Zip entries are deflated unless `GIT_ARCHIVE_ZIP_STORE` is given,
+ * or compression does not make them smaller.  Zip archives are
+ * limited to 4GB and 65535 entries.
+ *
+ * @param tree the tree to export
+ * @param opts archive options (or NULL for a tar archive)
+ * @param write_cb called with the archive, piece by piece
+ * @param payload passed through to `write_cb`
+ * @return 0 or an error code; GIT_EUSER if `write_cb` stopped the
+ *         export
+ */
+GIT_EXTERN(int) git_archive(
+	git_tree *tree,
+	const git_archive_opts *opts,
+	git_archive_write_cb write_cb,
+	void *payload);
+
+/** @} */
+GIT_END_DECL
+#endif
@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_git_blame_h__
+#define INCLUDE_git_blame_h__
+
+#include "common.h"
+#include "types.h"
+#include "oid.h"
+
+/**
+ * @file git2/blame.h
+ * @brief Git blame routines
+ * @defgroup git_blame Git blame routines
+ * @ingroup Git
+ * @{
+ */
+GIT_BEGIN_DECL
+
+typedef enum {
+	GIT_BLAME_NORMAL = 0,
+
+	/**
+	 * Also look for lines which were moved within the file, not only
+	 * for lines which are unchanged (like `git blame -M`)
+	 */
+	GIT_BLAME_TRACK_MOVES_SAME_FILE = (1 << 0),
+
+	/** Only follow the first parent of merge commits */
+	GIT_BLAME_FIRST_PARENT = (1 << 1),
+} git_blame_flag_t;
+
+typedef struct {
+	uint32_t flags; /** combination of `git_blame_flag_t` flags */
+
+	/**
+	 * For `GIT_BLAME_TRACK_MOVES_SAME_FILE`, how many alphanumeric
+	 * characters moved lines must have to be recognized; 0 for 20,
+	 * like git
+	 */
+	uint16_t min_match_characters;
+
+	/** the version of the file to blame; zero for HEAD */
+	git_oid newest_commit;
+
+	/**
+	 * where to stop looking: the lines which are older are blamed
+	 * on this commit, as a boundary; zero to go back to the roots
+	 */
+	git_oid oldest_commit;
+
+	/** the first and last lines to blame, counted from 1; 0 for the
+	 *  first and the last line of the file */
+	size_t min_line;
+	size_t max_line;
+} git_blame_options;
+
+/**
+ * Lines of the file which come from the same commit
+ */
+typedef struct {
+	/** number of lines */
+	size_t lines_in_hunk;
+
+	/** the blamed version of the file and where the lines are in it */
+	git_oid final_commit_id;
+	size_t final_start_line_number;
+
+	/** the commit where the lines come from and where they were there */
+	git_oid orig_commit_id;
+	const char *orig_path;
+	size_t orig_start_line_number;
+
+	/** set when the lines are older than `oldest_commit` */
+	char boundary;
+} git_blame_hunk;
+
+typedef struct git_blame git_blame;
+
+/**
+ * Find which commits the lines of a file come from
+ *
+ * History is walked from `newest_commit` back, only looking at the
+ * commits which changed the file: each version is diffed against its
+ * parents' and the lines which are unchanged are passed on to the
+ * parents.  The walk ends as soon as all the lines asked for are
+ * blamed, so a small range of lines in a file with a long history is
+ * cheaper to blame than the whole file.  Renames are not followed.
+ *
+ * @param out where to store the blame
+ * @param repo the repository
+ * @param path the path of the file, relative to the repository root
+ * @param options what to blame, or NULL for the whole file at HEAD
+ * @return 0, GIT_ENOTFOUND if the file is not in `newest_commit`, or
+ *         an error code
+ */
+GIT_EXTERN(int) git_blame_file(
+	git_blame **out,
+	git_repository *repo,
+	const char *path,
+	const git_blame_options *options);
+
+/**
+ * The number of hunks in the blame
+ */
+GIT_EXTERN(size_t) git_blame_get_hunk_count(git_blame *blame);
+
+/**
+ * Get a hunk by its position, the hunks being in line order
+ *
+ * @return the hunk, or NULL if `index` is out of range
+ */
+GIT_EXTERN(const git_blame_hunk *) git_blame_get_hunk_byindex(
+	git_blame *blame, size_t index);
+
+/**
+ * Get the hunk with a line of the blamed file
+ *
+ * @param lineno the line, counted from 1
+ * @return the hunk, or NULL if the line was not blamed
+ */
+GIT_EXTERN(const git_blame_hunk *) git_blame_get_hunk_byline(
+	git_blame *blame, size_t lineno);
+
+/**
+ * Free a blame
+ */
+GIT_EXTERN(void) git_blame_free(git_blame *blame);
+
+/** @} */
+GIT_END_DECL
+#endif
@@ -124,6 +124,9 @@ typedef enum {
 	/** Only update existing files, don't create new ones */
 	GIT_CHECKOUT_UPDATE_ONLY = (1u << 6),
 
+	/** Treat `paths` as a list of exact file paths instead of fnmatch patterns */
+	GIT_CHECKOUT_DISABLE_PATHSPEC_MATCH = (1u << 7),
+
 	/**
 	 * THE FOLLOWING OPTIONS ARE NOT YET IMPLEMENTED
 	 */
@@ -100,7 +100,8 @@ GIT_EXTERN(void) git_libgit2_version(int *major, int *minor, int *rev);
  */
 enum {
 	GIT_CAP_THREADS			= ( 1 << 0 ),
-	GIT_CAP_HTTPS			= ( 1 << 1 )
+	GIT_CAP_HTTPS			= ( 1 << 1 ),
+	GIT_CAP_TRACE			= ( 1 << 2 )
 };
 
 /**
@@ -115,6 +116,9 @@ enum {
  * - GIT_CAP_HTTPS
  *   Libgit2 supports the https:// protocol. This requires the open ssl library to be
  *   found when compiling libgit2.
+ *
+ * - GIT_CAP_TRACE
+ *   Libgit2 was compiled with tracing support (see git2/trace.h).
  */
 GIT_EXTERN(int) git_libgit2_capabilities(void);
 
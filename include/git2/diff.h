@@ -88,6 +88,11 @@ typedef enum {
 	GIT_DIFF_INCLUDE_TYPECHANGE_TREES  = (1 << 16),
 	/** Ignore file mode changes */
 	GIT_DIFF_IGNORE_FILEMODE = (1 << 17),
+	/** Read the working directory ahead of the diff on worker threads.
+	 *  This can be much faster on slow or networked filesystems and has
+	 *  no effect when libgit2 is built without thread support.
+	 */
+	GIT_DIFF_PARALLEL_WORKDIR_SCAN = (1 << 18),
 } git_diff_option_t;
 
 /**
@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_git_fsck_h__
+#define INCLUDE_git_fsck_h__
+
+#include "common.h"
+#include "types.h"
+#include "oid.h"
+
+/**
+ * @file git2/fsck.h
+ * @brief Git object database consistency checks
+ * @defgroup git_fsck Git object database consistency checks
+ * @ingroup Git
+ * @{
+ */
+GIT_BEGIN_DECL
+
+typedef enum {
+	GIT_FSCK_DEFAULT = 0,
+
+	/**
+	 * Only make sure that the blobs are there, which for packed blobs
+	 * is a lookup in the pack index, instead of reading them.  Commits,
+	 * trees and tags are always read, as they lead to other objects.
+	 */
+	GIT_FSCK_BLOBS_EXIST = (1 << 0),
+} git_fsck_t;
+
+/**
+ * Called for each missing or broken object
+ *
+ * @param id the object
+ * @param type the type the object should have, GIT_OBJ_ANY if unknown
+ * @param error GIT_ENOTFOUND if the object is missing, another error
+ *        code if it could not be read or parsed
+ * @param message a description of the problem
+ * @param payload the payload from the options
+ * @return 0 to go on with the check, any other value to stop it
+ */
+typedef int (*git_fsck_cb)(
+	const git_oid *id,
+	git_otype type,
+	int error,
+	const char *message,
+	void *payload);
+
+typedef struct {
+	unsigned int flags; /** combination of `git_fsck_t` flags */
+
+	/** worker threads; 0 for one per CPU */
+	unsigned int nthreads;
+
+	/**
+	 * Called for each problem found, from any of the worker threads
+	 * but never from two at once.  Without it, the check stops at the
+	 * first problem.
+	 */
+	git_fsck_cb problem_cb;
+	void *payload;
+} git_fsck_opts;
+
+/**
+ * Check that the given objects have complete history
+ *
+ * Every commit reachable from `tips` must be there, along with all
+ * the trees and blobs they reference; tags are followed to their
+ * targets.  Submodule commits are not looked for.
+ *
+ * Objects in `exclude` (typically the references as they were before
+ * a fetch) are taken to be complete, along with everything in the trees
+ * of the excluded commits, their ancestors and the root trees of those:
+ * the walk stops when it reaches one of them.
+ *
+ * Trees are read and walked by a pool of worker threads.
+ *
+ * @param repo the repository to check
+ * @param tips the objects whose history must be complete
+ * @param ntips number of objects in `tips`
+ * @param exclude objects known to be complete, or NULL
+ * @param nexclude number of objects in `exclude`
+ * @param opts check options (or NULL for the defaults)
+ * @return 0 if the history is complete, the error of the first
+ *         problem found otherwise (GIT_ENOTFOUND for a missing
+ *         object), or GIT_EUSER if the callback stopped the check
+ */
+GIT_EXTERN(int) git_repository_check_connectivity(
+	git_repository *repo,
+	const git_oid *tips,
+	size_t ntips,
+	const git_oid *exclude,
+	size_t nexclude,
+	const git_fsck_opts *opts);
+
+/**
+ * Check every object in an object database
+ *
+ * Each object is read, its contents hashed again and compared to its
+ * id, and commits, trees and tags are parsed.  Whether the objects
+ * they point to exist is not checked; see
+ * `git_repository_check_connectivity` for that.
+ *
+ * With `GIT_FSCK_BLOBS_EXIST` the blobs are not read, and so are not
+ * checked at all.
+ *
+ * @param odb the object database to check
+ * @param opts check options (or NULL for the defaults)
+ * @return 0 if all objects are sound, the error of the first problem
+ *         found otherwise, or GIT_EUSER if the callback stopped the
+ *         check
+ */
+GIT_EXTERN(int) git_odb_verify(git_odb *odb, const git_fsck_opts *opts);
+
+/** @} */
+GIT_END_DECL
+#endif
@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_git_fsmonitor_h__
+#define INCLUDE_git_fsmonitor_h__
+
+#include "common.h"
+#include "types.h"
+
+/**
+ * @file git2/fsmonitor.h
+ * @brief Git filesystem monitor routines
+ * @defgroup git_fsmonitor Git filesystem monitor routines
+ * @ingroup Git
+ * @{
+ *
+ * A filesystem monitor tells which paths of a working directory changed
+ * since a point in time, named by a token it handed out earlier.  Once
+ * one is set on a repository with `git_repository_set_fsmonitor`, index
+ * entries that `git_index_refresh` found clean are trusted to stay so
+ * until the monitor reports them, and both `git_index_refresh` and
+ * `git_diff_workdir_to_index` (and hence status) only look at those.
+ * The last token is kept in the index file, in the same "FSMN"
+ * extension core git uses.
+ */
+GIT_BEGIN_DECL
+
+/** The answer to a filesystem monitor query, being filled in */
+typedef struct git_fsmonitor_result git_fsmonitor_result;
+
+/** A filesystem monitor, see `git_fsmonitor_inotify_new` for the built-in one */
+struct git_fsmonitor {
+	/**
+	 * Report what changed in the working directory since `token` was
+	 * handed out (NULL when there is no token yet).  Each changed path,
+	 * relative to the working directory and with a directory standing
+	 * for everything below it, is passed to `git_fsmonitor_result_add`;
+	 * a monitor that cannot tell calls `git_fsmonitor_result_all`
+	 * instead.  Either way, it must hand out a new token naming the
+	 * moment the answer was given with `git_fsmonitor_result_set_token`.
+	 */
+	int (*query)(git_fsmonitor *fsm, const char *token, git_fsmonitor_result *result);
+
+	void (*free)(git_fsmonitor *fsm);
+};
+
+/**
+ * Add a changed path to a query result
+ *
+ * @param result the result being filled in
+ * @param path path relative to the working directory
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_fsmonitor_result_add(
+	git_fsmonitor_result *result, const char *path);
+
+/**
+ * Report that anything in the working directory may have changed
+ *
+ * @param result the result being filled in
+ */
+GIT_EXTERN(void) git_fsmonitor_result_all(git_fsmonitor_result *result);
+
+/**
+ * Set the token naming the moment a query was answered
+ *
+ * @param result the result being filled in
+ * @param token the token to pass to the next query
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_fsmonitor_result_set_token(
+	git_fsmonitor_result *result, const char *token);
+
+/**
+ * Create a filesystem monitor that watches a working directory
+ * with inotify
+ *
+ * Each directory is watched from the moment the monitor is created,
+ * so its first answer is always that everything may have changed, as
+ * is its answer to tokens handed out by another instance.  Only
+ * available on Linux.
+ *
+ * @param out pointer to the new monitor
+ * @param workdir the working directory to watch
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_fsmonitor_inotify_new(
+	git_fsmonitor **out, const char *workdir);
+
+/**
+ * Free a filesystem monitor that no repository owns
+ *
+ * @param fsm the monitor to free
+ */
+GIT_EXTERN(void) git_fsmonitor_free(git_fsmonitor *fsm);
+
+/** @} */
+GIT_END_DECL
+#endif
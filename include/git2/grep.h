@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_git_grep_h__
+#define INCLUDE_git_grep_h__
+
+#include "common.h"
+#include "types.h"
+#include "oid.h"
+
+/**
+ * @file git2/grep.h
+ * @brief Git content search routines
+ * @defgroup git_grep Git content search routines
+ * @ingroup Git
+ * @{
+ */
+GIT_BEGIN_DECL
+
+typedef enum {
+	GIT_GREP_DEFAULT = 0,
+
+	/** The pattern is a plain string, not a regular expression */
+	GIT_GREP_FIXED_STRINGS = (1 << 0),
+
+	/** Ignore case differences between the pattern and the contents */
+	GIT_GREP_IGNORE_CASE = (1 << 1),
+
+	/** Search binary files as well, as if they were text */
+	GIT_GREP_TEXT = (1 << 2),
+
+	/** Only report the first matching line of each file */
+	GIT_GREP_FILES_WITH_MATCHES = (1 << 3),
+
+	/** Match the pathspec as exact paths, not as fnmatch patterns */
+	GIT_GREP_DISABLE_PATHSPEC_MATCH = (1 << 4),
+} git_grep_flag_t;
+
+/**
+ * A line which matches the pattern
+ */
+typedef struct {
+	const char *path;
+	const git_oid *oid; /** of the blob; NULL for working directory files */
+
+	size_t line_number; /** counted from 1 */
+	const char *line; /** not NUL-terminated, without its newline */
+	size_t line_len;
+
+	/** where the first match in the line is */
+	size_t match_offset;
+	size_t match_len;
+} git_grep_match;
+
+/**
+ * Called for each matching line
+ *
+ * @param match the line; only valid for the duration of the call
+ * @param payload the payload given to the search
+ * @return 0 to go on, any other value to stop the search
+ */
+typedef int (*git_grep_cb)(const git_grep_match *match, void *payload);
+
+typedef struct {
+	unsigned int flags; /** combination of `git_grep_flag_t` flags */
+
+	/** only search the files matching these paths or patterns */
+	git_strarray pathspec;
+
+	/** worker threads, counting the caller; 0 for one per CPU */
+	unsigned int nthreads;
+} git_grep_opts;
+
+/**
+ * Search the blobs of a tree for lines matching a pattern
+ *
+ * The pattern is a POSIX extended regular expression, unless
+ * `GIT_GREP_FIXED_STRINGS` is given.  Binary files, detected like
+ * the filters do, are skipped unless `GIT_GREP_TEXT` is given;
+ * submodules are never searched.
+ *
+ * The blobs are searched by a pool of worker threads, in the order
+ * they are stored in the object database rather than by path.  The
+ * matches are still reported in path order, and then line order,
+ * always from the calling thread.  The matching lines of files which
+ * are done early are kept until their turn comes.
+ *
+ * @param tree the tree to search
+ * @param pattern what to look for
+ * @param opts search options, or NULL for the defaults
+ * @param cb called for each matching line
+ * @param payload passed through to `cb`
+ * @return 0 or an error code; GIT_EUSER if `cb` stopped the search
+ */
+GIT_EXTERN(int) git_grep_tree(
+	git_tree *tree,
+	const char *pattern,
+	const git_grep_opts *opts,
+	git_grep_cb cb,
+	void *payload);
+
+/**
+ * Search the blobs staged in an index for lines matching a pattern
+ *
+ * Works like `git_grep_tree`.  Conflicted files are searched in each
+ * of their stages.
+ *
+ * @param repo the repository holding the blobs
+ * @param index the index to search, or NULL for the repository's
+ * @param pattern what to look for
+ * @param opts search options, or NULL for the defaults
+ * @param cb called for each matching line
+ * @param payload passed through to `cb`
+ * @return 0 or an error code; GIT_EUSER if `cb` stopped the search
+ */
+GIT_EXTERN(int) git_grep_index(
+	git_repository *repo,
+	git_index *index,
+	const char *pattern,
+	const git_grep_opts *opts,
+	git_grep_cb cb,
+	void *payload);
+
+/**
+ * Search the tracked files of the working directory for lines
+ * matching a pattern
+ *
+ * Works like `git_grep_tree`, on the files of the working directory
+ * which are in the repository's index.  Tracked files which have
+ * been removed are skipped.
+ *
+ * @param repo the repository to search
+ * @param pattern what to look for
+ * @param opts search options, or NULL for the defaults
+ * @param cb called for each matching line
+ * @param payload passed through to `cb`
+ * @return 0 or an error code; GIT_EUSER if `cb` stopped the search
+ */
+GIT_EXTERN(int) git_grep_workdir(
+	git_repository *repo,
+	const char *pattern,
+	const git_grep_opts *opts,
+	git_grep_cb cb,
+	void *payload);
+
+/** @} */
+GIT_END_DECL
+#endif
@@ -11,6 +11,7 @@
 #include "indexer.h"
 #include "types.h"
 #include "oid.h"
+#include "strarray.h"
 
 /**
  * @file git2/index.h
@@ -46,6 +47,8 @@ GIT_BEGIN_DECL
 
 #define GIT_IDXENTRY_UNPACKED			(1 << 8)
 #define GIT_IDXENTRY_NEW_SKIP_WORKTREE (1 << 9)
+/* the filesystem monitor saw no change since the entry was found clean */
+#define GIT_IDXENTRY_FSMONITOR_VALID	(1 << 10)
 
 /*
  * Extended on-disk flags:
@@ -99,6 +102,15 @@ enum {
 	GIT_INDEXCAP_FROM_OWNER  = ~0u
 };
 
+/** Flags for `git_index_refresh` */
+typedef enum {
+	GIT_INDEX_REFRESH_DEFAULT = 0,
+	/** Stop looking as soon as one changed entry has been found */
+	GIT_INDEX_REFRESH_QUICK = (1u << 0),
+	/** Only report changes; leave the stat data of the entries alone */
+	GIT_INDEX_REFRESH_NO_UPDATE = (1u << 1),
+} git_index_refresh_t;
+
 /** @name Index File Functions
  *
  * These functions work on the index file itself.
@@ -380,6 +392,37 @@ GIT_EXTERN(int) git_index_add_from_workdir(git_index *index, const char *path);
  */
 GIT_EXTERN(int) git_index_find(git_index *index, const char *path);
 
+/**
+ * Compare the index against the working directory and refresh the
+ * cached stat data of unchanged entries
+ *
+ * Every entry is `lstat`ed, split across `nthreads` worker threads
+ * (0 picks one per online CPU; libgit2 built without thread support
+ * always uses the calling thread).  Entries whose stat data differs
+ * from the index, or which are "racily clean" because the file was
+ * modified in the same second the index was written, have their
+ * content hashed; when it matches, the entry's stat data is updated so
+ * the next check is a plain `lstat`.  The index is not written.
+ *
+ * Unmerged and intent-to-add entries always count as changed, and
+ * entries flagged with skip-worktree are never looked at.
+ *
+ * @param index an existing index object
+ * @param flags combination of `git_index_refresh_t` flags
+ * @param nthreads number of threads to use, or 0 for the CPU count
+ * @param changed optional list receiving the paths of the changed
+ *        entries, to be freed with `git_strarray_free`; with
+ *        GIT_INDEX_REFRESH_QUICK it holds at least one path if the
+ *        working directory is dirty
+ * @return 0 if the working directory matches the index, 1 if at least
+ *         one entry changed, or an error code
+ */
+GIT_EXTERN(int) git_index_refresh(
+	git_index *index,
+	unsigned int flags,
+	unsigned int nthreads,
+	git_strarray *changed);
+
 /**@}*/
 
 /** @name Conflict Index Entry Functions
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_git_lastcommit_h__
+#define INCLUDE_git_lastcommit_h__
+
+#include "common.h"
+#include "types.h"
+#include "oid.h"
+
+/**
+ * @file git2/lastcommit.h
+ * @brief Git routines to find the last commits of tree entries
+ * @defgroup git_lastcommit Git routines to find the last commits of tree entries
+ * @ingroup Git
+ * @{
+ */
+GIT_BEGIN_DECL
+
+/**
+ * Called for each entry of the directory
+ *
+ * @param entry the entry, in the directory at the starting commit
+ * @param commit_id the last commit which changed the entry
+ * @param payload the payload given to `git_last_commit_foreach`
+ * @return 0 to go on, any other value to stop
+ */
+typedef int (*git_last_commit_cb)(
+	const git_tree_entry *entry, const git_oid *commit_id, void *payload);
+
+/**
+ * Find the last commit which changed each entry of a directory
+ *
+ * This is what `git log -1 -- <path>/<entry>` finds for each entry,
+ * with the default history simplification: a merge which has an
+ * entry like one of its parents is not blamed for it, and only that
+ * parent is looked at further.
+ *
+ * All the entries are looked for in one walk of the history, newest
+ * commits first, which ends once each entry has been found.  A commit
+ * is only looked at for the entries which are not found yet; those
+ * which are in an unchanged subtree of a parent are passed to the
+ * parent without being compared one by one.
+ *
+ * @param repo the repository
+ * @param commit_id the commit to start from
+ * @param path the directory, relative to the repository root; NULL or
+ *        "" for the root of the tree
+ * @param cb called for each entry, in the directory's order, once all
+ *        the commits are found
+ * @param payload passed through to `cb`
+ * @return 0, GIT_ENOTFOUND if `path` is not a directory of the
+ *         commit, GIT_EUSER if `cb` stopped, or an error code
+ */
+GIT_EXTERN(int) git_last_commit_foreach(
+	git_repository *repo,
+	const git_oid *commit_id,
+	const char *path,
+	git_last_commit_cb cb,
+	void *payload);
+
+/** @} */
+GIT_END_DECL
+#endif
@@ -13,8 +13,8 @@
 
 /**
  * @file git2/merge.h
- * @brief Git merge-base routines
- * @defgroup git_revwalk Git merge-base routines
+ * @brief Git merge routines
+ * @defgroup git_merge Git merge routines
  * @ingroup Git
  * @{
  */
@@ -40,6 +40,68 @@ GIT_EXTERN(int) git_merge_base(git_oid *out, git_repository *repo, const git_oid
  */
 GIT_EXTERN(int) git_merge_base_many(git_oid *out, git_repository *repo, const git_oid input_array[], size_t length);
 
+/**
+ * Flags for `git_merge_trees`
+ */
+typedef enum {
+	/** Don't merge the contents of files modified on both sides;
+	 *  record every such file as a conflict instead */
+	GIT_MERGE_TREE_NO_CONTENT_MERGE = (1 << 0),
+} git_merge_tree_flags;
+
+/**
+ * How to resolve conflicting hunks when merging file contents
+ */
+typedef enum {
+	/** Leave the file conflicted */
+	GIT_MERGE_FILE_FAVOR_NORMAL = 0,
+	/** Resolve conflicting hunks with our side */
+	GIT_MERGE_FILE_FAVOR_OURS = 1,
+	/** Resolve conflicting hunks with their side */
+	GIT_MERGE_FILE_FAVOR_THEIRS = 2,
+	/** Keep the hunks of both sides */
+	GIT_MERGE_FILE_FAVOR_UNION = 3,
+} git_merge_file_favor_t;
+
+/**
+ * Options for `git_merge_trees`; zero them for the defaults
+ */
+typedef struct {
+	unsigned int flags; /** combination of `git_merge_tree_flags` */
+	git_merge_file_favor_t file_favor;
+} git_merge_tree_opts;
+
+/**
+ * Merge two trees against their common ancestor, producing an index
+ *
+ * The merge happens entirely in memory: the working directory and the
+ * repository index are never read nor modified.  Paths changed on a
+ * single side are taken from that side without looking at their
+ * contents, as are whole subtrees; files modified on both sides are
+ * merged line by line and the result written to the object database.
+ *
+ * The returned index holds the merged entries at stage 0 and, for
+ * every path which could not be merged, its ancestor, our and their
+ * versions at stages 1, 2 and 3.  Use `git_index_has_conflicts` to
+ * find out whether the merge was clean; the index must be freed with
+ * `git_index_free`.
+ *
+ * @param out pointer to store the resulting index
+ * @param repo repository containing the given trees
+ * @param ancestor_tree the common ancestor of both trees (or NULL)
+ * @param our_tree the tree that reflects the destination tree
+ * @param their_tree the tree to merge in to `our_tree`
+ * @param opts merge options (or NULL for the defaults)
+ * @return 0 on success, or an error code
+ */
+GIT_EXTERN(int) git_merge_trees(
+	git_index **out,
+	git_repository *repo,
+	git_tree *ancestor_tree,
+	git_tree *our_tree,
+	git_tree *their_tree,
+	const git_merge_tree_opts *opts);
+
 /** @} */
 GIT_END_DECL
 #endif
@@ -138,6 +138,86 @@ GIT_EXTERN(int) git_note_foreach(
 	void *payload
 );
 
+/**
+ * Start a batch of note changes
+ *
+ * A batch collects note insertions and removals in memory.  Nothing
+ * is written to the notes reference until `git_note_batch_commit` is
+ * called, at which point every affected notes tree is written once,
+ * with fanout subtrees created as needed, and a single notes commit
+ * is created on top of the tip `notes_ref` had when the batch was
+ * started, or of the batch's previous commit.
+ *
+ * @param out pointer to the new batch
+ * @param repo repository where the notes live
+ * @param notes_ref canonical name of the reference to use (optional);
+ *					defaults to "refs/notes/commits"
+ *
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_note_batch_new(git_note_batch **out,
+				   git_repository *repo, const char *notes_ref);
+
+/**
+ * Queue the addition of a note for an object
+ *
+ * The note blob is written immediately; the notes tree is only
+ * updated by `git_note_batch_commit`.  Adding a note for an object
+ * which is already annotated makes the commit fail with GIT_EEXISTS,
+ * unless that note was removed earlier in the same batch.
+ *
+ * @param out pointer to store the OID of the note blob (optional)
+ * @param batch the batch to add the note to
+ * @param oid OID of the git object to decorate
+ * @param note Content of the note to add for object oid
+ *
+ * @return 0, GIT_EEXISTS if the batch already adds a note
+ *         for `oid`, or an error code
+ */
+GIT_EXTERN(int) git_note_batch_create(git_oid *out, git_note_batch *batch,
+				      const git_oid *oid, const char *note);
+
+/**
+ * Queue the removal of the note of an object
+ *
+ * Removing a note which doesn't exist makes the commit fail
+ * with GIT_ENOTFOUND.
+ *
+ * @param batch the batch to record the removal in
+ * @param oid OID of the git object to remove the note from
+ *
+ * @return 0, GIT_ENOTFOUND if the batch already removes the note
+ *         for `oid`, or an error code
+ */
+GIT_EXTERN(int) git_note_batch_remove(git_note_batch *batch, const git_oid *oid);
+
+/**
+ * Write all the queued changes as a single notes commit
+ *
+ * Once the commit is made, the batch is empty again and on top of it:
+ * changes queued afterwards go into the next commit.  If the commit
+ * fails, the batch is left untouched.  Either way it must still be
+ * freed.
+ *
+ * @param out pointer to store the OID of the notes commit (optional)
+ * @param batch the batch to write
+ * @param author signature of the notes commit author
+ * @param committer signature of the notes commit committer
+ *
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_note_batch_commit(git_oid *out, git_note_batch *batch,
+				      git_signature *author, git_signature *committer);
+
+/**
+ * Free a batch of note changes
+ *
+ * Pending changes which have not been committed are discarded.
+ *
+ * @param batch the batch to free
+ */
+GIT_EXTERN(void) git_note_batch_free(git_note_batch *batch);
+
 /** @} */
 GIT_END_DECL
 #endif
@@ -162,6 +162,22 @@ GIT_EXTERN(int) git_odb_read_prefix(git_odb_object **out, git_odb *db, const git
  */
 GIT_EXTERN(int) git_odb_read_header(size_t *len_p, git_otype *type_p, git_odb *db, const git_oid *id);
 
+/**
+ * Read how many bytes an object takes up on disk.
+ *
+ * For a packed object this is the size of its entry in the pack, which
+ * for a delta can be much less than the object itself; for a loose
+ * object, the size of its file.  Backends that cannot tell are skipped.
+ *
+ * @param out pointer where to store the size
+ * @param db database to search for the object in.
+ * @param id identity of the object.
+ * @return
+ * - 0 if the size was read;
+ * - GIT_ENOTFOUND if no backend knows the object's size.
+ */
+GIT_EXTERN(int) git_odb_read_disk_size(git_off_t *out, git_odb *db, const git_oid *id);
+
 /**
  * Determine if the given object can be found in the object database.
  *
@@ -240,16 +256,18 @@ GIT_EXTERN(int) git_odb_open_wstream(git_odb_stream **stream, git_odb *db, size_
 /**
  * Open a stream to read an object from the ODB
  *
- * Note that most backends do *not* support streaming reads
- * because they store their objects as compressed/delta'ed blobs.
- *
- * It's recommended to use `git_odb_read` instead, which is
- * assured to work on all backends.
+ * Loose objects and objects stored whole in a pack are inflated
+ * as they are read, so that large blobs need not be held in memory.
+ * Other objects, such as deltas, are read whole with `git_odb_read`
+ * and handed out from memory.  Use `git_odb_read_header` to learn
+ * the type and size of the object.
  *
  * The returned stream will be of type `GIT_STREAM_RDONLY` and
  * will have the following methods:
  *
- *		- stream->read: read `n` bytes from the stream
+ *		- stream->read: read up to `n` bytes from the stream; returns
+ *			the number of bytes read, 0 at the end of the object, or
+ *			an error code
  *		- stream->free: free the stream
  *
  * The stream must always be free'd or will leak memory.
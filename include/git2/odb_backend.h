@@ -55,6 +55,19 @@ struct git_odb_backend {
 			struct git_odb_backend *,
 			const git_oid *);
 
+	/* The bytes an object takes up in the backend's storage */
+	int (* read_disk_size)(
+			git_off_t *,
+			struct git_odb_backend *,
+			const git_oid *);
+
+	/* Where an object is in the backend's storage, as a key by which
+	 * objects stored close together sort close together */
+	int (* locate)(
+			git_off_t *,
+			struct git_odb_backend *,
+			const git_oid *);
+
 	int (* write)(
 			git_oid *,
 			struct git_odb_backend *,
@@ -108,6 +108,56 @@ GIT_EXTERN(uint32_t) git_packbuilder_written(git_packbuilder *pb);
  */
 GIT_EXTERN(void) git_packbuilder_free(git_packbuilder *pb);
 
+/** Flags for `git_repository_repack` */
+typedef enum {
+	GIT_REPACK_DEFAULT = 0,
+	/** Leave the loose objects which were packed in place */
+	GIT_REPACK_KEEP_LOOSE = (1u << 0),
+	/** Look for new deltas rather than copying those of the old packs */
+	GIT_REPACK_NO_REUSE_DELTA = (1u << 1),
+} git_repack_t;
+
+typedef struct {
+	unsigned int flags; /** combination of `git_repack_t` flags */
+
+	/**
+	 * 0 to rewrite all the reachable objects into a single pack; any
+	 * other value only folds the loose objects and the smallest packs
+	 * together, so that each pack holds at least `geometric_factor`
+	 * times as many objects as the next smaller one.
+	 */
+	unsigned int geometric_factor;
+
+	/** threads looking for deltas, as in `git_packbuilder_set_threads` */
+	unsigned int nthreads;
+} git_repack_opts;
+
+/**
+ * Consolidate the objects of a repository into fewer packs
+ *
+ * By default the objects reachable from the references, their reflogs
+ * and the index (unless the repository is bare) are written to one new
+ * pack, and all the previous packs are removed.  Unreachable objects
+ * which were packed are thus dropped while unreachable loose objects
+ * are left alone.
+ *
+ * With a `geometric_factor`, no history is walked: the objects of the
+ * packs which break the geometric progression and the loose objects
+ * are written to a new pack, and the larger packs are left untouched,
+ * so that large packs are not rewritten on every run.
+ *
+ * Either way packs with a `.keep` file are neither rewritten nor
+ * removed, and their objects are not copied.  The new pack is in place
+ * before the old ones are removed, and the loose objects which are now
+ * packed are removed last.
+ *
+ * @param repo the repository to repack
+ * @param opts repack options (or NULL for the defaults)
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_repository_repack(
+	git_repository *repo, const git_repack_opts *opts);
+
 /** @} */
 GIT_END_DECL
 #endif
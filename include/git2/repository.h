@@ -456,6 +456,18 @@ GIT_EXTERN(int) git_repository_index(git_index **out, git_repository *repo);
  */
 GIT_EXTERN(void) git_repository_set_index(git_repository *repo, git_index *index);
 
+/**
+ * Set the filesystem monitor for this repository's working directory
+ *
+ * The repository takes ownership of the monitor and frees it along
+ * with itself, or when another one (or NULL) is set.  See
+ * `git2/fsmonitor.h` for what the monitor is used for.
+ *
+ * @param repo A repository object
+ * @param fsm The monitor, or NULL to stop using one
+ */
+GIT_EXTERN(void) git_repository_set_fsmonitor(git_repository *repo, git_fsmonitor *fsm);
+
 /**
  * Retrieve git's prepared message
  *
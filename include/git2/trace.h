@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_git_trace_h__
+#define INCLUDE_git_trace_h__
+
+#include "common.h"
+
+/**
+ * @file git2/trace.h
+ * @brief Git tracing and metrics routines
+ * @defgroup git_trace Git tracing and metrics routines
+ * @ingroup Git
+ * @{
+ */
+GIT_BEGIN_DECL
+
+/**
+ * Events reported by the library's instrumentation.
+ *
+ * Each event carries a `value` whose meaning depends on the event;
+ * events marked as spans also carry the time they took.
+ */
+typedef enum {
+	/** Object read from a loose file (span; value: object size) */
+	GIT_TRACE_ODB_LOOSE_READ = 0,
+	/** Object not found as a loose file */
+	GIT_TRACE_ODB_LOOSE_MISS = 1,
+	/** Object read from a packfile (span; value: object size) */
+	GIT_TRACE_ODB_PACK_READ = 2,
+	/** Object not found in any packfile */
+	GIT_TRACE_ODB_PACK_MISS = 3,
+	/** Object found in an object cache */
+	GIT_TRACE_CACHE_HIT = 4,
+	/** Object not found in an object cache */
+	GIT_TRACE_CACHE_MISS = 5,
+	/** zlib stream inflated (span; value: inflated bytes) */
+	GIT_TRACE_INFLATE = 6,
+	/** Deltified object resolved from a pack (value: chain length) */
+	GIT_TRACE_DELTA_CHAIN = 7,
+	/** Pack window mapped (value: bytes) */
+	GIT_TRACE_MWINDOW_MAP = 8,
+	/** Pack window unmapped (value: bytes) */
+	GIT_TRACE_MWINDOW_UNMAP = 9,
+	/** Index file read and parsed (span; value: entries) */
+	GIT_TRACE_INDEX_READ = 10,
+	/** Index file written (span; value: entries) */
+	GIT_TRACE_INDEX_WRITE = 11,
+	/** Fetch negotiation with a remote (span; value: haves sent) */
+	GIT_TRACE_NET_NEGOTIATE = 12,
+	/** Pack download from a remote (span; value: objects received) */
+	GIT_TRACE_NET_DOWNLOAD = 13
+} git_trace_event_t;
+
+#define GIT_TRACE__EVENTS 14
+
+/**
+ * Callback receiving every traced event.
+ *
+ * It is called on the thread which caused the event, possibly with
+ * library locks held: it must be quick and must not call back into
+ * the library.
+ *
+ * @param event the event
+ * @param elapsed_ns time taken by span events, 0 for the others
+ * @param value event specific value (see `git_trace_event_t`)
+ * @param payload the payload given to `git_trace_set`
+ */
+typedef void (*git_trace_cb)(
+	git_trace_event_t event,
+	uint64_t elapsed_ns,
+	size_t value,
+	void *payload);
+
+/**
+ * Aggregated metrics for an event
+ */
+typedef struct {
+	/** number of times the event happened */
+	uint64_t count;
+	/** sum of the event values */
+	uint64_t total_value;
+	/** largest event value seen */
+	uint64_t max_value;
+	/** total time spent in the event, for spans */
+	uint64_t total_ns;
+} git_trace_metric;
+
+/**
+ * Register a callback receiving every traced event.
+ *
+ * Only one callback can be registered at a time; registering a new
+ * one replaces the previous one.  Tracing has to be compiled in (see
+ * `GIT_CAP_TRACE`).
+ *
+ * @param callback the callback, or NULL to stop tracing
+ * @param payload payload passed to the callback
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_trace_set(git_trace_cb callback, void *payload);
+
+/**
+ * Enable or disable the built-in metrics registry.
+ *
+ * While enabled, every event is aggregated in a `git_trace_metric`
+ * which can be read with `git_trace_metrics_get`.  This works
+ * independently of the callback registered with `git_trace_set`.
+ *
+ * @param enabled non-zero to aggregate events, zero to stop
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_trace_metrics_enable(int enabled);
+
+/**
+ * Read the aggregated metrics for an event.
+ *
+ * @param out structure to fill
+ * @param event the event to look at
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_trace_metrics_get(
+	git_trace_metric *out,
+	git_trace_event_t event);
+
+/**
+ * Reset every aggregated metric to zero.
+ */
+GIT_EXTERN(void) git_trace_metrics_reset(void);
+
+/** @} */
+GIT_END_DECL
+#endif
@@ -221,6 +221,14 @@ GIT_EXTERN(void) git_treebuilder_clear(git_treebuilder *bld);
  */
 GIT_EXTERN(void) git_treebuilder_free(git_treebuilder *bld);
 
+/**
+ * Get the number of entries listed in a treebuilder
+ *
+ * @param bld a previously loaded treebuilder.
+ * @return the number of entries in the treebuilder
+ */
+GIT_EXTERN(unsigned int) git_treebuilder_entrycount(git_treebuilder *bld);
+
 /**
  * Get an entry from the builder from its filename
  *
@@ -125,6 +125,9 @@ typedef struct git_treebuilder git_treebuilder;
 /** Memory representation of an index file. */
 typedef struct git_index git_index;
 
+/** A filesystem monitor for a working directory */
+typedef struct git_fsmonitor git_fsmonitor;
+
 /** Memory representation of a set of config files */
 typedef struct git_config git_config;
 
@@ -140,6 +143,9 @@ typedef struct git_reflog git_reflog;
 /** Representation of a git note */
 typedef struct git_note git_note;
 
+/** A set of pending note changes to be written as a single commit */
+typedef struct git_note_batch git_note_batch;
+
 /** Representation of a git packbuilder */
 typedef struct git_packbuilder git_packbuilder;
 
@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#include "common.h"
+#include "global.h"
+#include "git2/alloc.h"
+
+static void *stdalloc__malloc(size_t len, void *payload)
+{
+	GIT_UNUSED(payload);
+	return malloc(len);
+}
+
+static void *stdalloc__realloc(void *ptr, size_t len, void *payload)
+{
+	GIT_UNUSED(payload);
+	return realloc(ptr, len);
+}
+
+static void stdalloc__free(void *ptr, void *payload)
+{
+	GIT_UNUSED(payload);
+	free(ptr);
+}
+
+git_allocator git__allocator = {
+	stdalloc__malloc, stdalloc__realloc, stdalloc__free, NULL
+};
+
+int git__alloc_stats_enabled;
+
+static git_alloc_stats alloc_stats[GIT_ALLOC__SUBSYSTEMS];
+
+GIT_INLINE(void) alloc_stats_add(size_t *counter, size_t value)
+{
+#if defined(GIT_THREADS) && defined(GIT_WIN32) && defined(_WIN64)
+	InterlockedExchangeAdd64((volatile LONG64 *)counter, (LONG64)value);
+#elif defined(GIT_THREADS) && defined(GIT_WIN32)
+	InterlockedExchangeAdd((volatile LONG *)counter, (LONG)value);
+#elif defined(GIT_THREADS) && defined(__GNUC__)
+	__sync_add_and_fetch(counter, value);
+#else
+	*counter += value;
+#endif
+}
+
+void git__alloc_stats_record(
+	git_alloc_subsystem_t subsystem, size_t len, const void *ptr)
+{
+	git_alloc_stats *stats = &alloc_stats[subsystem];
+
+	if (!ptr) {
+		alloc_stats_add(&stats->failures, 1);
+		return;
+	}
+
+	alloc_stats_add(&stats->allocations, 1);
+	alloc_stats_add(&stats->bytes, len);
+}
+
+int git_allocator_set(const git_allocator *allocator)
+{
+	if (allocator &&
+		(!allocator->gmalloc || !allocator->grealloc || !allocator->gfree)) {
+		giterr_set(GITERR_INVALID, "Incomplete allocator");
+		return -1;
+	}
+
+	/* Memory cached by the calling thread must go back where it came from */
+	git__global_state_release();
+
+	if (!allocator) {
+		git__allocator.gmalloc = stdalloc__malloc;
+		git__allocator.grealloc = stdalloc__realloc;
+		git__allocator.gfree = stdalloc__free;
+		git__allocator.payload = NULL;
+		return 0;
+	}
+
+	memcpy(&git__allocator, allocator, sizeof(git_allocator));
+	return 0;
+}
+
+void git_alloc_stats_enable(int enabled)
+{
+	git__alloc_stats_enabled = (enabled != 0);
+}
+
+int git_alloc_stats_get(
+	git_alloc_stats *out,
+	git_alloc_subsystem_t subsystem)
+{
+	assert(out);
+
+	if ((int)subsystem < 0 || subsystem >= GIT_ALLOC__SUBSYSTEMS) {
+		giterr_set(GITERR_INVALID, "Invalid allocation subsystem %d", subsystem);
+		return -1;
+	}
+
+	memcpy(out, &alloc_stats[subsystem], sizeof(git_alloc_stats));
+	return 0;
+}
+
+void git_alloc_stats_reset(void)
+{
+	memset(alloc_stats, 0, sizeof(alloc_stats));
+}
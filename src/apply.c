@@ -0,0 +1,1137 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "common.h"
+#include "buffer.h"
+#include "index.h"
+#include "vector.h"
+
+#include "git2/apply.h"
+#include "git2/blob.h"
+#include "git2/index.h"
+#include "git2/tree.h"
+
+/*
+ * The patch
+ */
+
+typedef struct {
+	char origin; /* ' ', '-' or '+' */
+	const char *content; /* with its newline, unless it has none */
+	size_t content_len;
+} apply_line;
+
+typedef struct {
+	size_t old_start, old_lines, new_start, new_lines;
+	size_t first_line, line_count; /* in the lines of the file's patch */
+} apply_hunk;
+
+/* The changes to one file */
+typedef struct {
+	char *old_path, *new_path;
+	unsigned int old_mode, new_mode; /* 0 if not given */
+	bool is_new, is_delete, is_rename, is_copy;
+
+	apply_hunk *hunks;
+	size_t hunk_count, hunk_alloc;
+	apply_line *lines;
+	size_t line_count, line_alloc;
+} apply_patch;
+
+static void apply_patch_free(apply_patch *patch)
+{
+	if (!patch)
+		return;
+
+	git__free(patch->old_path);
+	git__free(patch->new_path);
+	git__free(patch->hunks);
+	git__free(patch->lines);
+	git__free(patch);
+}
+
+/* Make room for one more item at the end of an array */
+static int apply_grow(void **items, size_t *alloc, size_t count, size_t item_size)
+{
+	size_t new_alloc;
+	void *new_items;
+
+	if (count < *alloc)
+		return 0;
+
+	new_alloc = *alloc ? *alloc * 2 : 8;
+	new_items = git__realloc(*items, new_alloc * item_size);
+	GITERR_CHECK_ALLOC(new_items);
+
+	*items = new_items;
+	*alloc = new_alloc;
+	return 0;
+}
+
+/* A path must stay in the tree */
+static bool apply_path_valid(const char *path, size_t len)
+{
+	const char *end = path + len, *next;
+
+	if (!len || *path == '/')
+		return false;
+
+	for (; path <= end; path = next + 1) {
+		size_t component;
+
+		next = memchr(path, '/', end - path);
+		if (!next)
+			next = end;
+
+		component = next - path;
+
+		if (!component ||
+			(component == 1 && path[0] == '.') ||
+			(component == 2 && !memcmp(path, "..", 2)) ||
+			(component == 4 && !strncasecmp(path, ".git", 4)))
+			return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * Parsing
+ */
+
+typedef struct {
+	const char *line, *end; /* the current line, and the end of the text */
+	size_t line_len; /* with its newline */
+	size_t line_num;
+} apply_parser;
+
+static void parse_measure(apply_parser *p)
+{
+	const char *newline = memchr(p->line, '\n', p->end - p->line);
+	p->line_len = newline ? (size_t)(newline - p->line + 1) : (size_t)(p->end - p->line);
+}
+
+static void parse_advance(apply_parser *p)
+{
+	p->line += p->line_len;
+	p->line_num++;
+	parse_measure(p);
+}
+
+GIT_INLINE(bool) parse_done(apply_parser *p)
+{
+	return p->line >= p->end;
+}
+
+GIT_INLINE(bool) parse_starts(apply_parser *p, const char *prefix)
+{
+	size_t len = strlen(prefix);
+	return p->line_len >= len && !memcmp(p->line, prefix, len);
+}
+
+/* The rest of the line after `prefix`, without its newline */
+static const char *parse_value(size_t *len, apply_parser *p, const char *prefix)
+{
+	size_t start = strlen(prefix);
+
+	*len = p->line_len - start;
+	if (*len && p->line[start + *len - 1] == '\n')
+		(*len)--;
+
+	return p->line + start;
+}
+
+static int parse_error(apply_parser *p, const char *message)
+{
+	giterr_set(GITERR_PATCH, "Corrupt patch at line %"PRIuZ": %s",
+		p->line_num + 1, message);
+	return -1;
+}
+
+static int parse_number(size_t *out, const char **scan, const char *end, int base)
+{
+	size_t n = 0;
+
+	if (*scan >= end || !git__isdigit(**scan))
+		return -1;
+
+	for (; *scan < end && git__isdigit(**scan); (*scan)++) {
+		if (**scan - '0' >= base || n > ((size_t)-1 - 9) / base)
+			return -1;
+		n = n * base + (**scan - '0');
+	}
+
+	*out = n;
+	return 0;
+}
+
+static int parse_mode(unsigned int *out, apply_parser *p, const char *value, size_t len)
+{
+	const char *scan = value, *end = value + len;
+	size_t mode;
+
+	if (parse_number(&mode, &scan, end, 8) < 0 || scan != end)
+		return parse_error(p, "invalid file mode");
+
+	*out = (unsigned int)mode;
+	return 0;
+}
+
+/*
+ * Take a path from the patch; strip its first component (the "a/" or
+ * "b/") if asked to.  `out` is left NULL for "/dev/null".
+ */
+static int parse_path(
+	char **out, apply_parser *p, const char *path, size_t len, bool strip)
+{
+	const char *tab, *slash;
+
+	/* traditional patches may have a timestamp after a tab */
+	if ((tab = memchr(path, '\t', len)) != NULL)
+		len = tab - path;
+
+	if (len == strlen("/dev/null") && !memcmp(path, "/dev/null", len))
+		return 0;
+
+	if (len && *path == '"')
+		return parse_error(p, "quoted paths are not supported");
+
+	if (strip) {
+		if ((slash = memchr(path, '/', len)) == NULL)
+			return parse_error(p, "the path has no directory to strip");
+
+		len -= slash + 1 - path;
+		path = slash + 1;
+	}
+
+	if (!apply_path_valid(path, len))
+		return parse_error(p, "invalid path");
+
+	git__free(*out);
+	*out = git__strndup(path, len);
+	GITERR_CHECK_ALLOC(*out);
+
+	return 0;
+}
+
+/*
+ * Find the path in "diff --git a/path b/path".  Paths with spaces make
+ * it ambiguous when they change, but then the other headers give them.
+ */
+static int parse_header_git_paths(apply_patch *patch, apply_parser *p)
+{
+	size_t len, i;
+	const char *names = parse_value(&len, p, "diff --git ");
+
+	for (i = 0; i < len; ++i) {
+		const char *a = names, *b = names + i + 1, *slash;
+		size_t a_len = i, b_len = len - i - 1;
+
+		if (names[i] != ' ')
+			continue;
+
+		if ((slash = memchr(a, '/', a_len)) == NULL)
+			break;
+		a_len -= slash + 1 - a;
+		a = slash + 1;
+
+		if ((slash = memchr(b, '/', b_len)) == NULL)
+			continue;
+		b_len -= slash + 1 - b;
+		b = slash + 1;
+
+		if (a_len == b_len && !memcmp(a, b, a_len))
+			return parse_path(&patch->old_path, p, a, a_len, false) < 0 ||
+				parse_path(&patch->new_path, p, b, b_len, false) < 0 ? -1 : 0;
+	}
+
+	return 0;
+}
+
+static int parse_header_git(apply_patch *patch, apply_parser *p)
+{
+	const char *value;
+	size_t len;
+	int error = 0;
+
+	if (parse_header_git_paths(patch, p) < 0)
+		return -1;
+
+	for (parse_advance(p); !parse_done(p) && !error; parse_advance(p)) {
+		if (parse_starts(p, "old mode ")) {
+			value = parse_value(&len, p, "old mode ");
+			error = parse_mode(&patch->old_mode, p, value, len);
+		} else if (parse_starts(p, "new mode ")) {
+			value = parse_value(&len, p, "new mode ");
+			error = parse_mode(&patch->new_mode, p, value, len);
+		} else if (parse_starts(p, "deleted file mode ")) {
+			patch->is_delete = true;
+			value = parse_value(&len, p, "deleted file mode ");
+			error = parse_mode(&patch->old_mode, p, value, len);
+		} else if (parse_starts(p, "new file mode ")) {
+			patch->is_new = true;
+			value = parse_value(&len, p, "new file mode ");
+			error = parse_mode(&patch->new_mode, p, value, len);
+		} else if (parse_starts(p, "index ")) {
+			const char *space;
+
+			/* the mode is there when it does not change */
+			value = parse_value(&len, p, "index ");
+			if ((space = memchr(value, ' ', len)) != NULL) {
+				len -= space + 1 - value;
+				if ((error = parse_mode(&patch->old_mode, p, space + 1, len)) == 0)
+					patch->new_mode = patch->old_mode;
+			}
+		} else if (parse_starts(p, "rename from ") || parse_starts(p, "copy from ")) {
+			patch->is_rename = (*p->line == 'r');
+			patch->is_copy = !patch->is_rename;
+			value = parse_value(&len, p, patch->is_rename ? "rename from " : "copy from ");
+			error = parse_path(&patch->old_path, p, value, len, false);
+		} else if (parse_starts(p, "rename to ") || parse_starts(p, "copy to ")) {
+			value = parse_value(&len, p, (*p->line == 'r') ? "rename to " : "copy to ");
+			error = parse_path(&patch->new_path, p, value, len, false);
+		} else if (parse_starts(p, "Binary files ") || parse_starts(p, "GIT binary patch")) {
+			giterr_set(GITERR_PATCH, "Binary patches are not supported");
+			return -1;
+		} else if (!parse_starts(p, "similarity index ") &&
+			!parse_starts(p, "dissimilarity index "))
+			break;
+	}
+
+	return error;
+}
+
+/* "start,lines" or "start" in a hunk header */
+static int parse_range(size_t *start, size_t *lines, const char **scan, const char *end)
+{
+	*lines = 1;
+
+	if (parse_number(start, scan, end, 10) < 0)
+		return -1;
+
+	if (*scan < end && **scan == ',') {
+		(*scan)++;
+		return parse_number(lines, scan, end, 10);
+	}
+
+	return 0;
+}
+
+static int parse_hunk_header(apply_hunk *hunk, apply_parser *p)
+{
+	const char *scan = p->line + strlen("@@ -"), *end = p->line + p->line_len;
+
+	if (parse_range(&hunk->old_start, &hunk->old_lines, &scan, end) < 0 ||
+		end - scan < 2 || memcmp(scan, " +", 2) != 0)
+		return parse_error(p, "invalid hunk header");
+
+	scan += 2;
+
+	if (parse_range(&hunk->new_start, &hunk->new_lines, &scan, end) < 0 ||
+		end - scan < 3 || memcmp(scan, " @@", 3) != 0 ||
+		(hunk->old_lines && !hunk->old_start))
+		return parse_error(p, "invalid hunk header");
+
+	return 0;
+}
+
+static int parse_hunk(apply_patch *patch, apply_parser *p)
+{
+	apply_hunk *hunk;
+	apply_line *line;
+	size_t old_left, new_left;
+
+	if (apply_grow((void **)&patch->hunks, &patch->hunk_alloc,
+			patch->hunk_count, sizeof(apply_hunk)) < 0)
+		return -1;
+
+	hunk = &patch->hunks[patch->hunk_count];
+	if (parse_hunk_header(hunk, p) < 0)
+		return -1;
+
+	hunk->first_line = patch->line_count;
+	hunk->line_count = 0;
+	old_left = hunk->old_lines;
+	new_left = hunk->new_lines;
+
+	for (parse_advance(p); old_left || new_left || parse_starts(p, "\\"); parse_advance(p)) {
+		char origin = parse_done(p) ? 0 : *p->line;
+
+		/* "\ No newline at end of file", about the line before */
+		if (origin == '\\') {
+			if (!hunk->line_count)
+				return parse_error(p, "unexpected end of file marker");
+
+			line = &patch->lines[patch->line_count - 1];
+			if (line->content_len && line->content[line->content_len - 1] == '\n')
+				line->content_len--;
+			continue;
+		}
+
+		/* some tools strip the space of empty context lines */
+		if (origin == '\n')
+			origin = ' ';
+
+		if ((origin == ' ' && (!old_left || !new_left)) ||
+			(origin == '-' && !old_left) ||
+			(origin == '+' && !new_left) ||
+			(origin != ' ' && origin != '-' && origin != '+'))
+			return parse_error(p, "the hunk does not have the lines it says");
+
+		if (origin != '+')
+			old_left--;
+		if (origin != '-')
+			new_left--;
+
+		if (apply_grow((void **)&patch->lines, &patch->line_alloc,
+				patch->line_count, sizeof(apply_line)) < 0)
+			return -1;
+
+		line = &patch->lines[patch->line_count++];
+		line->origin = origin;
+		line->content = (*p->line == '\n') ? p->line : p->line + 1;
+		line->content_len = (*p->line == '\n') ? 1 : p->line_len - 1;
+		hunk->line_count++;
+	}
+
+	patch->hunk_count++;
+	return 0;
+}
+
+/* The "---" and "+++" lines, and the hunks after them */
+static int parse_body(apply_patch *patch, apply_parser *p)
+{
+	char *old_path = NULL, *new_path = NULL;
+	const char *value;
+	size_t len;
+	int error = 0;
+
+	if (parse_starts(p, "--- ")) {
+		value = parse_value(&len, p, "--- ");
+		if ((error = parse_path(&old_path, p, value, len, true)) < 0)
+			goto cleanup;
+
+		parse_advance(p);
+		if (!parse_starts(p, "+++ ")) {
+			error = parse_error(p, "expected the \"+++\" line");
+			goto cleanup;
+		}
+
+		value = parse_value(&len, p, "+++ ");
+		if ((error = parse_path(&new_path, p, value, len, true)) < 0)
+			goto cleanup;
+
+		parse_advance(p);
+
+		if (!old_path)
+			patch->is_new = true;
+		else {
+			git__free(patch->old_path);
+			patch->old_path = old_path;
+			old_path = NULL;
+		}
+
+		if (!new_path)
+			patch->is_delete = true;
+		else {
+			git__free(patch->new_path);
+			patch->new_path = new_path;
+			new_path = NULL;
+		}
+	}
+
+	while (!error && parse_starts(p, "@@ -"))
+		error = parse_hunk(patch, p);
+
+	if (error < 0)
+		goto cleanup;
+
+	if ((!patch->is_new && !patch->old_path) ||
+		(!patch->is_delete && !patch->new_path) ||
+		(patch->is_new && patch->is_delete))
+		error = parse_error(p, "cannot tell which file is patched");
+
+cleanup:
+	git__free(old_path);
+	git__free(new_path);
+	return error;
+}
+
+static int parse_patches(git_vector *patches, const char *text, size_t len)
+{
+	apply_parser p;
+	apply_patch *patch;
+	int error = 0;
+
+	memset(&p, 0, sizeof(p));
+	p.line = text;
+	p.end = text + len;
+	parse_measure(&p);
+
+	while (!parse_done(&p) && !error) {
+		bool is_git = parse_starts(&p, "diff --git ");
+
+		/* skip what is around the patches, like a commit message */
+		if (!is_git && (!parse_starts(&p, "--- ") ||
+			p.end - (p.line + p.line_len) < 4 ||
+			memcmp(p.line + p.line_len, "+++ ", 4))) {
+			parse_advance(&p);
+			continue;
+		}
+
+		patch = git__calloc(1, sizeof(apply_patch));
+		GITERR_CHECK_ALLOC(patch);
+
+		if ((error = git_vector_insert(patches, patch)) < 0) {
+			apply_patch_free(patch);
+			break;
+		}
+
+		if (is_git)
+			error = parse_header_git(patch, &p);
+
+		if (!error)
+			error = parse_body(patch, &p);
+	}
+
+	if (!error && !patches->length) {
+		giterr_set(GITERR_PATCH, "No patch found");
+		error = -1;
+	}
+
+	return error;
+}
+
+
+/*
+ * Applying the hunks to a file
+ */
+
+/* The lines of the file being patched */
+typedef struct {
+	const char *data;
+	size_t *start; /* of each line, then the end of the data */
+	size_t count;
+} apply_image;
+
+static int apply_image_init(apply_image *img, const char *data, size_t size)
+{
+	const char *scan, *end = data + size;
+	size_t n;
+
+	memset(img, 0, sizeof(*img));
+	img->data = data;
+
+	for (scan = data, n = 0; scan < end; n++) {
+		scan = memchr(scan, '\n', end - scan);
+		scan = scan ? scan + 1 : end;
+	}
+
+	img->start = git__malloc((n + 1) * sizeof(size_t));
+	GITERR_CHECK_ALLOC(img->start);
+
+	for (scan = data, n = 0; scan < end; n++) {
+		img->start[n] = scan - data;
+		scan = memchr(scan, '\n', end - scan);
+		scan = scan ? scan + 1 : end;
+	}
+
+	img->start[n] = size;
+	img->count = n;
+
+	return 0;
+}
+
+/* Whether the lines are in the image at `at` */
+static bool apply_image_matches(
+	apply_image *img, size_t at, const apply_line **lines, size_t count)
+{
+	size_t i;
+
+	for (i = 0; i < count; ++i) {
+		size_t len = img->start[at + i + 1] - img->start[at + i];
+
+		if (len != lines[i]->content_len ||
+			memcmp(img->data + img->start[at + i], lines[i]->content, len) != 0)
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Find the lines in the image, at `expected` or as near as possible,
+ * not before `pos`; or only at its beginning or at its end.
+ */
+static bool apply_image_find(
+	size_t *at, apply_image *img, const apply_line **lines, size_t count,
+	size_t pos, size_t expected, bool match_beginning, bool match_end)
+{
+	size_t last, distance;
+
+	if (count > img->count || pos > img->count - count)
+		return false;
+
+	last = img->count - count;
+
+	if (match_beginning || match_end) {
+		*at = match_beginning ? 0 : last;
+		return *at >= pos && (!match_beginning || !match_end || !last) &&
+			apply_image_matches(img, *at, lines, count);
+	}
+
+	if (expected > last)
+		expected = last;
+	if (expected < pos)
+		expected = pos;
+
+	for (distance = 0; expected + distance <= last || expected - pos >= distance; ++distance) {
+		if (expected + distance <= last &&
+			apply_image_matches(img, expected + distance, lines, count)) {
+			*at = expected + distance;
+			return true;
+		}
+
+		if (distance && expected - pos >= distance &&
+			apply_image_matches(img, expected - distance, lines, count)) {
+			*at = expected - distance;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static int apply_hunks(
+	git_buf *out, apply_patch *patch, const char *path,
+	const char *source, size_t source_len, unsigned int fuzz)
+{
+	apply_image img;
+	const apply_line **old = NULL, **new = NULL;
+	size_t pos = 0, last_at = 0, last_start = 0, i, k;
+	int error = 0;
+
+	if (apply_image_init(&img, source, source_len) < 0)
+		return -1;
+
+	old = git__malloc((patch->line_count + 1) * sizeof(apply_line *));
+	new = git__malloc((patch->line_count + 1) * sizeof(apply_line *));
+	if (!old || !new) {
+		error = -1;
+		goto cleanup;
+	}
+
+	for (i = 0; i < patch->hunk_count; ++i) {
+		apply_hunk *hunk = &patch->hunks[i];
+		apply_line *lines = &patch->lines[hunk->first_line];
+		size_t old_count = 0, new_count = 0, leading, trailing, lead, trail;
+		size_t start, expected, at;
+		bool match_beginning, match_end;
+
+		for (k = 0; k < hunk->line_count; ++k) {
+			if (lines[k].origin != '+')
+				old[old_count++] = &lines[k];
+			if (lines[k].origin != '-')
+				new[new_count++] = &lines[k];
+		}
+
+		for (leading = 0; leading < hunk->line_count &&
+			lines[leading].origin == ' '; leading++)
+			/* count them */;
+
+		for (trailing = 0; trailing < hunk->line_count - leading &&
+			lines[hunk->line_count - 1 - trailing].origin == ' '; trailing++)
+			/* count them */;
+
+		/* where the hunk says it is, moved like the hunk before */
+		start = hunk->old_lines ? hunk->old_start - 1 : hunk->old_start;
+		expected = (start + last_at >= last_start) ? start + last_at - last_start : 0;
+
+		/* the context says whether the hunk is at an end of the file */
+		match_beginning = (leading || trailing) && hunk->old_start <= 1;
+		match_end = (leading || trailing) && !trailing;
+
+		for (lead = leading, trail = trailing; ; ) {
+			size_t skipped = leading - lead;
+
+			if (apply_image_find(&at, &img, old + skipped,
+					old_count - skipped - (trailing - trail),
+					pos, expected + skipped, match_beginning, match_end))
+				break;
+
+			if (!fuzz) {
+				error = -1;
+				break;
+			}
+
+			/* with fuzz, ignore where the hunk is, then some context */
+			if (match_beginning || match_end) {
+				match_beginning = match_end = false;
+				continue;
+			}
+
+			if ((!lead || leading - lead >= fuzz) &&
+				(!trail || trailing - trail >= fuzz)) {
+				error = -1;
+				break;
+			}
+
+			if (lead && leading - lead < fuzz)
+				lead--;
+			if (trail && trailing - trail < fuzz)
+				trail--;
+		}
+
+		if (error < 0) {
+			giterr_set(GITERR_PATCH, "Hunk %"PRIuZ" does not apply to '%s'", i + 1, path);
+			goto cleanup;
+		}
+
+		git_buf_put(out, img.data + img.start[pos], img.start[at] - img.start[pos]);
+
+		for (k = leading - lead; k < new_count - (trailing - trail); ++k)
+			git_buf_put(out, new[k]->content, new[k]->content_len);
+
+		pos = at + old_count - (leading - lead) - (trailing - trail);
+		last_at = at - (leading - lead);
+		last_start = start;
+	}
+
+	git_buf_put(out, img.data + img.start[pos], img.start[img.count] - img.start[pos]);
+
+	if (git_buf_oom(out))
+		error = -1;
+
+cleanup:
+	git__free(old);
+	git__free(new);
+	git__free(img.start);
+	return error;
+}
+
+
+/*
+ * Applying the patches
+ */
+
+/* A file as the patches leave it */
+typedef struct {
+	char *path;
+	git_oid id;
+	unsigned int mode; /* 0 when the file is removed */
+	git_off_t size;
+	size_t order;
+} apply_change;
+
+typedef struct {
+	git_repository *repo;
+	git_tree *tree; /* what the patches apply to: a tree, */
+	git_index *index; /* or an index */
+	unsigned int fuzz;
+	git_vector changes; /* in the order of the patches */
+} apply_ctx;
+
+static int apply_change_cmp(const void *a, const void *b)
+{
+	const apply_change *ca = a, *cb = b;
+	int cmp = strcmp(ca->path, cb->path);
+
+	if (cmp)
+		return cmp;
+
+	return (ca->order < cb->order) ? -1 : (ca->order > cb->order);
+}
+
+static int apply_change_add(
+	apply_ctx *ctx, const char *path, const git_oid *id, unsigned int mode, git_off_t size)
+{
+	apply_change *change = git__calloc(1, sizeof(apply_change));
+	GITERR_CHECK_ALLOC(change);
+
+	if ((change->path = git__strdup(path)) == NULL) {
+		git__free(change);
+		return -1;
+	}
+
+	if (id)
+		git_oid_cpy(&change->id, id);
+	change->mode = mode;
+	change->size = size;
+	change->order = ctx->changes.length;
+
+	if (git_vector_insert(&ctx->changes, change) < 0) {
+		git__free(change->path);
+		git__free(change);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Find a file as the patches so far left it; GIT_ENOTFOUND if none */
+static int apply_find_file(
+	git_oid *id, unsigned int *mode, git_off_t *size, apply_ctx *ctx, const char *path)
+{
+	apply_change *change;
+	size_t i = ctx->changes.length;
+
+	while (i-- > 0) {
+		change = git_vector_get(&ctx->changes, i);
+
+		if (!strcmp(change->path, path)) {
+			if (!change->mode)
+				return GIT_ENOTFOUND;
+
+			git_oid_cpy(id, &change->id);
+			*mode = change->mode;
+			*size = change->size;
+			return 0;
+		}
+	}
+
+	if (ctx->tree) {
+		git_tree_entry *entry;
+		int error = git_tree_entry_bypath(&entry, ctx->tree, path);
+
+		if (error == GIT_ENOTFOUND)
+			giterr_clear();
+		if (error < 0)
+			return error;
+
+		git_oid_cpy(id, git_tree_entry_id(entry));
+		*mode = git_tree_entry_filemode(entry);
+		*size = 0;
+
+		git_tree_entry_free(entry);
+	} else {
+		const git_index_entry *entry = git_index_get_bypath(ctx->index, path, 0);
+
+		if (!entry)
+			return GIT_ENOTFOUND;
+
+		git_oid_cpy(id, &entry->oid);
+		*mode = entry->mode;
+		*size = entry->file_size;
+	}
+
+	return 0;
+}
+
+/* Fail if the file is there; `what` says how the patch creates it */
+static int apply_check_absent(apply_ctx *ctx, const char *path, const char *what)
+{
+	git_oid id;
+	unsigned int mode;
+	git_off_t size;
+	int error = apply_find_file(&id, &mode, &size, ctx, path);
+
+	if (!error) {
+		giterr_set(GITERR_PATCH, "Cannot %s '%s': it already exists", what, path);
+		return GIT_EEXISTS;
+	}
+
+	return (error == GIT_ENOTFOUND) ? 0 : error;
+}
+
+GIT_INLINE(unsigned int) apply_normalize_mode(unsigned int mode)
+{
+	if (S_ISLNK(mode))
+		return GIT_FILEMODE_LINK;
+
+	return (mode & 0100) ? GIT_FILEMODE_BLOB_EXECUTABLE : GIT_FILEMODE_BLOB;
+}
+
+static int apply_patch_file(apply_ctx *ctx, apply_patch *patch)
+{
+	const char *path = patch->is_new ? patch->new_path : patch->old_path;
+	git_buf result = GIT_BUF_INIT;
+	git_blob *blob = NULL;
+	git_oid id;
+	unsigned int mode = 0;
+	git_off_t size = 0;
+	int error;
+
+	if (patch->is_new) {
+		if ((error = apply_check_absent(ctx, path, "create")) < 0)
+			return error;
+	} else {
+		error = apply_find_file(&id, &mode, &size, ctx, path);
+
+		if (error == GIT_ENOTFOUND)
+			giterr_set(GITERR_PATCH, "Cannot patch '%s': it does not exist", path);
+		else if (!error && !S_ISREG(mode) && !S_ISLNK(mode)) {
+			giterr_set(GITERR_PATCH, "Cannot patch '%s': it is not a file", path);
+			error = -1;
+		}
+
+		if (error < 0)
+			return error;
+	}
+
+	if ((patch->is_rename || patch->is_copy) && strcmp(patch->old_path, patch->new_path) &&
+		(error = apply_check_absent(ctx, patch->new_path,
+			patch->is_rename ? "rename to" : "copy to")) < 0)
+		return error;
+
+	if (patch->hunk_count || patch->is_new) {
+		const char *data = "";
+		size_t data_len = 0;
+
+		if (!patch->is_new) {
+			if ((error = git_blob_lookup(&blob, ctx->repo, &id)) < 0)
+				return error;
+
+			data = git_blob_rawcontent(blob);
+			data_len = (size_t)git_blob_rawsize(blob);
+		}
+
+		if ((error = apply_hunks(&result, patch, path, data, data_len, ctx->fuzz)) < 0)
+			goto cleanup;
+
+		if (patch->is_delete && result.size > 0) {
+			giterr_set(GITERR_PATCH,
+				"Cannot delete '%s': the patch does not remove all of it", path);
+			error = -1;
+			goto cleanup;
+		}
+
+		if (!patch->is_delete &&
+			(error = git_blob_create_frombuffer(&id, ctx->repo, result.ptr, result.size)) < 0)
+			goto cleanup;
+
+		size = result.size;
+	}
+
+	if (patch->new_mode)
+		mode = patch->new_mode;
+	mode = apply_normalize_mode(mode);
+
+	/* a renamed file is no longer at its old path */
+	if (patch->is_delete || (patch->is_rename && strcmp(patch->old_path, patch->new_path)))
+		error = apply_change_add(ctx, patch->old_path, NULL, 0, 0);
+
+	if (!error && !patch->is_delete)
+		error = apply_change_add(ctx, patch->new_path, &id, mode, size);
+
+cleanup:
+	git_buf_free(&result);
+	git_blob_free(blob);
+	return error;
+}
+
+/*
+ * Write the tree with the changes, which all are under `prefix_len`
+ * bytes of their paths, to `tree`; `out` is zero if it ends up empty.
+ */
+static int apply_write_tree(
+	git_oid *out, apply_ctx *ctx, git_tree *tree,
+	apply_change **changes, size_t count, size_t prefix_len)
+{
+	git_treebuilder *builder;
+	git_buf name = GIT_BUF_INIT;
+	size_t i, j;
+	int error;
+
+	memset(out, 0, sizeof(git_oid));
+
+	if ((error = git_treebuilder_create(&builder, tree)) < 0)
+		return error;
+
+	for (i = 0; i < count && !error; i = j) {
+		const char *path = changes[i]->path + prefix_len, *slash;
+		const git_tree_entry *entry;
+		git_tree *subtree = NULL;
+		git_oid subtree_id;
+
+		if ((slash = strchr(path, '/')) == NULL) {
+			j = i + 1;
+
+			if (changes[i]->mode)
+				error = git_treebuilder_insert(NULL, builder, path,
+					&changes[i]->id, changes[i]->mode);
+			else if (git_treebuilder_get(builder, path) != NULL)
+				error = git_treebuilder_remove(builder, path);
+
+			continue;
+		}
+
+		/* the changes in the same directory are next to each other */
+		for (j = i + 1; j < count &&
+			!strncmp(changes[j]->path + prefix_len, path, slash - path + 1); ++j)
+			/* find the end */;
+
+		git_buf_set(&name, path, slash - path);
+		if ((error = git_buf_oom(&name) ? -1 : 0) < 0)
+			break;
+
+		if ((entry = git_treebuilder_get(builder, name.ptr)) != NULL) {
+			if (git_tree_entry_type(entry) != GIT_OBJ_TREE) {
+				giterr_set(GITERR_PATCH,
+					"Cannot patch '%s': '%s' is not a directory", changes[i]->path, name.ptr);
+				error = -1;
+				break;
+			}
+
+			if ((error = git_tree_lookup(&subtree, ctx->repo, git_tree_entry_id(entry))) < 0)
+				break;
+		}
+
+		error = apply_write_tree(&subtree_id, ctx, subtree,
+			changes + i, j - i, prefix_len + (slash - path) + 1);
+		git_tree_free(subtree);
+
+		if (error < 0)
+			break;
+
+		if (!git_oid_iszero(&subtree_id))
+			error = git_treebuilder_insert(NULL, builder, name.ptr,
+				&subtree_id, GIT_FILEMODE_TREE);
+		else if (entry != NULL)
+			error = git_treebuilder_remove(builder, name.ptr);
+	}
+
+	if (!error && (!prefix_len || git_treebuilder_entrycount(builder) > 0))
+		error = git_treebuilder_write(out, ctx->repo, builder);
+
+	git_buf_free(&name);
+	git_treebuilder_free(builder);
+	return error;
+}
+
+/* Sort the changes by path, keeping only the last one of each file */
+static void apply_sort_changes(apply_ctx *ctx)
+{
+	apply_change *change, *next;
+	size_t i, kept = 0;
+
+	git_vector_sort(&ctx->changes);
+
+	git_vector_foreach(&ctx->changes, i, change) {
+		next = git_vector_get(&ctx->changes, i + 1);
+
+		if (next && !strcmp(next->path, change->path)) {
+			git__free(change->path);
+			git__free(change);
+		} else
+			ctx->changes.contents[kept++] = change;
+	}
+
+	ctx->changes.length = kept;
+}
+
+static int apply_ctx_run(
+	apply_ctx *ctx, git_repository *repo, const char *patch, size_t patch_len,
+	const git_apply_opts *opts)
+{
+	git_vector patches = GIT_VECTOR_INIT;
+	apply_patch *p;
+	size_t i;
+	int error;
+
+	ctx->repo = repo;
+	ctx->fuzz = opts ? opts->fuzz : 0;
+
+	if ((error = git_vector_init(&ctx->changes, 16, apply_change_cmp)) < 0)
+		return error;
+
+	if ((error = parse_patches(&patches, patch, patch_len)) == 0) {
+		git_vector_foreach(&patches, i, p) {
+			if ((error = apply_patch_file(ctx, p)) < 0)
+				break;
+		}
+	}
+
+	git_vector_foreach(&patches, i, p)
+		apply_patch_free(p);
+	git_vector_free(&patches);
+
+	if (!error)
+		apply_sort_changes(ctx);
+
+	return error;
+}
+
+static void apply_ctx_free(apply_ctx *ctx)
+{
+	apply_change *change;
+	size_t i;
+
+	git_vector_foreach(&ctx->changes, i, change) {
+		git__free(change->path);
+		git__free(change);
+	}
+
+	git_vector_free(&ctx->changes);
+}
+
+int git_apply_to_tree(
+	git_oid *out,
+	git_repository *repo,
+	git_tree *preimage,
+	const char *patch,
+	size_t patch_len,
+	const git_apply_opts *opts)
+{
+	apply_ctx ctx;
+	int error;
+
+	assert(out && repo && preimage && patch);
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.tree = preimage;
+
+	if ((error = apply_ctx_run(&ctx, repo, patch, patch_len, opts)) == 0)
+		error = apply_write_tree(out, &ctx, preimage,
+			(apply_change **)ctx.changes.contents, ctx.changes.length, 0);
+
+	apply_ctx_free(&ctx);
+	return error;
+}
+
+int git_apply_to_index(
+	git_repository *repo,
+	git_index *index,
+	const char *patch,
+	size_t patch_len,
+	const git_apply_opts *opts)
+{
+	apply_ctx ctx;
+	apply_change *change;
+	git_index_entry *entries = NULL;
+	size_t i;
+	int error;
+
+	assert(repo && index && patch);
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.index = index;
+
+	if ((error = apply_ctx_run(&ctx, repo, patch, patch_len, opts)) < 0)
+		goto cleanup;
+
+	if ((entries = git__calloc(ctx.changes.length ? ctx.changes.length : 1,
+			sizeof(git_index_entry))) == NULL) {
+		error = -1;
+		goto cleanup;
+	}
+
+	/* the contents changed: nothing is known of the working files */
+	git_vector_foreach(&ctx.changes, i, change) {
+		entries[i].path = change->path;
+		entries[i].mode = change->mode;
+		entries[i].file_size = change->size;
+		git_oid_cpy(&entries[i].oid, &change->id);
+	}
+
+	error = git_index__update(index, entries, ctx.changes.length);
+
+cleanup:
+	git__free(entries);
+	apply_ctx_free(&ctx);
+	return error;
+}
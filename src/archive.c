@@ -0,0 +1,1139 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include <zlib.h>
+
+#include "common.h"
+#include "repository.h"
+#include "odb.h"
+#include "tree.h"
+#include "attr.h"
+#include "pool.h"
+#include "thread-utils.h"
+
+#include "git2/archive.h"
+#include "git2/attr.h"
+#include "git2/blob.h"
+#include "git2/odb_backend.h"
+
+/* blobs this large are streamed by the writer instead of read ahead */
+#define ARCHIVE_STREAM_MIN (512 * 1024)
+
+/* how many entries each reader may be ahead of the writer */
+#define ARCHIVE_LOOKAHEAD 8
+
+/* the callback is given pieces of about this size */
+#define ARCHIVE_CHUNK (64 * 1024)
+
+#define TAR_BLOCK 512
+#define TAR_RECORD (20 * TAR_BLOCK)
+#define TAR_UMASK 002
+
+#define ZIP_LOCAL_HEADER 0x04034b50
+#define ZIP_DATA_DESCRIPTOR 0x08074b50
+#define ZIP_CENTRAL_HEADER 0x02014b50
+#define ZIP_END 0x06054b50
+#define ZIP_UNIX_VERSION ((3 << 8) | 20)
+#define ZIP_FLAG_DESCRIPTOR (1 << 3)
+#define ZIP_FLAG_UTF8 (1 << 11)
+#define ZIP_STORED 0
+#define ZIP_DEFLATED 8
+
+typedef struct {
+	const char *path; /* in the archive, with a slash after directories */
+	git_oid oid;
+	unsigned int mode;
+
+	/* set by whichever thread reads the blob */
+	bool loaded;
+	bool stream; /* left for the writer to stream */
+	int error;
+	git_odb_object *object;
+	size_t size;
+} archive_entry;
+
+typedef struct {
+	git_repository *repo;
+	git_odb *odb;
+	git_archive_format_t format;
+	unsigned int flags;
+	const char *prefix;
+	git_time_t mtime;
+	git_archive_write_cb write_cb;
+	void *payload;
+
+	git_pool paths;
+	git_vector entries;
+
+	/* where export-ignore comes from, in order of precedence */
+	git_attr_file *info_attrs;
+	git_vector attrs; /* of the directories being walked, root first */
+
+	/* the readers take entries in order, up to `lookahead` entries
+	 * after the one the writer is at */
+	git_mutex lock;
+	git_cond work, done;
+	size_t next, current, lookahead;
+	bool stop;
+	git_thread *threads;
+	unsigned int nthreads, started;
+
+	git_buf out;
+	git_off_t offset; /* of the end of `out` in the archive */
+	char *chunk; /* for streamed blobs */
+
+	git_buf central; /* the zip central directory */
+	size_t zip_entries;
+	z_stream zs;
+	bool deflating;
+} archive;
+
+static int archive_flush(archive *a)
+{
+	if (a->out.size > 0 && a->write_cb(a->out.ptr, a->out.size, a->payload)) {
+		giterr_clear();
+		return GIT_EUSER;
+	}
+
+	git_buf_clear(&a->out);
+	return 0;
+}
+
+static int archive_write(archive *a, const void *data, size_t len)
+{
+	if (a->out.size + len > ARCHIVE_CHUNK && archive_flush(a) < 0)
+		return GIT_EUSER;
+
+	a->offset += len;
+
+	/* no need to copy what fills a piece on its own */
+	if (len >= ARCHIVE_CHUNK) {
+		if (a->write_cb(data, len, a->payload)) {
+			giterr_clear();
+			return GIT_EUSER;
+		}
+		return 0;
+	}
+
+	return git_buf_put(&a->out, data, len);
+}
+
+static int archive_zeros(archive *a, size_t len)
+{
+	static const char zeros[TAR_BLOCK];
+	int error = 0;
+
+	while (len > 0 && !error) {
+		size_t n = min(len, sizeof(zeros));
+		error = archive_write(a, zeros, n);
+		len -= n;
+	}
+
+	return error;
+}
+
+
+/*
+ * Reading the blobs
+ */
+
+static void archive_read(archive *a, archive_entry *e)
+{
+	git_otype type;
+	int error;
+
+	if ((error = git_odb_read_header(&e->size, &type, a->odb, &e->oid)) < 0)
+		goto done;
+
+	if (type != GIT_OBJ_BLOB) {
+		giterr_set(GITERR_INVALID, "Failed to archive '%s'. Not a blob", e->path);
+		error = -1;
+	}
+	/* symlinks go in the header, whatever their size */
+	else if (e->size >= ARCHIVE_STREAM_MIN && !S_ISLNK(e->mode))
+		e->stream = true;
+	else
+		error = git_odb_read(&e->object, a->odb, &e->oid);
+
+done:
+	e->error = error;
+}
+
+#ifdef GIT_THREADS
+static void *archive_reader(void *payload)
+{
+	archive *a = payload;
+	archive_entry *e;
+
+	git_mutex_lock(&a->lock);
+
+	while (!a->stop && a->next < a->entries.length) {
+		if (a->next >= a->current + a->lookahead) {
+			git_cond_wait(&a->work, &a->lock);
+			continue;
+		}
+
+		e = git_vector_get(&a->entries, a->next++);
+		if (e->loaded)
+			continue;
+
+		git_mutex_unlock(&a->lock);
+		archive_read(a, e);
+		giterr_clear();
+		git_mutex_lock(&a->lock);
+
+		e->loaded = true;
+		git_cond_broadcast(&a->done);
+	}
+
+	git_mutex_unlock(&a->lock);
+	return NULL;
+}
+#endif
+
+static int archive_start_readers(archive *a)
+{
+#ifdef GIT_THREADS
+	/* a thread is not worth it for a few blobs */
+	if (a->nthreads < 2 || a->entries.length < 16)
+		return 0;
+
+	a->lookahead = a->nthreads * ARCHIVE_LOOKAHEAD;
+
+	a->threads = git__calloc(a->nthreads, sizeof(git_thread));
+	GITERR_CHECK_ALLOC(a->threads);
+
+	for (; a->started < a->nthreads; a->started++) {
+		if (git_thread_create(&a->threads[a->started], NULL, archive_reader, a) != 0) {
+			giterr_set(GITERR_THREAD, "Unable to create archive reader thread");
+			return -1;
+		}
+	}
+#else
+	GIT_UNUSED(a);
+#endif
+
+	return 0;
+}
+
+static void archive_stop_readers(archive *a)
+{
+	unsigned int i;
+
+	if (!a->started)
+		return;
+
+	git_mutex_lock(&a->lock);
+	a->stop = true;
+	git_cond_broadcast(&a->work);
+	git_mutex_unlock(&a->lock);
+
+	for (i = 0; i < a->started; ++i)
+		git_thread_join(a->threads[i], NULL);
+
+	a->started = 0;
+}
+
+/* Get entry `i` for the writer, reading it unless a reader has */
+static int archive_take(archive *a, size_t i, archive_entry *e)
+{
+	bool mine;
+
+	git_mutex_lock(&a->lock);
+
+	a->current = i;
+	git_cond_broadcast(&a->work);
+
+	if ((mine = (a->next <= i)) == true)
+		a->next = i + 1;
+	else
+		while (!e->loaded)
+			git_cond_wait(&a->done, &a->lock);
+
+	git_mutex_unlock(&a->lock);
+
+	if (mine && !e->loaded)
+		archive_read(a, e);
+	/* errors are raised again here, where they can be reported */
+	else if (e->error < 0)
+		archive_read(a, e);
+
+	return e->error;
+}
+
+
+/*
+ * tar
+ */
+
+struct tar_header {
+	char name[100];
+	char mode[8];
+	char uid[8];
+	char gid[8];
+	char size[12];
+	char mtime[12];
+	char chksum[8];
+	char typeflag;
+	char linkname[100];
+	char magic[6];
+	char version[2];
+	char uname[32];
+	char gname[32];
+	char devmajor[8];
+	char devminor[8];
+	char prefix[155];
+	char padding[12];
+};
+
+/* Fill a field with octal digits and a terminating NUL */
+static bool tar_octal(char *field, size_t width, uint64_t value)
+{
+	size_t i = width - 1;
+
+	field[i] = '\0';
+
+	while (i > 0) {
+		field[--i] = '0' + (value & 7);
+		value >>= 3;
+	}
+
+	return (value == 0);
+}
+
+static void tar_ext_record(git_buf *ext, const char *key, const char *value, size_t len)
+{
+	size_t total = 1 + 1 + strlen(key) + 1 + len + 1, scale;
+
+	/* the length of the record counts its own digits */
+	for (scale = 1; total / 10 >= scale; scale *= 10)
+		total++;
+
+	git_buf_printf(ext, "%"PRIuZ" %s=", total, key);
+	git_buf_put(ext, value, len);
+	git_buf_putc(ext, '\n');
+}
+
+static int tar_pad(archive *a)
+{
+	size_t tail = (size_t)(a->offset % TAR_BLOCK);
+	return tail ? archive_zeros(a, TAR_BLOCK - tail) : 0;
+}
+
+static int tar_write_header(archive *a, struct tar_header *header)
+{
+	unsigned char *bytes = (unsigned char *)header;
+	unsigned int sum = 0;
+	size_t i;
+
+	memset(header->chksum, ' ', sizeof(header->chksum));
+	for (i = 0; i < sizeof(*header); ++i)
+		sum += bytes[i];
+	tar_octal(header->chksum, sizeof(header->chksum), sum);
+
+	return archive_write(a, header, sizeof(*header));
+}
+
+static void tar_prepare(
+	archive *a, struct tar_header *header, unsigned int mode, uint64_t size)
+{
+	memset(header, 0, sizeof(*header));
+
+	tar_octal(header->mode, sizeof(header->mode), mode & 07777);
+	tar_octal(header->uid, sizeof(header->uid), 0);
+	tar_octal(header->gid, sizeof(header->gid), 0);
+	tar_octal(header->mtime, sizeof(header->mtime), (uint64_t)a->mtime);
+	tar_octal(header->devmajor, sizeof(header->devmajor), 0);
+	tar_octal(header->devminor, sizeof(header->devminor), 0);
+
+	/* too large for the field; the extended header has it */
+	if (!tar_octal(header->size, sizeof(header->size), size))
+		tar_octal(header->size, sizeof(header->size), 0);
+
+	memcpy(header->magic, "ustar", 6);
+	memcpy(header->version, "00", 2);
+	strcpy(header->uname, "root");
+	strcpy(header->gname, "root");
+}
+
+/* The last slash by which `path` can be split into the prefix field */
+static size_t tar_split(const char *path, size_t len)
+{
+	size_t i = min(len - 1, sizeof(((struct tar_header *)0)->prefix));
+
+	while (i > 0 && path[i] != '/')
+		i--;
+
+	return i;
+}
+
+static int tar_entry(archive *a, archive_entry *e, const char *link, size_t link_len)
+{
+	struct tar_header header;
+	git_buf ext = GIT_BUF_INIT;
+	unsigned int mode;
+	size_t len = strlen(e->path), split;
+	char hex[GIT_OID_HEXSZ + 1];
+	int error = 0;
+
+	git_oid_tostr(hex, sizeof(hex), &e->oid);
+
+	if (S_ISDIR(e->mode) || S_ISGITLINK(e->mode))
+		mode = 040777;
+	else if (S_ISLNK(e->mode))
+		mode = 0120777;
+	else
+		mode = 0100666 | (e->mode & 0111);
+
+	if (!S_ISLNK(mode))
+		mode &= ~TAR_UMASK;
+
+	tar_prepare(a, &header, mode,
+		(S_ISDIR(mode) || S_ISLNK(mode)) ? 0 : e->size);
+
+	header.typeflag = S_ISDIR(mode) ? '5' : S_ISLNK(mode) ? '2' : '0';
+
+	if (len <= sizeof(header.name))
+		memcpy(header.name, e->path, len);
+	else if ((split = tar_split(e->path, len)) > 0 &&
+		len - split - 1 <= sizeof(header.name)) {
+		memcpy(header.prefix, e->path, split);
+		memcpy(header.name, e->path + split + 1, len - split - 1);
+	} else {
+		p_snprintf(header.name, sizeof(header.name), "%s.data", hex);
+		tar_ext_record(&ext, "path", e->path, len);
+	}
+
+	if (link) {
+		if (link_len <= sizeof(header.linkname))
+			memcpy(header.linkname, link, link_len);
+		else {
+			p_snprintf(header.linkname, sizeof(header.linkname), "see %s.paxheader", hex);
+			tar_ext_record(&ext, "linkpath", link, link_len);
+		}
+	}
+
+	if (!S_ISDIR(mode) && !S_ISLNK(mode) &&
+		(uint64_t)e->size > 077777777777ULL) {
+		char size[32];
+		p_snprintf(size, sizeof(size), "%"PRIuZ, e->size);
+		tar_ext_record(&ext, "size", size, strlen(size));
+	}
+
+	if (git_buf_oom(&ext)) {
+		error = -1;
+		goto done;
+	}
+
+	if (ext.size > 0) {
+		struct tar_header ext_header;
+
+		tar_prepare(a, &ext_header, 0100666 & ~TAR_UMASK, ext.size);
+		p_snprintf(ext_header.name, sizeof(ext_header.name), "%s.paxheader", hex);
+		ext_header.typeflag = 'x';
+
+		if ((error = tar_write_header(a, &ext_header)) < 0 ||
+			(error = archive_write(a, ext.ptr, ext.size)) < 0 ||
+			(error = tar_pad(a)) < 0)
+			goto done;
+	}
+
+	error = tar_write_header(a, &header);
+
+done:
+	git_buf_free(&ext);
+	return error;
+}
+
+static int tar_finish(archive *a)
+{
+	/* two blocks of zeros end the archive, which is made of
+	 * whole records */
+	size_t len = TAR_RECORD - (size_t)(a->offset % TAR_RECORD);
+
+	if (len < 2 * TAR_BLOCK)
+		len += TAR_RECORD;
+
+	return archive_zeros(a, len);
+}
+
+
+/*
+ * zip
+ */
+
+static void zip_put16(git_buf *buf, unsigned int value)
+{
+	char bytes[2];
+
+	bytes[0] = (char)(value & 0xff);
+	bytes[1] = (char)((value >> 8) & 0xff);
+	git_buf_put(buf, bytes, 2);
+}
+
+static void zip_put32(git_buf *buf, uint32_t value)
+{
+	zip_put16(buf, value & 0xffff);
+	zip_put16(buf, (value >> 16) & 0xffff);
+}
+
+typedef struct {
+	unsigned int flags, method;
+	uint32_t crc, compressed_size, size;
+	uint32_t offset; /* of the local header */
+} zip_info;
+
+static void zip_dos_time(archive *a, unsigned int *time_out, unsigned int *date_out)
+{
+	time_t t = (time_t)a->mtime;
+	struct tm tm;
+
+	if (!p_gmtime_r(&t, &tm) || tm.tm_year < 80) {
+		*time_out = 0;
+		*date_out = (1 << 5) | 1; /* the first of January, 1980 */
+		return;
+	}
+
+	*time_out = (tm.tm_hour << 11) | (tm.tm_min << 5) | (tm.tm_sec / 2);
+	*date_out = ((tm.tm_year - 80) << 9) | ((tm.tm_mon + 1) << 5) | tm.tm_mday;
+}
+
+/* The parts which are the same in the local and central headers */
+static void zip_common(
+	archive *a, git_buf *buf, archive_entry *e, const zip_info *info)
+{
+	unsigned int dos_time, dos_date;
+
+	zip_dos_time(a, &dos_time, &dos_date);
+
+	zip_put16(buf, info->method == ZIP_DEFLATED ? 20 : 10);
+	zip_put16(buf, info->flags);
+	zip_put16(buf, info->method);
+	zip_put16(buf, dos_time);
+	zip_put16(buf, dos_date);
+	zip_put32(buf, info->crc);
+	zip_put32(buf, info->compressed_size);
+	zip_put32(buf, info->size);
+	zip_put16(buf, (unsigned int)strlen(e->path));
+	zip_put16(buf, 0); /* extra field */
+}
+
+static unsigned int zip_flags(archive_entry *e)
+{
+	const unsigned char *scan;
+
+	for (scan = (const unsigned char *)e->path; *scan; ++scan)
+		if (*scan >= 0x80)
+			return ZIP_FLAG_UTF8;
+
+	return 0;
+}
+
+static int zip_check_size(archive *a)
+{
+	if (a->offset > 0xffffffffLL || a->zip_entries >= 0xffff) {
+		giterr_set(GITERR_INVALID, "Failed to write archive. Too large for zip");
+		return -1;
+	}
+
+	return 0;
+}
+
+/* zip without its 64-bit extensions has 32-bit entry sizes */
+static int zip_entry_too_large(archive_entry *e)
+{
+	giterr_set(GITERR_INVALID,
+		"Failed to write archive. Entry '%s' is too large for zip", e->path);
+	return -1;
+}
+
+static int zip_local_header(archive *a, archive_entry *e, zip_info *info)
+{
+	git_buf header = GIT_BUF_INIT;
+	int error;
+
+	if ((error = zip_check_size(a)) < 0)
+		return error;
+
+	info->offset = (uint32_t)a->offset;
+
+	zip_put32(&header, ZIP_LOCAL_HEADER);
+	zip_common(a, &header, e, info);
+	git_buf_puts(&header, e->path);
+
+	error = git_buf_oom(&header) ? -1 : archive_write(a, header.ptr, header.size);
+
+	git_buf_free(&header);
+	return error;
+}
+
+static int zip_central_header(archive *a, archive_entry *e, const zip_info *info)
+{
+	uint32_t attr;
+
+	if (S_ISDIR(e->mode) || S_ISGITLINK(e->mode))
+		attr = (040755 << 16) | 0x10; /* and the MS-DOS directory flag */
+	else if (S_ISLNK(e->mode))
+		attr = 0120777 << 16;
+	else
+		attr = (uint32_t)((e->mode & 0111) ? 0100755 : 0100644) << 16;
+
+	zip_put32(&a->central, ZIP_CENTRAL_HEADER);
+	zip_put16(&a->central, ZIP_UNIX_VERSION);
+	zip_common(a, &a->central, e, info);
+	zip_put16(&a->central, 0); /* comment */
+	zip_put16(&a->central, 0); /* disk */
+	zip_put16(&a->central, 0); /* internal attributes */
+	zip_put32(&a->central, attr);
+	zip_put32(&a->central, info->offset);
+	git_buf_puts(&a->central, e->path);
+
+	a->zip_entries++;
+
+	return git_buf_oom(&a->central) ? -1 : 0;
+}
+
+static int zip_deflate_init(archive *a)
+{
+	if (a->deflating)
+		return (deflateReset(&a->zs) == Z_OK) ? 0 : -1;
+
+	memset(&a->zs, 0, sizeof(a->zs));
+
+	/* raw deflate, without the zlib header and trailer */
+	if (deflateInit2(&a->zs, Z_DEFAULT_COMPRESSION,
+			Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		giterr_set(GITERR_ZLIB, "Failed to initialize deflate");
+		return -1;
+	}
+
+	a->deflating = true;
+	return 0;
+}
+
+/* Deflate `len` bytes of `data` and hand the result to `out` */
+static int zip_deflate(
+	archive *a, const char *data, size_t len, int flush,
+	git_buf *out_buf, zip_info *info)
+{
+	char buffer[16 * 1024];
+	int status, error = 0;
+
+	a->zs.next_in = (Bytef *)data;
+	a->zs.avail_in = (uInt)len;
+
+	do {
+		a->zs.next_out = (Bytef *)buffer;
+		a->zs.avail_out = sizeof(buffer);
+
+		status = deflate(&a->zs, flush);
+		if (status == Z_STREAM_ERROR) {
+			giterr_set(GITERR_ZLIB, "Failed to deflate archive entry");
+			return -1;
+		}
+
+		len = sizeof(buffer) - a->zs.avail_out;
+		info->compressed_size += (uint32_t)len;
+
+		if (out_buf)
+			error = git_buf_put(out_buf, buffer, len);
+		else
+			error = archive_write(a, buffer, len);
+	} while (!error && (a->zs.avail_out == 0 ||
+		(flush == Z_FINISH && status != Z_STREAM_END)));
+
+	return error;
+}
+
+static int zip_entry(archive *a, archive_entry *e, const char *data, size_t len)
+{
+	git_buf deflated = GIT_BUF_INIT;
+	zip_info info;
+	int error;
+
+	memset(&info, 0, sizeof(info));
+	info.flags = zip_flags(e);
+	info.method = ZIP_STORED;
+	info.crc = crc32(0, (const Bytef *)data, (uInt)len);
+	info.size = info.compressed_size = (uint32_t)len;
+
+	if ((uint64_t)len > 0xffffffffULL)
+		return zip_entry_too_large(e);
+
+	/* only keep the deflated data if it is smaller */
+	if (len > 0 && S_ISREG(e->mode) && !(a->flags & GIT_ARCHIVE_ZIP_STORE)) {
+		zip_info deflated_info = info;
+
+		deflated_info.compressed_size = 0;
+
+		if ((error = zip_deflate_init(a)) < 0 ||
+			(error = zip_deflate(a, data, len, Z_FINISH, &deflated, &deflated_info)) < 0)
+			goto done;
+
+		if (deflated.size < len) {
+			info = deflated_info;
+			info.method = ZIP_DEFLATED;
+			data = deflated.ptr;
+			len = deflated.size;
+		}
+	}
+
+	if ((error = zip_local_header(a, e, &info)) < 0 ||
+		(error = archive_write(a, data, len)) < 0)
+		goto done;
+
+	error = zip_central_header(a, e, &info);
+
+done:
+	git_buf_free(&deflated);
+	return error;
+}
+
+static int zip_finish(archive *a)
+{
+	git_buf end = GIT_BUF_INIT;
+	uint32_t offset = (uint32_t)a->offset;
+	int error;
+
+	if ((error = zip_check_size(a)) < 0 ||
+		(error = archive_write(a, a->central.ptr, a->central.size)) < 0 ||
+		(error = zip_check_size(a)) < 0)
+		return error;
+
+	zip_put32(&end, ZIP_END);
+	zip_put16(&end, 0); /* this disk */
+	zip_put16(&end, 0); /* disk with the central directory */
+	zip_put16(&end, (unsigned int)a->zip_entries);
+	zip_put16(&end, (unsigned int)a->zip_entries);
+	zip_put32(&end, (uint32_t)a->central.size);
+	zip_put32(&end, offset);
+	zip_put16(&end, 0); /* comment */
+
+	error = git_buf_oom(&end) ? -1 : archive_write(a, end.ptr, end.size);
+
+	git_buf_free(&end);
+	return error;
+}
+
+
+/*
+ * Writing the entries
+ */
+
+static int archive_stream(archive *a, archive_entry *e)
+{
+	git_odb_stream *stream;
+	zip_info info;
+	uint64_t total = 0;
+	int read, error;
+
+	if ((error = git_odb_open_rstream(&stream, a->odb, &e->oid)) < 0)
+		return error;
+
+	memset(&info, 0, sizeof(info));
+
+	if (a->format == GIT_ARCHIVE_TAR)
+		error = tar_entry(a, e, NULL, 0);
+	else if ((uint64_t)e->size > 0xffffffffULL)
+		error = zip_entry_too_large(e);
+	else {
+		/* the sizes and checksum follow the data */
+		info.flags = zip_flags(e) | ZIP_FLAG_DESCRIPTOR;
+		info.method = (a->flags & GIT_ARCHIVE_ZIP_STORE) ? ZIP_STORED : ZIP_DEFLATED;
+		info.crc = crc32(0, Z_NULL, 0);
+
+		if ((error = zip_local_header(a, e, &info)) == 0 &&
+			info.method == ZIP_DEFLATED)
+			error = zip_deflate_init(a);
+	}
+
+	while (!error && (read = stream->read(stream, a->chunk, ARCHIVE_CHUNK)) != 0) {
+		if (read < 0) {
+			error = read;
+			break;
+		}
+
+		total += read;
+
+		if (a->format == GIT_ARCHIVE_TAR || info.method == ZIP_STORED) {
+			info.compressed_size += read;
+			error = archive_write(a, a->chunk, read);
+		} else
+			error = zip_deflate(a, a->chunk, read, Z_NO_FLUSH, NULL, &info);
+
+		info.crc = crc32(info.crc, (const Bytef *)a->chunk, read);
+	}
+
+	stream->free(stream);
+
+	if (!error && total != (uint64_t)e->size) {
+		giterr_set(GITERR_ODB, "Failed to archive '%s'. The blob changed size", e->path);
+		error = -1;
+	}
+
+	if (error < 0)
+		return error;
+
+	if (a->format == GIT_ARCHIVE_TAR)
+		return tar_pad(a);
+
+	if (info.method == ZIP_DEFLATED &&
+		(error = zip_deflate(a, NULL, 0, Z_FINISH, NULL, &info)) < 0)
+		return error;
+
+	info.size = (uint32_t)total;
+
+	{
+		git_buf descriptor = GIT_BUF_INIT;
+
+		zip_put32(&descriptor, ZIP_DATA_DESCRIPTOR);
+		zip_put32(&descriptor, info.crc);
+		zip_put32(&descriptor, info.compressed_size);
+		zip_put32(&descriptor, info.size);
+
+		error = git_buf_oom(&descriptor) ? -1 :
+			archive_write(a, descriptor.ptr, descriptor.size);
+		git_buf_free(&descriptor);
+	}
+
+	return error ? error : zip_central_header(a, e, &info);
+}
+
+static int archive_write_entry(archive *a, archive_entry *e)
+{
+	const char *data = NULL;
+	size_t len = 0;
+	int error;
+
+	if (e->stream)
+		return archive_stream(a, e);
+
+	if (e->object) {
+		data = git_odb_object_data(e->object);
+		len = git_odb_object_size(e->object);
+	}
+
+	if (a->format == GIT_ARCHIVE_ZIP)
+		return zip_entry(a, e, data, len);
+
+	if (S_ISLNK(e->mode))
+		return tar_entry(a, e, data, len);
+
+	if ((error = tar_entry(a, e, NULL, 0)) < 0 ||
+		(error = archive_write(a, data, len)) < 0)
+		return error;
+
+	return tar_pad(a);
+}
+
+
+/*
+ * Walking the tree
+ */
+
+static int archive_parse_attrs(
+	archive *a, git_attr_file **out, const char *key, const char *content)
+{
+	int error;
+
+	if ((error = git_attr_file__new(out, GIT_ATTR_FILE_FROM_INDEX, key, NULL)) < 0)
+		return error;
+
+	/* macros are defined in the repository's cache */
+	git_rwlock_wrlock(&git_repository_attr_cache(a->repo)->lock);
+	error = git_attr_file__parse_buffer(a->repo, NULL, content, *out);
+	git_rwlock_wrunlock(&git_repository_attr_cache(a->repo)->lock);
+
+	if (error < 0) {
+		git_attr_file__free(*out);
+		*out = NULL;
+	}
+
+	return error;
+}
+
+static int archive_load_info_attrs(archive *a)
+{
+	git_buf path = GIT_BUF_INIT, content = GIT_BUF_INIT;
+	int error;
+
+	if ((error = git_buf_joinpath(&path,
+			a->repo->path_repository, GIT_ATTR_FILE_INREPO)) < 0)
+		return error;
+
+	if ((error = git_futils_readbuffer(&content, path.ptr)) == 0)
+		error = archive_parse_attrs(a, &a->info_attrs,
+			GIT_ATTR_FILE_INREPO, content.ptr);
+	else if (error == GIT_ENOTFOUND) {
+		giterr_clear();
+		error = 0;
+	}
+
+	git_buf_free(&path);
+	git_buf_free(&content);
+	return error;
+}
+
+/* Returns 1 if the tree has attributes, which were pushed */
+static int archive_push_attrs(archive *a, git_tree *tree, git_buf *dir)
+{
+	const git_tree_entry *entry = git_tree_entry_byname(tree, GIT_ATTR_FILE);
+	git_attr_file *file = NULL;
+	git_buf key = GIT_BUF_INIT, content = GIT_BUF_INIT;
+	git_blob *blob = NULL;
+	int error;
+
+	if (!entry || git_tree_entry__is_tree(entry) || S_ISGITLINK(entry->attr))
+		return 0;
+
+	if ((error = git_blob_lookup(&blob, a->repo, &entry->oid)) < 0 ||
+		(error = git_buf_put(&content, git_blob_rawcontent(blob),
+			(size_t)git_blob_rawsize(blob))) < 0 ||
+		(error = git_buf_joinpath(&key, dir->ptr, GIT_ATTR_FILE)) < 0 ||
+		(error = archive_parse_attrs(a, &file, key.ptr, content.ptr)) < 0)
+		goto done;
+
+	if ((error = git_vector_insert(&a->attrs, file)) < 0)
+		git_attr_file__free(file);
+	else
+		error = 1;
+
+done:
+	git_blob_free(blob);
+	git_buf_free(&key);
+	git_buf_free(&content);
+	return error;
+}
+
+static bool archive_ignored(archive *a, const char *path, bool is_dir)
+{
+	git_attr_path info;
+	git_attr_file *file;
+	const char *value = NULL;
+	size_t i;
+
+	/* the attribute files match paths relative to the tree */
+	memset(&info, 0, sizeof(info));
+	info.path = (char *)path;
+	info.basename = strrchr(path, '/');
+	info.basename = info.basename ? info.basename + 1 : info.path;
+	info.is_dir = is_dir;
+
+	if (a->info_attrs)
+		git_attr_file__lookup_one(a->info_attrs, &info, "export-ignore", &value);
+
+	for (i = a->attrs.length; i > 0 && !value; --i) {
+		file = git_vector_get(&a->attrs, i - 1);
+		git_attr_file__lookup_one(file, &info, "export-ignore", &value);
+	}
+
+	return GIT_ATTR_TRUE(value);
+}
+
+static int archive_add(
+	archive *a, const char *path, const git_oid *oid, unsigned int mode)
+{
+	archive_entry *e = git__calloc(1, sizeof(archive_entry));
+	GITERR_CHECK_ALLOC(e);
+
+	if ((e->path = git_pool_strcat(&a->paths, a->prefix, path)) == NULL ||
+		git_vector_insert(&a->entries, e) < 0) {
+		git__free(e);
+		return -1;
+	}
+
+	git_oid_cpy(&e->oid, oid);
+	e->mode = mode;
+
+	/* only blobs are read */
+	e->loaded = (S_ISDIR(mode) || S_ISGITLINK(mode));
+
+	return 0;
+}
+
+static int archive_walk(archive *a, git_tree *tree, git_buf *path)
+{
+	const git_tree_entry *entry;
+	git_tree *subtree;
+	size_t i, len = path->size;
+	int error, pushed;
+	bool is_dir;
+
+	if ((pushed = archive_push_attrs(a, tree, path)) < 0)
+		return pushed;
+
+	for (i = 0, error = 0; i < git_tree_entrycount(tree) && !error; ++i) {
+		entry = git_tree_entry_byindex(tree, (unsigned int)i);
+		is_dir = git_tree_entry__is_tree(entry) || S_ISGITLINK(entry->attr);
+
+		git_buf_truncate(path, len);
+		if ((error = git_buf_puts(path, entry->filename)) < 0)
+			break;
+
+		if (archive_ignored(a, path->ptr, is_dir))
+			continue;
+
+		if (is_dir && (error = git_buf_putc(path, '/')) < 0)
+			break;
+
+		if ((error = archive_add(a, path->ptr, &entry->oid, entry->attr)) < 0 ||
+			!git_tree_entry__is_tree(entry))
+			continue;
+
+		if ((error = git_tree_lookup(&subtree, a->repo, &entry->oid)) == 0) {
+			error = archive_walk(a, subtree, path);
+			git_tree_free(subtree);
+		}
+	}
+
+	git_buf_truncate(path, len);
+
+	if (pushed) {
+		git_attr_file__free(git_vector_last(&a->attrs));
+		git_vector_pop(&a->attrs);
+	}
+
+	return error;
+}
+
+static int archive_init(
+	archive *a,
+	git_tree *tree,
+	const git_archive_opts *opts,
+	git_archive_write_cb write_cb,
+	void *payload)
+{
+	memset(a, 0, sizeof(*a));
+
+	a->repo = git_object_owner((git_object *)tree);
+	a->write_cb = write_cb;
+	a->payload = payload;
+	a->prefix = "";
+
+	if (opts) {
+		a->format = opts->format;
+		a->flags = opts->flags;
+		a->mtime = opts->mtime;
+		a->nthreads = opts->nthreads;
+		if (opts->prefix)
+			a->prefix = opts->prefix;
+	}
+
+	if (a->format != GIT_ARCHIVE_TAR && a->format != GIT_ARCHIVE_ZIP) {
+		giterr_set(GITERR_INVALID, "Unknown archive format %d", (int)a->format);
+		return -1;
+	}
+
+	if (!a->mtime)
+		a->mtime = (git_time_t)time(NULL);
+
+#ifdef GIT_THREADS
+	if (!a->nthreads)
+		a->nthreads = (unsigned int)git_online_cpus();
+#else
+	a->nthreads = 1;
+#endif
+
+	git_mutex_init(&a->lock);
+#ifdef GIT_THREADS
+	git_cond_init(&a->work);
+	git_cond_init(&a->done);
+#endif
+
+	a->chunk = git__malloc(ARCHIVE_CHUNK);
+	GITERR_CHECK_ALLOC(a->chunk);
+
+	if (git_pool_init(&a->paths, 1, 0) < 0 ||
+		git_vector_init(&a->entries, 0, NULL) < 0 ||
+		git_vector_init(&a->attrs, 4, NULL) < 0 ||
+		git_repository_odb__weakptr(&a->odb, a->repo) < 0 ||
+		git_attr_cache__init(a->repo) < 0)
+		return -1;
+
+	return archive_load_info_attrs(a);
+}
+
+static void archive_free(archive *a)
+{
+	archive_entry *e;
+	git_attr_file *file;
+	size_t i;
+
+	archive_stop_readers(a);
+
+	git_vector_foreach(&a->entries, i, e) {
+		git_odb_object_free(e->object);
+		git__free(e);
+	}
+	git_vector_free(&a->entries);
+
+	git_vector_foreach(&a->attrs, i, file)
+		git_attr_file__free(file);
+	git_vector_free(&a->attrs);
+	git_attr_file__free(a->info_attrs);
+
+	if (a->deflating)
+		deflateEnd(&a->zs);
+
+#ifdef GIT_THREADS
+	git_cond_free(&a->work);
+	git_cond_free(&a->done);
+#endif
+	git_mutex_free(&a->lock);
+
+	git_pool_clear(&a->paths);
+	git_buf_free(&a->out);
+	git_buf_free(&a->central);
+	git__free(a->threads);
+	git__free(a->chunk);
+}
+
+int git_archive(
+	git_tree *tree,
+	const git_archive_opts *opts,
+	git_archive_write_cb write_cb,
+	void *payload)
+{
+	archive a;
+	archive_entry *e;
+	git_buf path = GIT_BUF_INIT;
+	size_t i;
+	int error;
+
+	assert(tree && write_cb);
+
+	if ((error = archive_init(&a, tree, opts, write_cb, payload)) < 0)
+		goto cleanup;
+
+	/* like git, give the prefix directory an entry of its own */
+	if (*a.prefix && a.prefix[strlen(a.prefix) - 1] == '/' &&
+		(error = archive_add(&a, "", git_tree_id(tree), GIT_FILEMODE_TREE)) < 0)
+		goto cleanup;
+
+	if ((error = archive_walk(&a, tree, &path)) < 0 ||
+		(error = archive_start_readers(&a)) < 0)
+		goto cleanup;
+
+	git_vector_foreach(&a.entries, i, e) {
+		if ((error = archive_take(&a, i, e)) < 0 ||
+			(error = archive_write_entry(&a, e)) < 0)
+			goto cleanup;
+
+		git_odb_object_free(e->object);
+		e->object = NULL;
+	}
+
+	if ((error = (a.format == GIT_ARCHIVE_TAR) ? tar_finish(&a) : zip_finish(&a)) < 0)
+		goto cleanup;
+
+	error = archive_flush(&a);
+
+cleanup:
+	archive_free(&a);
+	git_buf_free(&path);
+	return error;
+}
@@ -205,7 +205,8 @@ cleanup:
 }
 
 
-int git_attr_add_macro(
+/* the caller must hold the cache write lock */
+static int attr_cache_add_macro(
 	git_repository *repo,
 	const char *name,
 	const char *values)
@@ -214,9 +215,6 @@ int git_attr_add_macro(
 	git_attr_rule *macro = NULL;
 	git_pool *pool;
 
-	if (git_attr_cache__init(repo) < 0)
-		return -1;
-
 	macro = git__calloc(1, sizeof(git_attr_rule));
 	GITERR_CHECK_ALLOC(macro);
 
@@ -239,11 +237,28 @@ int git_attr_add_macro(
 	return error;
 }
 
+int git_attr_add_macro(
+	git_repository *repo,
+	const char *name,
+	const char *values)
+{
+	int error;
+
+	if (git_attr_cache__init(repo) < 0)
+		return -1;
+
+	git_rwlock_wrlock(&git_repository_attr_cache(repo)->lock);
+	error = attr_cache_add_macro(repo, name, values);
+	git_rwlock_wrunlock(&git_repository_attr_cache(repo)->lock);
+
+	return error;
+}
+
 bool git_attr_cache__is_cached(
 	git_repository *repo, git_attr_file_source source, const char *path)
 {
 	git_buf cache_key = GIT_BUF_INIT;
-	git_strmap *files = git_repository_attr_cache(repo)->files;
+	git_attr_cache *cache = git_repository_attr_cache(repo);
 	const char *workdir = git_repository_workdir(repo);
 	bool rval;
 
@@ -252,7 +267,9 @@ bool git_attr_cache__is_cached(
 	if (git_buf_printf(&cache_key, "%d#%s", (int)source, path) < 0)
 		return false;
 
-	rval = git_strmap_exists(files, git_buf_cstr(&cache_key));
+	git_rwlock_rdlock(&cache->lock);
+	rval = git_strmap_exists(cache->files, git_buf_cstr(&cache_key));
+	git_rwlock_rdunlock(&cache->lock);
 
 	git_buf_free(&cache_key);
 
@@ -320,7 +337,7 @@ static int load_attr_from_cache(
 	const char *relative_path)
 {
 	git_buf  cache_key = GIT_BUF_INIT;
-	khiter_t cache_pos;
+	git_hashmap_iter cache_pos;
 
 	*file = NULL;
 
@@ -330,13 +347,15 @@ static int load_attr_from_cache(
 	if (git_buf_printf(&cache_key, "%d#%s", (int)source, relative_path) < 0)
 		return -1;
 
-	cache_pos = git_strmap_lookup_index(cache->files, cache_key.ptr);
-
-	git_buf_free(&cache_key);
+	git_rwlock_rdlock(&cache->lock);
 
+	cache_pos = git_strmap_lookup_index(cache->files, cache_key.ptr);
 	if (git_strmap_valid_index(cache->files, cache_pos))
 		*file = git_strmap_value_at(cache->files, cache_pos);
 
+	git_rwlock_rdunlock(&cache->lock);
+
+	git_buf_free(&cache_key);
 	return 0;
 }
 
@@ -347,19 +366,21 @@ int git_attr_cache__internal_file(
 {
 	int error = 0;
 	git_attr_cache *cache = git_repository_attr_cache(repo);
-	khiter_t cache_pos = git_strmap_lookup_index(cache->files, filename);
+	git_hashmap_iter cache_pos;
 
-	if (git_strmap_valid_index(cache->files, cache_pos)) {
+	git_rwlock_wrlock(&cache->lock);
+
+	cache_pos = git_strmap_lookup_index(cache->files, filename);
+
+	if (git_strmap_valid_index(cache->files, cache_pos))
 		*file = git_strmap_value_at(cache->files, cache_pos);
-		return 0;
+	else if ((error = git_attr_file__new(file, 0, filename, &cache->pool)) == 0) {
+		git_strmap_insert(cache->files, (*file)->key + 2, *file, error);
+		if (error > 0)
+			error = 0;
 	}
 
-	if (git_attr_file__new(file, 0, filename, &cache->pool) < 0)
-		return -1;
-
-	git_strmap_insert(cache->files, (*file)->key + 2, *file, error);
-	if (error > 0)
-		error = 0;
+	git_rwlock_wrunlock(&cache->lock);
 
 	return error;
 }
@@ -378,7 +399,8 @@ int git_attr_cache__push_file(
 	const char *workdir = git_repository_workdir(repo);
 	const char *relfile, *content = NULL;
 	git_attr_cache *cache = git_repository_attr_cache(repo);
-	git_attr_file *file = NULL;
+	git_attr_file *file = NULL, *updated = NULL;
+	void *old_file = NULL;
 	git_blob *blob = NULL;
 	git_futils_filestamp stamp;
 
@@ -396,8 +418,10 @@ int git_attr_cache__push_file(
 		relfile += strlen(workdir);
 
 	/* check cache */
-	if (load_attr_from_cache(&file, cache, source, relfile) < 0)
-		return -1;
+	if (load_attr_from_cache(&file, cache, source, relfile) < 0) {
+		error = -1;
+		goto finish;
+	}
 
 	/* if not in cache, load data, parse, and cache */
 
@@ -420,35 +444,44 @@ int git_attr_cache__push_file(
 		goto finish;
 	}
 
-	/* if we got here, we have to parse and/or reparse the file */
-	if (file)
-		git_attr_file__clear_rules(file);
-	else {
-		error = git_attr_file__new(&file, source, relfile, &cache->pool);
-		if (error < 0)
-			goto finish;
-	}
+	/*
+	 * if we got here, we have to parse the file; a cached copy is
+	 * replaced rather than reparsed, as it may be in use elsewhere
+	 */
+	git_rwlock_wrlock(&cache->lock);
 
-	if (parse && (error = parse(repo, parsedata, content, file)) < 0)
-		goto finish;
+	if ((error = git_attr_file__new(&updated, source, relfile, &cache->pool)) < 0)
+		goto unlock;
 
-	git_strmap_insert(cache->files, file->key, file, error); //-V595
-	if (error > 0)
-		error = 0;
+	if (parse && (error = parse(repo, parsedata, content, updated)) < 0)
+		goto unlock;
 
 	/* remember "cache buster" file signature */
 	if (blob)
-		git_oid_cpy(&file->cache_data.oid, git_object_id((git_object *)blob));
+		git_oid_cpy(&updated->cache_data.oid, git_object_id((git_object *)blob));
 	else
-		git_futils_filestamp_set(&file->cache_data.stamp, &stamp);
+		git_futils_filestamp_set(&updated->cache_data.stamp, &stamp);
+
+	git_strmap_insert2(cache->files, updated->key, updated, old_file, error);
+	if (error < 0)
+		goto unlock;
+
+	error = 0;
+	file = updated;
+	updated = NULL;
+
+	if (old_file != NULL && (error = git_vector_insert(&cache->retired, old_file)) < 0)
+		git_attr_file__free(old_file);
+
+unlock:
+	git_rwlock_wrunlock(&cache->lock);
 
 finish:
 	/* push file onto vector if we found one*/
 	if (!error && file != NULL)
 		error = git_vector_insert(stack, file);
 
-	if (error != 0)
-		git_attr_file__free(file);
+	git_attr_file__free(updated);
 
 	if (blob)
 		git_blob_free(blob);
@@ -597,15 +630,12 @@ static char *try_global_default(const char *relpath)
 	return rval;
 }
 
-int git_attr_cache__init(git_repository *repo)
+/* the caller must hold the cache write lock */
+static int attr_cache_init(git_repository *repo, git_attr_cache *cache)
 {
 	int ret;
-	git_attr_cache *cache = git_repository_attr_cache(repo);
 	git_config *cfg;
 
-	if (cache->initialized)
-		return 0;
-
 	/* cache config settings for attributes and ignores */
 	if (git_repository_config__weakptr(&cfg, repo) < 0)
 		return -1;
@@ -640,10 +670,32 @@ int git_attr_cache__init(git_repository *repo)
 	if (git_pool_init(&cache->pool, 1, 0) < 0)
 		return -1;
 
+	/* insert default macros */
+	if (attr_cache_add_macro(repo, "binary", "-diff -crlf -text") < 0)
+		return -1;
+
 	cache->initialized = 1;
+	return 0;
+}
 
-	/* insert default macros */
-	return git_attr_add_macro(repo, "binary", "-diff -crlf -text");
+int git_attr_cache__init(git_repository *repo)
+{
+	git_attr_cache *cache = git_repository_attr_cache(repo);
+	int error = 0, initialized;
+
+	git_rwlock_rdlock(&cache->lock);
+	initialized = cache->initialized;
+	git_rwlock_rdunlock(&cache->lock);
+
+	if (initialized)
+		return 0;
+
+	git_rwlock_wrlock(&cache->lock);
+	if (!cache->initialized)
+		error = attr_cache_init(repo, cache);
+	git_rwlock_wrunlock(&cache->lock);
+
+	return error;
 }
 
 void git_attr_cache_flush(
@@ -658,12 +710,17 @@ void git_attr_cache_flush(
 
 	if (cache->files != NULL) {
 		git_attr_file *file;
+		unsigned int i;
 
 		git_strmap_foreach_value(cache->files, file, {
 			git_attr_file__free(file);
 		});
 
 		git_strmap_free(cache->files);
+
+		git_vector_foreach(&cache->retired, i, file)
+			git_attr_file__free(file);
+		git_vector_free(&cache->retired);
 	}
 
 	if (cache->macros != NULL) {
@@ -698,7 +755,7 @@ git_attr_rule *git_attr_cache__lookup_macro(
 	git_repository *repo, const char *name)
 {
 	git_strmap *macros = git_repository_attr_cache(repo)->macros;
-	khiter_t pos;
+	git_hashmap_iter pos;
 
 	pos = git_strmap_lookup_index(macros, name);
 
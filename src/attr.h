@@ -15,13 +15,25 @@
 #define GIT_IGNORE_CONFIG "core.excludesfile"
 #define GIT_IGNORE_CONFIG_DEFAULT ".config/git/ignore"
 
+/*
+ * The attribute cache is shared by every user of the repository.
+ *
+ * `lock` is held for reading to look up `files` and for writing to
+ * change `files` or `macros` and to allocate from `pool`.  A cached
+ * file is never modified once published: when it changes on disk it
+ * is parsed anew and the stale copy is kept in `retired` (other
+ * threads may still be matching against it) until the cache is
+ * flushed.
+ */
 typedef struct {
 	int initialized;
 	git_pool pool;
 	git_strmap *files;	/* hash path to git_attr_file of rules */
 	git_strmap *macros;	/* hash name to vector<git_attr_assignment> */
+	git_vector retired;	/* replaced git_attr_files, freed on flush */
 	const char *cfg_attr_file; /* cached value of core.attributesfile */
 	const char *cfg_excl_file; /* cached value of core.excludesfile */
+	git_rwlock lock;
 } git_attr_cache;
 
 typedef int (*git_attr_file_parser)(
@@ -29,9 +41,11 @@ typedef int (*git_attr_file_parser)(
 
 extern int git_attr_cache__init(git_repository *repo);
 
+/* the caller must hold the cache write lock (i.e. be parsing a file) */
 extern int git_attr_cache__insert_macro(
 	git_repository *repo, git_attr_rule *macro);
 
+/* the caller must hold the cache write lock (i.e. be parsing a file) */
 extern git_attr_rule *git_attr_cache__lookup_macro(
 	git_repository *repo, const char *name);
 
@@ -0,0 +1,916 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "common.h"
+#include "repository.h"
+#include "refs.h"
+#include "oidmap.h"
+#include "pqueue.h"
+#include "vector.h"
+#include "xdiff/xinclude.h"
+
+#include "git2/blame.h"
+#include "git2/blob.h"
+#include "git2/commit.h"
+#include "git2/tree.h"
+
+GIT__USE_OIDMAP;
+
+/* like git, moved lines need this many alphanumeric characters */
+#define BLAME_MOVE_SCORE 20
+
+/* lines found more often than this in the parent start no move */
+#define BLAME_MOVE_CANDIDATES 64
+
+/*
+ * A commit some lines may come from.  Its `entries` are the lines it
+ * is suspected of, which are either passed on to its parents when it
+ * is processed, or blamed on it.
+ */
+typedef struct {
+	git_oid id;
+	git_time_t time;
+	git_oid blob_id; /* of the file in this commit */
+	git_blob *blob; /* loaded while needed */
+
+	git_vector entries;
+	bool queued;
+	bool boundary;
+} blame_origin;
+
+/* Consecutive lines of the final file, and where they are in `origin` */
+typedef struct {
+	blame_origin *origin;
+	size_t final_start, orig_start, count; /* counted from 0 */
+} blame_entry;
+
+struct git_blame {
+	git_repository *repo;
+	char *path;
+	git_blame_options opts;
+	git_oid final_id;
+
+	git_oidmap *origins;
+	git_pqueue queue; /* of the origins to process, newest first */
+
+	git_vector blamed; /* entries, once they are blamed */
+	git_vector hunks;
+};
+
+/* The lines of a blob, as xdiff counts them */
+typedef struct {
+	const char *data;
+	size_t *start; /* of each line, then the end of the data */
+	size_t count;
+} blame_lines;
+
+#define blame_line(l, i) ((l)->data + (l)->start[i])
+#define blame_line_len(l, i) ((l)->start[(i) + 1] - (l)->start[i])
+
+static int blame_lines_init(blame_lines *l, git_blob *blob)
+{
+	const char *data = git_blob_rawcontent(blob), *scan, *end;
+	size_t size = (size_t)git_blob_rawsize(blob), n;
+
+	memset(l, 0, sizeof(*l));
+	l->data = data;
+
+	for (scan = data, end = data + size, n = 0; scan < end; n++) {
+		scan = memchr(scan, '\n', end - scan);
+		scan = scan ? scan + 1 : end;
+	}
+
+	l->start = git__malloc((n + 1) * sizeof(size_t));
+	GITERR_CHECK_ALLOC(l->start);
+
+	for (scan = data, n = 0; scan < end; n++) {
+		l->start[n] = scan - data;
+		scan = memchr(scan, '\n', end - scan);
+		scan = scan ? scan + 1 : end;
+	}
+
+	l->start[n] = size;
+	l->count = n;
+
+	return 0;
+}
+
+static void blame_lines_free(blame_lines *l)
+{
+	git__free(l->start);
+	l->start = NULL;
+}
+
+
+/*
+ * Origins and entries
+ */
+
+static int blame_origin_cmp_time(void *a, void *b)
+{
+	return ((blame_origin *)a)->time < ((blame_origin *)b)->time;
+}
+
+static int blame_origin_get(
+	blame_origin **out, git_blame *blame, git_commit *commit, const git_oid *blob_id)
+{
+	blame_origin *o;
+	git_hashmap_iter pos;
+	int error;
+
+	pos = git_oidmap_lookup_index(blame->origins, git_commit_id(commit));
+	if (git_oidmap_valid_index(blame->origins, pos)) {
+		*out = git_oidmap_value_at(blame->origins, pos);
+		return 0;
+	}
+
+	o = git__calloc(1, sizeof(blame_origin));
+	GITERR_CHECK_ALLOC(o);
+
+	git_oid_cpy(&o->id, git_commit_id(commit));
+	git_oid_cpy(&o->blob_id, blob_id);
+	o->time = git_commit_time(commit);
+
+	if (git_vector_init(&o->entries, 4, NULL) < 0) {
+		git__free(o);
+		return -1;
+	}
+
+	git_oidmap_insert(blame->origins, &o->id, o, error);
+	if (error < 0) {
+		git_vector_free(&o->entries);
+		git__free(o);
+		return -1;
+	}
+
+	*out = o;
+	return 0;
+}
+
+static int blame_origin_load(git_blame *blame, blame_origin *o)
+{
+	if (o->blob)
+		return 0;
+
+	return git_blob_lookup(&o->blob, blame->repo, &o->blob_id);
+}
+
+/* Make it suspected of lines [orig_start, orig_start + count) */
+static int blame_suspect(
+	git_blame *blame, blame_origin *o,
+	size_t final_start, size_t orig_start, size_t count)
+{
+	blame_entry *e;
+
+	if (!count)
+		return 0;
+
+	e = git__malloc(sizeof(blame_entry));
+	GITERR_CHECK_ALLOC(e);
+
+	e->origin = o;
+	e->final_start = final_start;
+	e->orig_start = orig_start;
+	e->count = count;
+
+	if (git_vector_insert(&o->entries, e) < 0) {
+		git__free(e);
+		return -1;
+	}
+
+	if (!o->queued) {
+		if (git_pqueue_insert(&blame->queue, o) < 0)
+			return -1;
+		o->queued = true;
+	}
+
+	return 0;
+}
+
+/* Pass the part [start, start + count) of an entry on to another origin */
+GIT_INLINE(int) blame_pass(
+	git_blame *blame, blame_entry *e, size_t start, size_t count,
+	blame_origin *to, size_t to_start)
+{
+	return blame_suspect(blame, to,
+		e->final_start + (start - e->orig_start), to_start, count);
+}
+
+/* Find the blob of the blamed file in a commit; GIT_ENOTFOUND if none */
+static int blame_find_blob(git_oid *out, git_blame *blame, git_commit *commit)
+{
+	git_tree *tree;
+	git_tree_entry *entry;
+	int error;
+
+	if ((error = git_commit_tree(&tree, commit)) < 0)
+		return error;
+
+	error = git_tree_entry_bypath(&entry, tree, blame->path);
+	git_tree_free(tree);
+
+	if (error == GIT_ENOTFOUND) {
+		giterr_clear();
+		return error;
+	}
+	if (error < 0)
+		return error;
+
+	if (git_tree_entry_type(entry) != GIT_OBJ_BLOB)
+		error = GIT_ENOTFOUND;
+	else
+		git_oid_cpy(out, git_tree_entry_id(entry));
+
+	git_tree_entry_free(entry);
+	return error;
+}
+
+
+/*
+ * Passing the unchanged lines to a parent
+ */
+
+typedef struct {
+	size_t child_start, child_end, parent_start;
+} blame_range;
+
+typedef struct {
+	blame_range *ranges;
+	size_t count, alloc;
+	size_t child_lines;
+	int error;
+} blame_diff;
+
+static int blame_diff_add(blame_diff *d, size_t child_start, size_t child_end, size_t parent_start)
+{
+	if (child_start == child_end)
+		return 0;
+
+	if (d->count == d->alloc) {
+		size_t alloc = d->alloc ? d->alloc * 2 : 16;
+		blame_range *ranges = git__realloc(d->ranges, alloc * sizeof(blame_range));
+		GITERR_CHECK_ALLOC(ranges);
+
+		d->ranges = ranges;
+		d->alloc = alloc;
+	}
+
+	d->ranges[d->count].child_start = child_start;
+	d->ranges[d->count].child_end = child_end;
+	d->ranges[d->count].parent_start = parent_start;
+	d->count++;
+
+	return 0;
+}
+
+/* Called by xdiff with the whole edit script, instead of printing it */
+static int blame_diff_emit(
+	xdfenv_t *xe, xdchange_t *xscr, xdemitcb_t *ecb, xdemitconf_t const *xecfg)
+{
+	blame_diff *d = ecb->priv;
+	xdchange_t *xch;
+	size_t child = 0, parent = 0;
+
+	GIT_UNUSED(xe);
+	GIT_UNUSED(xecfg);
+
+	/* drop the whole file range, which was there in case of no changes */
+	d->count = 0;
+
+	/* keep what is between the changes */
+	for (xch = xscr; xch && !d->error; xch = xch->next) {
+		d->error = blame_diff_add(d, child, (size_t)xch->i2, parent);
+
+		child = (size_t)(xch->i2 + xch->chg2);
+		parent = (size_t)(xch->i1 + xch->chg1);
+	}
+
+	if (!d->error)
+		d->error = blame_diff_add(d, child, d->child_lines, parent);
+
+	return d->error;
+}
+
+static int blame_diff_blobs(
+	blame_diff *d, git_blob *parent, git_blob *child, size_t child_lines)
+{
+	mmfile_t parent_data, child_data;
+	xpparam_t params;
+	xdemitconf_t config;
+	xdemitcb_t callback;
+
+	memset(d, 0, sizeof(*d));
+	d->child_lines = child_lines;
+
+	memset(&params, 0, sizeof(params));
+	memset(&config, 0, sizeof(config));
+	memset(&callback, 0, sizeof(callback));
+
+	config.emit_func = (void (*)(void))blame_diff_emit;
+	callback.priv = d;
+
+	parent_data.ptr = (char *)git_blob_rawcontent(parent);
+	parent_data.size = (size_t)git_blob_rawsize(parent);
+	child_data.ptr = (char *)git_blob_rawcontent(child);
+	child_data.size = (size_t)git_blob_rawsize(child);
+
+	/* without changes, xdiff does not call us */
+	if (blame_diff_add(d, 0, child_lines, 0) < 0)
+		return -1;
+
+	if (xdl_diff(&parent_data, &child_data, &params, &config, &callback) < 0 && !d->error) {
+		giterr_set(GITERR_NOMEMORY, "Out of memory in diff");
+		d->error = -1;
+	}
+
+	return d->error;
+}
+
+/* Keep the part [start, start + count) of an entry in `entries` */
+static int blame_keep(git_vector *entries, blame_entry *e, size_t start, size_t count)
+{
+	blame_entry *part;
+
+	if (!count)
+		return 0;
+
+	part = git__malloc(sizeof(blame_entry));
+	GITERR_CHECK_ALLOC(part);
+
+	part->origin = e->origin;
+	part->final_start = e->final_start + (start - e->orig_start);
+	part->orig_start = start;
+	part->count = count;
+
+	if (git_vector_insert(entries, part) < 0) {
+		git__free(part);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Replace the origin's entries, freeing those left in the old vector */
+static void blame_replace_entries(blame_origin *o, git_vector *entries)
+{
+	blame_entry *e;
+	size_t i;
+
+	git_vector_foreach(&o->entries, i, e)
+		git__free(e);
+
+	git_vector_free(&o->entries);
+	o->entries = *entries;
+}
+
+/* Pass the lines of the entries outside of the changes to `parent` */
+static int blame_pass_unchanged(
+	git_blame *blame, blame_origin *o, blame_origin *parent, blame_diff *d)
+{
+	git_vector remaining = GIT_VECTOR_INIT;
+	blame_entry *e;
+	size_t i, r, hi, pos, end, stop;
+	int error = 0;
+
+	if (git_vector_init(&remaining, o->entries.length, NULL) < 0)
+		return -1;
+
+	git_vector_foreach(&o->entries, i, e) {
+		pos = e->orig_start;
+		end = e->orig_start + e->count;
+
+		/* the first range which does not end before the entry */
+		for (r = 0, hi = d->count; r < hi; ) {
+			size_t mid = r + (hi - r) / 2;
+
+			if (d->ranges[mid].child_end <= pos)
+				r = mid + 1;
+			else
+				hi = mid;
+		}
+
+		for (; pos < end && !error; pos = stop) {
+			blame_range *range = (r < d->count) ? &d->ranges[r] : NULL;
+
+			if (range && range->child_start <= pos) {
+				stop = min(end, range->child_end);
+				error = blame_pass(blame, e, pos, stop - pos, parent,
+					range->parent_start + (pos - range->child_start));
+				r++;
+			} else {
+				stop = range ? min(end, range->child_start) : end;
+				error = blame_keep(&remaining, e, pos, stop - pos);
+			}
+		}
+
+		if (error < 0)
+			break;
+	}
+
+	blame_replace_entries(o, &remaining);
+	return error;
+}
+
+
+/*
+ * Lines moved within the file
+ */
+
+typedef struct {
+	uint32_t hash;
+	size_t line;
+} blame_line_hash;
+
+static uint32_t blame_hash_line(blame_lines *l, size_t i)
+{
+	const unsigned char *scan = (const unsigned char *)blame_line(l, i);
+	size_t len = blame_line_len(l, i);
+	uint32_t hash = 2166136261u;
+
+	while (len--) {
+		hash ^= *scan++;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+static int blame_cmp_line_hash(const void *a, const void *b)
+{
+	const blame_line_hash *ha = a, *hb = b;
+
+	if (ha->hash != hb->hash)
+		return (ha->hash < hb->hash) ? -1 : 1;
+
+	return (ha->line < hb->line) ? -1 : (ha->line > hb->line);
+}
+
+GIT_INLINE(bool) blame_lines_equal(
+	blame_lines *a, size_t i, blame_lines *b, size_t j)
+{
+	return blame_line_len(a, i) == blame_line_len(b, j) &&
+		!memcmp(blame_line(a, i), blame_line(b, j), blame_line_len(a, i));
+}
+
+static size_t blame_score(blame_lines *l, size_t start, size_t count)
+{
+	const char *scan = blame_line(l, start), *end = blame_line(l, start + count);
+	size_t score = 0;
+
+	for (; scan < end; ++scan)
+		if (isalnum((unsigned char)*scan))
+			score++;
+
+	return score;
+}
+
+/*
+ * Pass the entries' longest runs of lines which are in the parent,
+ * anywhere, to the parent; do it again on what is around them.
+ */
+static int blame_pass_moves(
+	git_blame *blame, blame_origin *o, blame_origin *parent)
+{
+	git_vector remaining = GIT_VECTOR_INIT;
+	blame_lines child_lines, parent_lines;
+	blame_line_hash *index = NULL, *found;
+	uint32_t hash;
+	blame_entry *e;
+	size_t i, j, best_score, best_line, best_parent, best_count, min_score;
+	int error;
+
+	min_score = blame->opts.min_match_characters ?
+		blame->opts.min_match_characters : BLAME_MOVE_SCORE;
+
+	if ((error = blame_lines_init(&child_lines, o->blob)) < 0)
+		return error;
+	if ((error = blame_lines_init(&parent_lines, parent->blob)) < 0)
+		goto cleanup;
+
+	index = git__malloc((parent_lines.count + 1) * sizeof(blame_line_hash));
+	if (!index) {
+		error = -1;
+		goto cleanup;
+	}
+
+	for (i = 0; i < parent_lines.count; ++i) {
+		index[i].hash = blame_hash_line(&parent_lines, i);
+		index[i].line = i;
+	}
+	qsort(index, parent_lines.count, sizeof(blame_line_hash), blame_cmp_line_hash);
+
+	if ((error = git_vector_init(&remaining, o->entries.length, NULL)) < 0)
+		goto cleanup;
+
+	/* the entries around a move are appended, and looked at in turn */
+	for (i = 0; i < o->entries.length && !error; ++i) {
+		e = git_vector_get(&o->entries, i);
+		best_score = 0;
+		best_line = best_parent = best_count = 0;
+
+		for (j = e->orig_start; j < e->orig_start + e->count; ++j) {
+			size_t first, candidates, k, count;
+
+			hash = blame_hash_line(&child_lines, j);
+
+			/* the first line with the hash */
+			for (first = 0, k = parent_lines.count; first < k; ) {
+				size_t mid = first + (k - first) / 2;
+
+				if (index[mid].hash < hash)
+					first = mid + 1;
+				else
+					k = mid;
+			}
+
+			for (candidates = 0; first + candidates < parent_lines.count &&
+				index[first + candidates].hash == hash; candidates++)
+				/* count them */;
+
+			if (candidates > BLAME_MOVE_CANDIDATES)
+				continue;
+
+			for (k = 0; k < candidates; ++k) {
+				size_t score;
+
+				found = &index[first + k];
+
+				for (count = 0; j + count < e->orig_start + e->count &&
+					found->line + count < parent_lines.count &&
+					blame_lines_equal(&child_lines, j + count,
+						&parent_lines, found->line + count); count++)
+					/* extend the run */;
+
+				if (count && (score = blame_score(&child_lines, j, count)) > best_score) {
+					best_score = score;
+					best_line = j;
+					best_parent = found->line;
+					best_count = count;
+				}
+			}
+		}
+
+		if (best_score < min_score) {
+			if ((error = git_vector_insert(&remaining, e)) == 0)
+				o->entries.contents[i] = NULL;
+			continue;
+		}
+
+		/* what is before and after the move is looked at again */
+		if ((error = blame_pass(blame, e, best_line, best_count,
+				parent, best_parent)) < 0 ||
+			(error = blame_keep(&o->entries, e, e->orig_start,
+				best_line - e->orig_start)) < 0)
+			break;
+
+		error = blame_keep(&o->entries, e, best_line + best_count,
+			e->orig_start + e->count - best_line - best_count);
+	}
+
+	blame_replace_entries(o, &remaining);
+
+cleanup:
+	git__free(index);
+	blame_lines_free(&child_lines);
+	blame_lines_free(&parent_lines);
+	return error;
+}
+
+
+/*
+ * Walking the history
+ */
+
+/* Pass all the entries on to a parent with the same version of the file */
+static int blame_pass_all(git_blame *blame, blame_origin *o, blame_origin *to)
+{
+	blame_entry *e;
+	size_t i;
+
+	git_vector_foreach(&o->entries, i, e) {
+		if (blame_pass(blame, e, e->orig_start, e->count, to, e->orig_start) < 0)
+			return -1;
+	}
+
+	git_vector_foreach(&o->entries, i, e)
+		git__free(e);
+	git_vector_clear(&o->entries);
+
+	return 0;
+}
+
+/* Pass what it can of the origin's entries to its parents, blame the rest */
+static int blame_origin_process(git_blame *blame, blame_origin *o)
+{
+	git_commit *commit, *parent_commit = NULL;
+	blame_origin *parent;
+	blame_lines lines = { NULL, NULL, 0 };
+	blame_diff d;
+	blame_entry *e;
+	git_oid blob_id;
+	unsigned int i, parents;
+	int error;
+
+	if ((error = git_commit_lookup(&commit, blame->repo, &o->id)) < 0)
+		return error;
+
+	if (!git_oid_iszero(&blame->opts.oldest_commit) &&
+		!git_oid_cmp(&o->id, &blame->opts.oldest_commit)) {
+		o->boundary = true;
+		goto blamed;
+	}
+
+	parents = git_commit_parentcount(commit);
+	if (parents > 1 && (blame->opts.flags & GIT_BLAME_FIRST_PARENT) != 0)
+		parents = 1;
+
+	/* a parent with the same version of the file takes all the lines */
+	for (i = 0; i < parents; ++i) {
+		if ((error = git_commit_parent(&parent_commit, commit, i)) < 0)
+			goto cleanup;
+
+		error = blame_find_blob(&blob_id, blame, parent_commit);
+
+		if (!error && !git_oid_cmp(&blob_id, &o->blob_id)) {
+			if ((error = blame_origin_get(&parent, blame, parent_commit, &blob_id)) == 0)
+				error = blame_pass_all(blame, o, parent);
+			goto cleanup;
+		}
+
+		git_commit_free(parent_commit);
+		parent_commit = NULL;
+
+		if (error < 0 && error != GIT_ENOTFOUND)
+			goto cleanup;
+	}
+
+	if ((error = blame_origin_load(blame, o)) < 0 ||
+		(error = blame_lines_init(&lines, o->blob)) < 0)
+		goto cleanup;
+
+	for (i = 0; i < parents && o->entries.length > 0; ++i) {
+		if ((error = git_commit_parent(&parent_commit, commit, i)) < 0)
+			goto cleanup;
+
+		if ((error = blame_find_blob(&blob_id, blame, parent_commit)) == GIT_ENOTFOUND) {
+			git_commit_free(parent_commit);
+			parent_commit = NULL;
+			error = 0;
+			continue;
+		}
+
+		if (error < 0 ||
+			(error = blame_origin_get(&parent, blame, parent_commit, &blob_id)) < 0 ||
+			(error = blame_origin_load(blame, parent)) < 0)
+			goto cleanup;
+
+		git_commit_free(parent_commit);
+		parent_commit = NULL;
+
+		if ((error = blame_diff_blobs(&d, parent->blob, o->blob, lines.count)) == 0)
+			error = blame_pass_unchanged(blame, o, parent, &d);
+		git__free(d.ranges);
+
+		if (!error && o->entries.length > 0 &&
+			(blame->opts.flags & GIT_BLAME_TRACK_MOVES_SAME_FILE) != 0)
+			error = blame_pass_moves(blame, o, parent);
+
+		/* it will be looked up again, most likely from the cache */
+		git_blob_free(parent->blob);
+		parent->blob = NULL;
+
+		if (error < 0)
+			goto cleanup;
+	}
+
+blamed:
+	git_vector_foreach(&o->entries, i, e) {
+		if ((error = git_vector_insert(&blame->blamed, e)) < 0)
+			goto cleanup;
+		o->entries.contents[i] = NULL;
+	}
+	git_vector_clear(&o->entries);
+
+cleanup:
+	blame_lines_free(&lines);
+	git_blob_free(o->blob);
+	o->blob = NULL;
+	git_commit_free(parent_commit);
+	git_commit_free(commit);
+	return error;
+}
+
+static int blame_entry_cmp(const void *a, const void *b)
+{
+	const blame_entry *ea = a, *eb = b;
+
+	return (ea->final_start < eb->final_start) ? -1 :
+		(ea->final_start > eb->final_start);
+}
+
+/* Make hunks of the blamed entries, merging the contiguous ones */
+static int blame_make_hunks(git_blame *blame)
+{
+	git_blame_hunk *hunk = NULL;
+	blame_entry *e;
+	size_t i;
+
+	git_vector_sort(&blame->blamed);
+
+	git_vector_foreach(&blame->blamed, i, e) {
+		if (hunk && e->origin->boundary == hunk->boundary &&
+			!git_oid_cmp(&e->origin->id, &hunk->orig_commit_id) &&
+			e->final_start + 1 == hunk->final_start_line_number + hunk->lines_in_hunk &&
+			e->orig_start + 1 == hunk->orig_start_line_number + hunk->lines_in_hunk) {
+			hunk->lines_in_hunk += e->count;
+			continue;
+		}
+
+		hunk = git__calloc(1, sizeof(git_blame_hunk));
+		GITERR_CHECK_ALLOC(hunk);
+
+		hunk->lines_in_hunk = e->count;
+		git_oid_cpy(&hunk->final_commit_id, &blame->final_id);
+		hunk->final_start_line_number = e->final_start + 1;
+		git_oid_cpy(&hunk->orig_commit_id, &e->origin->id);
+		hunk->orig_path = blame->path;
+		hunk->orig_start_line_number = e->orig_start + 1;
+		hunk->boundary = e->origin->boundary;
+
+		if (git_vector_insert(&blame->hunks, hunk) < 0) {
+			git__free(hunk);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int git_blame_file(
+	git_blame **out,
+	git_repository *repo,
+	const char *path,
+	const git_blame_options *options)
+{
+	git_blame *blame;
+	git_commit *commit = NULL;
+	blame_origin *o;
+	blame_lines lines = { NULL, NULL, 0 };
+	git_oid blob_id;
+	size_t min_line, max_line;
+	int error;
+
+	assert(out && repo && path);
+	*out = NULL;
+
+	blame = git__calloc(1, sizeof(git_blame));
+	GITERR_CHECK_ALLOC(blame);
+
+	blame->repo = repo;
+	if (options)
+		memcpy(&blame->opts, options, sizeof(git_blame_options));
+
+	if ((blame->path = git__strdup(path)) == NULL ||
+		(blame->origins = git_oidmap_alloc()) == NULL ||
+		git_pqueue_init(&blame->queue, 16, blame_origin_cmp_time) < 0 ||
+		git_vector_init(&blame->blamed, 16, blame_entry_cmp) < 0 ||
+		git_vector_init(&blame->hunks, 16, NULL) < 0) {
+		giterr_set_oom();
+		error = -1;
+		goto cleanup;
+	}
+
+	if (!git_oid_iszero(&blame->opts.newest_commit))
+		git_oid_cpy(&blame->final_id, &blame->opts.newest_commit);
+	else if ((error = git_reference_name_to_oid(
+			&blame->final_id, repo, GIT_HEAD_FILE)) < 0)
+		goto cleanup;
+
+	if ((error = git_commit_lookup(&commit, repo, &blame->final_id)) < 0)
+		goto cleanup;
+
+	if ((error = blame_find_blob(&blob_id, blame, commit)) == GIT_ENOTFOUND) {
+		giterr_set(GITERR_INVALID,
+			"Cannot blame '%s': the file is not in the commit", path);
+		goto cleanup;
+	}
+
+	if (error < 0 ||
+		(error = blame_origin_get(&o, blame, commit, &blob_id)) < 0 ||
+		(error = blame_origin_load(blame, o)) < 0 ||
+		(error = blame_lines_init(&lines, o->blob)) < 0)
+		goto cleanup;
+
+	min_line = blame->opts.min_line ? blame->opts.min_line : 1;
+	max_line = blame->opts.max_line ? blame->opts.max_line : lines.count;
+
+	if ((blame->opts.min_line || blame->opts.max_line) &&
+		(min_line > max_line || max_line > lines.count)) {
+		giterr_set(GITERR_INVALID,
+			"Cannot blame lines %"PRIuZ" to %"PRIuZ" of '%s': the file has %"PRIuZ" lines",
+			min_line, max_line, path, lines.count);
+		error = -1;
+		goto cleanup;
+	}
+
+	if (min_line <= max_line &&
+		(error = blame_suspect(blame, o, min_line - 1, min_line - 1,
+			max_line - min_line + 1)) < 0)
+		goto cleanup;
+
+	/* newest first, so each commit is processed after its children */
+	while ((o = git_pqueue_pop(&blame->queue)) != NULL) {
+		o->queued = false;
+
+		if (o->entries.length > 0 &&
+			(error = blame_origin_process(blame, o)) < 0)
+			goto cleanup;
+	}
+
+	if ((error = blame_make_hunks(blame)) < 0)
+		goto cleanup;
+
+	*out = blame;
+
+cleanup:
+	blame_lines_free(&lines);
+	git_commit_free(commit);
+
+	if (error < 0)
+		git_blame_free(blame);
+
+	return error;
+}
+
+size_t git_blame_get_hunk_count(git_blame *blame)
+{
+	assert(blame);
+	return blame->hunks.length;
+}
+
+const git_blame_hunk *git_blame_get_hunk_byindex(git_blame *blame, size_t index)
+{
+	assert(blame);
+	return git_vector_get(&blame->hunks, index);
+}
+
+const git_blame_hunk *git_blame_get_hunk_byline(git_blame *blame, size_t lineno)
+{
+	git_blame_hunk *hunk;
+	size_t lo = 0, hi;
+
+	assert(blame);
+
+	for (hi = blame->hunks.length; lo < hi; ) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		hunk = git_vector_get(&blame->hunks, mid);
+
+		if (lineno < hunk->final_start_line_number)
+			hi = mid;
+		else if (lineno >= hunk->final_start_line_number + hunk->lines_in_hunk)
+			lo = mid + 1;
+		else
+			return hunk;
+	}
+
+	return NULL;
+}
+
+void git_blame_free(git_blame *blame)
+{
+	blame_origin *o;
+	blame_entry *e;
+	git_blame_hunk *hunk;
+	size_t i;
+
+	if (blame == NULL)
+		return;
+
+	if (blame->origins) {
+		git_oidmap_foreach_value(blame->origins, o, {
+			git_vector_foreach(&o->entries, i, e)
+				git__free(e);
+			git_vector_free(&o->entries);
+			git_blob_free(o->blob);
+			git__free(o);
+		});
+		git_oidmap_free(blame->origins);
+	}
+
+	git_vector_foreach(&blame->blamed, i, e)
+		git__free(e);
+	git_vector_free(&blame->blamed);
+
+	git_vector_foreach(&blame->hunks, i, hunk)
+		git__free(hunk);
+	git_vector_free(&blame->hunks);
+
+	git_pqueue_free(&blame->queue);
+	git__free(blame->path);
+	git__free(blame);
+}
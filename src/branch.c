@@ -5,6 +5,8 @@
  * a Linking Exception. For full terms see the included COPYING file.
  */
 
+#define GIT_ALLOC_SUBSYSTEM GIT_ALLOC_REFS
+
 #include "common.h"
 #include "commit.h"
 #include "tag.h"
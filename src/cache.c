@@ -5,12 +5,15 @@
  * a Linking Exception. For full terms see the included COPYING file.
  */
 
+#define GIT_ALLOC_SUBSYSTEM GIT_ALLOC_ODB
+
 #include "common.h"
 #include "repository.h"
 #include "commit.h"
 #include "thread-utils.h"
 #include "util.h"
 #include "cache.h"
+#include "trace.h"
 #include "git2/oid.h"
 
 int git_cache_init(git_cache *cache, size_t size, git_cached_obj_freeptr free_ptr)
@@ -63,6 +66,8 @@ void *git_cache_get(git_cache *cache, const git_oid *oid)
 	}
 	git_mutex_unlock(&cache->lock);
 
+	GIT_TRACE_EVENT(result ? GIT_TRACE_CACHE_HIT : GIT_TRACE_CACHE_MISS, 0);
+
 	return result;
 }
 
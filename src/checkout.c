@@ -625,6 +625,10 @@ int git_checkout_index(
 	if (opts && opts->paths.count > 0)
 		diff_opts.pathspec = opts->paths;
 
+	if (opts &&
+		(opts->checkout_strategy & GIT_CHECKOUT_DISABLE_PATHSPEC_MATCH) != 0)
+		diff_opts.flags |= GIT_DIFF_DISABLE_PATHSPEC_MATCH;
+
 	if ((error = git_diff_workdir_to_index(&diff, repo, index, &diff_opts)) < 0)
 		goto cleanup;
 
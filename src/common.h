@@ -44,6 +44,7 @@
 
 #include "git2/types.h"
 #include "git2/errors.h"
+#include "git2/alloc.h"
 #include "thread-utils.h"
 #include "bswap.h"
 
@@ -267,7 +267,7 @@ static int config_set(git_config_file *cfg, const char *name, const char *value)
 	cvar_t *var = NULL, *old_var;
 	diskfile_backend *b = (diskfile_backend *)cfg;
 	char *key, *esc_value = NULL;
-	khiter_t pos;
+	git_hashmap_iter pos;
 	int rval, ret;
 
 	if (normalize_name(name, &key) < 0)
@@ -350,7 +350,7 @@ static int config_get(git_config_file *cfg, const char *name, const git_config_e
 {
 	diskfile_backend *b = (diskfile_backend *)cfg;
 	char *key;
-	khiter_t pos;
+	git_hashmap_iter pos;
 
 	if (normalize_name(name, &key) < 0)
 		return -1;
@@ -377,7 +377,7 @@ static int config_get_multivar(
 	cvar_t *var;
 	diskfile_backend *b = (diskfile_backend *)cfg;
 	char *key;
-	khiter_t pos;
+	git_hashmap_iter pos;
 
 	if (normalize_name(name, &key) < 0)
 		return -1;
@@ -439,7 +439,7 @@ static int config_set_multivar(
 	char *key;
 	regex_t preg;
 	int result;
-	khiter_t pos;
+	git_hashmap_iter pos;
 
 	assert(regexp);
 
@@ -512,7 +512,7 @@ static int config_delete(git_config_file *cfg, const char *name)
 	diskfile_backend *b = (diskfile_backend *)cfg;
 	char *key;
 	int result;
-	khiter_t pos;
+	git_hashmap_iter pos;
 
 	if (normalize_name(name, &key) < 0)
 		return -1;
@@ -941,7 +941,7 @@ static int config_parse(diskfile_backend *cfg_file, unsigned int level)
 	cvar_t *var, *existing;
 	git_buf buf = GIT_BUF_INIT;
 	int result = 0;
-	khiter_t pos;
+	git_hashmap_iter pos;
 
 	/* Initialize the reading position */
 	cfg_file->reader.read_ptr = cfg_file->reader.buffer.ptr;
@@ -4,6 +4,8 @@
  * This file is part of libgit2, distributed under the GNU GPL v2 with
  * a Linking Exception. For full terms see the included COPYING file.
  */
+#define GIT_ALLOC_SUBSYSTEM GIT_ALLOC_PACK
+
 #include "common.h"
 #include "git2/odb.h"
 #include "delta-apply.h"
@@ -36,6 +38,23 @@ static int hdr_sz(
 	return 0;
 }
 
+int git__delta_read_header(
+	size_t *base_sz,
+	size_t *res_sz,
+	const unsigned char *delta,
+	size_t delta_len)
+{
+	const unsigned char *delta_end = delta + delta_len;
+
+	if (hdr_sz(base_sz, &delta, delta_end) < 0 ||
+		hdr_sz(res_sz, &delta, delta_end) < 0) {
+		giterr_set(GITERR_INVALID, "Failed to read delta header. The delta is truncated");
+		return -1;
+	}
+
+	return 0;
+}
+
 int git__delta_apply(
 	git_rawobj *out,
 	const unsigned char *base,
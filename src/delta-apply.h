@@ -30,4 +30,19 @@ extern int git__delta_apply(
 	const unsigned char *delta,
 	size_t delta_len);
 
+/**
+ * Read the header of a git binary delta.
+ *
+ * @param base_sz pointer to store the size of the base
+ * @param res_sz pointer to store the size of the result
+ * @param delta the delta, of which only the start is needed
+ * @param delta_len number of bytes available at delta
+ * @return 0 on success, or GIT_ERROR if the header is truncated.
+ */
+extern int git__delta_read_header(
+	size_t *base_sz,
+	size_t *res_sz,
+	const unsigned char *delta,
+	size_t delta_len);
+
 #endif
@@ -13,6 +13,8 @@
  * published by the Free Software Foundation.
  */
 
+#define GIT_ALLOC_SUBSYSTEM GIT_ALLOC_PACK
+
 #include "delta.h"
 
 /* maximum hash entry list for the same hash bucket */
@@ -174,7 +176,7 @@ git_delta_create_index(const void *buf, unsigned long bufsize)
 	memset(hash, 0, hsize * sizeof(*hash));
 
 	/* allocate an array to count hash entries */
-	hash_count = calloc(hsize, sizeof(*hash_count));
+	hash_count = git__calloc(hsize, sizeof(*hash_count));
 	if (!hash_count) {
 		git__free(hash);
 		return NULL;
@@ -4,6 +4,8 @@
  * This file is part of libgit2, distributed under the GNU GPL v2 with
  * a Linking Exception. For full terms see the included COPYING file.
  */
+#define GIT_ALLOC_SUBSYSTEM GIT_ALLOC_DIFF
+
 #include "common.h"
 #include "diff.h"
 #include "fileops.h"
@@ -41,6 +43,17 @@ static git_diff_delta *diff_delta__alloc(
 	return delta;
 }
 
+static bool diff_delta__is_included(git_diff_list *diff, git_delta_t status)
+{
+	if (status == GIT_DELTA_IGNORED)
+		return (diff->opts.flags & GIT_DIFF_INCLUDE_IGNORED) != 0;
+
+	if (status == GIT_DELTA_UNTRACKED)
+		return (diff->opts.flags & GIT_DIFF_INCLUDE_UNTRACKED) != 0;
+
+	return true;
+}
+
 static int diff_delta__from_one(
 	git_diff_list *diff,
 	git_delta_t   status,
@@ -48,12 +61,7 @@ static int diff_delta__from_one(
 {
 	git_diff_delta *delta;
 
-	if (status == GIT_DELTA_IGNORED &&
-		(diff->opts.flags & GIT_DIFF_INCLUDE_IGNORED) == 0)
-		return 0;
-
-	if (status == GIT_DELTA_UNTRACKED &&
-		(diff->opts.flags & GIT_DIFF_INCLUDE_UNTRACKED) == 0)
+	if (!diff_delta__is_included(diff, status))
 		return 0;
 
 	if (!git_pathspec_match_path(
@@ -443,6 +451,14 @@ static int maybe_modified(
 	else if ((oitem->flags_extended & GIT_IDXENTRY_SKIP_WORKTREE) != 0)
 		status = GIT_DELTA_UNMODIFIED;
 
+	/* the filesystem monitor saw nothing happen to it since it was
+	 * found clean (so its stat data was not even loaded) */
+	else if (new_is_workdir &&
+		(oitem->flags_extended & GIT_IDXENTRY_FSMONITOR_VALID) != 0) {
+		status = GIT_DELTA_UNMODIFIED;
+		nmode = omode;
+	}
+
 	/* if basic type of file changed, then split into delete and add */
 	else if (GIT_MODE_TYPE(omode) != GIT_MODE_TYPE(nmode)) {
 		if ((diff->opts.flags & GIT_DIFF_INCLUDE_TYPECHANGE) != 0)
@@ -570,6 +586,21 @@ static int diff_list_init_from_iterators(
 	return 0;
 }
 
+/*
+ * Load the stat data of the current workdir item.  Returns 1 after
+ * stepping past the item if the file was removed since its directory
+ * was read, as a workdir iterator which does not defer stat would have.
+ */
+static int diff_load_stat(git_iterator *iter, const git_index_entry **item)
+{
+	int error = git_iterator_current_load_stat(iter, item);
+
+	if (error != GIT_ENOTFOUND)
+		return error;
+
+	return git_iterator_advance(iter, item) < 0 ? -1 : 1;
+}
+
 static int diff_from_iterators(
 	git_diff_list **diff_ptr,
 	git_repository *repo,
@@ -604,6 +635,9 @@ static int diff_from_iterators(
 			goto fail;
 	}
 
+	/* only lstat the workdir files whose stat data ends up being used */
+	git_iterator_workdir_defer_stat(new_iter);
+
 	if (git_iterator_current(old_iter, &oitem) < 0 ||
 		git_iterator_current(new_iter, &nitem) < 0)
 		goto fail;
@@ -707,6 +741,14 @@ static int diff_from_iterators(
 			else if (new_iter->type != GIT_ITERATOR_WORKDIR)
 				delta_type = GIT_DELTA_ADDED;
 
+			if (diff_delta__is_included(diff, delta_type) &&
+				(error = diff_load_stat(new_iter, &nitem)) != 0) {
+				if (error < 0)
+					goto fail;
+				error = 0;
+				continue;
+			}
+
 			if (diff_delta__from_one(diff, delta_type, nitem) < 0)
 				goto fail;
 
@@ -735,6 +777,15 @@ static int diff_from_iterators(
 		else {
 			assert(oitem && nitem && diff->entrycomp(oitem, nitem) == 0);
 
+			/* a file gone from the workdir comes back round as deleted */
+			if ((oitem->flags_extended & GIT_IDXENTRY_FSMONITOR_VALID) == 0 &&
+				(error = diff_load_stat(new_iter, &nitem)) != 0) {
+				if (error < 0)
+					goto fail;
+				error = 0;
+				continue;
+			}
+
 			if (maybe_modified(old_iter, oitem, new_iter, nitem, diff) < 0 ||
 				git_iterator_advance(old_iter, &oitem) < 0 ||
 				git_iterator_advance(new_iter, &nitem) < 0)
@@ -764,6 +815,20 @@ fail:
 	git__free(pfx); git_iterator_free(a); git_iterator_free(b); \
     } while (0)
 
+static int diff_workdir_iterator(
+	git_iterator **iter,
+	git_repository *repo,
+	const char *pfx,
+	const git_diff_options *opts)
+{
+	int error = git_iterator_for_workdir_range(iter, repo, pfx, pfx);
+
+	if (!error && opts && (opts->flags & GIT_DIFF_PARALLEL_WORKDIR_SCAN) != 0)
+		error = git_iterator_workdir_prefetch(*iter, 0);
+
+	return error;
+}
+
 int git_diff_tree_to_tree(
 	git_diff_list **diff,
 	git_repository *repo,
@@ -818,9 +883,13 @@ int git_diff_workdir_to_index(
 	if (!index && (error = git_repository_index__weakptr(&index, repo)) < 0)
 		return error;
 
+	/* this settles which entries need not be looked at */
+	if ((error = git_index__fsmonitor_update(index)) < 0)
+		return error;
+
 	DIFF_FROM_ITERATORS(
 		git_iterator_for_index_range(&a, index, pfx, pfx),
-	    git_iterator_for_workdir_range(&b, repo, pfx, pfx)
+	    diff_workdir_iterator(&b, repo, pfx, opts)
 	);
 
 	return error;
@@ -839,7 +908,7 @@ int git_diff_workdir_to_tree(
 
 	DIFF_FROM_ITERATORS(
 		git_iterator_for_tree_range(&a, repo, old_tree, pfx, pfx),
-	    git_iterator_for_workdir_range(&b, repo, pfx, pfx)
+	    diff_workdir_iterator(&b, repo, pfx, opts)
 	);
 
 	return error;
@@ -4,6 +4,8 @@
  * This file is part of libgit2, distributed under the GNU GPL v2 with
  * a Linking Exception. For full terms see the included COPYING file.
  */
+#define GIT_ALLOC_SUBSYSTEM GIT_ALLOC_DIFF
+
 #include "common.h"
 #include "git2/attr.h"
 #include "git2/oid.h"
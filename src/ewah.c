@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "ewah.h"
+
+#define EWAH_MAX_RUN      0xffffffffu
+#define EWAH_MAX_LITERALS 0x7fffffffu
+
+GIT_INLINE(uint32_t) ewah_get32(const char *buffer)
+{
+	uint32_t value;
+	memcpy(&value, buffer, 4);
+	return ntohl(value);
+}
+
+GIT_INLINE(uint64_t) ewah_get64(const char *buffer)
+{
+	return ((uint64_t)ewah_get32(buffer) << 32) | ewah_get32(buffer + 4);
+}
+
+GIT_INLINE(int) ewah_put32(git_buf *buf, uint32_t value)
+{
+	value = htonl(value);
+	return git_buf_put(buf, (const char *)&value, 4);
+}
+
+GIT_INLINE(int) ewah_put64(git_buf *buf, uint64_t value)
+{
+	if (ewah_put32(buf, (uint32_t)(value >> 32)) < 0)
+		return -1;
+	return ewah_put32(buf, (uint32_t)value);
+}
+
+static int ewah_error_invalid(void)
+{
+	giterr_set(GITERR_INDEX, "Invalid data in index - corrupted EWAH bitmap");
+	return -1;
+}
+
+int git_ewah_read(
+	size_t *bit_size_out,
+	size_t *consumed,
+	const char *buffer,
+	size_t size,
+	git_ewah_bit_cb cb,
+	void *payload)
+{
+	size_t bit_size, word_count, pos, bit = 0, i, j;
+	const char *words;
+
+	if (size < 12)
+		return ewah_error_invalid();
+
+	bit_size = ewah_get32(buffer);
+	word_count = ewah_get32(buffer + 4);
+	words = buffer + 8;
+
+	if (word_count > (size - 12) / 8)
+		return ewah_error_invalid();
+
+	for (pos = 0; pos < word_count; ) {
+		uint64_t rlw = ewah_get64(words + 8 * pos++);
+		size_t run = (size_t)((rlw >> 1) & EWAH_MAX_RUN);
+		size_t literals = (size_t)(rlw >> 33);
+
+		if (literals > word_count - pos)
+			return ewah_error_invalid();
+
+		if ((rlw & 1) != 0 && cb != NULL) {
+			for (j = 0; j < run * 64 && bit + j < bit_size; ++j)
+				if (cb(bit + j, payload))
+					return GIT_EUSER;
+		}
+		bit += run * 64;
+
+		for (i = 0; i < literals; ++i, ++pos, bit += 64) {
+			uint64_t word = ewah_get64(words + 8 * pos);
+
+			for (j = 0; word && cb != NULL; ++j, word >>= 1) {
+				if ((word & 1) == 0 || bit + j >= bit_size)
+					continue;
+				if (cb(bit + j, payload))
+					return GIT_EUSER;
+			}
+		}
+	}
+
+	if (bit_size_out)
+		*bit_size_out = bit_size;
+	if (consumed)
+		*consumed = 8 + 8 * word_count + 4;
+
+	return 0;
+}
+
+int git_ewah_write(git_buf *out, const uint64_t *words, size_t bit_size)
+{
+	size_t start = out->size, n = git_ewah_words(bit_size);
+	size_t i = 0, written = 0, last_rlw = 0;
+	uint32_t word_count;
+
+	ewah_put32(out, (uint32_t)bit_size);
+	ewah_put32(out, 0); /* the word count, filled in below */
+
+	/* runs of clean words, each followed by the literals up to the next */
+	do {
+		uint64_t running = (i < n && words[i] == ~(uint64_t)0) ? ~(uint64_t)0 : 0;
+		size_t run = 0, literals = 0, l;
+
+		while (i < n && words[i] == running && run < EWAH_MAX_RUN)
+			++i, ++run;
+
+		while (i + literals < n && literals < EWAH_MAX_LITERALS &&
+			words[i + literals] != 0 && words[i + literals] != ~(uint64_t)0)
+			++literals;
+
+		last_rlw = written;
+		ewah_put64(out, (running & 1) | ((uint64_t)run << 1) | ((uint64_t)literals << 33));
+
+		for (l = 0; l < literals; ++l)
+			ewah_put64(out, words[i++]);
+
+		written += 1 + literals;
+	} while (i < n);
+
+	ewah_put32(out, (uint32_t)last_rlw);
+
+	if (git_buf_oom(out))
+		return -1;
+
+	word_count = htonl((uint32_t)written);
+	memcpy(out->ptr + start + 4, &word_count, 4);
+
+	return 0;
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_ewah_h__
+#define INCLUDE_ewah_h__
+
+#include "common.h"
+#include "buffer.h"
+
+/*
+ * EWAH-compressed bitmaps as core git serializes them in index
+ * extensions: the number of bits, the number of 64-bit words, the words
+ * and the position of the last run-length word, all big-endian.
+ *
+ * A run-length word carries the running bit in bit 0, the number of
+ * words that repeat it in the next 32 bits and the number of literal
+ * words that follow it in the top 31 bits.
+ */
+
+typedef int (*git_ewah_bit_cb)(size_t pos, void *payload);
+
+/**
+ * Call `cb` with the position of each set bit of the bitmap at the
+ * start of `buffer`, in increasing order.  The number of bits is
+ * stored in `bit_size` and the number of bytes the bitmap took up in
+ * `consumed`, either of which may be NULL.
+ *
+ * @return 0, GIT_EUSER if the callback failed or -1 on invalid data
+ */
+extern int git_ewah_read(
+	size_t *bit_size,
+	size_t *consumed,
+	const char *buffer,
+	size_t size,
+	git_ewah_bit_cb cb,
+	void *payload);
+
+/**
+ * Append the serialized form of the `bit_size` bits in `words` (bit
+ * `n` being bit `n % 64` of word `n / 64`) to `out`.
+ */
+extern int git_ewah_write(git_buf *out, const uint64_t *words, size_t bit_size);
+
+#define git_ewah_words(bit_size) (((bit_size) + 63) / 64)
+#define git_ewah_set(words, n) ((words)[(n) / 64] |= (uint64_t)1 << ((n) % 64))
+#define git_ewah_get(words, n) (((words)[(n) / 64] >> ((n) % 64)) & 1)
+
+#endif
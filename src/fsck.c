@@ -0,0 +1,692 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "common.h"
+#include "repository.h"
+#include "odb.h"
+#include "commit.h"
+#include "tree.h"
+#include "tag.h"
+#include "pool.h"
+#include "oidmap.h"
+#include "thread-utils.h"
+
+#include "git2/fsck.h"
+#include "git2/object.h"
+#include "git2/revwalk.h"
+
+GIT__USE_OIDMAP;
+
+/* the visited set is split so that the workers seldom wait on each other */
+#define FSCK_SHARDS 64
+
+typedef struct {
+	git_oid id;
+	git_otype type;
+} fsck_item;
+
+typedef struct {
+	git_mutex lock;
+	git_oidmap *map;
+	git_pool oids;
+} fsck_shard;
+
+typedef struct fsck fsck;
+
+struct fsck {
+	git_repository *repo;
+	git_odb *odb;
+	unsigned int flags;
+	git_fsck_cb problem_cb;
+	void *payload;
+	int (*check)(fsck *f, const fsck_item *item);
+
+	/* objects waiting to be checked, taken from the top */
+	git_mutex lock;
+	git_cond work;
+	fsck_item *queue;
+	size_t queued, queue_alloc;
+	unsigned int active; /* threads which may still queue objects */
+	bool stop;
+
+	git_mutex report_lock;
+	int error; /* of the first problem */
+	char *message;
+
+	fsck_shard *seen;
+
+	git_thread *threads;
+	unsigned int nthreads, started;
+};
+
+static void fsck_stop(fsck *f)
+{
+	git_mutex_lock(&f->lock);
+	f->stop = true;
+	git_cond_broadcast(&f->work);
+	git_mutex_unlock(&f->lock);
+}
+
+/* Record the error just raised on this thread; the first one is what
+ * the check returns, the others only go to the callback.  Returns
+ * whether the check should stop. */
+static bool fsck_record(fsck *f, const git_oid *id, git_otype type, int error)
+{
+	const git_error *e = giterr_last();
+	const char *message = e ? e->message : "unknown error";
+	bool stop = false;
+
+	git_mutex_lock(&f->report_lock);
+
+	if (!f->error) {
+		f->error = error;
+		f->message = git__strdup(message);
+	}
+
+	if (!id || !f->problem_cb)
+		stop = true;
+	else if (f->problem_cb(id, type, error, message, f->payload)) {
+		f->error = GIT_EUSER;
+		stop = true;
+	}
+
+	git_mutex_unlock(&f->report_lock);
+
+	return stop;
+}
+
+/* A problem with an object: the check goes on unless told to stop */
+static int fsck_report(fsck *f, const git_oid *id, git_otype type, int error)
+{
+	bool stop = fsck_record(f, id, type, error);
+
+	giterr_clear();
+	if (stop)
+		fsck_stop(f);
+
+	return 0;
+}
+
+/* Failures which are not about an object end the check; the error
+ * is returned, and left set for the caller */
+static int fsck_fail(fsck *f, int error)
+{
+	fsck_record(f, NULL, GIT_OBJ_ANY, error);
+	fsck_stop(f);
+
+	return error;
+}
+
+/* Returns 1 the first time an object is seen, 0 afterwards */
+static int fsck_mark(fsck *f, const git_oid *id)
+{
+	fsck_shard *shard = &f->seen[id->id[0] % FSCK_SHARDS];
+	git_oid *key;
+	int ret = 0;
+
+	git_mutex_lock(&shard->lock);
+
+	if (!git_oidmap_exists(shard->map, id)) {
+		if ((key = git_pool_malloc(&shard->oids, 1)) == NULL)
+			ret = -1;
+		else {
+			git_oid_cpy(key, id);
+			git_oidmap_insert(shard->map, key, key, ret);
+			ret = (ret < 0) ? -1 : 1;
+		}
+	}
+
+	git_mutex_unlock(&shard->lock);
+
+	return (ret < 0) ? fsck_fail(f, -1) : ret;
+}
+
+static int fsck_queue(fsck *f, const git_oid *id, git_otype type)
+{
+	fsck_item *item;
+
+	git_mutex_lock(&f->lock);
+
+	if (f->queued == f->queue_alloc) {
+		size_t alloc = f->queue_alloc ? f->queue_alloc * 2 : 256;
+		fsck_item *queue = git__realloc(f->queue, alloc * sizeof(fsck_item));
+
+		if (!queue) {
+			git_mutex_unlock(&f->lock);
+			return fsck_fail(f, -1);
+		}
+
+		f->queue = queue;
+		f->queue_alloc = alloc;
+	}
+
+	item = &f->queue[f->queued++];
+	git_oid_cpy(&item->id, id);
+	item->type = type;
+
+	git_cond_signal(&f->work);
+	git_mutex_unlock(&f->lock);
+
+	return 0;
+}
+
+static int fsck_queue_new(fsck *f, const git_oid *id, git_otype type)
+{
+	int error = fsck_mark(f, id);
+	return (error > 0) ? fsck_queue(f, id, type) : error;
+}
+
+static void *fsck_worker(void *payload)
+{
+	fsck *f = payload;
+	fsck_item item;
+
+	git_mutex_lock(&f->lock);
+
+	for (;;) {
+		/* an empty queue only means that we are done once no other
+		 * thread may fill it again */
+		while (!f->queued && f->active && !f->stop)
+			git_cond_wait(&f->work, &f->lock);
+
+		if (!f->queued || f->stop)
+			break;
+
+		item = f->queue[--f->queued];
+		f->active++;
+		git_mutex_unlock(&f->lock);
+
+		f->check(f, &item);
+
+		git_mutex_lock(&f->lock);
+		if (!--f->active)
+			git_cond_broadcast(&f->work);
+	}
+
+	git_mutex_unlock(&f->lock);
+	return NULL;
+}
+
+static int fsck_init(fsck *f, const git_fsck_opts *opts, bool visited)
+{
+	unsigned int i;
+
+	memset(f, 0, sizeof(*f));
+
+	if (opts) {
+		f->flags = opts->flags;
+		f->problem_cb = opts->problem_cb;
+		f->payload = opts->payload;
+		f->nthreads = opts->nthreads;
+	}
+
+#ifdef GIT_THREADS
+	if (!f->nthreads)
+		f->nthreads = (unsigned int)git_online_cpus();
+	if (f->nthreads < 1)
+		f->nthreads = 1;
+#else
+	f->nthreads = 1;
+#endif
+
+	/* the thread which queues the first objects */
+	f->active = 1;
+
+	git_mutex_init(&f->lock);
+	git_mutex_init(&f->report_lock);
+#ifdef GIT_THREADS
+	git_cond_init(&f->work);
+#endif
+
+	if (!visited)
+		return 0;
+
+	f->seen = git__calloc(FSCK_SHARDS, sizeof(fsck_shard));
+	GITERR_CHECK_ALLOC(f->seen);
+
+	for (i = 0; i < FSCK_SHARDS; ++i) {
+		git_mutex_init(&f->seen[i].lock);
+
+		if ((f->seen[i].map = git_oidmap_alloc()) == NULL ||
+			git_pool_init(&f->seen[i].oids, sizeof(git_oid), 0) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/* The calling thread checks objects alongside the workers */
+static int fsck_start(fsck *f)
+{
+#ifdef GIT_THREADS
+	if (f->nthreads < 2)
+		return 0;
+
+	f->threads = git__calloc(f->nthreads - 1, sizeof(git_thread));
+	GITERR_CHECK_ALLOC(f->threads);
+
+	for (; f->started < f->nthreads - 1; f->started++) {
+		if (git_thread_create(&f->threads[f->started], NULL, fsck_worker, f) != 0) {
+			giterr_set(GITERR_THREAD, "Unable to create object check thread");
+			return -1;
+		}
+	}
+#else
+	GIT_UNUSED(f);
+#endif
+
+	return 0;
+}
+
+/* Done queueing: help with the checks, and wait for them to end */
+static int fsck_finish(fsck *f)
+{
+	unsigned int i;
+
+	git_mutex_lock(&f->lock);
+	if (!--f->active)
+		git_cond_broadcast(&f->work);
+	git_mutex_unlock(&f->lock);
+
+	fsck_worker(f);
+
+	for (i = 0; i < f->started; ++i)
+		git_thread_join(f->threads[i], NULL);
+	f->started = 0;
+
+	if (f->error == GIT_EUSER)
+		giterr_clear();
+	else if (f->error)
+		giterr_set_str(GITERR_ODB, f->message ? f->message : "unknown error");
+
+	return f->error;
+}
+
+static void fsck_free(fsck *f)
+{
+	unsigned int i;
+
+	/* in case an error kept `fsck_finish` from being called */
+	if (f->started) {
+		fsck_stop(f);
+		for (i = 0; i < f->started; ++i)
+			git_thread_join(f->threads[i], NULL);
+	}
+
+	if (f->seen) {
+		for (i = 0; i < FSCK_SHARDS; ++i) {
+			if (f->seen[i].map)
+				git_oidmap_free(f->seen[i].map);
+			git_pool_clear(&f->seen[i].oids);
+			git_mutex_free(&f->seen[i].lock);
+		}
+		git__free(f->seen);
+	}
+
+#ifdef GIT_THREADS
+	git_cond_free(&f->work);
+#endif
+	git_mutex_free(&f->lock);
+	git_mutex_free(&f->report_lock);
+
+	git__free(f->threads);
+	git__free(f->queue);
+	git__free(f->message);
+}
+
+static int check_blob(fsck *f, const git_oid *id)
+{
+	git_odb_object *obj;
+	int error;
+
+	if ((f->flags & GIT_FSCK_BLOBS_EXIST) != 0) {
+		if (git_odb_exists(f->odb, id))
+			return 0;
+
+		return fsck_report(f, id, GIT_OBJ_BLOB,
+			git_odb__error_notfound("blob is missing", id));
+	}
+
+	if ((error = git_odb_read(&obj, f->odb, id)) < 0)
+		return fsck_report(f, id, GIT_OBJ_BLOB, error);
+
+	if (git_odb_object_type(obj) != GIT_OBJ_BLOB) {
+		giterr_set(GITERR_ODB, "Object is a %s, not a blob",
+			git_object_type2string(git_odb_object_type(obj)));
+		error = fsck_report(f, id, GIT_OBJ_BLOB, -1);
+	}
+
+	git_odb_object_free(obj);
+	return error;
+}
+
+static int check_commit(fsck *f, git_commit *commit)
+{
+	unsigned int i, parents = git_commit_parentcount(commit);
+	int error;
+
+	if ((error = fsck_queue_new(f, git_commit_tree_oid(commit), GIT_OBJ_TREE)) < 0)
+		return error;
+
+	for (i = 0; i < parents && !error; ++i)
+		error = fsck_queue_new(f, git_commit_parent_oid(commit, i), GIT_OBJ_COMMIT);
+
+	return error;
+}
+
+/* Subtrees are queued for other threads, blobs checked right away */
+static int check_tree(fsck *f, git_tree *tree)
+{
+	const git_tree_entry *entry;
+	unsigned int i, count = git_tree_entrycount(tree);
+	int error = 0;
+
+	for (i = 0; i < count && !error; ++i) {
+		entry = git_tree_entry_byindex(tree, i);
+
+		if (S_ISGITLINK(entry->attr))
+			continue;
+
+		if ((error = fsck_mark(f, &entry->oid)) <= 0)
+			continue;
+
+		if (git_tree_entry__is_tree(entry))
+			error = fsck_queue(f, &entry->oid, GIT_OBJ_TREE);
+		else
+			error = check_blob(f, &entry->oid);
+	}
+
+	return error;
+}
+
+static int check_reachable(fsck *f, const fsck_item *item)
+{
+	git_object *obj;
+	int error;
+
+	if (item->type == GIT_OBJ_BLOB)
+		return check_blob(f, &item->id);
+
+	if ((error = git_object_lookup(&obj, f->repo, &item->id, item->type)) < 0)
+		return fsck_report(f, &item->id, item->type, error);
+
+	switch (git_object_type(obj)) {
+	case GIT_OBJ_COMMIT:
+		error = check_commit(f, (git_commit *)obj);
+		break;
+	case GIT_OBJ_TREE:
+		error = check_tree(f, (git_tree *)obj);
+		break;
+	case GIT_OBJ_TAG:
+		error = fsck_queue_new(f,
+			git_tag_target_oid((git_tag *)obj), git_tag_type((git_tag *)obj));
+		break;
+	default: /* a blob given as a tip, which has been read already */
+		break;
+	}
+
+	git_object_free(obj);
+	return error;
+}
+
+/* Mark what an excluded tree holds; a tree seen before has been already */
+static int exclude_entry_cb(const char *root, const git_tree_entry *entry, void *payload)
+{
+	fsck *f = payload;
+	int error;
+
+	GIT_UNUSED(root);
+
+	if (S_ISGITLINK(entry->attr))
+		return 0;
+
+	if ((error = fsck_mark(f, &entry->oid)) < 0)
+		return error;
+
+	return error ? 0 : 1;
+}
+
+/*
+ * Excluded objects are taken to be complete, down to the last blob of
+ * the trees of excluded commits; their history is walked later.  Objects
+ * missing from them are not our business.
+ */
+static int exclude_object(fsck *f, git_revwalk *walk, const git_oid *id)
+{
+	git_object *obj = NULL, *target;
+	git_tree *tree = NULL;
+	int error;
+
+	if ((error = fsck_mark(f, id)) < 0)
+		return error;
+
+	if (git_object_lookup(&obj, f->repo, id, GIT_OBJ_ANY) < 0)
+		goto done;
+
+	while (git_object_type(obj) == GIT_OBJ_TAG) {
+		if ((error = fsck_mark(f, git_tag_target_oid((git_tag *)obj))) < 0 ||
+			git_tag_target(&target, (git_tag *)obj) < 0)
+			goto done;
+
+		git_object_free(obj);
+		obj = target;
+	}
+
+	if (git_object_type(obj) == GIT_OBJ_TREE)
+		tree = (git_tree *)obj;
+	else if (git_object_type(obj) != GIT_OBJ_COMMIT)
+		goto done;
+	else if ((error = fsck_mark(f, git_commit_tree_oid((git_commit *)obj))) < 0 ||
+		git_revwalk_push(walk, git_object_id(obj)) < 0 ||
+		git_commit_tree(&tree, (git_commit *)obj) < 0)
+		goto done;
+
+	if (git_tree_walk(tree, exclude_entry_cb, GIT_TREEWALK_PRE, f) < 0 && f->error)
+		error = f->error;
+
+	if ((git_object *)tree != obj)
+		git_tree_free(tree);
+
+done:
+	git_object_free(obj);
+	if (error >= 0)
+		giterr_clear();
+	return error;
+}
+
+/* The ancestors of excluded commits are complete too, as are their
+ * root trees, although those are not looked into */
+static int exclude_history(fsck *f, git_revwalk *walk)
+{
+	git_commit *commit;
+	git_oid id;
+	int error = 0;
+
+	while (git_revwalk_next(&id, walk) == 0) {
+		if ((error = fsck_mark(f, &id)) < 0)
+			return error;
+
+		if (git_commit_lookup(&commit, f->repo, &id) < 0)
+			break;
+
+		error = fsck_mark(f, git_commit_tree_oid(commit));
+		git_commit_free(commit);
+
+		if (error < 0)
+			return error;
+	}
+
+	giterr_clear();
+	return 0;
+}
+
+int git_repository_check_connectivity(
+	git_repository *repo,
+	const git_oid *tips,
+	size_t ntips,
+	const git_oid *exclude,
+	size_t nexclude,
+	const git_fsck_opts *opts)
+{
+	fsck f;
+	git_revwalk *walk = NULL;
+	size_t i;
+	int error;
+
+	assert(repo && (tips || !ntips) && (exclude || !nexclude));
+
+	if ((error = fsck_init(&f, opts, true)) < 0)
+		goto cleanup;
+
+	f.repo = repo;
+	f.check = check_reachable;
+
+	if ((error = git_repository_odb__weakptr(&f.odb, repo)) < 0)
+		goto cleanup;
+
+	if (nexclude > 0) {
+		if ((error = git_revwalk_new(&walk, repo)) < 0)
+			goto cleanup;
+
+		for (i = 0; i < nexclude; ++i)
+			if ((error = exclude_object(&f, walk, &exclude[i])) < 0)
+				goto cleanup;
+
+		if ((error = exclude_history(&f, walk)) < 0)
+			goto cleanup;
+	}
+
+	if ((error = fsck_start(&f)) < 0)
+		goto cleanup;
+
+	for (i = 0; i < ntips; ++i)
+		if ((error = fsck_queue_new(&f, &tips[i], GIT_OBJ_ANY)) < 0)
+			break;
+
+	error = fsck_finish(&f);
+
+cleanup:
+	git_revwalk_free(walk);
+	fsck_free(&f);
+	return error;
+}
+
+static int verify_parse(git_odb_object *obj)
+{
+	int error = 0;
+
+	switch (obj->raw.type) {
+	case GIT_OBJ_COMMIT: {
+		git_commit *commit = git__calloc(1, sizeof(git_commit));
+		GITERR_CHECK_ALLOC(commit);
+		error = git_commit__parse_buffer(commit, obj->raw.data, obj->raw.len);
+		git_commit__free(commit);
+		break;
+	}
+	case GIT_OBJ_TREE: {
+		git_tree *tree = git__calloc(1, sizeof(git_tree));
+		GITERR_CHECK_ALLOC(tree);
+		error = git_tree__parse(tree, obj);
+		git_tree__free(tree);
+		break;
+	}
+	case GIT_OBJ_TAG: {
+		git_tag *tag = git__calloc(1, sizeof(git_tag));
+		GITERR_CHECK_ALLOC(tag);
+		error = git_tag__parse_buffer(tag, obj->raw.data, obj->raw.len);
+		git_tag__free(tag);
+		break;
+	}
+	default:
+		break;
+	}
+
+	return error;
+}
+
+static int verify_object(fsck *f, const fsck_item *item)
+{
+	git_odb_object *obj;
+	git_otype type = GIT_OBJ_ANY;
+	git_oid actual;
+	size_t len;
+	int error;
+
+	if ((f->flags & GIT_FSCK_BLOBS_EXIST) != 0) {
+		if ((error = git_odb_read_header(&len, &type, f->odb, &item->id)) < 0)
+			return fsck_report(f, &item->id, type, error);
+
+		if (type == GIT_OBJ_BLOB)
+			return 0;
+	}
+
+	if ((error = git_odb_read(&obj, f->odb, &item->id)) < 0)
+		return fsck_report(f, &item->id, type, error);
+
+	type = obj->raw.type;
+
+	if ((error = git_odb_hash(&actual, obj->raw.data, obj->raw.len, type)) < 0)
+		goto done;
+
+	if (git_oid_cmp(&actual, &item->id) != 0) {
+		char hex[GIT_OID_HEXSZ + 1];
+
+		git_oid_tostr(hex, sizeof(hex), &actual);
+		giterr_set(GITERR_ODB, "Object hashes to %s", hex);
+		error = -1;
+		goto done;
+	}
+
+	error = verify_parse(obj);
+
+done:
+	git_odb_object_free(obj);
+	return (error < 0) ? fsck_report(f, &item->id, type, error) : 0;
+}
+
+static int verify_queue_cb(git_oid *id, void *payload)
+{
+	fsck *f = payload;
+	bool stop;
+
+	if (fsck_queue(f, id, GIT_OBJ_ANY) < 0)
+		return -1;
+
+	git_mutex_lock(&f->lock);
+	stop = f->stop;
+	git_mutex_unlock(&f->lock);
+
+	return stop ? GIT_EUSER : 0;
+}
+
+int git_odb_verify(git_odb *odb, const git_fsck_opts *opts)
+{
+	fsck f;
+	int error;
+
+	assert(odb);
+
+	/* objects stored twice are checked twice, which is what we want */
+	if ((error = fsck_init(&f, opts, false)) < 0)
+		goto cleanup;
+
+	f.odb = odb;
+	f.check = verify_object;
+
+	if ((error = fsck_start(&f)) < 0)
+		goto cleanup;
+
+	if ((error = git_odb_foreach(odb, verify_queue_cb, &f)) < 0 &&
+		error != GIT_EUSER)
+		fsck_fail(&f, error);
+
+	error = fsck_finish(&f);
+
+cleanup:
+	fsck_free(&f);
+	return error;
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "common.h"
+#include "fsmonitor.h"
+
+int git_fsmonitor_result_add(git_fsmonitor_result *result, const char *path)
+{
+	char *copy;
+
+	assert(result && path);
+
+	/* no point in collecting paths once everything changed */
+	if (result->all)
+		return 0;
+
+	copy = git__strdup(path);
+	GITERR_CHECK_ALLOC(copy);
+
+	if (git_vector_insert(&result->paths, copy) < 0) {
+		git__free(copy);
+		return -1;
+	}
+
+	return 0;
+}
+
+void git_fsmonitor_result_all(git_fsmonitor_result *result)
+{
+	char *path;
+	unsigned int i;
+
+	assert(result);
+
+	git_vector_foreach(&result->paths, i, path)
+		git__free(path);
+	git_vector_clear(&result->paths);
+
+	result->all = 1;
+}
+
+int git_fsmonitor_result_set_token(
+	git_fsmonitor_result *result, const char *token)
+{
+	char *copy;
+
+	assert(result && token);
+
+	copy = git__strdup(token);
+	GITERR_CHECK_ALLOC(copy);
+
+	git__free(result->token);
+	result->token = copy;
+
+	return 0;
+}
+
+int git_fsmonitor__query(
+	git_fsmonitor_result *result, git_fsmonitor *fsm, const char *token)
+{
+	int error;
+
+	assert(result && fsm);
+
+	memset(result, 0, sizeof(*result));
+
+	if ((error = git_vector_init(&result->paths, 16, git__strcmp_cb)) < 0 ||
+		(error = fsm->query(fsm, token, result)) < 0)
+		return error;
+
+	if (!result->token) {
+		giterr_set(GITERR_INVALID,
+			"The filesystem monitor did not hand out a token");
+		return -1;
+	}
+
+	git_vector_sort(&result->paths);
+
+	return 0;
+}
+
+void git_fsmonitor__result_free(git_fsmonitor_result *result)
+{
+	char *path;
+	unsigned int i;
+
+	if (!result)
+		return;
+
+	git_vector_foreach(&result->paths, i, path)
+		git__free(path);
+	git_vector_free(&result->paths);
+
+	git__free(result->token);
+	result->token = NULL;
+}
+
+void git_fsmonitor_free(git_fsmonitor *fsm)
+{
+	if (fsm)
+		fsm->free(fsm);
+}
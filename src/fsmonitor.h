@@ -0,0 +1,29 @@
+/*
+ * Copyright (C) 2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_fsmonitor_h__
+#define INCLUDE_fsmonitor_h__
+
+#include "common.h"
+#include "vector.h"
+#include "git2/fsmonitor.h"
+
+struct git_fsmonitor_result {
+	git_vector paths; /* sorted once the query returns */
+	char *token;
+	unsigned int all:1;
+};
+
+/*
+ * Ask `fsm` what changed since `token`; the result must be released
+ * with `git_fsmonitor__result_free` even when this fails.
+ */
+extern int git_fsmonitor__query(
+	git_fsmonitor_result *result, git_fsmonitor *fsm, const char *token);
+
+extern void git_fsmonitor__result_free(git_fsmonitor_result *result);
+
+#endif
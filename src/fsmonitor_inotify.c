@@ -0,0 +1,414 @@
+/*
+ * Copyright (C) 2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "common.h"
+#include "fsmonitor.h"
+
+#ifdef __linux__
+
+#include <sys/inotify.h>
+#include "buffer.h"
+#include "path.h"
+#include "strmap.h"
+#include "repository.h"
+
+GIT__USE_STRMAP
+
+#define INOTIFY_EVENTS \
+	(IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MODIFY | \
+	 IN_MOVED_FROM | IN_MOVED_TO)
+
+/* past this many remembered paths, start over and answer older
+ * tokens with "everything" */
+#define INOTIFY_MAX_CHANGES 65536
+
+typedef struct {
+	int wd;
+	char path[GIT_FLEX_ARRAY]; /* "" for the workdir, else "dir/" */
+} inotify_watch;
+
+typedef struct {
+	size_t seq; /* value of `fsmonitor_inotify.seq` when last changed */
+	char path[GIT_FLEX_ARRAY];
+} inotify_change;
+
+typedef struct {
+	git_fsmonitor parent;
+	git_mutex lock;
+	int fd;
+	git_buf root;
+	git_vector watches; /* inotify_watch, by watch descriptor */
+	git_strmap *changes;
+	size_t seq;   /* bumped each time a token is handed out */
+	size_t since; /* tokens older than this cannot be answered */
+	char id[64];  /* tells the tokens of this instance apart */
+} fsmonitor_inotify;
+
+static int inotify_watch_cmp(const void *a, const void *b)
+{
+	const inotify_watch *wa = a, *wb = b;
+	return (wa->wd < wb->wd) ? -1 : (wa->wd > wb->wd);
+}
+
+static int inotify_watch_tree(fsmonitor_inotify *fsm, git_buf *path);
+
+static int inotify_watch_tree_cb(void *payload, git_buf *path)
+{
+	fsmonitor_inotify *fsm = payload;
+
+	/* changes to the repository itself are not the workdir's */
+	if (git_buf_len(path) == git_buf_len(&fsm->root) + strlen(DOT_GIT) &&
+		!strcmp(path->ptr + git_buf_len(&fsm->root), DOT_GIT))
+		return 0;
+
+	return inotify_watch_tree(fsm, path);
+}
+
+static int inotify_watch_tree(fsmonitor_inotify *fsm, git_buf *path)
+{
+	inotify_watch *watch;
+	size_t rel_len;
+	int wd;
+
+	/* this doubles as the check whether `path` is a directory */
+	wd = inotify_add_watch(fsm->fd, path->ptr,
+		INOTIFY_EVENTS | IN_ONLYDIR | IN_DONT_FOLLOW);
+	if (wd < 0) {
+		if (errno == ENOTDIR || errno == ENOENT)
+			return 0;
+
+		giterr_set(GITERR_OS, "Failed to watch directory '%s'", path->ptr);
+		return -1;
+	}
+
+	rel_len = git_buf_len(path) - git_buf_len(&fsm->root);
+
+	watch = git__malloc(sizeof(inotify_watch) + rel_len + 2);
+	GITERR_CHECK_ALLOC(watch);
+
+	watch->wd = wd;
+	memcpy(watch->path, path->ptr + git_buf_len(&fsm->root), rel_len);
+	if (rel_len)
+		watch->path[rel_len++] = '/';
+	watch->path[rel_len] = '\0';
+
+	if (git_vector_insert(&fsm->watches, watch) < 0) {
+		git__free(watch);
+		return -1;
+	}
+
+	if (git_path_direach(path, inotify_watch_tree_cb, fsm) < 0) {
+		/* it is gone again; its parent will have seen that */
+		if (!git_path_isdir(path->ptr)) {
+			giterr_clear();
+			return 0;
+		}
+		return -1;
+	}
+
+	return 0;
+}
+
+static inotify_watch *inotify_find_watch(fsmonitor_inotify *fsm, int wd, unsigned int *pos)
+{
+	inotify_watch key;
+	int idx;
+
+	key.wd = wd;
+	if ((idx = git_vector_bsearch(&fsm->watches, &key)) < 0)
+		return NULL;
+
+	*pos = (unsigned int)idx;
+	return git_vector_get(&fsm->watches, *pos);
+}
+
+static void inotify_forget_changes(fsmonitor_inotify *fsm)
+{
+	inotify_change *change;
+
+	git_strmap_foreach_value(fsm->changes, change, {
+		git__free(change);
+	});
+	git_strmap_clear(fsm->changes);
+
+	fsm->since = fsm->seq;
+}
+
+static int inotify_record(fsmonitor_inotify *fsm, const char *path)
+{
+	inotify_change *change;
+	git_hashmap_iter pos;
+	size_t path_len;
+	int error;
+
+	pos = git_strmap_lookup_index(fsm->changes, path);
+	if (git_strmap_valid_index(fsm->changes, pos)) {
+		change = git_strmap_value_at(fsm->changes, pos);
+		change->seq = fsm->seq;
+		return 0;
+	}
+
+	if (git_strmap_num_entries(fsm->changes) >= INOTIFY_MAX_CHANGES)
+		inotify_forget_changes(fsm);
+
+	path_len = strlen(path);
+	change = git__malloc(sizeof(inotify_change) + path_len + 1);
+	GITERR_CHECK_ALLOC(change);
+
+	change->seq = fsm->seq;
+	memcpy(change->path, path, path_len + 1);
+
+	git_strmap_insert(fsm->changes, change->path, change, error);
+	if (error < 0) {
+		git__free(change);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Drop every watch and set them up again, for when the paths the
+ * watches stand for can no longer be trusted */
+static int inotify_rewatch(fsmonitor_inotify *fsm)
+{
+	inotify_watch *watch;
+	git_buf path = GIT_BUF_INIT;
+	unsigned int i;
+	int error;
+
+	git_vector_foreach(&fsm->watches, i, watch) {
+		inotify_rm_watch(fsm->fd, watch->wd);
+		git__free(watch);
+	}
+	git_vector_clear(&fsm->watches);
+
+	inotify_forget_changes(fsm);
+
+	if ((error = git_buf_set(&path, fsm->root.ptr, fsm->root.size)) == 0)
+		error = inotify_watch_tree(fsm, &path);
+
+	git_buf_free(&path);
+	return error;
+}
+
+static int inotify_read_events(fsmonitor_inotify *fsm)
+{
+	union {
+		struct inotify_event event;
+		char data[16 * (sizeof(struct inotify_event) + NAME_MAX + 1)];
+	} buf;
+	const struct inotify_event *event;
+	inotify_watch *watch;
+	git_buf path = GIT_BUF_INIT, full_path = GIT_BUF_INIT;
+	unsigned int pos;
+	bool rewatch = false;
+	ssize_t len;
+	char *ptr;
+	int error = 0;
+
+	while ((len = read(fsm->fd, buf.data, sizeof(buf.data))) > 0) {
+		for (ptr = buf.data; !error && ptr < buf.data + len;
+			 ptr += sizeof(struct inotify_event) + event->len) {
+			event = (const struct inotify_event *)ptr;
+
+			/* events were lost, or a directory moved and took the
+			 * paths of all the watches below it along */
+			if ((event->mask & IN_Q_OVERFLOW) != 0 ||
+				((event->mask & IN_ISDIR) != 0 &&
+				 (event->mask & (IN_MOVED_FROM | IN_MOVED_TO)) != 0)) {
+				rewatch = true;
+				continue;
+			}
+
+			if ((watch = inotify_find_watch(fsm, event->wd, &pos)) == NULL)
+				continue;
+
+			if ((event->mask & IN_IGNORED) != 0) {
+				git_vector_remove(&fsm->watches, pos);
+				git__free(watch);
+				continue;
+			}
+
+			/* events about a watched directory itself show up in
+			 * its parent as well */
+			if (!event->len ||
+				(!*watch->path && !strcmp(event->name, DOT_GIT)))
+				continue;
+
+			git_buf_clear(&path);
+			if ((error = git_buf_joinpath(&path, watch->path, event->name)) < 0 ||
+				(error = inotify_record(fsm, path.ptr)) < 0)
+				break;
+
+			/* the directory stands for all it already contains, so
+			 * only later changes need a watch */
+			if ((event->mask & (IN_CREATE | IN_ISDIR)) == (IN_CREATE | IN_ISDIR) &&
+				(error = git_buf_joinpath(&full_path, fsm->root.ptr, path.ptr)) == 0)
+				error = inotify_watch_tree(fsm, &full_path);
+		}
+
+		if (error < 0)
+			break;
+	}
+
+	if (!error && len < 0 && errno != EAGAIN && errno != EINTR) {
+		giterr_set(GITERR_OS, "Failed to read filesystem events");
+		error = -1;
+	}
+
+	if (!error && rewatch)
+		error = inotify_rewatch(fsm);
+
+	git_buf_free(&path);
+	git_buf_free(&full_path);
+	return error;
+}
+
+static int inotify_parse_token(size_t *seq, fsmonitor_inotify *fsm, const char *token)
+{
+	size_t id_len = strlen(fsm->id);
+	int64_t value;
+	const char *end;
+
+	if (!token || strncmp(token, fsm->id, id_len) != 0 || token[id_len] != ':' ||
+		git__strtol64(&value, token + id_len + 1, &end, 10) < 0 || *end ||
+		value < 0)
+		return -1;
+
+	*seq = (size_t)value;
+	return 0;
+}
+
+static int inotify_query(
+	git_fsmonitor *parent, const char *token, git_fsmonitor_result *result)
+{
+	fsmonitor_inotify *fsm = (fsmonitor_inotify *)parent;
+	inotify_change *change;
+	char new_token[sizeof(fsm->id) + 32];
+	size_t since;
+	int error;
+
+	git_mutex_lock(&fsm->lock);
+
+	if ((error = inotify_read_events(fsm)) < 0)
+		goto done;
+
+	if (inotify_parse_token(&since, fsm, token) < 0 ||
+		since < fsm->since || since > fsm->seq)
+		git_fsmonitor_result_all(result);
+	else {
+		git_strmap_foreach_value(fsm->changes, change, {
+			if (change->seq > since &&
+				(error = git_fsmonitor_result_add(result, change->path)) < 0)
+				goto done;
+		});
+	}
+
+	p_snprintf(new_token, sizeof(new_token), "%s:%"PRIuZ, fsm->id, fsm->seq);
+	if ((error = git_fsmonitor_result_set_token(result, new_token)) < 0)
+		goto done;
+
+	/* changes seen from now on are newer than the token */
+	fsm->seq++;
+
+done:
+	git_mutex_unlock(&fsm->lock);
+	return error;
+}
+
+static void inotify_free(git_fsmonitor *parent)
+{
+	fsmonitor_inotify *fsm = (fsmonitor_inotify *)parent;
+	inotify_watch *watch;
+	inotify_change *change;
+	unsigned int i;
+
+	if (fsm->fd >= 0)
+		close(fsm->fd);
+
+	git_vector_foreach(&fsm->watches, i, watch)
+		git__free(watch);
+	git_vector_free(&fsm->watches);
+
+	if (fsm->changes) {
+		git_strmap_foreach_value(fsm->changes, change, {
+			git__free(change);
+		});
+		git_strmap_free(fsm->changes);
+	}
+
+	git_buf_free(&fsm->root);
+	git_mutex_free(&fsm->lock);
+	git__free(fsm);
+}
+
+int git_fsmonitor_inotify_new(git_fsmonitor **out, const char *workdir)
+{
+	static git_atomic instances;
+	fsmonitor_inotify *fsm;
+	git_buf path = GIT_BUF_INIT;
+	int error;
+
+	assert(out && workdir);
+
+	*out = NULL;
+
+	fsm = git__calloc(1, sizeof(fsmonitor_inotify));
+	GITERR_CHECK_ALLOC(fsm);
+
+	fsm->parent.query = inotify_query;
+	fsm->parent.free = inotify_free;
+	fsm->seq = fsm->since = 1;
+	git_mutex_init(&fsm->lock);
+
+	/* a token handed out by an earlier process may not be taken for one
+	 * of ours, so tell instances apart by more than just the pid */
+	p_snprintf(fsm->id, sizeof(fsm->id), "inotify:%lu.%lu.%d",
+		(unsigned long)getpid(), (unsigned long)time(NULL),
+		git_atomic_inc(&instances));
+
+	if ((fsm->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0) {
+		giterr_set(GITERR_OS, "Failed to initialize inotify");
+		error = -1;
+		goto fail;
+	}
+
+	if ((error = git_vector_init(&fsm->watches, 64, inotify_watch_cmp)) < 0 ||
+		(error = git_path_prettify_dir(&fsm->root, workdir, NULL)) < 0 ||
+		(error = git_buf_set(&path, fsm->root.ptr, fsm->root.size)) < 0)
+		goto fail;
+
+	if ((fsm->changes = git_strmap_alloc()) == NULL) {
+		error = -1;
+		goto fail;
+	}
+
+	if ((error = inotify_watch_tree(fsm, &path)) < 0)
+		goto fail;
+
+	git_buf_free(&path);
+	*out = &fsm->parent;
+	return 0;
+
+fail:
+	git_buf_free(&path);
+	inotify_free(&fsm->parent);
+	return error;
+}
+
+#else
+
+int git_fsmonitor_inotify_new(git_fsmonitor **out, const char *workdir)
+{
+	GIT_UNUSED(workdir);
+
+	*out = NULL;
+	giterr_set(GITERR_OS, "inotify is not available on this platform");
+	return -1;
+}
+
+#endif
@@ -13,6 +13,20 @@
 
 git_mutex git__mwindow_mutex;
 
+/*
+ * Free the memory a thread's global state keeps between calls
+ */
+static void global_state_release(git_global_st *st)
+{
+	git_scratch__clear(&st->scratch);
+
+	if (st->last_error == &st->error_t)
+		st->last_error = NULL;
+
+	git__free(st->error_t.message);
+	st->error_t.message = NULL;
+}
+
 /**
  * Handle the global state with TLS
  *
@@ -76,6 +90,8 @@ int git_threads_init(void)
 
 void git_threads_shutdown(void)
 {
+	git__global_state_release();
+
 	TlsFree(_tls_index);
 	_tls_init = 0;
 	git_mutex_free(&git__mwindow_mutex);
@@ -84,6 +100,14 @@ void git_threads_shutdown(void)
 	git_hash_global_shutdown();
 }
 
+void git__global_state_release(void)
+{
+	void *ptr;
+
+	if (_tls_init && (ptr = TlsGetValue(_tls_index)) != NULL)
+		global_state_release(ptr);
+}
+
 git_global_st *git__global_state(void)
 {
 	void *ptr;
@@ -109,6 +133,7 @@ static int _tls_init = 0;
 
 static void cb__free_status(void *st)
 {
+	global_state_release(st);
 	git__free(st);
 }
 
@@ -132,6 +157,9 @@ int git_threads_init(void)
 
 void git_threads_shutdown(void)
 {
+	/* The key destructor only runs for threads exiting on their own */
+	git__global_state_release();
+
 	pthread_key_delete(_tls_key);
 	_tls_init = 0;
 
@@ -139,6 +167,14 @@ void git_threads_shutdown(void)
 	git_hash_global_shutdown();
 }
 
+void git__global_state_release(void)
+{
+	void *ptr;
+
+	if (_tls_init && (ptr = pthread_getspecific(_tls_key)) != NULL)
+		global_state_release(ptr);
+}
+
 git_global_st *git__global_state(void)
 {
 	void *ptr;
@@ -169,7 +205,12 @@ int git_threads_init(void)
 
 void git_threads_shutdown(void)
 {
-	/* noop */
+	git__global_state_release();
+}
+
+void git__global_state_release(void)
+{
+	global_state_release(&__state);
 }
 
 git_global_st *git__global_state(void)
@@ -9,6 +9,7 @@
 
 #include "mwindow.h"
 #include "hash.h"
+#include "scratch.h"
 
 #if defined(GIT_THREADS) && defined(_MSC_VER)
 # define GIT_MEMORY_BARRIER MemoryBarrier()
@@ -21,10 +22,14 @@
 typedef struct {
 	git_error *last_error;
 	git_error error_t;
+	git_scratch scratch;
 } git_global_st;
 
 git_global_st *git__global_state(void);
 
+/* Free what the calling thread's state holds on to between calls */
+void git__global_state_release(void);
+
 extern git_mutex git__mwindow_mutex;
 
 #define GIT_GLOBAL (git__global_state())
@@ -0,0 +1,888 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include <regex.h>
+
+#include "common.h"
+#include "repository.h"
+#include "odb.h"
+#include "index.h"
+#include "filter.h"
+#include "pathspec.h"
+#include "pool.h"
+#include "thread-utils.h"
+
+#include "git2/grep.h"
+#include "git2/tree.h"
+
+/* like git, only look at the start of a file to tell if it is binary */
+#define GREP_BINARY_CHECK 8000
+
+typedef struct {
+	size_t line_number;
+	size_t offset, len; /* of the line in the entry's `lines` */
+	size_t match_offset, match_len;
+} grep_hit;
+
+typedef struct {
+	const char *path;
+	git_oid oid;
+	unsigned int mode;
+	git_off_t locality;
+	bool located;
+
+	bool finished; /* set under the lock */
+	int error;
+	grep_hit *hits;
+	size_t nhits, hits_alloc;
+	git_buf lines;
+} grep_entry;
+
+typedef struct {
+	unsigned int flags;
+
+	/*
+	 * A string in every match, looked for before running the regex;
+	 * lowercase when ignoring case.  When `has_regex` is unset, it is
+	 * the whole pattern.
+	 */
+	char *literal;
+	size_t literal_len;
+
+	bool has_regex;
+	regex_t regex;
+} grep_pattern;
+
+typedef struct {
+	git_repository *repo;
+	git_odb *odb;
+	const char *workdir; /* set to read the files there */
+	git_grep_cb cb;
+	void *payload;
+	unsigned int flags;
+	grep_pattern pattern;
+
+	git_pool pool;
+	git_vector pathspec;
+	char *pathspec_prefix;
+
+	git_vector entries; /* in path order */
+	grep_entry **order; /* in the order to search them */
+
+	/* the workers and the caller take entries from `order` */
+	git_mutex lock;
+	git_cond done;
+	size_t next;
+	bool stop;
+	git_thread *threads;
+	unsigned int nthreads, started;
+} grep;
+
+
+/*
+ * Patterns
+ */
+
+/* Characters which make a pattern more than a string */
+#define GREP_REGEX_CHARS "\\[](){}.*+?^$|"
+
+static bool grep_is_ascii(const char *str, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; ++i)
+		if ((unsigned char)str[i] >= 0x80)
+			return false;
+
+	return true;
+}
+
+/*
+ * Find the longest run of plain characters which any match of an
+ * extended regular expression must contain.  Nothing is found in
+ * patterns with alternatives, nor in groups, which may be repeated
+ * or left out.
+ */
+static int grep_required_literal(git_buf *out, const char *pattern)
+{
+	git_buf run = GIT_BUF_INIT;
+	const char *scan = pattern;
+	int depth = 0;
+	char c;
+
+	git_buf_clear(out);
+
+	if (strchr(pattern, '|') != NULL)
+		return 0;
+
+	while ((c = *scan++) != '\0') {
+		switch (c) {
+		case '*':
+		case '?':
+		case '{':
+			/* the character before may not be there */
+			if (run.size > 0)
+				git_buf_truncate(&run, run.size - 1);
+			if (c == '{')
+				while (*scan && *scan++ != '}')
+					/* skip the bounds */;
+			c = '\0';
+			break;
+		case '[':
+			/* a bracket expression may start with ']' */
+			if (*scan == '^')
+				scan++;
+			if (*scan == ']')
+				scan++;
+			while (*scan && *scan != ']') {
+				/* classes, equivalences and collating elements
+				 * like "[:digit:]" have a ']' of their own */
+				if (*scan == '[' && scan[1] && strchr(":=.", scan[1])) {
+					const char *close = scan + 2;
+
+					while (*close && (close[0] != scan[1] || close[1] != ']'))
+						close++;
+					scan = *close ? close + 2 : close;
+				} else
+					scan++;
+			}
+			if (*scan)
+				scan++;
+			c = '\0';
+			break;
+		case '(':
+			depth++;
+			c = '\0';
+			break;
+		case ')':
+			depth--;
+			c = '\0';
+			break;
+		case '\\':
+			/* escaped letters and digits are classes or references */
+			if ((c = *scan) != '\0')
+				scan++;
+			if (isalnum((unsigned char)c))
+				c = '\0';
+			break;
+		case '.':
+		case '^':
+		case '$':
+		case '+':
+			c = '\0';
+			break;
+		}
+
+		if (c && !depth) {
+			git_buf_putc(&run, c);
+			continue;
+		}
+
+		if (run.size > out->size)
+			git_buf_set(out, run.ptr, run.size);
+		git_buf_clear(&run);
+	}
+
+	if (run.size > out->size)
+		git_buf_set(out, run.ptr, run.size);
+
+	git_buf_free(&run);
+	return git_buf_oom(out) ? -1 : 0;
+}
+
+static int grep_escape(git_buf *out, const char *str)
+{
+	for (; *str; ++str) {
+		if (strchr(GREP_REGEX_CHARS, *str))
+			git_buf_putc(out, '\\');
+		git_buf_putc(out, *str);
+	}
+
+	return git_buf_oom(out) ? -1 : 0;
+}
+
+static int grep_pattern_init(grep_pattern *p, const char *pattern, unsigned int flags)
+{
+	git_buf literal = GIT_BUF_INIT, regex = GIT_BUF_INIT;
+	bool icase = (flags & GIT_GREP_IGNORE_CASE) != 0;
+	bool fixed = (flags & GIT_GREP_FIXED_STRINGS) != 0;
+	int error;
+
+	memset(p, 0, sizeof(*p));
+	p->flags = flags;
+
+	if (!fixed && !strpbrk(pattern, GREP_REGEX_CHARS))
+		fixed = true;
+
+	/* only ASCII letters are folded when looking for the string */
+	if (fixed && (!icase || grep_is_ascii(pattern, strlen(pattern))))
+		error = git_buf_sets(&literal, pattern);
+	else {
+		if (fixed)
+			error = grep_escape(&regex, pattern);
+		else
+			error = git_buf_sets(&regex, pattern);
+
+		if (!error)
+			error = grep_required_literal(&literal, regex.ptr);
+
+		if (!error && icase && !grep_is_ascii(literal.ptr, literal.size))
+			git_buf_clear(&literal);
+
+		if (!error && (error = regcomp(&p->regex, regex.ptr,
+				REG_EXTENDED | REG_NEWLINE | (icase ? REG_ICASE : 0))) != 0) {
+			char message[256];
+
+			regerror(error, &p->regex, message, sizeof(message));
+			giterr_set(GITERR_INVALID, "Invalid grep pattern '%s': %s", pattern, message);
+			regfree(&p->regex);
+			error = -1;
+		} else if (!error)
+			p->has_regex = true;
+	}
+
+	if (!error && literal.size > 0) {
+		if (icase)
+			git__strntolower(literal.ptr, literal.size);
+
+		p->literal_len = literal.size;
+		p->literal = git_buf_detach(&literal);
+	}
+
+	git_buf_free(&literal);
+	git_buf_free(&regex);
+	return error;
+}
+
+static void grep_pattern_free(grep_pattern *p)
+{
+	if (p->has_regex)
+		regfree(&p->regex);
+
+	git__free(p->literal);
+}
+
+/* Find the pattern's string in `data`, returning its position or -1 */
+static ssize_t grep_find_literal(
+	grep_pattern *p, const char *data, size_t start, size_t len)
+{
+	const char *scan, *end;
+
+	if (p->literal_len > len - start)
+		return -1;
+
+	if (!p->literal_len)
+		return (ssize_t)start;
+
+	end = data + len - p->literal_len;
+
+	if (!(p->flags & GIT_GREP_IGNORE_CASE)) {
+		for (scan = data + start; scan <= end; ++scan) {
+			scan = memchr(scan, p->literal[0], end - scan + 1);
+			if (!scan)
+				break;
+			if (!memcmp(scan + 1, p->literal + 1, p->literal_len - 1))
+				return scan - data;
+		}
+
+		return -1;
+	}
+
+	for (scan = data + start; scan <= end; ++scan) {
+		size_t i;
+
+		for (i = 0; i < p->literal_len; ++i)
+			if ((char)tolower((unsigned char)scan[i]) != p->literal[i])
+				break;
+
+		if (i == p->literal_len)
+			return scan - data;
+	}
+
+	return -1;
+}
+
+/* Find the first match in `data` from `start`, which starts a line */
+static bool grep_find(
+	grep_pattern *p, const char *data, size_t start, size_t len,
+	size_t *match_offset, size_t *match_len)
+{
+	regmatch_t match;
+	ssize_t found;
+
+	if (p->literal || !p->has_regex) {
+		if ((found = grep_find_literal(p, data, start, len)) < 0)
+			return false;
+
+		if (!p->has_regex) {
+			*match_offset = (size_t)found;
+			*match_len = p->literal_len;
+			return true;
+		}
+
+		/* run the regex from the line with the string */
+		while ((size_t)found > start && data[found - 1] != '\n')
+			found--;
+		start = (size_t)found;
+	}
+
+	match.rm_so = start;
+	match.rm_eo = len;
+
+	if (regexec(&p->regex, data, 1, &match, REG_STARTEND) != 0)
+		return false;
+
+	*match_offset = match.rm_so;
+	*match_len = match.rm_eo - match.rm_so;
+	return true;
+}
+
+
+/*
+ * Searching an entry
+ */
+
+static int grep_add_hit(
+	grep_entry *e, const char *data, size_t line_number,
+	size_t line_start, size_t line_end, size_t match_offset, size_t match_len)
+{
+	grep_hit *hit;
+
+	if (e->nhits == e->hits_alloc) {
+		size_t alloc = e->hits_alloc ? e->hits_alloc * 2 : 4;
+
+		hit = git__realloc(e->hits, alloc * sizeof(grep_hit));
+		GITERR_CHECK_ALLOC(hit);
+
+		e->hits = hit;
+		e->hits_alloc = alloc;
+	}
+
+	hit = &e->hits[e->nhits++];
+	hit->line_number = line_number;
+	hit->offset = e->lines.size;
+	hit->len = line_end - line_start;
+	hit->match_offset = match_offset - line_start;
+	hit->match_len = min(match_len, line_end - match_offset);
+
+	return git_buf_put(&e->lines, data + line_start, hit->len);
+}
+
+static bool grep_is_binary(const char *data, size_t len)
+{
+	git_buf text = GIT_BUF_INIT;
+	git_text_stats stats;
+
+	text.ptr = (char *)data;
+	text.size = min(len, GREP_BINARY_CHECK);
+
+	git_text_gather_stats(&stats, &text);
+	return git_text_is_binary(&stats) != 0;
+}
+
+static int grep_buffer(grep *g, grep_entry *e, const char *data, size_t len)
+{
+	size_t pos = 0, counted = 0, line_number = 1;
+	size_t match_offset, match_len, line_start, line_end;
+	const char *newline;
+	int error;
+
+	if (!(g->flags & GIT_GREP_TEXT) && grep_is_binary(data, len))
+		return 0;
+
+	while (pos < len &&
+		grep_find(&g->pattern, data, pos, len, &match_offset, &match_len)) {
+
+		line_start = match_offset;
+		while (line_start > pos && data[line_start - 1] != '\n')
+			line_start--;
+
+		newline = memchr(data + match_offset, '\n', len - match_offset);
+		line_end = newline ? (size_t)(newline - data) : len;
+
+		/* there is no line after the last newline */
+		if (line_start == len)
+			break;
+
+		while ((newline = memchr(data + counted, '\n', line_start - counted)) != NULL) {
+			line_number++;
+			counted = newline - data + 1;
+		}
+		counted = line_start;
+
+		if ((error = grep_add_hit(e, data, line_number,
+				line_start, line_end, match_offset, match_len)) < 0)
+			return error;
+
+		if (g->flags & GIT_GREP_FILES_WITH_MATCHES)
+			break;
+
+		pos = line_end + 1;
+	}
+
+	return 0;
+}
+
+static int grep_read_workdir(grep *g, grep_entry *e, git_buf *content)
+{
+	git_buf path = GIT_BUF_INIT;
+	ssize_t read_len;
+	int error;
+
+	if ((error = git_buf_joinpath(&path, g->workdir, e->path)) < 0)
+		return error;
+
+	if (!S_ISLNK(e->mode))
+		error = git_futils_readbuffer(content, path.ptr);
+	else if ((error = git_buf_grow(content, GIT_PATH_MAX)) == 0) {
+		if ((read_len = p_readlink(path.ptr, content->ptr, GIT_PATH_MAX)) < 0) {
+			giterr_set(GITERR_OS, "Failed to read symlink '%s'", e->path);
+			error = (errno == ENOENT) ? GIT_ENOTFOUND : -1;
+		} else
+			content->size = (size_t)read_len;
+	}
+
+	/* a file which was removed has nothing to match */
+	if (error == GIT_ENOTFOUND) {
+		giterr_clear();
+		error = 0;
+	}
+
+	git_buf_free(&path);
+	return error;
+}
+
+static int grep_search(grep *g, grep_entry *e)
+{
+	git_odb_object *object = NULL;
+	git_buf content = GIT_BUF_INIT;
+	int error;
+
+	e->nhits = 0;
+	git_buf_clear(&e->lines);
+
+	if (g->workdir) {
+		if ((error = grep_read_workdir(g, e, &content)) == 0)
+			error = grep_buffer(g, e, content.ptr, content.size);
+	} else if ((error = git_odb_read(&object, g->odb, &e->oid)) == 0) {
+		if (git_odb_object_type(object) != GIT_OBJ_BLOB) {
+			giterr_set(GITERR_INVALID, "Failed to grep '%s'. Not a blob", e->path);
+			error = -1;
+		} else
+			error = grep_buffer(g, e,
+				git_odb_object_data(object), git_odb_object_size(object));
+	}
+
+	git_odb_object_free(object);
+	git_buf_free(&content);
+
+	return (e->error = error);
+}
+
+#ifdef GIT_THREADS
+static void *grep_worker(void *payload)
+{
+	grep *g = payload;
+	grep_entry *e;
+
+	git_mutex_lock(&g->lock);
+
+	while (!g->stop && g->next < g->entries.length) {
+		e = g->order[g->next++];
+
+		git_mutex_unlock(&g->lock);
+		grep_search(g, e);
+		giterr_clear();
+		git_mutex_lock(&g->lock);
+
+		e->finished = true;
+		git_cond_broadcast(&g->done);
+	}
+
+	git_mutex_unlock(&g->lock);
+	return NULL;
+}
+#endif
+
+static int grep_start_workers(grep *g)
+{
+#ifdef GIT_THREADS
+	/* the caller is a worker too */
+	if (g->nthreads < 2 || g->entries.length < 2)
+		return 0;
+
+	g->threads = git__calloc(g->nthreads - 1, sizeof(git_thread));
+	GITERR_CHECK_ALLOC(g->threads);
+
+	for (; g->started < g->nthreads - 1; g->started++) {
+		if (git_thread_create(&g->threads[g->started], NULL, grep_worker, g) != 0) {
+			giterr_set(GITERR_THREAD, "Unable to create grep worker thread");
+			return -1;
+		}
+	}
+#else
+	GIT_UNUSED(g);
+#endif
+
+	return 0;
+}
+
+static void grep_stop_workers(grep *g)
+{
+	unsigned int i;
+
+	if (!g->started)
+		return;
+
+	git_mutex_lock(&g->lock);
+	g->stop = true;
+	git_mutex_unlock(&g->lock);
+
+	for (i = 0; i < g->started; ++i)
+		git_thread_join(g->threads[i], NULL);
+
+	g->started = 0;
+}
+
+/* Wait for an entry to be searched, searching others meanwhile */
+static int grep_wait(grep *g, grep_entry *e)
+{
+	grep_entry *other;
+
+	git_mutex_lock(&g->lock);
+
+	while (!e->finished) {
+		if (g->next < g->entries.length) {
+			other = g->order[g->next++];
+
+			git_mutex_unlock(&g->lock);
+			grep_search(g, other);
+			git_mutex_lock(&g->lock);
+
+			other->finished = true;
+		} else
+			git_cond_wait(&g->done, &g->lock);
+	}
+
+	git_mutex_unlock(&g->lock);
+
+	/* errors from other threads are raised again, to be reported */
+	if (e->error < 0)
+		return grep_search(g, e);
+
+	return 0;
+}
+
+static int grep_report(grep *g, grep_entry *e)
+{
+	git_grep_match match;
+	size_t i;
+
+	memset(&match, 0, sizeof(match));
+	match.path = e->path;
+	match.oid = g->workdir ? NULL : &e->oid;
+
+	for (i = 0; i < e->nhits; ++i) {
+		grep_hit *hit = &e->hits[i];
+
+		match.line_number = hit->line_number;
+		match.line = e->lines.ptr + hit->offset;
+		match.line_len = hit->len;
+		match.match_offset = hit->match_offset;
+		match.match_len = hit->match_len;
+
+		if (g->cb(&match, g->payload)) {
+			giterr_clear();
+			return GIT_EUSER;
+		}
+	}
+
+	return 0;
+}
+
+static int grep_cmp_locality(const void *a, const void *b)
+{
+	const grep_entry *ea = *(const grep_entry **)a;
+	const grep_entry *eb = *(const grep_entry **)b;
+
+	if (ea->located != eb->located)
+		return ea->located ? -1 : 1;
+
+	if (ea->located && ea->locality != eb->locality)
+		return (ea->locality < eb->locality) ? -1 : 1;
+
+	/* loose objects are in directories by id */
+	return git_oid_cmp(&ea->oid, &eb->oid);
+}
+
+static int grep_run(grep *g)
+{
+	grep_entry *e;
+	size_t i;
+	int error = 0;
+
+	if (!g->entries.length)
+		return 0;
+
+	g->order = git__malloc(g->entries.length * sizeof(grep_entry *));
+	GITERR_CHECK_ALLOC(g->order);
+
+	git_vector_foreach(&g->entries, i, e) {
+		g->order[i] = e;
+
+		/* files are read by path, blobs where they are stored */
+		if (!g->workdir)
+			e->located = (git_odb__locate(&e->locality, g->odb, &e->oid) == 0);
+	}
+
+	if (!g->workdir)
+		git__tsort((void **)g->order, g->entries.length, grep_cmp_locality);
+
+	if ((error = grep_start_workers(g)) < 0)
+		return error;
+
+	git_vector_foreach(&g->entries, i, e) {
+		if ((error = grep_wait(g, e)) < 0 ||
+			(error = grep_report(g, e)) < 0)
+			break;
+
+		git__free(e->hits);
+		e->hits = NULL;
+		git_buf_free(&e->lines);
+	}
+
+	grep_stop_workers(g);
+	return error;
+}
+
+
+/*
+ * Collecting the entries
+ */
+
+static bool grep_path_matches(grep *g, const char *path)
+{
+	return git_pathspec_match_path(&g->pathspec, path,
+		(g->flags & GIT_GREP_DISABLE_PATHSPEC_MATCH) != 0, false);
+}
+
+static int grep_add(grep *g, const char *path, const git_oid *oid, unsigned int mode)
+{
+	grep_entry *e;
+
+	if (S_ISGITLINK(mode) || !grep_path_matches(g, path))
+		return 0;
+
+	e = git__calloc(1, sizeof(grep_entry));
+	GITERR_CHECK_ALLOC(e);
+
+	if ((e->path = git_pool_strdup(&g->pool, path)) == NULL ||
+		git_vector_insert(&g->entries, e) < 0) {
+		git__free(e);
+		return -1;
+	}
+
+	git_oid_cpy(&e->oid, oid);
+	e->mode = mode;
+
+	return 0;
+}
+
+static int grep_tree_cb(const char *root, const git_tree_entry *entry, void *payload)
+{
+	grep *g = payload;
+	git_buf path = GIT_BUF_INIT;
+	size_t len;
+	int error;
+
+	if (git_buf_joinpath(&path, root, git_tree_entry_name(entry)) < 0)
+		return -1;
+
+	if (git_tree_entry_type(entry) == GIT_OBJ_TREE) {
+		/* skip the trees outside of the pathspec's directory */
+		error = 0;
+
+		if (g->pathspec_prefix) {
+			len = min(path.size, strlen(g->pathspec_prefix));
+
+			if (strncmp(path.ptr, g->pathspec_prefix, len) != 0 ||
+				(path.size < strlen(g->pathspec_prefix) &&
+				 g->pathspec_prefix[len] != '/'))
+				error = 1;
+		}
+	} else
+		error = grep_add(g, path.ptr,
+			git_tree_entry_id(entry), git_tree_entry_filemode(entry));
+
+	git_buf_free(&path);
+	return error;
+}
+
+static int grep_init(
+	grep *g,
+	git_repository *repo,
+	const char *pattern,
+	const git_grep_opts *opts,
+	git_grep_cb cb,
+	void *payload)
+{
+	memset(g, 0, sizeof(*g));
+
+	g->repo = repo;
+	g->cb = cb;
+	g->payload = payload;
+
+	if (opts) {
+		g->flags = opts->flags;
+		g->nthreads = opts->nthreads;
+	}
+
+#ifdef GIT_THREADS
+	if (!g->nthreads)
+		g->nthreads = (unsigned int)git_online_cpus();
+#else
+	g->nthreads = 1;
+#endif
+
+	git_mutex_init(&g->lock);
+#ifdef GIT_THREADS
+	git_cond_init(&g->done);
+#endif
+
+	if (git_pool_init(&g->pool, 1, 0) < 0 ||
+		git_vector_init(&g->entries, 0, NULL) < 0 ||
+		git_repository_odb__weakptr(&g->odb, repo) < 0 ||
+		grep_pattern_init(&g->pattern, pattern, g->flags) < 0)
+		return -1;
+
+	if (opts && git_pathspec_init(&g->pathspec, &opts->pathspec, &g->pool) < 0)
+		return -1;
+
+	if (opts && !(g->flags & GIT_GREP_DISABLE_PATHSPEC_MATCH))
+		g->pathspec_prefix = git_pathspec_prefix(&opts->pathspec);
+
+	return 0;
+}
+
+static void grep_free(grep *g)
+{
+	grep_entry *e;
+	size_t i;
+
+	grep_stop_workers(g);
+
+	git_vector_foreach(&g->entries, i, e) {
+		git__free(e->hits);
+		git_buf_free(&e->lines);
+		git__free(e);
+	}
+	git_vector_free(&g->entries);
+
+	grep_pattern_free(&g->pattern);
+	git_pathspec_free(&g->pathspec);
+	git__free(g->pathspec_prefix);
+
+#ifdef GIT_THREADS
+	git_cond_free(&g->done);
+#endif
+	git_mutex_free(&g->lock);
+
+	git_pool_clear(&g->pool);
+	git__free(g->threads);
+	git__free(g->order);
+}
+
+int git_grep_tree(
+	git_tree *tree,
+	const char *pattern,
+	const git_grep_opts *opts,
+	git_grep_cb cb,
+	void *payload)
+{
+	grep g;
+	int error;
+
+	assert(tree && pattern && cb);
+
+	if ((error = grep_init(&g, git_object_owner((git_object *)tree),
+			pattern, opts, cb, payload)) == 0 &&
+		(error = git_tree_walk(tree, grep_tree_cb, GIT_TREEWALK_PRE, &g)) == 0)
+		error = grep_run(&g);
+
+	grep_free(&g);
+	return error;
+}
+
+static int grep_index(grep *g, git_index *index, bool stage_zero)
+{
+	const git_index_entry *entry;
+	const char *last = NULL;
+	unsigned int i;
+	int error = 0;
+
+	for (i = 0; i < git_index_entrycount(index) && !error; ++i) {
+		entry = git_index_get_byindex(index, i);
+
+		/* a conflicted file is only in the working directory once */
+		if (stage_zero && last && !strcmp(last, entry->path))
+			continue;
+		last = entry->path;
+
+		error = grep_add(g, entry->path, &entry->oid, entry->mode);
+	}
+
+	return error;
+}
+
+int git_grep_index(
+	git_repository *repo,
+	git_index *index,
+	const char *pattern,
+	const git_grep_opts *opts,
+	git_grep_cb cb,
+	void *payload)
+{
+	grep g;
+	int error;
+
+	assert(repo && pattern && cb);
+
+	if ((error = grep_init(&g, repo, pattern, opts, cb, payload)) == 0 &&
+		(index != NULL || (error = git_repository_index__weakptr(&index, repo)) == 0) &&
+		(error = grep_index(&g, index, false)) == 0)
+		error = grep_run(&g);
+
+	grep_free(&g);
+	return error;
+}
+
+int git_grep_workdir(
+	git_repository *repo,
+	const char *pattern,
+	const git_grep_opts *opts,
+	git_grep_cb cb,
+	void *payload)
+{
+	git_index *index;
+	grep g;
+	int error;
+
+	assert(repo && pattern && cb);
+
+	if ((error = git_repository__ensure_not_bare(repo, "grep the working directory")) < 0)
+		return error;
+
+	if ((error = grep_init(&g, repo, pattern, opts, cb, payload)) == 0 &&
+		(error = git_repository_index__weakptr(&index, repo)) == 0 &&
+		(error = grep_index(&g, index, true)) == 0) {
+		g.workdir = git_repository_workdir(repo);
+		error = grep_run(&g);
+	}
+
+	grep_free(&g);
+	return error;
+}
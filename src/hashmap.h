@@ -0,0 +1,316 @@
+/*
+ * Copyright (C) 2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_hashmap_h__
+#define INCLUDE_hashmap_h__
+
+#include "common.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+	(defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#	include <emmintrin.h>
+#	define GIT_HASHMAP_SSE2 1
+#endif
+
+/*
+ * Open addressing hash table in the style of Google's "Swiss tables".
+ *
+ * Next to the key and value arrays, the table keeps one control byte per
+ * bucket: either EMPTY, DELETED or, for a full bucket, the low 7 bits of
+ * the key's hash. A lookup loads the control bytes of 16 consecutive
+ * buckets at once and compares them all to the wanted 7 bits (with SSE2
+ * when available), so keys are only compared when their hashes very
+ * likely match. The first group of control bytes is mirrored past the
+ * end of the table, so a group can start on any bucket.
+ *
+ * Groups are probed with a triangular sequence, which visits every
+ * bucket of a power-of-two table. The table grows at 7/8 load; deleted
+ * buckets become tombstones that are dropped by the next resize.
+ *
+ * Like khash, positions are plain bucket indices: `git_hashmap_end(h)`
+ * means "not found" and iteration walks every bucket, skipping the
+ * ones for which `git_hashmap_exists_at` is false.
+ *
+ * `GIT_HASHMAP_TYPE` declares the table type and `GIT_HASHMAP_IMPL`
+ * instantiates its functions for a hash and an equality function; see
+ * oidmap.h and strmap.h.
+ */
+
+typedef uint32_t git_hashmap_iter;
+
+#ifdef _MSC_VER
+#	define git_hashmap_inline __inline
+#else
+#	define git_hashmap_inline inline
+#endif
+
+#define GIT_HASHMAP_GROUP 16
+
+#define GIT_HASHMAP_EMPTY   ((int8_t)-128)
+#define GIT_HASHMAP_DELETED ((int8_t)-2)
+
+#define GIT_HASHMAP_H1(hash) ((hash) >> 7)
+#define GIT_HASHMAP_H2(hash) ((int8_t)((hash) & 0x7f))
+
+GIT_INLINE(uint32_t) git_hashmap__ctz(uint32_t mask)
+{
+#if defined(__GNUC__)
+	return (uint32_t)__builtin_ctz(mask);
+#elif defined(_MSC_VER)
+	unsigned long idx;
+	_BitScanForward(&idx, mask);
+	return (uint32_t)idx;
+#else
+	uint32_t n = 0;
+	while (!(mask & 1)) {
+		mask >>= 1;
+		n++;
+	}
+	return n;
+#endif
+}
+
+/* Bit `i` is set if control byte `i` of the group holds `h2` */
+GIT_INLINE(uint32_t) git_hashmap__match(const int8_t *group, int8_t h2)
+{
+#ifdef GIT_HASHMAP_SSE2
+	__m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+	return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h2), ctrl));
+#else
+	uint32_t i, mask = 0;
+	for (i = 0; i < GIT_HASHMAP_GROUP; ++i)
+		mask |= (uint32_t)(group[i] == h2) << i;
+	return mask;
+#endif
+}
+
+/* Bit `i` is set if bucket `i` of the group is free, deleted or not */
+GIT_INLINE(uint32_t) git_hashmap__match_free(const int8_t *group)
+{
+#ifdef GIT_HASHMAP_SSE2
+	/* EMPTY and DELETED are the only control bytes with the sign bit */
+	__m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+	return (uint32_t)_mm_movemask_epi8(ctrl);
+#else
+	uint32_t i, mask = 0;
+	for (i = 0; i < GIT_HASHMAP_GROUP; ++i)
+		mask |= (uint32_t)(group[i] < 0) << i;
+	return mask;
+#endif
+}
+
+#define git_hashmap__match_empty(group) \
+	git_hashmap__match((group), GIT_HASHMAP_EMPTY)
+
+/* Spread the bits of a weak hash, so both of its halves are usable */
+GIT_INLINE(uint32_t) git_hashmap__mix(uint32_t h)
+{
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
+
+GIT_INLINE(uint32_t) git_hashmap_str_hash(const char *s)
+{
+	uint32_t h = 0;
+
+	for (; *s; ++s)
+		h = (h << 5) - h + (unsigned char)*s;
+
+	return git_hashmap__mix(h);
+}
+
+#define git_hashmap_str_equal(a, b) (strcmp(a, b) == 0)
+
+#define GIT_HASHMAP_T(name) struct git_hashmap_##name
+
+#define GIT_HASHMAP_TYPE(name, key_t) \
+	GIT_HASHMAP_T(name) { \
+		git_hashmap_iter n_buckets, size, n_occupied, growth_left; \
+		int8_t *ctrl; \
+		key_t *keys; \
+		void **vals; \
+	}
+
+#define git_hashmap_begin(h)         ((git_hashmap_iter)0)
+#define git_hashmap_end(h)           ((h)->n_buckets)
+#define git_hashmap_size(h)          ((h)->size)
+#define git_hashmap_exists_at(h, i)  ((h)->ctrl[i] >= 0)
+#define git_hashmap_key(h, i)        ((h)->keys[i])
+#define git_hashmap_val(h, i)        ((h)->vals[i])
+
+#define git_hashmap_foreach(h, kvar, vvar, code) { git_hashmap_iter __i; \
+	for (__i = git_hashmap_begin(h); __i != git_hashmap_end(h); ++__i) { \
+		if (!git_hashmap_exists_at(h, __i)) continue; \
+		(kvar) = git_hashmap_key(h, __i); \
+		(vvar) = git_hashmap_val(h, __i); \
+		code; \
+	} }
+
+#define git_hashmap_foreach_value(h, vvar, code) { git_hashmap_iter __i; \
+	for (__i = git_hashmap_begin(h); __i != git_hashmap_end(h); ++__i) { \
+		if (!git_hashmap_exists_at(h, __i)) continue; \
+		(vvar) = git_hashmap_val(h, __i); \
+		code; \
+	} }
+
+#define GIT_HASHMAP_IMPL(name, SCOPE, key_t, hash_fn, equal_fn) \
+	GIT_HASHMAP_IMPL_FOR(name, GIT_HASHMAP_T(name), SCOPE, key_t, hash_fn, equal_fn)
+
+/* functions for `name` working on an existing table type `map_t` */
+#define GIT_HASHMAP_IMPL_FOR(name, map_t, SCOPE, key_t, hash_fn, equal_fn) \
+	SCOPE map_t *git_hashmap_##name##_init(void) \
+	{ \
+		return git__calloc(1, sizeof(map_t)); \
+	} \
+	SCOPE void git_hashmap_##name##_destroy(map_t *h) \
+	{ \
+		if (!h) \
+			return; \
+		git__free(h->ctrl); \
+		git__free((void *)h->keys); \
+		git__free(h->vals); \
+		git__free(h); \
+	} \
+	SCOPE void git_hashmap_##name##_clear(map_t *h) \
+	{ \
+		if (!h || !h->ctrl) \
+			return; \
+		memset(h->ctrl, GIT_HASHMAP_EMPTY, h->n_buckets + GIT_HASHMAP_GROUP); \
+		h->size = h->n_occupied = 0; \
+		h->growth_left = h->n_buckets - h->n_buckets / 8; \
+	} \
+	SCOPE git_hashmap_iter git_hashmap_##name##_get( \
+		const map_t *h, key_t key) \
+	{ \
+		git_hashmap_iter mask, pos, step = 0, i; \
+		uint32_t hash, match; \
+		int8_t h2; \
+		if (!h->n_buckets) \
+			return 0; \
+		hash = hash_fn(key); \
+		h2 = GIT_HASHMAP_H2(hash); \
+		mask = h->n_buckets - 1; \
+		pos = GIT_HASHMAP_H1(hash) & mask; \
+		for (;;) { \
+			const int8_t *group = h->ctrl + pos; \
+			for (match = git_hashmap__match(group, h2); match; match &= match - 1) { \
+				i = (pos + git_hashmap__ctz(match)) & mask; \
+				if (equal_fn(h->keys[i], key)) \
+					return i; \
+			} \
+			if (git_hashmap__match_empty(group)) \
+				return h->n_buckets; \
+			step += GIT_HASHMAP_GROUP; \
+			pos = (pos + step) & mask; \
+		} \
+	} \
+	/* first free bucket on the probe sequence of `hash` */ \
+	SCOPE git_hashmap_iter git_hashmap_##name##__find_free( \
+		const map_t *h, uint32_t hash) \
+	{ \
+		git_hashmap_iter mask = h->n_buckets - 1, step = 0; \
+		git_hashmap_iter pos = GIT_HASHMAP_H1(hash) & mask; \
+		uint32_t match; \
+		while (!(match = git_hashmap__match_free(h->ctrl + pos))) { \
+			step += GIT_HASHMAP_GROUP; \
+			pos = (pos + step) & mask; \
+		} \
+		return (pos + git_hashmap__ctz(match)) & mask; \
+	} \
+	SCOPE void git_hashmap_##name##__set_ctrl( \
+		map_t *h, git_hashmap_iter i, int8_t c) \
+	{ \
+		h->ctrl[i] = c; \
+		/* keep the mirrored first group in sync */ \
+		if (i < GIT_HASHMAP_GROUP) \
+			h->ctrl[h->n_buckets + i] = c; \
+	} \
+	SCOPE int git_hashmap_##name##_resize( \
+		map_t *h, git_hashmap_iter new_n_buckets) \
+	{ \
+		map_t old = *h; \
+		git_hashmap_iter i, j; \
+		uint32_t hash; \
+		if (new_n_buckets < GIT_HASHMAP_GROUP) \
+			new_n_buckets = GIT_HASHMAP_GROUP; \
+		h->ctrl = git__malloc(new_n_buckets + GIT_HASHMAP_GROUP); \
+		h->keys = git__malloc(new_n_buckets * sizeof(key_t)); \
+		h->vals = git__malloc(new_n_buckets * sizeof(void *)); \
+		if (!h->ctrl || !h->keys || !h->vals) { \
+			git__free(h->ctrl); \
+			git__free((void *)h->keys); \
+			git__free(h->vals); \
+			*h = old; \
+			return -1; \
+		} \
+		memset(h->ctrl, GIT_HASHMAP_EMPTY, new_n_buckets + GIT_HASHMAP_GROUP); \
+		h->n_buckets = new_n_buckets; \
+		h->n_occupied = old.size; \
+		h->growth_left = new_n_buckets - new_n_buckets / 8 - old.size; \
+		for (i = 0; i < old.n_buckets; ++i) { \
+			if (old.ctrl[i] < 0) \
+				continue; \
+			hash = hash_fn(old.keys[i]); \
+			j = git_hashmap_##name##__find_free(h, hash); \
+			git_hashmap_##name##__set_ctrl(h, j, GIT_HASHMAP_H2(hash)); \
+			h->keys[j] = old.keys[i]; \
+			h->vals[j] = old.vals[i]; \
+		} \
+		git__free(old.ctrl); \
+		git__free((void *)old.keys); \
+		git__free(old.vals); \
+		return 0; \
+	} \
+	/* \
+	 * find or add the bucket of `key`; `*ret` is 0 if the key was \
+	 * already there, 1 if it was added (with an unset value) and -1 \
+	 * if growing the table failed \
+	 */ \
+	SCOPE git_hashmap_iter git_hashmap_##name##_put( \
+		map_t *h, key_t key, int *ret) \
+	{ \
+		git_hashmap_iter i = git_hashmap_##name##_get(h, key); \
+		uint32_t hash; \
+		if (i != h->n_buckets) { \
+			*ret = 0; \
+			return i; \
+		} \
+		if (!h->growth_left) { \
+			/* grow, unless tombstones take most of the room */ \
+			git_hashmap_iter n = h->n_buckets; \
+			if (h->size >= n / 2 - n / 16) \
+				n *= 2; \
+			if (git_hashmap_##name##_resize(h, n) < 0) { \
+				*ret = -1; \
+				return h->n_buckets; \
+			} \
+		} \
+		hash = hash_fn(key); \
+		i = git_hashmap_##name##__find_free(h, hash); \
+		if (h->ctrl[i] == GIT_HASHMAP_EMPTY) { \
+			h->n_occupied++; \
+			h->growth_left--; \
+		} \
+		git_hashmap_##name##__set_ctrl(h, i, GIT_HASHMAP_H2(hash)); \
+		h->keys[i] = key; \
+		h->size++; \
+		*ret = 1; \
+		return i; \
+	} \
+	SCOPE void git_hashmap_##name##_del( \
+		map_t *h, git_hashmap_iter i) \
+	{ \
+		if (i == h->n_buckets || h->ctrl[i] < 0) \
+			return; \
+		git_hashmap_##name##__set_ctrl(h, i, GIT_HASHMAP_DELETED); \
+		h->size--; \
+	}
+
+#endif
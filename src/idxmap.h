@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_idxmap_h__
+#define INCLUDE_idxmap_h__
+
+#include <ctype.h>
+#include "common.h"
+#include "git2/index.h"
+#include "hashmap.h"
+
+/*
+ * Sets of index entries, keyed by path and stage.  The case-insensitive
+ * flavor folds the paths the same way the `ignore_case` index sorts
+ * them; both share one layout so an index can hold either.
+ */
+GIT_HASHMAP_TYPE(idx, const git_index_entry *);
+typedef GIT_HASHMAP_T(idx) git_idxmap;
+
+#define git_idxmap__stage(e) \
+	(((e)->flags & GIT_IDXENTRY_STAGEMASK) >> GIT_IDXENTRY_STAGESHIFT)
+
+GIT_INLINE(uint32_t) git_idxmap_hash(const git_index_entry *e)
+{
+	uint32_t h = (uint32_t)git_idxmap__stage(e);
+	const char *s;
+
+	for (s = e->path; *s; ++s)
+		h = (h << 5) - h + (unsigned char)*s;
+
+	return git_hashmap__mix(h);
+}
+
+GIT_INLINE(uint32_t) git_idxmap_icase_hash(const git_index_entry *e)
+{
+	uint32_t h = (uint32_t)git_idxmap__stage(e);
+	const char *s;
+
+	for (s = e->path; *s; ++s)
+		h = (h << 5) - h + (unsigned char)tolower((unsigned char)*s);
+
+	return git_hashmap__mix(h);
+}
+
+#define git_idxmap_equal(a, b) \
+	(git_idxmap__stage(a) == git_idxmap__stage(b) && strcmp((a)->path, (b)->path) == 0)
+#define git_idxmap_icase_equal(a, b) \
+	(git_idxmap__stage(a) == git_idxmap__stage(b) && strcasecmp((a)->path, (b)->path) == 0)
+
+#define GIT__USE_IDXMAP \
+	GIT_HASHMAP_IMPL(idx, static git_hashmap_inline, const git_index_entry *, git_idxmap_hash, git_idxmap_equal)
+
+#define GIT__USE_IDXMAP_ICASE \
+	GIT_HASHMAP_IMPL_FOR(idx_icase, git_idxmap, static git_hashmap_inline, const git_index_entry *, git_idxmap_icase_hash, git_idxmap_icase_equal)
+
+#define git_idxmap_alloc()  git_hashmap_idx_init()
+#define git_idxmap_free(h)  git_hashmap_idx_destroy(h), h = NULL
+
+#define git_idxmap_num_entries(h) git_hashmap_size(h)
+
+#define git_idxmap_valid_index(h, idx) (idx != git_hashmap_end(h))
+#define git_idxmap_value_at(h, idx)    git_hashmap_val(h, idx)
+
+#endif
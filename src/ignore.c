@@ -256,8 +256,16 @@ int git_ignore_add_rule(
 	int error;
 	git_attr_file *ign_internal;
 
-	if (!(error = get_internal_ignores(&ign_internal, repo)))
-		error = parse_ignore_file(repo, NULL, rules, ign_internal);
+	if ((error = get_internal_ignores(&ign_internal, repo)) < 0)
+		return error;
+
+	/*
+	 * the internal rules are changed in place, so this should not race
+	 * with status or ignore checks on the same repository
+	 */
+	git_rwlock_wrlock(&git_repository_attr_cache(repo)->lock);
+	error = parse_ignore_file(repo, NULL, rules, ign_internal);
+	git_rwlock_wrunlock(&git_repository_attr_cache(repo)->lock);
 
 	return error;
 }
@@ -268,8 +276,11 @@ int git_ignore_clear_internal_rules(
 	int error;
 	git_attr_file *ign_internal;
 
-	if (!(error = get_internal_ignores(&ign_internal, repo)))
+	if (!(error = get_internal_ignores(&ign_internal, repo))) {
+		git_rwlock_wrlock(&git_repository_attr_cache(repo)->lock);
 		git_attr_file__clear_rules(ign_internal);
+		git_rwlock_wrunlock(&git_repository_attr_cache(repo)->lock);
+	}
 
 	return error;
 }
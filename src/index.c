@@ -5,6 +5,8 @@
  * a Linking Exception. For full terms see the included COPYING file.
  */
 
+#define GIT_ALLOC_SUBSYSTEM GIT_ALLOC_INDEX
+
 #include <stddef.h>
 
 #include "common.h"
@@ -15,6 +17,10 @@
 #include "hash.h"
 #include "iterator.h"
 #include "pathspec.h"
+#include "trace.h"
+#include "diff.h"
+#include "fsmonitor.h"
+#include "ewah.h"
 #include "git2/odb.h"
 #include "git2/oid.h"
 #include "git2/blob.h"
@@ -35,6 +41,10 @@ static const unsigned int INDEX_VERSION_NUMBER_EXT = 3;
 static const unsigned int INDEX_HEADER_SIG = 0x44495243;
 static const char INDEX_EXT_TREECACHE_SIG[] = {'T', 'R', 'E', 'E'};
 static const char INDEX_EXT_UNMERGED_SIG[] = {'R', 'E', 'U', 'C'};
+static const char INDEX_EXT_FSMONITOR_SIG[] = {'F', 'S', 'M', 'N'};
+static const char INDEX_EXT_LINK_SIG[] = {'l', 'i', 'n', 'k'};
+
+static const unsigned int INDEX_FSMONITOR_VERSION = 2;
 
 #define INDEX_OWNER(idx) ((git_repository *)(GIT_REFCOUNT_OWNER(idx)))
 
@@ -83,22 +93,41 @@ struct entry_long {
 	char path[1]; /* arbitrary length */
 };
 
+/* extensions that can only be applied once all the entries are known */
+struct index_deferred {
+	const char *link;
+	size_t link_size;
+	const char *fsmonitor;
+	size_t fsmonitor_size;
+};
+
+/* how the entries differ from those of the shared index, see read_link */
+typedef struct {
+	git_vector entries; /* the replacements, then the additions */
+	size_t replacements;
+	uint64_t *deleted;
+	uint64_t *replaced;
+} index_split;
+
 struct entry_srch_key {
 	const char *path;
 	int stage;
 };
 
 /* local declarations */
-static size_t read_extension(git_index *index, const char *buffer, size_t buffer_size);
+static size_t read_extension(
+	git_index *index, struct index_deferred *deferred, const char *buffer, size_t buffer_size);
 static size_t read_entry(git_index_entry *dest, const void *buffer, size_t buffer_size);
 static int read_header(struct index_header *dest, const void *buffer);
 
 static int parse_index(git_index *index, const char *buffer, size_t buffer_size);
 static int is_index_extended(git_index *index);
-static int write_index(git_index *index, git_filebuf *file);
+static int write_index(
+	git_index *index, git_filebuf *file, index_split *split, git_oid *checksum);
 
 static int index_find(git_index *index, const char *path, int stage);
 
+static git_index_entry *index_entry_dup(const git_index_entry *source_entry);
 static void index_entry_free(git_index_entry *entry);
 static void index_entry_reuc_free(git_index_reuc_entry *reuc);
 
@@ -242,8 +271,162 @@ static unsigned int index_merge_mode(
 	return index_create_mode(mode);
 }
 
+GIT__USE_IDXMAP
+GIT__USE_IDXMAP_ICASE
+
+/*
+ * The entries map finds entries by path and stage (case-folded for an
+ * `ignore_case` index) without sorting and searching the entry vector.
+ * It is built by the first lookup and kept up to date by the single
+ * entry changes after that; bulk changes just drop it. An index which
+ * holds several entries for one key (e.g. paths differing only in case
+ * in an `ignore_case` index) does not use it at all, as it can only
+ * remember one of them.
+ */
+static void index_map_drop(git_index *index)
+{
+	git_idxmap_free(index->entries_map);
+	index->entries_map_ambiguous = 0;
+}
+
+static git_hashmap_iter index_map_get(git_index *index, const git_index_entry *key)
+{
+	return index->ignore_case ?
+		git_hashmap_idx_icase_get(index->entries_map, key) :
+		git_hashmap_idx_get(index->entries_map, key);
+}
+
+/*
+ * put `entry` in `map` in the place of `replaced` (if not NULL): 0 on
+ * success, -1 when out of memory or 1 when another entry has its key
+ */
+static int index_map_put(
+	git_idxmap *map, bool ignore_case,
+	git_index_entry *entry, git_index_entry *replaced)
+{
+	git_hashmap_iter pos;
+	int ret;
+
+	pos = ignore_case ?
+		git_hashmap_idx_icase_put(map, entry, &ret) :
+		git_hashmap_idx_put(map, entry, &ret);
+
+	if (ret < 0)
+		return -1;
+	if (ret == 0 && git_hashmap_val(map, pos) != replaced)
+		return 1;
+
+	git_hashmap_key(map, pos) = entry;
+	git_hashmap_val(map, pos) = entry;
+	return 0;
+}
+
+/* add `entry`, which takes the place of `replaced` (if not NULL) */
+static void index_map_set(
+	git_index *index, git_index_entry *entry, git_index_entry *replaced)
+{
+	int error;
+
+	if (!index->entries_map)
+		return;
+
+	error = index_map_put(index->entries_map, index->ignore_case, entry, replaced);
+	if (error != 0) {
+		/* out of memory, or a second entry for the key */
+		index->entries_map_ambiguous = (error > 0);
+		git_idxmap_free(index->entries_map);
+		giterr_clear();
+	}
+}
+
+static void index_map_delete(git_index *index, const git_index_entry *entry)
+{
+	git_hashmap_iter pos;
+
+	if (!index->entries_map)
+		return;
+
+	pos = index_map_get(index, entry);
+	if (git_idxmap_valid_index(index->entries_map, pos) &&
+		git_idxmap_value_at(index->entries_map, pos) == entry)
+		git_hashmap_idx_del(index->entries_map, pos);
+}
+
+/*
+ * Readers sharing an index may all look entries up at once, so the map
+ * is built under `map_lock` and only published when it is complete.
+ */
+static int index_map_build(git_index *index)
+{
+	git_idxmap *map;
+	git_index_entry *entry;
+	unsigned int i;
+	int error = 0;
+
+	if (git__load(&index->entries_map) != NULL)
+		return 0;
+
+	git_mutex_lock(&index->map_lock);
+
+	if (index->entries_map != NULL)
+		goto done;
+
+	if (index->entries_map_ambiguous ||
+		(map = git_idxmap_alloc()) == NULL) {
+		error = -1;
+		goto done;
+	}
+
+	git_vector_foreach(&index->entries, i, entry) {
+		if ((error = index_map_put(map, index->ignore_case, entry, NULL)) != 0)
+			break;
+	}
+
+	if (!error)
+		git__swap(&index->entries_map, map);
+	else {
+		index->entries_map_ambiguous = (error > 0);
+		git_idxmap_free(map);
+		error = -1;
+	}
+
+done:
+	git_mutex_unlock(&index->map_lock);
+	if (error < 0)
+		giterr_clear();
+	return error;
+}
+
+/*
+ * Look up the entry for `path` and `stage` in the entries map: returns
+ * 1 and sets `out` if it exists, 0 if it does not, or -1 if the map is
+ * not usable and the entries have to be searched instead
+ */
+static int index_map_find(
+	git_index_entry **out, git_index *index, const char *path, int stage)
+{
+	git_index_entry key;
+	git_hashmap_iter pos;
+
+	if (index_map_build(index) < 0)
+		return -1;
+
+	key.path = (char *)path;
+	key.flags = (unsigned short)(stage << GIT_IDXENTRY_STAGESHIFT);
+
+	pos = index_map_get(index, &key);
+	if (!git_idxmap_valid_index(index->entries_map, pos))
+		return 0;
+
+	if (out)
+		*out = git_idxmap_value_at(index->entries_map, pos);
+	return 1;
+}
+
 static void index_set_ignore_case(git_index *index, bool ignore_case)
 {
+	index_map_drop(index);
+
 	index->entries._cmp = ignore_case ? index_icmp : index_cmp;
 	index->entries_cmp_path = ignore_case ? index_icmp_path : index_cmp_path;
 	index->entries_search = ignore_case ? index_isrch : index_srch;
@@ -278,6 +461,8 @@ int git_index_open(git_index **index_out, const char *index_path)
 	if (git_vector_init(&index->entries, 32, index_cmp) < 0)
 		return -1;
 
+	git_mutex_init(&index->map_lock);
+
 	index->entries_cmp_path = index_cmp_path;
 	index->entries_search = index_srch;
 	index->entries_search_path = index_srch_path;
@@ -310,6 +495,8 @@ static void index_free(git_index *index)
 	}
 	git_vector_free(&index->reuc);
 
+	git_index_free(index->split_base);
+	git_mutex_free(&index->map_lock);
 	git__free(index->index_file_path);
 	git__free(index);
 }
@@ -344,10 +531,14 @@ void git_index_clear(git_index *index)
 
 	git_vector_clear(&index->entries);
 	git_vector_clear(&index->reuc);
+	index_map_drop(index);
 	git_futils_filestamp_set(&index->stamp, NULL);
 
 	git_tree_cache_free(index->tree);
 	index->tree = NULL;
+
+	git__free(index->fsmonitor_token);
+	index->fsmonitor_token = NULL;
 }
 
 static int create_index_error(int error, const char *msg)
@@ -406,6 +597,7 @@ int git_index_read(git_index *index)
 	int error = 0, updated;
 	git_buf buffer = GIT_BUF_INIT;
 	git_futils_filestamp stamp = {0};
+	GIT_TRACE_SPAN(span);
 
 	if (!index->index_file_path)
 		return create_index_error(-1,
@@ -421,6 +613,8 @@ int git_index_read(git_index *index)
 	if (updated <= 0)
 		return updated;
 
+	GIT_TRACE_BEGIN(span);
+
 	error = git_futils_readbuffer(&buffer, index->index_file_path);
 	if (error < 0)
 		return error;
@@ -428,22 +622,301 @@ int git_index_read(git_index *index)
 	git_index_clear(index);
 	error = parse_index(index, buffer.ptr, buffer.size);
 
-	if (!error)
+	if (!error) {
 		git_futils_filestamp_set(&index->stamp, &stamp);
+		GIT_TRACE_END(GIT_TRACE_INDEX_READ, span, index->entries.length);
+	}
 
 	git_buf_free(&buffer);
 	return error;
 }
 
+static int index_shared_path(git_buf *out, git_index *index, const git_oid *oid)
+{
+	char hex[GIT_OID_HEXSZ + 1];
+
+	git_oid_tostr(hex, sizeof(hex), oid);
+
+	if (git_path_dirname_r(out, index->index_file_path) < 0)
+		return -1;
+
+	return git_buf_printf(out, "/" GIT_INDEX_SHARED_PREFIX "%s", hex);
+}
+
+static bool index_entry_same(const git_index_entry *a, const git_index_entry *b)
+{
+	return a->ctime.seconds == b->ctime.seconds &&
+		a->ctime.nanoseconds == b->ctime.nanoseconds &&
+		a->mtime.seconds == b->mtime.seconds &&
+		a->mtime.nanoseconds == b->mtime.nanoseconds &&
+		a->dev == b->dev &&
+		a->ino == b->ino &&
+		a->mode == b->mode &&
+		a->uid == b->uid &&
+		a->gid == b->gid &&
+		a->file_size == b->file_size &&
+		git_oid_equal(&a->oid, &b->oid) &&
+		(a->flags & ~GIT_IDXENTRY_EXTENDED) == (b->flags & ~GIT_IDXENTRY_EXTENDED) &&
+		(a->flags_extended & GIT_IDXENTRY_EXTENDED_FLAGS) ==
+			(b->flags_extended & GIT_IDXENTRY_EXTENDED_FLAGS);
+}
+
+static void index_split_free(index_split *split)
+{
+	git_vector_free(&split->entries);
+	git__free(split->deleted);
+	git__free(split->replaced);
+	memset(split, 0, sizeof(*split));
+}
+
+/*
+ * Compare the entries, sorted as on disk, with the shared index and
+ * return how many differ.
+ */
+static int index_split_diff(index_split *split, git_index *base, git_vector *entries)
+{
+	git_vector additions = GIT_VECTOR_INIT;
+	git_index_entry *shared, *entry;
+	size_t words = git_ewah_words(base->entries.length) + 1, i = 0, j = 0;
+	size_t deletions = 0;
+	int cmp, error = -1;
+
+	memset(split, 0, sizeof(*split));
+
+	split->deleted = git__calloc(words, sizeof(uint64_t));
+	split->replaced = git__calloc(words, sizeof(uint64_t));
+
+	if (!split->deleted || !split->replaced ||
+		git_vector_init(&split->entries, 16, NULL) < 0 ||
+		git_vector_init(&additions, 16, NULL) < 0)
+		goto done;
+
+	while (i < base->entries.length || j < entries->length) {
+		shared = git_vector_get(&base->entries, i);
+		entry = git_vector_get(entries, j);
+
+		if (!shared)
+			cmp = 1;
+		else if (!entry)
+			cmp = -1;
+		else
+			cmp = index_cmp(shared, entry);
+
+		if (cmp < 0) {
+			git_ewah_set(split->deleted, i);
+			deletions++;
+		} else if (cmp > 0) {
+			if (git_vector_insert(&additions, entry) < 0)
+				goto done;
+		} else if (!index_entry_same(shared, entry)) {
+			git_ewah_set(split->replaced, i);
+			if (git_vector_insert(&split->entries, entry) < 0)
+				goto done;
+		}
+
+		if (cmp <= 0)
+			i++;
+		if (cmp >= 0)
+			j++;
+	}
+
+	split->replacements = split->entries.length;
+
+	git_vector_foreach(&additions, i, entry)
+		if (git_vector_insert(&split->entries, entry) < 0)
+			goto done;
+
+	error = 0;
+
+done:
+	git_vector_free(&additions);
+
+	if (error < 0) {
+		index_split_free(split);
+		return error;
+	}
+
+	return (int)(deletions + split->entries.length);
+}
+
+struct index_split_expire {
+	const char *keep;
+	git_time_t before;
+};
+
+static int index_split_expire_cb(void *payload, git_buf *path)
+{
+	struct index_split_expire *expire = payload;
+	const char *name = strrchr(path->ptr, '/');
+	struct stat st;
+
+	name = name ? name + 1 : path->ptr;
+
+	if (git__prefixcmp(name, GIT_INDEX_SHARED_PREFIX) == 0 &&
+		strcmp(name, expire->keep) != 0 &&
+		p_stat(path->ptr, &st) == 0 &&
+		(git_time_t)st.st_mtime < expire->before)
+		p_unlink(path->ptr);
+
+	return 0;
+}
+
+/*
+ * Remove the shared indexes that were not used for a while, as other
+ * index files may still be split against them.
+ */
+static void index_split_expire(git_index *index, const char *expire_date)
+{
+	git_buf dir = GIT_BUF_INIT, keep = GIT_BUF_INIT;
+	struct index_split_expire expire;
+
+	if (!strcmp(expire_date, "never") ||
+		git__date_parse(&expire.before, expire_date) != 0 ||
+		git_path_dirname_r(&dir, index->index_file_path) < 0 ||
+		index_shared_path(&keep, index, &index->split_base_oid) < 0)
+		goto done;
+
+	expire.keep = strrchr(keep.ptr, '/') + 1;
+	git_path_direach(&dir, index_split_expire_cb, &expire);
+
+done:
+	giterr_clear();
+	git_buf_free(&dir);
+	git_buf_free(&keep);
+}
+
+/* Write all the entries into a new shared index and split against it */
+static int index_split_fold(git_index *index, git_vector *entries)
+{
+	git_index *base = NULL;
+	git_filebuf file = GIT_FILEBUF_INIT;
+	git_buf path = GIT_BUF_INIT;
+	git_index_entry *entry, *copy;
+	git_oid checksum;
+	size_t i;
+	int error = -1;
+
+	if (git_index_new(&base) < 0)
+		return -1;
+
+	git_vector_foreach(entries, i, entry) {
+		if ((copy = index_entry_dup(entry)) == NULL ||
+			git_vector_insert(&base->entries, copy) < 0) {
+			index_entry_free(copy);
+			goto done;
+		}
+	}
+	base->entries.sorted = 1;
+
+	if (git_path_dirname_r(&path, index->index_file_path) < 0 ||
+		git_buf_puts(&path, "/" GIT_INDEX_SHARED_PREFIX "tmp") < 0 ||
+		git_filebuf_open(&file, path.ptr,
+			GIT_FILEBUF_HASH_CONTENTS | GIT_FILEBUF_TEMPORARY) < 0)
+		goto done;
+
+	git_buf_clear(&path);
+
+	if (write_index(base, &file, NULL, &checksum) < 0 ||
+		index_shared_path(&path, index, &checksum) < 0 ||
+		git_filebuf_commit_at(&file, path.ptr, GIT_INDEX_FILE_MODE) < 0) {
+		git_filebuf_cleanup(&file);
+		goto done;
+	}
+
+	git_index_free(index->split_base);
+	index->split_base = base;
+	git_oid_cpy(&index->split_base_oid, &checksum);
+	base = NULL;
+	error = 0;
+
+done:
+	git_index_free(base);
+	git_buf_free(&path);
+	return error;
+}
+
+/*
+ * A split index is written when core.splitIndex asks for it or, if it
+ * is unset, when the index was split already.  The shared index is
+ * rewritten once more than splitIndex.maxPercentChange percent of the
+ * entries differ from it.
+ */
+static int index_split_prepare(index_split *split, git_index *index, bool *use_split)
+{
+	git_repository *repo = INDEX_OWNER(index);
+	git_config *cfg = NULL;
+	git_vector case_sorted, *out = &index->entries;
+	git_buf path = GIT_BUF_INIT;
+	const char *expire = "2.weeks.ago";
+	int32_t max_percent = 20;
+	int enabled = (index->split_base != NULL), changes = -1, error = 0;
+
+	memset(split, 0, sizeof(*split));
+
+	if (repo && git_repository_config__weakptr(&cfg, repo) == 0) {
+		if (git_config_get_bool(&enabled, cfg, "core.splitIndex") < 0)
+			enabled = (index->split_base != NULL);
+		if (git_config_get_int32(&max_percent, cfg, "splitIndex.maxPercentChange") < 0 ||
+			max_percent < 0)
+			max_percent = 20;
+		if (git_config_get_string(&expire, cfg, "splitIndex.sharedIndexExpire") < 0)
+			expire = "2.weeks.ago";
+	}
+	giterr_clear();
+
+	if (!(*use_split = (enabled != 0)))
+		return 0;
+
+	if (index->ignore_case) {
+		if (git_vector_dup(&case_sorted, &index->entries, index_cmp) < 0)
+			return -1;
+		git_vector_sort(&case_sorted);
+		out = &case_sorted;
+	}
+
+	if (index->split_base != NULL &&
+		(changes = index_split_diff(split, index->split_base, out)) < 0) {
+		error = changes;
+		goto done;
+	}
+
+	/* keep the shared index from expiring while it is in use */
+	if (changes >= 0 &&
+		(max_percent >= 100 || (size_t)changes * 100 <= (size_t)max_percent * out->length) &&
+		index_shared_path(&path, index, &index->split_base_oid) == 0 &&
+		p_utimes(path.ptr, NULL) == 0)
+		goto done;
+
+	index_split_free(split);
+
+	if ((error = index_split_fold(index, out)) < 0 ||
+		(error = index_split_diff(split, index->split_base, out)) < 0)
+		goto done;
+
+	index_split_expire(index, expire);
+	error = 0;
+
+done:
+	if (index->ignore_case)
+		git_vector_free(&case_sorted);
+	git_buf_free(&path);
+	return error;
+}
+
 int git_index_write(git_index *index)
 {
 	git_filebuf file = GIT_FILEBUF_INIT;
+	index_split split;
+	bool use_split;
 	int error;
+	GIT_TRACE_SPAN(span);
 
 	if (!index->index_file_path)
 		return create_index_error(-1,
 			"Failed to read index: The index is in-memory only");
 
+	GIT_TRACE_BEGIN(span);
+
 	git_vector_sort(&index->entries);
 	git_vector_sort(&index->reuc);
 
@@ -451,7 +924,20 @@ int git_index_write(git_index *index)
 			 &file, index->index_file_path, GIT_FILEBUF_HASH_CONTENTS)) < 0)
 		return error;
 
-	if ((error = write_index(index, &file)) < 0) {
+	if ((error = index_split_prepare(&split, index, &use_split)) < 0) {
+		git_filebuf_cleanup(&file);
+		return error;
+	}
+
+	if (!use_split) {
+		git_index_free(index->split_base);
+		index->split_base = NULL;
+	}
+
+	error = write_index(index, &file, use_split ? &split : NULL, NULL);
+	index_split_free(&split);
+
+	if (error < 0) {
 		git_filebuf_cleanup(&file);
 		return error;
 	}
@@ -464,6 +950,8 @@ int git_index_write(git_index *index)
 		return error;
 
 	index->on_disk = 1;
+
+	GIT_TRACE_END(GIT_TRACE_INDEX_WRITE, span, index->entries.length);
 	return 0;
 }
 
@@ -504,9 +992,13 @@ git_index_entry *git_index_get_byindex(git_index *index, size_t n)
 git_index_entry *git_index_get_bypath(git_index *index, const char *path, int stage)
 {
 	int pos;
+	git_index_entry *entry;
 
 	assert(index);
 
+	if ((pos = index_map_find(&entry, index, path, stage)) >= 0)
+		return pos ? entry : NULL;
+
 	git_vector_sort(&index->entries);
 
 	if((pos = index_find(index, path, stage)) < 0)
@@ -648,8 +1140,13 @@ static git_index_entry *index_entry_dup(const git_index_entry *source_entry)
 
 	/* duplicate the path string so we own it */
 	entry->path = git__strdup(entry->path);
-	if (!entry->path)
+	if (!entry->path) {
+		git__free(entry);
 		return NULL;
+	}
+
+	/* the copy has not been checked against the working directory */
+	entry->flags_extended &= ~GIT_IDXENTRY_FSMONITOR_VALID;
 
 	return entry;
 }
@@ -680,8 +1177,11 @@ static int index_insert(git_index *index, git_index_entry *entry, int replace)
 	else
 		entry->flags |= GIT_IDXENTRY_NAMEMASK;
 
-	/* look if an entry with this path already exists */
-	if ((position = index_find(index, entry->path, index_entry_stage(entry))) >= 0) {
+	/* look if an entry with this path already exists; the map can tell
+	 * that one does not without sorting the entries
+	 */
+	if (index_map_find(NULL, index, entry->path, index_entry_stage(entry)) != 0 &&
+		(position = index_find(index, entry->path, index_entry_stage(entry))) >= 0) {
 		existing = (git_index_entry **)&index->entries.contents[position];
 
 		/* update filemode to existing values if stat is not trusted */
@@ -691,10 +1191,16 @@ static int index_insert(git_index *index, git_index_entry *entry, int replace)
 	/* if replacing is not requested or no existing entry exists, just
 	 * insert entry at the end; the index is no longer sorted
 	 */
-	if (!replace || !existing)
-		return git_vector_insert(&index->entries, entry);
+	if (!replace || !existing) {
+		if (git_vector_insert(&index->entries, entry) < 0)
+			return -1;
+
+		index_map_set(index, entry, NULL);
+		return 0;
+	}
 
 	/* exists, replace it */
+	index_map_set(index, entry, *existing);
 	git__free((*existing)->path);
 	git__free(*existing);
 	*existing = entry;
@@ -769,6 +1275,78 @@ int git_index_add(git_index *index, const git_index_entry *source_entry)
 	return 0;
 }
 
+int git_index__add_unique(git_index *index, const git_index_entry *source_entry)
+{
+	git_index_entry *entry = index_entry_dup(source_entry);
+	size_t path_length;
+
+	if (entry == NULL)
+		return -1;
+
+	path_length = strlen(entry->path);
+
+	entry->flags &= ~GIT_IDXENTRY_NAMEMASK;
+	entry->flags |= (path_length < GIT_IDXENTRY_NAMEMASK) ?
+		path_length : GIT_IDXENTRY_NAMEMASK;
+
+	if (git_vector_insert(&index->entries, entry) < 0) {
+		index_entry_free(entry);
+		return -1;
+	}
+
+	index_map_set(index, entry, NULL);
+
+	git_tree_cache_invalidate_path(index->tree, entry->path);
+	return 0;
+}
+
+int git_index__update(
+	git_index *index, const git_index_entry *changes, size_t count)
+{
+	git_index_entry **added;
+	size_t i, nadded = 0;
+	int error = 0;
+
+	assert(index && (changes || !count));
+
+	added = git__calloc(count ? count : 1, sizeof(git_index_entry *));
+	GITERR_CHECK_ALLOC(added);
+
+	for (i = 0; i < count; ++i) {
+		if (!changes[i].mode)
+			continue;
+
+		if ((added[nadded] = index_entry_dup(&changes[i])) == NULL) {
+			error = -1;
+			goto cleanup;
+		}
+		nadded++;
+	}
+
+	if ((error = git_vector_reserve(
+			&index->entries, index->entries.length + nadded)) < 0)
+		goto cleanup;
+
+	/* nothing can fail from here on */
+	for (i = 0; i < count; ++i) {
+		if (!changes[i].mode &&
+			git_index_remove(index, changes[i].path, 0) == GIT_ENOTFOUND)
+			giterr_clear();
+	}
+
+	for (i = 0; i < nadded; ++i) {
+		index_insert(index, added[i], 1);
+		git_tree_cache_invalidate_path(index->tree, added[i]->path);
+		added[i] = NULL;
+	}
+
+cleanup:
+	for (i = 0; i < nadded; ++i)
+		index_entry_free(added[i]);
+	git__free(added);
+	return error;
+}
+
 int git_index_remove(git_index *index, const char *path, int stage)
 {
 	int position;
@@ -781,8 +1359,10 @@ int git_index_remove(git_index *index, const char *path, int stage)
 		return position;
 
 	entry = git_vector_get(&index->entries, position);
-	if (entry != NULL)
+	if (entry != NULL) {
 		git_tree_cache_invalidate_path(index->tree, entry->path);
+		index_map_delete(index, entry);
+	}
 
 	error = git_vector_remove(&index->entries, (unsigned int)position);
 
@@ -806,10 +1386,17 @@ static int index_find(git_index *index, const char *path, int stage)
 
 int git_index_find(git_index *index, const char *path)
 {
-	int pos;
+	int pos, stage, found = 0;
 
 	assert(index && path);
 
+	/* rule out paths which are not in the index at any stage */
+	for (stage = 0; stage <= 3 && found == 0; ++stage)
+		found = index_map_find(NULL, index, path, stage);
+
+	if (!found)
+		return GIT_ENOTFOUND;
+
 	if ((pos = git_vector_bsearch2(&index->entries, index->entries_search_path, path)) < 0)
 		return pos;
 
@@ -952,6 +1539,7 @@ int git_index_conflict_remove(git_index *index, const char *path)
 			continue;
 		}
 
+		index_map_delete(index, conflict_entry);
 		error = git_vector_remove(&index->entries, (unsigned int)pos);
 
 		if (error >= 0)
@@ -977,6 +1565,7 @@ void git_index_conflict_cleanup(git_index *index)
 {
 	assert(index);
 	git_vector_remove_matching(&index->entries, index_conflicts_match);
+	index_map_drop(index);
 }
 
 int git_index_has_conflicts(git_index *index)
@@ -994,17 +1583,400 @@ int git_index_has_conflicts(git_index *index)
 	return 0;
 }
 
-unsigned int git_index_reuc_entrycount(git_index *index)
+static void index_fsmonitor_invalidate(git_index *index, const char *path)
 {
-	assert(index);
-	return (unsigned int)index->reuc.length;
+	int (*ncmp)(const char *, const char *, size_t) =
+		index->ignore_case ? strncasecmp : strncmp;
+	size_t path_len = strlen(path), pos;
+	git_index_entry *entry;
+
+	while (path_len > 0 && path[path_len - 1] == '/')
+		path_len--;
+
+	/* the path itself and everything below it */
+	for (pos = git_index__prefix_position(index, path);
+		 (entry = git_vector_get(&index->entries, pos)) != NULL &&
+		 ncmp(entry->path, path, path_len) == 0; ++pos) {
+		if (entry->path[path_len] == '\0' || entry->path[path_len] == '/')
+			entry->flags_extended &= ~GIT_IDXENTRY_FSMONITOR_VALID;
+	}
 }
 
-static int index_reuc_insert(git_index *index, git_index_reuc_entry *reuc, int replace)
+int git_index__fsmonitor_update(git_index *index)
 {
-	git_index_reuc_entry **existing = NULL;
-	int position;
-
+	git_repository *repo = INDEX_OWNER(index);
+	git_fsmonitor *fsm = repo ? git__load(&repo->_fsmonitor) : NULL;
+	git_fsmonitor_result result;
+	git_index_entry *entry;
+	const char *path;
+	unsigned int i;
+	int error;
+
+	if (!fsm || !git_repository_workdir(repo)) {
+		/* nothing vouches for the entries any more */
+		if (index->fsmonitor_token) {
+			git_vector_foreach(&index->entries, i, entry)
+				entry->flags_extended &= ~GIT_IDXENTRY_FSMONITOR_VALID;
+
+			git__free(index->fsmonitor_token);
+			index->fsmonitor_token = NULL;
+		}
+		return 0;
+	}
+
+	if ((error = git_fsmonitor__query(&result, fsm, index->fsmonitor_token)) < 0)
+		goto cleanup;
+
+	if (result.all) {
+		git_vector_foreach(&index->entries, i, entry)
+			entry->flags_extended &= ~GIT_IDXENTRY_FSMONITOR_VALID;
+	} else {
+		git_vector_foreach(&result.paths, i, path)
+			index_fsmonitor_invalidate(index, path);
+	}
+
+	git__free(index->fsmonitor_token);
+	index->fsmonitor_token = result.token;
+	result.token = NULL;
+
+	error = 1;
+
+cleanup:
+	git_fsmonitor__result_free(&result);
+	return error;
+}
+
+enum {
+	INDEX_REFRESH_UNCHANGED = 0,
+	INDEX_REFRESH_CHANGED = 1,
+	INDEX_REFRESH_RETRY = 2, /* left for the calling thread */
+};
+
+typedef struct {
+	git_index *index;
+	git_repository *repo;
+	const char *workdir;
+	unsigned int flags;
+	unsigned int trust_ctime:1;
+	unsigned int fsmonitor:1;
+	unsigned char *state;
+	void *stop; /* set once a quick refresh has found a change */
+} index_refresh;
+
+typedef struct {
+	index_refresh *refresh;
+	size_t start, end;
+#ifdef GIT_THREADS
+	git_thread thread;
+#endif
+} index_refresh_chunk;
+
+static int index_refresh_entry(
+	index_refresh *r, git_index_entry *entry, git_buf *full_path, bool serial)
+{
+	struct stat st;
+	unsigned int mode;
+	git_oid oid;
+
+	if ((entry->flags_extended & GIT_IDXENTRY_SKIP_WORKTREE) != 0 ||
+		(r->fsmonitor &&
+		 (entry->flags_extended & GIT_IDXENTRY_FSMONITOR_VALID) != 0))
+		return INDEX_REFRESH_UNCHANGED;
+
+	if (index_entry_stage(entry) > 0 ||
+		(entry->flags_extended & GIT_IDXENTRY_INTENT_TO_ADD) != 0)
+		return INDEX_REFRESH_CHANGED;
+
+	if (git_buf_joinpath(full_path, r->workdir, entry->path) < 0)
+		return -1;
+
+	if (p_lstat(full_path->ptr, &st) < 0) {
+		if (errno == ENOENT || errno == ENOTDIR)
+			return INDEX_REFRESH_CHANGED;
+
+		giterr_set(GITERR_OS, "Could not stat '%s'", full_path->ptr);
+		return -1;
+	}
+
+	/* this also catches type changes and, unless the filemode is
+	 * distrusted, executable bit flips */
+	mode = index_merge_mode(r->index, entry, st.st_mode);
+	if (mode != entry->mode)
+		return INDEX_REFRESH_CHANGED;
+
+	if (S_ISGITLINK(mode)) {
+		/* submodule lookups go through the repository's submodule
+		 * cache, so they are kept off the worker threads */
+		if (!serial)
+			return INDEX_REFRESH_RETRY;
+
+		if (git_diff__oid_for_file(r->repo, entry->path, (uint16_t)mode, 0, &oid) < 0)
+			return -1;
+
+		/* a submodule that is not checked out is not a change */
+		return (git_oid_iszero(&oid) || git_oid_equal(&oid, &entry->oid)) ?
+			INDEX_REFRESH_UNCHANGED : INDEX_REFRESH_CHANGED;
+	}
+
+	/* an entry written in the same second as the index itself could
+	 * have changed again without its stat data showing it ("racy git"),
+	 * so its content has to be checked even when the stat data matches */
+	if (entry->file_size == (git_off_t)st.st_size &&
+		entry->mtime.seconds == (git_time_t)st.st_mtime &&
+		(!r->trust_ctime || entry->ctime.seconds == (git_time_t)st.st_ctime) &&
+		entry->ino == (unsigned int)st.st_ino &&
+		entry->uid == (unsigned int)st.st_uid &&
+		entry->gid == (unsigned int)st.st_gid &&
+		(!r->index->stamp.mtime || entry->mtime.seconds < r->index->stamp.mtime))
+		return INDEX_REFRESH_UNCHANGED;
+
+	if (git_diff__oid_for_file(
+			r->repo, entry->path, (uint16_t)mode, st.st_size, &oid) < 0)
+		return -1;
+
+	if (!git_oid_equal(&oid, &entry->oid))
+		return INDEX_REFRESH_CHANGED;
+
+	if ((r->flags & GIT_INDEX_REFRESH_NO_UPDATE) == 0) {
+		git_index_entry__init_from_stat(entry, &st);
+		entry->mode = mode;
+	}
+
+	return INDEX_REFRESH_UNCHANGED;
+}
+
+/* with a filesystem monitor, remember which entries are clean as of
+ * the token it handed out before they were looked at */
+static void index_refresh_mark(
+	index_refresh *r, git_index_entry *entry, int result)
+{
+	if (!r->fsmonitor || result == INDEX_REFRESH_RETRY)
+		return;
+
+	if (result == INDEX_REFRESH_UNCHANGED && !S_ISGITLINK(entry->mode))
+		entry->flags_extended |= GIT_IDXENTRY_FSMONITOR_VALID;
+	else
+		entry->flags_extended &= ~GIT_IDXENTRY_FSMONITOR_VALID;
+}
+
+static void *index_refresh_chunk_run(void *payload)
+{
+	index_refresh_chunk *chunk = payload;
+	index_refresh *r = chunk->refresh;
+	git_buf full_path = GIT_BUF_INIT;
+	size_t i;
+	int result;
+
+	for (i = chunk->start; i < chunk->end && !git__load(&r->stop); ++i) {
+		git_index_entry *entry = git_vector_get(&r->index->entries, i);
+
+		result = index_refresh_entry(r, entry, &full_path, false);
+
+		/* errors are raised again by the calling thread when it
+		 * retries the entry, where they can be reported */
+		if (result < 0) {
+			giterr_clear();
+			result = INDEX_REFRESH_RETRY;
+		}
+
+		r->state[i] = (unsigned char)result;
+		index_refresh_mark(r, entry, result);
+
+		if (result == INDEX_REFRESH_CHANGED &&
+			(r->flags & GIT_INDEX_REFRESH_QUICK) != 0)
+			git__swap(&r->stop, r);
+	}
+
+	git_buf_free(&full_path);
+	return NULL;
+}
+
+static int index_refresh_chunks(index_refresh *r, unsigned int nthreads)
+{
+	index_refresh_chunk *chunks;
+	size_t entrycount = r->index->entries.length;
+	unsigned int i, started = 0;
+	int error = 0;
+
+#ifdef GIT_THREADS
+	int val;
+
+	/* unless asked for, a thread is not worth it for a few entries */
+	if (!nthreads && (nthreads = (unsigned int)git_online_cpus()) > entrycount / 64)
+		nthreads = (unsigned int)(entrycount / 64);
+	if (nthreads > entrycount)
+		nthreads = (unsigned int)entrycount;
+
+	/* the workers look up attributes, which may come from the index,
+	 * and filters, which use the cached config; load both beforehand
+	 * rather than have the threads race to do it */
+	if (nthreads > 1 &&
+		((index_map_build(r->index) < 0 && !r->index->entries_map_ambiguous) ||
+		 git_repository__cvar(&val, r->repo, GIT_CVAR_AUTO_CRLF) < 0 ||
+		 git_repository__cvar(&val, r->repo, GIT_CVAR_EOL) < 0)) {
+		giterr_clear();
+		nthreads = 1;
+	}
+
+	if (nthreads < 1)
+		nthreads = 1;
+#else
+	nthreads = 1;
+#endif
+
+	chunks = git__calloc(nthreads, sizeof(index_refresh_chunk));
+	GITERR_CHECK_ALLOC(chunks);
+
+	for (i = 0; i < nthreads; ++i) {
+		chunks[i].refresh = r;
+		chunks[i].start = entrycount * i / nthreads;
+		chunks[i].end = entrycount * (i + 1) / nthreads;
+	}
+
+#ifdef GIT_THREADS
+	/* the calling thread takes the first chunk itself */
+	for (i = 1; i < nthreads; ++i, ++started) {
+		if (git_thread_create(&chunks[i].thread, NULL,
+				index_refresh_chunk_run, &chunks[i]) != 0) {
+			giterr_set(GITERR_THREAD, "Unable to create index refresh thread");
+			git__swap(&r->stop, r);
+			error = -1;
+			break;
+		}
+	}
+#endif
+
+	if (!error)
+		index_refresh_chunk_run(&chunks[0]);
+
+#ifdef GIT_THREADS
+	for (i = 1; i <= started; ++i)
+		git_thread_join(chunks[i].thread, NULL);
+#else
+	GIT_UNUSED(started);
+#endif
+
+	git__free(chunks);
+	return error;
+}
+
+int git_index_refresh(
+	git_index *index,
+	unsigned int flags,
+	unsigned int nthreads,
+	git_strarray *changed)
+{
+	index_refresh r;
+	git_vector paths = GIT_VECTOR_INIT;
+	git_buf full_path = GIT_BUF_INIT;
+	git_index_entry *entry;
+	git_config *cfg;
+	const char *last = NULL;
+	int error = 0, dirty = 0, val;
+	size_t i;
+
+	assert(index);
+
+	if (changed) {
+		changed->strings = NULL;
+		changed->count = 0;
+	}
+
+	memset(&r, 0, sizeof(r));
+	r.index = index;
+	r.flags = flags;
+
+	if ((r.repo = INDEX_OWNER(index)) == NULL)
+		return create_index_error(-1,
+			"Could not refresh index. "
+			"Index is not backed up by an existing repository.");
+
+	if ((r.workdir = git_repository_workdir(r.repo)) == NULL)
+		return create_index_error(GIT_EBAREREPO,
+			"Could not refresh index. Repository is bare");
+
+	if (git_repository_config__weakptr(&cfg, r.repo) < 0)
+		return -1;
+
+	r.trust_ctime = (git_config_get_bool(&val, cfg, "core.trustctime") < 0 || val);
+	giterr_clear();
+
+	if ((error = git_index__fsmonitor_update(index)) < 0)
+		return error;
+	r.fsmonitor = (error > 0);
+	error = 0;
+
+	/* chunks are contiguous ranges of a sorted index, so a directory
+	 * mostly stays with one thread */
+	git_vector_sort(&index->entries);
+
+	if (!index->entries.length)
+		return 0;
+
+	r.state = git__calloc(index->entries.length, sizeof(unsigned char));
+	GITERR_CHECK_ALLOC(r.state);
+
+	if ((error = index_refresh_chunks(&r, nthreads)) < 0)
+		goto cleanup;
+
+	git_vector_foreach(&index->entries, i, entry) {
+		if (r.state[i] == INDEX_REFRESH_RETRY) {
+			if ((error = index_refresh_entry(&r, entry, &full_path, true)) < 0)
+				goto cleanup;
+			r.state[i] = (unsigned char)error;
+			index_refresh_mark(&r, entry, error);
+			error = 0;
+		}
+
+		if (r.state[i] != INDEX_REFRESH_CHANGED)
+			continue;
+
+		dirty = 1;
+
+		/* the stages of a conflict share one path */
+		if (changed && (!last || strcmp(last, entry->path) != 0)) {
+			char *path = git__strdup(entry->path);
+
+			if (!path || git_vector_insert(&paths, path) < 0) {
+				git__free(path);
+				error = -1;
+				goto cleanup;
+			}
+			last = entry->path;
+		}
+
+		if ((flags & GIT_INDEX_REFRESH_QUICK) != 0 && !changed)
+			break;
+	}
+
+	if (changed) {
+		changed->strings = (char **)paths.contents;
+		changed->count = paths.length;
+		paths.contents = NULL;
+		paths.length = 0;
+	}
+
+cleanup:
+	git_vector_foreach(&paths, i, last)
+		git__free((char *)last);
+	git_vector_free(&paths);
+	git_buf_free(&full_path);
+	git__free(r.state);
+
+	return error < 0 ? error : dirty;
+}
+
+unsigned int git_index_reuc_entrycount(git_index *index)
+{
+	assert(index);
+	return (unsigned int)index->reuc.length;
+}
+
+static int index_reuc_insert(git_index *index, git_index_reuc_entry *reuc, int replace)
+{
+	git_index_reuc_entry **existing = NULL;
+	int position;
+
 	assert(index && reuc && reuc->path != NULL);
 
 	if ((position = git_index_reuc_find(index, reuc->path)) >= 0)
@@ -1162,6 +2134,66 @@ static int read_reuc(git_index *index, const char *buffer, size_t size)
 	return 0;
 }
 
+GIT_INLINE(uint32_t) index_get32(const char *buffer)
+{
+	uint32_t value;
+	memcpy(&value, buffer, 4);
+	return ntohl(value);
+}
+
+static int fsmonitor_mark_dirty(size_t pos, void *payload)
+{
+	git_index *index = payload;
+	git_index_entry *entry = git_vector_get(&index->entries, pos);
+
+	if (entry)
+		entry->flags_extended &= ~GIT_IDXENTRY_FSMONITOR_VALID;
+
+	return 0;
+}
+
+/*
+ * The extension holds the filesystem monitor token and an EWAH bitmap
+ * of the entries not known to be clean.
+ */
+static int read_fsmonitor(git_index *index, const char *buffer, size_t size)
+{
+	const char *token, *token_end;
+	size_t ewah_size, bit_size, i;
+	git_index_entry *entry;
+
+	/* version 1 holds a timestamp for core git's hook, which no monitor
+	 * of ours can answer for; leave the entries unvetted */
+	if (size < 4 || index_get32(buffer) != INDEX_FSMONITOR_VERSION)
+		return 0;
+
+	token = buffer + 4;
+	size -= 4;
+
+	if ((token_end = memchr(token, '\0', size)) == NULL)
+		return index_error_invalid("reading fsmonitor token");
+
+	size -= (token_end + 1) - token;
+	buffer = token_end + 1;
+
+	if (size < 4 || (ewah_size = index_get32(buffer)) > size - 4)
+		return index_error_invalid("reading fsmonitor bitmap");
+
+	git_vector_foreach(&index->entries, i, entry)
+		entry->flags_extended |= GIT_IDXENTRY_FSMONITOR_VALID;
+
+	if (git_ewah_read(&bit_size, NULL, buffer + 4, ewah_size,
+			fsmonitor_mark_dirty, index) < 0 ||
+		bit_size > index->entries.length)
+		return index_error_invalid("reading fsmonitor bitmap");
+
+	git__free(index->fsmonitor_token);
+	index->fsmonitor_token = git__strdup(token);
+	GITERR_CHECK_ALLOC(index->fsmonitor_token);
+
+	return 0;
+}
+
 static size_t read_entry(git_index_entry *dest, const void *buffer, size_t buffer_size)
 {
 	size_t path_length, entry_size;
@@ -1241,7 +2273,8 @@ static int read_header(struct index_header *dest, const void *buffer)
 	return 0;
 }
 
-static size_t read_extension(git_index *index, const char *buffer, size_t buffer_size)
+static size_t read_extension(
+	git_index *index, struct index_deferred *deferred, const char *buffer, size_t buffer_size)
 {
 	const struct index_extension *source;
 	struct index_extension dest;
@@ -1266,9 +2299,15 @@ static size_t read_extension(git_index *index, const char *buffer, size_t buffer
 		} else if (memcmp(dest.signature, INDEX_EXT_UNMERGED_SIG, 4) == 0) {
 			if (read_reuc(index, buffer + 8, dest.extension_size) < 0)
 				return 0;
+		} else if (memcmp(dest.signature, INDEX_EXT_FSMONITOR_SIG, 4) == 0) {
+			deferred->fsmonitor = buffer + 8;
+			deferred->fsmonitor_size = dest.extension_size;
 		}
 		/* else, unsupported extension. We cannot parse this, but we can skip
 		 * it by returning `total_size */
+	} else if (memcmp(dest.signature, INDEX_EXT_LINK_SIG, 4) == 0) {
+		deferred->link = buffer + 8;
+		deferred->link_size = dest.extension_size;
 	} else {
 		/* we cannot handle non-ignorable extensions;
 		 * in fact they aren't even defined in the standard */
@@ -1278,10 +2317,164 @@ static size_t read_extension(git_index *index, const char *buffer, size_t buffer
 	return total_size;
 }
 
+struct index_split_bits {
+	uint64_t *words;
+	size_t count;
+};
+
+static int index_split_set_bit(size_t pos, void *payload)
+{
+	struct index_split_bits *bits = payload;
+
+	if (pos >= bits->count)
+		return -1;
+
+	git_ewah_set(bits->words, pos);
+	return 0;
+}
+
+/*
+ * The extension names the shared index the entries of this file are
+ * applied to, followed by an EWAH bitmap of the shared entries deleted
+ * and one of those replaced.  The replacements are the first entries
+ * of this file, with empty paths, in the order of the entries they
+ * replace; the entries after them are added.
+ */
+static int read_link(git_index *index, const char *buffer, size_t size)
+{
+	git_buf path = GIT_BUF_INIT;
+	git_index *base = NULL;
+	git_vector merged = GIT_VECTOR_INIT;
+	git_index_entry *entry, *split, *copy;
+	struct index_split_bits bits;
+	uint64_t *deleted = NULL, *replaced = NULL;
+	size_t consumed, words, i, r = 0;
+	int error = -1;
+
+	if (size < GIT_OID_RAWSZ)
+		return index_error_invalid("reading link extension");
+
+	git_oid_fromraw(&index->split_base_oid, (const unsigned char *)buffer);
+	buffer += GIT_OID_RAWSZ;
+	size -= GIT_OID_RAWSZ;
+
+	if (index_shared_path(&path, index, &index->split_base_oid) < 0)
+		goto cleanup;
+
+	if (!git_path_isfile(path.ptr)) {
+		giterr_set(GITERR_INDEX, "The shared index '%s' does not exist", path.ptr);
+		goto cleanup;
+	}
+
+	if (git_index_open(&base, path.ptr) < 0)
+		goto cleanup;
+
+	if (base->split_base != NULL) {
+		error = index_error_invalid("shared index is split itself");
+		goto cleanup;
+	}
+
+	words = git_ewah_words(base->entries.length) + 1;
+	deleted = git__calloc(words, sizeof(uint64_t));
+	replaced = git__calloc(words, sizeof(uint64_t));
+	if (!deleted || !replaced)
+		goto cleanup;
+
+	bits.count = base->entries.length;
+
+	if (size > 0) {
+		bits.words = deleted;
+		if (git_ewah_read(NULL, &consumed, buffer, size, index_split_set_bit, &bits) < 0) {
+			error = index_error_invalid("reading link deletions");
+			goto cleanup;
+		}
+
+		bits.words = replaced;
+		if (git_ewah_read(NULL, NULL, buffer + consumed, size - consumed,
+				index_split_set_bit, &bits) < 0) {
+			error = index_error_invalid("reading link replacements");
+			goto cleanup;
+		}
+	}
+
+	if (git_vector_init(&merged,
+			base->entries.length + index->entries.length, index_cmp) < 0)
+		goto cleanup;
+
+	/* everything is copied so that a failure leaves both sides alone */
+	git_vector_foreach(&base->entries, i, entry) {
+		if (git_ewah_get(deleted, i)) {
+			if (git_ewah_get(replaced, i)) {
+				error = index_error_invalid("entry both deleted and replaced");
+				goto cleanup;
+			}
+			continue;
+		}
+
+		if (!git_ewah_get(replaced, i)) {
+			if ((copy = index_entry_dup(entry)) == NULL)
+				goto cleanup;
+		} else {
+			if (r >= index->entries.length ||
+				*(split = git_vector_get(&index->entries, r++))->path != '\0') {
+				error = index_error_invalid("invalid replacement entry");
+				goto cleanup;
+			}
+
+			if ((copy = git__malloc(sizeof(git_index_entry))) == NULL)
+				goto cleanup;
+
+			memcpy(copy, split, sizeof(git_index_entry));
+			copy->flags = (split->flags & ~GIT_IDXENTRY_NAMEMASK) |
+				(entry->flags & GIT_IDXENTRY_NAMEMASK);
+
+			if ((copy->path = git__strdup(entry->path)) == NULL) {
+				git__free(copy);
+				goto cleanup;
+			}
+		}
+
+		if (git_vector_insert(&merged, copy) < 0) {
+			index_entry_free(copy);
+			goto cleanup;
+		}
+	}
+
+	for (i = r; i < index->entries.length; ++i) {
+		if ((copy = index_entry_dup(git_vector_get(&index->entries, i))) == NULL ||
+			git_vector_insert(&merged, copy) < 0) {
+			index_entry_free(copy);
+			goto cleanup;
+		}
+	}
+
+	/* the additions go in among the shared entries */
+	if (r < index->entries.length)
+		git_vector_sort(&merged);
+
+	merged._cmp = index->entries._cmp;
+	git_vector_swap(&index->entries, &merged);
+
+	index->split_base = base;
+	base = NULL;
+	error = 0;
+
+cleanup:
+	git_vector_foreach(&merged, i, entry)
+		index_entry_free(entry);
+	git_vector_free(&merged);
+	git__free(deleted);
+	git__free(replaced);
+	git_index_free(base);
+	git_buf_free(&path);
+	return error;
+}
+
 static int parse_index(git_index *index, const char *buffer, size_t buffer_size)
 {
 	unsigned int i;
 	struct index_header header;
+	struct index_deferred deferred = {0};
 	git_oid checksum_calculated, checksum_expected;
 
 #define seek_forward(_increase) { \
@@ -1305,6 +2498,10 @@ static int parse_index(git_index *index, const char *buffer, size_t buffer_size)
 	seek_forward(INDEX_HEADER_SIZE);
 
 	git_vector_clear(&index->entries);
+	index_map_drop(index);
+
+	git_index_free(index->split_base);
+	index->split_base = NULL;
 
 	/* Parse all the entries */
 	for (i = 0; i < header.entry_count && buffer_size > INDEX_FOOTER_SIZE; ++i) {
@@ -1333,7 +2530,7 @@ static int parse_index(git_index *index, const char *buffer, size_t buffer_size)
 	while (buffer_size > INDEX_FOOTER_SIZE) {
 		size_t extension_size;
 
-		extension_size = read_extension(index, buffer, buffer_size);
+		extension_size = read_extension(index, &deferred, buffer, buffer_size);
 
 		/* see if we have read any bytes from the extension */
 		if (extension_size == 0)
@@ -1353,6 +2550,13 @@ static int parse_index(git_index *index, const char *buffer, size_t buffer_size)
 
 #undef seek_forward
 
+	if (deferred.link && read_link(index, deferred.link, deferred.link_size) < 0)
+		return -1;
+
+	if (deferred.fsmonitor &&
+		read_fsmonitor(index, deferred.fsmonitor, deferred.fsmonitor_size) < 0)
+		return -1;
+
 	/* force sorting in the vector: the entries are
 	 * assured to be sorted on the index */
 	index->entries.sorted = 1;
@@ -1377,14 +2581,20 @@ static int is_index_extended(git_index *index)
 	return extended;
 }
 
-static int write_disk_entry(git_filebuf *file, git_index_entry *entry)
+static int write_disk_entry(git_filebuf *file, git_index_entry *entry, bool strip_path)
 {
 	void *mem = NULL;
 	struct entry_short *ondisk;
 	size_t path_len, disk_size;
+	uint16_t flags = entry->flags;
 	char *path;
 
-	path_len = strlen(entry->path);
+	/* replacements in a split index take the path of what they replace */
+	if (strip_path) {
+		path_len = 0;
+		flags &= ~GIT_IDXENTRY_NAMEMASK;
+	} else
+		path_len = strlen(entry->path);
 
 	if (entry->flags & GIT_IDXENTRY_EXTENDED)
 		disk_size = long_entry_size(path_len);
@@ -1421,12 +2631,13 @@ static int write_disk_entry(git_filebuf *file, git_index_entry *entry)
 
 	git_oid_cpy(&ondisk->oid, &entry->oid);
 
-	ondisk->flags = htons(entry->flags);
+	ondisk->flags = htons(flags);
 
 	if (entry->flags & GIT_IDXENTRY_EXTENDED) {
 		struct entry_long *ondisk_ext;
 		ondisk_ext = (struct entry_long *)ondisk;
-		ondisk_ext->flags_extended = htons(entry->flags_extended);
+		ondisk_ext->flags_extended =
+			htons(entry->flags_extended & GIT_IDXENTRY_EXTENDED_FLAGS);
 		path = ondisk_ext->path;
 	}
 	else
@@ -1437,7 +2648,7 @@ static int write_disk_entry(git_filebuf *file, git_index_entry *entry)
 	return 0;
 }
 
-static int write_entries(git_index *index, git_filebuf *file)
+static int write_entries(git_index *index, git_filebuf *file, index_split *split)
 {
 	int error = 0;
 	unsigned int i;
@@ -1445,6 +2656,14 @@ static int write_entries(git_index *index, git_filebuf *file)
 	git_index_entry *entry;
 	git_vector *out = &index->entries;
 
+	if (split != NULL) {
+		git_vector_foreach(&split->entries, i, entry)
+			if ((error = write_disk_entry(file, entry, i < split->replacements)) < 0)
+				break;
+
+		return error;
+	}
+
 	/* If index->entries is sorted case-insensitively, then we need
 	 * to re-sort it case-sensitively before writing */
 	if (index->ignore_case) {
@@ -1454,7 +2673,7 @@ static int write_entries(git_index *index, git_filebuf *file)
 	}
 
 	git_vector_foreach(out, i, entry)
-		if ((error = write_disk_entry(file, entry)) < 0)
+		if ((error = write_disk_entry(file, entry, false)) < 0)
 			break;
 
 	if (index->ignore_case)
@@ -1526,7 +2745,95 @@ done:
 	return error;
 }
 
-static int write_index(git_index *index, git_filebuf *file)
+GIT_INLINE(int) index_put32(git_buf *buf, uint32_t value)
+{
+	value = htonl(value);
+	return git_buf_put(buf, (const char *)&value, 4);
+}
+
+static int write_fsmonitor_extension(git_index *index, git_filebuf *file)
+{
+	git_buf data = GIT_BUF_INIT;
+	git_vector case_sorted, *out = &index->entries;
+	git_index_entry *entry;
+	struct index_extension extension;
+	uint64_t *dirty;
+	size_t ewah_start, ewah_size, i;
+	int error = 0;
+
+	dirty = git__calloc(git_ewah_words(index->entries.length) + 1, sizeof(uint64_t));
+	GITERR_CHECK_ALLOC(dirty);
+
+	/* bits go by the order of the entries on disk */
+	if (index->ignore_case) {
+		if (git_vector_dup(&case_sorted, &index->entries, index_cmp) < 0) {
+			git__free(dirty);
+			return -1;
+		}
+		git_vector_sort(&case_sorted);
+		out = &case_sorted;
+	}
+
+	git_vector_foreach(out, i, entry)
+		if ((entry->flags_extended & GIT_IDXENTRY_FSMONITOR_VALID) == 0)
+			git_ewah_set(dirty, i);
+
+	if (index->ignore_case)
+		git_vector_free(&case_sorted);
+
+	index_put32(&data, INDEX_FSMONITOR_VERSION);
+	git_buf_put(&data, index->fsmonitor_token, strlen(index->fsmonitor_token) + 1);
+	index_put32(&data, 0); /* the size of the bitmap, filled in below */
+
+	ewah_start = data.size;
+	error = git_ewah_write(&data, dirty, index->entries.length);
+	git__free(dirty);
+
+	if (error < 0 || git_buf_oom(&data)) {
+		git_buf_free(&data);
+		return -1;
+	}
+
+	ewah_size = htonl((uint32_t)(data.size - ewah_start));
+	memcpy(data.ptr + ewah_start - 4, &ewah_size, 4);
+
+	memset(&extension, 0x0, sizeof(struct index_extension));
+	memcpy(&extension.signature, INDEX_EXT_FSMONITOR_SIG, 4);
+	extension.extension_size = (uint32_t)data.size;
+
+	error = write_extension(file, &extension, &data);
+
+	git_buf_free(&data);
+	return error;
+}
+
+static int write_link_extension(git_index *index, git_filebuf *file, index_split *split)
+{
+	git_buf data = GIT_BUF_INIT;
+	struct index_extension extension;
+	size_t base_length = index->split_base->entries.length;
+	int error;
+
+	git_buf_put(&data, (const char *)index->split_base_oid.id, GIT_OID_RAWSZ);
+
+	if (git_ewah_write(&data, split->deleted, base_length) < 0 ||
+		git_ewah_write(&data, split->replaced, base_length) < 0) {
+		git_buf_free(&data);
+		return -1;
+	}
+
+	memset(&extension, 0x0, sizeof(struct index_extension));
+	memcpy(&extension.signature, INDEX_EXT_LINK_SIG, 4);
+	extension.extension_size = (uint32_t)data.size;
+
+	error = write_extension(file, &extension, &data);
+
+	git_buf_free(&data);
+	return error;
+}
+
+static int write_index(
+	git_index *index, git_filebuf *file, index_split *split, git_oid *checksum)
 {
 	git_oid hash_final;
 
@@ -1540,12 +2847,17 @@ static int write_index(git_index *index, git_filebuf *file)
 
 	header.signature = htonl(INDEX_HEADER_SIG);
 	header.version = htonl(is_extended ? INDEX_VERSION_NUMBER_EXT : INDEX_VERSION_NUMBER);
-	header.entry_count = htonl((uint32_t)index->entries.length);
+	header.entry_count = htonl((uint32_t)
+		(split ? split->entries.length : index->entries.length));
 
 	if (git_filebuf_write(file, &header, sizeof(struct index_header)) < 0)
 		return -1;
 
-	if (write_entries(index, file) < 0)
+	if (write_entries(index, file, split) < 0)
+		return -1;
+
+	/* write the link to the shared index */
+	if (split != NULL && write_link_extension(index, file, split) < 0)
 		return -1;
 
 	/* TODO: write tree cache extension */
@@ -1554,9 +2866,18 @@ static int write_index(git_index *index, git_filebuf *file)
 	if (index->reuc.length > 0 && write_reuc_extension(index, file) < 0)
 		return -1;
 
+	/* the token only means something to the monitor that handed it out */
+	if (index->fsmonitor_token && INDEX_OWNER(index) &&
+		git__load(&INDEX_OWNER(index)->_fsmonitor) != NULL &&
+		write_fsmonitor_extension(index, file) < 0)
+		return -1;
+
 	/* get out the hash for all the contents we've appended to the file */
 	git_filebuf_hash(&hash_final, file);
 
+	if (checksum)
+		git_oid_cpy(checksum, &hash_final);
+
 	/* write it at the end of the file */
 	return git_filebuf_write(file, hash_final.id, GIT_OID_RAWSZ);
 }
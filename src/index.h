@@ -11,11 +11,13 @@
 #include "filebuf.h"
 #include "vector.h"
 #include "tree-cache.h"
+#include "idxmap.h"
 #include "git2/odb.h"
 #include "git2/index.h"
 
 #define GIT_INDEX_FILE "index"
 #define GIT_INDEX_FILE_MODE 0666
+#define GIT_INDEX_SHARED_PREFIX "sharedindex."
 
 struct git_index {
 	git_refcount rc;
@@ -24,6 +26,9 @@ struct git_index {
 
 	git_futils_filestamp stamp;
 	git_vector entries;
+	git_idxmap *entries_map; /* lookup cache, see index_map_find */
+	git_mutex map_lock; /* held while building entries_map */
+	unsigned int entries_map_ambiguous; /* not a bit, it is set under map_lock */
 
 	unsigned int on_disk:1;
 
@@ -33,6 +38,11 @@ struct git_index {
 
 	git_tree_cache *tree;
 
+	char *fsmonitor_token; /* when the FSMONITOR_VALID flags were last vetted */
+
+	git_index *split_base; /* the shared index named by the "link" extension */
+	git_oid split_base_oid;
+
 	git_vector reuc;
 
 	git_vector_cmp entries_cmp_path;
@@ -48,6 +58,31 @@ extern unsigned int git_index__prefix_position(git_index *index, const char *pat
 extern int git_index_entry__cmp(const void *a, const void *b);
 extern int git_index_entry__cmp_icase(const void *a, const void *b);
 
+/*
+ * Add a copy of `entry` without looking for an existing entry with the
+ * same path and stage, which the caller guarantees there isn't.  The
+ * index is only re-sorted when next searched, so this is the cheap way
+ * to populate an index with many entries.
+ */
+extern int git_index__add_unique(git_index *index, const git_index_entry *entry);
+
+/*
+ * Add or replace the stage 0 entry for the path of each of `changes`,
+ * or remove it for those with a zero mode.  Everything which may fail
+ * is done before the index is touched: it is changed for all of them
+ * or for none.
+ */
+extern int git_index__update(
+	git_index *index, const git_index_entry *changes, size_t count);
+
+/*
+ * Ask the repository's filesystem monitor what changed since the index
+ * last asked, and clear GIT_IDXENTRY_FSMONITOR_VALID on the entries it
+ * reports.  Returns 1 if the remaining flags can be trusted, 0 if there
+ * is no monitor (all the flags are cleared then) or an error code.
+ */
+extern int git_index__fsmonitor_update(git_index *index);
+
 extern int git_index_read_tree_match(
 	git_index *index, git_tree *tree, git_strarray *strspec);
 
@@ -5,10 +5,13 @@
  * a Linking Exception. For full terms see the included COPYING file.
  */
 
+#define GIT_ALLOC_SUBSYSTEM GIT_ALLOC_PACK
+
 #include <zlib.h>
 
 #include "git2/indexer.h"
 #include "git2/object.h"
+#include "git2/odb.h"
 #include "git2/oid.h"
 
 #include "common.h"
@@ -17,6 +20,8 @@
 #include "posix.h"
 #include "pack.h"
 #include "filebuf.h"
+#include "compress.h"
+#include "delta-apply.h"
 
 #define UINT31_MAX (0x7FFFFFFF)
 
@@ -36,6 +41,35 @@ struct git_indexer {
 	git_oid hash;
 };
 
+/*
+ * The stream indexer keeps fixed-size records in flat arrays, so that
+ * what it holds per object stays small however large the pack is.
+ */
+struct object_entry {
+	git_oid oid;
+	uint32_t crc;
+	git_off_t offset;
+};
+
+struct ofs_delta {
+	git_off_t offset;
+	git_off_t base_offset;
+};
+
+struct ref_delta {
+	git_off_t offset;
+	git_oid base_oid;
+	unsigned int resolved;
+};
+
+/* An object on the way down a delta chain, with the deltas on it left */
+struct delta_base {
+	git_off_t offset;
+	git_rawobj obj; /* data is NULL while it is not in memory */
+	size_t ofs_next, ofs_end;
+	size_t ref_next, ref_end;
+};
+
 struct git_indexer_stream {
 	unsigned int parsed_header :1,
 		opened_pack;
@@ -44,17 +78,22 @@ struct git_indexer_stream {
 	git_filebuf index_file;
 	git_off_t off;
 	size_t nr_objects;
-	git_vector objects;
-	git_vector deltas;
+	struct object_entry *objects; /* in pack order until finalized */
+	size_t objects_nr, objects_alloc;
+	struct ofs_delta *ofs_deltas; /* sorted by base offset to resolve */
+	size_t ofs_deltas_nr, ofs_deltas_alloc;
+	struct ref_delta *ref_deltas; /* sorted by base id to resolve */
+	size_t ref_deltas_nr, ref_deltas_alloc;
+	struct delta_base *bases;
+	size_t bases_alloc, bases_size;
 	unsigned int fanout[256];
 	git_oid hash;
+	git_odb *odb; /* where the bases a thin pack leaves out are */
 	git_transfer_progress_callback progress_cb;
 	void *progress_payload;
 };
 
-struct delta_info {
-	git_off_t delta_off;
-};
+size_t git_indexer__base_cache_limit = 96 * 1024 * 1024;
 
 const git_oid *git_indexer_hash(git_indexer *idx)
 {
@@ -77,6 +116,7 @@ static int open_pack(struct git_pack_file **out, const char *filename)
 	pack = git__calloc(1, sizeof(struct git_pack_file) + namelen + 1);
 	GITERR_CHECK_ALLOC(pack);
 
+	git_mutex_init(&pack->lock);
 	memcpy(pack->pack_name, filename, namelen + 1);
 
 	if (p_stat(filename, &st) < 0) {
@@ -96,6 +136,7 @@ static int open_pack(struct git_pack_file **out, const char *filename)
 	return 0;
 
 cleanup:
+	git_mutex_free(&pack->lock);
 	git__free(pack);
 	return -1;
 }
@@ -131,6 +172,53 @@ static int objects_cmp(const void *a, const void *b)
 	return git_oid_cmp(&entrya->oid, &entryb->oid);
 }
 
+static int object_entry_cmp(const void *a, const void *b)
+{
+	const struct object_entry *entrya = a;
+	const struct object_entry *entryb = b;
+
+	return git_oid_cmp(&entrya->oid, &entryb->oid);
+}
+
+static int ofs_delta_cmp(const void *a, const void *b)
+{
+	const struct ofs_delta *deltaa = a;
+	const struct ofs_delta *deltab = b;
+
+	if (deltaa->base_offset != deltab->base_offset)
+		return deltaa->base_offset < deltab->base_offset ? -1 : 1;
+	return deltaa->offset < deltab->offset ? -1 : deltaa->offset > deltab->offset;
+}
+
+static int ref_delta_cmp(const void *a, const void *b)
+{
+	const struct ref_delta *deltaa = a;
+	const struct ref_delta *deltab = b;
+	int cmp = git_oid_cmp(&deltaa->base_oid, &deltab->base_oid);
+
+	if (cmp)
+		return cmp;
+	return deltaa->offset < deltab->offset ? -1 : deltaa->offset > deltab->offset;
+}
+
+/* Make room for one more item, growing the way pack-objects' lists do */
+static int grow_array(void **array, size_t *alloc, size_t nr, size_t item_size)
+{
+	size_t new_alloc;
+	void *grown;
+
+	if (nr < *alloc)
+		return 0;
+
+	new_alloc = (*alloc + 1024) * 3 / 2;
+	grown = git__realloc(*array, new_alloc * item_size);
+	GITERR_CHECK_ALLOC(grown);
+
+	*array = grown;
+	*alloc = new_alloc;
+	return 0;
+}
+
 static int cache_cmp(const void *a, const void *b)
 {
 	const struct git_pack_entry *ea = a;
@@ -142,6 +230,7 @@ static int cache_cmp(const void *a, const void *b)
 int git_indexer_stream_new(
 		git_indexer_stream **out,
 		const char *prefix,
+		git_odb *odb,
 		git_transfer_progress_callback progress_cb,
 		void *progress_payload)
 {
@@ -152,6 +241,7 @@ int git_indexer_stream_new(
 
 	idx = git__calloc(1, sizeof(git_indexer_stream));
 	GITERR_CHECK_ALLOC(idx);
+	idx->odb = odb;
 	idx->progress_cb = progress_cb;
 	idx->progress_payload = progress_payload;
 
@@ -179,23 +269,39 @@ cleanup:
 static int store_delta(git_indexer_stream *idx, git_off_t entry_start, size_t entry_size, git_otype type)
 {
 	git_mwindow *w = NULL;
-	struct delta_info *delta;
+	git_off_t base_offset = 0;
+	git_oid base_oid;
+	unsigned char *base_info;
+	unsigned int left;
 	git_rawobj obj;
 	int error;
 
 	assert(type == GIT_OBJ_REF_DELTA || type == GIT_OBJ_OFS_DELTA);
 
 	if (type == GIT_OBJ_REF_DELTA) {
+		if (idx->off + GIT_OID_RAWSZ > idx->pack->mwf.size)
+			return GIT_EBUFS;
+
+		base_info = git_mwindow_open(&idx->pack->mwf, &w, idx->off, GIT_OID_RAWSZ, &left);
+		if (base_info == NULL)
+			return -1;
+
+		git_oid_fromraw(&base_oid, base_info);
+		git_mwindow_close(&w);
 		idx->off += GIT_OID_RAWSZ;
 	} else {
-		git_off_t base_off;
-
-		base_off = get_delta_base(idx->pack, &w, &idx->off, type, entry_start);
+		base_offset = get_delta_base(idx->pack, &w, &idx->off, type, entry_start);
 		git_mwindow_close(&w);
-		if (base_off < 0)
-			return (int)base_off;
+		if (base_offset < 0)
+			return (int)base_offset;
+
+		if (base_offset == 0) {
+			giterr_set(GITERR_INDEXER, "Indexing error: invalid delta offset");
+			return -1;
+		}
 	}
 
+	/* Inflated only to find where the next object starts */
 	error = packfile_unpack_compressed(&obj, idx->pack, &w, &idx->off, entry_size, type);
 	if (error == GIT_EBUFS) {
 		idx->off = entry_start;
@@ -204,80 +310,78 @@ static int store_delta(git_indexer_stream *idx, git_off_t entry_start, size_t en
 		return -1;
 	}
 
-	delta = git__calloc(1, sizeof(struct delta_info));
-	GITERR_CHECK_ALLOC(delta);
-	delta->delta_off = entry_start;
-
 	git__free(obj.data);
 
-	if (git_vector_insert(&idx->deltas, delta) < 0)
-		return -1;
+	if (type == GIT_OBJ_REF_DELTA) {
+		struct ref_delta *delta;
+
+		if (grow_array((void **)&idx->ref_deltas, &idx->ref_deltas_alloc,
+				idx->ref_deltas_nr, sizeof(struct ref_delta)) < 0)
+			return -1;
+
+		delta = &idx->ref_deltas[idx->ref_deltas_nr++];
+		delta->offset = entry_start;
+		git_oid_cpy(&delta->base_oid, &base_oid);
+		delta->resolved = 0;
+	} else {
+		struct ofs_delta *delta;
+
+		if (grow_array((void **)&idx->ofs_deltas, &idx->ofs_deltas_alloc,
+				idx->ofs_deltas_nr, sizeof(struct ofs_delta)) < 0)
+			return -1;
+
+		delta = &idx->ofs_deltas[idx->ofs_deltas_nr++];
+		delta->offset = entry_start;
+		delta->base_offset = base_offset;
+	}
 
 	return 0;
 }
 
-static int hash_and_save(git_indexer_stream *idx, git_rawobj *obj, git_off_t entry_start)
+/* Record the object `obj`, stored in the pack between `entry_start` and `entry_end` */
+static int hash_and_save(
+	git_oid *out,
+	git_indexer_stream *idx,
+	git_rawobj *obj,
+	git_off_t entry_start,
+	git_off_t entry_end)
 {
 	int i;
-	git_oid oid;
 	void *packed;
-	size_t entry_size;
+	size_t entry_size = (size_t)(entry_end - entry_start);
 	unsigned int left;
-	struct entry *entry;
+	struct object_entry *entry;
 	git_mwindow *w = NULL;
-	git_mwindow_file *mwf = &idx->pack->mwf;
-	struct git_pack_entry *pentry;
 
-	entry = git__calloc(1, sizeof(*entry));
-	GITERR_CHECK_ALLOC(entry);
+	if (grow_array((void **)&idx->objects, &idx->objects_alloc,
+			idx->objects_nr, sizeof(struct object_entry)) < 0)
+		return -1;
 
-	if (entry_start > UINT31_MAX) {
-		entry->offset = UINT32_MAX;
-		entry->offset_long = entry_start;
-	} else {
-		entry->offset = (uint32_t)entry_start;
-	}
+	entry = &idx->objects[idx->objects_nr];
+	entry->offset = entry_start;
 
 	/* FIXME: Parse the object instead of hashing it */
-	if (git_odb__hashobj(&oid, obj) < 0) {
+	if (git_odb__hashobj(&entry->oid, obj) < 0) {
 		giterr_set(GITERR_INDEXER, "Failed to hash object");
 		return -1;
 	}
 
-	pentry = git__malloc(sizeof(struct git_pack_entry));
-	GITERR_CHECK_ALLOC(pentry);
-
-	git_oid_cpy(&pentry->sha1, &oid);
-	pentry->offset = entry_start;
-	if (git_vector_insert(&idx->pack->cache, pentry) < 0)
-		goto on_error;
-
-	git_oid_cpy(&entry->oid, &oid);
-	entry->crc = crc32(0L, Z_NULL, 0);
-
-	entry_size = (size_t)(idx->off - entry_start);
-	packed = git_mwindow_open(mwf, &w, entry_start, entry_size, &left);
+	packed = git_mwindow_open(&idx->pack->mwf, &w, entry_start, entry_size, &left);
 	if (packed == NULL)
-		goto on_error;
+		return -1;
 
-	entry->crc = htonl(crc32(entry->crc, packed, (uInt)entry_size));
+	entry->crc = htonl(crc32(crc32(0L, Z_NULL, 0), packed, (uInt)entry_size));
 	git_mwindow_close(&w);
 
-	/* Add the object to the list */
-	if (git_vector_insert(&idx->objects, entry) < 0)
-		goto on_error;
-
-	for (i = oid.id[0]; i < 256; ++i) {
+	for (i = entry->oid.id[0]; i < 256; ++i) {
 		idx->fanout[i]++;
 	}
 
-	return 0;
+	if (out)
+		git_oid_cpy(out, &entry->oid);
 
-on_error:
-	git__free(entry);
-	git__free(pentry);
-	git__free(obj->data);
-	return -1;
+	idx->objects_nr++;
+	return 0;
 }
 
 static void do_progress_callback(git_indexer_stream *idx, git_transfer_progress *stats)
@@ -327,16 +431,6 @@ int git_indexer_stream_add(git_indexer_stream *idx, const void *data, size_t siz
 		/* for now, limit to 2^32 objects */
 		assert(idx->nr_objects == (size_t)((unsigned int)idx->nr_objects));
 
-		if (git_vector_init(&idx->pack->cache, (unsigned int)idx->nr_objects, cache_cmp) < 0)
-			return -1;
-
-		idx->pack->has_cache = 1;
-		if (git_vector_init(&idx->objects, (unsigned int)idx->nr_objects, objects_cmp) < 0)
-			return -1;
-
-		if (git_vector_init(&idx->deltas, (unsigned int)(idx->nr_objects / 2), NULL) < 0)
-			return -1;
-
 		stats->received_objects = 0;
 		stats->indexed_objects = 0;
 		stats->total_objects = (unsigned int)idx->nr_objects;
@@ -390,10 +484,10 @@ int git_indexer_stream_add(git_indexer_stream *idx, const void *data, size_t siz
 		if (error < 0)
 			return -1;
 
-		if (hash_and_save(idx, &obj, entry_start) < 0)
-			goto on_error;
-
+		error = hash_and_save(NULL, idx, &obj, entry_start, idx->off);
 		git__free(obj.data);
+		if (error < 0)
+			goto on_error;
 
 		stats->indexed_objects = (unsigned int)++processed;
 		stats->received_objects++;
@@ -429,36 +523,487 @@ static int index_path_stream(git_buf *path, git_indexer_stream *idx, const char
 	return git_buf_oom(path) ? -1 : 0;
 }
 
-static int resolve_deltas(git_indexer_stream *idx, git_transfer_progress *stats)
+/* Inflate the delta at `offset`, leaving `end` where its entry ends */
+static int read_delta(git_rawobj *delta, git_off_t *end, git_indexer_stream *idx, git_off_t offset)
 {
-	unsigned int i;
-	struct delta_info *delta;
+	git_mwindow *w = NULL;
+	git_off_t curpos = offset;
+	size_t size;
+	git_otype type;
 
-	git_vector_foreach(&idx->deltas, i, delta) {
-		git_rawobj obj;
+	if (git_packfile_unpack_header(&size, &type, &idx->pack->mwf, &w, &curpos) < 0)
+		return -1;
+	git_mwindow_close(&w);
 
-		idx->off = delta->delta_off;
-		if (git_packfile_unpack(&obj, idx->pack, &idx->off) < 0)
+	if (type == GIT_OBJ_OFS_DELTA) {
+		if (get_delta_base(idx->pack, &w, &curpos, type, offset) <= 0) {
+			git_mwindow_close(&w);
+			giterr_set(GITERR_INDEXER, "Indexing error: invalid delta offset");
 			return -1;
+		}
+		git_mwindow_close(&w);
+	} else {
+		curpos += GIT_OID_RAWSZ;
+	}
+
+	if (packfile_unpack_compressed(delta, idx->pack, &w, &curpos, size, type) < 0)
+		return -1;
+
+	*end = curpos;
+	return 0;
+}
 
-		if (hash_and_save(idx, &obj, delta->delta_off) < 0)
+static int apply_delta(
+	git_rawobj *out,
+	git_off_t *end,
+	git_indexer_stream *idx,
+	const git_rawobj *base,
+	git_off_t offset)
+{
+	git_rawobj delta;
+	int error;
+
+	if (read_delta(&delta, end, idx, offset) < 0)
+		return -1;
+
+	error = git__delta_apply(out, base->data, base->len, delta.data, delta.len);
+	git__free(delta.data);
+
+	out->type = base->type;
+	return error;
+}
+
+/* Bring the `n`-th base of the chain being resolved back into memory */
+static int load_base(git_indexer_stream *idx, size_t n)
+{
+	struct delta_base *base = &idx->bases[n];
+	git_off_t end = base->offset;
+
+	if (base->obj.data != NULL)
+		return 0;
+
+	/* the bottom of a chain is never a delta */
+	if (n == 0) {
+		if (git_packfile_unpack(&base->obj, idx->pack, &end) < 0)
 			return -1;
+	} else {
+		if (load_base(idx, n - 1) < 0 ||
+			apply_delta(&base->obj, &end, idx, &idx->bases[n - 1].obj, base->offset) < 0)
+			return -1;
+	}
+
+	idx->bases_size += base->obj.len;
+	return 0;
+}
+
+static void drop_base(git_indexer_stream *idx, struct delta_base *base)
+{
+	if (base->obj.data == NULL)
+		return;
+
+	idx->bases_size -= base->obj.len;
+	git__free(base->obj.data);
+	base->obj.data = NULL;
+}
+
+/*
+ * Stay within the base cache limit, dropping the bases farthest from
+ * the top of the chain first; they are inflated again if needed.
+ */
+static void trim_bases(git_indexer_stream *idx, size_t depth)
+{
+	size_t i;
+
+	for (i = 0; i + 1 < depth && idx->bases_size > git_indexer__base_cache_limit; ++i)
+		drop_base(idx, &idx->bases[i]);
+}
+
+/* Find the deltas on `base`, whose object is named `oid` */
+static void find_children(struct delta_base *base, git_indexer_stream *idx, const git_oid *oid)
+{
+	size_t lo, hi, mid;
+
+	lo = 0, hi = idx->ofs_deltas_nr;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (idx->ofs_deltas[mid].base_offset < base->offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	base->ofs_next = base->ofs_end = lo;
+	while (base->ofs_end < idx->ofs_deltas_nr &&
+		idx->ofs_deltas[base->ofs_end].base_offset == base->offset)
+		base->ofs_end++;
+
+	lo = 0, hi = idx->ref_deltas_nr;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (git_oid_cmp(&idx->ref_deltas[mid].base_oid, oid) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	base->ref_next = base->ref_end = lo;
+	while (base->ref_end < idx->ref_deltas_nr &&
+		git_oid_equal(&idx->ref_deltas[base->ref_end].base_oid, oid))
+		base->ref_end++;
+}
+
+/*
+ * Put the object at `offset` on top of the chain being resolved if
+ * there are deltas on it.  Takes over the data of `obj`, if given.
+ */
+static int push_base(
+	git_indexer_stream *idx,
+	size_t *depth,
+	git_off_t offset,
+	const git_oid *oid,
+	git_rawobj *obj)
+{
+	struct delta_base *base;
+
+	if (grow_array((void **)&idx->bases, &idx->bases_alloc,
+			*depth, sizeof(struct delta_base)) < 0) {
+		if (obj)
+			git__free(obj->data);
+		return -1;
+	}
+
+	base = &idx->bases[*depth];
+	memset(base, 0x0, sizeof(struct delta_base));
+	base->offset = offset;
+	find_children(base, idx, oid);
+
+	if (base->ofs_next == base->ofs_end && base->ref_next == base->ref_end) {
+		if (obj)
+			git__free(obj->data);
+		return 0;
+	}
+
+	if (obj) {
+		base->obj = *obj;
+		idx->bases_size += obj->len;
+	}
+
+	(*depth)++;
+	trim_bases(idx, *depth);
+	return 0;
+}
+
+/*
+ * Resolve the deltas on the object at `offset`, then those on the
+ * objects they make, depth first, so that each base is inflated once
+ * while the cache has room for it.
+ */
+static int resolve_children(
+	git_indexer_stream *idx,
+	git_off_t offset,
+	const git_oid *oid,
+	git_transfer_progress *stats)
+{
+	size_t depth = 0;
+	int error;
+
+	if ((error = push_base(idx, &depth, offset, oid, NULL)) < 0)
+		return error;
+
+	while (depth > 0) {
+		struct delta_base *base = &idx->bases[depth - 1];
+		git_off_t child, end;
+		git_oid child_oid;
+		git_rawobj obj;
+
+		if (base->ofs_next < base->ofs_end) {
+			child = idx->ofs_deltas[base->ofs_next++].offset;
+		} else if (base->ref_next < base->ref_end) {
+			struct ref_delta *delta = &idx->ref_deltas[base->ref_next++];
+
+			/* the pack may hold its base twice */
+			if (delta->resolved)
+				continue;
+
+			delta->resolved = 1;
+			child = delta->offset;
+		} else {
+			drop_base(idx, base);
+			depth--;
+			continue;
+		}
+
+		if ((error = load_base(idx, depth - 1)) < 0 ||
+			(error = apply_delta(&obj, &end, idx, &base->obj, child)) < 0)
+			break;
+
+		if ((error = hash_and_save(&child_oid, idx, &obj, child, end)) < 0) {
+			git__free(obj.data);
+			break;
+		}
 
-		git__free(obj.data);
 		stats->indexed_objects++;
 		do_progress_callback(idx, stats);
+
+		if ((error = push_base(idx, &depth, child, &child_oid, &obj)) < 0)
+			break;
+	}
+
+	while (depth > 0)
+		drop_base(idx, &idx->bases[--depth]);
+
+	return error;
+}
+
+/* Resolve the deltas, starting from each object that is not one */
+static int resolve_deltas(git_indexer_stream *idx, git_transfer_progress *stats)
+{
+	size_t i, nr_bases = idx->objects_nr;
+
+	qsort(idx->ofs_deltas, idx->ofs_deltas_nr, sizeof(struct ofs_delta), ofs_delta_cmp);
+	qsort(idx->ref_deltas, idx->ref_deltas_nr, sizeof(struct ref_delta), ref_delta_cmp);
+
+	for (i = 0; i < nr_bases; ++i) {
+		/* the objects may move as the resolved ones are added */
+		git_off_t offset = idx->objects[i].offset;
+		git_oid oid;
+
+		git_oid_cpy(&oid, &idx->objects[i].oid);
+		if (resolve_children(idx, offset, &oid, stats) < 0)
+			return -1;
 	}
 
 	return 0;
 }
 
+static int write_pack_at(git_indexer_stream *idx, git_off_t offset, const void *data, size_t len)
+{
+	if (p_lseek(idx->pack_file.fd, offset, SEEK_SET) < 0 ||
+		p_write(idx->pack_file.fd, data, len) < 0) {
+		giterr_set(GITERR_OS, "Failed to write to packfile");
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Append the object `id` from the object database to the pack, in
+ * place of the trailer, and index it and the deltas on it.  Returns
+ * GIT_ENOTFOUND if the object database does not have it.
+ */
+static int append_base(
+	git_off_t *end, git_indexer_stream *idx, const git_oid *id, git_transfer_progress *stats)
+{
+	static const char trailer[GIT_OID_RAWSZ] = {0};
+	git_odb_object *obj = NULL;
+	git_buf buf = GIT_BUF_INIT;
+	git_rawobj raw;
+	git_oid oid;
+	unsigned char hdr[10];
+	git_off_t entry_start = *end;
+	int hdr_len, error;
+
+	if ((error = git_odb_read(&obj, idx->odb, id)) < 0)
+		return error;
+
+	error = -1;
+
+	hdr_len = git_packfile__object_header(
+		hdr, (unsigned long)git_odb_object_size(obj), git_odb_object_type(obj));
+
+	if (git_buf_put(&buf, (char *)hdr, hdr_len) < 0 ||
+		git__compress(&buf, git_odb_object_data(obj), git_odb_object_size(obj)) < 0)
+		goto cleanup;
+
+	/* keep room for the trailer, which the pack windows count on */
+	if (write_pack_at(idx, entry_start, buf.ptr, buf.size) < 0 ||
+		write_pack_at(idx, entry_start + buf.size, trailer, GIT_OID_RAWSZ) < 0)
+		goto cleanup;
+
+	*end = entry_start + buf.size;
+
+	git_mwindow_free_all(&idx->pack->mwf);
+	idx->pack->mwf.size = *end + GIT_OID_RAWSZ;
+
+	raw.data = (void *)git_odb_object_data(obj);
+	raw.len = git_odb_object_size(obj);
+	raw.type = git_odb_object_type(obj);
+
+	if (hash_and_save(&oid, idx, &raw, entry_start, *end) < 0)
+		goto cleanup;
+
+	idx->nr_objects++;
+	stats->total_objects++;
+	stats->indexed_objects++;
+	do_progress_callback(idx, stats);
+
+	error = resolve_children(idx, entry_start, &oid, stats);
+
+cleanup:
+	git_odb_object_free(obj);
+	git_buf_free(&buf);
+	return error;
+}
+
+/* Give the pack its new object count and checksum */
+static int update_pack_trailer(git_indexer_stream *idx, git_off_t end)
+{
+	git_hash_ctx ctx;
+	git_oid checksum;
+	uint32_t nr_objects = htonl((uint32_t)idx->nr_objects);
+	char buf[8192];
+	git_off_t pos = 0;
+	ssize_t read_bytes;
+	int error = -1;
+
+	if (write_pack_at(idx, offsetof(struct git_pack_header, hdr_entries),
+			&nr_objects, sizeof(nr_objects)) < 0)
+		return -1;
+
+	if (git_hash_ctx_init(&ctx) < 0)
+		return -1;
+
+	if (p_lseek(idx->pack->mwf.fd, 0, SEEK_SET) < 0)
+		goto on_error;
+
+	while (pos < end) {
+		size_t want = (size_t)min(end - pos, (git_off_t)sizeof(buf));
+
+		if ((read_bytes = p_read(idx->pack->mwf.fd, buf, want)) <= 0)
+			goto on_error;
+
+		git_hash_update(&ctx, buf, (size_t)read_bytes);
+		pos += read_bytes;
+	}
+
+	git_hash_final(&checksum, &ctx);
+	git_mwindow_free_all(&idx->pack->mwf);
+	error = write_pack_at(idx, end, checksum.id, GIT_OID_RAWSZ);
+
+on_error:
+	if (error < 0 && !giterr_last())
+		giterr_set(GITERR_OS, "Failed to read back the packfile");
+	git_hash_ctx_cleanup(&ctx);
+	return error;
+}
+
+/*
+ * A thin pack leaves out the bases of some of its deltas, which the
+ * receiver already has.  Append those to the pack so it stands on its
+ * own, and resolve the deltas on them.
+ */
+static int fix_thin_pack(git_indexer_stream *idx, git_transfer_progress *stats)
+{
+	git_off_t end = idx->pack->mwf.size - GIT_OID_RAWSZ;
+	size_t i;
+	int error;
+
+	if (idx->odb == NULL)
+		goto missing;
+
+	for (i = 0; i < idx->ref_deltas_nr; ++i) {
+		git_oid base;
+
+		/* appending a base resolves all the deltas on it */
+		if (idx->ref_deltas[i].resolved)
+			continue;
+
+		/*
+		 * The base may be a delta in the pack whose own chain ends
+		 * on a missing object; appending that one resolves it.
+		 */
+		git_oid_cpy(&base, &idx->ref_deltas[i].base_oid);
+		if ((error = append_base(&end, idx, &base, stats)) == GIT_ENOTFOUND)
+			giterr_clear();
+		else if (error < 0)
+			return error;
+	}
+
+	if (stats->indexed_objects < stats->total_objects)
+		goto missing;
+
+	return update_pack_trailer(idx, end);
+
+missing:
+	giterr_set(GITERR_INDEXER,
+		"Indexing error: the bases of some deltas are missing from the pack");
+	return -1;
+}
+
+struct revindex_entry {
+	git_off_t offset;
+	uint32_t pos;
+};
+
+static int revindex_entry_cmp(const void *a, const void *b)
+{
+	const struct revindex_entry *entrya = a;
+	const struct revindex_entry *entryb = b;
+
+	return entrya->offset < entryb->offset ? -1 : entrya->offset > entryb->offset;
+}
+
+/* Write the .rev file, with the positions of the sorted objects in pack order */
+static int write_reverse_index(git_indexer_stream *idx, const git_oid *pack_hash)
+{
+	git_filebuf rev_file = GIT_FILEBUF_INIT;
+	git_buf path = GIT_BUF_INIT;
+	struct git_pack_rev_header hdr;
+	struct revindex_entry *entries;
+	git_oid file_hash;
+	size_t i;
+	int error = -1;
+
+	entries = git__malloc((idx->objects_nr ? idx->objects_nr : 1) * sizeof(struct revindex_entry));
+	GITERR_CHECK_ALLOC(entries);
+
+	for (i = 0; i < idx->objects_nr; ++i) {
+		entries[i].offset = idx->objects[i].offset;
+		entries[i].pos = (uint32_t)i;
+	}
+
+	qsort(entries, idx->objects_nr, sizeof(struct revindex_entry), revindex_entry_cmp);
+
+	if (git_buf_sets(&path, idx->pack->pack_name) < 0 ||
+		index_path_stream(&path, idx, ".rev") < 0 ||
+		git_filebuf_open(&rev_file, path.ptr, GIT_FILEBUF_HASH_CONTENTS) < 0)
+		goto cleanup;
+
+	hdr.rev_signature = htonl(PACK_REV_SIGNATURE);
+	hdr.rev_version = htonl(PACK_REV_VERSION);
+	hdr.rev_hash_id = htonl(PACK_REV_HASH_SHA1);
+	git_filebuf_write(&rev_file, &hdr, sizeof(hdr));
+
+	for (i = 0; i < idx->objects_nr; ++i) {
+		uint32_t n = htonl(entries[i].pos);
+		git_filebuf_write(&rev_file, &n, sizeof(n));
+	}
+
+	git_filebuf_write(&rev_file, pack_hash, sizeof(git_oid));
+
+	if (git_filebuf_hash(&file_hash, &rev_file) < 0)
+		goto cleanup;
+
+	git_filebuf_write(&rev_file, &file_hash, sizeof(git_oid));
+
+	error = git_filebuf_commit(&rev_file, GIT_PACK_FILE_MODE);
+
+cleanup:
+	git_filebuf_cleanup(&rev_file);
+	git__free(entries);
+	git_buf_free(&path);
+	return error;
+}
+
 int git_indexer_stream_finalize(git_indexer_stream *idx, git_transfer_progress *stats)
 {
 	git_mwindow *w = NULL;
-	unsigned int i, long_offsets = 0, left;
+	unsigned int long_offsets = 0, left;
+	size_t i;
 	struct git_pack_idx_header hdr;
 	git_buf filename = GIT_BUF_INIT;
-	struct entry *entry;
+	struct object_entry *entry;
 	void *packfile_hash;
 	git_oid file_hash;
 	git_hash_ctx ctx;
@@ -472,16 +1017,23 @@ int git_indexer_stream_finalize(git_indexer_stream *idx, git_transfer_progress *
 		return -1;
 	}
 
-	if (idx->deltas.length > 0)
+	if (idx->ofs_deltas_nr + idx->ref_deltas_nr > 0)
 		if (resolve_deltas(idx, stats) < 0)
 			return -1;
 
+	/* all of it came in, yet some deltas are on bases it left out */
+	if (stats->indexed_objects < stats->total_objects &&
+		stats->received_objects == stats->total_objects &&
+		fix_thin_pack(idx, stats) < 0)
+		return -1;
+
 	if (stats->indexed_objects != stats->total_objects) {
 		giterr_set(GITERR_INDEXER, "Indexing error: early EOF");
 		return -1;
 	}
 
-	git_vector_sort(&idx->objects);
+	if (idx->objects_nr > 0)
+		qsort(idx->objects, idx->objects_nr, sizeof(struct object_entry), object_entry_cmp);
 
 	git_buf_sets(&filename, idx->pack->pack_name);
 	git_buf_truncate(&filename, filename.size - strlen("pack"));
@@ -504,38 +1056,42 @@ int git_indexer_stream_finalize(git_indexer_stream *idx, git_transfer_progress *
 	}
 
 	/* Write out the object names (SHA-1 hashes) */
-	git_vector_foreach(&idx->objects, i, entry) {
+	for (i = 0; i < idx->objects_nr; ++i) {
+		entry = &idx->objects[i];
 		git_filebuf_write(&idx->index_file, &entry->oid, sizeof(git_oid));
 		git_hash_update(&ctx, &entry->oid, GIT_OID_RAWSZ);
 	}
 	git_hash_final(&idx->hash, &ctx);
 
 	/* Write out the CRC32 values */
-	git_vector_foreach(&idx->objects, i, entry) {
+	for (i = 0; i < idx->objects_nr; ++i) {
+		entry = &idx->objects[i];
 		git_filebuf_write(&idx->index_file, &entry->crc, sizeof(uint32_t));
 	}
 
 	/* Write out the offsets */
-	git_vector_foreach(&idx->objects, i, entry) {
+	for (i = 0; i < idx->objects_nr; ++i) {
 		uint32_t n;
 
-		if (entry->offset == UINT32_MAX)
+		entry = &idx->objects[i];
+		if (entry->offset > UINT31_MAX)
 			n = htonl(0x80000000 | long_offsets++);
 		else
-			n = htonl(entry->offset);
+			n = htonl((uint32_t)entry->offset);
 
 		git_filebuf_write(&idx->index_file, &n, sizeof(uint32_t));
 	}
 
 	/* Write out the long offsets */
-	git_vector_foreach(&idx->objects, i, entry) {
+	for (i = 0; i < idx->objects_nr; ++i) {
 		uint32_t split[2];
 
-		if (entry->offset != UINT32_MAX)
+		entry = &idx->objects[i];
+		if (entry->offset <= UINT31_MAX)
 			continue;
 
-		split[0] = htonl(entry->offset_long >> 32);
-		split[1] = htonl(entry->offset_long & 0xffffffff);
+		split[0] = htonl((uint32_t)((uint64_t)entry->offset >> 32));
+		split[1] = htonl((uint32_t)(entry->offset & 0xffffffff));
 
 		git_filebuf_write(&idx->index_file, &split, sizeof(uint32_t) * 2);
 	}
@@ -552,6 +1108,10 @@ int git_indexer_stream_finalize(git_indexer_stream *idx, git_transfer_progress *
 
 	git_filebuf_write(&idx->index_file, &file_hash, sizeof(git_oid));
 
+	/* Readers find the pack by its index, so write the reverse index first */
+	if (write_reverse_index(idx, &file_hash) < 0)
+		goto on_error;
+
 	/* Write out the packfile trailer to the idx file as well */
 	if (git_filebuf_hash(&file_hash, &idx->index_file) < 0)
 		goto on_error;
@@ -568,6 +1128,7 @@ int git_indexer_stream_finalize(git_indexer_stream *idx, git_transfer_progress *
 
 	git_mwindow_free_all(&idx->pack->mwf);
 	p_close(idx->pack->mwf.fd);
+	idx->pack->mwf.fd = -1;
 
 	if (index_path_stream(&filename, idx, ".pack") < 0)
 		goto on_error;
@@ -581,6 +1142,7 @@ int git_indexer_stream_finalize(git_indexer_stream *idx, git_transfer_progress *
 on_error:
 	git_mwindow_free_all(&idx->pack->mwf);
 	p_close(idx->pack->mwf.fd);
+	idx->pack->mwf.fd = -1;
 	git_filebuf_cleanup(&idx->index_file);
 	git_buf_free(&filename);
 	git_hash_ctx_cleanup(&ctx);
@@ -589,26 +1151,23 @@ on_error:
 
 void git_indexer_stream_free(git_indexer_stream *idx)
 {
-	unsigned int i;
-	struct entry *e;
-	struct git_pack_entry *pe;
-	struct delta_info *delta;
-
 	if (idx == NULL)
 		return;
 
-	git_vector_foreach(&idx->objects, i, e)
-		git__free(e);
-	git_vector_free(&idx->objects);
+	git__free(idx->objects);
 	if (idx->pack) {
-		git_vector_foreach(&idx->pack->cache, i, pe)
-			git__free(pe);
-		git_vector_free(&idx->pack->cache);
+		/* still open if the pack was never finalized */
+		git_mwindow_free_all(&idx->pack->mwf);
+		if (idx->pack->mwf.fd >= 0)
+			p_close(idx->pack->mwf.fd);
+
+		git_mutex_free(&idx->pack->lock);
 	}
-	git_vector_foreach(&idx->deltas, i, delta)
-		git__free(delta);
-	git_vector_free(&idx->deltas);
+	git__free(idx->ofs_deltas);
+	git__free(idx->ref_deltas);
+	git__free(idx->bases);
 	git__free(idx->pack);
+	git_filebuf_cleanup(&idx->pack_file);
 	git__free(idx);
 }
 
@@ -920,6 +1479,7 @@ void git_indexer_free(git_indexer *idx)
 	git_vector_foreach(&idx->pack->cache, i, pe)
 		git__free(pe);
 	git_vector_free(&idx->pack->cache);
+	git_mutex_free(&idx->pack->lock);
 	git__free(idx->pack);
 	git__free(idx);
 }
@@ -5,10 +5,13 @@
  * a Linking Exception. For full terms see the included COPYING file.
  */
 
+#define GIT_ALLOC_SUBSYSTEM GIT_ALLOC_DIFF
+
 #include "iterator.h"
 #include "tree.h"
 #include "ignore.h"
 #include "buffer.h"
+#include "scratch.h"
 #include "git2/submodule.h"
 
 #define ITERATOR_BASE_INIT(P,NAME_LC,NAME_UC) do { \
@@ -435,9 +438,13 @@ struct workdir_iterator_frame {
 	workdir_iterator_frame *next;
 	git_vector entries;
 	unsigned int index;
+	unsigned int depth;
+	unsigned int prefetch_next;
 	char *start;
 };
 
+typedef struct workdir_prefetch workdir_prefetch;
+
 typedef struct {
 	git_iterator base;
 	git_repository *repo;
@@ -447,6 +454,8 @@ typedef struct {
 	git_index_entry entry;
 	git_buf path;
 	int is_ignored;
+	bool defer_stat;
+	workdir_prefetch *prefetch;
 } workdir_iterator;
 
 static int git_path_with_stat_cmp_case(const void *a, const void *b)
@@ -492,6 +501,368 @@ static void workdir_iterator__free_frame(workdir_iterator_frame *wf)
 
 static int workdir_iterator__update_entry(workdir_iterator *wi);
 
+static bool workdir_iterator__is_dot_git(
+	workdir_iterator *wi, const git_path_with_stat *ps)
+{
+	return (STRCMP_CASESELECT(wi->base.ignore_case, ps->path, DOT_GIT "/") == 0 ||
+		STRCMP_CASESELECT(wi->base.ignore_case, ps->path, DOT_GIT) == 0);
+}
+
+#ifdef GIT_THREADS
+
+/*
+ * Directory prefetching
+ *
+ * Worker threads load (readdir, lstat and sort) the subdirectories of the
+ * directory at the top of the iterator's stack, in the order the iterator
+ * will reach them, so that on slow filesystems the iterator seldom waits
+ * on the disk. Only `lookahead` directories are loaded ahead at a time,
+ * deeper ones first, and ignored directories and submodules are never
+ * loaded. The iterator still expands a directory itself when it was not
+ * prefetched, and it drops the results it walks past without using.
+ */
+
+enum {
+	PREFETCH_PENDING = 0,
+	PREFETCH_RUNNING,
+	PREFETCH_DONE,
+};
+
+typedef struct {
+	workdir_iterator_frame *frame;
+	unsigned int index;
+	unsigned int depth;
+	int state;
+	int error;
+	bool cancelled;
+	git_vector entries;
+	char path[GIT_FLEX_ARRAY];
+} workdir_prefetch_job;
+
+struct workdir_prefetch {
+	git_mutex lock;
+	git_cond work; /* a job was queued, or the workers should stop */
+	git_cond done; /* a job finished */
+	git_vector jobs;
+	git_thread *threads;
+	unsigned int nthreads;
+	size_t root_len;
+	size_t lookahead;
+	bool shutdown;
+};
+
+static void prefetch_job_free(workdir_prefetch_job *job)
+{
+	unsigned int i;
+	git_path_with_stat *ps;
+
+	git_vector_foreach(&job->entries, i, ps)
+		git__free(ps);
+	git_vector_free(&job->entries);
+	git__free(job);
+}
+
+/* pick the first pending job of the deepest directory; lock held */
+static workdir_prefetch_job *prefetch_next_job(workdir_prefetch *pf)
+{
+	workdir_prefetch_job *job, *best = NULL;
+	unsigned int i;
+
+	git_vector_foreach(&pf->jobs, i, job) {
+		if (job->state == PREFETCH_PENDING && (!best || job->depth > best->depth))
+			best = job;
+	}
+
+	return best;
+}
+
+static void *prefetch_worker(void *payload)
+{
+	workdir_prefetch *pf = payload;
+	workdir_prefetch_job *job;
+
+	git_mutex_lock(&pf->lock);
+
+	while (!pf->shutdown) {
+		if ((job = prefetch_next_job(pf)) == NULL) {
+			git_cond_wait(&pf->work, &pf->lock);
+			continue;
+		}
+
+		job->state = PREFETCH_RUNNING;
+
+		/* the condition may have woken only one worker for many jobs */
+		if (prefetch_next_job(pf) != NULL)
+			git_cond_signal(&pf->work);
+
+		git_mutex_unlock(&pf->lock);
+
+		job->error = git_path_dirload_with_stat(
+			job->path, pf->root_len, 0, &job->entries);
+		if (!job->error)
+			git_vector_sort(&job->entries);
+
+		git_mutex_lock(&pf->lock);
+
+		if (job->cancelled)
+			prefetch_job_free(job);
+		else {
+			job->state = PREFETCH_DONE;
+			git_cond_signal(&pf->done);
+		}
+	}
+
+	/* pass the wake up on to the next worker */
+	git_cond_signal(&pf->work);
+	git_mutex_unlock(&pf->lock);
+
+	return NULL;
+}
+
+/* drop the jobs of `wf`, or those it moved past; lock held */
+static void prefetch_drop_jobs(
+	workdir_prefetch *pf, workdir_iterator_frame *wf, bool whole_frame)
+{
+	workdir_prefetch_job *job;
+	unsigned int i = 0;
+
+	while ((job = git_vector_get(&pf->jobs, i)) != NULL) {
+		if (job->frame != wf || (!whole_frame && job->index >= wf->index)) {
+			i++;
+			continue;
+		}
+
+		git_vector_remove(&pf->jobs, i);
+
+		if (job->state == PREFETCH_RUNNING)
+			job->cancelled = true; /* the worker frees it */
+		else
+			prefetch_job_free(job);
+	}
+}
+
+static void workdir_prefetch__drop_frame(
+	workdir_iterator *wi, workdir_iterator_frame *wf)
+{
+	if (!wi->prefetch)
+		return;
+
+	git_mutex_lock(&wi->prefetch->lock);
+	prefetch_drop_jobs(wi->prefetch, wf, true);
+	git_mutex_unlock(&wi->prefetch->lock);
+}
+
+static bool prefetch_wanted(workdir_iterator *wi, git_path_with_stat *ps)
+{
+	int ignored = 0, error;
+
+	if (!S_ISDIR(ps->st.st_mode) || workdir_iterator__is_dot_git(wi, ps))
+		return false;
+
+	if (git_ignore__lookup(&wi->ignores, ps->path, &ignored) < 0 || ignored) {
+		giterr_clear();
+		return false;
+	}
+
+	/* submodules are never descended into */
+	if ((error = git_submodule_lookup(NULL, wi->repo, ps->path)) != GIT_ENOTFOUND) {
+		giterr_clear();
+		return false;
+	}
+
+	giterr_clear();
+	return true;
+}
+
+/* queue the next subdirectories of the current directory */
+static void workdir_prefetch__schedule(workdir_iterator *wi)
+{
+	workdir_prefetch *pf = wi->prefetch;
+	workdir_iterator_frame *wf = wi->stack;
+	workdir_prefetch_job *job;
+	git_path_with_stat *ps;
+	size_t queued, path_len;
+
+	if (!pf || !wf)
+		return;
+
+	git_mutex_lock(&pf->lock);
+	prefetch_drop_jobs(pf, wf, false);
+	queued = pf->jobs.length;
+	git_mutex_unlock(&pf->lock);
+
+	if (wf->prefetch_next <= wf->index)
+		wf->prefetch_next = wf->index + 1;
+
+	for (; queued < pf->lookahead &&
+		(ps = git_vector_get(&wf->entries, wf->prefetch_next)) != NULL;
+		wf->prefetch_next++)
+	{
+		if (!prefetch_wanted(wi, ps))
+			continue;
+
+		/* `ps->path_len` does not count the trailing slash of directories */
+		path_len = strlen(ps->path);
+
+		job = git__calloc(1, sizeof(workdir_prefetch_job) + pf->root_len + path_len + 1);
+		if (!job || git_vector_init(&job->entries, 0, wf->entries._cmp) < 0) {
+			git__free(job);
+			giterr_clear(); /* prefetching is only an optimization */
+			return;
+		}
+
+		job->frame = wf;
+		job->index = wf->prefetch_next;
+		job->depth = wf->depth + 1;
+		memcpy(job->path, wi->path.ptr, pf->root_len);
+		memcpy(job->path + pf->root_len, ps->path, path_len + 1);
+
+		git_mutex_lock(&pf->lock);
+		if (git_vector_insert(&pf->jobs, job) < 0) {
+			git_mutex_unlock(&pf->lock);
+			prefetch_job_free(job);
+			giterr_clear();
+			return;
+		}
+		git_cond_signal(&pf->work);
+		git_mutex_unlock(&pf->lock);
+
+		queued++;
+	}
+}
+
+/*
+ * Move the prefetched entries of the current directory into `wf`;
+ * returns GIT_ENOTFOUND when the directory was not prefetched
+ */
+static int workdir_prefetch__take(workdir_iterator *wi, workdir_iterator_frame *wf)
+{
+	workdir_prefetch *pf = wi->prefetch;
+	workdir_prefetch_job *job = NULL;
+	unsigned int i;
+	int error = GIT_ENOTFOUND;
+
+	if (!pf || !wi->stack)
+		return GIT_ENOTFOUND;
+
+	git_mutex_lock(&pf->lock);
+
+	git_vector_foreach(&pf->jobs, i, job) {
+		if (job->frame == wi->stack && job->index == wi->stack->index)
+			break;
+	}
+
+	if (i < pf->jobs.length) {
+		/* rather than waiting on the queue, load it right away */
+		if (job->state == PREFETCH_PENDING) {
+			git_vector_remove(&pf->jobs, i);
+			prefetch_job_free(job);
+			goto done;
+		}
+
+		while (job->state != PREFETCH_DONE)
+			git_cond_wait(&pf->done, &pf->lock);
+
+		/* only this thread changes the job list, so `i` is still valid */
+		git_vector_remove(&pf->jobs, i);
+
+		git_vector_swap(&wf->entries, &job->entries);
+		error = job->error;
+		prefetch_job_free(job);
+	}
+
+done:
+	git_mutex_unlock(&pf->lock);
+	return error;
+}
+
+static void workdir_prefetch__free(workdir_prefetch *pf)
+{
+	workdir_prefetch_job *job;
+	unsigned int i;
+
+	if (!pf)
+		return;
+
+	git_mutex_lock(&pf->lock);
+	pf->shutdown = true;
+	git_cond_signal(&pf->work);
+	git_mutex_unlock(&pf->lock);
+
+	for (i = 0; i < pf->nthreads; ++i)
+		git_thread_join(pf->threads[i], NULL);
+
+	git_vector_foreach(&pf->jobs, i, job)
+		prefetch_job_free(job);
+	git_vector_free(&pf->jobs);
+
+	git_cond_free(&pf->work);
+	git_cond_free(&pf->done);
+	git_mutex_free(&pf->lock);
+	git__free(pf->threads);
+	git__free(pf);
+}
+
+int git_iterator_workdir_prefetch(git_iterator *iter, unsigned int nthreads)
+{
+	workdir_iterator *wi = (workdir_iterator *)iter;
+	workdir_prefetch *pf;
+
+	if (iter->type != GIT_ITERATOR_WORKDIR || wi->prefetch)
+		return 0;
+
+	if (!nthreads)
+		nthreads = (unsigned int)git_online_cpus();
+	if (nthreads > GIT_ITERATOR_PREFETCH_MAX_THREADS)
+		nthreads = GIT_ITERATOR_PREFETCH_MAX_THREADS;
+
+	pf = git__calloc(1, sizeof(workdir_prefetch));
+	GITERR_CHECK_ALLOC(pf);
+
+	pf->threads = git__calloc(nthreads, sizeof(git_thread));
+	if (!pf->threads || git_vector_init(&pf->jobs, 0, NULL) < 0) {
+		git__free(pf->threads);
+		git__free(pf);
+		return -1;
+	}
+
+	pf->root_len = wi->root_len;
+	pf->lookahead = nthreads * 4;
+
+	git_mutex_init(&pf->lock);
+	git_cond_init(&pf->work);
+	git_cond_init(&pf->done);
+
+	for (; pf->nthreads < nthreads; pf->nthreads++) {
+		if (git_thread_create(&pf->threads[pf->nthreads], NULL, prefetch_worker, pf) != 0) {
+			giterr_set(GITERR_THREAD, "Unable to create directory prefetch thread");
+			workdir_prefetch__free(pf);
+			return -1;
+		}
+	}
+
+	wi->prefetch = pf;
+	workdir_prefetch__schedule(wi);
+
+	return 0;
+}
+
+#else
+
+#define workdir_prefetch__schedule(wi) (void)0
+#define workdir_prefetch__drop_frame(wi, wf) (void)0
+#define workdir_prefetch__take(wi, wf) GIT_ENOTFOUND
+#define workdir_prefetch__free(pf) (void)0
+
+int git_iterator_workdir_prefetch(git_iterator *iter, unsigned int nthreads)
+{
+	GIT_UNUSED(iter);
+	GIT_UNUSED(nthreads);
+	return 0;
+}
+
+#endif
+
 static int workdir_iterator__entry_cmp_case(const void *prefix, const void *item)
 {
 	const git_path_with_stat *ps = item;
@@ -510,13 +881,19 @@ static int workdir_iterator__expand_dir(workdir_iterator *wi)
 	workdir_iterator_frame *wf = workdir_iterator__alloc_frame(wi);
 	GITERR_CHECK_ALLOC(wf);
 
-	error = git_path_dirload_with_stat(wi->path.ptr, wi->root_len, &wf->entries);
+	if ((error = workdir_prefetch__take(wi, wf)) == GIT_ENOTFOUND) {
+		error = git_path_dirload_with_stat(
+			wi->path.ptr, wi->root_len, GIT_PATH_DIRLOAD_DEFER_STAT, &wf->entries);
+		git_vector_sort(&wf->entries);
+	}
+
 	if (error < 0 || wf->entries.length == 0) {
 		workdir_iterator__free_frame(wf);
 		return GIT_ENOTFOUND;
 	}
 
-	git_vector_sort(&wf->entries);
+	if (wi->stack)
+		wf->depth = wi->stack->depth + 1;
 
 	if (!wi->stack)
 		wf->start = wi->base.start;
@@ -540,6 +917,8 @@ static int workdir_iterator__expand_dir(workdir_iterator *wi)
 		(void)git_ignore__push_dir(&wi->ignores, &wi->path.ptr[slash_pos + 1]);
 	}
 
+	workdir_prefetch__schedule(wi);
+
 	return workdir_iterator__update_entry(wi);
 }
 
@@ -574,14 +953,14 @@ static int workdir_iterator__advance(
 		next = git_vector_get(&wf->entries, ++wf->index);
 		if (next != NULL) {
 			/* match git's behavior of ignoring anything named ".git" */
-			if (STRCMP_CASESELECT(wi->base.ignore_case, next->path, DOT_GIT "/") == 0 ||
-				STRCMP_CASESELECT(wi->base.ignore_case, next->path, DOT_GIT) == 0)
+			if (workdir_iterator__is_dot_git(wi, next))
 				continue;
 			/* else found a good entry */
 			break;
 		}
 
 		/* pop workdir directory stack */
+		workdir_prefetch__drop_frame(wi, wf);
 		wi->stack = wf->next;
 		workdir_iterator__free_frame(wf);
 		git_ignore__pop_dir(&wi->ignores);
@@ -592,6 +971,8 @@ static int workdir_iterator__advance(
 		}
 	}
 
+	workdir_prefetch__schedule(wi);
+
 	error = workdir_iterator__update_entry(wi);
 
 	if (!error && entry != NULL)
@@ -615,12 +996,17 @@ static int workdir_iterator__reset(git_iterator *self)
 	workdir_iterator *wi = (workdir_iterator *)self;
 	while (wi->stack != NULL && wi->stack->next != NULL) {
 		workdir_iterator_frame *wf = wi->stack;
+		workdir_prefetch__drop_frame(wi, wf);
 		wi->stack = wf->next;
 		workdir_iterator__free_frame(wf);
 		git_ignore__pop_dir(&wi->ignores);
 	}
-	if (wi->stack)
+	if (wi->stack) {
+		workdir_prefetch__drop_frame(wi, wi->stack);
 		wi->stack->index = 0;
+		wi->stack->prefetch_next = 0;
+		workdir_prefetch__schedule(wi);
+	}
 	return 0;
 }
 
@@ -628,6 +1014,10 @@ static void workdir_iterator__free(git_iterator *self)
 {
 	workdir_iterator *wi = (workdir_iterator *)self;
 
+	/* stop the workers before the frames their jobs point to go away */
+	workdir_prefetch__free(wi->prefetch);
+	wi->prefetch = NULL;
+
 	while (wi->stack != NULL) {
 		workdir_iterator_frame *wf = wi->stack;
 		wi->stack = wf->next;
@@ -635,7 +1025,7 @@ static void workdir_iterator__free(git_iterator *self)
 	}
 
 	git_ignore__free(&wi->ignores);
-	git_buf_free(&wi->path);
+	git_scratch__release(&wi->path);
 }
 
 static int workdir_iterator__update_entry(workdir_iterator *wi)
@@ -658,12 +1048,24 @@ static int workdir_iterator__update_entry(workdir_iterator *wi)
 	wi->entry.path = ps->path;
 
 	/* skip over .git entries */
-	if (STRCMP_CASESELECT(wi->base.ignore_case, ps->path, DOT_GIT "/") == 0 ||
-		STRCMP_CASESELECT(wi->base.ignore_case, ps->path, DOT_GIT) == 0)
+	if (workdir_iterator__is_dot_git(wi, ps))
 		return workdir_iterator__advance((git_iterator *)wi, NULL);
 
 	wi->is_ignored = -1;
 
+	/* directories only ever need their type */
+	if (!wi->defer_stat && !S_ISDIR(ps->st.st_mode)) {
+		int error = git_path_with_stat_load(ps, wi->path.ptr);
+
+		/* skip entries removed since the directory was read */
+		if (error == GIT_ENOTFOUND) {
+			giterr_clear();
+			return workdir_iterator__advance((git_iterator *)wi, NULL);
+		}
+		if (error < 0)
+			return error;
+	}
+
 	git_index_entry__init_from_stat(&wi->entry, &ps->st);
 
 	/* need different mode here to keep directories during iteration */
@@ -721,10 +1123,14 @@ int git_iterator_for_workdir_range(
 	/* Match ignore_case flag for iterator to that of the index */
 	wi->base.ignore_case = index->ignore_case;
 
+	git_buf_init(&wi->path, 0);
+	git_scratch__take(&wi->path);
+
 	if (git_buf_sets(&wi->path, git_repository_workdir(repo)) < 0 ||
 		git_path_to_dir(&wi->path) < 0 ||
 		git_ignore__for_path(repo, "", &wi->ignores) < 0)
 	{
+		git_scratch__release(&wi->path);
 		git__free(wi);
 		return -1;
 	}
@@ -967,6 +1373,37 @@ int git_iterator_cmp(
 	return ITERATOR_PREFIXCMP(*iter, entry->path, path_prefix);
 }
 
+void git_iterator_workdir_defer_stat(git_iterator *iter)
+{
+	if (iter->type == GIT_ITERATOR_WORKDIR)
+		((workdir_iterator *)iter)->defer_stat = true;
+}
+
+int git_iterator_current_load_stat(
+	git_iterator *iter, const git_index_entry **entry)
+{
+	workdir_iterator *wi = (workdir_iterator *)iter;
+	git_path_with_stat *ps;
+	int error;
+
+	if (iter->type == GIT_ITERATOR_WORKDIR && wi->entry.path &&
+		(ps = git_vector_get(&wi->stack->entries, wi->stack->index)) != NULL &&
+		!ps->st_loaded && !S_ISDIR(ps->st.st_mode))
+	{
+		error = git_path_with_stat_load(ps, wi->path.ptr);
+
+		if (error == GIT_ENOTFOUND)
+			giterr_clear();
+		if (error < 0)
+			return error;
+
+		git_index_entry__init_from_stat(&wi->entry, &ps->st);
+		wi->entry.mode = git_futils_canonical_mode(ps->st.st_mode);
+	}
+
+	return git_iterator_current(iter, entry);
+}
+
 int git_iterator_current_workdir_path(git_iterator *iter, git_buf **path)
 {
 	workdir_iterator *wi = (workdir_iterator *)iter;
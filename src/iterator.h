@@ -81,6 +81,17 @@ GIT_INLINE(int) git_iterator_for_workdir(
 	return git_iterator_for_workdir_range(iter, repo, NULL, NULL);
 }
 
+#define GIT_ITERATOR_PREFETCH_MAX_THREADS 16
+
+/**
+ * Load the directories of a workdir iterator ahead of the iteration on
+ * `nthreads` worker threads (0 for one per CPU).  The entries come out
+ * in the same order either way.  This does nothing for other iterator
+ * types or when libgit2 is built without thread support.
+ */
+extern int git_iterator_workdir_prefetch(
+	git_iterator *iter, unsigned int nthreads);
+
 extern int git_iterator_spoolandsort_range(
 	git_iterator **iter, git_iterator *towrap,
 	git_vector_cmp comparer, bool ignore_case,
@@ -180,6 +191,23 @@ extern int git_iterator_advance_into_directory(
 extern int git_iterator_cmp(
 	git_iterator *iter, const char *path_prefix);
 
+/**
+ * Make a workdir iterator leave the stat data of files (size, times,
+ * inode, executable bit) unset until `git_iterator_current_load_stat`
+ * asks for it, so that entries which are only looked at by name and
+ * type never get lstat'ed.
+ */
+extern void git_iterator_workdir_defer_stat(git_iterator *iter);
+
+/**
+ * Return the current entry with its stat data loaded.  Same as
+ * `git_iterator_current` for iterators that do not defer stat.
+ * Returns GIT_ENOTFOUND if the file was removed since its directory
+ * was read; the iterator is left on it for the caller to advance.
+ */
+extern int git_iterator_current_load_stat(
+	git_iterator *iter, const git_index_entry **entry);
+
 /**
  * Get the full path of the current item from a workdir iterator.
  * This will return NULL for a non-workdir iterator.
@@ -0,0 +1,301 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "common.h"
+#include "oidmap.h"
+#include "pqueue.h"
+
+#include "git2/lastcommit.h"
+#include "git2/commit.h"
+#include "git2/tree.h"
+
+GIT__USE_OIDMAP;
+
+/*
+ * A commit of the walk, and the entries it may be the last commit of.
+ * Each entry which is not found yet is with exactly one commit.
+ */
+typedef struct {
+	git_oid id;
+	git_time_t time;
+	size_t *entries; /* positions in the starting directory */
+	size_t count, alloc;
+	bool queued;
+} last_commit;
+
+typedef struct {
+	git_repository *repo;
+	const char *path;
+	git_tree *dir; /* at the starting commit */
+	git_oid *found; /* the commit of each entry */
+	size_t unresolved;
+
+	git_oidmap *commits;
+	git_pqueue queue; /* newest first */
+} last_walk;
+
+static int last_commit_cmp_time(void *a, void *b)
+{
+	return ((last_commit *)a)->time < ((last_commit *)b)->time;
+}
+
+static int last_commit_get(last_commit **out, last_walk *w, git_commit *commit)
+{
+	last_commit *c;
+	git_hashmap_iter pos;
+	int error;
+
+	pos = git_oidmap_lookup_index(w->commits, git_commit_id(commit));
+	if (git_oidmap_valid_index(w->commits, pos)) {
+		*out = git_oidmap_value_at(w->commits, pos);
+		return 0;
+	}
+
+	c = git__calloc(1, sizeof(last_commit));
+	GITERR_CHECK_ALLOC(c);
+
+	git_oid_cpy(&c->id, git_commit_id(commit));
+	c->time = git_commit_time(commit);
+
+	git_oidmap_insert(w->commits, &c->id, c, error);
+	if (error < 0) {
+		git__free(c);
+		return -1;
+	}
+
+	*out = c;
+	return 0;
+}
+
+/* Give the commit an entry to look for, and queue it if needed */
+static int last_commit_add(last_walk *w, last_commit *c, size_t entry)
+{
+	if (c->count == c->alloc) {
+		size_t alloc = c->alloc ? c->alloc * 2 : 8;
+		size_t *entries = git__realloc(c->entries, alloc * sizeof(size_t));
+		GITERR_CHECK_ALLOC(entries);
+
+		c->entries = entries;
+		c->alloc = alloc;
+	}
+
+	c->entries[c->count++] = entry;
+
+	if (!c->queued) {
+		if (git_pqueue_insert(&w->queue, c) < 0)
+			return -1;
+		c->queued = true;
+	}
+
+	return 0;
+}
+
+/* Find the directory in a commit; GIT_ENOTFOUND if it is not there */
+static int last_find_dir(git_oid *out, last_walk *w, git_commit *commit)
+{
+	git_tree *tree;
+	git_tree_entry *entry;
+	int error;
+
+	if (!*w->path) {
+		git_oid_cpy(out, git_commit_tree_oid(commit));
+		return 0;
+	}
+
+	if ((error = git_commit_tree(&tree, commit)) < 0)
+		return error;
+
+	error = git_tree_entry_bypath(&entry, tree, w->path);
+	git_tree_free(tree);
+
+	if (error == GIT_ENOTFOUND) {
+		giterr_clear();
+		return error;
+	}
+	if (error < 0)
+		return error;
+
+	if (git_tree_entry_type(entry) != GIT_OBJ_TREE)
+		error = GIT_ENOTFOUND;
+	else
+		git_oid_cpy(out, git_tree_entry_id(entry));
+
+	git_tree_entry_free(entry);
+	return error;
+}
+
+/*
+ * Pass each of the commit's entries on to the first parent which has
+ * it unchanged, like history simplification does, and find the commit
+ * of those none of the parents has.
+ */
+static int last_commit_process(last_walk *w, last_commit *c)
+{
+	git_commit *commit, *parent = NULL;
+	git_tree *parent_dir = NULL;
+	last_commit *p;
+	git_oid dir_id, parent_dir_id;
+	size_t *entries = c->entries, count = c->count, i, kept;
+	unsigned int n;
+	int error;
+
+	/* what it gets from now on is processed when it comes out again */
+	c->entries = NULL;
+	c->count = c->alloc = 0;
+
+	if ((error = git_commit_lookup(&commit, w->repo, &c->id)) < 0)
+		goto cleanup;
+
+	if ((error = last_find_dir(&dir_id, w, commit)) < 0)
+		goto cleanup;
+
+	for (n = 0; n < git_commit_parentcount(commit) && count > 0; ++n) {
+		if ((error = git_commit_parent(&parent, commit, n)) < 0)
+			goto cleanup;
+
+		if ((error = last_find_dir(&parent_dir_id, w, parent)) == GIT_ENOTFOUND) {
+			git_commit_free(parent);
+			parent = NULL;
+			error = 0;
+			continue;
+		}
+
+		if (error < 0 || (error = last_commit_get(&p, w, parent)) < 0)
+			goto cleanup;
+
+		git_commit_free(parent);
+		parent = NULL;
+
+		/* an unchanged directory has all the entries unchanged */
+		if (!git_oid_cmp(&parent_dir_id, &dir_id)) {
+			for (i = 0; i < count; ++i)
+				if ((error = last_commit_add(w, p, entries[i])) < 0)
+					goto cleanup;
+
+			count = 0;
+			break;
+		}
+
+		if ((error = git_tree_lookup(&parent_dir, w->repo, &parent_dir_id)) < 0)
+			goto cleanup;
+
+		for (i = 0, kept = 0; i < count; ++i) {
+			const git_tree_entry *entry, *older;
+
+			entry = git_tree_entry_byindex(w->dir, entries[i]);
+			older = git_tree_entry_byname(parent_dir, git_tree_entry_name(entry));
+
+			if (older != NULL &&
+				git_tree_entry_filemode(older) == git_tree_entry_filemode(entry) &&
+				!git_oid_cmp(git_tree_entry_id(older), git_tree_entry_id(entry))) {
+				if ((error = last_commit_add(w, p, entries[i])) < 0)
+					goto cleanup;
+			} else
+				entries[kept++] = entries[i];
+		}
+
+		count = kept;
+
+		git_tree_free(parent_dir);
+		parent_dir = NULL;
+	}
+
+	/* no parent has them like this: the commit changed them */
+	for (i = 0; i < count; ++i) {
+		git_oid_cpy(&w->found[entries[i]], &c->id);
+		w->unresolved--;
+	}
+
+cleanup:
+	git__free(entries);
+	git_tree_free(parent_dir);
+	git_commit_free(parent);
+	git_commit_free(commit);
+	return error;
+}
+
+int git_last_commit_foreach(
+	git_repository *repo,
+	const git_oid *commit_id,
+	const char *path,
+	git_last_commit_cb cb,
+	void *payload)
+{
+	last_walk w;
+	last_commit *c;
+	git_commit *commit = NULL;
+	git_oid dir_id;
+	size_t i, count;
+	int error;
+
+	assert(repo && commit_id && cb);
+
+	memset(&w, 0, sizeof(w));
+	w.repo = repo;
+	w.path = path ? path : "";
+
+	if ((error = git_commit_lookup(&commit, repo, commit_id)) < 0)
+		goto cleanup;
+
+	if ((error = last_find_dir(&dir_id, &w, commit)) == GIT_ENOTFOUND) {
+		giterr_set(GITERR_TREE,
+			"Cannot find the last commits in '%s': not a directory", w.path);
+		goto cleanup;
+	}
+
+	if (error < 0 || (error = git_tree_lookup(&w.dir, repo, &dir_id)) < 0)
+		goto cleanup;
+
+	count = git_tree_entrycount(w.dir);
+
+	if ((w.found = git__calloc(count + 1, sizeof(git_oid))) == NULL ||
+		(w.commits = git_oidmap_alloc()) == NULL ||
+		git_pqueue_init(&w.queue, 16, last_commit_cmp_time) < 0) {
+		giterr_set_oom();
+		error = -1;
+		goto cleanup;
+	}
+
+	if ((error = last_commit_get(&c, &w, commit)) < 0)
+		goto cleanup;
+
+	for (i = 0; i < count; ++i)
+		if ((error = last_commit_add(&w, c, i)) < 0)
+			goto cleanup;
+
+	w.unresolved = count;
+
+	while (w.unresolved > 0 && (c = git_pqueue_pop(&w.queue)) != NULL) {
+		c->queued = false;
+
+		if (c->count > 0 && (error = last_commit_process(&w, c)) < 0)
+			goto cleanup;
+	}
+
+	for (i = 0; i < count; ++i) {
+		if (cb(git_tree_entry_byindex(w.dir, i), &w.found[i], payload)) {
+			giterr_clear();
+			error = GIT_EUSER;
+			break;
+		}
+	}
+
+cleanup:
+	if (w.commits) {
+		git_oidmap_foreach_value(w.commits, c, {
+			git__free(c->entries);
+			git__free(c);
+		});
+		git_oidmap_free(w.commits);
+	}
+
+	git_pqueue_free(&w.queue);
+	git__free(w.found);
+	git_tree_free(w.dir);
+	git_commit_free(commit);
+	return error;
+}
@@ -9,9 +9,13 @@
 #include "buffer.h"
 #include "merge.h"
 #include "refs.h"
+#include "tree.h"
+#include "index.h"
+#include "xdiff/xdiff.h"
 #include "git2/repository.h"
 #include "git2/merge.h"
 #include "git2/reset.h"
+#include "git2/blob.h"
 
 int git_merge__cleanup(git_repository *repo)
 {
@@ -46,3 +50,427 @@ cleanup:
 	return error;
 }
 
+
+enum {
+	MERGE_ANCESTOR = 0,
+	MERGE_OURS = 1,
+	MERGE_THEIRS = 2,
+};
+
+typedef struct {
+	git_repository *repo;
+	git_odb *odb;
+	git_index *index;
+	const git_merge_tree_opts *opts;
+	git_buf path;
+} merge_trees_data;
+
+typedef struct {
+	const git_tree_entry *entry;
+	int side;
+} merge_side_entry;
+
+static int merge_side_entry_cmp(const void *a, const void *b)
+{
+	const merge_side_entry *sa = a, *sb = b;
+	int cmp = strcmp(sa->entry->filename, sb->entry->filename);
+
+	return cmp ? cmp : (sa->side - sb->side);
+}
+
+GIT_INLINE(bool) merge_entry_equal(
+	const git_tree_entry *a, const git_tree_entry *b)
+{
+	if (!a || !b)
+		return (a == b);
+
+	return a->attr == b->attr && git_oid_equal(&a->oid, &b->oid);
+}
+
+GIT_INLINE(bool) merge_entry_is_file(const git_tree_entry *e)
+{
+	return (e == NULL) ||
+		e->attr == GIT_FILEMODE_BLOB || e->attr == GIT_FILEMODE_BLOB_EXECUTABLE;
+}
+
+static int merge_add_entry(
+	merge_trees_data *data,
+	const char *name,
+	const git_oid *oid,
+	unsigned int mode,
+	int stage)
+{
+	git_index_entry entry;
+	size_t path_len = git_buf_len(&data->path);
+	int error;
+
+	if (git_buf_puts(&data->path, name) < 0)
+		return -1;
+
+	memset(&entry, 0, sizeof(entry));
+	entry.path = data->path.ptr;
+	entry.mode = mode;
+	entry.flags = (stage << GIT_IDXENTRY_STAGESHIFT);
+	git_oid_cpy(&entry.oid, oid);
+
+	error = git_index__add_unique(data->index, &entry);
+
+	git_buf_truncate(&data->path, path_len);
+	return error;
+}
+
+static int merge_add_tree(merge_trees_data *data, const git_tree_entry *te)
+{
+	git_tree *tree;
+	size_t i, path_len = git_buf_len(&data->path);
+	int error = 0;
+
+	if (git_tree_lookup(&tree, data->repo, &te->oid) < 0)
+		return -1;
+
+	if (git_buf_puts(&data->path, te->filename) < 0 ||
+		git_buf_putc(&data->path, '/') < 0)
+		error = -1;
+
+	for (i = 0; !error && i < tree->entries.length; ++i) {
+		const git_tree_entry *entry = git_vector_get(&tree->entries, i);
+
+		if (git_tree_entry__is_tree(entry))
+			error = merge_add_tree(data, entry);
+		else
+			error = merge_add_entry(
+				data, entry->filename, &entry->oid, entry->attr, 0);
+	}
+
+	git_buf_truncate(&data->path, path_len);
+	git_tree_free(tree);
+	return error;
+}
+
+static int merge_add_conflict(
+	merge_trees_data *data, const git_tree_entry *entries[3])
+{
+	int i;
+
+	for (i = MERGE_ANCESTOR; i <= MERGE_THEIRS; ++i) {
+		if (entries[i] != NULL &&
+			merge_add_entry(data, entries[i]->filename,
+				&entries[i]->oid, entries[i]->attr, i + 1) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int merge_file_contents(
+	git_oid *out,
+	bool *conflicted,
+	merge_trees_data *data,
+	const git_tree_entry *entries[3])
+{
+	git_blob *blobs[3] = { NULL, NULL, NULL };
+	mmfile_t files[3];
+	mmbuffer_t result = { NULL, 0 };
+	xmparam_t xmparam;
+	int i, error = 0;
+
+	*conflicted = true;
+
+	if (data->opts->flags & GIT_MERGE_TREE_NO_CONTENT_MERGE)
+		return 0;
+
+	for (i = MERGE_ANCESTOR; i <= MERGE_THEIRS; ++i) {
+		git_buf content = GIT_BUF_INIT;
+
+		files[i].ptr = "";
+		files[i].size = 0;
+
+		if (entries[i] == NULL)
+			continue;
+
+		if ((error = git_blob_lookup(&blobs[i], data->repo, &entries[i]->oid)) < 0)
+			goto cleanup;
+
+		content.ptr = (char *)git_blob_rawcontent(blobs[i]);
+		content.size = git_blob_rawsize(blobs[i]);
+
+		/* Binary files can't be merged, leave them conflicted */
+		if (git_buf_is_binary(&content))
+			goto cleanup;
+
+		files[i].ptr = content.ptr;
+		files[i].size = (long)content.size;
+	}
+
+	memset(&xmparam, 0, sizeof(xmparam));
+	xmparam.level = XDL_MERGE_ZEALOUS;
+	xmparam.favor = data->opts->file_favor;
+	xmparam.marker_size = DEFAULT_CONFLICT_MARKER_SIZE;
+	xmparam.ancestor = "ancestor";
+	xmparam.file1 = "ours";
+	xmparam.file2 = "theirs";
+
+	if ((error = xdl_merge(&files[MERGE_ANCESTOR], &files[MERGE_OURS],
+			&files[MERGE_THEIRS], &xmparam, &result)) < 0) {
+		giterr_set(GITERR_INVALID, "Failed to merge the contents of '%s%s'",
+			git_buf_cstr(&data->path), entries[MERGE_OURS]->filename);
+		error = -1;
+		goto cleanup;
+	}
+
+	/* The result contains conflict markers */
+	if (error > 0) {
+		error = 0;
+		goto cleanup;
+	}
+
+	if ((error = git_odb_write(
+			out, data->odb, result.ptr, result.size, GIT_OBJ_BLOB)) < 0)
+		goto cleanup;
+
+	*conflicted = false;
+
+cleanup:
+	free(result.ptr);
+	for (i = MERGE_ANCESTOR; i <= MERGE_THEIRS; ++i)
+		git_blob_free(blobs[i]);
+
+	return error;
+}
+
+/*
+ * Merge the non-tree entries found under the same name.  When `has_tree`
+ * is set, one of the sides also has a tree by that name, so anything but
+ * a deletion of the file conflicts with it.
+ */
+static int merge_files(
+	merge_trees_data *data,
+	const git_tree_entry *entries[3],
+	bool has_tree)
+{
+	const git_tree_entry *ancestor = entries[MERGE_ANCESTOR],
+		*ours = entries[MERGE_OURS], *theirs = entries[MERGE_THEIRS],
+		*result = NULL;
+	unsigned int mode;
+	git_oid oid;
+	bool conflicted = false;
+	int error;
+
+	if (merge_entry_equal(ours, theirs))
+		result = ours;
+	else if (merge_entry_equal(ancestor, ours))
+		result = theirs;
+	else if (merge_entry_equal(ancestor, theirs))
+		result = ours;
+	else if (!ours || !theirs ||
+		!merge_entry_is_file(ancestor) ||
+		!merge_entry_is_file(ours) || !merge_entry_is_file(theirs))
+		return merge_add_conflict(data, entries);
+	else {
+		/* Both sides changed a regular file */
+		if (ours->attr == theirs->attr)
+			mode = ours->attr;
+		else if (ancestor && ancestor->attr == ours->attr)
+			mode = theirs->attr;
+		else if (ancestor && ancestor->attr == theirs->attr)
+			mode = ours->attr;
+		else
+			return merge_add_conflict(data, entries);
+
+		if (git_oid_equal(&ours->oid, &theirs->oid))
+			git_oid_cpy(&oid, &ours->oid);
+		else if (ancestor && git_oid_equal(&ancestor->oid, &ours->oid))
+			git_oid_cpy(&oid, &theirs->oid);
+		else if (ancestor && git_oid_equal(&ancestor->oid, &theirs->oid))
+			git_oid_cpy(&oid, &ours->oid);
+		else if ((error = merge_file_contents(&oid, &conflicted, data, entries)) < 0)
+			return error;
+
+		if (conflicted || has_tree)
+			return merge_add_conflict(data, entries);
+
+		return merge_add_entry(data, ours->filename, &oid, mode, 0);
+	}
+
+	if (result == NULL)
+		return 0;
+
+	if (has_tree)
+		return merge_add_conflict(data, entries);
+
+	return merge_add_entry(data, result->filename, &result->oid, result->attr, 0);
+}
+
+static int merge_trees_r(
+	merge_trees_data *data, git_tree *trees[3]);
+
+/*
+ * Merge the trees found under the same name; a whole subtree is taken
+ * from one side without reading it any further when the other side
+ * didn't touch it.
+ */
+static int merge_subtrees(
+	merge_trees_data *data, const git_tree_entry *entries[3], bool *has_result)
+{
+	const git_tree_entry *ancestor = entries[MERGE_ANCESTOR],
+		*ours = entries[MERGE_OURS], *theirs = entries[MERGE_THEIRS],
+		*result;
+	git_tree *trees[3] = { NULL, NULL, NULL };
+	size_t path_len = git_buf_len(&data->path);
+	int i, error = 0;
+
+	if (merge_entry_equal(ours, theirs))
+		result = ours;
+	else if (merge_entry_equal(ancestor, ours))
+		result = theirs;
+	else if (merge_entry_equal(ancestor, theirs))
+		result = ours;
+	else {
+		*has_result = true;
+
+		for (i = MERGE_ANCESTOR; !error && i <= MERGE_THEIRS; ++i) {
+			if (entries[i] != NULL)
+				error = git_tree_lookup(&trees[i], data->repo, &entries[i]->oid);
+		}
+
+		if (!error &&
+			(git_buf_puts(&data->path, (ours ? ours : theirs)->filename) < 0 ||
+			 git_buf_putc(&data->path, '/') < 0))
+			error = -1;
+
+		if (!error)
+			error = merge_trees_r(data, trees);
+
+		git_buf_truncate(&data->path, path_len);
+		for (i = MERGE_ANCESTOR; i <= MERGE_THEIRS; ++i)
+			git_tree_free(trees[i]);
+
+		return error;
+	}
+
+	*has_result = (result != NULL);
+
+	return result ? merge_add_tree(data, result) : 0;
+}
+
+static int merge_trees_r(merge_trees_data *data, git_tree *trees[3])
+{
+	git_vector names = GIT_VECTOR_INIT;
+	merge_side_entry *sides = NULL, *side;
+	size_t i, j, count = 0;
+	int error = 0;
+
+	for (i = MERGE_ANCESTOR; i <= MERGE_THEIRS; ++i)
+		count += trees[i] ? trees[i]->entries.length : 0;
+
+	sides = git__calloc(count > 0 ? count : 1, sizeof(merge_side_entry));
+	GITERR_CHECK_ALLOC(sides);
+
+	if (git_vector_init(&names, count, merge_side_entry_cmp) < 0) {
+		git__free(sides);
+		return -1;
+	}
+
+	for (i = MERGE_ANCESTOR, count = 0; i <= MERGE_THEIRS; ++i) {
+		for (j = 0; trees[i] && j < trees[i]->entries.length; ++j) {
+			sides[count].entry = git_vector_get(&trees[i]->entries, j);
+			sides[count].side = (int)i;
+
+			if ((error = git_vector_insert(&names, &sides[count++])) < 0)
+				goto cleanup;
+		}
+	}
+
+	git_vector_sort(&names);
+
+	for (i = 0; !error && i < names.length; i = j) {
+		const git_tree_entry *files[3] = { NULL, NULL, NULL },
+			*dirs[3] = { NULL, NULL, NULL };
+		bool has_file = false, has_tree = false;
+
+		side = git_vector_get(&names, i);
+
+		for (j = i; j < names.length; ++j) {
+			merge_side_entry *next = git_vector_get(&names, j);
+
+			if (strcmp(next->entry->filename, side->entry->filename) != 0)
+				break;
+
+			if (git_tree_entry__is_tree(next->entry)) {
+				dirs[next->side] = next->entry;
+				has_tree = true;
+			} else {
+				files[next->side] = next->entry;
+				has_file = true;
+			}
+		}
+
+		if (has_tree)
+			error = merge_subtrees(data, dirs, &has_tree);
+
+		if (!error && has_file)
+			error = merge_files(data, files, has_tree);
+	}
+
+cleanup:
+	git_vector_free(&names);
+	git__free(sides);
+	return error;
+}
+
+int git_merge_trees(
+	git_index **out,
+	git_repository *repo,
+	git_tree *ancestor_tree,
+	git_tree *our_tree,
+	git_tree *their_tree,
+	const git_merge_tree_opts *given_opts)
+{
+	merge_trees_data data;
+	git_merge_tree_opts opts;
+	git_tree *trees[3];
+	int error;
+
+	assert(out && repo && our_tree && their_tree);
+
+	*out = NULL;
+
+	memset(&data, 0, sizeof(data));
+
+	if (given_opts)
+		memcpy(&opts, given_opts, sizeof(opts));
+	else
+		memset(&opts, 0, sizeof(opts));
+
+	data.repo = repo;
+	data.opts = &opts;
+
+	if ((error = git_repository_odb__weakptr(&data.odb, repo)) < 0 ||
+		(error = git_index_new(&data.index)) < 0)
+		return error;
+
+	trees[MERGE_ANCESTOR] = ancestor_tree;
+	trees[MERGE_OURS] = our_tree;
+	trees[MERGE_THEIRS] = their_tree;
+
+	if (git_oid_equal(git_tree_id(our_tree), git_tree_id(their_tree)))
+		trees[MERGE_ANCESTOR] = trees[MERGE_THEIRS] = NULL;
+	else if (ancestor_tree &&
+		git_oid_equal(git_tree_id(ancestor_tree), git_tree_id(our_tree)))
+		trees[MERGE_ANCESTOR] = trees[MERGE_OURS] = NULL;
+	else if (ancestor_tree &&
+		git_oid_equal(git_tree_id(ancestor_tree), git_tree_id(their_tree)))
+		trees[MERGE_ANCESTOR] = trees[MERGE_THEIRS] = NULL;
+
+	error = merge_trees_r(&data, trees);
+
+	git_buf_free(&data.path);
+
+	if (error < 0) {
+		git_index_free(data.index);
+		return error;
+	}
+
+	*out = data.index;
+	return 0;
+}
@@ -5,12 +5,15 @@
  * a Linking Exception. For full terms see the included COPYING file.
  */
 
+#define GIT_ALLOC_SUBSYSTEM GIT_ALLOC_PACK
+
 #include "common.h"
 #include "mwindow.h"
 #include "vector.h"
 #include "fileops.h"
 #include "map.h"
 #include "global.h"
+#include "trace.h"
 
 #define DEFAULT_WINDOW_SIZE \
 	(sizeof(void*) >= 8 \
@@ -68,6 +71,7 @@ void git_mwindow_free_all(git_mwindow_file *mwf)
 		ctl->mapped -= w->window_map.len;
 		ctl->open_windows--;
 
+		GIT_TRACE_EVENT(GIT_TRACE_MWINDOW_UNMAP, w->window_map.len);
 		git_futils_mmap_free(&w->window_map);
 
 		mwf->windows = w->next;
@@ -142,6 +146,8 @@ static int git_mwindow_close_lru(git_mwindow_file *mwf)
 	}
 
 	ctl->mapped -= lru_w->window_map.len;
+
+	GIT_TRACE_EVENT(GIT_TRACE_MWINDOW_UNMAP, lru_w->window_map.len);
 	git_futils_mmap_free(&lru_w->window_map);
 
 	if (lru_l)
@@ -198,6 +204,8 @@ static git_mwindow *new_window(
 	ctl->mmap_calls++;
 	ctl->open_windows++;
 
+	GIT_TRACE_EVENT(GIT_TRACE_MWINDOW_MAP, w->window_map.len);
+
 	if (ctl->mapped > ctl->peak_mapped)
 		ctl->peak_mapped = ctl->mapped;
 
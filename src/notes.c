@@ -608,3 +608,521 @@ int git_note_foreach(
 
 	return error;
 }
+
+GIT__USE_OIDMAP;
+
+#define NOTE_BATCH_EXPECT_EXISTING	(1u << 0)
+#define NOTE_BATCH_REMOVE		(1u << 1)
+#define NOTE_BATCH_RESOLVED		(1u << 2)
+
+typedef struct {
+	git_oid target;
+	git_oid blob;
+	unsigned int flags;
+} note_batch_entry;
+
+static int note_batch_entry_cmp(const void *a, const void *b)
+{
+	const note_batch_entry *ea = a, *eb = b;
+	return git_oid_cmp(&ea->target, &eb->target);
+}
+
+int git_note_batch_new(
+	git_note_batch **out, git_repository *repo, const char *notes_ref)
+{
+	int error;
+	git_note_batch *batch;
+
+	assert(out && repo);
+
+	batch = git__calloc(1, sizeof(git_note_batch));
+	GITERR_CHECK_ALLOC(batch);
+
+	batch->repo = repo;
+
+	if ((error = retrieve_note_tree_and_commit(
+			&batch->tree, &batch->commit, repo, &notes_ref)) < 0 &&
+		error != GIT_ENOTFOUND)
+		goto on_error;
+
+	batch->notes_ref = git__strdup(notes_ref);
+	batch->targets = git_oidmap_alloc();
+
+	if (!batch->notes_ref || !batch->targets ||
+		git_vector_init(&batch->entries, 16, note_batch_entry_cmp) < 0 ||
+		git_pool_init(&batch->entry_pool, sizeof(note_batch_entry), 0) < 0 ||
+		git_pool_init(&batch->resolved_pool, sizeof(note_batch_entry), 0) < 0) {
+		error = -1;
+		goto on_error;
+	}
+
+	giterr_clear();
+	*out = batch;
+	return 0;
+
+on_error:
+	git_note_batch_free(batch);
+	return error;
+}
+
+static int note_batch_entry_for(
+	note_batch_entry **out, git_note_batch *batch, const git_oid *oid)
+{
+	int error;
+	git_hashmap_iter pos;
+	note_batch_entry *entry;
+
+	pos = git_oidmap_lookup_index(batch->targets, oid);
+	if (git_oidmap_valid_index(batch->targets, pos)) {
+		*out = git_oidmap_value_at(batch->targets, pos);
+		return 0;
+	}
+
+	entry = git_pool_mallocz(&batch->entry_pool, 1);
+	GITERR_CHECK_ALLOC(entry);
+
+	git_oid_cpy(&entry->target, oid);
+	entry->flags = NOTE_BATCH_REMOVE;
+
+	if (git_vector_insert(&batch->entries, entry) < 0)
+		return -1;
+
+	git_oidmap_insert(batch->targets, &entry->target, entry, error);
+	if (error < 0)
+		return -1;
+
+	*out = entry;
+	return 1;
+}
+
+int git_note_batch_create(
+	git_oid *out, git_note_batch *batch, const git_oid *oid, const char *note)
+{
+	git_oid blob;
+	note_batch_entry *entry;
+	char target[GIT_OID_HEXSZ + 1];
+
+	assert(batch && oid && note);
+
+	if (note_batch_entry_for(&entry, batch, oid) < 0)
+		return -1;
+
+	if (!(entry->flags & NOTE_BATCH_REMOVE)) {
+		giterr_set(GITERR_REPOSITORY,
+			"Note for '%s' is already added by this batch",
+			git_oid_tostr(target, sizeof(target), oid));
+		return GIT_EEXISTS;
+	}
+
+	if (git_blob_create_frombuffer(&blob, batch->repo, note, strlen(note)) < 0)
+		return -1;
+
+	entry->flags &= ~NOTE_BATCH_REMOVE;
+	git_oid_cpy(&entry->blob, &blob);
+
+	if (out)
+		git_oid_cpy(out, &blob);
+
+	return 0;
+}
+
+int git_note_batch_remove(git_note_batch *batch, const git_oid *oid)
+{
+	int is_new;
+	note_batch_entry *entry;
+	char target[GIT_OID_HEXSZ + 1];
+
+	assert(batch && oid);
+
+	if ((is_new = note_batch_entry_for(&entry, batch, oid)) < 0)
+		return -1;
+
+	if (is_new) {
+		entry->flags = NOTE_BATCH_REMOVE | NOTE_BATCH_EXPECT_EXISTING;
+		return 0;
+	}
+
+	if (entry->flags & NOTE_BATCH_REMOVE) {
+		giterr_set(GITERR_REPOSITORY,
+			"Note for '%s' is already removed by this batch",
+			git_oid_tostr(target, sizeof(target), oid));
+		return GIT_ENOTFOUND;
+	}
+
+	/*
+	 * Removing a note added by this very batch: if it replaced an
+	 * existing note, that one still has to go; otherwise the pair
+	 * cancels out and is skipped when committing.
+	 */
+	entry->flags |= NOTE_BATCH_REMOVE;
+	return 0;
+}
+
+static int note_batch_check(const note_batch_entry *entry, bool exists)
+{
+	char target[GIT_OID_HEXSZ + 1];
+
+	if (entry->flags & NOTE_BATCH_RESOLVED)
+		return 0;
+
+	git_oid_fmt(target, &entry->target);
+	target[GIT_OID_HEXSZ] = '\0';
+
+	if (exists && !(entry->flags & NOTE_BATCH_EXPECT_EXISTING)) {
+		giterr_set(GITERR_REPOSITORY, "Note for '%s' exists already", target);
+		return GIT_EEXISTS;
+	}
+
+	if (!exists && (entry->flags & NOTE_BATCH_EXPECT_EXISTING)) {
+		giterr_set(GITERR_REPOSITORY, "Object '%s' has no note", target);
+		return GIT_ENOTFOUND;
+	}
+
+	return 0;
+}
+
+static int note_batch_resolved(
+	note_batch_entry **out, git_note_batch *batch,
+	const git_oid *target, const git_oid *blob)
+{
+	note_batch_entry *entry = git_pool_malloc(&batch->resolved_pool, 1);
+	GITERR_CHECK_ALLOC(entry);
+
+	git_oid_cpy(&entry->target, target);
+	git_oid_cpy(&entry->blob, blob);
+	entry->flags = NOTE_BATCH_RESOLVED;
+
+	*out = entry;
+	return 0;
+}
+
+static bool is_fanout_entry(const git_tree_entry *entry)
+{
+	const char *name = git_tree_entry_name(entry);
+
+	return S_ISDIR(git_tree_entry_filemode(entry)) &&
+		strlen(name) == 2 && git__ishex(name);
+}
+
+/*
+ * Gather the notes stored directly in `tree` (i.e. not below a fanout
+ * subtree), merge the batch `entries` targeting this level into them and
+ * return the resulting, sorted, list of notes in `merged`.
+ *
+ * Entries whose note may live in a fanout subtree of `tree` can't be
+ * checked at this level; they are left unresolved in `merged` so that
+ * the next level down gets to validate them.
+ */
+static int note_batch_merge_level(
+	git_vector *merged,
+	git_vector *flat,
+	bool *has_fanout,
+	git_note_batch *batch,
+	git_tree *tree,
+	note_batch_entry **entries,
+	size_t count,
+	size_t depth)
+{
+	size_t i, j = 0, name_len = GIT_OID_HEXSZ - depth * 2;
+	char path[GIT_OID_HEXSZ + 1];
+	note_batch_entry *note;
+	const git_tree_entry *te;
+
+	*has_fanout = false;
+
+	git_oid_fmt(path, &entries[0]->target);
+	path[GIT_OID_HEXSZ] = '\0';
+
+	for (i = 0; tree && i < git_tree_entrycount(tree); ++i) {
+		git_oid target;
+
+		te = git_tree_entry_byindex(tree, i);
+
+		if (is_fanout_entry(te)) {
+			*has_fanout = true;
+			continue;
+		}
+
+		if (S_ISDIR(git_tree_entry_filemode(te)) ||
+			strlen(git_tree_entry_name(te)) != name_len ||
+			!git__ishex(git_tree_entry_name(te)))
+			continue;
+
+		memcpy(path + depth * 2, git_tree_entry_name(te), name_len);
+		if (git_oid_fromstr(&target, path) < 0)
+			continue;
+
+		if (note_batch_resolved(&note, batch, &target, git_tree_entry_id(te)) < 0 ||
+			git_vector_insert(flat, note) < 0)
+			return -1;
+	}
+
+	git_vector_sort(flat);
+
+	for (i = 0; i < count || j < flat->length; ) {
+		note_batch_entry *entry = (i < count) ? entries[i] : NULL;
+		note_batch_entry *existing = git_vector_get(flat, j);
+		int cmp, error;
+
+		if (!entry)
+			cmp = 1;
+		else if (!existing)
+			cmp = -1;
+		else
+			cmp = git_oid_cmp(&entry->target, &existing->target);
+
+		if (cmp > 0) {
+			/* Untouched note living at this level */
+			note = existing;
+			j++;
+		} else if (cmp == 0) {
+			if ((error = note_batch_check(entry, true)) < 0)
+				return error;
+
+			i++; j++;
+
+			if (entry->flags & NOTE_BATCH_REMOVE)
+				continue;
+
+			if (note_batch_resolved(&note, batch, &entry->target, &entry->blob) < 0)
+				return -1;
+		} else {
+			note = entry;
+			i++;
+
+			if (*has_fanout && !(entry->flags & NOTE_BATCH_RESOLVED)) {
+				git_oid_fmt(path, &entry->target);
+				path[depth * 2 + 2] = '\0';
+
+				te = git_tree_entry_byname(tree, path + depth * 2);
+				if (te != NULL && is_fanout_entry(te)) {
+					/* Let the subtree have a say about this one */
+					if (git_vector_insert(merged, note) < 0)
+						return -1;
+					continue;
+				}
+			}
+
+			if ((error = note_batch_check(entry, false)) < 0)
+				return error;
+
+			if (entry->flags & NOTE_BATCH_REMOVE)
+				continue;
+		}
+
+		if (git_vector_insert(merged, note) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int note_batch_write_tree(
+	git_oid *out,
+	bool *empty,
+	git_note_batch *batch,
+	git_tree *tree,
+	note_batch_entry **entries,
+	size_t count,
+	size_t depth)
+{
+	int error;
+	bool has_fanout;
+	size_t i, start;
+	git_vector merged = GIT_VECTOR_INIT, flat = GIT_VECTOR_INIT;
+	git_treebuilder *tb = NULL;
+	git_tree *subtree = NULL;
+	note_batch_entry *note;
+	char path[GIT_OID_HEXSZ + 1];
+
+	if ((error = git_vector_init(&merged, count, note_batch_entry_cmp)) < 0 ||
+		(error = git_vector_init(&flat, 0, note_batch_entry_cmp)) < 0 ||
+		(error = git_treebuilder_create(&tb, tree)) < 0)
+		goto cleanup;
+
+	if ((error = note_batch_merge_level(
+			&merged, &flat, &has_fanout, batch, tree, entries, count, depth)) < 0)
+		goto cleanup;
+
+	/* Every note of this level is rewritten below */
+	git_vector_foreach(&flat, i, note) {
+		git_oid_fmt(path, &note->target);
+		path[GIT_OID_HEXSZ] = '\0';
+
+		if ((error = git_treebuilder_remove(tb, path + depth * 2)) < 0)
+			goto cleanup;
+	}
+
+	if (!has_fanout &&
+		(merged.length <= GIT_NOTES_FANOUT_THRESHOLD ||
+		 depth + 2 >= GIT_OID_RAWSZ)) {
+		git_vector_foreach(&merged, i, note) {
+			git_oid_fmt(path, &note->target);
+			path[GIT_OID_HEXSZ] = '\0';
+
+			if ((error = git_treebuilder_insert(NULL, tb,
+					path + depth * 2, &note->blob, GIT_FILEMODE_BLOB)) < 0)
+				goto cleanup;
+		}
+	} else {
+		/* Spread the notes over fanout subtrees, one per leading byte */
+		for (start = 0; start < merged.length; start = i) {
+			const git_tree_entry *te;
+			git_oid subtree_oid;
+			bool subtree_empty;
+			unsigned char byte;
+
+			note = git_vector_get(&merged, start);
+			byte = note->target.id[depth];
+
+			for (i = start + 1; i < merged.length; ++i) {
+				note_batch_entry *next = git_vector_get(&merged, i);
+				if (next->target.id[depth] != byte)
+					break;
+			}
+
+			git_oid_fmt(path, &note->target);
+			path[depth * 2 + 2] = '\0';
+
+			te = tree ? git_tree_entry_byname(tree, path + depth * 2) : NULL;
+			if (te != NULL && is_fanout_entry(te) &&
+				(error = git_tree_lookup(&subtree, batch->repo, git_tree_entry_id(te))) < 0)
+				goto cleanup;
+
+			error = note_batch_write_tree(&subtree_oid, &subtree_empty, batch,
+				subtree, (note_batch_entry **)merged.contents + start,
+				i - start, depth + 1);
+
+			git_tree_free(subtree);
+			subtree = NULL;
+
+			if (error < 0)
+				goto cleanup;
+
+			if (subtree_empty)
+				error = git_treebuilder_get(tb, path + depth * 2) ?
+					git_treebuilder_remove(tb, path + depth * 2) : 0;
+			else
+				error = git_treebuilder_insert(NULL, tb,
+					path + depth * 2, &subtree_oid, GIT_FILEMODE_TREE);
+
+			if (error < 0)
+				goto cleanup;
+		}
+	}
+
+	*empty = (git_treebuilder_entrycount(tb) == 0);
+
+	/* Empty subtrees are dropped by the caller; the root is always written */
+	if (!*empty || depth == 0)
+		error = git_treebuilder_write(out, batch->repo, tb);
+
+cleanup:
+	git_treebuilder_free(tb);
+	git_vector_free(&merged);
+	git_vector_free(&flat);
+	return error;
+}
+
+static int tree_write_empty(git_oid *out, git_repository *repo)
+{
+	int error;
+	git_treebuilder *tb;
+
+	if ((error = git_treebuilder_create(&tb, NULL)) < 0)
+		return error;
+
+	error = git_treebuilder_write(out, repo, tb);
+
+	git_treebuilder_free(tb);
+	return error;
+}
+
+static int note_batch_entry_is_noop(git_vector *v, size_t idx)
+{
+	const note_batch_entry *entry = git_vector_get(v, idx);
+
+	/* Added then removed within the batch */
+	return (entry->flags & NOTE_BATCH_REMOVE) &&
+		!(entry->flags & NOTE_BATCH_EXPECT_EXISTING);
+}
+
+int git_note_batch_commit(
+	git_oid *out, git_note_batch *batch,
+	git_signature *author, git_signature *committer)
+{
+	int error;
+	bool empty;
+	git_vector entries = GIT_VECTOR_INIT;
+	git_tree *tree = NULL;
+	git_commit *commit;
+	git_oid tree_oid, commit_oid;
+
+	assert(batch && author && committer);
+
+	if ((error = git_vector_dup(&entries, &batch->entries, note_batch_entry_cmp)) < 0)
+		return error;
+
+	git_vector_remove_matching(&entries, note_batch_entry_is_noop);
+	git_vector_sort(&entries);
+
+	if (entries.length > 0)
+		error = note_batch_write_tree(&tree_oid, &empty, batch,
+			batch->tree, (note_batch_entry **)entries.contents,
+			entries.length, 0);
+	else if (batch->tree != NULL)
+		git_oid_cpy(&tree_oid, git_tree_id(batch->tree));
+	else
+		error = tree_write_empty(&tree_oid, batch->repo);
+
+	if (error < 0)
+		goto cleanup;
+
+	if ((error = git_tree_lookup(&tree, batch->repo, &tree_oid)) < 0)
+		goto cleanup;
+
+	error = git_commit_create(&commit_oid, batch->repo, batch->notes_ref,
+		author, committer, NULL, GIT_NOTES_DEFAULT_MSG_BATCH, tree,
+		batch->commit == NULL ? 0 : 1,
+		(const git_commit **) &batch->commit);
+
+	if (error < 0 ||
+		(error = git_commit_lookup(&commit, batch->repo, &commit_oid)) < 0)
+		goto cleanup;
+
+	if (out)
+		git_oid_cpy(out, &commit_oid);
+
+	/* the next changes go on top of this commit */
+	git_commit_free(batch->commit);
+	batch->commit = commit;
+	git_tree_free(batch->tree);
+	batch->tree = tree;
+	tree = NULL;
+
+	git_vector_clear(&batch->entries);
+	git_oidmap_clear(batch->targets);
+	git_pool_clear(&batch->entry_pool);
+
+cleanup:
+	git_tree_free(tree);
+	git_vector_free(&entries);
+	git_pool_clear(&batch->resolved_pool);
+	return error;
+}
+
+void git_note_batch_free(git_note_batch *batch)
+{
+	if (batch == NULL)
+		return;
+
+	git_pool_clear(&batch->entry_pool);
+	git_pool_clear(&batch->resolved_pool);
+	git_vector_free(&batch->entries);
+	if (batch->targets)
+		git_oidmap_free(batch->targets);
+	git_tree_free(batch->tree);
+	git_commit_free(batch->commit);
+	git__free(batch->notes_ref);
+	git__free(batch);
+}
@@ -10,6 +10,9 @@
 #include "common.h"
 
 #include "git2/oid.h"
+#include "oidmap.h"
+#include "vector.h"
+#include "pool.h"
 
 #define GIT_NOTES_DEFAULT_REF "refs/notes/commits"
 
@@ -19,10 +22,36 @@
 #define GIT_NOTES_DEFAULT_MSG_RM \
 	"Notes removed by 'git_note_remove' from libgit2"
 
+#define GIT_NOTES_DEFAULT_MSG_BATCH \
+	"Notes updated by 'git_note_batch_commit' from libgit2"
+
+/*
+ * Number of notes a single notes tree may hold before
+ * `git_note_batch_commit` fans it out into 2-hex-digit subtrees
+ */
+#define GIT_NOTES_FANOUT_THRESHOLD 256
+
 struct git_note {
 	git_oid oid;
 
 	char *message;
 };
 
+struct git_note_batch {
+	git_repository *repo;
+	char *notes_ref;
+
+	/* tip of `notes_ref` when the batch was started or last
+	 * committed; NULL if unborn */
+	git_commit *commit;
+	git_tree *tree;
+
+	git_oidmap *targets;
+	git_vector entries;
+	git_pool entry_pool;
+
+	/* notes read or rewritten by a commit; cleared when it ends */
+	git_pool resolved_pool;
+};
+
 #endif /* INCLUDE_notes_h__ */
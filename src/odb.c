@@ -5,6 +5,8 @@
  * a Linking Exception. For full terms see the included COPYING file.
  */
 
+#define GIT_ALLOC_SUBSYSTEM GIT_ALLOC_ODB
+
 #include "common.h"
 #include <zlib.h>
 #include "git2/object.h"
@@ -543,6 +545,51 @@ int git_odb_read_header(size_t *len_p, git_otype *type_p, git_odb *db, const git
 	return error;
 }
 
+int git_odb_read_disk_size(git_off_t *out, git_odb *db, const git_oid *id)
+{
+	unsigned int i;
+	int error = GIT_ENOTFOUND;
+
+	assert(out && db && id);
+
+	for (i = 0; i < db->backends.length && error < 0; ++i) {
+		backend_internal *internal = git_vector_get(&db->backends, i);
+		git_odb_backend *b = internal->backend;
+
+		if (b->read_disk_size != NULL)
+			error = b->read_disk_size(out, b, id);
+	}
+
+	if (error == GIT_ENOTFOUND || error == GIT_PASSTHROUGH)
+		return git_odb__error_notfound("no backend knows the size of the object", id);
+
+	return error;
+}
+
+int git_odb__locate(git_off_t *out, git_odb *db, const git_oid *id)
+{
+	unsigned int i;
+	int error = GIT_ENOTFOUND;
+
+	assert(out && db && id);
+
+	/* the keys of a backend only compare with its own */
+	for (i = 0; i < db->backends.length && error < 0; ++i) {
+		backend_internal *internal = git_vector_get(&db->backends, i);
+		git_odb_backend *b = internal->backend;
+
+		if (b->locate != NULL)
+			error = b->locate(out, b, id);
+	}
+
+	if (error == GIT_ENOTFOUND || error == GIT_PASSTHROUGH) {
+		giterr_clear();
+		return GIT_ENOTFOUND;
+	}
+
+	return error;
+}
+
 int git_odb__read_header_or_object(
 	git_odb_object **out, size_t *len_p, git_otype *type_p,
 	git_odb *db, const git_oid *id)
@@ -752,14 +799,46 @@ int git_odb_open_wstream(
 	return error;
 }
 
+typedef struct {
+	git_odb_stream stream;
+	git_odb_object *object;
+	size_t pos;
+} odb_object_stream;
+
+static int object_stream_read(git_odb_stream *_stream, char *buffer, size_t len)
+{
+	odb_object_stream *stream = (odb_object_stream *)_stream;
+	size_t left = stream->object->raw.len - stream->pos;
+
+	if (len > left)
+		len = left;
+	if (len > INT_MAX)
+		len = INT_MAX;
+
+	memcpy(buffer, (char *)stream->object->raw.data + stream->pos, len);
+	stream->pos += len;
+
+	return (int)len;
+}
+
+static void object_stream_free(git_odb_stream *_stream)
+{
+	odb_object_stream *stream = (odb_object_stream *)_stream;
+
+	git_odb_object_free(stream->object);
+	git__free(stream);
+}
+
 int git_odb_open_rstream(git_odb_stream **stream, git_odb *db, const git_oid *oid)
 {
 	unsigned int i;
-	int error = GIT_ERROR;
+	int error = GIT_ENOTFOUND;
+	odb_object_stream *object_stream;
+	git_odb_object *object;
 
 	assert(stream && db);
 
-	for (i = 0; i < db->backends.length && error < 0; ++i) {
+	for (i = 0; i < db->backends.length && error < 0 && error != GIT_PASSTHROUGH; ++i) {
 		backend_internal *internal = git_vector_get(&db->backends, i);
 		git_odb_backend *b = internal->backend;
 
@@ -767,10 +846,31 @@ int git_odb_open_rstream(git_odb_stream **stream, git_odb *db, const git_oid *oi
 			error = b->readstream(stream, b, oid);
 	}
 
-	if (error == GIT_PASSTHROUGH)
-		error = 0;
+	if (error != GIT_ENOTFOUND && error != GIT_PASSTHROUGH)
+		return error;
 
-	return error;
+	/*
+	 * no backend could stream the object;
+	 * read it whole and hand it out from memory
+	 */
+	giterr_clear();
+
+	if ((error = git_odb_read(&object, db, oid)) < 0)
+		return error;
+
+	object_stream = git__calloc(1, sizeof(odb_object_stream));
+	if (!object_stream) {
+		git_odb_object_free(object);
+		return -1;
+	}
+
+	object_stream->object = object;
+	object_stream->stream.mode = GIT_STREAM_RDONLY;
+	object_stream->stream.read = &object_stream_read;
+	object_stream->stream.free = &object_stream_free;
+
+	*stream = (git_odb_stream *)object_stream;
+	return 0;
 }
 
 int git_odb_write_pack(struct git_odb_writepack **out, git_odb *db, git_transfer_progress_callback progress_cb, void *progress_payload)
@@ -92,4 +92,11 @@ int git_odb__read_header_or_object(
 	git_odb_object **out, size_t *len_p, git_otype *type_p,
 	git_odb *db, const git_oid *id);
 
+/*
+ * Get a key for reading objects in storage order: objects stored close
+ * together get close keys.  Returns GIT_ENOTFOUND, without setting an
+ * error, for objects which no backend can place (e.g. loose ones).
+ */
+int git_odb__locate(git_off_t *out, git_odb *db, const git_oid *id);
+
 #endif
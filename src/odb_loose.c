@@ -5,6 +5,8 @@
  * a Linking Exception. For full terms see the included COPYING file.
  */
 
+#define GIT_ALLOC_SUBSYSTEM GIT_ALLOC_ODB
+
 #include "common.h"
 #include <zlib.h>
 #include "git2/object.h"
@@ -14,6 +16,8 @@
 #include "odb.h"
 #include "delta-apply.h"
 #include "filebuf.h"
+#include "scratch.h"
+#include "trace.h"
 
 #include "git2/odb_backend.h"
 #include "git2/types.h"
@@ -28,6 +32,16 @@ typedef struct {
 	git_filebuf fbuf;
 } loose_writestream;
 
+typedef struct {
+	git_odb_stream stream;
+	git_map map;
+	z_stream zs;
+	unsigned char head[64]; /* the header, and the data inflated with it */
+	size_t head_pos, head_end;
+	size_t size, total; /* of the object, and of what was read so far */
+	bool done;
+} loose_readstream;
+
 typedef struct loose_backend {
 	git_odb_backend parent;
 
@@ -335,6 +349,7 @@ static int inflate_disk_obj(git_rawobj *out, git_buf *obj)
 	z_stream zs;
 	obj_hdr hdr;
 	size_t used;
+	GIT_TRACE_SPAN(span);
 
 	/*
 	 * check for a pack-like loose object
@@ -342,6 +357,8 @@ static int inflate_disk_obj(git_rawobj *out, git_buf *obj)
 	if (!is_zlib_compressed_data((unsigned char *)obj->ptr))
 		return inflate_packlike_loose_disk_obj(out, obj);
 
+	GIT_TRACE_BEGIN(span);
+
 	/*
 	 * inflate the initial part of the io buffer in order
 	 * to parse the object header (type and size).
@@ -366,6 +383,7 @@ static int inflate_disk_obj(git_rawobj *out, git_buf *obj)
 	out->len = hdr.size;
 	out->type = hdr.type;
 
+	GIT_TRACE_END(GIT_TRACE_INFLATE, span, hdr.size);
 	return 0;
 }
 
@@ -397,10 +415,12 @@ static int read_loose(git_rawobj *out, git_buf *loc)
 	out->len = 0;
 	out->type = GIT_OBJ_BAD;
 
+	git_scratch__take(&obj);
+
 	if (!(error = git_futils_readbuffer(&obj, loc->ptr)))
 		error = inflate_disk_obj(out, &obj);
 
-	git_buf_free(&obj);
+	git_scratch__release(&obj);
 
 	return error;
 }
@@ -578,6 +598,29 @@ static int locate_object_short_oid(
  *
  ***********************************************************/
 
+static int loose_backend__read_disk_size(git_off_t *out, git_odb_backend *backend, const git_oid *oid)
+{
+	git_buf object_path = GIT_BUF_INIT;
+	struct stat st;
+	int error = 0;
+
+	assert(backend && oid);
+
+	git_scratch__take(&object_path);
+
+	if (locate_object(&object_path, (loose_backend *)backend, oid) < 0)
+		error = git_odb__error_notfound("no matching loose object", oid);
+	else if (p_stat(object_path.ptr, &st) < 0) {
+		giterr_set(GITERR_OS, "Failed to stat loose object '%s'", object_path.ptr);
+		error = -1;
+	} else
+		*out = (git_off_t)st.st_size;
+
+	git_scratch__release(&object_path);
+
+	return error;
+}
+
 static int loose_backend__read_header(size_t *len_p, git_otype *type_p, git_odb_backend *backend, const git_oid *oid)
 {
 	git_buf object_path = GIT_BUF_INIT;
@@ -586,6 +629,8 @@ static int loose_backend__read_header(size_t *len_p, git_otype *type_p, git_odb_
 
 	assert(backend && oid);
 
+	git_scratch__take(&object_path);
+
 	raw.len = 0;
 	raw.type = GIT_OBJ_BAD;
 
@@ -596,7 +641,7 @@ static int loose_backend__read_header(size_t *len_p, git_otype *type_p, git_odb_
 		*type_p = raw.type;
 	}
 
-	git_buf_free(&object_path);
+	git_scratch__release(&object_path);
 
 	return error;
 }
@@ -606,18 +651,24 @@ static int loose_backend__read(void **buffer_p, size_t *len_p, git_otype *type_p
 	git_buf object_path = GIT_BUF_INIT;
 	git_rawobj raw;
 	int error = 0;
+	GIT_TRACE_SPAN(span);
 
 	assert(backend && oid);
 
-	if (locate_object(&object_path, (loose_backend *)backend, oid) < 0)
+	GIT_TRACE_BEGIN(span);
+	git_scratch__take(&object_path);
+
+	if (locate_object(&object_path, (loose_backend *)backend, oid) < 0) {
 		error = git_odb__error_notfound("no matching loose object", oid);
-	else if ((error = read_loose(&raw, &object_path)) == 0) {
+		GIT_TRACE_EVENT(GIT_TRACE_ODB_LOOSE_MISS, 0);
+	} else if ((error = read_loose(&raw, &object_path)) == 0) {
 		*buffer_p = raw.data;
 		*len_p = raw.len;
 		*type_p = raw.type;
+		GIT_TRACE_END(GIT_TRACE_ODB_LOOSE_READ, span, raw.len);
 	}
 
-	git_buf_free(&object_path);
+	git_scratch__release(&object_path);
 
 	return error;
 }
@@ -669,9 +720,11 @@ static int loose_backend__exists(git_odb_backend *backend, const git_oid *oid)
 
 	assert(backend && oid);
 
+	git_scratch__take(&object_path);
+
 	error = locate_object(&object_path, (loose_backend *)backend, oid);
 
-	git_buf_free(&object_path);
+	git_scratch__release(&object_path);
 
 	return !error;
 }
@@ -894,6 +947,129 @@ cleanup:
 	return error;
 }
 
+static int loose_backend__readstream_read(
+	git_odb_stream *_stream, char *buffer, size_t len)
+{
+	loose_readstream *stream = (loose_readstream *)_stream;
+	size_t out = 0;
+	int status;
+
+	if (len > INT_MAX)
+		len = INT_MAX;
+
+	if (stream->head_pos < stream->head_end) {
+		out = min(len, stream->head_end - stream->head_pos);
+		memcpy(buffer, stream->head + stream->head_pos, out);
+		stream->head_pos += out;
+	}
+
+	while (out < len && !stream->done) {
+		set_stream_output(&stream->zs, buffer + out, len - out);
+		status = inflate(&stream->zs, Z_NO_FLUSH);
+
+		if (status != Z_OK && status != Z_STREAM_END) {
+			giterr_set(GITERR_ZLIB, "Failed to inflate loose object");
+			return -1;
+		}
+
+		out = len - stream->zs.avail_out;
+		stream->done = (status == Z_STREAM_END);
+	}
+
+	stream->total += out;
+
+	if (stream->total > stream->size ||
+		(stream->done && stream->head_pos == stream->head_end &&
+		 stream->total != stream->size)) {
+		giterr_set(GITERR_ODB, "Loose object has the wrong size");
+		return -1;
+	}
+
+	return (int)out;
+}
+
+static void loose_backend__readstream_free(git_odb_stream *_stream)
+{
+	loose_readstream *stream = (loose_readstream *)_stream;
+
+	inflateEnd(&stream->zs);
+	git_futils_mmap_free(&stream->map);
+	git__free(stream);
+}
+
+/*
+ * The object is inflated as it is read, straight from the mapped file,
+ * so that large blobs need not be held in memory at once.  Objects in
+ * the old pack-like format are left for `git_odb_read` to handle.
+ */
+static int loose_backend__readstream(
+	git_odb_stream **stream_out, git_odb_backend *backend, const git_oid *oid)
+{
+	git_buf object_path = GIT_BUF_INIT;
+	loose_readstream *stream;
+	obj_hdr hdr;
+	size_t used;
+	int error;
+
+	assert(backend && oid);
+
+	if (locate_object(&object_path, (loose_backend *)backend, oid) < 0) {
+		git_buf_free(&object_path);
+		return git_odb__error_notfound("no matching loose object", oid);
+	}
+
+	stream = git__calloc(1, sizeof(loose_readstream));
+	GITERR_CHECK_ALLOC(stream);
+
+	error = git_futils_mmap_ro_file(&stream->map, object_path.ptr);
+	git_buf_free(&object_path);
+
+	if (error < 0) {
+		git__free(stream);
+		return error;
+	}
+
+	if (stream->map.len < 2 ||
+		!is_zlib_compressed_data((unsigned char *)stream->map.data)) {
+		git_futils_mmap_free(&stream->map);
+		git__free(stream);
+		return GIT_PASSTHROUGH;
+	}
+
+	init_stream(&stream->zs, stream->head, sizeof(stream->head));
+	set_stream_input(&stream->zs, stream->map.data, stream->map.len);
+
+	if (inflateInit(&stream->zs) < Z_OK) {
+		git_futils_mmap_free(&stream->map);
+		git__free(stream);
+		giterr_set(GITERR_ZLIB, "Failed to inflate loose object");
+		return -1;
+	}
+
+	stream->stream.backend = backend;
+	stream->stream.mode = GIT_STREAM_RDONLY;
+	stream->stream.read = &loose_backend__readstream_read;
+	stream->stream.free = &loose_backend__readstream_free;
+
+	error = inflate(&stream->zs, 0);
+
+	if ((error != Z_OK && error != Z_STREAM_END) ||
+		(used = get_object_header(&hdr, stream->head)) == 0 ||
+		!git_object_typeisloose(hdr.type)) {
+		loose_backend__readstream_free((git_odb_stream *)stream);
+		giterr_set(GITERR_ODB, "Failed to inflate disk object.");
+		return -1;
+	}
+
+	stream->done = (error == Z_STREAM_END);
+	stream->size = hdr.size;
+	stream->head_pos = used;
+	stream->head_end = stream->zs.total_out;
+
+	*stream_out = (git_odb_stream *)stream;
+	return 0;
+}
+
 static void loose_backend__free(git_odb_backend *_backend)
 {
 	loose_backend *backend;
@@ -928,7 +1104,9 @@ int git_odb_backend_loose(
 	backend->parent.write = &loose_backend__write;
 	backend->parent.read_prefix = &loose_backend__read_prefix;
 	backend->parent.read_header = &loose_backend__read_header;
+	backend->parent.read_disk_size = &loose_backend__read_disk_size;
 	backend->parent.writestream = &loose_backend__stream;
+	backend->parent.readstream = &loose_backend__readstream;
 	backend->parent.exists = &loose_backend__exists;
 	backend->parent.foreach = &loose_backend__foreach;
 	backend->parent.free = &loose_backend__free;
@@ -5,6 +5,8 @@
  * a Linking Exception. For full terms see the included COPYING file.
  */
 
+#define GIT_ALLOC_SUBSYSTEM GIT_ALLOC_PACK
+
 #include "common.h"
 #include <zlib.h>
 #include "git2/repository.h"
@@ -16,6 +18,7 @@
 #include "sha1_lookup.h"
 #include "mwindow.h"
 #include "pack.h"
+#include "trace.h"
 
 #include "git2/odb_backend.h"
 
@@ -24,6 +27,14 @@ struct pack_backend {
 	git_vector packs;
 	struct git_pack_file *last_found;
 	char *pack_folder;
+
+	/*
+	 * Readers walk `packs` under the read lock; refreshing it takes the
+	 * write lock. Packs are only freed with the backend, so a pack found
+	 * under the lock stays valid after it is released. `last_found` is
+	 * only a hint, read and replaced atomically.
+	 */
+	git_rwlock lock;
 };
 
 struct pack_writepack {
@@ -246,22 +257,24 @@ static int packfile_refresh_all(struct pack_backend *backend)
 	if (backend->pack_folder == NULL)
 		return 0;
 
+	/* the folder may show up later, e.g. when the repository is repacked */
 	if (p_stat(backend->pack_folder, &st) < 0 || !S_ISDIR(st.st_mode))
-		return git_odb__error_notfound("failed to refresh packfiles", NULL);
+		return 0;
 
 	git_buf_sets(&path, backend->pack_folder);
 
+	git_rwlock_wrlock(&backend->lock);
+
 	/* reload all packs */
 	error = git_path_direach(&path, packfile_load__cb, (void *)backend);
+	if (!error)
+		git_vector_sort(&backend->packs);
 
-	git_buf_free(&path);
-
-	if (error < 0)
-		return error;
+	git_rwlock_wrunlock(&backend->lock);
 
-	git_vector_sort(&backend->packs);
+	git_buf_free(&path);
 
-	return 0;
+	return (error < 0) ? error : 0;
 }
 
 static int pack_entry_find_inner(
@@ -284,7 +297,7 @@ static int pack_entry_find_inner(
 			continue;
 
 		if (git_pack_entry_find(e, p, oid, GIT_OID_HEXSZ) == 0) {
-			backend->last_found = p;
+			git__swap(&backend->last_found, p);
 			return 0;
 		}
 	}
@@ -292,20 +305,31 @@ static int pack_entry_find_inner(
 	return -1;
 }
 
-static int pack_entry_find(struct git_pack_entry *e, struct pack_backend *backend, const git_oid *oid)
+static int pack_entry_find_locked(
+	struct git_pack_entry *e,
+	struct pack_backend *backend,
+	const git_oid *oid,
+	struct git_pack_file *last_found)
 {
 	int error;
-	struct git_pack_file *last_found = backend->last_found;
 
-	if (backend->last_found &&
-		git_pack_entry_find(e, backend->last_found, oid, GIT_OID_HEXSZ) == 0)
-		return 0;
+	git_rwlock_rdlock(&backend->lock);
+	error = pack_entry_find_inner(e, backend, oid, last_found);
+	git_rwlock_rdunlock(&backend->lock);
+
+	return error;
+}
+
+static int pack_entry_find(struct git_pack_entry *e, struct pack_backend *backend, const git_oid *oid)
+{
+	int error;
+	struct git_pack_file *last_found = git__load(&backend->last_found);
 
-	if (!pack_entry_find_inner(e, backend, oid, last_found))
+	if (!pack_entry_find_locked(e, backend, oid, last_found))
 		return 0;
 	if ((error = packfile_refresh_all(backend)) < 0)
 		return error;
-	if (!pack_entry_find_inner(e, backend, oid, last_found))
+	if (!pack_entry_find_locked(e, backend, oid, last_found))
 		return 0;
 
 	return git_odb__error_notfound("failed to find pack entry", oid);
@@ -343,7 +367,7 @@ static unsigned pack_entry_find_prefix_inner(
 		if (!error) {
 			if (++found > 1)
 				break;
-			backend->last_found = p;
+			git__swap(&backend->last_found, p);
 		}
 	}
 
@@ -358,13 +382,20 @@ static int pack_entry_find_prefix(
 {
 	unsigned found = 0;
 	int error;
-	struct git_pack_file *last_found = backend->last_found;
+	struct git_pack_file *last_found = git__load(&backend->last_found);
+
+	git_rwlock_rdlock(&backend->lock);
+	found = pack_entry_find_prefix_inner(e, backend, short_oid, len, last_found);
+	git_rwlock_rdunlock(&backend->lock);
 
-	if ((found = pack_entry_find_prefix_inner(e, backend, short_oid, len, last_found)) > 0)
+	if (found > 0)
 		goto cleanup;
 	if ((error = packfile_refresh_all(backend)) < 0)
 		return error;
+
+	git_rwlock_rdlock(&backend->lock);
 	found = pack_entry_find_prefix_inner(e, backend, short_oid, len, last_found);
+	git_rwlock_rdunlock(&backend->lock);
 
 cleanup:
 	if (!found)
@@ -384,34 +415,148 @@ cleanup:
  *
  ***********************************************************/
 
-/*
-int pack_backend__read_header(git_rawobj *obj, git_odb_backend *backend, const git_oid *oid)
+static int pack_backend__read_header(size_t *len_p, git_otype *type_p, git_odb_backend *backend, const git_oid *oid)
+{
+	struct git_pack_entry e;
+	int error;
+
+	assert(len_p && type_p && backend && oid);
+
+	if ((error = pack_entry_find(&e, (struct pack_backend *)backend, oid)) < 0)
+		return error;
+
+	return git_packfile_resolve_header(len_p, type_p, e.p, e.offset);
+}
+
+static int pack_backend__read_disk_size(git_off_t *out, git_odb_backend *backend, const git_oid *oid)
 {
-	pack_location location;
+	struct git_pack_entry e;
+	int error;
+
+	if ((error = pack_entry_find(&e, (struct pack_backend *)backend, oid)) < 0)
+		return error;
 
-	assert(obj && backend && oid);
+	return git_packfile__disk_size(out, e.p, e.offset);
+}
+
+static int pack_backend__locate(git_off_t *out, git_odb_backend *_backend, const git_oid *oid)
+{
+	struct pack_backend *backend = (struct pack_backend *)_backend;
+	struct git_pack_entry e;
+	unsigned int i;
 
-	if (locate_packfile(&location, (struct pack_backend *)backend, oid) < 0)
+	/* only a hint, not worth looking for new packs */
+	if (pack_entry_find_locked(&e, backend, oid, git__load(&backend->last_found)) < 0)
 		return GIT_ENOTFOUND;
 
-	return read_header_packed(obj, &location);
+	git_rwlock_rdlock(&backend->lock);
+	for (i = 0; i < backend->packs.length; ++i)
+		if (git_vector_get(&backend->packs, i) == e.p)
+			break;
+	git_rwlock_rdunlock(&backend->lock);
+
+	/* by pack, in the order they are searched, then by offset */
+	*out = ((git_off_t)i << 40) | e.offset;
+	return 0;
 }
-*/
 
 static int pack_backend__read(void **buffer_p, size_t *len_p, git_otype *type_p, git_odb_backend *backend, const git_oid *oid)
 {
 	struct git_pack_entry e;
 	git_rawobj raw;
 	int error;
+	GIT_TRACE_SPAN(span);
+
+	GIT_TRACE_BEGIN(span);
+
+	if ((error = pack_entry_find(&e, (struct pack_backend *)backend, oid)) < 0) {
+		if (error == GIT_ENOTFOUND)
+			GIT_TRACE_EVENT(GIT_TRACE_ODB_PACK_MISS, 0);
+		return error;
+	}
 
-	if ((error = pack_entry_find(&e, (struct pack_backend *)backend, oid)) < 0 ||
-		(error = git_packfile_unpack(&raw, e.p, &e.offset)) < 0)
+	if ((error = git_packfile_unpack(&raw, e.p, &e.offset)) < 0)
 		return error;
 
 	*buffer_p = raw.data;
 	*len_p = raw.len;
 	*type_p = raw.type;
 
+	GIT_TRACE_END(GIT_TRACE_ODB_PACK_READ, span, raw.len);
+	return 0;
+}
+
+typedef struct {
+	git_odb_stream stream;
+	git_packfile_stream pack;
+	size_t size, total;
+} pack_readstream;
+
+static int pack_backend__readstream_read(git_odb_stream *_stream, char *buffer, size_t len)
+{
+	pack_readstream *stream = (pack_readstream *)_stream;
+	ssize_t read = git_packfile_stream_read(&stream->pack, buffer, min(len, (size_t)INT_MAX));
+
+	if (read < 0)
+		return (int)read;
+
+	stream->total += read;
+
+	if (stream->total > stream->size || (!read && stream->total != stream->size)) {
+		giterr_set(GITERR_ODB, "Packed object has the wrong size");
+		return -1;
+	}
+
+	return (int)read;
+}
+
+static void pack_backend__readstream_free(git_odb_stream *_stream)
+{
+	pack_readstream *stream = (pack_readstream *)_stream;
+
+	git_packfile_stream_free(&stream->pack);
+	git__free(stream);
+}
+
+/*
+ * Objects stored whole are inflated as they are read; deltas need
+ * their base in memory anyway and are left to `git_odb_read`.
+ */
+static int pack_backend__readstream(git_odb_stream **stream_out, git_odb_backend *backend, const git_oid *oid)
+{
+	struct git_pack_entry e;
+	git_mwindow *w_curs = NULL;
+	pack_readstream *stream;
+	git_otype type;
+	size_t size;
+	int error;
+
+	assert(stream_out && backend && oid);
+
+	if ((error = pack_entry_find(&e, (struct pack_backend *)backend, oid)) < 0)
+		return error;
+
+	if ((error = git_packfile_unpack_header(&size, &type, &e.p->mwf, &w_curs, &e.offset)) < 0)
+		return error;
+
+	if (type == GIT_OBJ_OFS_DELTA || type == GIT_OBJ_REF_DELTA)
+		return GIT_PASSTHROUGH;
+
+	stream = git__calloc(1, sizeof(pack_readstream));
+	GITERR_CHECK_ALLOC(stream);
+
+	if (git_packfile_stream_open(&stream->pack, e.p, e.offset) < 0) {
+		git__free(stream);
+		return -1;
+	}
+
+	stream->size = size;
+	stream->stream.backend = backend;
+	stream->stream.mode = GIT_STREAM_RDONLY;
+	stream->stream.read = &pack_backend__readstream_read;
+	stream->stream.free = &pack_backend__readstream_free;
+
+	*stream_out = (git_odb_stream *)stream;
 	return 0;
 }
 
@@ -463,6 +608,7 @@ static int pack_backend__foreach(git_odb_backend *_backend, int (*cb)(git_oid *o
 	int error;
 	struct git_pack_file *p;
 	struct pack_backend *backend;
+	git_vector packs = GIT_VECTOR_INIT;
 	unsigned int i;
 
 	assert(_backend && cb);
@@ -472,12 +618,21 @@ static int pack_backend__foreach(git_odb_backend *_backend, int (*cb)(git_oid *o
 	if ((error = packfile_refresh_all(backend)) < 0)
 		return error;
 
-	git_vector_foreach(&backend->packs, i, p) {
+	/* the callback may read objects and so refresh the pack list */
+	git_rwlock_rdlock(&backend->lock);
+	error = git_vector_dup(&packs, &backend->packs, NULL);
+	git_rwlock_rdunlock(&backend->lock);
+
+	if (error < 0)
+		return error;
+
+	git_vector_foreach(&packs, i, p) {
 		if ((error = git_pack_foreach_entry(p, cb, data)) < 0)
-			return error;
+			break;
 	}
 
-	return 0;
+	git_vector_free(&packs);
+	return (error < 0) ? error : 0;
 }
 
 static int pack_backend__writepack_add(struct git_odb_writepack *_writepack, const void *data, size_t size, git_transfer_progress *stats)
@@ -526,7 +681,7 @@ static int pack_backend__writepack(struct git_odb_writepack **out,
 	GITERR_CHECK_ALLOC(writepack);
 
 	if (git_indexer_stream_new(&writepack->indexer_stream,
-		backend->pack_folder, progress_cb, progress_payload) < 0) {
+		backend->pack_folder, _backend->odb, progress_cb, progress_payload) < 0) {
 		git__free(writepack);
 		return -1;
 	}
@@ -556,6 +711,7 @@ static void pack_backend__free(git_odb_backend *_backend)
 	}
 
 	git_vector_free(&backend->packs);
+	git_rwlock_free(&backend->lock);
 	git__free(backend->pack_folder);
 	git__free(backend);
 }
@@ -574,12 +730,17 @@ int git_odb_backend_one_pack(git_odb_backend **backend_out, const char *idx)
 	if (git_vector_init(&backend->packs, 1, NULL) < 0)
 		goto on_error;
 
+	git_rwlock_init(&backend->lock);
+
 	if (git_vector_insert(&backend->packs, packfile) < 0)
 		goto on_error;
 
 	backend->parent.read = &pack_backend__read;
 	backend->parent.read_prefix = &pack_backend__read_prefix;
-	backend->parent.read_header = NULL;
+	backend->parent.read_header = &pack_backend__read_header;
+	backend->parent.readstream = &pack_backend__readstream;
+	backend->parent.read_disk_size = &pack_backend__read_disk_size;
+	backend->parent.locate = &pack_backend__locate;
 	backend->parent.exists = &pack_backend__exists;
 	backend->parent.foreach = &pack_backend__foreach;
 	backend->parent.free = &pack_backend__free;
@@ -591,7 +752,7 @@ int git_odb_backend_one_pack(git_odb_backend **backend_out, const char *idx)
 on_error:
 	git_vector_free(&backend->packs);
 	git__free(backend);
-	git__free(packfile);
+	packfile_free(packfile);
 	return -1;
 }
 
@@ -610,13 +771,16 @@ int git_odb_backend_pack(git_odb_backend **backend_out, const char *objects_dir)
 		return -1;
 	}
 
-	if (git_path_isdir(git_buf_cstr(&path)) == true) {
-		backend->pack_folder = git_buf_detach(&path);
-	}
+	git_rwlock_init(&backend->lock);
+
+	backend->pack_folder = git_buf_detach(&path);
 
 	backend->parent.read = &pack_backend__read;
 	backend->parent.read_prefix = &pack_backend__read_prefix;
-	backend->parent.read_header = NULL;
+	backend->parent.read_header = &pack_backend__read_header;
+	backend->parent.readstream = &pack_backend__readstream;
+	backend->parent.read_disk_size = &pack_backend__read_disk_size;
+	backend->parent.locate = &pack_backend__locate;
 	backend->parent.exists = &pack_backend__exists;
 	backend->parent.foreach = &pack_backend__foreach;
 	backend->parent.writepack = &pack_backend__writepack;
@@ -9,29 +9,44 @@
 
 #include "common.h"
 #include "git2/oid.h"
+#include "hashmap.h"
 
-#define kmalloc git__malloc
-#define kcalloc git__calloc
-#define krealloc git__realloc
-#define kfree git__free
-#include "khash.h"
+GIT_HASHMAP_TYPE(oid, const git_oid *);
+typedef GIT_HASHMAP_T(oid) git_oidmap;
 
-__KHASH_TYPE(oid, const git_oid *, void *);
-typedef khash_t(oid) git_oidmap;
-
-GIT_INLINE(khint_t) hash_git_oid(const git_oid *oid)
+/* The object ids are SHA-1 hashes already, their bytes are used as is */
+GIT_INLINE(uint32_t) git_oidmap_hash(const git_oid *oid)
 {
-	int i;
-	khint_t h = 0;
-	for (i = 0; i < 20; ++i)
-		h = (h << 5) - h + oid->id[i];
+	uint32_t h;
+	memcpy(&h, oid->id, sizeof(h));
 	return h;
 }
 
 #define GIT__USE_OIDMAP \
-	__KHASH_IMPL(oid, static kh_inline, const git_oid *, void *, 1, hash_git_oid, git_oid_equal)
+	GIT_HASHMAP_IMPL(oid, static git_hashmap_inline, const git_oid *, git_oidmap_hash, git_oid_equal)
+
+#define git_oidmap_alloc()  git_hashmap_oid_init()
+#define git_oidmap_free(h)  git_hashmap_oid_destroy(h), h = NULL
+#define git_oidmap_clear(h) git_hashmap_oid_clear(h)
+
+#define git_oidmap_num_entries(h) git_hashmap_size(h)
+
+#define git_oidmap_lookup_index(h, k)  git_hashmap_oid_get(h, k)
+#define git_oidmap_valid_index(h, idx) (idx != git_hashmap_end(h))
+
+#define git_oidmap_exists(h, k) (git_hashmap_oid_get(h, k) != git_hashmap_end(h))
+
+#define git_oidmap_value_at(h, idx)        git_hashmap_val(h, idx)
+#define git_oidmap_set_value_at(h, idx, v) git_hashmap_val(h, idx) = v
+#define git_oidmap_delete_at(h, idx)       git_hashmap_oid_del(h, idx)
+
+#define git_oidmap_insert(h, key, val, rval) do { \
+	git_hashmap_iter __pos = git_hashmap_oid_put(h, key, &rval); \
+	if (rval >= 0) { \
+		if (rval == 0) git_hashmap_key(h, __pos) = key; \
+		git_hashmap_val(h, __pos) = val; \
+	} } while (0)
 
-#define git_oidmap_alloc() kh_init(oid)
-#define git_oidmap_free(h) kh_destroy(oid,h), h = NULL
+#define git_oidmap_foreach_value git_hashmap_foreach_value
 
 #endif
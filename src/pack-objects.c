@@ -5,6 +5,8 @@
  * a Linking Exception. For full terms see the included COPYING file.
  */
 
+#define GIT_ALLOC_SUBSYSTEM GIT_ALLOC_PACK
+
 #include "pack-objects.h"
 
 #include "compress.h"
@@ -145,30 +147,25 @@ void git_packbuilder_set_threads(git_packbuilder *pb, unsigned int n)
 static void rehash(git_packbuilder *pb)
 {
 	git_pobject *po;
-	khiter_t pos;
 	unsigned int i;
 	int ret;
 
-	kh_clear(oid, pb->object_ix);
-	for (i = 0, po = pb->object_list; i < pb->nr_objects; i++, po++) {
-		pos = kh_put(oid, pb->object_ix, &po->id, &ret);
-		kh_value(pb->object_ix, pos) = po;
-	}
+	git_oidmap_clear(pb->object_ix);
+	for (i = 0, po = pb->object_list; i < pb->nr_objects; i++, po++)
+		git_oidmap_insert(pb->object_ix, &po->id, po, ret);
 }
 
 int git_packbuilder_insert(git_packbuilder *pb, const git_oid *oid,
 			   const char *name)
 {
 	git_pobject *po;
-	khiter_t pos;
 	int ret;
 
 	assert(pb && oid);
 
 	/* If the object already exists in the hash table, then we don't
 	 * have any work to do */
-	pos = kh_get(oid, pb->object_ix, oid);
-	if (pos != kh_end(pb->object_ix))
+	if (git_oidmap_exists(pb->object_ix, oid))
 		return 0;
 
 	if (pb->nr_objects >= pb->nr_alloc) {
@@ -189,48 +186,13 @@ int git_packbuilder_insert(git_packbuilder *pb, const git_oid *oid,
 	git_oid_cpy(&po->id, oid);
 	po->hash = name_hash(name);
 
-	pos = kh_put(oid, pb->object_ix, &po->id, &ret);
+	git_oidmap_insert(pb->object_ix, &po->id, po, ret);
 	assert(ret != 0);
-	kh_value(pb->object_ix, pos) = po;
 
 	pb->done = false;
 	return 0;
 }
 
-/*
- * The per-object header is a pretty dense thing, which is
- *  - first byte: low four bits are "size",
- *    then three bits of "type",
- *    with the high bit being "size continues".
- *  - each byte afterwards: low seven bits are size continuation,
- *    with the high bit being "size continues"
- */
-static int gen_pack_object_header(
-		unsigned char *hdr,
-		unsigned long size,
-		git_otype type)
-{
-	unsigned char *hdr_base;
-	unsigned char c;
-
-	assert(type >= GIT_OBJ_COMMIT && type <= GIT_OBJ_REF_DELTA);
-
-	/* TODO: add support for chunked objects; see git.git 6c0d19b1 */
-
-	c = (unsigned char)((type << 4) | (size & 15));
-	size >>= 4;
-	hdr_base = hdr;
-
-	while (size) {
-		*hdr++ = c | 0x80;
-		c = size & 0x7f;
-		size >>= 7;
-	}
-	*hdr++ = c;
-
-	return hdr - hdr_base;
-}
-
 static int get_delta(void **out, git_odb *odb, git_pobject *po)
 {
 	git_odb_object *src = NULL, *trg = NULL;
@@ -274,7 +236,15 @@ static int write_object(git_buf *buf, git_packbuilder *pb, git_pobject *po)
 	unsigned long size;
 	void *data;
 
-	if (po->delta) {
+	if (po->reuse_pack) {
+		/* the compressed delta is copied as it is */
+		if (git_packfile__raw_data(&zbuf, po->reuse_pack,
+				po->reuse_offset, po->reuse_data) < 0)
+			goto on_error;
+		data = NULL;
+		size = po->delta_size;
+		type = GIT_OBJ_REF_DELTA;
+	} else if (po->delta) {
 		if (po->delta_data)
 			data = po->delta_data;
 		else if (get_delta(&data, pb->odb, po) < 0)
@@ -291,7 +261,7 @@ static int write_object(git_buf *buf, git_packbuilder *pb, git_pobject *po)
 	}
 
 	/* Write header */
-	hdr_len = gen_pack_object_header(hdr, size, type);
+	hdr_len = git_packfile__object_header(hdr, size, type);
 
 	if (git_buf_put(buf, (char *)hdr, hdr_len) < 0)
 		goto on_error;
@@ -306,7 +276,10 @@ static int write_object(git_buf *buf, git_packbuilder *pb, git_pobject *po)
 	}
 
 	/* Write data */
-	if (po->z_delta_size)
+	if (po->reuse_pack) {
+		data = zbuf.ptr;
+		size = zbuf.size;
+	} else if (po->z_delta_size)
 		size = po->z_delta_size;
 	else if (git__compress(&zbuf, data, size) < 0)
 		goto on_error;
@@ -362,6 +335,7 @@ static int write_one(git_buf *buf, git_packbuilder *pb, git_pobject *po,
 		case WRITE_ONE_RECURSIVE:
 			/* we cannot depend on this one */
 			po->delta = NULL;
+			po->reuse_pack = NULL;
 			break;
 		default:
 			break;
@@ -438,15 +412,15 @@ static int cb_tag_foreach(const char *name, git_oid *oid, void *data)
 {
 	git_packbuilder *pb = data;
 	git_pobject *po;
-	khiter_t pos;
+	git_hashmap_iter pos;
 
 	GIT_UNUSED(name);
 
-	pos = kh_get(oid, pb->object_ix, oid);
-	if (pos == kh_end(pb->object_ix))
+	pos = git_oidmap_lookup_index(pb->object_ix, oid);
+	if (!git_oidmap_valid_index(pb->object_ix, pos))
 		return 0;
 
-	po = kh_value(pb->object_ix, pos);
+	po = git_oidmap_value_at(pb->object_ix, pos);
 	po->tagged = 1;
 
 	/* TODO: peel objects */
@@ -1211,6 +1185,10 @@ static int prepare_pack(git_packbuilder *pb)
 		if (po->size < 50 || po->size > pb->big_file_threshold)
 			continue;
 
+		/* The delta was reused from an existing pack */
+		if (po->delta)
+			continue;
+
 		delta_list[n++] = po;
 	}
 
@@ -1229,6 +1207,59 @@ static int prepare_pack(git_packbuilder *pb)
 	return 0;
 }
 
+int git_packbuilder__reuse_deltas(git_packbuilder *pb, git_vector *packs)
+{
+	struct git_pack_entry e;
+	struct git_pack_file *p = NULL;
+	git_pobject *po;
+	git_hashmap_iter pos;
+	git_oid base;
+	git_off_t data_offset;
+	size_t delta_size;
+	unsigned int i, j;
+	int error;
+
+	/*
+	 * Every object is taken from the first pack which has it. As a
+	 * delta's base is in the same pack, a chain of reused deltas can
+	 * only go back to earlier packs and so never loops.
+	 */
+	for (i = 0; i < pb->nr_objects; ++i) {
+		po = pb->object_list + i;
+		if (po->delta)
+			continue;
+
+		for (j = 0; j < packs->length; ++j) {
+			p = git_vector_get(packs, j);
+			if (git_pack_entry_find(&e, p, &po->id, GIT_OID_HEXSZ) == 0)
+				break;
+		}
+
+		giterr_clear();
+		if (j == packs->length)
+			continue;
+
+		error = git_packfile__delta_info(
+			&base, &delta_size, &data_offset, p, e.offset);
+		if (error == GIT_ENOTFOUND)
+			continue;
+		if (error < 0)
+			return error;
+
+		pos = git_oidmap_lookup_index(pb->object_ix, &base);
+		if (!git_oidmap_valid_index(pb->object_ix, pos))
+			continue;
+
+		po->delta = git_oidmap_value_at(pb->object_ix, pos);
+		po->delta_size = (unsigned long)delta_size;
+		po->reuse_pack = p;
+		po->reuse_offset = e.offset;
+		po->reuse_data = data_offset;
+	}
+
+	return 0;
+}
+
 #define PREPARE_PACK if (prepare_pack(pb) < 0) { return -1; }
 
 int git_packbuilder_send(git_packbuilder *pb, gitno_socket *s)
@@ -14,6 +14,7 @@
 #include "hash.h"
 #include "oidmap.h"
 #include "netops.h"
+#include "vector.h"
 
 #include "git2/oid.h"
 
@@ -42,6 +43,11 @@ typedef struct git_pobject {
 	unsigned long delta_size;
 	unsigned long z_delta_size;
 
+	/* the pack whose copy of the delta is written out, if reused */
+	struct git_pack_file *reuse_pack;
+	git_off_t reuse_offset;
+	git_off_t reuse_data;
+
 	int written:1,
 	    recursing:1,
 	    tagged:1,
@@ -85,4 +91,11 @@ struct git_packbuilder {
 int git_packbuilder_send(git_packbuilder *pb, gitno_socket *s);
 int git_packbuilder_write_buf(git_buf *buf, git_packbuilder *pb);
 
+/*
+ * Keep the deltas the objects have in `packs` when their base is being
+ * packed too, rather than looking for new ones; the packs must stay
+ * open until the pack is written.
+ */
+int git_packbuilder__reuse_deltas(git_packbuilder *pb, git_vector *packs);
+
 #endif /* INCLUDE_pack_objects_h__ */
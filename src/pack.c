@@ -5,6 +5,8 @@
  * a Linking Exception. For full terms see the included COPYING file.
  */
 
+#define GIT_ALLOC_SUBSYSTEM GIT_ALLOC_PACK
+
 #include "common.h"
 #include "odb.h"
 #include "pack.h"
@@ -12,12 +14,14 @@
 #include "sha1_lookup.h"
 #include "mwindow.h"
 #include "fileops.h"
+#include "trace.h"
 
 #include "git2/oid.h"
 #include <zlib.h>
 
 static int packfile_open(struct git_pack_file *p);
 static git_off_t nth_packed_object_offset(const struct git_pack_file *p, uint32_t n);
+static void pack_revindex_free(struct git_pack_file *p);
 int packfile_unpack_compressed(
 		git_rawobj *obj,
 		struct git_pack_file *p,
@@ -165,7 +169,8 @@ static int pack_index_check(const char *path, struct git_pack_file *p)
 	return 0;
 }
 
-static int pack_index_open(struct git_pack_file *p)
+/* the caller must hold the pack lock */
+static int pack_index_open_locked(struct git_pack_file *p)
 {
 	char *idx_name;
 	int error;
@@ -189,13 +194,24 @@ static int pack_index_open(struct git_pack_file *p)
 	return error;
 }
 
+static int pack_index_open(struct git_pack_file *p)
+{
+	int error;
+
+	git_mutex_lock(&p->lock);
+	error = pack_index_open_locked(p);
+	git_mutex_unlock(&p->lock);
+
+	return error;
+}
+
 static unsigned char *pack_window_open(
 		struct git_pack_file *p,
 		git_mwindow **w_cursor,
 		git_off_t offset,
 		unsigned int *left)
 {
-	if (p->mwf.fd == -1 && packfile_open(p) < 0)
+	if (packfile_open(p) < 0)
 		return NULL;
 
 	/* Since packfiles end in a hash of their content and it's
@@ -277,6 +293,43 @@ int git_packfile_unpack_header(
 	return 0;
 }
 
+/*
+ * The per-object header is a pretty dense thing, which is
+ *  - first byte: low four bits are "size",
+ *    then three bits of "type",
+ *    with the high bit being "size continues".
+ *  - each byte afterwards: low seven bits are size continuation,
+ *    with the high bit being "size continues"
+ */
+int git_packfile__object_header(unsigned char *hdr, unsigned long size, git_otype type)
+{
+	unsigned char *hdr_base;
+	unsigned char c;
+
+	assert(type >= GIT_OBJ_COMMIT && type <= GIT_OBJ_REF_DELTA);
+
+	/* TODO: add support for chunked objects; see git.git 6c0d19b1 */
+
+	c = (unsigned char)((type << 4) | (size & 15));
+	size >>= 4;
+	hdr_base = hdr;
+
+	while (size) {
+		*hdr++ = c | 0x80;
+		c = size & 0x7f;
+		size >>= 7;
+	}
+	*hdr++ = c;
+
+	return (int)(hdr - hdr_base);
+}
+
+static int packfile_unpack(
+	git_rawobj *obj,
+	struct git_pack_file *p,
+	git_off_t *obj_offset,
+	size_t *chain_len);
+
 static int packfile_unpack_delta(
 		git_rawobj *obj,
 		struct git_pack_file *p,
@@ -284,7 +337,8 @@ static int packfile_unpack_delta(
 		git_off_t *curpos,
 		size_t delta_size,
 		git_otype delta_type,
-		git_off_t obj_offset)
+		git_off_t obj_offset,
+		size_t *chain_len)
 {
 	git_off_t base_offset;
 	git_rawobj base, delta;
@@ -297,7 +351,8 @@ static int packfile_unpack_delta(
 	if (base_offset < 0) /* must actually be an error code */
 		return (int)base_offset;
 
-	error = git_packfile_unpack(&base, p, &base_offset);
+	(*chain_len)++;
+	error = packfile_unpack(&base, p, &base_offset, chain_len);
 
 	/*
 	 * TODO: git.git tries to load the base from other packfiles
@@ -327,10 +382,11 @@ static int packfile_unpack_delta(
 	return error; /* error set by git__delta_apply */
 }
 
-int git_packfile_unpack(
+static int packfile_unpack(
 	git_rawobj *obj,
 	struct git_pack_file *p,
-	git_off_t *obj_offset)
+	git_off_t *obj_offset,
+	size_t *chain_len)
 {
 	git_mwindow *w_curs = NULL;
 	git_off_t curpos = *obj_offset;
@@ -358,7 +414,7 @@ int git_packfile_unpack(
 	case GIT_OBJ_REF_DELTA:
 		error = packfile_unpack_delta(
 				obj, p, &w_curs, &curpos,
-				size, type, *obj_offset);
+				size, type, *obj_offset, chain_len);
 		break;
 
 	case GIT_OBJ_COMMIT:
@@ -379,6 +435,20 @@ int git_packfile_unpack(
 	return error;
 }
 
+int git_packfile_unpack(
+	git_rawobj *obj,
+	struct git_pack_file *p,
+	git_off_t *obj_offset)
+{
+	size_t chain_len = 0;
+	int error = packfile_unpack(obj, p, obj_offset, &chain_len);
+
+	if (!error && chain_len > 0)
+		GIT_TRACE_EVENT(GIT_TRACE_DELTA_CHAIN, chain_len);
+
+	return error;
+}
+
 static void *use_git_alloc(void *opaq, unsigned int count, unsigned int size)
 {
 	GIT_UNUSED(opaq);
@@ -402,6 +472,9 @@ int packfile_unpack_compressed(
 	int st;
 	z_stream stream;
 	unsigned char *buffer, *in;
+	GIT_TRACE_SPAN(span);
+
+	GIT_TRACE_BEGIN(span);
 
 	buffer = git__calloc(1, size + 1);
 	GITERR_CHECK_ALLOC(buffer);
@@ -449,9 +522,125 @@ int packfile_unpack_compressed(
 	obj->type = type;
 	obj->len = size;
 	obj->data = buffer;
+
+	GIT_TRACE_END(GIT_TRACE_INFLATE, span, size);
+	return 0;
+}
+
+int git_packfile_resolve_header(
+	size_t *size_p, git_otype *type_p, struct git_pack_file *p, git_off_t offset)
+{
+	git_mwindow *w_curs = NULL;
+	git_packfile_stream stream;
+	git_off_t curpos, base_offset = offset;
+	unsigned char delta_head[20];
+	size_t size, base_size, head_len = 0;
+	git_otype type;
+	ssize_t read = 0;
+	bool first = true;
+	int error;
+
+	for (;;) {
+		curpos = base_offset;
+		if ((error = git_packfile_unpack_header(&size, &type, &p->mwf, &w_curs, &curpos)) < 0)
+			return error;
+
+		if (type != GIT_OBJ_OFS_DELTA && type != GIT_OBJ_REF_DELTA)
+			break;
+
+		offset = base_offset;
+		base_offset = get_delta_base(p, &w_curs, &curpos, type, offset);
+		git_mwindow_close(&w_curs);
+
+		if (base_offset == 0)
+			return packfile_error("delta offset is zero");
+		if (base_offset < 0)
+			return (int)base_offset;
+
+		if (!first)
+			continue;
+
+		/* the size of the result is at the start of the delta */
+		if ((error = git_packfile_stream_open(&stream, p, curpos)) < 0)
+			return error;
+
+		while (head_len < sizeof(delta_head) &&
+			(read = git_packfile_stream_read(&stream,
+				delta_head + head_len, sizeof(delta_head) - head_len)) > 0)
+			head_len += read;
+
+		git_packfile_stream_free(&stream);
+
+		if (read < 0 || git__delta_read_header(
+				&base_size, size_p, delta_head, head_len) < 0)
+			return -1;
+
+		first = false;
+	}
+
+	if (first)
+		*size_p = size;
+
+	*type_p = type;
+	return 0;
+}
+
+int git_packfile_stream_open(
+	git_packfile_stream *obj, struct git_pack_file *p, git_off_t curpos)
+{
+	memset(obj, 0, sizeof(git_packfile_stream));
+	obj->p = p;
+	obj->curpos = curpos;
+	obj->zstream.zalloc = use_git_alloc;
+	obj->zstream.zfree = use_git_free;
+
+	if (inflateInit(&obj->zstream) != Z_OK) {
+		giterr_set(GITERR_ZLIB, "Failed to inflate packfile");
+		return -1;
+	}
+
 	return 0;
 }
 
+ssize_t git_packfile_stream_read(
+	git_packfile_stream *obj, void *buffer, size_t len)
+{
+	unsigned char *in;
+	uInt want = (uInt)min(len, (size_t)UINT_MAX);
+	int st;
+
+	obj->zstream.next_out = buffer;
+	obj->zstream.avail_out = want;
+
+	/* a window may end in the middle of the stream, or give too
+	 * little input for any output; go on until some comes out */
+	while (!obj->done && want && obj->zstream.avail_out == want) {
+		in = pack_window_open(obj->p, &obj->mw, obj->curpos, &obj->zstream.avail_in);
+		if (in == NULL)
+			return packfile_error("truncated object");
+
+		obj->zstream.next_in = in;
+		st = inflate(&obj->zstream, Z_NO_FLUSH);
+		git_mwindow_close(&obj->mw);
+
+		obj->curpos += obj->zstream.next_in - in;
+
+		if (st == Z_STREAM_END)
+			obj->done = true;
+		else if (st != Z_OK) {
+			giterr_set(GITERR_ZLIB, "Failed to inflate packfile");
+			return -1;
+		}
+	}
+
+	return (ssize_t)(want - obj->zstream.avail_out);
+}
+
+void git_packfile_stream_free(git_packfile_stream *obj)
+{
+	inflateEnd(&obj->zstream);
+}
+
 /*
  * curpos is where the data starts, delta_obj_offset is the where the
  * header starts
@@ -467,6 +656,7 @@ git_off_t get_delta_base(
 	unsigned char *base_info;
 	git_off_t base_offset;
 	git_oid unused;
+	uint32_t pos;
 
 	base_info = pack_window_open(p, w_curs, *curpos, &left);
 	/* Assumption: the only reason this would fail is because the file is too small */
@@ -494,6 +684,10 @@ git_off_t get_delta_base(
 		base_offset = delta_obj_offset - base_offset;
 		if (base_offset <= 0 || base_offset >= delta_obj_offset)
 			return 0; /* out of bound */
+		/* with a reverse index at hand, the base must start an object */
+		if ((p->revindex || p->revindex_map.data) &&
+			git_packfile__revindex_pos(&pos, p, base_offset) < 0)
+			return 0;
 		*curpos += used;
 	} else if (type == GIT_OBJ_REF_DELTA) {
 		/* If we have the cooperative cache, search in it first */
@@ -527,8 +721,10 @@ git_off_t get_delta_base(
 static struct git_pack_file *packfile_alloc(size_t extra)
 {
 	struct git_pack_file *p = git__calloc(1, sizeof(*p) + extra);
-	if (p != NULL)
+	if (p != NULL) {
 		p->mwf.fd = -1;
+		git_mutex_init(&p->lock);
+	}
 	return p;
 }
 
@@ -545,12 +741,16 @@ void packfile_free(struct git_pack_file *p)
 		p_close(p->mwf.fd);
 
 	pack_index_free(p);
+	pack_revindex_free(p);
 
 	git__free(p->bad_object_sha1);
+
+	git_mutex_free(&p->lock);
 	git__free(p);
 }
 
-static int packfile_open(struct git_pack_file *p)
+/* the caller must hold the pack lock */
+static int packfile_open_locked(struct git_pack_file *p)
 {
 	struct stat st;
 	struct git_pack_header hdr;
@@ -559,7 +759,7 @@ static int packfile_open(struct git_pack_file *p)
 
 	assert(p->index_map.data);
 
-	if (!p->index_map.data && pack_index_open(p) < 0)
+	if (!p->index_map.data && pack_index_open_locked(p) < 0)
 		return git_odb__error_notfound("failed to open packfile", NULL);
 
 	/* TODO: open with noatime */
@@ -616,6 +816,18 @@ cleanup:
 	return -1;
 }
 
+static int packfile_open(struct git_pack_file *p)
+{
+	int error = 0;
+
+	git_mutex_lock(&p->lock);
+	if (p->mwf.fd == -1)
+		error = packfile_open_locked(p);
+	git_mutex_unlock(&p->lock);
+
+	return error;
+}
+
 int git_packfile_check(struct git_pack_file **pack_out, const char *path)
 {
 	struct stat st;
@@ -633,7 +845,7 @@ int git_packfile_check(struct git_pack_file **pack_out, const char *path)
 	 */
 	path_len -= strlen(".idx");
 	if (path_len < 1) {
-		git__free(p);
+		packfile_free(p);
 		return git_odb__error_notfound("invalid packfile path", NULL);
 	}
 
@@ -645,7 +857,7 @@ int git_packfile_check(struct git_pack_file **pack_out, const char *path)
 
 	strcpy(p->pack_name + path_len, ".pack");
 	if (p_stat(p->pack_name, &st) < 0 || !S_ISREG(st.st_mode)) {
-		git__free(p);
+		packfile_free(p);
 		return git_odb__error_notfound("packfile not found", NULL);
 	}
 
@@ -690,6 +902,306 @@ static git_off_t nth_packed_object_offset(const struct git_pack_file *p, uint32_
 	}
 }
 
+/***********************************************************
+ *
+ * PACKFILE REVERSE INDEX
+ *
+ ***********************************************************/
+
+static void pack_revindex_free(struct git_pack_file *p)
+{
+	git__free(p->revindex);
+	p->revindex = NULL;
+
+	if (p->revindex_map.data) {
+		git_futils_mmap_free(&p->revindex_map);
+		p->revindex_map.data = NULL;
+	}
+}
+
+/* the caller must hold the pack lock */
+static int pack_revindex_map(struct git_pack_file *p)
+{
+	git_buf path = GIT_BUF_INIT;
+	struct git_pack_rev_header *hdr;
+	const unsigned char *pack_sha1, *idx_pack_sha1;
+	const uint32_t *positions;
+	struct stat st;
+	git_file fd;
+	uint32_t i;
+	int error;
+
+	if (git_buf_put(&path, p->pack_name, strlen(p->pack_name) - strlen(".pack")) < 0 ||
+		git_buf_puts(&path, ".rev") < 0)
+		return -1;
+
+	fd = git_futils_open_ro(path.ptr);
+	git_buf_free(&path);
+	if (fd < 0)
+		return fd;
+
+	if (p_fstat(fd, &st) < 0 ||
+		st.st_size != (git_off_t)(sizeof(*hdr) + 4 * (size_t)p->num_objects + 20 + 20)) {
+		p_close(fd);
+		return packfile_error("wrong reverse index size");
+	}
+
+	error = git_futils_mmap_ro(&p->revindex_map, fd, 0, (size_t)st.st_size);
+	p_close(fd);
+
+	if (error < 0) {
+		p->revindex_map.data = NULL;
+		return error;
+	}
+
+	hdr = p->revindex_map.data;
+	pack_sha1 = (unsigned char *)p->revindex_map.data + p->revindex_map.len - 40;
+	idx_pack_sha1 = (unsigned char *)p->index_map.data + p->index_map.len - 40;
+
+	if (hdr->rev_signature != htonl(PACK_REV_SIGNATURE) ||
+		hdr->rev_version != htonl(PACK_REV_VERSION) ||
+		hdr->rev_hash_id != htonl(PACK_REV_HASH_SHA1) ||
+		memcmp(pack_sha1, idx_pack_sha1, GIT_OID_RAWSZ) != 0) {
+		git_futils_mmap_free(&p->revindex_map);
+		p->revindex_map.data = NULL;
+		return packfile_error("reverse index does not match the pack");
+	}
+
+	/* lookups index the pack's index with these */
+	positions = (const uint32_t *)(hdr + 1);
+	for (i = 0; i < p->num_objects; ++i) {
+		if (ntohl(positions[i]) >= p->num_objects) {
+			git_futils_mmap_free(&p->revindex_map);
+			p->revindex_map.data = NULL;
+			return packfile_error("corrupt reverse index");
+		}
+	}
+
+	return 0;
+}
+
+struct revindex_entry {
+	git_off_t offset;
+	uint32_t pos;
+};
+
+static int revindex_entry_cmp(const void *a, const void *b)
+{
+	const struct revindex_entry *entrya = a;
+	const struct revindex_entry *entryb = b;
+
+	return entrya->offset < entryb->offset ? -1 : entrya->offset > entryb->offset;
+}
+
+/* the caller must hold the pack lock */
+static int pack_revindex_build(struct git_pack_file *p)
+{
+	struct revindex_entry *entries;
+	size_t alloc = p->num_objects ? p->num_objects : 1; /* even if empty */
+	uint32_t i;
+
+	entries = git__malloc(alloc * sizeof(struct revindex_entry));
+	GITERR_CHECK_ALLOC(entries);
+
+	for (i = 0; i < p->num_objects; ++i) {
+		entries[i].offset = nth_packed_object_offset(p, i);
+		entries[i].pos = i;
+	}
+
+	qsort(entries, p->num_objects, sizeof(struct revindex_entry), revindex_entry_cmp);
+
+	p->revindex = git__malloc(alloc * sizeof(uint32_t));
+	if (p->revindex != NULL) {
+		for (i = 0; i < p->num_objects; ++i)
+			p->revindex[i] = entries[i].pos;
+	}
+
+	git__free(entries);
+	GITERR_CHECK_ALLOC(p->revindex);
+	return 0;
+}
+
+static int pack_revindex_open(struct git_pack_file *p)
+{
+	int error;
+
+	if ((error = pack_index_open(p)) < 0)
+		return error;
+
+	git_mutex_lock(&p->lock);
+	if (p->revindex == NULL && p->revindex_map.data == NULL) {
+		/* without a usable .rev file (missing, stale or corrupt),
+		 * sort the offsets in the index like core git does */
+		if ((error = pack_revindex_map(p)) < 0) {
+			giterr_clear();
+			error = pack_revindex_build(p);
+		}
+	}
+	git_mutex_unlock(&p->lock);
+
+	return error;
+}
+
+GIT_INLINE(uint32_t) revindex_nth(const struct git_pack_file *p, uint32_t n)
+{
+	const uint32_t *positions;
+
+	if (p->revindex)
+		return p->revindex[n];
+
+	positions = (const uint32_t *)((const char *)p->revindex_map.data +
+		sizeof(struct git_pack_rev_header));
+	return ntohl(positions[n]);
+}
+
+int git_packfile__revindex_pos(uint32_t *pos, struct git_pack_file *p, git_off_t offset)
+{
+	uint32_t lo = 0, hi, mid;
+	git_off_t mid_offset;
+	int error;
+
+	if ((error = pack_revindex_open(p)) < 0)
+		return error;
+
+	hi = p->num_objects;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		mid_offset = nth_packed_object_offset(p, revindex_nth(p, mid));
+
+		if (mid_offset == offset) {
+			*pos = mid;
+			return 0;
+		}
+
+		if (mid_offset < offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return packfile_error("no object starts at the given offset");
+}
+
+int git_packfile__disk_size(git_off_t *out, struct git_pack_file *p, git_off_t offset)
+{
+	uint32_t pos;
+	git_off_t next;
+	int error;
+
+	if ((error = git_packfile__revindex_pos(&pos, p, offset)) < 0)
+		return error;
+
+	/* up to the next object, or the trailer after the last one */
+	if (pos + 1 < p->num_objects)
+		next = nth_packed_object_offset(p, revindex_nth(p, pos + 1));
+	else
+		next = p->mwf.size - GIT_OID_RAWSZ;
+
+	*out = next - offset;
+	return 0;
+}
+
+static void nth_packed_object_id(git_oid *out, const struct git_pack_file *p, uint32_t n)
+{
+	const unsigned char *index = p->index_map.data;
+
+	if (p->index_version > 1)
+		git_oid_fromraw(out, index + 8 + 4 * 256 + 20 * n);
+	else
+		git_oid_fromraw(out, index + 4 * 256 + 24 * n + 4);
+}
+
+int git_packfile__delta_info(
+	git_oid *base,
+	size_t *delta_size,
+	git_off_t *data_offset,
+	struct git_pack_file *p,
+	git_off_t offset)
+{
+	git_mwindow *w_curs = NULL;
+	git_off_t curpos = offset, base_offset;
+	git_otype type;
+	size_t size;
+	uint32_t pos;
+	int error;
+
+	if ((error = git_packfile_unpack_header(&size, &type, &p->mwf, &w_curs, &curpos)) < 0)
+		return error;
+
+	if (type != GIT_OBJ_OFS_DELTA && type != GIT_OBJ_REF_DELTA)
+		return GIT_ENOTFOUND;
+
+	base_offset = get_delta_base(p, &w_curs, &curpos, type, offset);
+	git_mwindow_close(&w_curs);
+
+	if (base_offset == 0)
+		return packfile_error("delta offset is zero");
+	if (base_offset < 0)
+		return (int)base_offset;
+
+	if ((error = git_packfile__revindex_pos(&pos, p, base_offset)) < 0)
+		return error;
+
+	nth_packed_object_id(base, p, revindex_nth(p, pos));
+	*delta_size = size;
+	*data_offset = curpos;
+	return 0;
+}
+
+int git_packfile__raw_data(
+	git_buf *out,
+	struct git_pack_file *p,
+	git_off_t offset,
+	git_off_t data_offset)
+{
+	git_mwindow *w_curs = NULL;
+	git_off_t end, curpos;
+	uLong crc = crc32(0L, Z_NULL, 0);
+	const uint32_t *crcs;
+	unsigned char *data;
+	unsigned int left;
+	size_t len, skip;
+	uint32_t pos, n;
+	int error;
+
+	if ((error = git_packfile__revindex_pos(&pos, p, offset)) < 0 ||
+		(error = git_packfile__disk_size(&end, p, offset)) < 0)
+		return error;
+
+	end += offset;
+	for (curpos = offset; curpos < end; curpos += len) {
+		if ((data = pack_window_open(p, &w_curs, curpos, &left)) == NULL)
+			return packfile_error("object data is out of bounds");
+
+		len = (size_t)min((git_off_t)left, end - curpos);
+		skip = curpos < data_offset ? (size_t)min((git_off_t)len, data_offset - curpos) : 0;
+		crc = crc32(crc, data, (uInt)len);
+
+		error = git_buf_put(out, (char *)data + skip, len - skip);
+		git_mwindow_close(&w_curs);
+
+		if (error < 0)
+			return error;
+	}
+
+	/* version 2 indexes have the CRC of every object after the ids */
+	if (p->index_version > 1) {
+		n = revindex_nth(p, pos);
+		crcs = (const uint32_t *)((const unsigned char *)p->index_map.data +
+			8 + 4 * 256 + 20 * p->num_objects);
+
+		if (ntohl(crcs[n]) != (uint32_t)crc)
+			return packfile_error("packed object is corrupted");
+	}
+
+	return 0;
+}
+
+int git_packfile__index_open(struct git_pack_file *p)
+{
+	return pack_index_open(p);
+}
+
 static int git__memcmp4(const void *a, const void *b) {
 	return memcmp(a, b, 4);
 }
@@ -699,19 +1211,18 @@ int git_pack_foreach_entry(
 	int (*cb)(git_oid *oid, void *data),
 	void *data)
 {
-	const unsigned char *index = p->index_map.data, *current;
+	const unsigned char *index, *current;
+	git_oid **entries;
 	uint32_t i;
+	int error;
 
-	if (index == NULL) {
-		int error;
-
-		if ((error = pack_index_open(p)) < 0)
-			return error;
+	git_mutex_lock(&p->lock);
 
-		assert(p->index_map.data);
+	if ((error = pack_index_open_locked(p)) < 0)
+		goto done;
 
-		index = p->index_map.data;
-	}
+	assert(p->index_map.data);
+	index = p->index_map.data;
 
 	if (p->index_version > 1) {
 		index += 8;
@@ -721,13 +1232,14 @@ int git_pack_foreach_entry(
 
 	if (p->oids == NULL) {
 		git_vector offsets, oids;
-		int error;
 
 		if ((error = git_vector_init(&oids, p->num_objects, NULL)))
-			return error;
+			goto done;
 
-		if ((error = git_vector_init(&offsets, p->num_objects, git__memcmp4)))
-			return error;
+		if ((error = git_vector_init(&offsets, p->num_objects, git__memcmp4))) {
+			git_vector_free(&oids);
+			goto done;
+		}
 
 		if (p->index_version > 1) {
 			const unsigned char *off = index + 24 * p->num_objects;
@@ -747,8 +1259,16 @@ int git_pack_foreach_entry(
 		p->oids = (git_oid **)oids.contents;
 	}
 
+done:
+	entries = p->oids;
+	git_mutex_unlock(&p->lock);
+
+	if (error < 0)
+		return error;
+
+	/* the callback may look up objects in this very pack */
 	for (i = 0; i < p->num_objects; i++)
-		if (cb(p->oids[i], data))
+		if (cb(entries[i], data))
 			return GIT_EUSER;
 
 	return 0;
@@ -761,25 +1281,22 @@ static int pack_entry_find_offset(
 	const git_oid *short_oid,
 	size_t len)
 {
-	const uint32_t *level1_ofs = p->index_map.data;
-	const unsigned char *index = p->index_map.data;
+	const uint32_t *level1_ofs;
+	const unsigned char *index;
 	unsigned hi, lo, stride;
-	int pos, found = 0;
+	int pos, found = 0, error;
 	const unsigned char *current = 0;
 
 	*offset_out = 0;
 
-	if (index == NULL) {
-		int error;
-
-		if ((error = pack_index_open(p)) < 0)
-			return error;
+	/* the index is mapped once and stays mapped until the pack is freed */
+	if ((error = pack_index_open(p)) < 0)
+		return error;
 
-		assert(p->index_map.data);
+	assert(p->index_map.data);
 
-		index = p->index_map.data;
-		level1_ofs = p->index_map.data;
-	}
+	index = p->index_map.data;
+	level1_ofs = p->index_map.data;
 
 	if (p->index_version > 1) {
 		level1_ofs += 2;
@@ -874,7 +1391,7 @@ int git_pack_entry_find(
 	/* we found a unique entry in the index;
 	 * make sure the packfile backing the index
 	 * still exists on disk */
-	if (p->mwf.fd == -1 && (error = packfile_open(p)) < 0)
+	if ((error = packfile_open(p)) < 0)
 		return error;
 
 	e->offset = offset;
@@ -8,9 +8,12 @@
 #ifndef INCLUDE_pack_h__
 #define INCLUDE_pack_h__
 
+#include <zlib.h>
+
 #include "git2/oid.h"
 
 #include "common.h"
+#include "buffer.h"
 #include "map.h"
 #include "mwindow.h"
 #include "odb.h"
@@ -51,10 +54,31 @@ struct git_pack_idx_header {
 	uint32_t idx_version;
 };
 
+/*
+ * The reverse index of a pack, in a .rev file next to its index, lists
+ * the index positions of its objects in the order they are in the pack.
+ * The header is followed by those positions, the checksum of the pack
+ * and the checksum of the file.
+ */
+
+#define PACK_REV_SIGNATURE 0x52494458	/* "RIDX" */
+#define PACK_REV_VERSION 1
+#define PACK_REV_HASH_SHA1 1
+
+struct git_pack_rev_header {
+	uint32_t rev_signature;
+	uint32_t rev_version;
+	uint32_t rev_hash_id;
+};
+
 struct git_pack_file {
 	git_mwindow_file mwf;
 	git_map index_map;
 
+	/* index positions in pack order, from the .rev file or built */
+	git_map revindex_map;
+	uint32_t *revindex;
+
 	uint32_t num_objects;
 	uint32_t num_bad_objects;
 	git_oid *bad_object_sha1; /* array of git_oid */
@@ -66,6 +90,9 @@ struct git_pack_file {
 	git_vector cache;
 	git_oid **oids;
 
+	/* guards lazily opening the index and the packfile, and `oids` */
+	git_mutex lock;
+
 	/* something like ".git/objects/pack/xxxxx.pack" */
 	char pack_name[GIT_FLEX_ARRAY]; /* more */
 };
@@ -76,6 +103,18 @@ struct git_pack_entry {
 	struct git_pack_file *p;
 };
 
+/*
+ * Write the header of an object of `size` bytes to `hdr`, which must
+ * have room for 10 bytes, and return its length.
+ */
+int git_packfile__object_header(unsigned char *hdr, unsigned long size, git_otype type);
+
+/*
+ * How many bytes of delta bases the stream indexer keeps in memory
+ * while resolving deltas; the others are inflated again when needed.
+ */
+extern size_t git_indexer__base_cache_limit;
+
 int git_packfile_unpack_header(
 		size_t *size_p,
 		git_otype *type_p,
@@ -84,6 +123,14 @@ int git_packfile_unpack_header(
 		git_off_t *curpos);
 
 int git_packfile_unpack(git_rawobj *obj, struct git_pack_file *p, git_off_t *obj_offset);
+
+/*
+ * Find the size and type of the object at `offset` without unpacking
+ * it: only the start of a delta is inflated, and its bases' headers
+ * are read for the type.
+ */
+int git_packfile_resolve_header(
+	size_t *size_p, git_otype *type_p, struct git_pack_file *p, git_off_t offset);
 int packfile_unpack_compressed(
 	git_rawobj *obj,
 	struct git_pack_file *p,
@@ -92,6 +139,28 @@ int packfile_unpack_compressed(
 	size_t size,
 	git_otype type);
 
+/*
+ * Inflate the object whose data starts at `curpos` a piece at a time,
+ * for objects too large to be inflated at once; deltas must be
+ * unpacked with `git_packfile_unpack` instead.
+ */
+typedef struct {
+	struct git_pack_file *p;
+	git_mwindow *mw;
+	git_off_t curpos;
+	z_stream zstream;
+	bool done;
+} git_packfile_stream;
+
+int git_packfile_stream_open(
+	git_packfile_stream *obj, struct git_pack_file *p, git_off_t curpos);
+
+/* Returns the number of bytes read, which is 0 at the end, or an error */
+ssize_t git_packfile_stream_read(
+	git_packfile_stream *obj, void *buffer, size_t len);
+
+void git_packfile_stream_free(git_packfile_stream *obj);
+
 git_off_t get_delta_base(struct git_pack_file *p, git_mwindow **w_curs,
 		git_off_t *curpos, git_otype type,
 		git_off_t delta_obj_offset);
@@ -103,6 +172,42 @@ int git_pack_entry_find(
 		struct git_pack_file *p,
 		const git_oid *short_oid,
 		size_t len);
+
+/*
+ * Find the object at `offset` in the reverse index, which is loaded or
+ * built on first use, and store its position in pack order in `pos`.
+ */
+int git_packfile__revindex_pos(uint32_t *pos, struct git_pack_file *p, git_off_t offset);
+
+/* The bytes the object at `offset` takes up in the pack, header included */
+int git_packfile__disk_size(git_off_t *out, struct git_pack_file *p, git_off_t offset);
+
+/*
+ * Find out whether the object at `offset` is stored as a delta: if so,
+ * fill in the id of its base, the size of the delta and where its
+ * compressed data starts; returns GIT_ENOTFOUND for whole objects.
+ */
+int git_packfile__delta_info(
+	git_oid *base,
+	size_t *delta_size,
+	git_off_t *data_offset,
+	struct git_pack_file *p,
+	git_off_t offset);
+
+/*
+ * Append the compressed data of the object at `offset`, which starts
+ * at `data_offset`, to `out` as it is in the pack.  The entry is
+ * checked against the CRC of version 2 indexes.
+ */
+int git_packfile__raw_data(
+	git_buf *out,
+	struct git_pack_file *p,
+	git_off_t offset,
+	git_off_t data_offset);
+
+/* Map the index of `p`, which fills in `num_objects` */
+int git_packfile__index_open(struct git_pack_file *p);
+
 int git_pack_foreach_entry(
 		struct git_pack_file *p,
 		int (*cb)(git_oid *oid, void *data),
@@ -7,6 +7,7 @@
 #include "common.h"
 #include "path.h"
 #include "posix.h"
+#include "scratch.h"
 #ifdef GIT_WIN32
 #include "win32/dir.h"
 #include "win32/posix.h"
@@ -773,45 +774,156 @@ int git_path_with_stat_cmp(const void *a, const void *b)
 	return git__strcmp_cb(psa->path, psb->path);
 }
 
+/*
+ * The file type of a directory entry as `st_mode` bits, or 0 when the
+ * listing does not say and the entry has to be lstat'ed to find out
+ */
+#ifdef GIT_WIN32
+#	define DIRENT_READ(dir, buf, de, mode) \
+	git__readdir_ext(dir, buf, de, mode)
+#else
+/* each listing has a stream of its own, so plain readdir is safe */
+GIT_INLINE(int) dirent_read(DIR *dir, struct dirent **de)
+{
+	errno = 0;
+	*de = readdir(dir);
+	return *de ? 0 : errno;
+}
+#	define DIRENT_READ(dir, buf, de, mode) dirent_read(dir, de)
+#endif
+
+GIT_INLINE(mode_t) dirent_mode(const struct dirent *de, int is_dir)
+{
+#if defined(GIT_WIN32)
+	GIT_UNUSED(de);
+	/* regular files may still be reparse points, so only trust dirs */
+	return is_dir ? S_IFDIR : 0;
+#elif defined(DT_UNKNOWN)
+	GIT_UNUSED(is_dir);
+	switch (de->d_type) {
+	case DT_DIR: return S_IFDIR;
+	case DT_REG: return S_IFREG;
+	case DT_LNK: return S_IFLNK;
+	default:     return 0;
+	}
+#else
+	GIT_UNUSED(de);
+	GIT_UNUSED(is_dir);
+	return 0;
+#endif
+}
+
+int git_path_with_stat_load(git_path_with_stat *ps, const char *full_path)
+{
+	int error;
+
+	if (ps->st_loaded)
+		return 0;
+
+	if ((error = git_path_lstat(full_path, &ps->st)) < 0)
+		return error;
+
+	ps->st_loaded = 1;
+	return 0;
+}
+
 int git_path_dirload_with_stat(
 	const char *path,
 	size_t prefix_len,
+	unsigned int flags,
 	git_vector *contents)
 {
-	int error;
-	unsigned int i;
+	int error = 0, is_dir = 0, need_slash;
+	DIR *dir;
+	struct dirent *de, *de_buf;
+	size_t path_len, entry_len;
 	git_path_with_stat *ps;
 	git_buf full = GIT_BUF_INIT;
 
-	if (git_buf_set(&full, path, prefix_len) < 0)
+	assert(path != NULL && contents != NULL);
+	path_len = strlen(path);
+	assert(path_len > 0 && path_len >= prefix_len);
+
+	if ((dir = opendir(path)) == NULL) {
+		giterr_set(GITERR_OS, "Failed to open directory '%s'", path);
 		return -1;
+	}
 
-	error = git_path_dirload(
-		path, prefix_len, sizeof(git_path_with_stat) + 1, contents);
-	if (error < 0) {
-		git_buf_free(&full);
-		return error;
+	git_scratch__take(&full);
+
+	/* only the Windows listing fills a caller's buffer */
+#ifdef GIT_WIN32
+	if ((de_buf = git__malloc(sizeof(struct dirent))) == NULL) {
+		error = -1;
+		goto cleanup;
+	}
+#else
+	de_buf = NULL;
+#endif
+
+	if (git_buf_set(&full, path, prefix_len) < 0) {
+		error = -1;
+		goto cleanup;
 	}
 
-	git_vector_foreach(contents, i, ps) {
-		size_t path_len = strlen((char *)ps);
+	path += prefix_len;
+	path_len -= prefix_len;
+	need_slash = (path_len > 0 && path[path_len-1] != '/') ? 1 : 0;
+
+	while ((error = DIRENT_READ(dir, de_buf, &de, &is_dir)) == 0 && de != NULL) {
+		if (git_path_is_dot_or_dotdot(de->d_name))
+			continue;
 
-		memmove(ps->path, ps, path_len + 1);
-		ps->path_len = path_len;
+		entry_len = strlen(de->d_name);
 
-		if ((error = git_buf_joinpath(&full, full.ptr, ps->path)) < 0 ||
-			(error = git_path_lstat(full.ptr, &ps->st)) < 0)
+		/* room for a trailing slash and the NUL */
+		ps = git__calloc(1, sizeof(git_path_with_stat) +
+			path_len + need_slash + entry_len + 2);
+		if (!ps) {
+			error = -1;
 			break;
+		}
 
-		git_buf_truncate(&full, prefix_len);
-
-		if (S_ISDIR(ps->st.st_mode)) {
+		if (path_len)
+			memcpy(ps->path, path, path_len);
+		if (need_slash)
 			ps->path[path_len] = '/';
-			ps->path[path_len + 1] = '\0';
+		memcpy(&ps->path[path_len + need_slash], de->d_name, entry_len);
+		ps->path_len = path_len + need_slash + entry_len;
+
+		if ((flags & GIT_PATH_DIRLOAD_DEFER_STAT) != 0)
+			ps->st.st_mode = dirent_mode(de, is_dir);
+
+		if (!ps->st.st_mode) {
+			git_buf_truncate(&full, prefix_len);
+
+			if ((error = git_buf_joinpath(&full, full.ptr, ps->path)) < 0 ||
+				(error = git_path_lstat(full.ptr, &ps->st)) < 0) {
+				git__free(ps);
+				break;
+			}
+
+			ps->st_loaded = 1;
+		}
+
+		if (S_ISDIR(ps->st.st_mode))
+			ps->path[ps->path_len] = '/';
+
+		if ((error = git_vector_insert(contents, ps)) < 0) {
+			git__free(ps);
+			break;
 		}
 	}
 
-	git_buf_free(&full);
+	if (error > 0) {
+		giterr_set(GITERR_OS, "Failed to process directory entry in '%s'", path);
+		error = -1;
+	}
+
+cleanup:
+	closedir(dir);
+	git__free(de_buf);
+	git_scratch__release(&full);
 
 	return error;
 }
@@ -317,11 +317,17 @@ extern int git_path_dirload(
 typedef struct {
 	struct stat st;
 	size_t      path_len;
+	int         st_loaded; /* if 0, only the file type in st_mode is set */
 	char        path[GIT_FLEX_ARRAY];
 } git_path_with_stat;
 
 extern int git_path_with_stat_cmp(const void *a, const void *b);
 
+/**
+ * Only lstat the entries whose type the directory listing does not give.
+ */
+#define GIT_PATH_DIRLOAD_DEFER_STAT (1u << 0)
+
 /**
  * Load all directory entries along with stat info into a vector.
  *
@@ -329,10 +335,27 @@ extern int git_path_with_stat_cmp(const void *a, const void *b);
  * vector is a git_path_with_stat structure that contains both the
  * path and the stat info, plus directories will have a / suffixed
  * to their path name.
+ *
+ * With GIT_PATH_DIRLOAD_DEFER_STAT, entries are only lstat'ed when
+ * readdir cannot tell their type (or on platforms where it never can);
+ * the others just get the type bits of `st.st_mode` and `st_loaded`
+ * left at 0, to be completed with `git_path_with_stat_load` if the
+ * rest of the stat data turns out to be needed.
  */
 extern int git_path_dirload_with_stat(
 	const char *path,
 	size_t prefix_len,
+	unsigned int flags,
 	git_vector *contents);
 
+/**
+ * Fill in the stat data of an entry loaded with deferred stat.
+ *
+ * @param ps The directory entry
+ * @param full_path The path to `ps` on disk (without a trailing slash)
+ * @return 0 on success, GIT_ENOTFOUND if the entry is gone, <0 on error
+ */
+extern int git_path_with_stat_load(
+	git_path_with_stat *ps, const char *full_path);
+
 #endif
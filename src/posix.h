@@ -57,6 +57,8 @@ extern int p_rename(const char *from, const char *to);
 
 #ifndef GIT_WIN32
 
+#include <sys/time.h>
+
 #define p_stat(p,b) stat(p, b)
 #define p_chdir(p) chdir(p)
 #define p_rmdir(p) rmdir(p)
@@ -70,6 +72,7 @@ typedef int GIT_SOCKET;
 #define p_localtime_r localtime_r
 #define p_gmtime_r gmtime_r
 #define p_gettimeofday gettimeofday
+#define p_utimes(p,t) utimes(p, t)
 
 #else
 
@@ -78,6 +81,7 @@ struct timezone;
 extern struct tm * p_localtime_r (const time_t *timer, struct tm *result);
 extern struct tm * p_gmtime_r (const time_t *timer, struct tm *result);
 extern int p_gettimeofday(struct timeval *tv, struct timezone *tz);
+extern int p_utimes(const char *path, const struct timeval times[2]);
 
 
 #endif
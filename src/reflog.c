@@ -5,10 +5,13 @@
  * a Linking Exception. For full terms see the included COPYING file.
  */
 
+#define GIT_ALLOC_SUBSYSTEM GIT_ALLOC_REFS
+
 #include "reflog.h"
 #include "repository.h"
 #include "filebuf.h"
 #include "signature.h"
+#include "scratch.h"
 
 static int reflog_init(git_reflog **reflog, git_reference *ref)
 {
@@ -215,6 +218,8 @@ int git_reflog_read(git_reflog **reflog, git_reference *ref)
 	if (reflog_init(&log, ref) < 0)
 		return -1;
 
+	git_scratch__take(&log_path);
+
 	if (retrieve_reflog_path(&log_path, ref) < 0)
 		goto cleanup;
 
@@ -238,7 +243,7 @@ cleanup:
 
 success:
 	git_buf_free(&log_file);
-	git_buf_free(&log_path);
+	git_scratch__release(&log_path);
 
 	return error;
 }
@@ -399,12 +404,14 @@ int git_reflog_delete(git_reference *ref)
 	int error;
 	git_buf path = GIT_BUF_INIT;
 
+	git_scratch__take(&path);
+
 	error = retrieve_reflog_path(&path, ref);
 
 	if (!error && git_path_exists(path.ptr))
 		error = p_unlink(path.ptr);
 
-	git_buf_free(&path);
+	git_scratch__release(&path);
 
 	return error;
 }
@@ -5,12 +5,15 @@
  * a Linking Exception. For full terms see the included COPYING file.
  */
 
+#define GIT_ALLOC_SUBSYSTEM GIT_ALLOC_REFS
+
 #include "refs.h"
 #include "hash.h"
 #include "repository.h"
 #include "fileops.h"
 #include "pack.h"
 #include "reflog.h"
+#include "scratch.h"
 
 #include <git2/tag.h>
 #include <git2/object.h>
@@ -119,13 +122,14 @@ static int reference_read(
 
 	assert(file_content && repo_path && ref_name);
 
+	git_scratch__take(&path);
+
 	/* Determine the full path of the file */
-	if (git_buf_joinpath(&path, repo_path, ref_name) < 0)
-		return -1;
+	if ((result = git_buf_joinpath(&path, repo_path, ref_name)) == 0)
+		result = git_futils_readbuffer_updated(
+			file_content, path.ptr, mtime, NULL, updated);
 
-	result = git_futils_readbuffer_updated(
-		file_content, path.ptr, mtime, NULL, updated);
-	git_buf_free(&path);
+	git_scratch__release(&path);
 
 	return result;
 }
@@ -203,14 +207,15 @@ static int loose_lookup(git_reference *ref)
 	int result, updated;
 	git_buf ref_file = GIT_BUF_INIT;
 
+	git_scratch__take(&ref_file);
+
 	result = reference_read(&ref_file, &ref->mtime,
 		ref->owner->path_repository, ref->name, &updated);
 
-	if (result < 0)
+	if (result < 0 || !updated) {
+		git_scratch__release(&ref_file);
 		return result;
-
-	if (!updated)
-		return 0;
+	}
 
 	if (ref->flags & GIT_REF_SYMBOLIC) {
 		git__free(ref->target.symbolic);
@@ -228,7 +233,7 @@ static int loose_lookup(git_reference *ref)
 		result = loose_parse_oid(&ref->target.oid, &ref_file);
 	}
 
-	git_buf_free(&ref_file);
+	git_scratch__release(&ref_file);
 	return result;
 }
 
@@ -401,20 +406,45 @@ corrupt:
 	return -1;
 }
 
+static void packed_free_map(git_strmap *packfile)
+{
+	struct packref *reference;
+
+	if (!packfile)
+		return;
+
+	git_strmap_foreach_value(packfile, reference, {
+		git__free(reference);
+	});
+
+	git_strmap_free(packfile);
+}
+
+/*
+ * Bring the in-memory packed refs up to date with the packed-refs file.
+ *
+ * The file is read and parsed without holding the refcache lock; the
+ * new table is swapped in under the write lock, so readers holding the
+ * read lock never see a table being modified.
+ */
 static int packed_load(git_repository *repo)
 {
-	int result, updated;
+	int result, updated, loaded;
 	git_buf packfile = GIT_BUF_INIT;
 	const char *buffer_start, *buffer_end;
 	git_refcache *ref_cache = &repo->references;
+	git_strmap *packed = NULL;
+	time_t mtime;
 
-	/* First we make sure we have allocated the hash table */
-	if (ref_cache->packfile == NULL) {
-		ref_cache->packfile = git_strmap_alloc();
-		GITERR_CHECK_ALLOC(ref_cache->packfile);
-	}
+	git_rwlock_rdlock(&ref_cache->lock);
+	loaded = (ref_cache->packfile != NULL);
+	mtime = ref_cache->packfile_time;
+	git_rwlock_rdunlock(&ref_cache->lock);
 
-	result = reference_read(&packfile, &ref_cache->packfile_time,
+	if (!loaded)
+		mtime = 0;
+
+	result = reference_read(&packfile, &mtime,
 		repo->path_repository, GIT_PACKEDREFS_FILE, &updated);
 
 	/*
@@ -425,21 +455,15 @@ static int packed_load(git_repository *repo)
 	 * refresh the packed refs.
 	 */
 	if (result == GIT_ENOTFOUND) {
-		git_strmap_clear(ref_cache->packfile);
-		return 0;
-	}
-
-	if (result < 0)
+		giterr_clear();
+		mtime = 0;
+	} else if (result < 0)
 		return -1;
-
-	if (!updated)
+	else if (!updated && loaded)
 		return 0;
 
-	/*
-	 * At this point, we want to refresh the packed refs. We already
-	 * have the contents in our buffer.
-	 */
-	git_strmap_clear(ref_cache->packfile);
+	packed = git_strmap_alloc();
+	GITERR_CHECK_ALLOC(packed);
 
 	buffer_start = (const char *)packfile.ptr;
 	buffer_end = (const char *)(buffer_start) + packfile.size;
@@ -460,21 +484,43 @@ static int packed_load(git_repository *repo)
 			goto parse_failed;
 
 		if (buffer_start[0] == '^') {
-			if (packed_parse_peel(ref, &buffer_start, buffer_end) < 0)
+			if (packed_parse_peel(ref, &buffer_start, buffer_end) < 0) {
+				git__free(ref);
 				goto parse_failed;
+			}
 		}
 
-		git_strmap_insert(ref_cache->packfile, ref->name, ref, err);
-		if (err < 0)
+		git_strmap_insert(packed, ref->name, ref, err);
+		if (err < 0) {
+			git__free(ref);
 			goto parse_failed;
+		}
 	}
 
 	git_buf_free(&packfile);
+
+	/* an empty table stays in place while there is no packed-refs file */
+	if (result == GIT_ENOTFOUND && loaded) {
+		git_rwlock_rdlock(&ref_cache->lock);
+		loaded = (git_strmap_num_entries(ref_cache->packfile) > 0);
+		git_rwlock_rdunlock(&ref_cache->lock);
+
+		if (!loaded) {
+			git_strmap_free(packed);
+			return 0;
+		}
+	}
+
+	git_rwlock_wrlock(&ref_cache->lock);
+	packed = git__swap(&ref_cache->packfile, packed);
+	ref_cache->packfile_time = mtime;
+	git_rwlock_wrunlock(&ref_cache->lock);
+
+	packed_free_map(packed);
 	return 0;
 
 parse_failed:
-	git_strmap_free(ref_cache->packfile);
-	ref_cache->packfile = NULL;
+	packed_free_map(packed);
 	git_buf_free(&packfile);
 	return -1;
 }
@@ -499,9 +545,16 @@ static int _dirent_loose_listall(void *_data, git_buf *full_path)
 		return git_path_direach(full_path, _dirent_loose_listall, _data);
 
 	/* do not add twice a reference that exists already in the packfile */
-	if ((data->list_flags & GIT_REF_PACKED) != 0 &&
-		git_strmap_exists(data->repo->references.packfile, file_path))
-		return 0;
+	if ((data->list_flags & GIT_REF_PACKED) != 0) {
+		int packed;
+
+		git_rwlock_rdlock(&data->repo->references.lock);
+		packed = git_strmap_exists(data->repo->references.packfile, file_path);
+		git_rwlock_rdunlock(&data->repo->references.lock);
+
+		if (packed)
+			return 0;
+	}
 
 	if (data->list_flags != GIT_REF_LISTALL) {
 		if ((data->list_flags & loose_guess_rtype(full_path)) == 0)
@@ -549,7 +602,7 @@ static int _dirent_loose_load(void *data, git_buf *full_path)
  * Load all the loose references from the repository
  * into the in-memory Packfile, and build a vector with
  * all the references so it can be written back to
- * disk.
+ * disk.  The caller holds the refcache write lock.
  */
 static int packed_loadloose(git_repository *repository)
 {
@@ -720,6 +773,7 @@ static int packed_sort(const void *a, const void *b)
 
 /*
  * Write all the contents in the in-memory packfile to disk.
+ * The caller holds the refcache write lock.
  */
 static int packed_write(git_repository *repo)
 {
@@ -869,12 +923,12 @@ static int reference_exists(int *exists, git_repository *repo, const char *ref_n
 	if (git_buf_joinpath(&ref_path, repo->path_repository, ref_name) < 0)
 		return -1;
 
-	if (git_path_isfile(ref_path.ptr) == true ||
-		git_strmap_exists(repo->references.packfile, ref_path.ptr))
-	{
+	if (git_path_isfile(ref_path.ptr) == true) {
 		*exists = 1;
 	} else {
-		*exists = 0;
+		git_rwlock_rdlock(&repo->references.lock);
+		*exists = git_strmap_exists(repo->references.packfile, ref_path.ptr);
+		git_rwlock_rdunlock(&repo->references.lock);
 	}
 
 	git_buf_free(&ref_path);
@@ -936,18 +990,21 @@ static int reference_can_write(
 
 static int packed_lookup(git_reference *ref)
 {
+	git_refcache *ref_cache = &ref->owner->references;
 	struct packref *pack_ref = NULL;
-	git_strmap *packfile_refs;
-	khiter_t pos;
+	git_hashmap_iter pos;
+	int error = 0;
 
 	if (packed_load(ref->owner) < 0)
 		return -1;
 
+	git_rwlock_rdlock(&ref_cache->lock);
+
 	/* maybe the packfile hasn't changed at all, so we don't
 	 * have to re-lookup the reference */
 	if ((ref->flags & GIT_REF_PACKED) &&
-		ref->mtime == ref->owner->references.packfile_time)
-		return 0;
+		ref->mtime == ref_cache->packfile_time)
+		goto cleanup;
 
 	if (ref->flags & GIT_REF_SYMBOLIC) {
 		git__free(ref->target.symbolic);
@@ -955,20 +1012,22 @@ static int packed_lookup(git_reference *ref)
 	}
 
 	/* Look up on the packfile */
-	packfile_refs = ref->owner->references.packfile;
-	pos = git_strmap_lookup_index(packfile_refs, ref->name);
-	if (!git_strmap_valid_index(packfile_refs, pos)) {
+	pos = git_strmap_lookup_index(ref_cache->packfile, ref->name);
+	if (!git_strmap_valid_index(ref_cache->packfile, pos)) {
 		giterr_set(GITERR_REFERENCE, "Reference '%s' not found", ref->name);
-		return GIT_ENOTFOUND;
+		error = GIT_ENOTFOUND;
+		goto cleanup;
 	}
 
-	pack_ref = git_strmap_value_at(packfile_refs, pos);
+	pack_ref = git_strmap_value_at(ref_cache->packfile, pos);
 
 	ref->flags = GIT_REF_OID | GIT_REF_PACKED;
-	ref->mtime = ref->owner->references.packfile_time;
+	ref->mtime = ref_cache->packfile_time;
 	git_oid_cpy(&ref->target.oid, &pack_ref->oid);
 
-	return 0;
+cleanup:
+	git_rwlock_rdunlock(&ref_cache->lock);
+	return error;
 }
 
 static int reference_lookup(git_reference *ref)
@@ -1008,27 +1067,33 @@ static int reference_delete(git_reference *ref)
 	 * We need to reload the packfile, remove the reference from the
 	 * packing list, and repack */
 	if (ref->flags & GIT_REF_PACKED) {
-		git_strmap *packfile_refs;
+		git_refcache *ref_cache = &ref->owner->references;
 		struct packref *packref;
-		khiter_t pos;
+		git_hashmap_iter pos;
 
 		/* load the existing packfile */
 		if (packed_load(ref->owner) < 0)
 			return -1;
 
-		packfile_refs = ref->owner->references.packfile;
-		pos = git_strmap_lookup_index(packfile_refs, ref->name);
-		if (!git_strmap_valid_index(packfile_refs, pos)) {
+		git_rwlock_wrlock(&ref_cache->lock);
+
+		pos = git_strmap_lookup_index(ref_cache->packfile, ref->name);
+		if (!git_strmap_valid_index(ref_cache->packfile, pos)) {
+			git_rwlock_wrunlock(&ref_cache->lock);
 			giterr_set(GITERR_REFERENCE,
 				"Reference %s stopped existing in the packfile", ref->name);
 			return -1;
 		}
 
-		packref = git_strmap_value_at(packfile_refs, pos);
-		git_strmap_delete_at(packfile_refs, pos);
+		packref = git_strmap_value_at(ref_cache->packfile, pos);
+		git_strmap_delete_at(ref_cache->packfile, pos);
 
 		git__free(packref);
-		if (packed_write(ref->owner) < 0)
+		result = packed_write(ref->owner);
+
+		git_rwlock_wrunlock(&ref_cache->lock);
+
+		if (result < 0)
 			return -1;
 
 	/* If the reference is loose, we can just remove the reference
@@ -1467,12 +1532,19 @@ int git_reference_resolve(git_reference **ref_out, git_reference *ref)
 
 int git_reference_packall(git_repository *repo)
 {
-	if (packed_load(repo) < 0 || /* load the existing packfile */
-		packed_loadloose(repo) < 0 || /* add all the loose refs */
-		packed_write(repo) < 0) /* write back to disk */
+	int error;
+
+	if (packed_load(repo) < 0) /* load the existing packfile */
 		return -1;
 
-	return 0;
+	git_rwlock_wrlock(&repo->references.lock);
+
+	if ((error = packed_loadloose(repo)) == 0) /* add all the loose refs */
+		error = packed_write(repo); /* write back to disk */
+
+	git_rwlock_wrunlock(&repo->references.lock);
+
+	return error < 0 ? -1 : 0;
 }
 
 int git_reference_foreach(
@@ -1485,19 +1557,44 @@ int git_reference_foreach(
 	struct dirent_list_data data;
 	git_buf refs_path = GIT_BUF_INIT;
 
-	/* list all the packed references first */
+	/* list all the packed references first; the names are copied out
+	 * so that the callback does not run under the refcache lock */
 	if (list_flags & GIT_REF_PACKED) {
+		git_vector packed_names = GIT_VECTOR_INIT;
 		const char *ref_name;
+		char *name;
 		void *ref;
+		unsigned int i;
 		GIT_UNUSED(ref);
 
 		if (packed_load(repo) < 0)
 			return -1;
 
+		result = 0;
+
+		git_rwlock_rdlock(&repo->references.lock);
 		git_strmap_foreach(repo->references.packfile, ref_name, ref, {
-			if (callback(ref_name, payload))
-				return GIT_EUSER;
+			if (result < 0)
+				continue;
+
+			if ((name = git__strdup(ref_name)) == NULL)
+				result = -1;
+			else if (git_vector_insert(&packed_names, name) < 0) {
+				git__free(name);
+				result = -1;
+			}
 		});
+		git_rwlock_rdunlock(&repo->references.lock);
+
+		git_vector_foreach(&packed_names, i, name) {
+			if (!result && callback(name, payload))
+				result = GIT_EUSER;
+			git__free(name);
+		}
+		git_vector_free(&packed_names);
+
+		if (result < 0)
+			return result;
 	}
 
 	/* now list the loose references, trying not to
@@ -1560,15 +1657,8 @@ void git_repository__refcache_free(git_refcache *refs)
 {
 	assert(refs);
 
-	if (refs->packfile) {
-		struct packref *reference;
-
-		git_strmap_foreach_value(refs->packfile, reference, {
-			git__free(reference);
-		});
-
-		git_strmap_free(refs->packfile);
-	}
+	packed_free_map(refs->packfile);
+	refs->packfile = NULL;
 }
 
 static int is_valid_ref_char(char ch)
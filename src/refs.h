@@ -58,9 +58,15 @@ struct git_reference {
 	} target;
 };
 
+/*
+ * The packed refs table is shared by every user of the repository:
+ * `lock` is held for reading while it is looked up and for writing
+ * while it is replaced or modified.
+ */
 typedef struct {
 	git_strmap *packfile;
 	time_t packfile_time;
+	git_rwlock lock;
 } git_refcache;
 
 void git_repository__refcache_free(git_refcache *refs);
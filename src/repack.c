@@ -0,0 +1,733 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "common.h"
+#include "repository.h"
+#include "fileops.h"
+#include "index.h"
+#include "odb.h"
+#include "pack.h"
+#include "pack-objects.h"
+#include "pool.h"
+
+#include "git2/pack.h"
+#include "git2/indexer.h"
+#include "git2/reflog.h"
+#include "git2/refs.h"
+#include "git2/revwalk.h"
+#include "git2/tag.h"
+#include "git2/commit.h"
+#include "git2/tree.h"
+
+GIT__USE_OIDMAP;
+
+typedef struct {
+	git_repository *repo;
+	unsigned int flags;
+	git_packbuilder *pb;
+	git_revwalk *walk;
+
+	git_buf objects; /* the objects directory, with a trailing slash */
+	git_buf pack_dir;
+
+	git_vector packs; /* the packs which stay */
+	git_vector rolled; /* the packs which are folded into the new one */
+	git_oid pack_id; /* the new pack, if any was written */
+	bool written;
+
+	git_oidmap *seen; /* objects reached so far, keyed in `oids` */
+	git_pool oids;
+	int error; /* from callbacks */
+} repack;
+
+static int pack_cmp_size(const void *a, const void *b)
+{
+	const struct git_pack_file *pa = a, *pb = b;
+
+	if (pa->num_objects < pb->num_objects)
+		return -1;
+	return pa->num_objects > pb->num_objects;
+}
+
+static bool in_packs(git_vector *packs, const git_oid *id)
+{
+	struct git_pack_entry e;
+	struct git_pack_file *p;
+	unsigned int i;
+
+	git_vector_foreach(packs, i, p) {
+		if (git_pack_entry_find(&e, p, id, GIT_OID_HEXSZ) == 0)
+			return true;
+	}
+
+	giterr_clear();
+	return false;
+}
+
+static int load_pack_cb(void *payload, git_buf *path)
+{
+	repack *r = payload;
+	struct git_pack_file *p;
+	int error;
+
+	if (git__suffixcmp(path->ptr, ".idx") != 0)
+		return 0;
+
+	if ((error = git_packfile_check(&p, path->ptr)) == GIT_ENOTFOUND) {
+		/* ignore an index without its pack, as the odb does */
+		giterr_clear();
+		return 0;
+	}
+
+	if (error < 0 || (error = git_packfile__index_open(p)) < 0 ||
+		(error = git_vector_insert(p->pack_keep ? &r->packs : &r->rolled, p)) < 0) {
+		if (p)
+			packfile_free(p);
+		r->error = error;
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Sort out which packs to fold together: the packs are sorted by their
+ * number of objects, and every pack which is not at least `factor` times
+ * as large as the previous one is folded into the new pack along with
+ * all the packs smaller than it.  Then as many of the larger packs as
+ * are needed for the progression to hold again after the new pack is
+ * written are folded in as well.
+ */
+static int split_packs(repack *r, unsigned int factor)
+{
+	struct git_pack_file *p;
+	size_t split, i;
+	uint64_t total = 0;
+
+	git_vector_sort(&r->rolled);
+
+	for (split = r->rolled.length; split > 1; --split) {
+		struct git_pack_file *ours = git_vector_get(&r->rolled, split - 1);
+		struct git_pack_file *prev = git_vector_get(&r->rolled, split - 2);
+
+		if ((uint64_t)ours->num_objects < (uint64_t)factor * prev->num_objects)
+			break;
+	}
+
+	/* the first pack is always in progression with nothing */
+	if (split == 1)
+		split = 0;
+
+	for (i = 0; i < split; ++i)
+		total += ((struct git_pack_file *)git_vector_get(&r->rolled, i))->num_objects;
+
+	for (; split < r->rolled.length; ++split) {
+		p = git_vector_get(&r->rolled, split);
+		if ((uint64_t)p->num_objects >= (uint64_t)factor * total)
+			break;
+		total += p->num_objects;
+	}
+
+	/* move the packs which are in progression out of the way */
+	while (r->rolled.length > split) {
+		p = git_vector_last(&r->rolled);
+		if (git_vector_insert(&r->packs, p) < 0)
+			return -1;
+		git_vector_pop(&r->rolled);
+	}
+
+	return 0;
+}
+
+static int load_packs(repack *r, unsigned int factor)
+{
+	git_buf path = GIT_BUF_INIT;
+	int error;
+
+	if ((error = git_buf_sets(&path, r->pack_dir.ptr)) < 0)
+		return error;
+
+	error = git_path_direach(&path, load_pack_cb, r);
+	git_buf_free(&path);
+
+	if (error < 0)
+		return r->error ? r->error : error;
+
+	return factor ? split_packs(r, factor) : 0;
+}
+
+struct loose_walk {
+	repack *r;
+	int (*cb)(repack *r, const git_oid *id, const char *path);
+	bool prune;
+};
+
+static int loose_object_cb(void *payload, git_buf *path)
+{
+	struct loose_walk *w = payload;
+	const char *name = path->ptr + w->r->objects.size;
+	char hex[GIT_OID_HEXSZ];
+	git_oid id;
+	int error;
+
+	/* "xx/" followed by the rest of the hex id */
+	if (path->size != w->r->objects.size + GIT_OID_HEXSZ + 1)
+		return 0;
+
+	memcpy(hex, name, 2);
+	memcpy(hex + 2, name + 3, GIT_OID_HEXSZ - 2);
+	if (git_oid_fromstrn(&id, hex, GIT_OID_HEXSZ) < 0) {
+		giterr_clear();
+		return 0;
+	}
+
+	if ((error = w->cb(w->r, &id, path->ptr)) < 0) {
+		w->r->error = error;
+		return -1;
+	}
+
+	return 0;
+}
+
+static int loose_dir_cb(void *payload, git_buf *path)
+{
+	struct loose_walk *w = payload;
+	const char *name = path->ptr + w->r->objects.size;
+
+	if (path->size != w->r->objects.size + 2 ||
+		git__fromhex(name[0]) < 0 || git__fromhex(name[1]) < 0 ||
+		!git_path_isdir(path->ptr))
+		return 0;
+
+	if (git_path_direach(path, loose_object_cb, w) < 0)
+		return -1;
+
+	/* only goes when the last object has */
+	if (w->prune)
+		p_rmdir(path->ptr);
+
+	return 0;
+}
+
+static int foreach_loose(
+	repack *r, int (*cb)(repack *r, const git_oid *id, const char *path), bool prune)
+{
+	struct loose_walk w;
+	git_buf path = GIT_BUF_INIT;
+	int error;
+
+	w.r = r;
+	w.cb = cb;
+	w.prune = prune;
+
+	if ((error = git_buf_sets(&path, r->objects.ptr)) < 0)
+		return error;
+
+	r->error = 0;
+	error = git_path_direach(&path, loose_dir_cb, &w);
+	git_buf_free(&path);
+
+	return (error < 0 && r->error) ? r->error : error;
+}
+
+/* returns 1 the first time `id` is seen, 0 after that */
+static int mark_seen(repack *r, const git_oid *id)
+{
+	git_oid *key;
+	int ret;
+
+	if (git_oidmap_exists(r->seen, id))
+		return 0;
+
+	key = git_pool_malloc(&r->oids, 1);
+	GITERR_CHECK_ALLOC(key);
+	git_oid_cpy(key, id);
+
+	git_oidmap_insert(r->seen, key, key, ret);
+	if (ret < 0) {
+		giterr_set_oom();
+		return -1;
+	}
+
+	return 1;
+}
+
+/* objects in the packs which stay (i.e. kept ones) are not copied */
+static int insert_object(repack *r, const git_oid *id, const char *name)
+{
+	int error;
+
+	if ((error = mark_seen(r, id)) <= 0)
+		return error;
+
+	if (!in_packs(&r->packs, id) &&
+		(error = git_packbuilder_insert(r->pb, id, name)) < 0)
+		return error;
+
+	return 1;
+}
+
+static int insert_tree(repack *r, const git_oid *id, git_buf *path)
+{
+	git_tree *tree;
+	const git_tree_entry *entry;
+	size_t len;
+	unsigned int i;
+	int error;
+
+	if ((error = insert_object(r, id, path->size ? path->ptr : NULL)) <= 0)
+		return error;
+
+	if ((error = git_tree_lookup(&tree, r->repo, id)) < 0)
+		return error;
+
+	if (path->size && git_buf_putc(path, '/') < 0) {
+		git_tree_free(tree);
+		return -1;
+	}
+	len = path->size;
+
+	for (i = 0; i < git_tree_entrycount(tree) && error >= 0; ++i) {
+		entry = git_tree_entry_byindex(tree, i);
+
+		if ((error = git_buf_puts(path, git_tree_entry_name(entry))) < 0)
+			break;
+
+		switch (git_tree_entry_type(entry)) {
+		case GIT_OBJ_TREE:
+			error = insert_tree(r, git_tree_entry_id(entry), path);
+			break;
+		case GIT_OBJ_BLOB:
+			error = insert_object(r, git_tree_entry_id(entry), path->ptr);
+			break;
+		default:
+			/* submodule commits are in another repository */
+			break;
+		}
+
+		git_buf_truncate(path, len);
+	}
+
+	git_tree_free(tree);
+	return error < 0 ? error : 0;
+}
+
+/* insert the tags, trees and blobs `id` peels through; queue commits */
+static int insert_tip(repack *r, const git_oid *id)
+{
+	git_object *obj;
+	git_buf path = GIT_BUF_INIT;
+	git_oid target;
+	int error;
+
+	git_oid_cpy(&target, id);
+
+	for (;;) {
+		if ((error = git_object_lookup(&obj, r->repo, &target, GIT_OBJ_ANY)) < 0)
+			return error;
+
+		switch (git_object_type(obj)) {
+		case GIT_OBJ_TAG:
+			if ((error = insert_object(r, &target, NULL)) > 0) {
+				git_oid_cpy(&target, git_tag_target_oid((git_tag *)obj));
+				git_object_free(obj);
+				continue;
+			}
+			break;
+		case GIT_OBJ_COMMIT:
+			error = git_revwalk_push(r->walk, &target);
+			break;
+		case GIT_OBJ_TREE:
+			error = insert_tree(r, &target, &path);
+			break;
+		default:
+			error = insert_object(r, &target, NULL);
+			break;
+		}
+
+		git_object_free(obj);
+		break;
+	}
+
+	git_buf_free(&path);
+	return error < 0 ? error : 0;
+}
+
+static int insert_reflog(repack *r, git_reference *ref)
+{
+	git_reflog *reflog;
+	const git_reflog_entry *entry;
+	const git_oid *ids[2];
+	unsigned int i, j;
+	int error;
+
+	if (!git_reference_has_log(ref))
+		return 0;
+
+	if ((error = git_reflog_read(&reflog, ref)) < 0)
+		return error;
+
+	for (i = 0; i < git_reflog_entrycount(reflog) && !error; ++i) {
+		entry = git_reflog_entry_byindex(reflog, i);
+		ids[0] = git_reflog_entry_oidold(entry);
+		ids[1] = git_reflog_entry_oidnew(entry);
+
+		for (j = 0; j < 2 && !error; ++j) {
+			if (git_oid_iszero(ids[j]))
+				continue;
+
+			/* old entries may name objects which are long gone */
+			if ((error = insert_tip(r, ids[j])) == GIT_ENOTFOUND) {
+				giterr_clear();
+				error = 0;
+			}
+		}
+	}
+
+	git_reflog_free(reflog);
+	return error;
+}
+
+static int insert_ref(repack *r, const char *name)
+{
+	git_reference *ref;
+	int error;
+
+	if ((error = git_reference_lookup(&ref, r->repo, name)) < 0)
+		return error;
+
+	if (git_reference_type(ref) == GIT_REF_OID)
+		error = insert_tip(r, git_reference_oid(ref));
+
+	if (!error)
+		error = insert_reflog(r, ref);
+
+	git_reference_free(ref);
+	return error;
+}
+
+static int insert_ref_cb(const char *name, void *payload)
+{
+	repack *r = payload;
+
+	if ((r->error = insert_ref(r, name)) < 0)
+		return -1;
+
+	return 0;
+}
+
+static int insert_tree_cache(repack *r, const git_tree_cache *tree, git_buf *path)
+{
+	size_t i;
+	int error;
+
+	if (tree->entries >= 0) {
+		if ((error = git_buf_sets(path, tree->name)) < 0 ||
+			(error = insert_tree(r, &tree->oid, path)) < 0)
+			return error;
+	}
+
+	for (i = 0; i < tree->children_count; ++i) {
+		if ((error = insert_tree_cache(r, tree->children[i], path)) < 0)
+			return error;
+	}
+
+	return 0;
+}
+
+static int insert_index(repack *r)
+{
+	git_index *index;
+	git_index_entry *entry;
+	git_buf path = GIT_BUF_INIT;
+	unsigned int i;
+	int error;
+
+	if ((error = git_repository_index__weakptr(&index, r->repo)) < 0)
+		return error;
+
+	for (i = 0; i < git_index_entrycount(index); ++i) {
+		entry = git_index_get_byindex(index, i);
+
+		if (S_ISGITLINK(entry->mode))
+			continue;
+
+		if ((error = insert_object(r, &entry->oid, entry->path)) < 0)
+			return error;
+	}
+
+	/* index writes trust the cached trees to be there */
+	if (index->tree)
+		error = insert_tree_cache(r, index->tree, &path);
+
+	git_buf_free(&path);
+	return error;
+}
+
+static int insert_reachable(repack *r)
+{
+	git_commit *commit;
+	git_buf path = GIT_BUF_INIT;
+	git_oid id;
+	int error;
+
+	if ((r->seen = git_oidmap_alloc()) == NULL ||
+		git_pool_init(&r->oids, sizeof(git_oid), 0) < 0 ||
+		(error = git_revwalk_new(&r->walk, r->repo)) < 0)
+		return -1;
+
+	git_revwalk_sorting(r->walk, GIT_SORT_TIME);
+
+	/* HEAD when detached, and its reflog */
+	if ((error = insert_ref(r, GIT_HEAD_FILE)) < 0)
+		return error;
+
+	r->error = 0;
+	if ((error = git_reference_foreach(
+			r->repo, GIT_REF_LISTALL, insert_ref_cb, r)) < 0)
+		return r->error ? r->error : error;
+
+	if (!git_repository_is_bare(r->repo) && (error = insert_index(r)) < 0)
+		return error;
+
+	/* the commits, then the trees and blobs they reach */
+	while ((error = git_revwalk_next(&id, r->walk)) == 0) {
+		if ((error = insert_object(r, &id, NULL)) < 0 ||
+			(error = git_commit_lookup(&commit, r->repo, &id)) < 0)
+			break;
+
+		git_buf_clear(&path);
+		error = insert_tree(r, git_commit_tree_oid(commit), &path);
+		git_commit_free(commit);
+
+		if (error < 0)
+			break;
+	}
+
+	git_buf_free(&path);
+	return error == GIT_ITEROVER ? 0 : error;
+}
+
+static int insert_pack_cb(git_oid *id, void *payload)
+{
+	repack *r = payload;
+
+	if ((r->error = git_packbuilder_insert(r->pb, id, NULL)) < 0)
+		return -1;
+
+	return 0;
+}
+
+static int insert_loose_cb(repack *r, const git_oid *id, const char *path)
+{
+	GIT_UNUSED(path);
+
+	if (in_packs(&r->packs, id))
+		return 0;
+
+	return git_packbuilder_insert(r->pb, id, NULL);
+}
+
+static int insert_rolled(repack *r)
+{
+	struct git_pack_file *p;
+	unsigned int i;
+	int error;
+
+	git_vector_foreach(&r->rolled, i, p) {
+		r->error = 0;
+		if ((error = git_pack_foreach_entry(p, insert_pack_cb, r)) < 0)
+			return r->error ? r->error : error;
+	}
+
+	return foreach_loose(r, insert_loose_cb, false);
+}
+
+struct pack_writer {
+	git_indexer_stream *idx;
+	git_transfer_progress stats;
+};
+
+static int write_pack_cb(void *buf, size_t size, void *payload)
+{
+	struct pack_writer *w = payload;
+	return git_indexer_stream_add(w->idx, buf, size, &w->stats);
+}
+
+static int write_pack(repack *r)
+{
+	struct pack_writer w;
+	struct git_pack_file *p = NULL;
+	git_buf path = GIT_BUF_INIT;
+	char hex[GIT_OID_HEXSZ + 1];
+	int error;
+
+	if (!(r->flags & GIT_REPACK_NO_REUSE_DELTA) &&
+		(error = git_packbuilder__reuse_deltas(r->pb, &r->rolled)) < 0)
+		return error;
+
+	memset(&w, 0, sizeof(w));
+	if ((error = git_indexer_stream_new(&w.idx, r->pack_dir.ptr, NULL, NULL, NULL)) < 0)
+		return error;
+
+	if ((error = git_packbuilder_foreach(r->pb, write_pack_cb, &w)) == 0 &&
+		(error = git_indexer_stream_finalize(w.idx, &w.stats)) == 0) {
+		git_oid_cpy(&r->pack_id, git_indexer_stream_hash(w.idx));
+		r->written = true;
+	}
+
+	git_indexer_stream_free(w.idx);
+	if (error < 0)
+		return error;
+
+	/* its objects are packed for the loose objects to be pruned */
+	git_oid_tostr(hex, sizeof(hex), &r->pack_id);
+	if ((error = git_buf_printf(&path, "%s/pack-%s.idx", r->pack_dir.ptr, hex)) == 0 &&
+		(error = git_packfile_check(&p, path.ptr)) == 0 &&
+		(error = git_vector_insert(&r->packs, p)) < 0)
+		packfile_free(p);
+
+	git_buf_free(&path);
+	return error;
+}
+
+static int remove_pack(struct git_pack_file *p)
+{
+	/* the index goes first so that the pack is no longer looked up */
+	static const char *exts[] = { ".idx", ".pack", ".rev", ".bitmap" };
+	git_buf path = GIT_BUF_INIT;
+	size_t base, i;
+	int error = 0;
+
+	base = strlen(p->pack_name) - strlen(".pack");
+	if (git_buf_set(&path, p->pack_name, base) < 0) {
+		packfile_free(p);
+		return -1;
+	}
+
+	packfile_free(p);
+
+	for (i = 0; i < ARRAY_SIZE(exts) && !error; ++i) {
+		git_buf_truncate(&path, base);
+		if ((error = git_buf_puts(&path, exts[i])) < 0)
+			break;
+
+		if (p_unlink(path.ptr) < 0 && errno != ENOENT) {
+			giterr_set(GITERR_OS, "Failed to remove old pack '%s'", path.ptr);
+			error = -1;
+		}
+	}
+
+	git_buf_free(&path);
+	return error;
+}
+
+static int remove_rolled(repack *r)
+{
+	struct git_pack_file *p;
+	int error = 0;
+
+	while (r->rolled.length > 0) {
+		p = git_vector_last(&r->rolled);
+		git_vector_pop(&r->rolled);
+
+		/* the same objects may have been written out again */
+		if (r->written && !git_oid_cmp(&p->sha1, &r->pack_id))
+			packfile_free(p);
+		else if (remove_pack(p) < 0)
+			error = -1;
+	}
+
+	return error;
+}
+
+static int prune_loose_cb(repack *r, const git_oid *id, const char *path)
+{
+	if (!in_packs(&r->packs, id))
+		return 0;
+
+	if (p_unlink(path) < 0 && errno != ENOENT) {
+		giterr_set(GITERR_OS, "Failed to remove loose object '%s'", path);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void repack_free(repack *r)
+{
+	struct git_pack_file *p;
+	unsigned int i;
+
+	git_vector_foreach(&r->packs, i, p)
+		packfile_free(p);
+	git_vector_foreach(&r->rolled, i, p)
+		packfile_free(p);
+
+	git_vector_free(&r->packs);
+	git_vector_free(&r->rolled);
+	git_revwalk_free(r->walk);
+	git_packbuilder_free(r->pb);
+
+	if (r->seen)
+		git_oidmap_free(r->seen);
+	git_pool_clear(&r->oids);
+
+	git_buf_free(&r->objects);
+	git_buf_free(&r->pack_dir);
+}
+
+int git_repository_repack(git_repository *repo, const git_repack_opts *opts)
+{
+	repack r;
+	unsigned int factor = opts ? opts->geometric_factor : 0;
+	struct git_pack_file *p;
+	uint32_t count;
+	int error;
+
+	assert(repo);
+
+	memset(&r, 0, sizeof(r));
+	r.repo = repo;
+	r.flags = opts ? opts->flags : 0;
+
+	if ((error = git_buf_joinpath(&r.objects, repo->path_repository, GIT_OBJECTS_DIR)) < 0 ||
+		(error = git_path_to_dir(&r.objects)) < 0 ||
+		(error = git_buf_joinpath(&r.pack_dir, r.objects.ptr, "pack")) < 0 ||
+		(error = git_futils_mkdir(r.pack_dir.ptr, NULL, GIT_OBJECT_DIR_MODE, GIT_MKDIR_PATH)) < 0 ||
+		(error = git_vector_init(&r.packs, 8, NULL)) < 0 ||
+		(error = git_vector_init(&r.rolled, 8, pack_cmp_size)) < 0 ||
+		(error = load_packs(&r, factor)) < 0 ||
+		(error = git_packbuilder_new(&r.pb, repo)) < 0)
+		goto cleanup;
+
+	git_packbuilder_set_threads(r.pb, opts ? opts->nthreads : 0);
+
+	if ((error = factor ? insert_rolled(&r) : insert_reachable(&r)) < 0)
+		goto cleanup;
+
+	/* a lone pack would only be written out again */
+	count = git_packbuilder_object_count(r.pb);
+	p = git_vector_last(&r.rolled);
+	if (factor && r.rolled.length <= 1 && count == (p ? p->num_objects : 0)) {
+		while (r.rolled.length > 0) {
+			git_vector_insert(&r.packs, git_vector_last(&r.rolled));
+			git_vector_pop(&r.rolled);
+		}
+	} else {
+		if ((count > 0 && (error = write_pack(&r)) < 0) ||
+			(error = remove_rolled(&r)) < 0)
+			goto cleanup;
+	}
+
+	if (!(r.flags & GIT_REPACK_KEEP_LOOSE))
+		error = foreach_loose(&r, prune_loose_cb, true);
+
+cleanup:
+	repack_free(&r);
+	return error;
+}
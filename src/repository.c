@@ -30,35 +30,64 @@
 
 #define GIT_TEMPLATE_DIR "/usr/share/git-core/templates"
 
-static void drop_odb(git_repository *repo)
+/*
+ * The `_odb`, `_config` and `_index` members are loaded lazily and may
+ * be requested by several threads at once: they are only ever replaced
+ * with an atomic compare-and-swap or exchange, and a thread which loses
+ * the race to load one simply frees its own copy.
+ */
+static void set_odb(git_repository *repo, git_odb *odb)
 {
-	if (repo->_odb != NULL) {
-		GIT_REFCOUNT_OWN(repo->_odb, NULL);
-		git_odb_free(repo->_odb);
-		repo->_odb = NULL;
+	git_odb *old;
+
+	if (odb)
+		GIT_REFCOUNT_OWN(odb, repo);
+
+	if ((old = git__swap(&repo->_odb, odb)) != NULL) {
+		if (old != odb)
+			GIT_REFCOUNT_OWN(old, NULL);
+		git_odb_free(old);
 	}
 }
 
-static void drop_config(git_repository *repo)
+static void set_config(git_repository *repo, git_config *config)
 {
-	if (repo->_config != NULL) {
-		GIT_REFCOUNT_OWN(repo->_config, NULL);
-		git_config_free(repo->_config);
-		repo->_config = NULL;
+	git_config *old;
+
+	if (config)
+		GIT_REFCOUNT_OWN(config, repo);
+
+	if ((old = git__swap(&repo->_config, config)) != NULL) {
+		if (old != config)
+			GIT_REFCOUNT_OWN(old, NULL);
+		git_config_free(old);
 	}
 
 	git_repository__cvar_cache_clear(repo);
 }
 
-static void drop_index(git_repository *repo)
+static void set_index(git_repository *repo, git_index *index)
 {
-	if (repo->_index != NULL) {
-		GIT_REFCOUNT_OWN(repo->_index, NULL);
-		git_index_free(repo->_index);
-		repo->_index = NULL;
+	git_index *old;
+
+	if (index)
+		GIT_REFCOUNT_OWN(index, repo);
+
+	if ((old = git__swap(&repo->_index, index)) != NULL) {
+		if (old != index)
+			GIT_REFCOUNT_OWN(old, NULL);
+		git_index_free(old);
 	}
 }
 
+static void set_fsmonitor(git_repository *repo, git_fsmonitor *fsm)
+{
+	git_fsmonitor *old;
+
+	if ((old = git__swap(&repo->_fsmonitor, fsm)) != NULL && old != fsm)
+		git_fsmonitor_free(old);
+}
+
 void git_repository_free(git_repository *repo)
 {
 	if (repo == NULL)
@@ -72,9 +101,13 @@ void git_repository_free(git_repository *repo)
 	git__free(repo->path_repository);
 	git__free(repo->workdir);
 
-	drop_config(repo);
-	drop_index(repo);
-	drop_odb(repo);
+	set_config(repo, NULL);
+	set_index(repo, NULL);
+	set_odb(repo, NULL);
+	set_fsmonitor(repo, NULL);
+
+	git_rwlock_free(&repo->references.lock);
+	git_rwlock_free(&repo->attrcache.lock);
 
 	git__free(repo);
 }
@@ -113,6 +146,9 @@ static git_repository *repository_alloc(void)
 		return NULL;
 	}
 
+	git_rwlock_init(&repo->references.lock);
+	git_rwlock_init(&repo->attrcache.lock);
+
 	/* set all the entries in the cvar cache to `unset` */
 	git_repository__cvar_cache_clear(repo);
 
@@ -494,8 +530,9 @@ on_error:
 
 int git_repository_config__weakptr(git_config **out, git_repository *repo)
 {
-	if (repo->_config == NULL) {
+	if (git__load(&repo->_config) == NULL) {
 		git_buf global_buf = GIT_BUF_INIT, xdg_buf = GIT_BUF_INIT, system_buf = GIT_BUF_INIT;
+		git_config *config;
 		int res;
 
 		const char *global_config_path = NULL;
@@ -511,7 +548,7 @@ int git_repository_config__weakptr(git_config **out, git_repository *repo)
 		if (git_config_find_system_r(&system_buf) == 0)
 			system_config_path = system_buf.ptr;
 
-		res = load_config(&repo->_config, repo, global_config_path, xdg_config_path, system_config_path);
+		res = load_config(&config, repo, global_config_path, xdg_config_path, system_config_path);
 
 		git_buf_free(&global_buf);
 		git_buf_free(&xdg_buf);
@@ -520,10 +557,15 @@ int git_repository_config__weakptr(git_config **out, git_repository *repo)
 		if (res < 0)
 			return -1;
 
-		GIT_REFCOUNT_OWN(repo->_config, repo);
+		GIT_REFCOUNT_OWN(config, repo);
+
+		if (git__compare_and_swap(&repo->_config, NULL, config) != NULL) {
+			GIT_REFCOUNT_OWN(config, NULL);
+			git_config_free(config);
+		}
 	}
 
-	*out = repo->_config;
+	*out = git__load(&repo->_config);
 	return 0;
 }
 
@@ -540,33 +582,36 @@ void git_repository_set_config(git_repository *repo, git_config *config)
 {
 	assert(repo && config);
 
-	drop_config(repo);
-
-	repo->_config = config;
-	GIT_REFCOUNT_OWN(repo->_config, repo);
+	set_config(repo, config);
 }
 
 int git_repository_odb__weakptr(git_odb **out, git_repository *repo)
 {
 	assert(repo && out);
 
-	if (repo->_odb == NULL) {
+	if (git__load(&repo->_odb) == NULL) {
 		git_buf odb_path = GIT_BUF_INIT;
+		git_odb *odb;
 		int res;
 
 		if (git_buf_joinpath(&odb_path, repo->path_repository, GIT_OBJECTS_DIR) < 0)
 			return -1;
 
-		res = git_odb_open(&repo->_odb, odb_path.ptr);
+		res = git_odb_open(&odb, odb_path.ptr);
 		git_buf_free(&odb_path); /* done with path */
 
 		if (res < 0)
 			return -1;
 
-		GIT_REFCOUNT_OWN(repo->_odb, repo);
+		GIT_REFCOUNT_OWN(odb, repo);
+
+		if (git__compare_and_swap(&repo->_odb, NULL, odb) != NULL) {
+			GIT_REFCOUNT_OWN(odb, NULL);
+			git_odb_free(odb);
+		}
 	}
 
-	*out = repo->_odb;
+	*out = git__load(&repo->_odb);
 	return 0;
 }
 
@@ -583,37 +628,43 @@ void git_repository_set_odb(git_repository *repo, git_odb *odb)
 {
 	assert(repo && odb);
 
-	drop_odb(repo);
-
-	repo->_odb = odb;
-	GIT_REFCOUNT_OWN(repo->_odb, repo);
 	GIT_REFCOUNT_INC(odb);
+	set_odb(repo, odb);
 }
 
 int git_repository_index__weakptr(git_index **out, git_repository *repo)
 {
 	assert(out && repo);
 
-	if (repo->_index == NULL) {
+	if (git__load(&repo->_index) == NULL) {
 		int res;
 		git_buf index_path = GIT_BUF_INIT;
+		git_index *index;
 
 		if (git_buf_joinpath(&index_path, repo->path_repository, GIT_INDEX_FILE) < 0)
 			return -1;
 
-		res = git_index_open(&repo->_index, index_path.ptr);
+		res = git_index_open(&index, index_path.ptr);
 		git_buf_free(&index_path); /* done with path */
 
 		if (res < 0)
 			return -1;
 
-		GIT_REFCOUNT_OWN(repo->_index, repo);
+		GIT_REFCOUNT_OWN(index, repo);
 
-		if (git_index_set_caps(repo->_index, GIT_INDEXCAP_FROM_OWNER) < 0)
+		if (git_index_set_caps(index, GIT_INDEXCAP_FROM_OWNER) < 0) {
+			GIT_REFCOUNT_OWN(index, NULL);
+			git_index_free(index);
 			return -1;
+		}
+
+		if (git__compare_and_swap(&repo->_index, NULL, index) != NULL) {
+			GIT_REFCOUNT_OWN(index, NULL);
+			git_index_free(index);
+		}
 	}
 
-	*out = repo->_index;
+	*out = git__load(&repo->_index);
 	return 0;
 }
 
@@ -630,11 +681,14 @@ void git_repository_set_index(git_repository *repo, git_index *index)
 {
 	assert(repo && index);
 
-	drop_index(repo);
-
-	repo->_index = index;
-	GIT_REFCOUNT_OWN(repo->_index, repo);
 	GIT_REFCOUNT_INC(index);
+	set_index(repo, index);
+}
+
+void git_repository_set_fsmonitor(git_repository *repo, git_fsmonitor *fsm)
+{
+	assert(repo);
+	set_fsmonitor(repo, fsm);
 }
 
 static int check_repositoryformatversion(git_config *config)
@@ -12,6 +12,7 @@
 #include "git2/odb.h"
 #include "git2/repository.h"
 #include "git2/object.h"
+#include "git2/fsmonitor.h"
 
 #include "index.h"
 #include "cache.h"
@@ -81,6 +82,7 @@ struct git_repository {
 	git_odb *_odb;
 	git_config *_config;
 	git_index *_index;
+	git_fsmonitor *_fsmonitor;
 
 	git_cache objects;
 	git_refcache references;
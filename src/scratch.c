@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#include "common.h"
+#include "global.h"
+#include "scratch.h"
+
+void git_scratch__take(git_buf *buf)
+{
+	git_global_st *global = GIT_GLOBAL;
+	git_scratch *scratch;
+
+	assert(buf && buf->asize == 0);
+
+	if (!global || !(scratch = &global->scratch)->depth)
+		return;
+
+	scratch->depth--;
+
+	buf->ptr = scratch->ptr[scratch->depth];
+	buf->asize = scratch->asize[scratch->depth];
+	buf->size = 0;
+	buf->ptr[0] = '\0';
+}
+
+void git_scratch__release(git_buf *buf)
+{
+	git_global_st *global = GIT_GLOBAL;
+	git_scratch *scratch;
+
+	if (!buf)
+		return;
+
+	if (!global ||
+		buf->asize == 0 ||
+		buf->ptr == git_buf__oom ||
+		buf->asize > GIT_SCRATCH_MAX_RETAINED) {
+		git_buf_free(buf);
+		return;
+	}
+
+	scratch = &global->scratch;
+
+	if (scratch->disabled || scratch->depth == GIT_SCRATCH_DEPTH) {
+		git_buf_free(buf);
+		return;
+	}
+
+	scratch->ptr[scratch->depth] = buf->ptr;
+	scratch->asize[scratch->depth] = buf->asize;
+	scratch->depth++;
+
+	git_buf_init(buf, 0);
+}
+
+void git_scratch__clear(git_scratch *scratch)
+{
+	while (scratch->depth > 0) {
+		scratch->depth--;
+		git__free(scratch->ptr[scratch->depth]);
+		scratch->ptr[scratch->depth] = NULL;
+		scratch->asize[scratch->depth] = 0;
+	}
+}
+
+void git_scratch__set_enabled(int enabled)
+{
+	git_global_st *global = GIT_GLOBAL;
+
+	if (!global)
+		return;
+
+	global->scratch.disabled = !enabled;
+
+	if (!enabled)
+		git_scratch__clear(&global->scratch);
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_scratch_h__
+#define INCLUDE_scratch_h__
+
+#include "buffer.h"
+
+#define GIT_SCRATCH_DEPTH 8
+#define GIT_SCRATCH_MAX_RETAINED (16 * 1024)
+
+/**
+ * Per-thread stack of retained buffer allocations.
+ *
+ * Hot paths which build a temporary path or read a small file into a
+ * `git_buf` on every call can borrow an allocation left behind by a
+ * previous call instead of going through a malloc/realloc/free cycle:
+ *
+ *     git_buf path = GIT_BUF_INIT;
+ *
+ *     git_scratch__take(&path);
+ *     ... use `path` like any other buffer ...
+ *     git_scratch__release(&path);
+ *
+ * `git_scratch__release` replaces the call to `git_buf_free`: the
+ * allocation is pushed back on the calling thread's stack, unless the
+ * stack is full or the buffer grew past `GIT_SCRATCH_MAX_RETAINED`, in
+ * which case it is simply freed.
+ */
+typedef struct {
+	char *ptr[GIT_SCRATCH_DEPTH];
+	size_t asize[GIT_SCRATCH_DEPTH];
+	size_t depth;
+	unsigned int disabled : 1;
+} git_scratch;
+
+/**
+ * Hand an empty `buf` a retained allocation, if one is available.
+ * `buf` must be freshly initialized.
+ */
+extern void git_scratch__take(git_buf *buf);
+
+/**
+ * Give the allocation of `buf` back to the scratch stack (or free it)
+ * and reset `buf` to an empty buffer.
+ */
+extern void git_scratch__release(git_buf *buf);
+
+/**
+ * Free every allocation retained by `scratch`.
+ */
+extern void git_scratch__clear(git_scratch *scratch);
+
+/**
+ * Enable or disable allocation retention for the calling thread.
+ * Disabling it frees whatever was retained so far.
+ */
+extern void git_scratch__set_enabled(int enabled);
+
+#endif
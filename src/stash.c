@@ -10,9 +10,10 @@
 #include "commit.h"
 #include "tree.h"
 #include "reflog.h"
+#include "pool.h"
+#include "git2/blob.h"
 #include "git2/diff.h"
 #include "git2/stash.h"
-#include "git2/status.h"
 #include "git2/checkout.h"
 
 static int create_error(int error, const char *msg)
@@ -161,19 +162,41 @@ cleanup:
 }
 
 struct cb_data {
-	git_index *index;
+	git_repository *repo;
+	git_vector *updates;
+	git_pool *pool;
 
 	bool include_changed;
 	bool include_untracked;
 	bool include_ignored;
 };
 
-static int update_index_cb(
+static int add_update(
+	struct cb_data *data,
+	const char *path,
+	git_filemode_t mode)
+{
+	git_tree_update *update;
+
+	update = git_pool_mallocz(data->pool, 1);
+	GITERR_CHECK_ALLOC(update);
+
+	update->path = path;
+	update->mode = mode;
+
+	/* Deletions only need the path */
+	if (mode != 0 &&
+		git_blob_create_fromfile(&update->oid, data->repo, path) < 0)
+		return -1;
+
+	return git_vector_insert(data->updates, update);
+}
+
+static int collect_updates_cb(
 	void *cb_data,
 	const git_diff_delta *delta,
 	float progress)
 {
-	int pos;
 	struct cb_data *data = (struct cb_data *)cb_data;
 
 	GIT_UNUSED(progress);
@@ -183,31 +206,33 @@ static int update_index_cb(
 		if (!data->include_ignored)
 			break;
 
-		return git_index_add_from_workdir(data->index, delta->new_file.path);
+		return add_update(data, delta->new_file.path, delta->new_file.mode);
 
 	case GIT_DELTA_UNTRACKED:
 		if (!data->include_untracked)
 			break;
 
-		return git_index_add_from_workdir(data->index, delta->new_file.path);
+		return add_update(data, delta->new_file.path, delta->new_file.mode);
 
 	case GIT_DELTA_ADDED:
 		/* Fall through */
 	case GIT_DELTA_MODIFIED:
+		/* Fall through */
+	case GIT_DELTA_TYPECHANGE:
 		if (!data->include_changed)
 			break;
 
-		return git_index_add_from_workdir(data->index, delta->new_file.path);
+		/* Submodules keep the commit recorded in the index */
+		if (S_ISGITLINK(delta->new_file.mode))
+			break;
+
+		return add_update(data, delta->new_file.path, delta->new_file.mode);
 
 	case GIT_DELTA_DELETED:
 		if (!data->include_changed)
 			break;
 
-		if ((pos = git_index_find(data->index, delta->new_file.path)) < 0)
-			return -1;
-
-		if (git_index_remove(data->index, delta->new_file.path, 0) < 0)
-			return -1;
+		return add_update(data, delta->old_file.path, 0);
 
 	default:
 		/* Unimplemented */
@@ -221,66 +246,62 @@ static int update_index_cb(
 	return 0;
 }
 
-static int build_untracked_tree(
+/*
+ * Build a tree from `baseline` (or from scratch) by applying the workdir
+ * changes selected in `data`; only the trees holding a change are written.
+ */
+static int build_tree_from_workdir_changes(
 	git_tree **tree_out,
-	git_index *index,
-	git_commit *i_commit,
-	uint32_t flags)
+	git_repository *repo,
+	git_tree *baseline,
+	git_diff_list *workdir_changes,
+	struct cb_data *data)
 {
-	git_tree *i_tree = NULL;
-	git_diff_list *diff = NULL;
-	git_diff_options opts = {0};
-	struct cb_data data = {0};
+	git_vector updates = GIT_VECTOR_INIT;
+	git_pool pool;
+	git_oid tree_oid;
 	int error = -1;
 
-	git_index_clear(index);
-
-	data.index = index;
-
-	if (flags & GIT_STASH_INCLUDE_UNTRACKED) {
-		opts.flags |= GIT_DIFF_INCLUDE_UNTRACKED | GIT_DIFF_RECURSE_UNTRACKED_DIRS;
-		data.include_untracked = true;
-	}
-
-	if (flags & GIT_STASH_INCLUDE_IGNORED) {
-		opts.flags |= GIT_DIFF_INCLUDE_IGNORED;
-		data.include_ignored = true;
-	}
-
-	if (git_commit_tree(&i_tree, i_commit) < 0)
-		goto cleanup;
+	if (git_pool_init(&pool, sizeof(git_tree_update), 0) < 0)
+		return -1;
 
-	if (git_diff_workdir_to_tree(&diff, git_index_owner(index), i_tree, &opts) < 0)
-		goto cleanup;
+	data->repo = repo;
+	data->updates = &updates;
+	data->pool = &pool;
 
-	if (git_diff_foreach(diff, &data, update_index_cb, NULL, NULL) < 0)
+	if (git_diff_foreach(workdir_changes, data, collect_updates_cb, NULL, NULL) < 0)
 		goto cleanup;
 
-	if (build_tree_from_index(tree_out, index) < 0)
+	if (git_tree__create_updated(&tree_oid, repo, baseline, &updates) < 0)
 		goto cleanup;
 
-	error = 0;
+	error = git_tree_lookup(tree_out, repo, &tree_oid);
 
 cleanup:
-	git_diff_list_free(diff);
-	git_tree_free(i_tree);
+	git_vector_free(&updates);
+	git_pool_clear(&pool);
 	return error;
 }
 
 static int commit_untracked(
 	git_commit **u_commit,
-	git_index *index,
+	git_repository *repo,
 	git_signature *stasher,
 	const char *message,
-	git_commit *i_commit,
+	git_diff_list *workdir_changes,
 	uint32_t flags)
 {
 	git_tree *u_tree = NULL;
 	git_oid u_commit_oid;
 	git_buf msg = GIT_BUF_INIT;
+	struct cb_data data = {0};
 	int error = -1;
 
-	if (build_untracked_tree(&u_tree, index, i_commit, flags) < 0)
+	data.include_untracked = (flags & GIT_STASH_INCLUDE_UNTRACKED) != 0;
+	data.include_ignored = (flags & GIT_STASH_INCLUDE_IGNORED) != 0;
+
+	if (build_tree_from_workdir_changes(
+			&u_tree, repo, NULL, workdir_changes, &data) < 0)
 		goto cleanup;
 
 	if (git_buf_printf(&msg, "untracked files on %s\n", message) < 0)
@@ -288,7 +309,7 @@ static int commit_untracked(
 
 	if (git_commit_create(
 		&u_commit_oid,
-		git_index_owner(index),
+		repo,
 		NULL,
 		stasher,
 		stasher,
@@ -299,7 +320,7 @@ static int commit_untracked(
 		NULL) < 0)
 			goto cleanup;
 
-	error = git_commit_lookup(u_commit, git_index_owner(index), &u_commit_oid);
+	error = git_commit_lookup(u_commit, repo, &u_commit_oid);
 
 cleanup:
 	git_tree_free(u_tree);
@@ -307,58 +328,18 @@ cleanup:
 	return error;
 }
 
-static int build_workdir_tree(
-	git_tree **tree_out,
-	git_index *index,
-	git_commit *b_commit)
-{
-	git_repository *repo = git_index_owner(index);
-	git_tree *b_tree = NULL;
-	git_diff_list *diff = NULL, *diff2 = NULL;
-	git_diff_options opts = {0};
-	struct cb_data data = {0};
-	int error = -1;
-
-	if (git_commit_tree(&b_tree, b_commit) < 0)
-		goto cleanup;
-
-	if (git_diff_index_to_tree(&diff, repo, b_tree, NULL, &opts) < 0)
-		goto cleanup;
-
-	if (git_diff_workdir_to_index(&diff2, repo, NULL, &opts) < 0)
-		goto cleanup;
-
-	if (git_diff_merge(diff, diff2) < 0)
-		goto cleanup;
-
-	data.index = index;
-	data.include_changed = true;
-
-	if (git_diff_foreach(diff, &data, update_index_cb, NULL, NULL) < 0)
-		goto cleanup;
-
-	if (build_tree_from_index(tree_out, index) < 0)
-		goto cleanup;
-
-	error = 0;
-
-cleanup:
-	git_diff_list_free(diff);
-	git_diff_list_free(diff2);
-	git_tree_free(b_tree);
-	return error;
-}
-
 static int commit_worktree(
 	git_oid *w_commit_oid,
-	git_index *index,
+	git_repository *repo,
 	git_signature *stasher,
 	const char *message,
+	git_diff_list *workdir_changes,
 	git_commit *i_commit,
 	git_commit *b_commit,
 	git_commit *u_commit)
 {
 	git_tree *w_tree = NULL, *i_tree = NULL;
+	struct cb_data data = {0};
 	int error = -1;
 
 	const git_commit *parents[] = {	NULL, NULL,	NULL };
@@ -370,15 +351,19 @@ static int commit_worktree(
 	if (git_commit_tree(&i_tree, i_commit) < 0)
 		return -1;
 
-	if (git_index_read_tree(index, i_tree) < 0)
-		goto cleanup;
+	/*
+	 * The worktree commit is the index commit plus the changes made
+	 * in the workdir; everything else is shared with the index tree.
+	 */
+	data.include_changed = true;
 
-	if (build_workdir_tree(&w_tree, index, b_commit) < 0)
+	if (build_tree_from_workdir_changes(
+			&w_tree, repo, i_tree, workdir_changes, &data) < 0)
 		goto cleanup;
 
 	if (git_commit_create(
 		w_commit_oid,
-		git_index_owner(index),
+		repo,
 		NULL,
 		stasher,
 		stasher,
@@ -456,59 +441,166 @@ cleanup:
 	return error;
 }
 
-static int is_dirty_cb(const char *path, unsigned int status, void *payload)
+static int retrieve_changes(
+	git_diff_list **index_changes,
+	git_diff_list **workdir_changes,
+	git_repository *repo,
+	git_commit *b_commit,
+	uint32_t flags)
 {
-	GIT_UNUSED(path);
-	GIT_UNUSED(status);
-	GIT_UNUSED(payload);
+	git_tree *b_tree = NULL;
+	git_diff_options opts = {0};
+	int error;
+
+	if ((error = git_commit_tree(&b_tree, b_commit)) < 0)
+		return error;
+
+	if ((error = git_diff_index_to_tree(
+			index_changes, repo, b_tree, NULL, &opts)) < 0)
+		goto cleanup;
+
+	if (flags & GIT_STASH_INCLUDE_UNTRACKED)
+		opts.flags |= GIT_DIFF_INCLUDE_UNTRACKED | GIT_DIFF_RECURSE_UNTRACKED_DIRS;
+
+	if (flags & GIT_STASH_INCLUDE_IGNORED)
+		opts.flags |= GIT_DIFF_INCLUDE_IGNORED;
 
-	return 1;
+	error = git_diff_workdir_to_index(workdir_changes, repo, NULL, &opts);
+
+cleanup:
+	git_tree_free(b_tree);
+	return error;
 }
 
 static int ensure_there_are_changes_to_stash(
-	git_repository *repo,
-	bool include_untracked_files,
-	bool include_ignored_files)
+	git_diff_list *index_changes,
+	git_diff_list *workdir_changes)
 {
-	int error;
-	git_status_options opts;
+	if (git_diff_num_deltas(index_changes) > 0 ||
+		git_diff_num_deltas(workdir_changes) > 0)
+		return 0;
+
+	return create_error(GIT_ENOTFOUND, "There is nothing to stash.");
+}
 
-	memset(&opts, 0, sizeof(opts));
-	opts.show  = GIT_STATUS_SHOW_INDEX_AND_WORKDIR;
-	if (include_untracked_files)
-		opts.flags = GIT_STATUS_OPT_INCLUDE_UNTRACKED |
-		GIT_STATUS_OPT_RECURSE_UNTRACKED_DIRS;
+struct reset_data {
+	git_vector *paths;
+	bool include_untracked;
+};
 
-	if (include_ignored_files)
-		opts.flags = GIT_STATUS_OPT_INCLUDE_IGNORED;
+static int collect_paths_cb(
+	void *cb_data,
+	const git_diff_delta *delta,
+	float progress)
+{
+	struct reset_data *data = (struct reset_data *)cb_data;
 
-	error = git_status_foreach_ext(repo, &opts, is_dirty_cb, NULL);
+	GIT_UNUSED(progress);
 
-	if (error == GIT_EUSER)
+	if (delta->status == GIT_DELTA_IGNORED ||
+		(delta->status == GIT_DELTA_UNTRACKED && !data->include_untracked))
 		return 0;
 
-	if (!error)
-		return create_error(GIT_ENOTFOUND, "There is nothing to stash.");
+	return git_vector_insert(data->paths, (char *)delta->old_file.path);
+}
 
+static int reset_index_entry(
+	git_index *index,
+	git_tree *tree,
+	const char *path)
+{
+	git_tree_entry *tree_entry = NULL;
+	git_index_entry *index_entry, entry;
+	int error;
+
+	index_entry = git_index_get_bypath(index, path, 0);
+
+	if ((error = git_tree_entry_bypath(&tree_entry, tree, path)) == GIT_ENOTFOUND) {
+		giterr_clear();
+		return index_entry ? git_index_remove(index, path, 0) : 0;
+	}
+
+	if (error < 0)
+		return error;
+
+	if (!index_entry ||
+		index_entry->mode != git_tree_entry_filemode(tree_entry) ||
+		!git_oid_equal(&index_entry->oid, git_tree_entry_id(tree_entry))) {
+		memset(&entry, 0, sizeof(entry));
+		entry.path = (char *)path;
+		entry.mode = git_tree_entry_filemode(tree_entry);
+		git_oid_cpy(&entry.oid, git_tree_entry_id(tree_entry));
+
+		error = git_index_add(index, &entry);
+	}
+
+	git_tree_entry_free(tree_entry);
 	return error;
 }
 
+/*
+ * Bring the paths which have been stashed back to their state in `commit`.
+ * Other index entries (and their cached stat data) are left untouched
+ * and checkout only looks at the stashed paths.
+ */
 static int reset_index_and_workdir(
 	git_repository *repo,
+	git_index *index,
 	git_commit *commit,
+	git_diff_list *index_changes,
+	git_diff_list *workdir_changes,
 	bool remove_untracked)
 {
 	git_checkout_opts opts;
+	git_vector paths = GIT_VECTOR_INIT;
+	struct reset_data data;
+	git_tree *tree = NULL;
+	const char *path;
+	unsigned int i;
+	int error = -1;
+
+	if (git_vector_init(&paths, 16, git__strcmp_cb) < 0)
+		return -1;
+
+	data.paths = &paths;
+	data.include_untracked = remove_untracked;
+
+	if (git_diff_foreach(index_changes, &data, collect_paths_cb, NULL, NULL) < 0 ||
+		git_diff_foreach(workdir_changes, &data, collect_paths_cb, NULL, NULL) < 0)
+		goto cleanup;
+
+	git_vector_sort(&paths);
+	git_vector_uniq(&paths);
+
+	if (git_commit_tree(&tree, commit) < 0)
+		goto cleanup;
+
+	git_vector_foreach(&paths, i, path) {
+		if (reset_index_entry(index, tree, path) < 0)
+			goto cleanup;
+	}
+
+	if (git_index_write(index) < 0)
+		goto cleanup;
 
 	memset(&opts, 0, sizeof(git_checkout_opts));
 
 	opts.checkout_strategy =
-		GIT_CHECKOUT_UPDATE_MODIFIED | GIT_CHECKOUT_UPDATE_UNTRACKED;
+		GIT_CHECKOUT_UPDATE_MODIFIED | GIT_CHECKOUT_UPDATE_UNTRACKED |
+		GIT_CHECKOUT_DISABLE_PATHSPEC_MATCH;
 
 	if (remove_untracked)
 		opts.checkout_strategy |= GIT_CHECKOUT_REMOVE_UNTRACKED;
 
-	return git_checkout_tree(repo, (git_object *)commit, &opts);
+	opts.paths.strings = (char **)paths.contents;
+	opts.paths.count = paths.length;
+
+	error = git_checkout_index(repo, index, &opts);
+
+cleanup:
+	git_tree_free(tree);
+	git_vector_free(&paths);
+	return error;
 }
 
 int git_stash_save(
@@ -520,6 +612,7 @@ int git_stash_save(
 {
 	git_index *index = NULL;
 	git_commit *b_commit = NULL, *i_commit = NULL, *u_commit = NULL;
+	git_diff_list *index_changes = NULL, *workdir_changes = NULL;
 	git_buf msg = GIT_BUF_INIT;
 	int error;
 
@@ -531,10 +624,12 @@ int git_stash_save(
 	if ((error = retrieve_base_commit_and_message(&b_commit, &msg, repo)) < 0)
 		goto cleanup;
 
+	if ((error = retrieve_changes(
+		&index_changes, &workdir_changes, repo, b_commit, flags)) < 0)
+		goto cleanup;
+
 	if ((error = ensure_there_are_changes_to_stash(
-		repo,
-		(flags & GIT_STASH_INCLUDE_UNTRACKED) == GIT_STASH_INCLUDE_UNTRACKED,
-		(flags & GIT_STASH_INCLUDE_IGNORED) == GIT_STASH_INCLUDE_IGNORED)) < 0)
+		index_changes, workdir_changes)) < 0)
 		goto cleanup;
 
 	error = -1;
@@ -546,13 +641,15 @@ int git_stash_save(
 		goto cleanup;
 
 	if ((flags & GIT_STASH_INCLUDE_UNTRACKED || flags & GIT_STASH_INCLUDE_IGNORED)
-		&& commit_untracked(&u_commit, index, stasher, git_buf_cstr(&msg), i_commit, flags) < 0)
+		&& commit_untracked(&u_commit, repo, stasher, git_buf_cstr(&msg),
+			workdir_changes, flags) < 0)
 		goto cleanup;
 
 	if (prepare_worktree_commit_message(&msg, message) < 0)
 		goto cleanup;
 
-	if (commit_worktree(out, index, stasher, git_buf_cstr(&msg), i_commit, b_commit, u_commit) < 0)
+	if (commit_worktree(out, repo, stasher, git_buf_cstr(&msg),
+			workdir_changes, i_commit, b_commit, u_commit) < 0)
 		goto cleanup;
 
 	git_buf_rtrim(&msg);
@@ -561,8 +658,11 @@ int git_stash_save(
 
 	if (reset_index_and_workdir(
 		repo,
+		index,
 		((flags & GIT_STASH_KEEP_INDEX) == GIT_STASH_KEEP_INDEX) ?
 			i_commit : b_commit,
+		index_changes,
+		workdir_changes,
 		(flags & GIT_STASH_INCLUDE_UNTRACKED) == GIT_STASH_INCLUDE_UNTRACKED) < 0)
 		goto cleanup;
 
@@ -570,6 +670,8 @@ int git_stash_save(
 
 cleanup:
 	git_buf_free(&msg);
+	git_diff_list_free(index_changes);
+	git_diff_list_free(workdir_changes);
 	git_commit_free(i_commit);
 	git_commit_free(b_commit);
 	git_commit_free(u_commit);
@@ -8,57 +8,55 @@
 #define INCLUDE_strmap_h__
 
 #include "common.h"
+#include "hashmap.h"
 
-#define kmalloc git__malloc
-#define kcalloc git__calloc
-#define krealloc git__realloc
-#define kfree git__free
-#include "khash.h"
-
-__KHASH_TYPE(str, const char *, void *);
-typedef khash_t(str) git_strmap;
+GIT_HASHMAP_TYPE(str, const char *);
+typedef GIT_HASHMAP_T(str) git_strmap;
 
 #define GIT__USE_STRMAP \
-	__KHASH_IMPL(str, static kh_inline, const char *, void *, 1, kh_str_hash_func, kh_str_hash_equal)
+	GIT_HASHMAP_IMPL(str, static git_hashmap_inline, const char *, git_hashmap_str_hash, git_hashmap_str_equal)
+
+#define git_strmap_alloc()  git_hashmap_str_init()
+#define git_strmap_free(h)  git_hashmap_str_destroy(h), h = NULL
+#define git_strmap_clear(h) git_hashmap_str_clear(h)
 
-#define git_strmap_alloc()  kh_init(str)
-#define git_strmap_free(h)  kh_destroy(str, h), h = NULL
-#define git_strmap_clear(h) kh_clear(str, h)
+#define git_strmap_num_entries(h) git_hashmap_size(h)
 
-#define git_strmap_num_entries(h) kh_size(h)
+#define git_strmap_lookup_index(h, k)  git_hashmap_str_get(h, k)
+#define git_strmap_valid_index(h, idx) (idx != git_hashmap_end(h))
 
-#define git_strmap_lookup_index(h, k)  kh_get(str, h, k)
-#define git_strmap_valid_index(h, idx) (idx != kh_end(h))
+#define git_strmap_exists(h, k) (git_hashmap_str_get(h, k) != git_hashmap_end(h))
 
-#define git_strmap_exists(h, k) (kh_get(str, h, k) != kh_end(h))
+#define git_strmap_value_at(h, idx)        git_hashmap_val(h, idx)
+#define git_strmap_set_value_at(h, idx, v) git_hashmap_val(h, idx) = v
+#define git_strmap_delete_at(h, idx)       git_hashmap_str_del(h, idx)
 
-#define git_strmap_value_at(h, idx)        kh_val(h, idx)
-#define git_strmap_set_value_at(h, idx, v) kh_val(h, idx) = v
-#define git_strmap_delete_at(h, idx)       kh_del(str, h, idx)
+/* add a bucket for `key` without setting its value, see git_hashmap_put */
+#define git_strmap_put(h, key, rval) git_hashmap_str_put(h, key, rval)
 
 #define git_strmap_insert(h, key, val, rval) do { \
-	khiter_t __pos = kh_put(str, h, key, &rval); \
+	git_hashmap_iter __pos = git_hashmap_str_put(h, key, &rval); \
 	if (rval >= 0) { \
-		if (rval == 0) kh_key(h, __pos) = key; \
-		kh_val(h, __pos) = val; \
+		if (rval == 0) git_hashmap_key(h, __pos) = key; \
+		git_hashmap_val(h, __pos) = val; \
 	} } while (0)
 
 #define git_strmap_insert2(h, key, val, oldv, rval) do { \
-	khiter_t __pos = kh_put(str, h, key, &rval); \
+	git_hashmap_iter __pos = git_hashmap_str_put(h, key, &rval); \
 	if (rval >= 0) { \
 		if (rval == 0) { \
-			oldv = kh_val(h, __pos); \
-			kh_key(h, __pos) = key; \
+			oldv = git_hashmap_val(h, __pos); \
+			git_hashmap_key(h, __pos) = key; \
 		} else { oldv = NULL; } \
-		kh_val(h, __pos) = val; \
+		git_hashmap_val(h, __pos) = val; \
 	} } while (0)
 
 #define git_strmap_delete(h, key) do { \
-	khiter_t __pos = git_strmap_lookup_index(h, key); \
+	git_hashmap_iter __pos = git_strmap_lookup_index(h, key); \
 	if (git_strmap_valid_index(h, __pos)) \
 		git_strmap_delete_at(h, __pos); } while (0)
 
-#define git_strmap_foreach		kh_foreach
-#define git_strmap_foreach_value	kh_foreach_value
+#define git_strmap_foreach		git_hashmap_foreach
+#define git_strmap_foreach_value	git_hashmap_foreach_value
 
 #endif
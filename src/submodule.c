@@ -37,18 +37,18 @@ static git_cvar_map _sm_ignore_map[] = {
 	{GIT_CVAR_STRING, "all", GIT_SUBMODULE_IGNORE_ALL},
 };
 
-static kh_inline khint_t str_hash_no_trailing_slash(const char *s)
+GIT_INLINE(uint32_t) str_hash_no_trailing_slash(const char *s)
 {
-	khint_t h;
+	uint32_t h;
 
 	for (h = 0; *s; ++s)
 		if (s[1] != '\0' || *s != '/')
-			h = (h << 5) - h + *s;
+			h = (h << 5) - h + (unsigned char)*s;
 
-	return h;
+	return git_hashmap__mix(h);
 }
 
-static kh_inline int str_equal_no_trailing_slash(const char *a, const char *b)
+GIT_INLINE(int) str_equal_no_trailing_slash(const char *a, const char *b)
 {
 	size_t alen = a ? strlen(a) : 0;
 	size_t blen = b ? strlen(b) : 0;
@@ -61,8 +61,8 @@ static kh_inline int str_equal_no_trailing_slash(const char *a, const char *b)
 	return (alen == blen && strncmp(a, b, alen) == 0);
 }
 
-__KHASH_IMPL(
-	str, static kh_inline, const char *, void *, 1,
+GIT_HASHMAP_IMPL(
+	str, static git_hashmap_inline, const char *,
 	str_hash_no_trailing_slash, str_equal_no_trailing_slash);
 
 static int load_submodule_config(git_repository *repo, bool force);
@@ -101,7 +101,7 @@ int git_submodule_lookup(
 	const char *name)       /* trailing slash is allowed */
 {
 	int error;
-	khiter_t pos;
+	git_hashmap_iter pos;
 
 	assert(repo && name);
 
@@ -892,7 +892,7 @@ static int submodule_get(
 	const char *alternate)
 {
 	git_strmap *smcfg = repo->submodules;
-	khiter_t pos;
+	git_hashmap_iter pos;
 	git_submodule *sm;
 	int error;
 
@@ -909,7 +909,7 @@ static int submodule_get(
 		/* insert value at name - if another thread beats us to it, then use
 		 * their record and release our own.
 		 */
-		pos = kh_put(str, smcfg, sm->name, &error);
+		pos = git_strmap_put(smcfg, sm->name, &error);
 
 		if (error < 0) {
 			submodule_release(sm, 1);
@@ -1102,7 +1102,7 @@ static int submodule_load_from_wd_lite(
 static void submodule_mode_mismatch(
 	git_repository *repo, const char *path, unsigned int flag)
 {
-	khiter_t pos = git_strmap_lookup_index(repo->submodules, path);
+	git_hashmap_iter pos = git_strmap_lookup_index(repo->submodules, path);
 
 	if (git_strmap_valid_index(repo->submodules, pos)) {
 		git_submodule *sm = git_strmap_value_at(repo->submodules, pos);
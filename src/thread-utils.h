@@ -46,6 +46,20 @@ GIT_INLINE(void) git_atomic_set(git_atomic *a, int val)
 #define git_cond_signal(c)	pthread_cond_signal(c)
 #define git_cond_broadcast(c)	pthread_cond_broadcast(c)
 
+/* Pthreads read-write locks */
+#define git_rwlock pthread_rwlock_t
+#define git_rwlock_init(a)	pthread_rwlock_init(a, NULL)
+#define git_rwlock_rdlock(a)	pthread_rwlock_rdlock(a)
+#define git_rwlock_wrlock(a)	pthread_rwlock_wrlock(a)
+#define git_rwlock_free(a)	pthread_rwlock_destroy(a)
+#if defined(GIT_WIN32)
+#define git_rwlock_rdunlock(a)	pthread_rwlock_rdunlock(a)
+#define git_rwlock_wrunlock(a)	pthread_rwlock_wrunlock(a)
+#else
+#define git_rwlock_rdunlock(a)	pthread_rwlock_unlock(a)
+#define git_rwlock_wrunlock(a)	pthread_rwlock_unlock(a)
+#endif
+
 GIT_INLINE(int) git_atomic_inc(git_atomic *a)
 {
 #if defined(GIT_WIN32)
@@ -68,6 +82,58 @@ GIT_INLINE(int) git_atomic_dec(git_atomic *a)
 #endif
 }
 
+/*
+ * Atomically replace `*ptr` by `newval` if it still holds `oldval`;
+ * returns the value `*ptr` held before the call, so the swap happened
+ * if and only if the result is `oldval`.
+ */
+GIT_INLINE(void *) git___compare_and_swap(
+	void * volatile *ptr, void *oldval, void *newval)
+{
+#if defined(GIT_WIN32)
+	return InterlockedCompareExchangePointer((volatile PVOID *)ptr, newval, oldval);
+#elif defined(__GNUC__)
+	return __sync_val_compare_and_swap(ptr, oldval, newval);
+#else
+#	error "Unsupported architecture for atomic operations"
+#endif
+}
+
+/* Atomically store `newval` in `*ptr`; returns the previous value */
+GIT_INLINE(void *) git___swap(void * volatile *ptr, void *newval)
+{
+#if defined(GIT_WIN32)
+	return InterlockedExchangePointer((volatile PVOID *)ptr, newval);
+#elif defined(__GNUC__)
+	void *old = __sync_lock_test_and_set(ptr, newval);
+	__sync_synchronize();
+	return old;
+#else
+#	error "Unsupported architecture for atomic operations"
+#endif
+}
+
+/*
+ * Read a pointer published by `git__compare_and_swap` or `git__swap`,
+ * so that the object it points to is seen fully initialized
+ */
+GIT_INLINE(void *) git___load(void * volatile *ptr)
+{
+#if defined(GIT_WIN32)
+	void *value = *ptr;
+	MemoryBarrier();
+	return value;
+#elif defined(__GNUC__) && defined(__ATOMIC_ACQUIRE)
+	return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+#elif defined(__GNUC__)
+	void *value = *ptr;
+	__sync_synchronize();
+	return value;
+#else
+#	error "Unsupported architecture for atomic operations"
+#endif
+}
+
 #else
 
 #define git_thread unsigned int
@@ -91,6 +157,15 @@ GIT_INLINE(int) git_atomic_dec(git_atomic *a)
 #define git_cond_signal(c) (void)0
 #define git_cond_broadcast(c) (void)0
 
+/* Pthreads read-write locks */
+#define git_rwlock unsigned int
+#define git_rwlock_init(a) (void)0
+#define git_rwlock_rdlock(a) (void)0
+#define git_rwlock_rdunlock(a) (void)0
+#define git_rwlock_wrlock(a) (void)0
+#define git_rwlock_wrunlock(a) (void)0
+#define git_rwlock_free(a) (void)0
+
 GIT_INLINE(int) git_atomic_inc(git_atomic *a)
 {
 	return ++a->val;
@@ -101,8 +176,40 @@ GIT_INLINE(int) git_atomic_dec(git_atomic *a)
 	return --a->val;
 }
 
+GIT_INLINE(void *) git___compare_and_swap(
+	void * volatile *ptr, void *oldval, void *newval)
+{
+	void *old = *ptr;
+
+	if (old == oldval)
+		*ptr = newval;
+
+	return old;
+}
+
+GIT_INLINE(void *) git___swap(void * volatile *ptr, void *newval)
+{
+	void *old = *ptr;
+	*ptr = newval;
+	return old;
+}
+
+GIT_INLINE(void *) git___load(void * volatile *ptr)
+{
+	return *ptr;
+}
+
 #endif
 
+#define git__compare_and_swap(ptr, oldval, newval) \
+	git___compare_and_swap((void * volatile *)(ptr), (oldval), (newval))
+
+#define git__swap(ptr, newval) \
+	git___swap((void * volatile *)(ptr), (newval))
+
+#define git__load(ptr) \
+	git___load((void * volatile *)(ptr))
+
 extern int git_online_cpus(void);
 
 #endif /* INCLUDE_thread_utils_h__ */
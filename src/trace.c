@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#include "common.h"
+#include "trace.h"
+
+#ifdef GIT_TRACE
+
+#include <time.h>
+#ifndef GIT_WIN32
+# include <sys/time.h>
+#endif
+
+int git_trace__active;
+
+static struct {
+	git_trace_cb callback;
+	void *payload;
+	int metrics;
+} trace;
+
+static git_trace_metric trace_metrics[GIT_TRACE__EVENTS];
+
+static void trace_update_active(void)
+{
+	git_trace__active = (trace.callback != NULL || trace.metrics);
+}
+
+uint64_t git_trace__now(void)
+{
+#if defined(GIT_WIN32)
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER now;
+
+	if (!freq.QuadPart)
+		QueryPerformanceFrequency(&freq);
+
+	QueryPerformanceCounter(&now);
+	return (uint64_t)((double)now.QuadPart * 1e9 / (double)freq.QuadPart);
+#elif defined(CLOCK_MONOTONIC)
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#else
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000000 + (uint64_t)tv.tv_usec * 1000;
+#endif
+}
+
+GIT_INLINE(void) metric_add(uint64_t *counter, uint64_t value)
+{
+#if defined(GIT_THREADS) && defined(GIT_WIN32)
+	InterlockedExchangeAdd64((volatile LONG64 *)counter, (LONG64)value);
+#elif defined(GIT_THREADS) && defined(__GNUC__)
+	__sync_add_and_fetch(counter, value);
+#else
+	*counter += value;
+#endif
+}
+
+GIT_INLINE(void) metric_max(uint64_t *counter, uint64_t value)
+{
+#if defined(GIT_THREADS) && defined(GIT_WIN32)
+	LONG64 seen;
+
+	while ((uint64_t)(seen = *(volatile LONG64 *)counter) < value &&
+		InterlockedCompareExchange64(
+			(volatile LONG64 *)counter, (LONG64)value, seen) != seen)
+		/* retry */;
+#elif defined(GIT_THREADS) && defined(__GNUC__)
+	uint64_t seen;
+
+	while ((seen = *(volatile uint64_t *)counter) < value &&
+		!__sync_bool_compare_and_swap(counter, seen, value))
+		/* retry */;
+#else
+	if (*counter < value)
+		*counter = value;
+#endif
+}
+
+void git_trace__emit(git_trace_event_t event, uint64_t start, size_t value)
+{
+	uint64_t elapsed = start ? git_trace__now() - start : 0;
+	git_trace_cb callback = trace.callback;
+
+	if (trace.metrics) {
+		git_trace_metric *metric = &trace_metrics[event];
+
+		metric_add(&metric->count, 1);
+		metric_add(&metric->total_value, value);
+		metric_add(&metric->total_ns, elapsed);
+		metric_max(&metric->max_value, value);
+	}
+
+	if (callback)
+		callback(event, elapsed, value, trace.payload);
+}
+
+int git_trace_set(git_trace_cb callback, void *payload)
+{
+	trace.callback = NULL;
+	trace.payload = payload;
+	trace.callback = callback;
+
+	trace_update_active();
+	return 0;
+}
+
+int git_trace_metrics_enable(int enabled)
+{
+	trace.metrics = (enabled != 0);
+
+	trace_update_active();
+	return 0;
+}
+
+int git_trace_metrics_get(git_trace_metric *out, git_trace_event_t event)
+{
+	assert(out);
+
+	if ((int)event < 0 || event >= GIT_TRACE__EVENTS) {
+		giterr_set(GITERR_INVALID, "Invalid trace event %d", event);
+		return -1;
+	}
+
+	memcpy(out, &trace_metrics[event], sizeof(git_trace_metric));
+	return 0;
+}
+
+void git_trace_metrics_reset(void)
+{
+	memset(trace_metrics, 0, sizeof(trace_metrics));
+}
+
+#else
+
+static int trace_unsupported(void)
+{
+	giterr_set(GITERR_INVALID,
+		"This version of libgit2 was not built with tracing support");
+	return -1;
+}
+
+int git_trace_set(git_trace_cb callback, void *payload)
+{
+	GIT_UNUSED(payload);
+
+	return callback ? trace_unsupported() : 0;
+}
+
+int git_trace_metrics_enable(int enabled)
+{
+	return enabled ? trace_unsupported() : 0;
+}
+
+int git_trace_metrics_get(git_trace_metric *out, git_trace_event_t event)
+{
+	GIT_UNUSED(event);
+
+	assert(out);
+	memset(out, 0, sizeof(git_trace_metric));
+	return trace_unsupported();
+}
+
+void git_trace_metrics_reset(void)
+{
+	/* noop */
+}
+
+#endif
@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_trace_h__
+#define INCLUDE_trace_h__
+
+#include "common.h"
+#include "git2/trace.h"
+
+/*
+ * Instrumentation helpers.
+ *
+ * A span is declared with GIT_TRACE_SPAN, started with GIT_TRACE_BEGIN
+ * and reported with GIT_TRACE_END; GIT_TRACE_EVENT reports a plain
+ * event.  When tracing is not compiled in (GIT_TRACE undefined) they
+ * compile to nothing; when it is, they cost a single test of
+ * `git_trace__active` until a callback or the metrics are enabled.
+ */
+#ifdef GIT_TRACE
+
+extern int git_trace__active;
+
+extern uint64_t git_trace__now(void);
+extern void git_trace__emit(
+	git_trace_event_t event, uint64_t start, size_t value);
+
+#define GIT_TRACE_SPAN(span) uint64_t span = 0
+
+#define GIT_TRACE_BEGIN(span) do { \
+	if (git_trace__active) (span) = git_trace__now(); } while (0)
+
+#define GIT_TRACE_END(event, span, value) do { \
+	if (git_trace__active) git_trace__emit((event), (span), (value)); } while (0)
+
+#define GIT_TRACE_EVENT(event, value) do { \
+	if (git_trace__active) git_trace__emit((event), 0, (value)); } while (0)
+
+#else
+
+#define GIT_TRACE_SPAN(span) int span = 0
+#define GIT_TRACE_BEGIN(span) GIT_UNUSED(span)
+#define GIT_TRACE_END(event, span, value) GIT_UNUSED(span)
+#define GIT_TRACE_EVENT(event, value) do { } while (0)
+
+#endif
+
+#endif
@@ -7,6 +7,7 @@
 #include "smart.h"
 #include "refs.h"
 #include "repository.h"
+#include "trace.h"
 
 #define NETWORK_XFER_THRESHOLD (100*1024)
 
@@ -89,6 +90,12 @@ int git_smart__detect_caps(git_pkt_ref *pkt, transport_smart_caps *caps)
 			continue;
 		}
 
+		if(!git__prefixcmp(ptr, GIT_CAP_THIN_PACK)) {
+			caps->common = caps->thin_pack = 1;
+			ptr += strlen(GIT_CAP_THIN_PACK);
+			continue;
+		}
+
 		/* Keep side-band check after side-band-64k */
 		if(!git__prefixcmp(ptr, GIT_CAP_SIDE_BAND_64K)) {
 			caps->common = caps->side_band_64k = 1;
@@ -213,6 +220,9 @@ int git_smart__negotiate_fetch(git_transport *transport, git_repository *repo, c
 	int error = -1, pkt_type;
 	unsigned int i;
 	git_oid oid;
+	GIT_TRACE_SPAN(span);
+
+	GIT_TRACE_BEGIN(span);
 
 	/* No own logic, do our thing */
 	if (git_pkt_buffer_wants(refs, count, &t->caps, &data) < 0)
@@ -334,6 +344,7 @@ int git_smart__negotiate_fetch(git_transport *transport, git_repository *repo, c
 		} while (1);
 	}
 
+	GIT_TRACE_END(GIT_TRACE_NET_NEGOTIATE, span, i);
 	return 0;
 
 on_error:
@@ -402,6 +413,9 @@ int git_smart__download_pack(
 	struct git_odb_writepack *writepack = NULL;
 	int error = -1;
 	struct network_packetsize_payload npp = {0};
+	GIT_TRACE_SPAN(span);
+
+	GIT_TRACE_BEGIN(span);
 
 	memset(stats, 0, sizeof(git_transfer_progress));
 
@@ -469,6 +483,7 @@ int git_smart__download_pack(
 
 on_success:
 	error = 0;
+	GIT_TRACE_END(GIT_TRACE_NET_DOWNLOAD, span, stats->received_objects);
 
 on_error:
 	writepack->free(writepack);
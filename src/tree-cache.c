@@ -5,6 +5,8 @@
  * a Linking Exception. For full terms see the included COPYING file.
  */
 
+#define GIT_ALLOC_SUBSYSTEM GIT_ALLOC_INDEX
+
 #include "tree-cache.h"
 
 static git_tree_cache *find_child(const git_tree_cache *tree, const char *path)
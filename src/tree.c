@@ -613,6 +613,21 @@ int git_treebuilder_insert(
 	return 0;
 }
 
+unsigned int git_treebuilder_entrycount(git_treebuilder *bld)
+{
+	unsigned int i, count = 0;
+
+	assert(bld);
+
+	for (i = 0; i < bld->entries.length; ++i) {
+		git_tree_entry *entry = bld->entries.contents[i];
+		if (!entry->removed)
+			count++;
+	}
+
+	return count;
+}
+
 static git_tree_entry *treebuilder_get(git_treebuilder *bld, const char *filename)
 {
 	int idx;
@@ -689,6 +704,112 @@ on_error:
 	return -1;
 }
 
+static int tree_update_cmp(const void *a, const void *b)
+{
+	const git_tree_update *ua = a, *ub = b;
+	return strcmp(ua->path, ub->path);
+}
+
+static int tree_update_r(
+	git_oid *out,
+	bool *empty,
+	git_repository *repo,
+	git_tree *tree,
+	git_tree_update **updates,
+	size_t count,
+	size_t prefix_len)
+{
+	git_treebuilder *bld = NULL;
+	git_tree *subtree = NULL;
+	git_buf name = GIT_BUF_INIT;
+	size_t i, j;
+	int error;
+
+	if ((error = git_treebuilder_create(&bld, tree)) < 0)
+		return error;
+
+	for (i = 0; i < count; i = j) {
+		const char *path = updates[i]->path + prefix_len;
+		const char *slash = strchr(path, '/');
+		const git_tree_entry *entry;
+		git_oid subtree_oid;
+		bool subtree_empty;
+
+		j = i + 1;
+
+		if (slash == NULL) {
+			if (updates[i]->mode != 0)
+				error = git_treebuilder_insert(
+					NULL, bld, path, &updates[i]->oid, updates[i]->mode);
+			else if (treebuilder_get(bld, path) != NULL)
+				error = git_treebuilder_remove(bld, path);
+
+			if (error < 0)
+				goto cleanup;
+			continue;
+		}
+
+		/* Gather all the updates below this subdirectory */
+		while (j < count &&
+			!strncmp(updates[j]->path + prefix_len, path, slash - path + 1))
+			j++;
+
+		git_buf_clear(&name);
+		if ((error = git_buf_put(&name, path, slash - path)) < 0)
+			goto cleanup;
+
+		entry = tree ? entry_fromname(tree, name.ptr, name.size) : NULL;
+
+		if (entry != NULL && git_tree_entry__is_tree(entry) &&
+			(error = git_tree_lookup(&subtree, repo, &entry->oid)) < 0)
+			goto cleanup;
+
+		error = tree_update_r(&subtree_oid, &subtree_empty, repo, subtree,
+			updates + i, j - i, prefix_len + name.size + 1);
+
+		git_tree_free(subtree);
+		subtree = NULL;
+
+		if (error < 0)
+			goto cleanup;
+
+		if (!subtree_empty)
+			error = git_treebuilder_insert(
+				NULL, bld, name.ptr, &subtree_oid, GIT_FILEMODE_TREE);
+		else if ((entry = treebuilder_get(bld, name.ptr)) != NULL &&
+			git_tree_entry__is_tree(entry))
+			error = git_treebuilder_remove(bld, name.ptr);
+
+		if (error < 0)
+			goto cleanup;
+	}
+
+	*empty = (git_treebuilder_entrycount(bld) == 0);
+
+	/* Empty subtrees are dropped by the caller, but the root is kept */
+	if (!*empty || prefix_len == 0)
+		error = git_treebuilder_write(out, repo, bld);
+
+cleanup:
+	git_buf_free(&name);
+	git_treebuilder_free(bld);
+	return error;
+}
+
+int git_tree__create_updated(
+	git_oid *out, git_repository *repo, git_tree *baseline, git_vector *updates)
+{
+	bool empty;
+
+	assert(out && repo && updates);
+
+	updates->_cmp = tree_update_cmp;
+	git_vector_sort(updates);
+
+	return tree_update_r(out, &empty, repo, baseline,
+		(git_tree_update **)updates->contents, updates->length, 0);
+}
+
 void git_treebuilder_filter(git_treebuilder *bld, int (*filter)(const git_tree_entry *, void *), void *payload)
 {
 	unsigned int i;
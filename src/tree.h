@@ -53,6 +53,24 @@ int git_tree__prefix_position(git_tree *tree, const char *prefix);
  */
 int git_tree__write_index(git_oid *oid, git_index *index, git_repository *repo);
 
+/**
+ * A change to apply to a tree with `git_tree__create_updated`
+ */
+typedef struct {
+	const char *path;
+	git_oid oid;
+	git_filemode_t mode; /* 0 removes the entry at `path` */
+} git_tree_update;
+
+/**
+ * Write the tree resulting from applying `updates` (a vector of
+ * `git_tree_update` pointers, sorted by path in the process) to
+ * `baseline`, which may be NULL.  Only the trees leading to an updated
+ * path are rewritten; trees left empty are removed.
+ */
+int git_tree__create_updated(
+	git_oid *out, git_repository *repo, git_tree *baseline, git_vector *updates);
+
 /**
  * Obsolete mode kept for compatibility reasons
  */
@@ -28,6 +28,9 @@ int git_libgit2_capabilities()
 #ifdef GIT_THREADS
 		| GIT_CAP_THREADS
 #endif
+#ifdef GIT_TRACE
+		| GIT_CAP_TRACE
+#endif
 #if defined(GIT_SSL) || defined(GIT_WINHTTP)
 		| GIT_CAP_HTTPS
 #endif
@@ -14,6 +14,29 @@
 # define min(a,b) ((a) < (b) ? (a) : (b))
 #endif
 
+/*
+ * Allocations are accounted to the subsystem named by GIT_ALLOC_SUBSYSTEM
+ * when statistics are enabled; a source file can set it before its first
+ * include to have its allocations counted apart.
+ */
+#ifndef GIT_ALLOC_SUBSYSTEM
+# define GIT_ALLOC_SUBSYSTEM GIT_ALLOC_OTHER
+#endif
+
+extern git_allocator git__allocator;
+extern int git__alloc_stats_enabled;
+
+extern void git__alloc_stats_record(
+	git_alloc_subsystem_t subsystem, size_t len, const void *ptr);
+
+GIT_INLINE(void *) git__alloc_checked(void *ptr, size_t len)
+{
+	if (git__alloc_stats_enabled)
+		git__alloc_stats_record(GIT_ALLOC_SUBSYSTEM, len, ptr);
+	if (!ptr) giterr_set_oom();
+	return ptr;
+}
+
 /*
  * Custom memory allocation wrappers
  * that set error code and error message
@@ -21,22 +44,32 @@
  */
 GIT_INLINE(void *) git__malloc(size_t len)
 {
-	void *ptr = malloc(len);
-	if (!ptr) giterr_set_oom();
-	return ptr;
+	return git__alloc_checked(
+		git__allocator.gmalloc(len, git__allocator.payload), len);
 }
 
 GIT_INLINE(void *) git__calloc(size_t nelem, size_t elsize)
 {
-	void *ptr = calloc(nelem, elsize);
-	if (!ptr) giterr_set_oom();
-	return ptr;
+	size_t len = nelem * elsize;
+	void *ptr = NULL;
+
+	if (!elsize || len / elsize == nelem)
+		ptr = git__allocator.gmalloc(len, git__allocator.payload);
+
+	if (ptr)
+		memset(ptr, 0, len);
+
+	return git__alloc_checked(ptr, len);
 }
 
 GIT_INLINE(char *) git__strdup(const char *str)
 {
-	char *ptr = strdup(str);
-	if (!ptr) giterr_set_oom();
+	size_t len = strlen(str);
+	char *ptr = git__malloc(len + 1);
+
+	if (ptr)
+		memcpy(ptr, str, len + 1);
+
 	return ptr;
 }
 
@@ -48,11 +81,9 @@ GIT_INLINE(char *) git__strndup(const char *str, size_t n)
 	while (length < n && str[length])
 		++length;
 
-	ptr = (char*)malloc(length + 1);
-	if (!ptr) {
-		giterr_set_oom();
+	ptr = git__malloc(length + 1);
+	if (!ptr)
 		return NULL;
-	}
 
 	if (length)
 		memcpy(ptr, str, length);
@@ -64,12 +95,18 @@ GIT_INLINE(char *) git__strndup(const char *str, size_t n)
 
 GIT_INLINE(void *) git__realloc(void *ptr, size_t size)
 {
-	void *new_ptr = realloc(ptr, size);
-	if (!new_ptr) giterr_set_oom();
-	return new_ptr;
+	void *new_ptr = ptr ?
+		git__allocator.grealloc(ptr, size, git__allocator.payload) :
+		git__allocator.gmalloc(size, git__allocator.payload);
+
+	return git__alloc_checked(new_ptr, size);
 }
 
-#define git__free(ptr) free(ptr)
+GIT_INLINE(void) git__free(void *ptr)
+{
+	if (ptr)
+		git__allocator.gfree(ptr, git__allocator.payload);
+}
 
 #define STRCMP_CASESELECT(IGNORE_CASE, STR1, STR2) \
 	((IGNORE_CASE) ? strcasecmp((STR1), (STR2)) : strcmp((STR1), (STR2)))
@@ -135,20 +172,20 @@ extern int git__bsearch(
 extern int git__strcmp_cb(const void *a, const void *b);
 
 typedef struct {
-	short refcount;
+	git_atomic refcount;
 	void *owner;
 } git_refcount;
 
 typedef void (*git_refcount_freeptr)(void *r);
 
 #define GIT_REFCOUNT_INC(r) { \
-	((git_refcount *)(r))->refcount++; \
+	git_atomic_inc(&((git_refcount *)(r))->refcount); \
 }
 
 #define GIT_REFCOUNT_DEC(_r, do_free) { \
 	git_refcount *r = (git_refcount *)(_r); \
-	r->refcount--; \
-	if (r->refcount <= 0 && r->owner == NULL) { do_free(_r); } \
+	int val = git_atomic_dec(&r->refcount); \
+	if (val <= 0 && r->owner == NULL) { do_free(_r); } \
 }
 
 #define GIT_REFCOUNT_OWN(r, o) { \
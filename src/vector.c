@@ -256,6 +256,22 @@ void git_vector_swap(git_vector *a, git_vector *b)
 	memcpy(b, &t, sizeof(t));
 }
 
+int git_vector_reserve(git_vector *v, size_t size)
+{
+	void **contents;
+
+	if (size <= v->_alloc_size)
+		return 0;
+
+	contents = git__realloc(v->contents, size * sizeof(void *));
+	GITERR_CHECK_ALLOC(contents);
+
+	v->contents = contents;
+	v->_alloc_size = size;
+
+	return 0;
+}
+
 int git_vector_resize_to(git_vector *v, size_t new_length)
 {
 	if (new_length <= v->length)
@@ -86,6 +86,9 @@ void git_vector_pop(git_vector *v);
 void git_vector_uniq(git_vector *v);
 void git_vector_remove_matching(git_vector *v, int (*match)(git_vector *v, size_t idx));
 
+/** Make room for `size` elements, so inserting up to there cannot fail */
+int git_vector_reserve(git_vector *v, size_t size);
+
 int git_vector_resize_to(git_vector *v, size_t new_length);
 int git_vector_set(void **old, git_vector *v, size_t position, void *value);
 
@@ -12,6 +12,7 @@
 #include <io.h>
 #include <fcntl.h>
 #include <ws2tcpip.h>
+#include <sys/utime.h>
 
 int p_unlink(const char *path)
 {
@@ -505,6 +506,21 @@ int p_gettimeofday(struct timeval *tv, struct timezone *tz)
    return 0;
 }
 
+int p_utimes(const char *path, const struct timeval times[2])
+{
+	wchar_t buf[GIT_WIN_PATH];
+	struct _utimbuf utb;
+
+	git__utf8_to_16(buf, GIT_WIN_PATH, path);
+
+	if (times == NULL)
+		return _wutime(buf, NULL);
+
+	utb.actime = times[0].tv_sec;
+	utb.modtime = times[1].tv_sec;
+	return _wutime(buf, &utb);
+}
+
 int p_inet_pton(int af, const char* src, void* dst)
 {
 	union {
@@ -122,6 +122,46 @@ int pthread_cond_signal(pthread_cond_t *cond)
 /* pthread_cond_broadcast is not implemented because doing so with just Win32 events
  * is quite complicated, and no caller in libgit2 uses it yet. */
 
+int pthread_rwlock_init(
+	pthread_rwlock_t *GIT_RESTRICT lock,
+	const pthread_rwlockattr_t *GIT_RESTRICT attr)
+{
+	GIT_UNUSED(attr);
+	InitializeSRWLock(lock);
+	return 0;
+}
+
+int pthread_rwlock_rdlock(pthread_rwlock_t *lock)
+{
+	AcquireSRWLockShared(lock);
+	return 0;
+}
+
+int pthread_rwlock_rdunlock(pthread_rwlock_t *lock)
+{
+	ReleaseSRWLockShared(lock);
+	return 0;
+}
+
+int pthread_rwlock_wrlock(pthread_rwlock_t *lock)
+{
+	AcquireSRWLockExclusive(lock);
+	return 0;
+}
+
+int pthread_rwlock_wrunlock(pthread_rwlock_t *lock)
+{
+	ReleaseSRWLockExclusive(lock);
+	return 0;
+}
+
+int pthread_rwlock_destroy(pthread_rwlock_t *lock)
+{
+	/* slim reader/writer locks need no cleanup */
+	GIT_UNUSED(lock);
+	return 0;
+}
+
 int pthread_num_processors_np(void)
 {
 	DWORD_PTR p, s;
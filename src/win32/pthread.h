@@ -22,6 +22,8 @@ typedef int pthread_attr_t;
 typedef CRITICAL_SECTION pthread_mutex_t;
 typedef HANDLE pthread_t;
 typedef HANDLE pthread_cond_t;
+typedef SRWLOCK pthread_rwlock_t;
+typedef int pthread_rwlockattr_t;
 
 #define PTHREAD_MUTEX_INITIALIZER {(void*)-1};
 
@@ -42,6 +44,14 @@ int pthread_cond_wait(pthread_cond_t *, pthread_mutex_t *);
 int pthread_cond_signal(pthread_cond_t *);
 /* pthread_cond_broadcast is not supported on Win32 yet. */
 
+/* Slim reader/writer locks need to know which side is unlocking */
+int pthread_rwlock_init(pthread_rwlock_t *GIT_RESTRICT, const pthread_rwlockattr_t *GIT_RESTRICT);
+int pthread_rwlock_rdlock(pthread_rwlock_t *);
+int pthread_rwlock_rdunlock(pthread_rwlock_t *);
+int pthread_rwlock_wrlock(pthread_rwlock_t *);
+int pthread_rwlock_wrunlock(pthread_rwlock_t *);
+int pthread_rwlock_destroy(pthread_rwlock_t *);
+
 int pthread_num_processors_np(void);
 
 #endif
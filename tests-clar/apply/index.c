@@ -0,0 +1,139 @@
+#include "clar_libgit2.h"
+
+static git_repository *_repo;
+static git_index *_index;
+
+void test_apply_index__initialize(void)
+{
+	git_object *tree;
+
+	_repo = cl_git_sandbox_init("testrepo.git");
+
+	cl_git_pass(git_revparse_single(&tree, _repo, "763d71a^{tree}"));
+	cl_git_pass(git_index_new(&_index));
+	cl_git_pass(git_index_read_tree(_index, (git_tree *)tree));
+	git_object_free(tree);
+}
+
+void test_apply_index__cleanup(void)
+{
+	git_index_free(_index);
+	_index = NULL;
+	cl_git_sandbox_cleanup();
+}
+
+void test_apply_index__changes_the_staged_files(void)
+{
+	const char *patch =
+		"diff --git a/ab/4.txt b/ab/4.txt\n"
+		"deleted file mode 100644\n"
+		"--- a/ab/4.txt\n"
+		"+++ /dev/null\n"
+		"@@ -1 +0,0 @@\n"
+		"-4.txt\n"
+		"diff --git a/new.txt b/new.txt\n"
+		"old mode 100644\n"
+		"new mode 100755\n"
+		"--- a/new.txt\n"
+		"+++ b/new.txt\n"
+		"@@ -1 +1,2 @@\n"
+		" new file\n"
+		"+and a new line\n";
+	const git_index_entry *entry;
+	git_blob *blob;
+	size_t count = git_index_entrycount(_index);
+
+	cl_git_pass(git_apply_to_index(_repo, _index, patch, strlen(patch), NULL));
+
+	cl_assert_equal_i(count - 1, git_index_entrycount(_index));
+	cl_assert(git_index_get_bypath(_index, "ab/4.txt", 0) == NULL);
+
+	cl_assert((entry = git_index_get_bypath(_index, "new.txt", 0)) != NULL);
+	cl_assert_equal_i(GIT_FILEMODE_BLOB_EXECUTABLE, entry->mode);
+	cl_assert_equal_i(24, (int)entry->file_size);
+
+	cl_git_pass(git_blob_lookup(&blob, _repo, &entry->oid));
+	cl_assert_equal_s("new file\nand a new line\n", git_blob_rawcontent(blob));
+	git_blob_free(blob);
+}
+
+void test_apply_index__is_unchanged_when_a_file_does_not_apply(void)
+{
+	const char *patch =
+		"--- a/new.txt\n"
+		"+++ b/new.txt\n"
+		"@@ -1 +1 @@\n"
+		"-new file\n"
+		"+changed file\n"
+		"--- a/README\n"
+		"+++ b/README\n"
+		"@@ -1 +1 @@\n"
+		"-not what it has\n"
+		"+something else\n";
+	git_oid before, after;
+
+	cl_git_pass(git_index_write_tree_to(&before, _index, _repo));
+	cl_git_fail(git_apply_to_index(_repo, _index, patch, strlen(patch), NULL));
+	cl_git_pass(git_index_write_tree_to(&after, _index, _repo));
+
+	cl_assert(git_oid_cmp(&before, &after) == 0);
+}
+
+static int _allocs_left;
+
+static void *failing_malloc(size_t len, void *payload)
+{
+	GIT_UNUSED(payload);
+	return (_allocs_left-- > 0) ? malloc(len) : NULL;
+}
+
+static void *failing_realloc(void *ptr, size_t len, void *payload)
+{
+	GIT_UNUSED(payload);
+	return (_allocs_left-- > 0) ? realloc(ptr, len) : NULL;
+}
+
+static void failing_free(void *ptr, void *payload)
+{
+	GIT_UNUSED(payload);
+	free(ptr);
+}
+
+void test_apply_index__is_unchanged_when_out_of_memory(void)
+{
+	/* no blob is read or written for these */
+	const char *patch =
+		"diff --git a/README b/README.md\n"
+		"similarity index 100%\n"
+		"rename from README\n"
+		"rename to README.md\n"
+		"diff --git a/new.txt b/new.txt\n"
+		"old mode 100644\n"
+		"new mode 100755\n";
+	git_allocator failing = {
+		failing_malloc, failing_realloc, failing_free, NULL
+	};
+	git_oid before, after;
+	int limit, error;
+
+	cl_git_pass(git_index_write_tree_to(&before, _index, _repo));
+
+	for (limit = 0; limit < 1000; ++limit) {
+		_allocs_left = limit;
+
+		git_allocator_set(&failing);
+		error = git_apply_to_index(_repo, _index, patch, strlen(patch), NULL);
+		git_allocator_set(NULL);
+
+		if (!error)
+			break;
+
+		cl_assert_equal_i(-1, error);
+		cl_git_pass(git_index_write_tree_to(&after, _index, _repo));
+		cl_assert(git_oid_cmp(&before, &after) == 0);
+	}
+
+	cl_assert_equal_i(0, error);
+	cl_assert(git_index_get_bypath(_index, "README", 0) == NULL);
+	cl_assert(git_index_get_bypath(_index, "README.md", 0) != NULL);
+}
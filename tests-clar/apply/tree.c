@@ -0,0 +1,307 @@
+#include "clar_libgit2.h"
+#include "buffer.h"
+
+static git_repository *_repo;
+static git_tree *_tree;
+
+#define FILE_CONTENT \
+	"one\ntwo\nthree\nfour\nfive\nsix\nseven\neight\nnine\nten\n"
+
+static void insert_blob(git_treebuilder *builder, const char *name, const char *content)
+{
+	git_oid id;
+
+	cl_git_pass(git_blob_create_frombuffer(&id, _repo, content, strlen(content)));
+	cl_git_pass(git_treebuilder_insert(NULL, builder, name, &id, GIT_FILEMODE_BLOB));
+}
+
+void test_apply_tree__initialize(void)
+{
+	git_treebuilder *builder;
+	git_oid id;
+
+	_repo = cl_git_sandbox_init("testrepo.git");
+
+	cl_git_pass(git_treebuilder_create(&builder, NULL));
+	insert_blob(builder, "sub.txt", "sub\n");
+	cl_git_pass(git_treebuilder_write(&id, _repo, builder));
+	git_treebuilder_free(builder);
+
+	cl_git_pass(git_treebuilder_create(&builder, NULL));
+	cl_git_pass(git_treebuilder_insert(NULL, builder, "dir", &id, GIT_FILEMODE_TREE));
+	cl_git_pass(git_treebuilder_insert(NULL, builder, "other", &id, GIT_FILEMODE_TREE));
+	insert_blob(builder, "file.txt", FILE_CONTENT);
+	cl_git_pass(git_treebuilder_write(&id, _repo, builder));
+	git_treebuilder_free(builder);
+
+	cl_git_pass(git_tree_lookup(&_tree, _repo, &id));
+}
+
+void test_apply_tree__cleanup(void)
+{
+	git_tree_free(_tree);
+	_tree = NULL;
+	cl_git_sandbox_cleanup();
+}
+
+static int apply(git_tree **out, const char *patch, unsigned int fuzz)
+{
+	git_apply_opts opts;
+	git_oid id;
+	int error;
+
+	memset(&opts, 0, sizeof(opts));
+	opts.fuzz = fuzz;
+
+	if ((error = git_apply_to_tree(&id, _repo, _tree, patch, strlen(patch), &opts)) < 0)
+		return error;
+
+	return git_tree_lookup(out, _repo, &id);
+}
+
+static void check_file(git_tree *tree, const char *path, const char *expected)
+{
+	git_tree_entry *entry;
+	git_blob *blob;
+
+	cl_git_pass(git_tree_entry_bypath(&entry, tree, path));
+	cl_git_pass(git_blob_lookup(&blob, _repo, git_tree_entry_id(entry)));
+	cl_assert_equal_i(strlen(expected), (size_t)git_blob_rawsize(blob));
+	cl_assert(memcmp(expected, git_blob_rawcontent(blob), strlen(expected)) == 0);
+
+	git_blob_free(blob);
+	git_tree_entry_free(entry);
+}
+
+static void check_mode(git_tree *tree, const char *path, git_filemode_t expected)
+{
+	git_tree_entry *entry;
+
+	cl_git_pass(git_tree_entry_bypath(&entry, tree, path));
+	cl_assert_equal_i(expected, git_tree_entry_filemode(entry));
+	git_tree_entry_free(entry);
+}
+
+static void check_missing(git_tree *tree, const char *path)
+{
+	git_tree_entry *entry;
+
+	cl_assert_equal_i(GIT_ENOTFOUND, git_tree_entry_bypath(&entry, tree, path));
+}
+
+void test_apply_tree__modifies_files(void)
+{
+	git_tree *tree;
+
+	cl_git_pass(apply(&tree,
+		"A change\n\n"
+		"diff --git a/file.txt b/file.txt\n"
+		"index 1234567..89abcde 100644\n"
+		"--- a/file.txt\n"
+		"+++ b/file.txt\n"
+		"@@ -1,4 +1,4 @@\n"
+		" one\n"
+		"-two\n"
+		"+TWO\n"
+		" three\n"
+		" four\n"
+		"@@ -7,4 +7,5 @@\n"
+		" seven\n"
+		" eight\n"
+		" nine\n"
+		"+nine and a half\n"
+		" ten\n"
+		"diff --git a/dir/sub.txt b/dir/sub.txt\n"
+		"--- a/dir/sub.txt\n"
+		"+++ b/dir/sub.txt\n"
+		"@@ -1 +1 @@\n"
+		"-sub\n"
+		"+sub without newline\n"
+		"\\ No newline at end of file\n"
+		"-- \n"
+		"signature\n", 0));
+
+	check_file(tree, "file.txt",
+		"one\nTWO\nthree\nfour\nfive\nsix\nseven\neight\nnine\nnine and a half\nten\n");
+	check_file(tree, "dir/sub.txt", "sub without newline");
+	check_file(tree, "other/sub.txt", "sub\n");
+
+	/* what the patch does not touch is not written again */
+	cl_assert(git_oid_cmp(
+		git_tree_entry_id(git_tree_entry_byname(_tree, "other")),
+		git_tree_entry_id(git_tree_entry_byname(tree, "other"))) == 0);
+
+	git_tree_free(tree);
+}
+
+void test_apply_tree__finds_moved_hunks_and_uses_fuzz(void)
+{
+	git_tree *tree;
+	const char *moved =
+		"--- a/file.txt\n"
+		"+++ b/file.txt\n"
+		"@@ -6,3 +6,3 @@\n"
+		" two\n"
+		"-three\n"
+		"+THREE\n"
+		" four\n";
+	const char *fuzzy =
+		"--- a/file.txt\n"
+		"+++ b/file.txt\n"
+		"@@ -2,5 +2,5 @@\n"
+		" 2\n"
+		" three\n"
+		"-four\n"
+		"+FOUR\n"
+		" five\n"
+		" 6\n";
+
+	cl_git_pass(apply(&tree, moved, 0));
+	check_file(tree, "file.txt",
+		"one\ntwo\nTHREE\nfour\nfive\nsix\nseven\neight\nnine\nten\n");
+	git_tree_free(tree);
+
+	cl_git_fail(apply(&tree, fuzzy, 0));
+	cl_git_pass(apply(&tree, fuzzy, 1));
+	check_file(tree, "file.txt",
+		"one\ntwo\nthree\nFOUR\nfive\nsix\nseven\neight\nnine\nten\n");
+	git_tree_free(tree);
+}
+
+void test_apply_tree__creates_deletes_and_renames_files(void)
+{
+	git_tree *tree;
+
+	cl_git_pass(apply(&tree,
+		"diff --git a/new/dir/file b/new/dir/file\n"
+		"new file mode 100755\n"
+		"index 0000000..1234567\n"
+		"--- /dev/null\n"
+		"+++ b/new/dir/file\n"
+		"@@ -0,0 +1,2 @@\n"
+		"+new\n"
+		"+file\n"
+		"diff --git a/dir/sub.txt b/dir/sub.txt\n"
+		"deleted file mode 100644\n"
+		"index 1234567..0000000\n"
+		"--- a/dir/sub.txt\n"
+		"+++ /dev/null\n"
+		"@@ -1 +0,0 @@\n"
+		"-sub\n"
+		"diff --git a/file.txt b/renamed.txt\n"
+		"similarity index 100%\n"
+		"rename from file.txt\n"
+		"rename to renamed.txt\n", 0));
+
+	check_file(tree, "new/dir/file", "new\nfile\n");
+	check_mode(tree, "new/dir/file", GIT_FILEMODE_BLOB_EXECUTABLE);
+	check_file(tree, "renamed.txt", FILE_CONTENT);
+	check_missing(tree, "file.txt");
+	/* the directory is gone with its only file */
+	check_missing(tree, "dir");
+	check_file(tree, "other/sub.txt", "sub\n");
+
+	git_tree_free(tree);
+}
+
+void test_apply_tree__errors(void)
+{
+	git_tree *tree;
+
+	/* the hunk is not there */
+	cl_git_fail(apply(&tree,
+		"--- a/file.txt\n"
+		"+++ b/file.txt\n"
+		"@@ -1,2 +1,2 @@\n"
+		" one\n"
+		"-three\n"
+		"+3\n", 0));
+
+	cl_git_fail(apply(&tree,
+		"--- a/no-such-file\n"
+		"+++ b/no-such-file\n"
+		"@@ -1 +1 @@\n"
+		"-one\n"
+		"+1\n", 0));
+
+	cl_assert_equal_i(GIT_EEXISTS, apply(&tree,
+		"--- /dev/null\n"
+		"+++ b/file.txt\n"
+		"@@ -0,0 +1 @@\n"
+		"+one\n", 0));
+
+	/* the hunk says it has more lines */
+	cl_git_fail(apply(&tree,
+		"--- a/file.txt\n"
+		"+++ b/file.txt\n"
+		"@@ -1,3 +1,3 @@\n"
+		" one\n"
+		"-two\n"
+		"+2\n", 0));
+
+	cl_git_fail(apply(&tree,
+		"--- a/../file.txt\n"
+		"+++ b/../file.txt\n"
+		"@@ -1 +1 @@\n"
+		"-one\n"
+		"+1\n", 0));
+
+	cl_git_fail(apply(&tree,
+		"diff --git a/file.txt b/file.txt\n"
+		"index 1234567..89abcde 100644\n"
+		"Binary files a/file.txt and b/file.txt differ\n", 0));
+
+	cl_git_fail(apply(&tree, "no patch here\n", 0));
+}
+
+static int print_cb(
+	void *payload, const git_diff_delta *delta, const git_diff_range *range,
+	char line_origin, const char *content, size_t content_len)
+{
+	GIT_UNUSED(delta);
+	GIT_UNUSED(range);
+	GIT_UNUSED(line_origin);
+
+	return git_buf_put(payload, content, content_len);
+}
+
+void test_apply_tree__applies_printed_diffs(void)
+{
+	const char *commits[] = {
+		"8496071c1b46c854b31185ea97743be6a8774479",
+		"5b5b025afb0b4c913b4c338a42934a3863bf3644",
+		"c47800c7266a2be04c571c04d5a6614691ea99bd",
+		"763d71aadf09a7951596c9746c024e7eece7c7af",
+		"a65fedf39aefe402d3bb6e24df4d4f5fe4547750",
+	};
+	git_buf patch = GIT_BUF_INIT;
+	git_tree *old_tree, *new_tree;
+	git_diff_list *diff;
+	git_object *obj;
+	git_oid id;
+	size_t i;
+
+	cl_git_pass(git_revparse_single(&obj, _repo, "8496071c^{tree}"));
+	old_tree = (git_tree *)obj;
+
+	for (i = 1; i < ARRAY_SIZE(commits); ++i) {
+		git_buf_clear(&patch);
+		git_buf_printf(&patch, "%s^{tree}", commits[i]);
+		cl_git_pass(git_revparse_single(&obj, _repo, patch.ptr));
+		new_tree = (git_tree *)obj;
+
+		git_buf_clear(&patch);
+		cl_git_pass(git_diff_tree_to_tree(&diff, _repo, old_tree, new_tree, NULL));
+		cl_git_pass(git_diff_print_patch(diff, &patch, print_cb));
+		git_diff_list_free(diff);
+
+		cl_git_pass(git_apply_to_tree(&id, _repo, old_tree, patch.ptr, patch.size, NULL));
+		cl_assert(git_oid_cmp(&id, git_tree_id(new_tree)) == 0);
+
+		git_tree_free(old_tree);
+		old_tree = new_tree;
+	}
+
+	git_tree_free(old_tree);
+	git_buf_free(&patch);
+}
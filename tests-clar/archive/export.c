@@ -0,0 +1,363 @@
+#include "clar_libgit2.h"
+#include "buffer.h"
+#include "fileops.h"
+
+#include <zlib.h>
+
+static git_repository *_repo;
+static git_tree *_tree;
+
+void test_archive_export__initialize(void)
+{
+	git_oid id;
+
+	_repo = cl_git_sandbox_init("testrepo.git");
+
+	cl_git_pass(git_oid_fromstr(&id, "f1425cef211cc08caa31e7b545ffb232acb098c3"));
+	cl_git_pass(git_tree_lookup(&_tree, _repo, &id));
+}
+
+void test_archive_export__cleanup(void)
+{
+	git_tree_free(_tree);
+	_tree = NULL;
+
+	cl_git_sandbox_cleanup();
+}
+
+static int collect_cb(const char *data, size_t len, void *payload)
+{
+	git_buf *out = payload;
+	return git_buf_put(out, data, len);
+}
+
+static unsigned long tar_number(const char *field, size_t width)
+{
+	char copy[16];
+
+	memcpy(copy, field, width);
+	copy[width] = '\0';
+
+	return strtoul(copy, NULL, 8);
+}
+
+/* List the paths and sizes of a tar archive, one "path size" per line */
+static void tar_list(git_buf *list, const git_buf *tar)
+{
+	const unsigned char *block;
+	size_t offset = 0, i;
+	unsigned long size, sum;
+
+	cl_assert(tar->size > 0 && tar->size % 10240 == 0);
+
+	for (; offset + 512 <= tar->size; offset += 512 + ((size + 511) & ~511ul)) {
+		block = (const unsigned char *)tar->ptr + offset;
+		if (!block[0])
+			break;
+
+		for (sum = 0, i = 0; i < 512; ++i)
+			sum += (i >= 148 && i < 156) ? ' ' : block[i];
+		cl_assert_equal_i(sum, tar_number((const char *)block + 148, 8));
+		cl_assert(memcmp(block + 257, "ustar", 6) == 0);
+
+		size = tar_number((const char *)block + 124, 12);
+		git_buf_printf(list, "%s%s %c %lu\n",
+			block[345] ? (const char *)block + 345 : "",
+			(const char *)block, block[156], size);
+	}
+
+	/* nothing but zeros after the last entry */
+	for (; offset < tar->size; ++offset)
+		cl_assert(tar->ptr[offset] == 0);
+}
+
+void test_archive_export__tar_lists_directories_before_contents(void)
+{
+	git_buf tar = GIT_BUF_INIT, list = GIT_BUF_INIT;
+	git_archive_opts opts;
+
+	memset(&opts, 0, sizeof(opts));
+	opts.prefix = "proj/";
+	opts.mtime = 1234567890;
+
+	cl_git_pass(git_archive(_tree, &opts, collect_cb, &tar));
+	tar_list(&list, &tar);
+
+	cl_assert_equal_s(
+		"proj/ 5 0\n"
+		"proj/4.txt 0 6\n"
+		"proj/c/ 5 0\n"
+		"proj/c/3.txt 0 6\n"
+		"proj/de/ 5 0\n"
+		"proj/de/2.txt 0 6\n"
+		"proj/de/fgh/ 5 0\n"
+		"proj/de/fgh/1.txt 0 6\n", list.ptr);
+
+	cl_assert_equal_i(0664, tar_number(tar.ptr + 512 + 100, 8));
+	cl_assert_equal_i(1234567890, tar_number(tar.ptr + 512 + 136, 12));
+
+	git_buf_free(&tar);
+	git_buf_free(&list);
+}
+
+void test_archive_export__export_ignore(void)
+{
+	git_buf tar = GIT_BUF_INIT, list = GIT_BUF_INIT;
+	git_treebuilder *builder;
+	git_tree *tree;
+	git_oid id;
+	static const char *attrs = "c export-ignore\n4.txt export-ignore\n";
+
+	/* a .gitattributes in the tree applies below its directory */
+	cl_git_pass(git_blob_create_frombuffer(&id, _repo, attrs, strlen(attrs)));
+	cl_git_pass(git_treebuilder_create(&builder, _tree));
+	cl_git_pass(git_treebuilder_insert(NULL, builder, ".gitattributes", &id, GIT_FILEMODE_BLOB));
+	cl_git_pass(git_treebuilder_write(&id, _repo, builder));
+	git_treebuilder_free(builder);
+	cl_git_pass(git_tree_lookup(&tree, _repo, &id));
+
+	/* and info/attributes overrides it */
+	cl_must_pass(p_mkdir("testrepo.git/info", 0777));
+	cl_git_mkfile("testrepo.git/info/attributes",
+		"4.txt -export-ignore\nde/fgh export-ignore\n");
+
+	cl_git_pass(git_archive(tree, NULL, collect_cb, &tar));
+	tar_list(&list, &tar);
+
+	cl_assert_equal_s(
+		".gitattributes 0 36\n"
+		"4.txt 0 6\n"
+		"de/ 5 0\n"
+		"de/2.txt 0 6\n", list.ptr);
+
+	git_tree_free(tree);
+	git_buf_free(&tar);
+	git_buf_free(&list);
+}
+
+void test_archive_export__pax_record_length_counts_its_digits(void)
+{
+	git_buf tar = GIT_BUF_INIT;
+	char name[991];
+	git_treebuilder *builder;
+	git_tree *tree;
+	const char *data, *record;
+	unsigned long size, len;
+	char *end;
+	git_oid id;
+
+	/* "1001 path=<990 bytes>\n": adding the digits makes it a fourth one */
+	memset(name, 'a', 990);
+	name[990] = '\0';
+
+	cl_git_pass(git_oid_fromstr(&id, "a71586c1dfe8a71c6cbf6c129f404c5642ff31bd"));
+	cl_git_pass(git_treebuilder_create(&builder, NULL));
+	cl_git_pass(git_treebuilder_insert(NULL, builder, name, &id, GIT_FILEMODE_BLOB));
+	cl_git_pass(git_treebuilder_write(&id, _repo, builder));
+	git_treebuilder_free(builder);
+	cl_git_pass(git_tree_lookup(&tree, _repo, &id));
+
+	cl_git_pass(git_archive(tree, NULL, collect_cb, &tar));
+
+	cl_assert_equal_i('x', tar.ptr[156]);
+	size = tar_number(tar.ptr + 124, 12);
+	data = tar.ptr + 512;
+
+	for (record = data; record < data + size; record += len) {
+		len = strtoul(record, &end, 10);
+		cl_assert(*end == ' ' && len > 0);
+		cl_assert(record + len <= data + size);
+		cl_assert_equal_i('\n', record[len - 1]);
+
+		if (!git__prefixcmp(end + 1, "path="))
+			cl_assert_equal_i(1001, len);
+	}
+
+	git_tree_free(tree);
+	git_buf_free(&tar);
+}
+
+static uint32_t zip_get(const git_buf *zip, size_t offset, size_t width)
+{
+	const unsigned char *bytes = (const unsigned char *)zip->ptr + offset;
+	uint32_t value = 0;
+
+	cl_assert(offset + width <= zip->size);
+
+	while (width-- > 0)
+		value = (value << 8) | bytes[width];
+
+	return value;
+}
+
+static void zip_inflate(git_buf *out, const char *data, size_t len, size_t size)
+{
+	z_stream zs;
+
+	memset(&zs, 0, sizeof(zs));
+	cl_assert_equal_i(Z_OK, inflateInit2(&zs, -15));
+
+	cl_git_pass(git_buf_grow(out, size + 1));
+	zs.next_in = (Bytef *)data;
+	zs.avail_in = (uInt)len;
+	zs.next_out = (Bytef *)out->ptr;
+	zs.avail_out = (uInt)size + 1;
+
+	cl_assert_equal_i(Z_STREAM_END, inflate(&zs, Z_FINISH));
+	out->size = zs.total_out;
+	inflateEnd(&zs);
+}
+
+/* Check every entry of a zip archive against the blobs of `tree`;
+ * returns how many entries are deflated */
+static int zip_check(const git_buf *zip, git_tree *tree, size_t expected)
+{
+	size_t end = zip->size - 22, central, count, i;
+	int deflated = 0;
+
+	cl_assert_equal_i(0x06054b50, zip_get(zip, end, 4));
+	count = zip_get(zip, end + 10, 2);
+	central = zip_get(zip, end + 16, 4);
+	cl_assert_equal_i(expected, count);
+	cl_assert_equal_i(end, central + zip_get(zip, end + 12, 4));
+
+	for (i = 0; i < count; ++i) {
+		git_buf path = GIT_BUF_INIT, data = GIT_BUF_INIT;
+		size_t name_len, local, compressed, size;
+		unsigned int method;
+		uint32_t mode;
+		const char *content;
+
+		cl_assert_equal_i(0x02014b50, zip_get(zip, central, 4));
+		method = zip_get(zip, central + 10, 2);
+		compressed = zip_get(zip, central + 20, 4);
+		size = zip_get(zip, central + 24, 4);
+		name_len = zip_get(zip, central + 28, 2);
+		mode = zip_get(zip, central + 38, 4) >> 16;
+		local = zip_get(zip, central + 42, 4);
+		cl_git_pass(git_buf_put(&path, zip->ptr + central + 46, name_len));
+
+		cl_assert_equal_i(0x04034b50, zip_get(zip, local, 4));
+		cl_assert(memcmp(zip->ptr + local + 30, path.ptr, name_len) == 0);
+		content = zip->ptr + local + 30 + name_len + zip_get(zip, local + 28, 2);
+
+		if (S_ISDIR(mode)) {
+			cl_assert(git__suffixcmp(path.ptr, "/") == 0);
+			cl_assert_equal_i(0, size);
+		} else {
+			git_tree_entry *entry;
+			git_blob *blob;
+
+			if (method == 8) {
+				zip_inflate(&data, content, compressed, size);
+				deflated++;
+			} else {
+				cl_assert_equal_i(0, method);
+				cl_git_pass(git_buf_put(&data, content, compressed));
+			}
+
+			cl_git_pass(git_tree_entry_bypath(&entry, tree, path.ptr));
+			cl_git_pass(git_blob_lookup(&blob, _repo, git_tree_entry_id(entry)));
+			cl_assert_equal_i(git_blob_rawsize(blob), data.size);
+			cl_assert(memcmp(git_blob_rawcontent(blob), data.ptr, data.size) == 0);
+			cl_assert_equal_i(zip_get(zip, central + 16, 4),
+				crc32(0, (const Bytef *)data.ptr, (uInt)data.size));
+
+			git_blob_free(blob);
+			git_tree_entry_free(entry);
+		}
+
+		central += 46 + name_len + zip_get(zip, central + 30, 2) +
+			zip_get(zip, central + 32, 2);
+		git_buf_free(&path);
+		git_buf_free(&data);
+	}
+
+	return deflated;
+}
+
+void test_archive_export__zip(void)
+{
+	git_buf zip = GIT_BUF_INIT;
+	git_archive_opts opts;
+
+	memset(&opts, 0, sizeof(opts));
+	opts.format = GIT_ARCHIVE_ZIP;
+
+	cl_git_pass(git_archive(_tree, &opts, collect_cb, &zip));
+	/* the small blobs are not worth deflating */
+	cl_assert_equal_i(0, zip_check(&zip, _tree, 7));
+	git_buf_clear(&zip);
+
+	opts.flags = GIT_ARCHIVE_ZIP_STORE;
+	cl_git_pass(git_archive(_tree, &opts, collect_cb, &zip));
+	cl_assert_equal_i(0, zip_check(&zip, _tree, 7));
+
+	git_buf_free(&zip);
+}
+
+void test_archive_export__large_blobs_are_streamed(void)
+{
+	git_buf content = GIT_BUF_INIT, out = GIT_BUF_INIT, list = GIT_BUF_INIT;
+	git_treebuilder *builder;
+	git_tree *tree;
+	git_archive_opts opts;
+	git_oid id;
+	char name[16];
+	int i;
+
+	/* enough entries for the readers to start */
+	cl_git_pass(git_treebuilder_create(&builder, NULL));
+
+	for (i = 0; i < 40000; ++i)
+		git_buf_printf(&content, "line %d of a large blob\n", i);
+	cl_assert(content.size > 512 * 1024);
+	cl_git_pass(git_blob_create_frombuffer(&id, _repo, content.ptr, content.size));
+	cl_git_pass(git_treebuilder_insert(NULL, builder, "large.txt", &id, GIT_FILEMODE_BLOB));
+
+	for (i = 0; i < 24; ++i) {
+		p_snprintf(name, sizeof(name), "file%02d.txt", i);
+		cl_git_pass(git_blob_create_frombuffer(&id, _repo, content.ptr, 4096 + i));
+		cl_git_pass(git_treebuilder_insert(NULL, builder, name, &id, GIT_FILEMODE_BLOB));
+	}
+
+	cl_git_pass(git_treebuilder_write(&id, _repo, builder));
+	git_treebuilder_free(builder);
+	cl_git_pass(git_tree_lookup(&tree, _repo, &id));
+
+	memset(&opts, 0, sizeof(opts));
+	opts.nthreads = 4;
+
+	cl_git_pass(git_archive(tree, &opts, collect_cb, &out));
+	tar_list(&list, &out);
+	cl_assert(git__prefixcmp(list.ptr, "file00.txt 0 4096\n") == 0);
+	cl_assert(strstr(list.ptr, "file23.txt 0 4119\nlarge.txt 0 ") != NULL);
+	cl_assert(memcmp(out.ptr + (512 + 4096) + 23 * (512 + 4608) + 512,
+		content.ptr, content.size) == 0);
+	git_buf_clear(&out);
+
+	opts.format = GIT_ARCHIVE_ZIP;
+	cl_git_pass(git_archive(tree, &opts, collect_cb, &out));
+	cl_assert_equal_i(25, zip_check(&out, tree, 25));
+	git_buf_clear(&out);
+
+	opts.flags = GIT_ARCHIVE_ZIP_STORE;
+	cl_git_pass(git_archive(tree, &opts, collect_cb, &out));
+	cl_assert_equal_i(0, zip_check(&out, tree, 25));
+
+	git_tree_free(tree);
+	git_buf_free(&content);
+	git_buf_free(&out);
+	git_buf_free(&list);
+}
+
+static int stop_cb(const char *data, size_t len, void *payload)
+{
+	GIT_UNUSED(data); GIT_UNUSED(len); GIT_UNUSED(payload);
+	return 1;
+}
+
+void test_archive_export__callback_can_stop(void)
+{
+	cl_assert_equal_i(GIT_EUSER, git_archive(_tree, NULL, stop_cb, NULL));
+}
@@ -0,0 +1,226 @@
+#include "clar_libgit2.h"
+
+static git_repository *_repo;
+static git_signature *_sig;
+static git_time_t _time;
+
+void test_blame_file__initialize(void)
+{
+	_repo = cl_git_sandbox_init("testrepo.git");
+	_time = 1340000000;
+}
+
+void test_blame_file__cleanup(void)
+{
+	git_signature_free(_sig);
+	_sig = NULL;
+	cl_git_sandbox_cleanup();
+}
+
+/* Commit a tree with `content` as "file.txt", on top of the parents */
+static void commit_file(
+	git_oid *out, const char *content, int parent_count, const git_oid *parent_ids)
+{
+	git_treebuilder *builder;
+	const git_commit *parents[2];
+	git_tree *tree;
+	git_oid id;
+	int i;
+
+	cl_git_pass(git_blob_create_frombuffer(&id, _repo, content, strlen(content)));
+	cl_git_pass(git_treebuilder_create(&builder, NULL));
+	cl_git_pass(git_treebuilder_insert(NULL, builder, "file.txt", &id, GIT_FILEMODE_BLOB));
+	cl_git_pass(git_treebuilder_write(&id, _repo, builder));
+	git_treebuilder_free(builder);
+	cl_git_pass(git_tree_lookup(&tree, _repo, &id));
+
+	for (i = 0; i < parent_count; ++i)
+		cl_git_pass(git_commit_lookup(
+			(git_commit **)&parents[i], _repo, &parent_ids[i]));
+
+	git_signature_free(_sig);
+	cl_git_pass(git_signature_new(&_sig, "Blamed", "blamed@example.com", _time++, 0));
+	cl_git_pass(git_commit_create(
+		out, _repo, NULL, _sig, _sig, NULL, "blame me\n", tree, parent_count, parents));
+
+	for (i = 0; i < parent_count; ++i)
+		git_commit_free((git_commit *)parents[i]);
+	git_tree_free(tree);
+}
+
+static void check_hunk(
+	git_blame *blame, size_t index, size_t lines, size_t final_start,
+	const git_oid *orig_id, size_t orig_start)
+{
+	const git_blame_hunk *hunk = git_blame_get_hunk_byindex(blame, index);
+
+	cl_assert(hunk != NULL);
+	cl_assert_equal_i(lines, hunk->lines_in_hunk);
+	cl_assert_equal_i(final_start, hunk->final_start_line_number);
+	cl_assert(git_oid_cmp(orig_id, &hunk->orig_commit_id) == 0);
+	cl_assert_equal_i(orig_start, hunk->orig_start_line_number);
+	cl_assert_equal_s("file.txt", hunk->orig_path);
+}
+
+void test_blame_file__lines_come_from_the_commits_which_added_them(void)
+{
+	git_blame_options opts;
+	git_blame *blame;
+	git_oid ids[3];
+
+	commit_file(&ids[0], "one\ntwo\nthree\n", 0, NULL);
+	commit_file(&ids[1], "zero\none\ntwo\nTHREE\n", 1, &ids[0]);
+	commit_file(&ids[2], "zero\none\nmore\ntwo\nTHREE\n", 1, &ids[1]);
+
+	memset(&opts, 0, sizeof(opts));
+	git_oid_cpy(&opts.newest_commit, &ids[2]);
+	cl_git_pass(git_blame_file(&blame, _repo, "file.txt", &opts));
+
+	cl_assert_equal_i(5, git_blame_get_hunk_count(blame));
+	check_hunk(blame, 0, 1, 1, &ids[1], 1);
+	check_hunk(blame, 1, 1, 2, &ids[0], 1);
+	check_hunk(blame, 2, 1, 3, &ids[2], 3);
+	check_hunk(blame, 3, 1, 4, &ids[0], 2);
+	check_hunk(blame, 4, 1, 5, &ids[1], 4);
+	cl_assert(git_blame_get_hunk_byindex(blame, 5) == NULL);
+
+	cl_assert(git_blame_get_hunk_byline(blame, 4) == git_blame_get_hunk_byindex(blame, 3));
+	cl_assert(git_blame_get_hunk_byline(blame, 0) == NULL);
+	cl_assert(git_blame_get_hunk_byline(blame, 6) == NULL);
+	cl_assert(git_oid_cmp(&ids[2],
+		&git_blame_get_hunk_byline(blame, 1)->final_commit_id) == 0);
+
+	git_blame_free(blame);
+}
+
+void test_blame_file__merges_take_lines_from_each_parent(void)
+{
+	git_blame_options opts;
+	git_blame *blame;
+	git_oid ids[4];
+
+	commit_file(&ids[0], "a\nb\nc\nd\n", 0, NULL);
+	commit_file(&ids[1], "A\nb\nc\nd\n", 1, &ids[0]);
+	commit_file(&ids[2], "a\nb\nc\nD\n", 1, &ids[0]);
+	commit_file(&ids[3], "A\nb\nc\nD\n", 2, &ids[1]);
+
+	memset(&opts, 0, sizeof(opts));
+	git_oid_cpy(&opts.newest_commit, &ids[3]);
+	cl_git_pass(git_blame_file(&blame, _repo, "file.txt", &opts));
+
+	cl_assert_equal_i(3, git_blame_get_hunk_count(blame));
+	check_hunk(blame, 0, 1, 1, &ids[1], 1);
+	check_hunk(blame, 1, 2, 2, &ids[0], 2);
+	check_hunk(blame, 2, 1, 4, &ids[2], 4);
+	git_blame_free(blame);
+
+	/* the second parent's change is the merge's own */
+	opts.flags = GIT_BLAME_FIRST_PARENT;
+	cl_git_pass(git_blame_file(&blame, _repo, "file.txt", &opts));
+
+	cl_assert_equal_i(3, git_blame_get_hunk_count(blame));
+	check_hunk(blame, 2, 1, 4, &ids[3], 4);
+	git_blame_free(blame);
+}
+
+void test_blame_file__only_blames_the_lines_asked_for(void)
+{
+	git_blame_options opts;
+	git_blame *blame;
+	git_oid ids[3];
+
+	commit_file(&ids[0], "one\ntwo\nthree\nfour\n", 0, NULL);
+	commit_file(&ids[1], "ONE\ntwo\nthree\nfour\n", 1, &ids[0]);
+	commit_file(&ids[2], "ONE\ntwo\nthree\nFOUR\n", 1, &ids[1]);
+
+	memset(&opts, 0, sizeof(opts));
+	git_oid_cpy(&opts.newest_commit, &ids[2]);
+	opts.min_line = 2;
+	opts.max_line = 3;
+	cl_git_pass(git_blame_file(&blame, _repo, "file.txt", &opts));
+
+	cl_assert_equal_i(1, git_blame_get_hunk_count(blame));
+	check_hunk(blame, 0, 2, 2, &ids[0], 2);
+	cl_assert(git_blame_get_hunk_byline(blame, 1) == NULL);
+	cl_assert(git_blame_get_hunk_byline(blame, 4) == NULL);
+	git_blame_free(blame);
+
+	/* lines older than the oldest commit are blamed on it */
+	opts.min_line = 0;
+	opts.max_line = 0;
+	git_oid_cpy(&opts.oldest_commit, &ids[1]);
+	cl_git_pass(git_blame_file(&blame, _repo, "file.txt", &opts));
+
+	cl_assert_equal_i(2, git_blame_get_hunk_count(blame));
+	check_hunk(blame, 0, 3, 1, &ids[1], 1);
+	cl_assert(git_blame_get_hunk_byindex(blame, 0)->boundary);
+	check_hunk(blame, 1, 1, 4, &ids[2], 4);
+	cl_assert(!git_blame_get_hunk_byindex(blame, 1)->boundary);
+	git_blame_free(blame);
+
+	opts.min_line = 3;
+	opts.max_line = 5;
+	cl_git_fail(git_blame_file(&blame, _repo, "file.txt", &opts));
+	opts.max_line = 2;
+	cl_git_fail(git_blame_file(&blame, _repo, "file.txt", &opts));
+}
+
+void test_blame_file__can_find_lines_moved_within_the_file(void)
+{
+	git_blame_options opts;
+	git_blame *blame;
+	git_oid ids[2];
+
+	commit_file(&ids[0],
+		"static int first_function(void);\n"
+		"static int second_function(void);\n"
+		"int main(void)\n"
+		"{\n"
+		"\treturn first_function() + second_function();\n"
+		"}\n", 0, NULL);
+	commit_file(&ids[1],
+		"int main(void)\n"
+		"{\n"
+		"\treturn first_function() + second_function();\n"
+		"}\n"
+		"static int first_function(void);\n"
+		"static int second_function(void);\n", 1, &ids[0]);
+
+	memset(&opts, 0, sizeof(opts));
+	git_oid_cpy(&opts.newest_commit, &ids[1]);
+	cl_git_pass(git_blame_file(&blame, _repo, "file.txt", &opts));
+
+	cl_assert_equal_i(2, git_blame_get_hunk_count(blame));
+	check_hunk(blame, 0, 4, 1, &ids[0], 3);
+	check_hunk(blame, 1, 2, 5, &ids[1], 5);
+	git_blame_free(blame);
+
+	opts.flags = GIT_BLAME_TRACK_MOVES_SAME_FILE;
+	cl_git_pass(git_blame_file(&blame, _repo, "file.txt", &opts));
+
+	cl_assert_equal_i(2, git_blame_get_hunk_count(blame));
+	check_hunk(blame, 0, 4, 1, &ids[0], 3);
+	check_hunk(blame, 1, 2, 5, &ids[0], 1);
+	git_blame_free(blame);
+}
+
+void test_blame_file__head_and_missing_files(void)
+{
+	git_blame *blame;
+	const git_blame_hunk *hunk;
+	git_oid head, orig;
+
+	cl_git_pass(git_reference_name_to_oid(&head, _repo, "HEAD"));
+	cl_git_pass(git_oid_fromstr(&orig, "4a202b346bb0fb0db7eff3cffeb3c70babbd2045"));
+	cl_git_pass(git_blame_file(&blame, _repo, "README", NULL));
+
+	cl_assert_equal_i(1, git_blame_get_hunk_count(blame));
+	hunk = git_blame_get_hunk_byindex(blame, 0);
+	cl_assert(git_oid_cmp(&head, &hunk->final_commit_id) == 0);
+	cl_assert(git_oid_cmp(&orig, &hunk->orig_commit_id) == 0);
+	cl_assert_equal_i(1, hunk->lines_in_hunk);
+	git_blame_free(blame);
+
+	cl_assert_equal_i(GIT_ENOTFOUND,
+		git_blame_file(&blame, _repo, "no-such-file", NULL));
+}
@@ -0,0 +1,134 @@
+#include "clar_libgit2.h"
+
+struct counting_allocator {
+	int live;
+	int total;
+	int limit;
+};
+
+static struct counting_allocator counter;
+
+static void *counting_malloc(size_t len, void *payload)
+{
+	struct counting_allocator *c = payload;
+
+	if (c->limit >= 0 && c->total >= c->limit)
+		return NULL;
+
+	c->live++;
+	c->total++;
+	return malloc(len);
+}
+
+static void *counting_realloc(void *ptr, size_t len, void *payload)
+{
+	struct counting_allocator *c = payload;
+
+	if (c->limit >= 0 && c->total >= c->limit)
+		return NULL;
+
+	c->total++;
+	return realloc(ptr, len);
+}
+
+static void counting_free(void *ptr, void *payload)
+{
+	struct counting_allocator *c = payload;
+
+	c->live--;
+	free(ptr);
+}
+
+static git_allocator counting = {
+	counting_malloc, counting_realloc, counting_free, &counter
+};
+
+void test_core_alloc__initialize(void)
+{
+	memset(&counter, 0, sizeof(counter));
+	counter.limit = -1;
+}
+
+void test_core_alloc__cleanup(void)
+{
+	git_allocator_set(NULL);
+	git_alloc_stats_enable(0);
+	git_alloc_stats_reset();
+}
+
+static void open_and_read(void)
+{
+	git_repository *repo;
+	git_reference *head;
+	git_commit *commit;
+
+	cl_git_pass(git_repository_open(&repo, cl_fixture("testrepo.git")));
+	cl_git_pass(git_repository_head(&head, repo));
+	cl_git_pass(git_commit_lookup(&commit, repo, git_reference_oid(head)));
+
+	git_commit_free(commit);
+	git_reference_free(head);
+	git_repository_free(repo);
+}
+
+void test_core_alloc__custom_allocator_sees_every_allocation(void)
+{
+	cl_git_pass(git_allocator_set(&counting));
+
+	open_and_read();
+
+	cl_git_pass(git_allocator_set(NULL));
+
+	cl_assert(counter.total > 0);
+	cl_assert_equal_i(0, counter.live);
+}
+
+void test_core_alloc__refused_allocations_fail_cleanly(void)
+{
+	git_repository *repo;
+
+	counter.limit = 0;
+	cl_git_pass(git_allocator_set(&counting));
+
+	cl_git_fail(git_repository_open(&repo, cl_fixture("testrepo.git")));
+	cl_assert_equal_i(GITERR_NOMEMORY, giterr_last()->klass);
+
+	cl_git_pass(git_allocator_set(NULL));
+	cl_assert_equal_i(0, counter.live);
+}
+
+void test_core_alloc__cannot_set_an_incomplete_allocator(void)
+{
+	git_allocator incomplete = { counting_malloc, NULL, counting_free, NULL };
+
+	cl_git_fail(git_allocator_set(&incomplete));
+}
+
+void test_core_alloc__stats_are_kept_per_subsystem(void)
+{
+	git_alloc_stats stats;
+
+	git_alloc_stats_reset();
+	open_and_read();
+
+	cl_git_pass(git_alloc_stats_get(&stats, GIT_ALLOC_REFS));
+	cl_assert_equal_i(0, (int)stats.allocations);
+
+	git_alloc_stats_enable(1);
+	open_and_read();
+	git_alloc_stats_enable(0);
+
+	cl_git_pass(git_alloc_stats_get(&stats, GIT_ALLOC_REFS));
+	cl_assert(stats.allocations > 0);
+	cl_assert(stats.bytes > 0);
+	cl_assert_equal_i(0, (int)stats.failures);
+
+	cl_git_pass(git_alloc_stats_get(&stats, GIT_ALLOC_ODB));
+	cl_assert(stats.allocations > 0);
+
+	git_alloc_stats_reset();
+	cl_git_pass(git_alloc_stats_get(&stats, GIT_ALLOC_ODB));
+	cl_assert_equal_i(0, (int)stats.allocations);
+
+	cl_git_fail(git_alloc_stats_get(&stats, (git_alloc_subsystem_t)GIT_ALLOC__SUBSYSTEMS));
+}
@@ -233,3 +233,64 @@ void test_core_dirent__length_limits(void)
 	cl_must_fail(p_creat(big_filename, 0666));
 	git__free(big_filename);
 }
+
+static void free_with_stat(git_vector *contents)
+{
+	unsigned int i;
+	git_path_with_stat *ps;
+
+	git_vector_foreach(contents, i, ps)
+		git__free(ps);
+	git_vector_free(contents);
+}
+
+/* deferring stat keeps the names and types, and loads the rest later */
+void test_core_dirent__dirload_with_deferred_stat(void)
+{
+	git_vector full = GIT_VECTOR_INIT, deferred = GIT_VECTOR_INIT;
+	git_path_with_stat *a, *b;
+	git_buf path = GIT_BUF_INIT;
+	unsigned int i;
+
+	cl_must_pass(p_mkdir("dirload", 0777));
+	cl_must_pass(p_mkdir("dirload/subdir", 0777));
+	cl_git_mkfile("dirload/file", "contents\n");
+	cl_git_mkfile("dirload/subdir/nested", "more contents\n");
+#ifndef GIT_WIN32
+	cl_must_pass(p_symlink("file", "dirload/link"));
+#endif
+
+	full._cmp = deferred._cmp = git_path_with_stat_cmp;
+
+	cl_git_pass(git_path_dirload_with_stat("dirload", 0, 0, &full));
+	cl_git_pass(git_path_dirload_with_stat(
+		"dirload", 0, GIT_PATH_DIRLOAD_DEFER_STAT, &deferred));
+
+	git_vector_sort(&full);
+	git_vector_sort(&deferred);
+	cl_assert_equal_i(full.length, deferred.length);
+
+	git_vector_foreach(&full, i, a) {
+		b = git_vector_get(&deferred, i);
+
+		cl_assert(a->st_loaded);
+		cl_assert_equal_s(a->path, b->path);
+		cl_assert_equal_i(a->path_len, b->path_len);
+		cl_assert_equal_i(a->st.st_mode & S_IFMT, b->st.st_mode & S_IFMT);
+
+		cl_git_pass(git_buf_sets(&path, b->path));
+		if (S_ISDIR(b->st.st_mode))
+			git_buf_truncate(&path, path.size - 1);
+		cl_git_pass(git_path_with_stat_load(b, path.ptr));
+
+		cl_assert(b->st_loaded);
+		cl_assert_equal_i(a->st.st_mode, b->st.st_mode);
+		cl_assert_equal_i(a->st.st_size, b->st.st_size);
+		cl_assert_equal_i(a->st.st_ino, b->st.st_ino);
+	}
+
+	free_with_stat(&full);
+	free_with_stat(&deferred);
+	git_buf_free(&path);
+	cl_git_pass(git_futils_rmdir_r("dirload", NULL, GIT_RMDIR_REMOVE_FILES));
+}
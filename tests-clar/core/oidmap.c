@@ -0,0 +1,116 @@
+#include "clar_libgit2.h"
+#include "oidmap.h"
+
+GIT__USE_OIDMAP;
+
+#define NOIDS 10000
+
+static git_oid *g_oids;
+
+void test_core_oidmap__initialize(void)
+{
+	size_t i, j;
+
+	g_oids = git__calloc(NOIDS, sizeof(git_oid));
+	cl_assert(g_oids != NULL);
+
+	/* share the leading bytes, which are the bytes used as the hash */
+	for (i = 0; i < NOIDS; ++i) {
+		for (j = 0; j < GIT_OID_RAWSZ; ++j)
+			g_oids[i].id[j] = (unsigned char)(i * 7 + j);
+		g_oids[i].id[0] = (unsigned char)(i % 3);
+		g_oids[i].id[1] = 0;
+		g_oids[i].id[2] = 0;
+		g_oids[i].id[3] = (unsigned char)(i / 4000);
+		g_oids[i].id[18] = (unsigned char)(i >> 8);
+		g_oids[i].id[19] = (unsigned char)i;
+	}
+}
+
+void test_core_oidmap__cleanup(void)
+{
+	git__free(g_oids);
+	g_oids = NULL;
+}
+
+void test_core_oidmap__empty(void)
+{
+	git_oidmap *map = git_oidmap_alloc();
+	cl_assert(map != NULL);
+
+	cl_assert_equal_i(0, git_oidmap_num_entries(map));
+	cl_assert(!git_oidmap_exists(map, &g_oids[0]));
+
+	git_oidmap_clear(map);
+	git_oidmap_free(map);
+	cl_assert(map == NULL);
+}
+
+void test_core_oidmap__insert_and_lookup(void)
+{
+	git_oidmap *map = git_oidmap_alloc();
+	git_hashmap_iter pos;
+	size_t i, seen = 0;
+	void *value;
+	int ret;
+
+	for (i = 0; i < NOIDS; ++i) {
+		git_oidmap_insert(map, &g_oids[i], &g_oids[i], ret);
+		cl_assert_equal_i(1, ret);
+	}
+
+	/* inserting again replaces the value */
+	git_oidmap_insert(map, &g_oids[42], NULL, ret);
+	cl_assert_equal_i(0, ret);
+	cl_assert_equal_i(NOIDS, git_oidmap_num_entries(map));
+
+	for (i = 0; i < NOIDS; ++i) {
+		pos = git_oidmap_lookup_index(map, &g_oids[i]);
+		cl_assert(git_oidmap_valid_index(map, pos));
+		cl_assert(git_oidmap_value_at(map, pos) == (i == 42 ? NULL : &g_oids[i]));
+	}
+
+	git_oidmap_foreach_value(map, value, { GIT_UNUSED(value); seen++; });
+	cl_assert_equal_i(NOIDS, seen);
+
+	git_oidmap_free(map);
+}
+
+void test_core_oidmap__delete_and_reinsert(void)
+{
+	git_oidmap *map = git_oidmap_alloc();
+	git_hashmap_iter pos;
+	size_t i, round;
+	int ret;
+
+	for (i = 0; i < NOIDS; ++i)
+		git_oidmap_insert(map, &g_oids[i], &g_oids[i], ret);
+
+	/* churn through deletions, so the table must drop its tombstones */
+	for (round = 0; round < 4; ++round) {
+		for (i = round % 2; i < NOIDS; i += 2) {
+			pos = git_oidmap_lookup_index(map, &g_oids[i]);
+			cl_assert(git_oidmap_valid_index(map, pos));
+			git_oidmap_delete_at(map, pos);
+		}
+
+		cl_assert_equal_i(NOIDS / 2, git_oidmap_num_entries(map));
+
+		for (i = 0; i < NOIDS; ++i)
+			cl_assert_equal_i(
+				(i % 2) != (round % 2), git_oidmap_exists(map, &g_oids[i]));
+
+		for (i = round % 2; i < NOIDS; i += 2) {
+			git_oidmap_insert(map, &g_oids[i], &g_oids[i], ret);
+			cl_assert_equal_i(1, ret);
+		}
+
+		cl_assert_equal_i(NOIDS, git_oidmap_num_entries(map));
+	}
+
+	git_oidmap_clear(map);
+	cl_assert_equal_i(0, git_oidmap_num_entries(map));
+	cl_assert(!git_oidmap_exists(map, &g_oids[1]));
+
+	git_oidmap_free(map);
+}
@@ -0,0 +1,68 @@
+#include "clar_libgit2.h"
+#include "scratch.h"
+
+void test_core_scratch__cleanup(void)
+{
+	git_scratch__set_enabled(1);
+}
+
+void test_core_scratch__released_buffers_are_reused(void)
+{
+	git_buf a = GIT_BUF_INIT, b = GIT_BUF_INIT;
+	char *ptr;
+
+	git_scratch__set_enabled(0);
+	git_scratch__set_enabled(1);
+
+	git_scratch__take(&a);
+	cl_assert(a.asize == 0);
+	cl_git_pass(git_buf_sets(&a, "refs/heads/master"));
+	ptr = a.ptr;
+	git_scratch__release(&a);
+
+	cl_assert(a.asize == 0);
+	cl_assert_equal_s("", a.ptr);
+
+	git_scratch__take(&b);
+	cl_assert(b.ptr == ptr);
+	cl_assert(b.asize > 0);
+	cl_assert_equal_i(0, (int)b.size);
+	cl_assert_equal_s("", b.ptr);
+
+	cl_git_pass(git_buf_sets(&b, "objects/pack"));
+	cl_assert_equal_s("objects/pack", b.ptr);
+	git_scratch__release(&b);
+}
+
+void test_core_scratch__large_buffers_are_not_retained(void)
+{
+	git_buf buf = GIT_BUF_INIT;
+
+	git_scratch__set_enabled(0);
+	git_scratch__set_enabled(1);
+
+	cl_git_pass(git_buf_grow(&buf, GIT_SCRATCH_MAX_RETAINED + 1));
+	git_scratch__release(&buf);
+
+	git_scratch__take(&buf);
+	cl_assert(buf.asize == 0);
+}
+
+void test_core_scratch__disabling_frees_retained_buffers(void)
+{
+	git_buf buf = GIT_BUF_INIT;
+
+	cl_git_pass(git_buf_sets(&buf, "HEAD"));
+	git_scratch__release(&buf);
+
+	git_scratch__set_enabled(0);
+
+	git_scratch__take(&buf);
+	cl_assert(buf.asize == 0);
+
+	cl_git_pass(git_buf_sets(&buf, "HEAD"));
+	git_scratch__release(&buf);
+
+	git_scratch__take(&buf);
+	cl_assert(buf.asize == 0);
+}
@@ -56,7 +56,7 @@ void test_core_strmap__1(void)
 
 void test_core_strmap__2(void)
 {
-	khiter_t pos;
+	git_hashmap_iter pos;
 	int i;
 	char *str;
 	git_strmap *table = git_strmap_alloc();
@@ -0,0 +1,111 @@
+#include "clar_libgit2.h"
+
+static git_repository *_repo;
+static int _events[GIT_TRACE__EVENTS];
+
+static bool trace_supported(void)
+{
+	return (git_libgit2_capabilities() & GIT_CAP_TRACE) != 0;
+}
+
+void test_core_trace__initialize(void)
+{
+	memset(_events, 0, sizeof(_events));
+	cl_git_pass(git_repository_open(&_repo, cl_fixture("testrepo.git")));
+}
+
+void test_core_trace__cleanup(void)
+{
+	git_repository_free(_repo);
+	_repo = NULL;
+
+	git_trace_set(NULL, NULL);
+	git_trace_metrics_enable(0);
+	git_trace_metrics_reset();
+}
+
+static void trace_cb(
+	git_trace_event_t event, uint64_t elapsed_ns, size_t value, void *payload)
+{
+	GIT_UNUSED(elapsed_ns);
+	GIT_UNUSED(value);
+
+	cl_assert(payload == _events);
+	_events[event]++;
+}
+
+static void lookup(const char *sha)
+{
+	git_object *object;
+	git_oid oid;
+
+	cl_git_pass(git_oid_fromstr(&oid, sha));
+	cl_git_pass(git_object_lookup(&object, _repo, &oid, GIT_OBJ_ANY));
+	git_object_free(object);
+}
+
+void test_core_trace__callback_receives_odb_events(void)
+{
+	if (!trace_supported()) {
+		cl_git_fail(git_trace_set(trace_cb, _events));
+		return;
+	}
+
+	cl_git_pass(git_trace_set(trace_cb, _events));
+
+	/* loose object */
+	lookup("a8233120f6ad708f843d861ce2b7228ec4e3dec6");
+	cl_assert_equal_i(1, _events[GIT_TRACE_ODB_LOOSE_READ]);
+	cl_assert(_events[GIT_TRACE_INFLATE] >= 1);
+
+	/* deltified object only present in a packfile */
+	lookup("edc438eedf6854c51e1a0d7954a6849046f5a4f6");
+	cl_assert_equal_i(1, _events[GIT_TRACE_ODB_PACK_READ]);
+	cl_assert_equal_i(1, _events[GIT_TRACE_ODB_LOOSE_MISS]);
+	cl_assert_equal_i(1, _events[GIT_TRACE_DELTA_CHAIN]);
+	cl_assert(_events[GIT_TRACE_MWINDOW_MAP] >= 1);
+
+	/* the second lookup is served by the cache */
+	lookup("edc438eedf6854c51e1a0d7954a6849046f5a4f6");
+	cl_assert(_events[GIT_TRACE_CACHE_HIT] >= 1);
+	cl_assert_equal_i(1, _events[GIT_TRACE_ODB_PACK_READ]);
+
+	cl_git_pass(git_trace_set(NULL, NULL));
+
+	lookup("a8233120f6ad708f843d861ce2b7228ec4e3dec6");
+	cl_assert_equal_i(1, _events[GIT_TRACE_ODB_LOOSE_READ]);
+}
+
+void test_core_trace__metrics_aggregate_events(void)
+{
+	git_trace_metric metric;
+
+	if (!trace_supported()) {
+		cl_git_fail(git_trace_metrics_enable(1));
+		return;
+	}
+
+	cl_git_pass(git_trace_metrics_enable(1));
+	git_trace_metrics_reset();
+
+	lookup("a8233120f6ad708f843d861ce2b7228ec4e3dec6");
+	lookup("edc438eedf6854c51e1a0d7954a6849046f5a4f6");
+
+	cl_git_pass(git_trace_metrics_get(&metric, GIT_TRACE_ODB_LOOSE_READ));
+	cl_assert_equal_i(1, (int)metric.count);
+	cl_assert(metric.total_value > 0);
+	cl_assert_equal_i((int)metric.total_value, (int)metric.max_value);
+
+	cl_git_pass(git_trace_metrics_get(&metric, GIT_TRACE_DELTA_CHAIN));
+	cl_assert_equal_i(1, (int)metric.count);
+	cl_assert_equal_i(1, (int)metric.max_value);
+
+	cl_git_pass(git_trace_metrics_enable(0));
+	lookup("a8233120f6ad708f843d861ce2b7228ec4e3dec6");
+
+	git_trace_metrics_reset();
+	cl_git_pass(git_trace_metrics_get(&metric, GIT_TRACE_ODB_LOOSE_READ));
+	cl_assert_equal_i(0, (int)metric.count);
+
+	cl_git_fail(git_trace_metrics_get(&metric, (git_trace_event_t)GIT_TRACE__EVENTS));
+}
@@ -2,6 +2,7 @@
 #include "diff_helpers.h"
 #include "iterator.h"
 #include "tree.h"
+#include "fileops.h"
 
 void test_diff_iterator__initialize(void)
 {
@@ -668,3 +669,137 @@ void test_diff_iterator__workdir_1_ranged_empty_2(void)
 		"status", NULL, "aaaa_empty_before",
 		0, 0, NULL, NULL);
 }
+
+static void collect_workdir_paths(
+	git_vector *paths, git_repository *repo, unsigned int prefetch_threads)
+{
+	git_iterator *i;
+	const git_index_entry *entry;
+
+	cl_git_pass(git_iterator_for_workdir(&i, repo));
+	if (prefetch_threads > 0)
+		cl_git_pass(git_iterator_workdir_prefetch(i, prefetch_threads));
+
+	cl_git_pass(git_iterator_current(i, &entry));
+
+	while (entry != NULL) {
+		cl_git_pass(git_vector_insert(paths, git__strdup(entry->path)));
+
+		/* descend into everything but one ignored directory */
+		if (S_ISDIR(entry->mode) && strcmp(entry->path, "ignored_dir/") != 0) {
+			cl_git_pass(git_iterator_advance_into_directory(i, &entry));
+			continue;
+		}
+
+		cl_git_pass(git_iterator_advance(i, &entry));
+	}
+
+	git_iterator_free(i);
+}
+
+void test_diff_iterator__workdir_prefetch_keeps_order(void)
+{
+	git_repository *repo = cl_git_sandbox_init("status");
+	git_vector expected = GIT_VECTOR_INIT, actual = GIT_VECTOR_INIT;
+	git_buf path = GIT_BUF_INIT;
+	unsigned int i, j, threads;
+	char *str;
+
+	/* a wide and deep tree, with some directories only git ignores */
+	for (i = 0; i < 20; ++i) {
+		for (j = 0; j < 5; ++j) {
+			cl_git_pass(git_buf_printf(&path, "status/dir%02u/sub%u/deeper", i, j));
+			cl_git_pass(git_futils_mkdir_r(path.ptr, NULL, 0777));
+			cl_git_pass(git_buf_puts(&path, "/file"));
+			cl_git_mkfile(path.ptr, "content\n");
+			git_buf_clear(&path);
+		}
+	}
+	cl_git_pass(git_futils_mkdir_r("status/ignored_dir/sub", NULL, 0777));
+	cl_git_mkfile("status/ignored_dir/sub/file", "content\n");
+	cl_git_pass(git_futils_mkdir_r("status/dir03/ignored_nested/sub", NULL, 0777));
+	cl_git_mkfile("status/dir03/ignored_nested/sub/file", "content\n");
+	cl_git_pass(git_futils_mkdir_r("status/dir04/empty", NULL, 0777));
+
+	collect_workdir_paths(&expected, repo, 0);
+	cl_assert(expected.length > 300);
+
+	for (threads = 1; threads <= 8; threads *= 2) {
+		collect_workdir_paths(&actual, repo, threads);
+
+		cl_assert_equal_i(expected.length, actual.length);
+		for (i = 0; i < expected.length; ++i)
+			cl_assert_equal_s(expected.contents[i], actual.contents[i]);
+
+		git_vector_foreach(&actual, i, str)
+			git__free(str);
+		git_vector_clear(&actual);
+	}
+
+	git_vector_foreach(&expected, i, str)
+		git__free(str);
+	git_vector_free(&expected);
+	git_vector_free(&actual);
+	git_buf_free(&path);
+}
+
+void test_diff_iterator__workdir_prefetch_free_midway(void)
+{
+	git_repository *repo = cl_git_sandbox_init("status");
+	git_iterator *i;
+	const git_index_entry *entry;
+	git_buf path = GIT_BUF_INIT;
+	int n;
+
+	for (n = 0; n < 50; ++n) {
+		cl_git_pass(git_buf_printf(&path, "status/dir%02d/sub", n));
+		cl_git_pass(git_futils_mkdir_r(path.ptr, NULL, 0777));
+		git_buf_clear(&path);
+	}
+	git_buf_free(&path);
+
+	/* stop while workers still have directories queued */
+	cl_git_pass(git_iterator_for_workdir(&i, repo));
+	cl_git_pass(git_iterator_workdir_prefetch(i, 4));
+	cl_git_pass(git_iterator_current(i, &entry));
+	cl_git_pass(git_iterator_reset(i));
+	cl_git_pass(git_iterator_current(i, &entry));
+	cl_assert(entry != NULL);
+	git_iterator_free(i);
+}
+
+void test_diff_iterator__workdir_deferred_stat_of_removed_file(void)
+{
+	git_repository *repo = cl_git_sandbox_init("status");
+	git_iterator *i;
+	const git_index_entry *entry;
+	git_buf path = GIT_BUF_INIT;
+
+	cl_git_pass(git_iterator_for_workdir(&i, repo));
+	git_iterator_workdir_defer_stat(i);
+
+	/* the top directory is read before stat is deferred */
+	cl_git_pass(git_iterator_current(i, &entry));
+	while (entry && !S_ISDIR(entry->mode))
+		cl_git_pass(git_iterator_advance(i, &entry));
+	cl_assert(entry != NULL);
+
+	cl_git_pass(git_iterator_advance_into_directory(i, &entry));
+	while (entry && S_ISDIR(entry->mode))
+		cl_git_pass(git_iterator_advance(i, &entry));
+	cl_assert(entry != NULL);
+
+	/* removed between reading its directory and loading its stat */
+	cl_git_pass(git_buf_joinpath(&path, "status", entry->path));
+	cl_git_pass(p_unlink(path.ptr));
+
+	cl_assert_equal_i(GIT_ENOTFOUND, git_iterator_current_load_stat(i, &entry));
+	cl_assert(giterr_last() == NULL);
+
+	cl_git_pass(git_iterator_advance(i, &entry));
+	cl_git_pass(git_iterator_current_load_stat(i, &entry));
+	cl_assert(entry != NULL);
+
+	git_iterator_free(i);
+	git_buf_free(&path);
+}
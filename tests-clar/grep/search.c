@@ -0,0 +1,289 @@
+#include "clar_libgit2.h"
+#include "buffer.h"
+#include "posix.h"
+
+static git_repository *_repo;
+
+void test_grep_search__cleanup(void)
+{
+	cl_git_sandbox_cleanup();
+}
+
+/* Write "path:line:match:text" for each match */
+static int collect_cb(const git_grep_match *match, void *payload)
+{
+	git_buf *out = payload;
+
+	git_buf_printf(out, "%s:%"PRIuZ":", match->path, match->line_number);
+	git_buf_put(out, match->line + match->match_offset, match->match_len);
+	git_buf_putc(out, ':');
+	git_buf_put(out, match->line, match->line_len);
+	git_buf_putc(out, '\n');
+
+	return git_buf_oom(out) ? -1 : 0;
+}
+
+static void insert_blob(
+	git_treebuilder *builder, const char *name, const char *content, size_t len)
+{
+	git_oid id;
+
+	cl_git_pass(git_blob_create_frombuffer(&id, _repo, content, len));
+	cl_git_pass(git_treebuilder_insert(NULL, builder, name, &id, GIT_FILEMODE_BLOB));
+}
+
+static git_tree *build_tree(void)
+{
+	git_treebuilder *builder;
+	git_tree *tree;
+	git_oid id;
+	static const char binary[] = "int main(void)\n\0\1\2\3";
+
+	cl_git_pass(git_treebuilder_create(&builder, NULL));
+	insert_blob(builder, "b.c",
+		"/* b */\nint b(void);\n\nint main(void)\n{\n\treturn b();\n}\n", 52);
+	cl_git_pass(git_treebuilder_write(&id, _repo, builder));
+	git_treebuilder_free(builder);
+
+	cl_git_pass(git_treebuilder_create(&builder, NULL));
+	cl_git_pass(git_treebuilder_insert(NULL, builder, "dir", &id, GIT_FILEMODE_TREE));
+	insert_blob(builder, "a.c", "int a(void)\n{\n\treturn 1;\n}", 26);
+	insert_blob(builder, "bin", binary, sizeof(binary) - 1);
+	insert_blob(builder, "readme", "Int or INT?\nno ints\n", 20);
+	cl_git_pass(git_treebuilder_write(&id, _repo, builder));
+	git_treebuilder_free(builder);
+
+	cl_git_pass(git_tree_lookup(&tree, _repo, &id));
+	return tree;
+}
+
+void test_grep_search__tree(void)
+{
+	git_buf out = GIT_BUF_INIT;
+	git_grep_opts opts;
+	git_tree *tree;
+
+	_repo = cl_git_sandbox_init("testrepo.git");
+	tree = build_tree();
+
+	cl_git_pass(git_grep_tree(tree, "^int [a-z]+\\(", NULL, collect_cb, &out));
+	cl_assert_equal_s(
+		"a.c:1:int a(:int a(void)\n"
+		"dir/b.c:2:int b(:int b(void);\n"
+		"dir/b.c:4:int main(:int main(void)\n", out.ptr);
+	git_buf_clear(&out);
+
+	/* a string, without the regex */
+	cl_git_pass(git_grep_tree(tree, "return", NULL, collect_cb, &out));
+	cl_assert_equal_s(
+		"a.c:3:return:\treturn 1;\n"
+		"dir/b.c:6:return:\treturn b();\n", out.ptr);
+	git_buf_clear(&out);
+
+	memset(&opts, 0, sizeof(opts));
+	opts.flags = GIT_GREP_FIXED_STRINGS | GIT_GREP_IGNORE_CASE;
+
+	cl_git_pass(git_grep_tree(tree, "int ", &opts, collect_cb, &out));
+	cl_assert_equal_s(
+		"a.c:1:int :int a(void)\n"
+		"dir/b.c:2:int :int b(void);\n"
+		"dir/b.c:4:int :int main(void)\n"
+		"readme:1:Int :Int or INT?\n", out.ptr);
+	git_buf_clear(&out);
+
+	/* the string must be there, but the regex decides */
+	opts.flags = GIT_GREP_IGNORE_CASE | GIT_GREP_FILES_WITH_MATCHES;
+	cl_git_pass(git_grep_tree(tree, "int[s?]$", &opts, collect_cb, &out));
+	cl_assert_equal_s(
+		"readme:1:INT?:Int or INT?\n", out.ptr);
+	git_buf_clear(&out);
+
+	git_buf_free(&out);
+	git_tree_free(tree);
+}
+
+void test_grep_search__bracket_classes(void)
+{
+	git_buf out = GIT_BUF_INIT;
+	git_treebuilder *builder;
+	git_tree *tree;
+	git_oid id;
+
+	_repo = cl_git_sandbox_init("testrepo.git");
+
+	cl_git_pass(git_treebuilder_create(&builder, NULL));
+	insert_blob(builder, "digits", "5x\n", 3);
+	insert_blob(builder, "letters", "abc\n", 4);
+	cl_git_pass(git_treebuilder_write(&id, _repo, builder));
+	git_treebuilder_free(builder);
+	cl_git_pass(git_tree_lookup(&tree, _repo, &id));
+
+	/* the ']' closing a class does not close the bracket expression */
+	cl_git_pass(git_grep_tree(tree, "[[:digit:]]x", NULL, collect_cb, &out));
+	cl_assert_equal_s("digits:1:5x:5x\n", out.ptr);
+	git_buf_clear(&out);
+
+	cl_git_pass(git_grep_tree(tree, "a[[:alpha:]]c", NULL, collect_cb, &out));
+	cl_assert_equal_s("letters:1:abc:abc\n", out.ptr);
+	git_buf_clear(&out);
+
+	cl_git_pass(git_grep_tree(tree, "[[=a=]][[.b.]]c", NULL, collect_cb, &out));
+	cl_assert_equal_s("letters:1:abc:abc\n", out.ptr);
+
+	git_buf_free(&out);
+	git_tree_free(tree);
+}
+
+void test_grep_search__binary_files(void)
+{
+	git_buf out = GIT_BUF_INIT;
+	git_grep_opts opts;
+	git_tree *tree;
+
+	_repo = cl_git_sandbox_init("testrepo.git");
+	tree = build_tree();
+
+	cl_git_pass(git_grep_tree(tree, "main", NULL, collect_cb, &out));
+	cl_assert_equal_s("dir/b.c:4:main:int main(void)\n", out.ptr);
+	git_buf_clear(&out);
+
+	memset(&opts, 0, sizeof(opts));
+	opts.flags = GIT_GREP_TEXT;
+
+	cl_git_pass(git_grep_tree(tree, "main", &opts, collect_cb, &out));
+	cl_assert_equal_s(
+		"bin:1:main:int main(void)\n"
+		"dir/b.c:4:main:int main(void)\n", out.ptr);
+
+	git_buf_free(&out);
+	git_tree_free(tree);
+}
+
+void test_grep_search__pathspec(void)
+{
+	git_buf out = GIT_BUF_INIT;
+	git_grep_opts opts;
+	git_tree *tree;
+	char *paths[] = { "dir/*.c", "readme" };
+
+	_repo = cl_git_sandbox_init("testrepo.git");
+	tree = build_tree();
+
+	memset(&opts, 0, sizeof(opts));
+	opts.pathspec.strings = paths;
+	opts.pathspec.count = 2;
+
+	cl_git_pass(git_grep_tree(tree, "int", &opts, collect_cb, &out));
+	cl_assert_equal_s(
+		"dir/b.c:2:int:int b(void);\n"
+		"dir/b.c:4:int:int main(void)\n"
+		"readme:2:int:no ints\n", out.ptr);
+	git_buf_clear(&out);
+
+	opts.pathspec.count = 1;
+	opts.flags = GIT_GREP_DISABLE_PATHSPEC_MATCH;
+
+	cl_git_pass(git_grep_tree(tree, "int", &opts, collect_cb, &out));
+	cl_assert_equal_s("", out.ptr ? out.ptr : "");
+
+	git_buf_free(&out);
+	git_tree_free(tree);
+}
+
+void test_grep_search__results_come_in_path_order(void)
+{
+	git_buf expected = GIT_BUF_INIT, out = GIT_BUF_INIT, content = GIT_BUF_INIT;
+	git_treebuilder *builder;
+	git_grep_opts opts;
+	git_tree *tree;
+	git_oid id;
+	char name[16];
+	int i;
+
+	_repo = cl_git_sandbox_init("testrepo.git");
+
+	/* written in reverse, so the blobs are stored out of path order */
+	cl_git_pass(git_treebuilder_create(&builder, NULL));
+
+	for (i = 63; i >= 0; --i) {
+		git_buf_clear(&content);
+		git_buf_printf(&content, "file %d\nneedle %d\nhay\nneedle again\n", i, i);
+		p_snprintf(name, sizeof(name), "file%02d", i);
+		insert_blob(builder, name, content.ptr, content.size);
+	}
+
+	cl_git_pass(git_treebuilder_write(&id, _repo, builder));
+	git_treebuilder_free(builder);
+	cl_git_pass(git_tree_lookup(&tree, _repo, &id));
+
+	for (i = 0; i < 64; ++i)
+		git_buf_printf(&expected,
+			"file%02d:2:needle:needle %d\nfile%02d:4:needle:needle again\n", i, i, i);
+
+	memset(&opts, 0, sizeof(opts));
+	opts.nthreads = 1;
+	cl_git_pass(git_grep_tree(tree, "needle", &opts, collect_cb, &out));
+	cl_assert_equal_s(expected.ptr, out.ptr);
+	git_buf_clear(&out);
+
+	opts.nthreads = 4;
+	cl_git_pass(git_grep_tree(tree, "ne+dle", &opts, collect_cb, &out));
+	cl_assert_equal_s(expected.ptr, out.ptr);
+
+	git_buf_free(&expected);
+	git_buf_free(&out);
+	git_buf_free(&content);
+	git_tree_free(tree);
+}
+
+void test_grep_search__index_and_workdir(void)
+{
+	git_buf out = GIT_BUF_INIT;
+	git_grep_opts opts;
+
+	_repo = cl_git_sandbox_init("status");
+
+	memset(&opts, 0, sizeof(opts));
+	opts.flags = GIT_GREP_FILES_WITH_MATCHES;
+
+	cl_git_pass(git_grep_index(_repo, NULL, "modified", &opts, collect_cb, &out));
+	cl_assert_equal_s(
+		"modified_file:1:modified:modified_file\n"
+		"staged_changes_modified_file:1:modified:staged_changes_modified_file\n"
+		"staged_new_file_modified_file:1:modified:staged_new_file_modified_file\n"
+		"subdir/modified_file:1:modified:subdir/modified_file\n", out.ptr);
+	git_buf_clear(&out);
+
+	/* deleted files are skipped, untracked ones not searched */
+	cl_git_pass(git_grep_workdir(_repo, "_?deleted|new_", NULL, collect_cb, &out));
+	cl_assert_equal_s(
+		"staged_new_file:1:new_:staged_new_file\n"
+		"staged_new_file_modified_file:1:new_:staged_new_file_modified_file\n"
+		"staged_new_file_modified_file:2:new_:staged_new_file_modified_file\n", out.ptr);
+
+	git_buf_free(&out);
+}
+
+static int stop_cb(const git_grep_match *match, void *payload)
+{
+	GIT_UNUSED(match);
+	(*(int *)payload)++;
+	return 1;
+}
+
+void test_grep_search__errors(void)
+{
+	git_buf out = GIT_BUF_INIT;
+	git_tree *tree;
+	int count = 0;
+
+	_repo = cl_git_sandbox_init("testrepo.git");
+	tree = build_tree();
+
+	cl_git_fail(git_grep_tree(tree, "int (", NULL, collect_cb, &out));
+	cl_assert_equal_i(GIT_EUSER, git_grep_tree(tree, "int", NULL, stop_cb, &count));
+	cl_assert_equal_i(1, count);
+
+	git_buf_free(&out);
+	git_tree_free(tree);
+}
@@ -0,0 +1,271 @@
+#include "clar_libgit2.h"
+#include "posix.h"
+#include "index.h"
+#include "fsmonitor.h"
+
+static git_repository *g_repo = NULL;
+static git_index *g_index = NULL;
+
+typedef struct {
+	git_fsmonitor parent;
+	const char *changed[4];
+	int queries;
+	char token[16];
+} fake_fsmonitor;
+
+static fake_fsmonitor *g_fake = NULL;
+
+static int fake_query(
+	git_fsmonitor *fsm, const char *token, git_fsmonitor_result *result)
+{
+	fake_fsmonitor *fake = (fake_fsmonitor *)fsm;
+	size_t i;
+	int error;
+
+	/* only tokens of our own can be answered */
+	if (!token || strcmp(token, fake->token) != 0)
+		git_fsmonitor_result_all(result);
+
+	for (i = 0; i < ARRAY_SIZE(fake->changed) && fake->changed[i]; ++i) {
+		if ((error = git_fsmonitor_result_add(result, fake->changed[i])) < 0)
+			return error;
+		fake->changed[i] = NULL;
+	}
+
+	p_snprintf(fake->token, sizeof(fake->token), "fake:%d", ++fake->queries);
+	return git_fsmonitor_result_set_token(result, fake->token);
+}
+
+static void fake_free(git_fsmonitor *fsm)
+{
+	git__free(fsm);
+}
+
+void test_index_fsmonitor__initialize(void)
+{
+	g_repo = cl_git_sandbox_init("status");
+	cl_git_pass(git_repository_index(&g_index, g_repo));
+
+	g_fake = git__calloc(1, sizeof(fake_fsmonitor));
+	cl_assert(g_fake);
+	g_fake->parent.query = fake_query;
+	g_fake->parent.free = fake_free;
+	git_repository_set_fsmonitor(g_repo, &g_fake->parent);
+}
+
+void test_index_fsmonitor__cleanup(void)
+{
+	git_index_free(g_index);
+	g_index = NULL;
+	g_fake = NULL;
+	cl_git_sandbox_cleanup();
+}
+
+static size_t count_changes(void)
+{
+	git_strarray changed;
+	size_t count;
+
+	cl_assert(git_index_refresh(g_index, 0, 0, &changed) >= 0);
+	count = changed.count;
+	git_strarray_free(&changed);
+
+	return count;
+}
+
+static bool entry_is_valid(git_index *index, const char *path)
+{
+	git_index_entry *entry = git_index_get_bypath(index, path, 0);
+	cl_assert(entry != NULL);
+	return (entry->flags_extended & GIT_IDXENTRY_FSMONITOR_VALID) != 0;
+}
+
+void test_index_fsmonitor__refresh_trusts_the_monitor(void)
+{
+	cl_assert_equal_i(8, count_changes());
+	cl_assert(entry_is_valid(g_index, "current_file"));
+	cl_assert(!entry_is_valid(g_index, "modified_file"));
+	cl_assert_equal_s("fake:1", g_index->fsmonitor_token);
+
+	/* unreported, so not even looked at */
+	cl_git_rewritefile("status/current_file", "changed behind its back\n");
+	cl_assert_equal_i(8, count_changes());
+
+	g_fake->changed[0] = "current_file";
+	cl_assert_equal_i(9, count_changes());
+	cl_assert(!entry_is_valid(g_index, "current_file"));
+
+	/* it stays unvetted until it is clean again */
+	cl_assert_equal_i(9, count_changes());
+	cl_git_rewritefile("status/current_file", "current_file\n");
+	g_fake->changed[0] = "current_file";
+	cl_assert_equal_i(8, count_changes());
+	cl_assert(entry_is_valid(g_index, "current_file"));
+}
+
+void test_index_fsmonitor__directories_cover_their_contents(void)
+{
+	cl_assert_equal_i(8, count_changes());
+	cl_assert(entry_is_valid(g_index, "subdir/current_file"));
+	cl_assert(entry_is_valid(g_index, "subdir.txt"));
+
+	cl_git_rewritefile("status/subdir/current_file", "changed\n");
+
+	g_fake->changed[0] = "subdir/";
+	cl_assert_equal_i(9, count_changes());
+	cl_assert(!entry_is_valid(g_index, "subdir/current_file"));
+	cl_assert(entry_is_valid(g_index, "subdir.txt"));
+}
+
+void test_index_fsmonitor__unknown_token_rechecks_everything(void)
+{
+	cl_assert_equal_i(8, count_changes());
+	cl_git_rewritefile("status/current_file", "changed behind its back\n");
+
+	strcpy(g_fake->token, "forgotten");
+	cl_assert_equal_i(9, count_changes());
+}
+
+void test_index_fsmonitor__status_skips_vetted_entries(void)
+{
+	unsigned int status;
+
+	cl_assert_equal_i(8, count_changes());
+	cl_git_rewritefile("status/current_file", "changed behind its back\n");
+
+	cl_git_pass(git_status_file(&status, g_repo, "current_file"));
+	cl_assert_equal_i(GIT_STATUS_CURRENT, status);
+
+	g_fake->changed[0] = "current_file";
+	cl_git_pass(git_status_file(&status, g_repo, "current_file"));
+	cl_assert_equal_i(GIT_STATUS_WT_MODIFIED, status);
+}
+
+void test_index_fsmonitor__token_and_flags_are_written(void)
+{
+	git_index *index;
+
+	cl_assert_equal_i(8, count_changes());
+	cl_git_pass(git_index_write(g_index));
+
+	cl_git_pass(git_index_open(&index, "status/.git/index"));
+	cl_assert_equal_s("fake:1", index->fsmonitor_token);
+	cl_assert(entry_is_valid(index, "current_file"));
+	cl_assert(entry_is_valid(index, "subdir/current_file"));
+	cl_assert(!entry_is_valid(index, "modified_file"));
+	cl_assert(!entry_is_valid(index, "file_deleted"));
+	git_index_free(index);
+
+	/* a new monitor knows nothing of the old one's tokens */
+	git_repository_set_fsmonitor(g_repo, NULL);
+	g_fake = NULL;
+	cl_git_pass(git_index_write(g_index));
+
+	cl_git_pass(git_index_open(&index, "status/.git/index"));
+	cl_assert(index->fsmonitor_token == NULL);
+	cl_assert(!entry_is_valid(index, "current_file"));
+	git_index_free(index);
+}
+
+void test_index_fsmonitor__dropping_the_monitor_drops_the_flags(void)
+{
+	cl_assert_equal_i(8, count_changes());
+	cl_git_rewritefile("status/current_file", "changed behind its back\n");
+
+	git_repository_set_fsmonitor(g_repo, NULL);
+	g_fake = NULL;
+
+	cl_assert_equal_i(9, count_changes());
+	cl_assert(g_index->fsmonitor_token == NULL);
+	cl_assert(!entry_is_valid(g_index, "subdir/current_file"));
+}
+
+#ifdef __linux__
+
+static bool result_has(git_fsmonitor_result *result, const char *path)
+{
+	const char *p;
+	unsigned int i;
+
+	git_vector_foreach(&result->paths, i, p)
+		if (!strcmp(p, path))
+			return true;
+
+	return false;
+}
+
+void test_index_fsmonitor__inotify(void)
+{
+	git_fsmonitor *fsm, *other;
+	git_fsmonitor_result result;
+	char *token;
+
+	cl_git_pass(git_fsmonitor_inotify_new(&fsm, "status"));
+
+	cl_git_pass(git_fsmonitor__query(&result, fsm, NULL));
+	cl_assert(result.all);
+	token = git__strdup(result.token);
+	git_fsmonitor__result_free(&result);
+
+	cl_git_pass(git_fsmonitor__query(&result, fsm, token));
+	cl_assert(!result.all);
+	cl_assert_equal_i(0, result.paths.length);
+	git__free(token);
+	token = git__strdup(result.token);
+	git_fsmonitor__result_free(&result);
+
+	cl_git_rewritefile("status/subdir/current_file", "changed\n");
+	cl_git_pass(p_unlink("status/modified_file"));
+	cl_git_pass(p_mkdir("status/newdir", 0777));
+	cl_git_mkfile("status/newdir/file", "new\n");
+	cl_git_pass(git_index_write(g_index));
+
+	cl_git_pass(git_fsmonitor__query(&result, fsm, token));
+	cl_assert(!result.all);
+	cl_assert(result_has(&result, "subdir/current_file"));
+	cl_assert(result_has(&result, "modified_file"));
+	cl_assert(result_has(&result, "newdir"));
+	cl_assert(!result_has(&result, ".git/index"));
+	git_fsmonitor__result_free(&result);
+
+	/* files in new directories are watched too */
+	cl_git_pass(git_fsmonitor__query(&result, fsm, token));
+	git__free(token);
+	token = git__strdup(result.token);
+	git_fsmonitor__result_free(&result);
+
+	cl_git_rewritefile("status/newdir/file", "newer\n");
+	cl_git_pass(git_fsmonitor__query(&result, fsm, token));
+	cl_assert_equal_i(1, result.paths.length);
+	cl_assert(result_has(&result, "newdir/file"));
+	git_fsmonitor__result_free(&result);
+
+	/* another instance cannot answer for this one's tokens */
+	cl_git_pass(git_fsmonitor_inotify_new(&other, "status"));
+	cl_git_pass(git_fsmonitor__query(&result, other, token));
+	cl_assert(result.all);
+	git_fsmonitor__result_free(&result);
+	git_fsmonitor_free(other);
+
+	git__free(token);
+	git_fsmonitor_free(fsm);
+}
+
+void test_index_fsmonitor__inotify_refresh(void)
+{
+	git_fsmonitor *fsm;
+
+	cl_git_pass(git_fsmonitor_inotify_new(&fsm, "status"));
+	git_repository_set_fsmonitor(g_repo, fsm);
+	g_fake = NULL;
+
+	cl_assert_equal_i(8, count_changes());
+	cl_assert(entry_is_valid(g_index, "current_file"));
+
+	cl_git_rewritefile("status/current_file", "changed\n");
+	cl_assert_equal_i(9, count_changes());
+	cl_assert(!entry_is_valid(g_index, "current_file"));
+	cl_assert(entry_is_valid(g_index, "subdir/current_file"));
+}
+
+#endif
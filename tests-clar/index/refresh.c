@@ -0,0 +1,158 @@
+#include "clar_libgit2.h"
+#include "posix.h"
+#include "index.h"
+
+static git_repository *g_repo = NULL;
+static git_index *g_index = NULL;
+
+static const char *changed_paths[] = {
+	"file_deleted",
+	"modified_file",
+	"staged_changes_file_deleted",
+	"staged_changes_modified_file",
+	"staged_new_file_deleted_file",
+	"staged_new_file_modified_file",
+	"subdir/deleted_file",
+	"subdir/modified_file",
+};
+
+void test_index_refresh__initialize(void)
+{
+	g_repo = cl_git_sandbox_init("status");
+	cl_git_pass(git_repository_index(&g_index, g_repo));
+}
+
+void test_index_refresh__cleanup(void)
+{
+	git_index_free(g_index);
+	g_index = NULL;
+	cl_git_sandbox_cleanup();
+}
+
+static void assert_changed(unsigned int nthreads)
+{
+	git_strarray changed;
+	size_t i;
+
+	cl_assert_equal_i(1, git_index_refresh(g_index, 0, nthreads, &changed));
+
+	cl_assert_equal_i(ARRAY_SIZE(changed_paths), changed.count);
+	for (i = 0; i < changed.count; ++i)
+		cl_assert_equal_s(changed_paths[i], changed.strings[i]);
+
+	git_strarray_free(&changed);
+}
+
+void test_index_refresh__reports_changed_paths(void)
+{
+	assert_changed(1);
+	assert_changed(4);
+	assert_changed(0);
+}
+
+void test_index_refresh__clean_workdir(void)
+{
+	git_strarray changed;
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(changed_paths); ++i)
+		cl_git_pass(git_index_remove(g_index, changed_paths[i], 0));
+
+	cl_assert_equal_i(0, git_index_refresh(g_index, 0, 3, &changed));
+	cl_assert_equal_i(0, changed.count);
+	git_strarray_free(&changed);
+
+	cl_assert_equal_i(0, git_index_refresh(g_index, 0, 3, NULL));
+}
+
+void test_index_refresh__quick(void)
+{
+	git_strarray changed;
+
+	cl_assert_equal_i(1, git_index_refresh(
+		g_index, GIT_INDEX_REFRESH_QUICK, 2, &changed));
+	cl_assert(changed.count >= 1);
+	git_strarray_free(&changed);
+
+	cl_assert_equal_i(1, git_index_refresh(
+		g_index, GIT_INDEX_REFRESH_QUICK, 0, NULL));
+}
+
+void test_index_refresh__updates_stat_of_unchanged_entries(void)
+{
+	git_index_entry *entry, before;
+	struct stat st;
+
+	cl_git_pass(p_lstat("status/current_file", &st));
+
+	/* the sandbox copy has different stat data than the fixture index */
+	entry = git_index_get_bypath(g_index, "current_file", 0);
+	cl_assert(entry != NULL);
+	cl_assert(entry->ino != (unsigned int)st.st_ino);
+	memcpy(&before, entry, sizeof(before));
+
+	cl_assert_equal_i(1, git_index_refresh(
+		g_index, GIT_INDEX_REFRESH_NO_UPDATE, 0, NULL));
+	entry = git_index_get_bypath(g_index, "current_file", 0);
+	cl_assert_equal_i(before.ino, entry->ino);
+
+	cl_assert_equal_i(1, git_index_refresh(g_index, 0, 0, NULL));
+	entry = git_index_get_bypath(g_index, "current_file", 0);
+	cl_assert_equal_i((unsigned int)st.st_ino, entry->ino);
+	cl_assert(entry->file_size == st.st_size);
+	cl_assert(entry->mtime.seconds == (git_time_t)st.st_mtime);
+	cl_assert(git_oid_equal(&before.oid, &entry->oid));
+	cl_assert_equal_i(before.mode, entry->mode);
+
+	/* entries with the wrong content keep their stat data */
+	entry = git_index_get_bypath(g_index, "modified_file", 0);
+	memcpy(&before, entry, sizeof(before));
+	cl_assert_equal_i(1, git_index_refresh(g_index, 0, 0, NULL));
+	cl_assert_equal_i(before.ino, entry->ino);
+}
+
+void test_index_refresh__racily_clean_entries_are_hashed(void)
+{
+	git_index_entry *entry;
+	git_strarray changed;
+	struct stat st;
+
+	/* same size, so nothing but the content tells the change apart */
+	cl_git_rewritefile("status/current_file", "CURRENT_FILE\n");
+	cl_git_pass(p_lstat("status/current_file", &st));
+
+	/* written no earlier than the index was read: racy */
+	entry = git_index_get_bypath(g_index, "current_file", 0);
+	git_index_entry__init_from_stat(entry, &st);
+	cl_assert(entry->mtime.seconds >= g_index->stamp.mtime);
+
+	cl_assert_equal_i(1, git_index_refresh(g_index, 0, 0, &changed));
+	cl_assert_equal_i(ARRAY_SIZE(changed_paths) + 1, changed.count);
+	cl_assert_equal_s("current_file", changed.strings[0]);
+	git_strarray_free(&changed);
+}
+
+void test_index_refresh__conflicts_are_changes(void)
+{
+	git_index_entry ancestor, ours, theirs;
+	git_strarray changed;
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(changed_paths); ++i)
+		cl_git_pass(git_index_remove(g_index, changed_paths[i], 0));
+
+	memset(&ancestor, 0, sizeof(ancestor));
+	memset(&ours, 0, sizeof(ours));
+	memset(&theirs, 0, sizeof(theirs));
+	ancestor.path = ours.path = theirs.path = "conflicted";
+	ancestor.mode = ours.mode = theirs.mode = 0100644;
+	git_oid_fromstr(&ancestor.oid, "9fd738e8f7967c078dceed8190330fc8648ee56a");
+	git_oid_fromstr(&ours.oid, "a8233120f6ad708f843d861ce2b7228ec4e3dec6");
+	git_oid_fromstr(&theirs.oid, "a71586c1dfe8a71c6cbf6c129f404c5642ff31bd");
+	cl_git_pass(git_index_conflict_add(g_index, &ancestor, &ours, &theirs));
+
+	cl_assert_equal_i(1, git_index_refresh(g_index, 0, 2, &changed));
+	cl_assert_equal_i(1, changed.count);
+	cl_assert_equal_s("conflicted", changed.strings[0]);
+	git_strarray_free(&changed);
+}
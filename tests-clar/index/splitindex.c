@@ -0,0 +1,212 @@
+#include "clar_libgit2.h"
+#include "posix.h"
+#include "index.h"
+
+static git_repository *g_repo = NULL;
+static git_index *g_index = NULL;
+
+void test_index_splitindex__initialize(void)
+{
+	git_config *cfg;
+
+	g_repo = cl_git_sandbox_init("status");
+
+	cl_git_pass(git_repository_config(&cfg, g_repo));
+	cl_git_pass(git_config_set_bool(cfg, "core.splitIndex", true));
+	cl_git_pass(git_config_set_string(cfg, "splitIndex.sharedIndexExpire", "never"));
+	git_config_free(cfg);
+
+	cl_git_pass(git_repository_index(&g_index, g_repo));
+}
+
+void test_index_splitindex__cleanup(void)
+{
+	git_index_free(g_index);
+	g_index = NULL;
+	cl_git_sandbox_cleanup();
+}
+
+static int count_shared_cb(void *payload, git_buf *path)
+{
+	if (strstr(path->ptr, "/" GIT_INDEX_SHARED_PREFIX) != NULL)
+		(*(int *)payload)++;
+	return 0;
+}
+
+static int count_shared(void)
+{
+	git_buf path = GIT_BUF_INIT;
+	int count = 0;
+
+	cl_git_pass(git_buf_sets(&path, "status/.git"));
+	cl_git_pass(git_path_direach(&path, count_shared_cb, &count));
+	git_buf_free(&path);
+
+	return count;
+}
+
+static void assert_same_entries(git_index *a, git_index *b)
+{
+	git_index_entry *ea, *eb;
+	unsigned int i;
+
+	cl_assert_equal_i(git_index_entrycount(a), git_index_entrycount(b));
+
+	for (i = 0; i < git_index_entrycount(a); ++i) {
+		ea = git_index_get_byindex(a, i);
+		eb = git_index_get_byindex(b, i);
+
+		cl_assert_equal_s(ea->path, eb->path);
+		cl_assert(git_oid_equal(&ea->oid, &eb->oid));
+		cl_assert_equal_i(ea->mode, eb->mode);
+		cl_assert_equal_i(ea->flags, eb->flags);
+		cl_assert(ea->file_size == eb->file_size);
+	}
+}
+
+static void set_config(const char *name, const char *value)
+{
+	git_config *cfg;
+
+	cl_git_pass(git_repository_config(&cfg, g_repo));
+	cl_git_pass(git_config_set_string(cfg, name, value));
+	git_config_free(cfg);
+}
+
+void test_index_splitindex__write_and_read_back(void)
+{
+	git_index *index;
+
+	cl_assert_equal_i(0, count_shared());
+	cl_git_pass(git_index_write(g_index));
+	cl_assert_equal_i(1, count_shared());
+	cl_assert(g_index->split_base != NULL);
+
+	cl_git_pass(git_index_open(&index, "status/.git/index"));
+	cl_assert(index->split_base != NULL);
+	cl_assert(git_oid_equal(&g_index->split_base_oid, &index->split_base_oid));
+	assert_same_entries(g_index, index);
+	git_index_free(index);
+}
+
+void test_index_splitindex__small_changes_only_write_the_delta(void)
+{
+	git_index *index;
+	git_index_entry *entry, added;
+	git_oid base;
+	struct stat split_st, shared_st;
+	git_buf shared = GIT_BUF_INIT;
+	char hex[GIT_OID_HEXSZ + 1];
+
+	/* the sandbox has few entries, so a few changes are a lot */
+	set_config("splitIndex.maxPercentChange", "50");
+
+	cl_git_pass(git_index_write(g_index));
+	git_oid_cpy(&base, &g_index->split_base_oid);
+
+	/* replace one entry, delete another, add a third */
+	entry = git_index_get_bypath(g_index, "current_file", 0);
+	entry->file_size = 1234;
+	cl_git_pass(git_index_remove(g_index, "modified_file", 0));
+
+	memcpy(&added, git_index_get_bypath(g_index, "subdir.txt", 0), sizeof(added));
+	added.path = "zzz_added";
+	cl_git_pass(git_index_add(g_index, &added));
+
+	cl_git_pass(git_index_write(g_index));
+	cl_assert(git_oid_equal(&base, &g_index->split_base_oid));
+	cl_assert_equal_i(1, count_shared());
+
+	git_oid_tostr(hex, sizeof(hex), &base);
+	cl_git_pass(git_buf_printf(&shared, "status/.git/" GIT_INDEX_SHARED_PREFIX "%s", hex));
+	cl_git_pass(p_stat(shared.ptr, &shared_st));
+	cl_git_pass(p_stat("status/.git/index", &split_st));
+	cl_assert(split_st.st_size < shared_st.st_size / 2);
+	git_buf_free(&shared);
+
+	cl_git_pass(git_index_open(&index, "status/.git/index"));
+	assert_same_entries(g_index, index);
+	cl_assert(git_index_get_bypath(index, "current_file", 0)->file_size == 1234);
+	cl_assert(git_index_get_bypath(index, "modified_file", 0) == NULL);
+	cl_assert(git_index_get_bypath(index, "zzz_added", 0) != NULL);
+	git_index_free(index);
+}
+
+void test_index_splitindex__too_many_changes_rewrite_the_shared_index(void)
+{
+	git_index *index;
+	git_oid base;
+
+	cl_git_pass(git_index_write(g_index));
+	git_oid_cpy(&base, &g_index->split_base_oid);
+
+	cl_git_pass(git_index_remove(g_index, "current_file", 0));
+	cl_git_pass(git_index_write(g_index));
+	cl_assert(git_oid_equal(&base, &g_index->split_base_oid));
+
+	set_config("splitIndex.maxPercentChange", "0");
+	cl_git_pass(git_index_remove(g_index, "modified_file", 0));
+	cl_git_pass(git_index_write(g_index));
+	cl_assert(!git_oid_equal(&base, &g_index->split_base_oid));
+	cl_assert_equal_i(2, count_shared());
+
+	cl_git_pass(git_index_open(&index, "status/.git/index"));
+	assert_same_entries(g_index, index);
+	git_index_free(index);
+}
+
+void test_index_splitindex__unused_shared_indexes_expire(void)
+{
+	git_buf old = GIT_BUF_INIT;
+	struct timeval times[2];
+	char hex[GIT_OID_HEXSZ + 1];
+
+	cl_git_pass(git_index_write(g_index));
+	git_oid_tostr(hex, sizeof(hex), &g_index->split_base_oid);
+	cl_git_pass(git_buf_printf(&old, "status/.git/" GIT_INDEX_SHARED_PREFIX "%s", hex));
+
+	times[0].tv_sec = times[1].tv_sec = 1000000000;
+	times[0].tv_usec = times[1].tv_usec = 0;
+	cl_git_pass(p_utimes(old.ptr, times));
+
+	set_config("splitIndex.sharedIndexExpire", "2.weeks.ago");
+	set_config("splitIndex.maxPercentChange", "0");
+	cl_git_pass(git_index_remove(g_index, "current_file", 0));
+	cl_git_pass(git_index_write(g_index));
+
+	cl_assert(!git_path_exists(old.ptr));
+	cl_assert_equal_i(1, count_shared());
+	git_buf_free(&old);
+}
+
+void test_index_splitindex__can_be_turned_off(void)
+{
+	git_index *index;
+
+	cl_git_pass(git_index_write(g_index));
+
+	set_config("core.splitIndex", "false");
+	cl_git_pass(git_index_write(g_index));
+	cl_assert(g_index->split_base == NULL);
+
+	cl_git_pass(git_index_open(&index, "status/.git/index"));
+	cl_assert(index->split_base == NULL);
+	assert_same_entries(g_index, index);
+	git_index_free(index);
+}
+
+void test_index_splitindex__missing_shared_index(void)
+{
+	git_index *index;
+	git_buf shared = GIT_BUF_INIT;
+	char hex[GIT_OID_HEXSZ + 1];
+
+	cl_git_pass(git_index_write(g_index));
+	git_oid_tostr(hex, sizeof(hex), &g_index->split_base_oid);
+	cl_git_pass(git_buf_printf(&shared, "status/.git/" GIT_INDEX_SHARED_PREFIX "%s", hex));
+	cl_git_pass(p_unlink(shared.ptr));
+	git_buf_free(&shared);
+
+	cl_git_fail(git_index_open(&index, "status/.git/index"));
+	git_index_free(index);
+}
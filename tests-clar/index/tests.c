@@ -261,3 +261,85 @@ void test_index_tests__add_from_workdir_to_a_bare_repository_returns_EBAREPO(voi
 	git_index_free(index);
 	git_repository_free(bare_repo);
 }
+
+void test_index_tests__find_ignore_case(void)
+{
+   git_index *index;
+   git_index_entry *entry;
+   git_buf upper = GIT_BUF_INIT;
+   unsigned int i;
+
+   cl_git_pass(git_index_open(&index, TEST_INDEX_PATH));
+
+   /* case sensitive lookups first, then the same under ignore_case */
+   cl_assert(git_index_get_bypath(index, "MAKEFILE", 0) == NULL);
+   cl_assert_equal_i(GIT_ENOTFOUND, git_index_find(index, "MAKEFILE"));
+
+   cl_git_pass(git_index_set_caps(index, GIT_INDEXCAP_IGNORE_CASE));
+
+   for (i = 0; i < ARRAY_SIZE(test_entries); ++i) {
+      cl_git_pass(git_buf_sets(&upper, test_entries[i].path));
+      git__strtolower(upper.ptr);
+      upper.ptr[0] = (char)toupper(upper.ptr[0]);
+
+      cl_assert((entry = git_index_get_bypath(index, upper.ptr, 0)) != NULL);
+      cl_assert_equal_s(test_entries[i].path, entry->path);
+      cl_assert(git_index_get_bypath(index, upper.ptr, 1) == NULL);
+
+      cl_assert(git_index_find(index, upper.ptr) >= 0);
+      cl_assert(git_index_get_byindex(index, git_index_find(index, upper.ptr)) == entry);
+   }
+
+   cl_assert(git_index_get_bypath(index, "NO-SUCH-FILE", 0) == NULL);
+   cl_assert_equal_i(GIT_ENOTFOUND, git_index_find(index, "no-such-file"));
+
+   git_buf_free(&upper);
+   git_index_free(index);
+}
+
+void test_index_tests__lookups_follow_changes(void)
+{
+   git_index *index;
+   git_index_entry entry, *found;
+   char path[32];
+   int i;
+
+   cl_git_pass(git_index_new(&index));
+   cl_git_pass(git_index_set_caps(index, GIT_INDEXCAP_IGNORE_CASE));
+
+   memset(&entry, 0, sizeof(entry));
+   entry.mode = GIT_FILEMODE_BLOB;
+   cl_git_pass(git_oid_fromstr(&entry.oid, "a8233120f6ad708f843d861ce2b7228ec4e3dec6"));
+   entry.path = path;
+
+   for (i = 0; i < 100; ++i) {
+      p_snprintf(path, sizeof(path), "dir/File%02d", i);
+      cl_git_pass(git_index_add(index, &entry));
+   }
+   cl_assert_equal_i(100, git_index_entrycount(index));
+
+   /* adding an existing path under another case replaces it */
+   strcpy(path, "DIR/FILE42");
+   entry.file_size = 42;
+   cl_git_pass(git_index_add(index, &entry));
+   cl_assert_equal_i(100, git_index_entrycount(index));
+
+   cl_assert((found = git_index_get_bypath(index, "dir/file42", 0)) != NULL);
+   cl_assert_equal_s("DIR/FILE42", found->path);
+   cl_assert_equal_i(42, (int)found->file_size);
+
+   cl_git_pass(git_index_remove(index, "Dir/File42", 0));
+   cl_assert(git_index_get_bypath(index, "dir/file42", 0) == NULL);
+   cl_assert_equal_i(GIT_ENOTFOUND, git_index_find(index, "dir/file42"));
+   cl_assert(git_index_get_bypath(index, "dir/file43", 0) != NULL);
+
+   /* and so does going back to case sensitive lookups */
+   cl_git_pass(git_index_set_caps(index, 0));
+   cl_assert(git_index_get_bypath(index, "dir/file43", 0) == NULL);
+   cl_assert(git_index_get_bypath(index, "dir/File43", 0) != NULL);
+
+   git_index_clear(index);
+   cl_assert(git_index_get_bypath(index, "dir/File43", 0) == NULL);
+
+   git_index_free(index);
+}
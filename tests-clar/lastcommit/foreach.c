@@ -0,0 +1,88 @@
+#include "clar_libgit2.h"
+#include "buffer.h"
+
+static git_repository *_repo;
+
+void test_lastcommit_foreach__initialize(void)
+{
+	cl_git_pass(git_repository_open(&_repo, cl_fixture("testrepo.git")));
+}
+
+void test_lastcommit_foreach__cleanup(void)
+{
+	git_repository_free(_repo);
+	_repo = NULL;
+}
+
+/* Write "name commit" for each entry */
+static int collect_cb(const git_tree_entry *entry, const git_oid *commit_id, void *payload)
+{
+	git_buf *out = payload;
+	char id[GIT_OID_HEXSZ + 1];
+
+	git_buf_printf(out, "%s %s\n",
+		git_tree_entry_name(entry), git_oid_tostr(id, sizeof(id), commit_id));
+
+	return git_buf_oom(out) ? -1 : 0;
+}
+
+static void check_last_commits(const char *commit, const char *path, const char *expected)
+{
+	git_buf out = GIT_BUF_INIT;
+	git_oid id;
+
+	cl_git_pass(git_oid_fromstr(&id, commit));
+	cl_git_pass(git_last_commit_foreach(_repo, &id, path, collect_cb, &out));
+	cl_assert_equal_s(expected, out.ptr);
+
+	git_buf_free(&out);
+}
+
+void test_lastcommit_foreach__follows_the_unchanged_side_of_merges(void)
+{
+	/* README comes from the second parent of a merge */
+	check_last_commits("a65fedf39aefe402d3bb6e24df4d4f5fe4547750", NULL,
+		"README 4a202b346bb0fb0db7eff3cffeb3c70babbd2045\n"
+		"branch_file.txt a65fedf39aefe402d3bb6e24df4d4f5fe4547750\n"
+		"new.txt 9fd738e8f7967c078dceed8190330fc8648ee56a\n");
+}
+
+void test_lastcommit_foreach__in_a_directory(void)
+{
+	check_last_commits("763d71aadf09a7951596c9746c024e7eece7c7af", "",
+		"README 8496071c1b46c854b31185ea97743be6a8774479\n"
+		"ab 763d71aadf09a7951596c9746c024e7eece7c7af\n"
+		"branch_file.txt c47800c7266a2be04c571c04d5a6614691ea99bd\n"
+		"new.txt 5b5b025afb0b4c913b4c338a42934a3863bf3644\n");
+
+	check_last_commits("763d71aadf09a7951596c9746c024e7eece7c7af", "ab",
+		"4.txt 763d71aadf09a7951596c9746c024e7eece7c7af\n"
+		"c 763d71aadf09a7951596c9746c024e7eece7c7af\n"
+		"de 763d71aadf09a7951596c9746c024e7eece7c7af\n");
+}
+
+static int stop_cb(const git_tree_entry *entry, const git_oid *commit_id, void *payload)
+{
+	GIT_UNUSED(entry);
+	GIT_UNUSED(commit_id);
+	(*(int *)payload)++;
+	return 1;
+}
+
+void test_lastcommit_foreach__errors(void)
+{
+	git_oid id;
+	int count = 0;
+
+	cl_git_pass(git_oid_fromstr(&id, "763d71aadf09a7951596c9746c024e7eece7c7af"));
+
+	cl_assert_equal_i(GIT_ENOTFOUND,
+		git_last_commit_foreach(_repo, &id, "ab/4.txt", stop_cb, &count));
+	cl_assert_equal_i(GIT_ENOTFOUND,
+		git_last_commit_foreach(_repo, &id, "no/such/dir", stop_cb, &count));
+	cl_assert_equal_i(0, count);
+
+	cl_assert_equal_i(GIT_EUSER,
+		git_last_commit_foreach(_repo, &id, "ab", stop_cb, &count));
+	cl_assert_equal_i(1, count);
+}
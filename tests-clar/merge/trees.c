@@ -0,0 +1,265 @@
+#include "clar_libgit2.h"
+
+#include "git2/merge.h"
+
+static git_repository *_repo;
+
+typedef struct {
+	const char *path;
+	const char *content;
+} merge_file;
+
+void test_merge_trees__initialize(void)
+{
+	_repo = cl_git_sandbox_init("testrepo.git");
+}
+
+void test_merge_trees__cleanup(void)
+{
+	cl_git_sandbox_cleanup();
+}
+
+static git_tree *build_tree(const merge_file *files)
+{
+	git_index *index;
+	git_index_entry entry;
+	git_tree *tree;
+	git_oid oid;
+
+	cl_git_pass(git_index_new(&index));
+
+	for (; files->path != NULL; files++) {
+		memset(&entry, 0, sizeof(entry));
+		entry.path = (char *)files->path;
+		entry.mode = GIT_FILEMODE_BLOB;
+		cl_git_pass(git_blob_create_frombuffer(
+			&entry.oid, _repo, files->content, strlen(files->content)));
+		cl_git_pass(git_index_add(index, &entry));
+	}
+
+	cl_git_pass(git_index_write_tree_to(&oid, index, _repo));
+	cl_git_pass(git_tree_lookup(&tree, _repo, &oid));
+
+	git_index_free(index);
+	return tree;
+}
+
+static git_index *merge(
+	const merge_file *ancestor, const merge_file *ours,
+	const merge_file *theirs, git_merge_tree_opts *opts)
+{
+	git_tree *trees[3];
+	git_index *index;
+
+	trees[0] = build_tree(ancestor);
+	trees[1] = build_tree(ours);
+	trees[2] = build_tree(theirs);
+
+	cl_git_pass(git_merge_trees(&index, _repo, trees[0], trees[1], trees[2], opts));
+
+	git_tree_free(trees[0]);
+	git_tree_free(trees[1]);
+	git_tree_free(trees[2]);
+
+	return index;
+}
+
+static void assert_entry(
+	git_index *index, const char *path, int stage, const char *content)
+{
+	git_index_entry *entry;
+	git_blob *blob;
+
+	cl_assert((entry = git_index_get_bypath(index, path, stage)) != NULL);
+
+	cl_git_pass(git_blob_lookup(&blob, _repo, &entry->oid));
+	cl_assert_equal_s(content, (const char *)git_blob_rawcontent(blob));
+	git_blob_free(blob);
+}
+
+#define LINES(a, b) "1\n" a "\n3\n4\n5\n6\n7\n8\n" b "\n10\n"
+
+static const merge_file ancestor[] = {
+	{ "README", "readme\n" },
+	{ "lib/one.c", "one\n" },
+	{ "lib/two.c", "two\n" },
+	{ "lines.txt", LINES("2", "9") },
+	{ "doomed.txt", "doomed\n" },
+	{ "untouched/deep/file.txt", "untouched\n" },
+	{ NULL, NULL }
+};
+
+void test_merge_trees__clean_merge(void)
+{
+	git_index *index;
+
+	merge_file ours[] = {
+		{ "README", "readme, ours\n" },
+		{ "lib/one.c", "one\n" },
+		{ "lib/two.c", "two\n" },
+		{ "lines.txt", LINES("two", "9") },
+		{ "doomed.txt", "doomed\n" },
+		{ "both.txt", "added by both\n" },
+		{ "untouched/deep/file.txt", "untouched\n" },
+		{ NULL, NULL }
+	};
+	merge_file theirs[] = {
+		{ "README", "readme\n" },
+		{ "lib/one.c", "one\n" },
+		{ "lib/two.c", "two, theirs\n" },
+		{ "lib/three.c", "three\n" },
+		{ "lines.txt", LINES("2", "nine") },
+		{ "both.txt", "added by both\n" },
+		{ "untouched/deep/file.txt", "untouched\n" },
+		{ NULL, NULL }
+	};
+
+	index = merge(ancestor, ours, theirs, NULL);
+
+	cl_assert(!git_index_has_conflicts(index));
+	cl_assert_equal_i(7, git_index_entrycount(index));
+
+	assert_entry(index, "README", 0, "readme, ours\n");
+	assert_entry(index, "lib/one.c", 0, "one\n");
+	assert_entry(index, "lib/two.c", 0, "two, theirs\n");
+	assert_entry(index, "lib/three.c", 0, "three\n");
+	assert_entry(index, "lines.txt", 0, LINES("two", "nine"));
+	assert_entry(index, "both.txt", 0, "added by both\n");
+	assert_entry(index, "untouched/deep/file.txt", 0, "untouched\n");
+	cl_assert(git_index_get_bypath(index, "doomed.txt", 0) == NULL);
+
+	git_index_free(index);
+}
+
+void test_merge_trees__conflicts_are_recorded_in_stages(void)
+{
+	git_index *index;
+	git_index_entry *a, *o, *t;
+
+	merge_file ours[] = {
+		{ "README", "readme\n" },
+		{ "lib/one.c", "one\n" },
+		{ "lines.txt", LINES("ours", "9") },
+		{ "doomed.txt", "doomed, but modified\n" },
+		{ "untouched/deep/file.txt", "untouched\n" },
+		{ NULL, NULL }
+	};
+	merge_file theirs[] = {
+		{ "README", "readme\n" },
+		{ "lib/one.c", "one\n" },
+		{ "lib/two.c", "two\n" },
+		{ "lines.txt", LINES("theirs", "9") },
+		{ "untouched/deep/file.txt", "untouched\n" },
+		{ NULL, NULL }
+	};
+
+	index = merge(ancestor, ours, theirs, NULL);
+
+	cl_assert(git_index_has_conflicts(index));
+
+	/* both modified */
+	cl_git_pass(git_index_conflict_get(&a, &o, &t, index, "lines.txt"));
+	assert_entry(index, "lines.txt", 1, LINES("2", "9"));
+	assert_entry(index, "lines.txt", 2, LINES("ours", "9"));
+	assert_entry(index, "lines.txt", 3, LINES("theirs", "9"));
+
+	/* modified by us, deleted by them */
+	cl_git_pass(git_index_conflict_get(&a, &o, &t, index, "doomed.txt"));
+	cl_assert(a != NULL && o != NULL && t == NULL);
+
+	/* deleted by us, untouched by them */
+	cl_assert(git_index_get_bypath(index, "lib/two.c", 0) == NULL);
+
+	git_index_free(index);
+}
+
+void test_merge_trees__favor_resolves_content_conflicts(void)
+{
+	git_index *index;
+	git_merge_tree_opts opts = {0};
+
+	merge_file ours[] = {
+		{ "lines.txt", LINES("ours", "9") },
+		{ NULL, NULL }
+	};
+	merge_file theirs[] = {
+		{ "lines.txt", LINES("theirs", "nine") },
+		{ NULL, NULL }
+	};
+	merge_file base[] = {
+		{ "lines.txt", LINES("2", "9") },
+		{ NULL, NULL }
+	};
+
+	opts.file_favor = GIT_MERGE_FILE_FAVOR_OURS;
+	index = merge(base, ours, theirs, &opts);
+	cl_assert(!git_index_has_conflicts(index));
+	assert_entry(index, "lines.txt", 0, LINES("ours", "nine"));
+	git_index_free(index);
+
+	opts.file_favor = GIT_MERGE_FILE_FAVOR_NORMAL;
+	opts.flags = GIT_MERGE_TREE_NO_CONTENT_MERGE;
+	index = merge(base, ours, theirs, &opts);
+	cl_assert(git_index_has_conflicts(index));
+	git_index_free(index);
+}
+
+void test_merge_trees__directory_file_conflict(void)
+{
+	git_index *index;
+
+	merge_file base[] = {
+		{ "README", "readme\n" },
+		{ NULL, NULL }
+	};
+	merge_file ours[] = {
+		{ "README", "readme\n" },
+		{ "thing", "a file\n" },
+		{ NULL, NULL }
+	};
+	merge_file theirs[] = {
+		{ "README", "readme\n" },
+		{ "thing/inside", "a directory\n" },
+		{ NULL, NULL }
+	};
+
+	index = merge(base, ours, theirs, NULL);
+
+	cl_assert(git_index_has_conflicts(index));
+	cl_assert(git_index_get_bypath(index, "thing", 0) == NULL);
+	assert_entry(index, "thing", 2, "a file\n");
+	assert_entry(index, "thing/inside", 0, "a directory\n");
+
+	git_index_free(index);
+}
+
+void test_merge_trees__without_ancestor(void)
+{
+	git_index *index;
+	git_tree *ours, *theirs;
+
+	merge_file our_files[] = {
+		{ "README", "readme\n" },
+		{ "a.txt", "a\n" },
+		{ NULL, NULL }
+	};
+	merge_file their_files[] = {
+		{ "README", "readme\n" },
+		{ "b.txt", "b\n" },
+		{ NULL, NULL }
+	};
+
+	ours = build_tree(our_files);
+	theirs = build_tree(their_files);
+
+	cl_git_pass(git_merge_trees(&index, _repo, NULL, ours, theirs, NULL));
+
+	cl_assert(!git_index_has_conflicts(index));
+	cl_assert_equal_i(3, git_index_entrycount(index));
+	assert_entry(index, "a.txt", 0, "a\n");
+	assert_entry(index, "b.txt", 0, "b\n");
+
+	git_index_free(index);
+	git_tree_free(ours);
+	git_tree_free(theirs);
+}
@@ -0,0 +1,246 @@
+#include "clar_libgit2.h"
+
+#include "notes.h"
+
+static git_repository *_repo;
+static git_signature *_sig;
+
+#define BATCH_REF "refs/notes/batch"
+#define BATCH_NOTES_COUNT 600
+
+void test_notes_notesbatch__initialize(void)
+{
+	_repo = cl_git_sandbox_init("testrepo.git");
+	cl_git_pass(git_signature_now(&_sig, "alice", "alice@example.com"));
+}
+
+void test_notes_notesbatch__cleanup(void)
+{
+	git_signature_free(_sig);
+	cl_git_sandbox_cleanup();
+}
+
+static void target_oid(git_oid *oid, int i)
+{
+	char buf[32];
+	sprintf(buf, "target %d", i);
+	cl_git_pass(git_odb_hash(oid, buf, strlen(buf), GIT_OBJ_BLOB));
+}
+
+static void assert_note(const char *notes_ref, const git_oid *target, const char *message)
+{
+	git_note *note;
+
+	cl_git_pass(git_note_read(&note, _repo, notes_ref, target));
+	cl_assert_equal_s(message, git_note_message(note));
+	git_note_free(note);
+}
+
+static int count_cb(git_note_data *note_data, void *payload)
+{
+	GIT_UNUSED(note_data);
+	(*(size_t *)payload)++;
+	return 0;
+}
+
+static size_t count_notes(const char *notes_ref)
+{
+	size_t count = 0;
+	cl_git_pass(git_note_foreach(_repo, notes_ref, count_cb, &count));
+	return count;
+}
+
+static void add_batch_notes(git_oid *commit_oid, int from, int to)
+{
+	git_note_batch *batch;
+	git_oid oid;
+	int i;
+
+	cl_git_pass(git_note_batch_new(&batch, _repo, BATCH_REF));
+	for (i = from; i < to; ++i) {
+		target_oid(&oid, i);
+		cl_git_pass(git_note_batch_create(NULL, batch, &oid, "batched\n"));
+	}
+	cl_git_pass(git_note_batch_commit(commit_oid, batch, _sig, _sig));
+	git_note_batch_free(batch);
+}
+
+void test_notes_notesbatch__many_notes_make_a_single_commit_with_fanout(void)
+{
+	git_oid commit_oid, oid;
+	git_commit *commit;
+	git_tree *tree;
+	unsigned int i;
+
+	add_batch_notes(&commit_oid, 0, BATCH_NOTES_COUNT);
+
+	cl_git_pass(git_reference_name_to_oid(&oid, _repo, BATCH_REF));
+	cl_assert(git_oid_cmp(&oid, &commit_oid) == 0);
+
+	cl_git_pass(git_commit_lookup(&commit, _repo, &commit_oid));
+	cl_assert_equal_i(0, git_commit_parentcount(commit));
+	cl_git_pass(git_commit_tree(&tree, commit));
+
+	/* Too many notes for a flat tree: only fanout subtrees at the root */
+	cl_assert(git_tree_entrycount(tree) > 0);
+	for (i = 0; i < git_tree_entrycount(tree); ++i) {
+		const git_tree_entry *entry = git_tree_entry_byindex(tree, i);
+		cl_assert_equal_i(GIT_OBJ_TREE, git_tree_entry_type(entry));
+		cl_assert_equal_i(2, strlen(git_tree_entry_name(entry)));
+	}
+
+	git_tree_free(tree);
+	git_commit_free(commit);
+
+	for (i = 0; i < BATCH_NOTES_COUNT; ++i) {
+		target_oid(&oid, i);
+		assert_note(BATCH_REF, &oid, "batched\n");
+	}
+
+	cl_assert_equal_i(BATCH_NOTES_COUNT, count_notes(BATCH_REF));
+}
+
+void test_notes_notesbatch__can_add_and_remove_on_top_of_a_previous_batch(void)
+{
+	git_note_batch *batch;
+	git_oid first, second, oid;
+	git_commit *commit;
+	git_note *note;
+	int i;
+
+	add_batch_notes(&first, 0, BATCH_NOTES_COUNT);
+
+	cl_git_pass(git_note_batch_new(&batch, _repo, BATCH_REF));
+	for (i = 0; i < BATCH_NOTES_COUNT; i += 2) {
+		target_oid(&oid, i);
+		cl_git_pass(git_note_batch_remove(batch, &oid));
+	}
+	target_oid(&oid, 1);
+	cl_git_pass(git_note_batch_remove(batch, &oid));
+	cl_git_pass(git_note_batch_create(NULL, batch, &oid, "replaced\n"));
+	target_oid(&oid, BATCH_NOTES_COUNT);
+	cl_git_pass(git_note_batch_create(NULL, batch, &oid, "new\n"));
+	cl_git_pass(git_note_batch_commit(&second, batch, _sig, _sig));
+	git_note_batch_free(batch);
+
+	cl_git_pass(git_commit_lookup(&commit, _repo, &second));
+	cl_assert_equal_i(1, git_commit_parentcount(commit));
+	cl_assert(git_oid_cmp(git_commit_parent_oid(commit, 0), &first) == 0);
+	git_commit_free(commit);
+
+	target_oid(&oid, 0);
+	cl_assert_equal_i(GIT_ENOTFOUND, git_note_read(&note, _repo, BATCH_REF, &oid));
+	target_oid(&oid, 1);
+	assert_note(BATCH_REF, &oid, "replaced\n");
+	target_oid(&oid, 3);
+	assert_note(BATCH_REF, &oid, "batched\n");
+	target_oid(&oid, BATCH_NOTES_COUNT);
+	assert_note(BATCH_REF, &oid, "new\n");
+
+	cl_assert_equal_i(BATCH_NOTES_COUNT / 2 + 1, count_notes(BATCH_REF));
+}
+
+void test_notes_notesbatch__can_insert_in_an_existing_fanout(void)
+{
+	git_note_batch *batch;
+	git_oid oid;
+
+	cl_git_pass(git_note_batch_new(&batch, _repo, "refs/notes/fanout"));
+	cl_git_pass(git_oid_fromstr(&oid, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750"));
+	cl_git_pass(git_note_batch_create(NULL, batch, &oid, "I decorate a65f\n"));
+	cl_git_pass(git_oid_fromstr(&oid, "8496071c1b46c854b31185ea97743be6a8774479"));
+	cl_git_pass(git_note_batch_remove(batch, &oid));
+	cl_git_pass(git_note_batch_create(NULL, batch, &oid, "I decorate 8496\n"));
+	cl_git_pass(git_note_batch_commit(NULL, batch, _sig, _sig));
+	git_note_batch_free(batch);
+
+	assert_note("refs/notes/fanout", &oid, "I decorate 8496\n");
+	cl_git_pass(git_oid_fromstr(&oid, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750"));
+	assert_note("refs/notes/fanout", &oid, "I decorate a65f\n");
+}
+
+void test_notes_notesbatch__conflicting_changes_are_refused(void)
+{
+	git_note_batch *batch;
+	git_oid oid, before, after;
+
+	cl_git_pass(git_reference_name_to_oid(&before, _repo, "refs/notes/fanout"));
+	cl_git_pass(git_oid_fromstr(&oid, "8496071c1b46c854b31185ea97743be6a8774479"));
+
+	cl_git_pass(git_note_batch_new(&batch, _repo, "refs/notes/fanout"));
+	cl_git_pass(git_note_batch_create(NULL, batch, &oid, "hello\n"));
+	cl_assert_equal_i(GIT_EEXISTS, git_note_batch_create(NULL, batch, &oid, "hello\n"));
+	cl_assert_equal_i(GIT_EEXISTS, git_note_batch_commit(NULL, batch, _sig, _sig));
+	git_note_batch_free(batch);
+
+	cl_git_pass(git_oid_fromstr(&oid, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750"));
+
+	cl_git_pass(git_note_batch_new(&batch, _repo, "refs/notes/fanout"));
+	cl_git_pass(git_note_batch_remove(batch, &oid));
+	cl_assert_equal_i(GIT_ENOTFOUND, git_note_batch_remove(batch, &oid));
+	cl_assert_equal_i(GIT_ENOTFOUND, git_note_batch_commit(NULL, batch, _sig, _sig));
+	git_note_batch_free(batch);
+
+	cl_git_pass(git_reference_name_to_oid(&after, _repo, "refs/notes/fanout"));
+	cl_assert(git_oid_cmp(&before, &after) == 0);
+}
+
+void test_notes_notesbatch__adding_then_removing_a_note_is_a_noop(void)
+{
+	git_note_batch *batch;
+	git_oid oid;
+
+	cl_git_pass(git_oid_fromstr(&oid, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750"));
+
+	cl_git_pass(git_note_batch_new(&batch, _repo, BATCH_REF));
+	cl_git_pass(git_note_batch_create(NULL, batch, &oid, "hello\n"));
+	cl_git_pass(git_note_batch_remove(batch, &oid));
+	cl_git_pass(git_note_batch_commit(NULL, batch, _sig, _sig));
+	git_note_batch_free(batch);
+
+	cl_assert_equal_i(0, count_notes(BATCH_REF));
+}
+
+void test_notes_notesbatch__can_commit_a_batch_again(void)
+{
+	git_note_batch *batch;
+	git_commit *first, *second;
+	git_oid first_oid, second_oid, oid;
+
+	cl_git_pass(git_note_batch_new(&batch, _repo, "refs/notes/fanout"));
+	cl_git_pass(git_oid_fromstr(&oid, "8496071c1b46c854b31185ea97743be6a8774479"));
+	cl_git_pass(git_note_batch_remove(batch, &oid));
+	cl_git_pass(git_note_batch_commit(&first_oid, batch, _sig, _sig));
+
+	/* the batch goes on from its first commit */
+	cl_git_pass(git_note_batch_create(NULL, batch, &oid, "back again\n"));
+	cl_git_pass(git_note_batch_commit(&second_oid, batch, _sig, _sig));
+	git_note_batch_free(batch);
+
+	cl_git_pass(git_commit_lookup(&first, _repo, &first_oid));
+	cl_git_pass(git_commit_lookup(&second, _repo, &second_oid));
+	cl_assert_equal_i(1, git_commit_parentcount(second));
+	cl_assert(git_oid_cmp(git_commit_parent_oid(second, 0), &first_oid) == 0);
+	git_commit_free(first);
+	git_commit_free(second);
+
+	assert_note("refs/notes/fanout", &oid, "back again\n");
+}
+
+void test_notes_notesbatch__can_add_remove_and_add_a_new_note(void)
+{
+	git_note_batch *batch;
+	git_oid oid;
+
+	target_oid(&oid, 0);
+
+	cl_git_pass(git_note_batch_new(&batch, _repo, BATCH_REF));
+	cl_git_pass(git_note_batch_create(NULL, batch, &oid, "first\n"));
+	cl_git_pass(git_note_batch_remove(batch, &oid));
+	cl_git_pass(git_note_batch_create(NULL, batch, &oid, "second\n"));
+	cl_git_pass(git_note_batch_commit(NULL, batch, _sig, _sig));
+	git_note_batch_free(batch);
+
+	assert_note(BATCH_REF, &oid, "second\n");
+	cl_assert_equal_i(1, count_notes(BATCH_REF));
+}
@@ -0,0 +1,46 @@
+#include "clar_libgit2.h"
+#include "odb.h"
+
+static git_odb *_odb;
+
+void test_odb_disksize__initialize(void)
+{
+	cl_git_pass(git_odb_open(&_odb, cl_fixture("testrepo.git/objects")));
+}
+
+void test_odb_disksize__cleanup(void)
+{
+	git_odb_free(_odb);
+}
+
+static git_off_t disk_size(const char *sha)
+{
+	git_oid id;
+	git_off_t size;
+
+	cl_git_pass(git_oid_fromstr(&id, sha));
+	cl_git_pass(git_odb_read_disk_size(&size, _odb, &id));
+
+	return size;
+}
+
+void test_odb_disksize__packed(void)
+{
+	/* a delta of 1091 bytes on a blob of 3628 */
+	cl_assert_equal_i(457, (int)disk_size("001d938dbe69b6251f4a03cf374235c72fd0a0d2"));
+	cl_assert_equal_i(109, (int)disk_size("0087a575a0655d2e53e8ba4feffcc321dcb8cbc3"));
+}
+
+void test_odb_disksize__loose(void)
+{
+	cl_assert_equal_i(26, (int)disk_size("a8233120f6ad708f843d861ce2b7228ec4e3dec6"));
+}
+
+void test_odb_disksize__missing(void)
+{
+	git_oid id;
+	git_off_t size;
+
+	cl_git_pass(git_oid_fromstr(&id, "deadbeefdeadbeefdeadbeefdeadbeefdeadbeef"));
+	cl_assert_equal_i(GIT_ENOTFOUND, git_odb_read_disk_size(&size, _odb, &id));
+}
@@ -0,0 +1,204 @@
+#include "clar_libgit2.h"
+#include "fileops.h"
+
+static git_repository *_repo;
+
+/* new.txt of master, only stored loose */
+#define NEW_TXT "a71586c1dfe8a71c6cbf6c129f404c5642ff31bd"
+#define NEW_TXT_PATH "testrepo.git/objects/a7/1586c1dfe8a71c6cbf6c129f404c5642ff31bd"
+#define OTHER_PATH "testrepo.git/objects/fa/49b077972391ad58037050f2a75f74e3671e92"
+
+void test_odb_fsck__initialize(void)
+{
+	_repo = cl_git_sandbox_init("testrepo.git");
+}
+
+void test_odb_fsck__cleanup(void)
+{
+	cl_git_sandbox_cleanup();
+}
+
+typedef struct {
+	int count;
+	git_oid id;
+	git_otype type;
+	int error;
+} problems;
+
+static int problem_cb(
+	const git_oid *id, git_otype type, int error, const char *message, void *payload)
+{
+	problems *p = payload;
+
+	cl_assert(message != NULL);
+
+	p->count++;
+	git_oid_cpy(&p->id, id);
+	p->type = type;
+	p->error = error;
+
+	return 0;
+}
+
+static void ref_tips(git_oid *out, size_t *count, const char **names)
+{
+	for (*count = 0; names[*count]; ++*count)
+		cl_git_pass(git_reference_name_to_oid(&out[*count], _repo, names[*count]));
+}
+
+static const char *all_refs[] = {
+	"refs/heads/master", "refs/heads/packed-test", "refs/heads/subtrees",
+	"refs/heads/test", "refs/tags/annotated_tag_to_blob",
+	"refs/tags/point_to_blob", "refs/tags/wrapped_tag", NULL
+};
+
+void test_odb_fsck__complete_history_passes(void)
+{
+	git_fsck_opts opts;
+	git_oid tips[8];
+	size_t count;
+
+	ref_tips(tips, &count, all_refs);
+	memset(&opts, 0, sizeof(opts));
+
+	cl_git_pass(git_repository_check_connectivity(_repo, tips, count, NULL, 0, NULL));
+
+	opts.nthreads = 4;
+	opts.flags = GIT_FSCK_BLOBS_EXIST;
+	cl_git_pass(git_repository_check_connectivity(_repo, tips, count, NULL, 0, &opts));
+}
+
+void test_odb_fsck__missing_blob_is_found(void)
+{
+	git_fsck_opts opts;
+	problems p;
+	git_oid tips[8], exclude;
+	size_t count;
+
+	cl_must_pass(p_unlink(NEW_TXT_PATH));
+	ref_tips(tips, &count, all_refs);
+
+	cl_assert_equal_i(GIT_ENOTFOUND,
+		git_repository_check_connectivity(_repo, tips, count, NULL, 0, NULL));
+
+	memset(&opts, 0, sizeof(opts));
+	memset(&p, 0, sizeof(p));
+	opts.nthreads = 4;
+	opts.flags = GIT_FSCK_BLOBS_EXIST;
+	opts.problem_cb = problem_cb;
+	opts.payload = &p;
+
+	cl_assert_equal_i(GIT_ENOTFOUND,
+		git_repository_check_connectivity(_repo, tips, count, NULL, 0, &opts));
+	cl_assert_equal_i(1, p.count);
+	cl_assert_equal_i(GIT_OBJ_BLOB, p.type);
+	cl_assert_equal_i(GIT_ENOTFOUND, p.error);
+	cl_assert(git_oid_streq(&p.id, NEW_TXT) == 0);
+
+	/* a history taken to be complete is not looked into */
+	cl_git_pass(git_reference_name_to_oid(&exclude, _repo, "refs/heads/master"));
+	cl_git_pass(git_repository_check_connectivity(_repo, tips, 1, &exclude, 1, NULL));
+}
+
+/* Write a commit of the tree `tree_id` on `parent` */
+static void write_commit(git_oid *out, const git_oid *tree_id, const git_oid *parent_id)
+{
+	git_signature *sig;
+	git_commit *parent;
+	git_tree *tree;
+
+	cl_git_pass(git_signature_new(&sig, "fsck", "fsck@example.com", 1234567890, 0));
+	cl_git_pass(git_tree_lookup(&tree, _repo, tree_id));
+	cl_git_pass(git_commit_lookup(&parent, _repo, parent_id));
+	cl_git_pass(git_commit_create_v(out, _repo, NULL, sig, sig, NULL, "fsck\n", tree, 1, parent));
+
+	git_commit_free(parent);
+	git_tree_free(tree);
+	git_signature_free(sig);
+}
+
+void test_odb_fsck__excluded_history_and_trees_are_complete(void)
+{
+	git_treebuilder *builder;
+	git_fsck_opts opts;
+	git_commit *master, *previous;
+	git_oid id, subtree, excluded, tips[2];
+
+	cl_git_pass(git_reference_name_to_oid(&id, _repo, "refs/heads/master"));
+	cl_git_pass(git_commit_lookup(&master, _repo, &id));
+	cl_git_pass(git_commit_parent(&previous, master, 0));
+
+	/* the excluded commit has new.txt in a subtree */
+	cl_git_pass(git_treebuilder_create(&builder, NULL));
+	cl_git_pass(git_oid_fromstr(&id, NEW_TXT));
+	cl_git_pass(git_treebuilder_insert(NULL, builder, "new.txt", &id, GIT_FILEMODE_BLOB));
+	cl_git_pass(git_treebuilder_write(&subtree, _repo, builder));
+	cl_git_pass(git_treebuilder_insert(NULL, builder, "dir", &subtree, GIT_FILEMODE_TREE));
+	cl_git_pass(git_treebuilder_write(&id, _repo, builder));
+	git_treebuilder_free(builder);
+	write_commit(&excluded, &id, git_commit_id(master));
+
+	/* one tip shares that subtree, the other the tree of an ancestor */
+	cl_git_pass(git_treebuilder_create(&builder, NULL));
+	cl_git_pass(git_treebuilder_insert(NULL, builder, "moved", &subtree, GIT_FILEMODE_TREE));
+	cl_git_pass(git_treebuilder_write(&id, _repo, builder));
+	git_treebuilder_free(builder);
+	write_commit(&tips[0], &id, &excluded);
+	write_commit(&tips[1], git_commit_tree_oid(previous), git_commit_id(previous));
+
+	cl_must_pass(p_unlink(NEW_TXT_PATH));
+
+	cl_assert_equal_i(GIT_ENOTFOUND,
+		git_repository_check_connectivity(_repo, tips, 2, NULL, 0, NULL));
+	cl_git_pass(git_repository_check_connectivity(_repo, tips, 2, &excluded, 1, NULL));
+
+	memset(&opts, 0, sizeof(opts));
+	opts.nthreads = 4;
+	cl_git_pass(git_repository_check_connectivity(_repo, tips, 2, &excluded, 1, &opts));
+
+	git_commit_free(previous);
+	git_commit_free(master);
+}
+
+void test_odb_fsck__verify_passes(void)
+{
+	git_odb *odb;
+	git_fsck_opts opts;
+
+	cl_git_pass(git_repository_odb(&odb, _repo));
+	cl_git_pass(git_odb_verify(odb, NULL));
+
+	memset(&opts, 0, sizeof(opts));
+	opts.nthreads = 4;
+	cl_git_pass(git_odb_verify(odb, &opts));
+
+	git_odb_free(odb);
+}
+
+void test_odb_fsck__verify_finds_corrupt_objects(void)
+{
+	git_odb *odb;
+	git_fsck_opts opts;
+	problems p;
+
+	/* new.txt now holds another blob */
+	cl_must_pass(p_unlink(NEW_TXT_PATH));
+	cl_git_pass(git_futils_cp(OTHER_PATH, NEW_TXT_PATH, 0644));
+
+	memset(&opts, 0, sizeof(opts));
+	memset(&p, 0, sizeof(p));
+	opts.problem_cb = problem_cb;
+	opts.payload = &p;
+
+	cl_git_pass(git_repository_odb(&odb, _repo));
+	cl_git_fail(git_odb_verify(odb, &opts));
+	cl_assert_equal_i(1, p.count);
+	cl_assert_equal_i(GIT_OBJ_BLOB, p.type);
+	cl_assert(git_oid_streq(&p.id, NEW_TXT) == 0);
+
+	/* blobs are not read when they only need to exist */
+	opts.flags = GIT_FSCK_BLOBS_EXIST;
+	cl_git_pass(git_odb_verify(odb, &opts));
+
+	git_odb_free(odb);
+}
@@ -0,0 +1,170 @@
+#include "clar_libgit2.h"
+#include "fileops.h"
+#include "pack.h"
+#include "git2/odb_backend.h"
+
+/* a pack whose delta chains are up to 50 deep */
+#define DEEP_PACK "testrepo.git/objects/pack/pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695"
+
+static size_t _limit;
+
+void test_pack_indexer__initialize(void)
+{
+	_limit = git_indexer__base_cache_limit;
+}
+
+void test_pack_indexer__cleanup(void)
+{
+	git_indexer__base_cache_limit = _limit;
+}
+
+static void index_deep_pack(void)
+{
+	git_indexer_stream *idx;
+	git_transfer_progress stats;
+	git_buf pack = GIT_BUF_INIT, expected = GIT_BUF_INIT, actual = GIT_BUF_INIT;
+	git_buf path = GIT_BUF_INIT;
+	char hex[GIT_OID_HEXSZ + 1];
+	size_t i;
+
+	memset(&stats, 0, sizeof(stats));
+	cl_git_pass(git_futils_readbuffer(&pack, cl_fixture(DEEP_PACK ".pack")));
+	cl_git_pass(git_futils_readbuffer(&expected, cl_fixture(DEEP_PACK ".idx")));
+
+	/* in small pieces, as they come over the network */
+	cl_git_pass(git_indexer_stream_new(&idx, ".", NULL, NULL, NULL));
+	for (i = 0; i < pack.size; i += 1000)
+		cl_git_pass(git_indexer_stream_add(
+			idx, pack.ptr + i, min(1000, pack.size - i), &stats));
+	cl_git_pass(git_indexer_stream_finalize(idx, &stats));
+	cl_assert_equal_i(stats.total_objects, stats.indexed_objects);
+
+	git_oid_tostr(hex, sizeof(hex), git_indexer_stream_hash(idx));
+	cl_git_pass(git_buf_printf(&path, "pack-%s.idx", hex));
+	git_indexer_stream_free(idx);
+
+	cl_git_pass(git_futils_readbuffer(&actual, path.ptr));
+	cl_assert_equal_i(expected.size, actual.size);
+	cl_assert(memcmp(expected.ptr, actual.ptr, expected.size) == 0);
+
+	git_buf_free(&pack);
+	git_buf_free(&expected);
+	git_buf_free(&actual);
+	git_buf_free(&path);
+}
+
+/* Index the deep pack, which writes its .rev; return its pack name */
+static void index_with_reverse_index(char *hex, git_buf *rev)
+{
+	git_indexer_stream *idx;
+	git_transfer_progress stats;
+	git_buf pack = GIT_BUF_INIT, path = GIT_BUF_INIT;
+
+	memset(&stats, 0, sizeof(stats));
+	cl_git_pass(git_futils_readbuffer(&pack, cl_fixture(DEEP_PACK ".pack")));
+
+	cl_git_pass(git_indexer_stream_new(&idx, ".", NULL, NULL, NULL));
+	cl_git_pass(git_indexer_stream_add(idx, pack.ptr, pack.size, &stats));
+	cl_git_pass(git_indexer_stream_finalize(idx, &stats));
+
+	git_oid_tostr(hex, GIT_OID_HEXSZ + 1, git_indexer_stream_hash(idx));
+	git_indexer_stream_free(idx);
+
+	cl_git_pass(git_buf_printf(&path, "pack-%s.rev", hex));
+	cl_git_pass(git_futils_readbuffer(rev, path.ptr));
+	cl_assert_equal_i(12 + 4 * stats.total_objects + 40, rev->size);
+	cl_assert(memcmp(rev->ptr, "RIDX", 4) == 0);
+
+	git_buf_free(&pack);
+	git_buf_free(&path);
+}
+
+/* Look up sizes, and so positions, through a fresh pack of `hex` */
+static void check_disk_size(const char *hex)
+{
+	git_buf path = GIT_BUF_INIT;
+	git_odb *odb;
+	git_odb_backend *backend;
+	git_oid id;
+	git_off_t size;
+
+	cl_git_pass(git_buf_printf(&path, "pack-%s.idx", hex));
+	cl_git_pass(git_odb_new(&odb));
+	cl_git_pass(git_odb_backend_one_pack(&backend, path.ptr));
+	cl_git_pass(git_odb_add_backend(odb, backend, 1));
+
+	cl_git_pass(git_oid_fromstr(&id, "001d938dbe69b6251f4a03cf374235c72fd0a0d2"));
+	cl_git_pass(git_odb_read_disk_size(&size, odb, &id));
+	cl_assert_equal_i(457, (int)size);
+
+	git_odb_free(odb);
+	git_buf_free(&path);
+}
+
+static void write_rev(const char *hex, const char *data, size_t len)
+{
+	git_buf path = GIT_BUF_INIT;
+	int fd;
+
+	cl_git_pass(git_buf_printf(&path, "pack-%s.rev", hex));
+	p_unlink(path.ptr);
+
+	cl_assert((fd = p_creat(path.ptr, 0644)) >= 0);
+	cl_git_pass(p_write(fd, data, len));
+	p_close(fd);
+
+	git_buf_free(&path);
+}
+
+void test_pack_indexer__writes_a_reverse_index(void)
+{
+	git_buf rev = GIT_BUF_INIT;
+	char hex[GIT_OID_HEXSZ + 1];
+
+	index_with_reverse_index(hex, &rev);
+
+	/* object sizes now come from the mapped file */
+	check_disk_size(hex);
+
+	git_buf_free(&rev);
+}
+
+void test_pack_indexer__ignores_a_bad_reverse_index(void)
+{
+	git_buf rev = GIT_BUF_INIT;
+	char hex[GIT_OID_HEXSZ + 1];
+	char *bad;
+
+	index_with_reverse_index(hex, &rev);
+	cl_assert((bad = git__malloc(rev.size)) != NULL);
+
+	/* cut short */
+	write_rev(hex, rev.ptr, rev.size - 10);
+	check_disk_size(hex);
+
+	/* made for another pack */
+	memcpy(bad, rev.ptr, rev.size);
+	bad[rev.size - 40] ^= 0xff;
+	write_rev(hex, bad, rev.size);
+	check_disk_size(hex);
+
+	/* pointing past the index */
+	memcpy(bad, rev.ptr, rev.size);
+	memset(bad + 12, 0xff, 4);
+	write_rev(hex, bad, rev.size);
+	check_disk_size(hex);
+
+	git__free(bad);
+	git_buf_free(&rev);
+}
+
+void test_pack_indexer__deep_delta_chains(void)
+{
+	index_deep_pack();
+}
+
+void test_pack_indexer__bases_beyond_the_cache_limit_are_inflated_again(void)
+{
+	git_indexer__base_cache_limit = 0;
+	index_deep_pack();
+}
@@ -0,0 +1,159 @@
+#include "clar_libgit2.h"
+#include "fileops.h"
+
+static git_repository *_repo;
+
+#define PACK_DIR "testrepo.git/objects/pack/"
+#define DEEP_PACK PACK_DIR "pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695"
+#define SMALL_PACK PACK_DIR "pack-d7c6adf9f61318f041845b01440d09aa7a91e1b5"
+
+/* a loose object that is reachable, and one that is not */
+#define REACHABLE_LOOSE "testrepo.git/objects/08/b041783f40edfe12bb406c9c9a8a040177c125"
+#define DANGLING_LOOSE "testrepo.git/objects/1a/443023183e3f2bfbef8ac923cd81c1018a18fd"
+
+void test_pack_repack__initialize(void)
+{
+	_repo = cl_git_sandbox_init("testrepo.git");
+}
+
+void test_pack_repack__cleanup(void)
+{
+	cl_git_sandbox_cleanup();
+}
+
+static int count_idx_cb(void *payload, git_buf *path)
+{
+	if (!git__suffixcmp(path->ptr, ".idx"))
+		(*(int *)payload)++;
+	return 0;
+}
+
+static int count_packs(void)
+{
+	git_buf path = GIT_BUF_INIT;
+	int count = 0;
+
+	cl_git_pass(git_buf_sets(&path, PACK_DIR));
+	cl_git_pass(git_path_direach(&path, count_idx_cb, &count));
+	git_buf_free(&path);
+
+	return count;
+}
+
+static void assert_exists(git_repository *repo, const char *hex, bool exists)
+{
+	git_odb *odb;
+	git_odb_object *obj;
+	git_oid id;
+
+	cl_git_pass(git_oid_fromstr(&id, hex));
+	cl_git_pass(git_repository_odb(&odb, repo));
+
+	if (exists) {
+		cl_git_pass(git_odb_read(&obj, odb, &id));
+		git_odb_object_free(obj);
+	} else
+		cl_assert(!git_odb_exists(odb, &id));
+
+	git_odb_free(odb);
+}
+
+static void assert_history_readable(git_repository *repo)
+{
+	git_revwalk *walk;
+	git_commit *commit;
+	git_tree *tree;
+	git_oid id;
+	int count = 0;
+
+	cl_git_pass(git_revwalk_new(&walk, repo));
+	cl_git_pass(git_revwalk_push_glob(walk, "heads"));
+
+	while (git_revwalk_next(&id, walk) == 0) {
+		cl_git_pass(git_commit_lookup(&commit, repo, &id));
+		cl_git_pass(git_commit_tree(&tree, commit));
+		git_tree_free(tree);
+		git_commit_free(commit);
+		count++;
+	}
+
+	cl_assert(count > 0);
+	git_revwalk_free(walk);
+}
+
+void test_pack_repack__everything_reachable_goes_to_one_pack(void)
+{
+	git_repository *repo;
+
+	cl_assert_equal_i(3, count_packs());
+	cl_git_pass(git_repository_repack(_repo, NULL));
+	cl_assert_equal_i(1, count_packs());
+
+	/* packed loose objects are pruned, the others are left alone */
+	cl_assert(!git_path_exists(REACHABLE_LOOSE));
+	cl_assert(git_path_exists(DANGLING_LOOSE));
+
+	/* the repository works on, as does a new one */
+	assert_history_readable(_repo);
+	assert_exists(_repo, "08b041783f40edfe12bb406c9c9a8a040177c125", true);
+
+	cl_git_pass(git_repository_open(&repo, "testrepo.git"));
+	assert_history_readable(repo);
+	assert_exists(repo, "08b041783f40edfe12bb406c9c9a8a040177c125", true);
+
+	/* unreachable packed objects are gone with their pack */
+	assert_exists(repo, "001d938dbe69b6251f4a03cf374235c72fd0a0d2", false);
+	git_repository_free(repo);
+}
+
+void test_pack_repack__deltas_are_found_without_reuse(void)
+{
+	git_repack_opts opts;
+
+	memset(&opts, 0, sizeof(opts));
+	opts.flags = GIT_REPACK_NO_REUSE_DELTA | GIT_REPACK_KEEP_LOOSE;
+	opts.nthreads = 1;
+
+	cl_git_pass(git_repository_repack(_repo, &opts));
+	cl_assert_equal_i(1, count_packs());
+	cl_assert(git_path_exists(REACHABLE_LOOSE));
+	assert_history_readable(_repo);
+}
+
+void test_pack_repack__kept_packs_stay(void)
+{
+	cl_git_mkfile(SMALL_PACK ".keep", "");
+
+	cl_git_pass(git_repository_repack(_repo, NULL));
+	cl_assert_equal_i(2, count_packs());
+	cl_assert(git_path_exists(SMALL_PACK ".pack"));
+	cl_assert(!git_path_exists(DEEP_PACK ".pack"));
+	assert_history_readable(_repo);
+}
+
+void test_pack_repack__geometric_leaves_large_packs_alone(void)
+{
+	git_repository *repo;
+	git_repack_opts opts;
+
+	memset(&opts, 0, sizeof(opts));
+	opts.geometric_factor = 2;
+
+	/* the two six-object packs and the loose objects are folded */
+	cl_git_pass(git_repository_repack(_repo, &opts));
+	cl_assert_equal_i(2, count_packs());
+	cl_assert(git_path_exists(DEEP_PACK ".pack"));
+	cl_assert(!git_path_exists(SMALL_PACK ".pack"));
+	cl_assert(!git_path_exists(REACHABLE_LOOSE));
+	cl_assert(!git_path_exists(DANGLING_LOOSE));
+
+	/* now in progression, so nothing to do */
+	cl_git_pass(git_repository_repack(_repo, &opts));
+	cl_assert_equal_i(2, count_packs());
+
+	cl_git_pass(git_repository_open(&repo, "testrepo.git"));
+	assert_history_readable(repo);
+	assert_exists(repo, "001d938dbe69b6251f4a03cf374235c72fd0a0d2", true);
+	assert_exists(repo, "1a443023183e3f2bfbef8ac923cd81c1018a18fd", true);
+	git_repository_free(repo);
+}
@@ -0,0 +1,179 @@
+#include "clar_libgit2.h"
+#include "fileops.h"
+#include "compress.h"
+#include "hash.h"
+#include "pack.h"
+#include "git2/odb_backend.h"
+
+/*
+ * thin.pack holds a commit, its tree and a blob stored as a delta on
+ * 215da64, a blob of testrepo.git that the pack leaves out.
+ */
+static git_odb *_odb;
+static git_buf _pack = GIT_BUF_INIT;
+static git_transfer_progress _stats;
+
+void test_pack_thin__initialize(void)
+{
+	cl_git_pass(git_odb_open(&_odb, cl_fixture("testrepo.git/objects")));
+	cl_git_pass(git_futils_readbuffer(&_pack, cl_fixture("thin.pack")));
+	memset(&_stats, 0, sizeof(_stats));
+}
+
+void test_pack_thin__cleanup(void)
+{
+	git_odb_free(_odb);
+	git_buf_free(&_pack);
+}
+
+void test_pack_thin__bases_come_from_the_odb(void)
+{
+	git_indexer_stream *idx;
+	git_odb *odb;
+	git_odb_backend *backend;
+	git_odb_object *obj;
+	git_buf path = GIT_BUF_INIT;
+	git_oid id;
+	char hex[GIT_OID_HEXSZ + 1];
+
+	cl_git_pass(git_indexer_stream_new(&idx, ".", _odb, NULL, NULL));
+	cl_git_pass(git_indexer_stream_add(idx, _pack.ptr, _pack.size, &_stats));
+	cl_git_pass(git_indexer_stream_finalize(idx, &_stats));
+
+	cl_assert_equal_i(4, _stats.total_objects);
+	cl_assert_equal_i(4, _stats.indexed_objects);
+	cl_assert_equal_i(3, _stats.received_objects);
+
+	git_oid_tostr(hex, sizeof(hex), git_indexer_stream_hash(idx));
+	cl_git_pass(git_buf_printf(&path, "pack-%s.idx", hex));
+	git_indexer_stream_free(idx);
+
+	/* the completed pack stands on its own */
+	cl_git_pass(git_odb_new(&odb));
+	cl_git_pass(git_odb_backend_one_pack(&backend, path.ptr));
+	cl_git_pass(git_odb_add_backend(odb, backend, 1));
+
+	cl_git_pass(git_oid_fromstr(&id, "23a82e3b298f7a8e828c1ccce988c39717b30978"));
+	cl_git_pass(git_odb_read(&obj, odb, &id));
+	cl_assert_equal_i(134799 + strlen("one more line\n"), git_odb_object_size(obj));
+	git_odb_object_free(obj);
+
+	cl_git_pass(git_oid_fromstr(&id, "215da649e1c68079fb03f4f9bc0f196cca9855c8"));
+	cl_assert(git_odb_exists(odb, &id));
+
+	git_odb_free(odb);
+	git_buf_free(&path);
+}
+
+void test_pack_thin__refused_without_an_odb(void)
+{
+	git_indexer_stream *idx;
+
+	cl_git_pass(git_indexer_stream_new(&idx, ".", NULL, NULL, NULL));
+	cl_git_pass(git_indexer_stream_add(idx, _pack.ptr, _pack.size, &_stats));
+	cl_git_fail(git_indexer_stream_finalize(idx, &_stats));
+	git_indexer_stream_free(idx);
+}
+
+/* Append a REF delta which copies all of its base and adds `text` */
+static void append_ref_delta(
+	git_buf *pack, const char *base_hex, size_t base_len, const char *text)
+{
+	git_buf delta = GIT_BUF_INIT;
+	unsigned char hdr[10];
+	size_t len = strlen(text);
+	git_oid base;
+	int hdr_len;
+
+	cl_assert(base_len < 0x80 && base_len + len < 0x80 && len < 0x80);
+
+	git_buf_putc(&delta, (char)base_len);
+	git_buf_putc(&delta, (char)(base_len + len));
+	/* copy from offset 0, with one byte of size */
+	git_buf_putc(&delta, (char)0x90);
+	git_buf_putc(&delta, (char)base_len);
+	/* insert the text */
+	git_buf_putc(&delta, (char)len);
+	git_buf_put(&delta, text, len);
+	cl_assert(!git_buf_oom(&delta));
+
+	hdr_len = git_packfile__object_header(hdr, (unsigned long)delta.size, GIT_OBJ_REF_DELTA);
+	cl_git_pass(git_oid_fromstr(&base, base_hex));
+
+	cl_git_pass(git_buf_put(pack, (char *)hdr, hdr_len));
+	cl_git_pass(git_buf_put(pack, (char *)base.id, GIT_OID_RAWSZ));
+	cl_git_pass(git__compress(pack, delta.ptr, delta.size));
+
+	git_buf_free(&delta);
+}
+
+void test_pack_thin__chained_deltas_on_a_missing_base(void)
+{
+	static const char header[] = { 'P', 'A', 'C', 'K', 0, 0, 0, 2, 0, 0, 0, 2 };
+	git_indexer_stream *idx;
+	git_odb *odb;
+	git_odb_backend *backend;
+	git_odb_object *obj;
+	git_buf pack = GIT_BUF_INIT, path = GIT_BUF_INIT;
+	git_oid checksum, id;
+	char hex[GIT_OID_HEXSZ + 1];
+
+	/*
+	 * fa49b07 ("new file\n") is left out; a7844e1 is a delta on it and
+	 * c114770 a delta on a7844e1.  a7844e1 sorts first, so its deltas
+	 * come up before the missing base which resolves it.
+	 */
+	cl_git_pass(git_buf_put(&pack, header, sizeof(header)));
+	append_ref_delta(&pack, "a7844e189f957f40050fab2cd5d23683f162d3ca",
+		strlen("new file\none more line\n"), "and another\n");
+	append_ref_delta(&pack, "fa49b077972391ad58037050f2a75f74e3671e92",
+		strlen("new file\n"), "one more line\n");
+	cl_git_pass(git_hash_buf(&checksum, pack.ptr, pack.size));
+	cl_git_pass(git_buf_put(&pack, (char *)checksum.id, GIT_OID_RAWSZ));
+
+	cl_git_pass(git_indexer_stream_new(&idx, ".", _odb, NULL, NULL));
+	cl_git_pass(git_indexer_stream_add(idx, pack.ptr, pack.size, &_stats));
+	cl_git_pass(git_indexer_stream_finalize(idx, &_stats));
+
+	cl_assert_equal_i(3, _stats.total_objects);
+	cl_assert_equal_i(3, _stats.indexed_objects);
+	cl_assert_equal_i(2, _stats.received_objects);
+
+	git_oid_tostr(hex, sizeof(hex), git_indexer_stream_hash(idx));
+	cl_git_pass(git_buf_printf(&path, "pack-%s.idx", hex));
+	git_indexer_stream_free(idx);
+
+	cl_git_pass(git_odb_new(&odb));
+	cl_git_pass(git_odb_backend_one_pack(&backend, path.ptr));
+	cl_git_pass(git_odb_add_backend(odb, backend, 1));
+
+	cl_git_pass(git_oid_fromstr(&id, "c1147703f0f9cccb8aec4684d6b3c7f0ea258b33"));
+	cl_git_pass(git_odb_read(&obj, odb, &id));
+	cl_assert_equal_s("new file\none more line\nand another\n", git_odb_object_data(obj));
+	git_odb_object_free(obj);
+
+	git_odb_free(odb);
+	git_buf_free(&path);
+	git_buf_free(&pack);
+}
+
+void test_pack_thin__fails_when_a_base_is_nowhere(void)
+{
+	static const char header[] = { 'P', 'A', 'C', 'K', 0, 0, 0, 2, 0, 0, 0, 1 };
+	git_indexer_stream *idx;
+	git_buf pack = GIT_BUF_INIT;
+	git_oid checksum;
+
+	cl_git_pass(git_buf_put(&pack, header, sizeof(header)));
+	append_ref_delta(&pack, "a7844e189f957f40050fab2cd5d23683f162d3ca",
+		strlen("new file\none more line\n"), "and another\n");
+	cl_git_pass(git_hash_buf(&checksum, pack.ptr, pack.size));
+	cl_git_pass(git_buf_put(&pack, (char *)checksum.id, GIT_OID_RAWSZ));
+
+	cl_git_pass(git_indexer_stream_new(&idx, ".", _odb, NULL, NULL));
+	cl_git_pass(git_indexer_stream_add(idx, pack.ptr, pack.size, &_stats));
+	cl_git_fail(git_indexer_stream_finalize(idx, &_stats));
+
+	git_indexer_stream_free(idx);
+	git_buf_free(&pack);
+}
@@ -368,3 +368,36 @@ void test_stash_save__including_untracked_without_any_untracked_file_creates_an_
 
 	assert_object_oid("stash^3^{tree}", EMPTY_TREE, GIT_OBJ_TREE);
 }
+
+void test_stash_save__can_stash_deletions_in_subdirectories(void)
+{
+	git_index *index;
+	git_oid commit_oid;
+
+	cl_git_pass(p_mkdir("stash/sub", 0777));
+	cl_git_pass(p_mkdir("stash/sub/deep", 0777));
+	cl_git_mkfile("stash/sub/deep/gone", "bye\n");
+	cl_git_mkfile("stash/sub/stays", "still here\n");	/* ae3eb5bbaa2743304e90f18f0d3e35ca0fadbe4b */
+
+	cl_git_pass(git_repository_index(&index, repo));
+	cl_git_pass(git_index_add_from_workdir(index, "sub/deep/gone"));
+	cl_git_pass(git_index_add_from_workdir(index, "sub/stays"));
+	cl_git_pass(git_index_write(index));
+	commit_staged_files(&commit_oid, index, signature);
+	git_index_free(index);
+
+	cl_git_pass(p_unlink("stash/sub/deep/gone"));
+	assert_status("sub/deep/gone", GIT_STATUS_WT_DELETED);
+
+	cl_git_pass(git_stash_save(&stash_tip_oid, repo, signature, NULL, GIT_STASH_DEFAULT));
+
+	assert_object_oid("stash:sub/deep/gone", NULL, GIT_OBJ_BLOB);
+	assert_object_oid("stash:sub/deep", NULL, GIT_OBJ_TREE);
+	assert_object_oid("stash^2:sub/deep/gone", "b023018cabc396e7692c70bbf5784a93d3f738ab", GIT_OBJ_BLOB);
+	assert_object_oid("stash:sub/stays", "ae3eb5bbaa2743304e90f18f0d3e35ca0fadbe4b", GIT_OBJ_BLOB);
+
+	assert_status("sub/deep/gone", GIT_STATUS_CURRENT);
+	assert_status("sub/stays", GIT_STATUS_CURRENT);
+	assert_status("what", GIT_STATUS_CURRENT);
+	assert_status("when", GIT_STATUS_WT_NEW);
+}
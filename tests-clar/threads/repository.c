@@ -0,0 +1,129 @@
+#include "clar_libgit2.h"
+
+#define THREADS 8
+#define ROUNDS 5
+
+static git_repository *g_repo;
+static size_t g_commits;
+
+void test_threads_repository__initialize(void)
+{
+	cl_git_sandbox_init("testrepo");
+}
+
+void test_threads_repository__cleanup(void)
+{
+	cl_git_sandbox_cleanup();
+}
+
+static size_t count_commits(git_repository *repo)
+{
+	git_revwalk *walk;
+	git_oid oid;
+	size_t count = 0;
+
+	if (git_revwalk_new(&walk, repo) < 0)
+		return 0;
+
+	if (!git_revwalk_push_head(walk))
+		while (!git_revwalk_next(&oid, walk))
+			count++;
+
+	git_revwalk_free(walk);
+	return count;
+}
+
+static void *read_repository(void *payload)
+{
+	git_odb *odb;
+	git_config *cfg;
+	git_index *index;
+	git_reference *ref;
+	git_object *obj;
+	git_strarray refs;
+	const char *value;
+	int ignored, *failed = payload;
+
+	/* the lazily loaded members race to be created */
+	if (git_repository_odb(&odb, g_repo) < 0 ||
+		git_repository_config(&cfg, g_repo) < 0 ||
+		git_repository_index(&index, g_repo) < 0)
+		goto fail;
+
+	git_odb_free(odb);
+	git_config_free(cfg);
+	git_index_free(index);
+
+	/* loose and packed references */
+	if (git_reference_lookup(&ref, g_repo, "refs/heads/master") < 0)
+		goto fail;
+	git_reference_free(ref);
+
+	if (git_reference_lookup(&ref, g_repo, "refs/heads/packed") < 0)
+		goto fail;
+	git_reference_free(ref);
+
+	if (git_reference_list(&refs, g_repo, GIT_REF_LISTALL) < 0)
+		goto fail;
+	git_strarray_free(&refs);
+
+	/* objects, loose and packed */
+	if (count_commits(g_repo) != g_commits)
+		goto fail;
+
+	if (git_revparse_single(&obj, g_repo, "packed-tag^{tree}") < 0)
+		goto fail;
+	git_object_free(obj);
+
+	/* attributes and ignores */
+	if (git_attr_get(&value, g_repo, 0, "README", "diff") < 0 ||
+		git_status_should_ignore(&ignored, g_repo, "new_file") < 0 ||
+		ignored)
+		goto fail;
+
+	return NULL;
+
+fail:
+	*failed = 1;
+	return NULL;
+}
+
+void test_threads_repository__concurrent_readers(void)
+{
+	int failed[THREADS];
+	int r, i;
+#ifdef GIT_THREADS
+	git_thread threads[THREADS];
+#endif
+
+	cl_git_pass(git_repository_open(&g_repo, "testrepo"));
+	g_commits = count_commits(g_repo);
+	cl_assert(g_commits > 0);
+	git_repository_free(g_repo);
+
+	for (r = 0; r < ROUNDS; ++r) {
+		/* start every round from a repository with nothing loaded */
+		cl_git_pass(git_repository_open(&g_repo, "testrepo"));
+		memset(failed, 0, sizeof(failed));
+
+		for (i = 0; i < THREADS; ++i) {
+#ifdef GIT_THREADS
+			cl_git_pass(git_thread_create(
+				&threads[i], NULL, read_repository, &failed[i]));
+#else
+			read_repository(&failed[i]);
+#endif
+		}
+
+#ifdef GIT_THREADS
+		for (i = 0; i < THREADS; ++i)
+			cl_git_pass(git_thread_join(threads[i], NULL));
+#endif
+
+		git_repository_free(g_repo);
+		g_repo = NULL;
+
+		for (i = 0; i < THREADS; ++i)
+			cl_assert_equal_i(0, failed[i]);
+	}
+}